@@ -11,6 +11,8 @@
 
 #define _POSIX_C_SOURCE 200809L
 
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +25,15 @@
 #include "lstate.h"
 #include "lundump.h"
 #include "lopcodes.h"
+#include "analyze.h"
+#include "ljson.h"
+
+/* -------------------------------------------------------------------------
+** Superinstructions (see luaP_fuse) are analyzed as the original
+** instructions they stand for.
+** ------------------------------------------------------------------------- */
+#define get_opcode(i)	unfusedop(GET_OPCODE(i))
+
 
 /* -------------------------------------------------------------------------
 ** Version tag burned in at compile time.
@@ -47,6 +58,8 @@
 **     RETURN_KIND_UPVALUE  = 4;
 **     RETURN_KIND_CONSTANT = 5;
 **     RETURN_KIND_MULTI    = 6;   // multiple values / vararg
+**     RETURN_KIND_MIXED    = 7;
+**     RETURN_KIND_STRING   = 8;   // concatenation or f-string
 **   }
 */
 /*
@@ -97,7 +110,8 @@ typedef enum {
   RETURN_KIND_UPVALUE  = 4,
   RETURN_KIND_CONSTANT = 5,
   RETURN_KIND_MULTI    = 6,
-  RETURN_KIND_MIXED    = 7   /* multiple return sites with different kinds */
+  RETURN_KIND_MIXED    = 7,  /* multiple return sites with different kinds */
+  RETURN_KIND_STRING   = 8   /* OP_CONCAT / OP_FSTRING result */
 } ReturnKind;
 
 /*
@@ -208,11 +222,18 @@ typedef struct {
 **     repeated ReadEntry reads           = 16;
 **   }
 */
+/* A global set to the closure of a child, resolved after the recursion. */
+typedef struct {
+  int global;  /* index into report->globals[] */
+  int child;   /* index into the Proto's p[] */
+} PendingGlobal;
+
 typedef struct {
   /* identity */
   const char *source;
   int         line_defined;
   int         last_line;
+  uint64_t    fingerprint;        /* see fingerprint_proto; not emitted */
 
   /* signature */
   int         param_count;
@@ -252,9 +273,10 @@ typedef struct {
   int        num_reads;
   int        cap_reads;
 
-  /* pending resolution: proto pointers needing function_index after recursion */
-  const Proto **pending_proto;   /* parallel to globals, indexed by global slot */
-  int           num_pending;     /* always == report->num_globals at resolution time */
+  /* pending resolution: globals needing function_index after recursion */
+  PendingGlobal *pending;
+  int            num_pending;
+  int            cap_pending;
 } FunctionInfo;
 
 /*
@@ -273,6 +295,27 @@ typedef struct {
   int         function_index;  /* -1 = not resolved */
 } GlobalEntry;
 
+/*
+** Open-addressing hash index over the names of an array of entries.
+** Slots hold entry index + 1 (0 = empty); size is a power of 2.
+*/
+typedef struct {
+  int *slots;
+  int  size;
+} NameIndex;
+
+/* Entry of the def-use table of a function (see build_defs). */
+typedef struct {
+  int def;       /* last earlier pc that wrote the register read here */
+  int newtable;  /* NEWTABLE that produced R[A] as of here, -1 if none */
+} RegDef;
+
+/* Entry of the fingerprint index of a previous report. */
+typedef struct {
+  uint64_t fp;
+  int      index;  /* into previous report's functions[] */
+} FpEntry;
+
 /*
 ** InterfaceReport — the top-level output message.
 **
@@ -282,7 +325,7 @@ typedef struct {
 **     repeated GlobalEntry  globals     = 3;
 **   }
 */
-typedef struct {
+struct InterfaceReport {
   FunctionInfo *functions;
   int           num_functions;
   int           cap_functions;
@@ -290,7 +333,16 @@ typedef struct {
   GlobalEntry  *globals;
   int           num_globals;
   int           cap_globals;
-} InterfaceReport;
+
+  /* state of an analysis in progress (see analyze_proto_incremental) */
+  uint64_t              *fingerprints;  /* of the Protos, in order */
+  const FpEntry         *previous;      /* previous report, by fingerprint */
+  int                    num_previous;
+  InterfaceReport       *prev_report;
+  NameIndex              global_index;  /* over globals[] */
+  RegDef                *defs;          /* def-use table of the current function */
+  int                    cap_defs;
+};
 
 
 /* -------------------------------------------------------------------------
@@ -305,28 +357,100 @@ static const char *str_dup(const char *s) {
   return copy;
 }
 
-/* Write s to out as a JSON string, escaping as required by RFC 8259. */
-static void json_write_string(FILE *out, const char *s) {
-  fputc('"', out);
-  if (!s) { fputc('"', out); return; }
-  for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
-    switch (*p) {
-      case '"':  fputs("\\\"", out); break;
-      case '\\': fputs("\\\\", out); break;
-      case '\b': fputs("\\b",  out); break;
-      case '\f': fputs("\\f",  out); break;
-      case '\n': fputs("\\n",  out); break;
-      case '\r': fputs("\\r",  out); break;
-      case '\t': fputs("\\t",  out); break;
-      default:
-        if (*p < 0x20)
-          fprintf(out, "\\u%04x", *p);
-        else
-          fputc(*p, out);
-        break;
+/* -------------------------------------------------------------------------
+** Output buffer
+**
+** Reports are rendered into one growable buffer. With a writer, the
+** buffer is handed over to it whenever it fills up, so a report of any
+** size streams out through a small buffer; without one, the buffer ends
+** up holding the whole report.
+** ------------------------------------------------------------------------- */
+#define RBUFFER_FLUSH 8192  /* buffered bytes before calling the writer */
+
+typedef struct {
+  unsigned char *buf;
+  size_t         len;
+  size_t         cap;
+  report_Writer  writer;   /* NULL: keep everything in buf */
+  void          *ud;
+  int            failed;   /* out of memory or write error */
+} RBuffer;
+
+static void rb_flush(RBuffer *b) {
+  if (b->writer && b->len > 0 && !b->failed) {
+    if (b->writer(b->buf, b->len, b->ud) != 0) b->failed = 1;
+    b->len = 0;
+  }
+}
+
+static int rb_reserve(RBuffer *b, size_t n) {
+  if (b->failed) return 0;
+  if (b->writer && b->len + n > RBUFFER_FLUSH) {
+    rb_flush(b);
+    if (b->failed) return 0;
+  }
+  if (b->cap - b->len < n) {
+    size_t ncap = b->cap ? b->cap : 256;
+    unsigned char *nbuf;
+    while (ncap - b->len < n) ncap *= 2;
+    nbuf = (unsigned char *)realloc(b->buf, ncap);
+    if (!nbuf) { b->failed = 1; return 0; }
+    b->buf = nbuf;
+    b->cap = ncap;
+  }
+  return 1;
+}
+
+static void rb_write(RBuffer *b, const void *p, size_t n) {
+  if (n == 0 || !rb_reserve(b, n)) return;
+  memcpy(b->buf + b->len, p, n);
+  b->len += n;
+}
+
+static void rb_putc(RBuffer *b, int c) {
+  if (!rb_reserve(b, 1)) return;
+  b->buf[b->len++] = (unsigned char)c;
+}
+
+#define rb_puts(b, s)	rb_write(b, s, strlen(s))
+
+static void rb_printf(RBuffer *b, const char *fmt, ...) {
+  va_list ap;
+  int n;
+  if (!rb_reserve(b, 64)) return;
+  va_start(ap, fmt);
+  n = vsnprintf((char *)b->buf + b->len, b->cap - b->len, fmt, ap);
+  va_end(ap);
+  if (n < 0) { b->failed = 1; return; }
+  if ((size_t)n >= b->cap - b->len) {  /* did not fit? */
+    if (!rb_reserve(b, (size_t)n + 1)) return;
+    va_start(ap, fmt);
+    vsnprintf((char *)b->buf + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+  }
+  b->len += (size_t)n;
+}
+
+/*
+** Write s to out as a JSON string, escaping as required by RFC 8259
+** (see ljson.h). Runs of characters that need no escaping are copied
+** in one go.
+*/
+static void json_write_string(RBuffer *out, const char *s) {
+  rb_putc(out, '"');
+  if (s) {
+    size_t n = strlen(s);
+    while (n > 0) {
+      size_t k = ljson_plainlen(s, n);
+      char e[6];
+      rb_write(out, s, k);
+      if (k == n) break;
+      rb_write(out, e, (size_t)ljson_escape((unsigned char)s[k], e));
+      s += k + 1;
+      n -= k + 1;
     }
   }
-  fputc('"', out);
+  rb_putc(out, '"');
 }
 
 
@@ -360,7 +484,7 @@ static int decode_array_size(const Proto *f, int pc) {
   /* k=1: real array size = EXTRAARG:C (high bits from EXTRAARG, low 8 from C) */
   if (pc + 1 < f->sizecode) {
     Instruction extra = f->code[pc + 1];
-    if (GET_OPCODE(extra) == OP_EXTRAARG)
+    if (get_opcode(extra) == OP_EXTRAARG)
       return (GETARG_Ax(extra) << 8) | c;
   }
   return c; /* fallback — shouldn't happen in well-formed bytecode */
@@ -409,11 +533,57 @@ static CallSite *push_call_site(FunctionInfo *fi) {
   return cs;
 }
 
-static void push_read(FunctionInfo *fi, const char *tbl, const char *field) {
+/* -------------------------------------------------------------------------
+** Name indexes — see NameIndex. Entries are looked up by probing from
+** their hash; callers compare the candidates themselves.
+** ------------------------------------------------------------------------- */
+#define NAME_SEED 2166136261u
+
+typedef unsigned (*EntryHash)(const void *entries, int i);
+
+static unsigned name_hash(const char *s, unsigned h) {
+  for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+static unsigned global_hash(const void *entries, int i) {
+  return name_hash(((const GlobalEntry *)entries)[i].name, NAME_SEED);
+}
+
+static unsigned read_hash(const void *entries, int i) {
+  const ReadEntry *r = &((const ReadEntry *)entries)[i];
+  return name_hash(r->field_name, name_hash(r->table_name, NAME_SEED) ^ '.');
+}
+
+/*
+** Make room for one more entry in an index over entries[0..n), keeping
+** it at most half full. Growing rehashes all entries.
+*/
+static void index_reserve(NameIndex *ix, const void *entries, int n,
+                          EntryHash hash) {
+  int size;
+  if (2 * (n + 1) <= ix->size) return;
+  size = ix->size == 0 ? 16 : ix->size * 2;
+  free(ix->slots);
+  ix->slots = (int *)calloc(size, sizeof(int));
+  ix->size  = size;
+  for (int i = 0; i < n; i++) {
+    unsigned j = hash(entries, i) & (size - 1);
+    while (ix->slots[j]) j = (j + 1) & (size - 1);
+    ix->slots[j] = i + 1;
+  }
+}
+
+static void push_read(FunctionInfo *fi, NameIndex *ix,
+                      const char *tbl, const char *field) {
   /* Deduplicate — identical table.field pairs are noise when read in a loop */
-  for (int i = 0; i < fi->num_reads; i++) {
-    if (strcmp(fi->reads[i].table_name, tbl) == 0 &&
-        strcmp(fi->reads[i].field_name, field) == 0)
+  unsigned mask, j;
+  index_reserve(ix, fi->reads, fi->num_reads, read_hash);
+  mask = ix->size - 1;
+  j = name_hash(field, name_hash(tbl, NAME_SEED) ^ '.') & mask;
+  for (; ix->slots[j]; j = (j + 1) & mask) {
+    const ReadEntry *r = &fi->reads[ix->slots[j] - 1];
+    if (strcmp(r->table_name, tbl) == 0 && strcmp(r->field_name, field) == 0)
       return;
   }
   if (fi->num_reads >= fi->cap_reads) {
@@ -423,7 +593,7 @@ static void push_read(FunctionInfo *fi, const char *tbl, const char *field) {
   }
   fi->reads[fi->num_reads].table_name = str_dup(tbl);
   fi->reads[fi->num_reads].field_name = str_dup(field);
-  fi->num_reads++;
+  ix->slots[j] = ++fi->num_reads;
 }
 
 static void push_closure(FunctionInfo *fi, int line, int nupvals) {
@@ -443,11 +613,17 @@ static void push_closure(FunctionInfo *fi, int line, int nupvals) {
 */
 static void upsert_global(InterfaceReport *report, const char *name,
                            int is_fn, int function_index) {
-  for (int i = 0; i < report->num_globals; i++) {
-    if (strcmp(report->globals[i].name, name) == 0) {
-      if (is_fn) report->globals[i].is_function = 1;
+  NameIndex *ix = &report->global_index;
+  unsigned mask, j;
+  index_reserve(ix, report->globals, report->num_globals, global_hash);
+  mask = ix->size - 1;
+  j = name_hash(name, NAME_SEED) & mask;
+  for (; ix->slots[j]; j = (j + 1) & mask) {
+    GlobalEntry *g = &report->globals[ix->slots[j] - 1];
+    if (strcmp(g->name, name) == 0) {
+      if (is_fn) g->is_function = 1;
       if (function_index >= 0)
-        report->globals[i].function_index = function_index;
+        g->function_index = function_index;
       return;
     }
   }
@@ -460,153 +636,131 @@ static void upsert_global(InterfaceReport *report, const char *name,
   report->globals[report->num_globals].name           = str_dup(name);
   report->globals[report->num_globals].is_function    = is_fn;
   report->globals[report->num_globals].function_index = function_index;
-  report->num_globals++;
+  ix->slots[j] = ++report->num_globals;
 }
 
 
 /* -------------------------------------------------------------------------
-** Backward scan: given that we're at instruction `pc` and want to know
-** what produced register `reg`, walk back up to `limit` instructions.
-** Returns 1 if a CLOSURE wrote to reg, 0 if something else did, -1 if
-** we ran out of instructions without finding a writer (indeterminate).
+** Def-use table
+**
+** The analysis asks "which instruction last wrote register r before pc?"
+** for the register an instruction reads: C of SETTABUP (the value), B of
+** GETFIELD (the table), A of everything else (CALL's callee, RETURN's
+** first value). Like the backward scans it replaces, "wrote" means any
+** instruction whose A field is r. One forward pass over the code answers
+** all of these, and also where the table in R[A] of each instruction
+** came from, skipping over the SETFIELD/SETI/SETTABLE/SETLIST that fill
+** it in without reassigning the register:
+**   NEWTABLE  r
+**   SETFIELD  r, "host", ...
+**   SETFIELD  r, "port", ...
+**   RETURN1   r
 ** ------------------------------------------------------------------------- */
-static int find_reg_source(const Proto *f, int pc, int reg) {
-  int limit = (pc - 16 < 0) ? 0 : pc - 16;
 
-  for (int i = pc - 1; i >= limit; i--) {
-    Instruction ins = f->code[i];
-    OpCode op = GET_OPCODE(ins);
-    int a = GETARG_A(ins);
-
-    if (op == OP_CLOSURE && a == reg)
+/* Instructions that reassign R[A] (other than NEWTABLE). */
+static int writes_ra(OpCode op) {
+  switch (op) {
+    case OP_MOVE:      case OP_LOADI:     case OP_LOADF:
+    case OP_LOADK:     case OP_LOADKX:    case OP_LOADFALSE:
+    case OP_LFALSESKIP: case OP_LOADTRUE: case OP_LOADNIL:
+    case OP_GETUPVAL:  case OP_GETTABUP:  case OP_GETTABLE:
+    case OP_GETI:      case OP_GETFIELD:  case OP_SELF:
+    case OP_ADDI:      case OP_ADDK:      case OP_SUBK:
+    case OP_MULK:      case OP_MODK:      case OP_POWK:
+    case OP_DIVK:      case OP_IDIVK:     case OP_BANDK:
+    case OP_BORK:      case OP_BXORK:     case OP_SHRI:  case OP_SHLI:
+    case OP_ADD:       case OP_SUB:       case OP_MUL:
+    case OP_DIV:       case OP_IDIV:      case OP_MOD:
+    case OP_POW:       case OP_BAND:      case OP_BOR:
+    case OP_BXOR:      case OP_SHL:       case OP_SHR:
+    case OP_MMBIN:     case OP_MMBINI:    case OP_MMBINK:
+    case OP_UNM:       case OP_BNOT:      case OP_NOT:
+    case OP_LEN:       case OP_CONCAT:    case OP_FSTRING:
+    case OP_CALL:      case OP_TAILCALL:
+    case OP_CLOSURE:   case OP_VARARG:
       return 1;
-
-    /* Does this instruction write to reg? If so, it's not a closure. */
-    switch (op) {
-      /* All iABC / iABx / iAsBx ops that write R[A]: */
-      case OP_MOVE:      case OP_LOADI:     case OP_LOADF:
-      case OP_LOADK:     case OP_LOADKX:    case OP_LOADFALSE:
-      case OP_LFALSESKIP: case OP_LOADTRUE: case OP_LOADNIL:
-      case OP_GETUPVAL:  case OP_GETTABUP:  case OP_GETTABLE:
-      case OP_GETI:      case OP_GETFIELD:  case OP_NEWTABLE:
-      case OP_SELF:
-      case OP_ADDI:      case OP_ADDK:      case OP_SUBK:
-      case OP_MULK:      case OP_MODK:      case OP_POWK:
-      case OP_DIVK:      case OP_IDIVK:     case OP_BANDK:
-      case OP_BORK:      case OP_BXORK:     case OP_SHRI:
-      case OP_SHLI:
-      case OP_ADD:       case OP_SUB:       case OP_MUL:
-      case OP_DIV:       case OP_IDIV:      case OP_MOD:
-      case OP_POW:       case OP_BAND:      case OP_BOR:
-      case OP_BXOR:      case OP_SHL:       case OP_SHR:
-      case OP_MMBIN:     case OP_MMBINI:    case OP_MMBINK:
-      case OP_UNM:       case OP_BNOT:      case OP_NOT:
-      case OP_LEN:       case OP_CONCAT:
-      case OP_CALL:      case OP_TAILCALL:
-      case OP_VARARG:
-        if (a == reg) return 0;
-        break;
-      default:
-        break;
-    }
+    default:
+      return 0;
   }
-  return -1; /* indeterminate */
 }
 
-
-/* -------------------------------------------------------------------------
-** Walk backwards from pc to find what originally produced register reg.
-** Unlike find_reg_source (which stops at any writer), this one is
-** specifically looking for OP_NEWTABLE and skips over instructions that
-** read *from* reg without overwriting it (e.g. SETFIELD, SETI, SETLIST
-** all take a table register in A but don't reassign it).
-** Returns the pc of the NEWTABLE if found, -1 otherwise.
-** ------------------------------------------------------------------------- */
-static int find_newtable_for_reg(const Proto *f, int pc, int reg) {
-  for (int i = pc - 1; i >= 0; i--) {
-    Instruction ins = f->code[i];
-    OpCode op = GET_OPCODE(ins);
+/* Fill report->defs for f (one entry per instruction). */
+static const RegDef *build_defs(const Proto *f, InterfaceReport *report) {
+  int last[MAXARG_A + 1];  /* last pc with A == r, for each register r */
+  RegDef *du;
+  if (f->sizecode > report->cap_defs) {
+    free(report->defs);
+    report->defs = (RegDef *)malloc(f->sizecode * sizeof(RegDef));
+    report->cap_defs = f->sizecode;
+  }
+  du = report->defs;
+  for (int r = 0; r <= MAXARG_A; r++) last[r] = -1;
+  for (int pc = 0; pc < f->sizecode; pc++) {
+    Instruction ins = f->code[pc];
+    OpCode op = get_opcode(ins);
     int a = GETARG_A(ins);
+    int r = (op == OP_SETTABUP) ? GETARG_C(ins)
+          : (op == OP_GETFIELD) ? GETARG_B(ins) : a;
+    int prior = last[a];
+    du[pc].def = last[r];
+    if (op == OP_NEWTABLE)
+      du[pc].newtable = pc;
+    else if (writes_ra(op) || prior < 0)
+      du[pc].newtable = -1;
+    else  /* does not reassign R[A]: same table as before */
+      du[pc].newtable = du[prior].newtable;
+    last[a] = pc;
+  }
+  return du;
+}
 
-    if (op == OP_NEWTABLE && a == reg)
-      return i;
-
-    /* These ops use reg as a table to write into but do NOT reassign it —
-    ** skip over them so we keep looking for the NEWTABLE. */
-    if ((op == OP_SETFIELD || op == OP_SETTABLE ||
-         op == OP_SETI     || op == OP_SETLIST) && a == reg)
-      continue;
+/*
+** The instruction that last wrote the register read at pc, if it is at
+** most `window` instructions back; -1 otherwise.
+*/
+static int reg_def(const RegDef *du, int pc, int window) {
+  int d = du[pc].def;
+  return (d >= 0 && d >= pc - window) ? d : -1;
+}
 
-    /* Any other instruction that writes to reg stops the search — the
-    ** register has been reassigned and the NEWTABLE is unrelated. */
-    switch (op) {
-      case OP_MOVE:      case OP_LOADI:     case OP_LOADF:
-      case OP_LOADK:     case OP_LOADKX:    case OP_LOADFALSE:
-      case OP_LFALSESKIP: case OP_LOADTRUE: case OP_LOADNIL:
-      case OP_GETUPVAL:  case OP_GETTABUP:  case OP_GETTABLE:
-      case OP_GETI:      case OP_GETFIELD:  case OP_SELF:
-      case OP_ADDI:      case OP_ADDK:      case OP_SUBK:
-      case OP_MULK:      case OP_MODK:      case OP_POWK:
-      case OP_DIVK:      case OP_IDIVK:     case OP_BANDK:
-      case OP_BORK:      case OP_BXORK:     case OP_SHRI:  case OP_SHLI:
-      case OP_ADD:       case OP_SUB:       case OP_MUL:
-      case OP_DIV:       case OP_IDIV:      case OP_MOD:
-      case OP_POW:       case OP_BAND:      case OP_BOR:
-      case OP_BXOR:      case OP_SHL:       case OP_SHR:
-      case OP_MMBIN:     case OP_MMBINI:    case OP_MMBINK:
-      case OP_UNM:       case OP_BNOT:      case OP_NOT:
-      case OP_LEN:       case OP_CONCAT:
-      case OP_CALL:      case OP_TAILCALL:
-      case OP_CLOSURE:   case OP_VARARG:
-        if (a == reg) return -1;
-        break;
-      default:
-        break;
-    }
-  }
-  return -1;
+/*
+** The NEWTABLE that produced the register read at pc, -1 if it was
+** reassigned since (or never came from a NEWTABLE).
+*/
+static int find_newtable_for_reg(const RegDef *du, int pc) {
+  int d = du[pc].def;
+  return d >= 0 ? du[d].newtable : -1;
 }
 
 /* -------------------------------------------------------------------------
 ** Classify what a return instruction returns.
 ** ------------------------------------------------------------------------- */
-static ReturnKind classify_return(const Proto *f, int pc,
-                                  int last_newtable_pc) {
+static ReturnKind classify_return(const Proto *f, const RegDef *du, int pc) {
   Instruction ins = f->code[pc];
-  OpCode op = GET_OPCODE(ins);
+  OpCode op = get_opcode(ins);
 
   if (op == OP_RETURN0)
     return RETURN_KIND_VOID;
 
   if (op == OP_RETURN1) {
-    int reg = GETARG_A(ins);
-
-    /* Walk back looking for the NEWTABLE that produced this register,
-    ** skipping over SETFIELD/SETI/SETTABLE/SETLIST which mutate the table
-    ** without reassigning the register. This correctly handles patterns like:
-    **   NEWTABLE  r
-    **   SETFIELD  r, "host", ...
-    **   SETFIELD  r, "port", ...
-    **   RETURN1   r
-    */
-    if (find_newtable_for_reg(f, pc, reg) >= 0)
+    int i;
+    /* Look for the NEWTABLE that produced this register (see build_defs) */
+    if (find_newtable_for_reg(du, pc) >= 0)
       return RETURN_KIND_TABLE;
 
-    /* Walk back for other value sources */
-    int limit = (pc - 24 < 0) ? 0 : pc - 24;
-    for (int i = pc - 1; i >= limit; i--) {
-      Instruction prev = f->code[i];
-      OpCode pop = GET_OPCODE(prev);
-      if (GETARG_A(prev) != reg) continue;
+    /* Otherwise classify by its last writer, if that is close enough */
+    i = reg_def(du, pc, 24);
+    if (i >= 0) {
+      OpCode pop = get_opcode(f->code[i]);
       if (pop == OP_CALL || pop == OP_TAILCALL) return RETURN_KIND_CALL;
       if (pop == OP_GETUPVAL)                   return RETURN_KIND_UPVALUE;
       if (pop == OP_GETTABUP || pop == OP_GETTABLE ||
           pop == OP_GETFIELD || pop == OP_GETI)  return RETURN_KIND_UPVALUE;
       if (pop == OP_CLOSURE)                    return RETURN_KIND_UNKNOWN;
+      if (pop == OP_CONCAT || pop == OP_FSTRING) return RETURN_KIND_STRING;
       if (pop == OP_LOADK   || pop == OP_LOADI  ||
           pop == OP_LOADF   || pop == OP_LOADTRUE ||
           pop == OP_LOADFALSE)                  return RETURN_KIND_CONSTANT;
-      break;
     }
     return RETURN_KIND_UNKNOWN;
   }
@@ -619,8 +773,7 @@ static ReturnKind classify_return(const Proto *f, int pc,
 
     if (b == 2) {
       /* Single value — same register-tracing logic as RETURN1 */
-      int reg = GETARG_A(ins);
-      if (find_newtable_for_reg(f, pc, reg) >= 0)
+      if (find_newtable_for_reg(du, pc) >= 0)
         return RETURN_KIND_TABLE;
     }
     if (b > 2) return RETURN_KIND_MULTI;
@@ -632,7 +785,7 @@ static ReturnKind classify_return(const Proto *f, int pc,
 
 /* -------------------------------------------------------------------------
 ** Resolve the callee name for a CALL/TAILCALL at `call_pc`.
-** The callee is in R[callee_reg].  Walk back to find what loaded it.
+** The callee is in R[A]; its writer comes from the def-use table.
 **
 ** Sets *kind_out and writes a heap-allocated name string into *name_out
 ** (caller owns it).  name_out may be set to NULL for CALL_KIND_UNKNOWN.
@@ -644,109 +797,310 @@ static ReturnKind classify_return(const Proto *f, int pc,
 **   SELF      -, K[C]=string      → CALL_KIND_METHOD,  name = ?:K[C]
 **   MOVE / other                  → CALL_KIND_LOCAL,   name = NULL
 ** ------------------------------------------------------------------------- */
-static void resolve_callee(const Proto *f, int call_pc, int callee_reg,
+static void resolve_callee(const Proto *f, const RegDef *du, int call_pc,
                            CallKind *kind_out, const char **name_out) {
   *kind_out = CALL_KIND_UNKNOWN;
   *name_out = NULL;
 
-  int limit = (call_pc - 32 < 0) ? 0 : call_pc - 32;
+  int i = reg_def(du, call_pc, 32);
+  if (i < 0) return;
+
+  Instruction ins = f->code[i];
+  OpCode op = get_opcode(ins);
+
+  if (op == OP_GETTABUP) {
+    int upv     = GETARG_B(ins);
+    int key_idx = GETARG_C(ins);
+    if (key_idx >= f->sizek) return;
+    TValue *kv = &f->k[key_idx];
+    if (!ttisstring(kv)) return;
+    const char *field = getstr(tsvalue(kv));
+
+    if (upv == 0) {
+      /* Direct _ENV access → global call */
+      *kind_out = CALL_KIND_GLOBAL;
+      *name_out = str_dup(field);
+    } else {
+      /* Named upvalue → "upvname.field" */
+      const char *upvname = "?";
+      if (upv < f->sizeupvalues && f->upvalues[upv].name)
+        upvname = getstr(f->upvalues[upv].name);
+      size_t len = strlen(upvname) + 1 + strlen(field) + 1;
+      char *buf = (char *)malloc(len);
+      snprintf(buf, len, "%s.%s", upvname, field);
+      *kind_out = CALL_KIND_FIELD;
+      *name_out = buf;
+    }
+    return;
+  }
 
-  for (int i = call_pc - 1; i >= limit; i--) {
-    Instruction ins = f->code[i];
-    OpCode op = GET_OPCODE(ins);
-    int a = GETARG_A(ins);
+  if (op == OP_GETFIELD) {
+    int key_idx = GETARG_C(ins);
+    if (key_idx >= f->sizek) return;
+    TValue *kv = &f->k[key_idx];
+    if (!ttisstring(kv)) return;
+    const char *field = getstr(tsvalue(kv));
+
+    /* Try to identify the source register (B) as a global name: see
+    ** whether it came from a GETTABUP shortly before */
+    const char *src_name = "?";
+    int j = reg_def(du, i, 16);
+    if (j >= 0 && get_opcode(f->code[j]) == OP_GETTABUP) {
+      int cidx = GETARG_C(f->code[j]);
+      if (cidx < f->sizek && ttisstring(&f->k[cidx]))
+        src_name = getstr(tsvalue(&f->k[cidx]));
+    }
 
-    if (a != callee_reg) continue;
+    size_t len = strlen(src_name) + 1 + strlen(field) + 1;
+    char *buf = (char *)malloc(len);
+    snprintf(buf, len, "%s.%s", src_name, field);
+    *kind_out = CALL_KIND_FIELD;
+    *name_out = buf;
+    return;
+  }
 
-    if (op == OP_GETTABUP) {
-      int upv     = GETARG_B(ins);
-      int key_idx = GETARG_C(ins);
-      if (key_idx >= f->sizek) break;
-      TValue *kv = &f->k[key_idx];
-      if (!ttisstring(kv)) break;
-      const char *field = getstr(tsvalue(kv));
+  if (op == OP_SELF) {
+    int key_idx = GETARG_C(ins);
+    if (key_idx >= f->sizek) return;
+    TValue *kv = &f->k[key_idx];
+    if (!ttisstring(kv)) return;
+    *kind_out = CALL_KIND_METHOD;
+    *name_out = str_dup(getstr(tsvalue(kv)));
+    return;
+  }
 
-      if (upv == 0) {
-        /* Direct _ENV access → global call */
-        *kind_out = CALL_KIND_GLOBAL;
-        *name_out = str_dup(field);
-      } else {
-        /* Named upvalue → "upvname.field" */
-        const char *upvname = "?";
-        if (upv < f->sizeupvalues && f->upvalues[upv].name)
-          upvname = getstr(f->upvalues[upv].name);
-        size_t len = strlen(upvname) + 1 + strlen(field) + 1;
-        char *buf = (char *)malloc(len);
-        snprintf(buf, len, "%s.%s", upvname, field);
-        *kind_out = CALL_KIND_FIELD;
-        *name_out = buf;
-      }
-      return;
-    }
+  if (op == OP_MOVE || op == OP_GETUPVAL || op == OP_CLOSURE)
+    *kind_out = CALL_KIND_LOCAL;
 
-    if (op == OP_GETFIELD) {
-      int key_idx = GETARG_C(ins);
-      if (key_idx >= f->sizek) break;
-      TValue *kv = &f->k[key_idx];
-      if (!ttisstring(kv)) break;
-      const char *field = getstr(tsvalue(kv));
-
-      /* Try to identify the source register (B) as an upvalue name */
-      int src_reg = GETARG_B(ins);
-      const char *src_name = "?";
-      /* Walk back a little further to see if src_reg came from GETTABUP */
-      int limit2 = (i - 16 < 0) ? 0 : i - 16;
-      for (int j = i - 1; j >= limit2; j--) {
-        Instruction prev = f->code[j];
-        if (GET_OPCODE(prev) == OP_GETTABUP && GETARG_A(prev) == src_reg) {
-          int cidx = GETARG_C(prev);
-          if (cidx < f->sizek && ttisstring(&f->k[cidx]))
-            src_name = getstr(tsvalue(&f->k[cidx]));
-          break;
-        }
-        if (GETARG_A(prev) == src_reg) break; /* overwritten, give up */
-      }
+  /* Any other writer — unknown */
+}
 
-      size_t len = strlen(src_name) + 1 + strlen(field) + 1;
-      char *buf = (char *)malloc(len);
-      snprintf(buf, len, "%s.%s", src_name, field);
-      *kind_out = CALL_KIND_FIELD;
-      *name_out = buf;
-      return;
+/* -------------------------------------------------------------------------
+** Record a global set by the SETTABUP at `pc`. Globals are collected in the
+** report as functions are visited, so this also runs for functions whose
+** analysis is reused from a previous report.
+** ------------------------------------------------------------------------- */
+static void record_global(const Proto *f, const RegDef *du, FunctionInfo *fi,
+                          InterfaceReport *report, int pc) {
+  Instruction ins = f->code[pc];
+  /* UpValue[A][K[B]] := RK(C)
+  ** We only care about _ENV (upvalue 0) assignments at the top level.
+  ** When k==1, C is a constant index (not a register) — the value is
+  ** a literal, never a closure. */
+  if (GETARG_A(ins) != 0) return;
+
+  int key_idx = GETARG_B(ins);
+  int k_flag  = GETARG_k(ins);
+
+  if (key_idx >= f->sizek) return;
+  TValue *kv = &f->k[key_idx];
+  if (!ttisstring(kv)) return;
+
+  const char *name = getstr(tsvalue(kv));
+
+  int is_fn = 0;
+  int child = -1;
+
+  if (!k_flag) {
+    int j = reg_def(du, pc, 16);
+    if (j >= 0 && get_opcode(f->code[j]) == OP_CLOSURE) {
+      is_fn = 1;
+      if (GETARG_Bx(f->code[j]) < f->sizep)
+        child = GETARG_Bx(f->code[j]);
     }
+  }
 
-    if (op == OP_SELF) {
-      int key_idx = GETARG_C(ins);
-      if (key_idx >= f->sizek) break;
-      TValue *kv = &f->k[key_idx];
-      if (!ttisstring(kv)) break;
-      *kind_out = CALL_KIND_METHOD;
-      *name_out = str_dup(getstr(tsvalue(kv)));
-      return;
+  /* Record the global now; function_index resolved after recursion */
+  int global_slot = report->num_globals;
+  upsert_global(report, name, is_fn, -1);
+
+  /* If this was a new entry (not a duplicate) and we know the child,
+  ** stash it for post-recursion resolution */
+  if (child >= 0 && report->num_globals > global_slot) {
+    if (fi->num_pending >= fi->cap_pending) {
+      int nc = fi->cap_pending == 0 ? 4 : fi->cap_pending * 2;
+      fi->pending = (PendingGlobal *)realloc(fi->pending,
+                                             nc * sizeof(PendingGlobal));
+      fi->cap_pending = nc;
     }
+    fi->pending[fi->num_pending].global = global_slot;
+    fi->pending[fi->num_pending].child  = child;
+    fi->num_pending++;
+  }
+}
 
-    if (op == OP_MOVE || op == OP_GETUPVAL) {
-      *kind_out = CALL_KIND_LOCAL;
-      return;
-    }
+/* -------------------------------------------------------------------------
+** Fingerprints
+**
+** A function's fingerprint hashes everything its FunctionInfo is built
+** from — code, constants, names, and line information relative to its
+** first line — plus the fingerprints and relative positions of its
+** children. Functions with equal fingerprints get equal FunctionInfo,
+** except that all line numbers are shifted by the difference between
+** their first lines. This lets an analysis reuse the results of a
+** previous report for functions that did not change (even if they moved).
+** ------------------------------------------------------------------------- */
+#define FP_SEED   UINT64_C(0xcbf29ce484222325)
+#define FP_MULT   UINT64_C(0x9e3779b97f4a7c15)
 
-    if (op == OP_CLOSURE) {
-      *kind_out = CALL_KIND_LOCAL;
-      return;
+static uint64_t fp_mix(uint64_t h, uint64_t w) {
+  h = (h ^ w) * FP_MULT;
+  return h ^ (h >> 32);
+}
+
+/* Hash a block eight bytes at a time; the tail goes with the length. */
+static uint64_t fp_bytes(uint64_t h, const void *p, size_t n) {
+  const unsigned char *b = (const unsigned char *)p;
+  uint64_t w;
+  for (; n >= 8; b += 8, n -= 8) {
+    memcpy(&w, b, 8);
+    h = fp_mix(h, w);
+  }
+  w = (uint64_t)n << 56;
+  for (size_t i = 0; i < n; i++)
+    w |= (uint64_t)b[i] << (8 * i);
+  return fp_mix(h, w);
+}
+
+static uint64_t fp_int(uint64_t h, lua_Integer v) {
+  return fp_mix(h, (uint64_t)v);
+}
+
+static uint64_t fp_str(uint64_t h, const TString *s) {
+  if (!s) return fp_int(h, -1);
+  h = fp_int(h, (lua_Integer)tsslen(s));
+  return fp_bytes(h, getstr(s), tsslen(s));
+}
+
+static int count_protos(const Proto *f) {
+  int n = 1;
+  for (int i = 0; i < f->sizep; i++)
+    n += count_protos(f->p[i]);
+  return n;
+}
+
+/*
+** Fingerprint f and its nested functions, storing them in the order
+** they get in report->functions (depth first), starting at fps[*n].
+*/
+static uint64_t fingerprint_proto(const Proto *f, uint64_t *fps, int *n) {
+  int my = (*n)++;
+  int line = f->linedefined;
+  uint64_t h = FP_SEED;
+  h = fp_str(h, f->source);
+  h = fp_int(h, f->numparams);
+  h = fp_int(h, f->is_vararg);
+  h = fp_int(h, f->lastlinedefined - line);
+  for (int i = 0; i < f->numparams; i++)
+    h = fp_str(h, (i < f->sizelocvars) ? f->locvars[i].varname : NULL);
+  h = fp_int(h, f->sizeupvalues);
+  for (int i = 0; i < f->sizeupvalues; i++)
+    h = fp_str(h, f->upvalues ? f->upvalues[i].name : NULL);
+  h = fp_int(h, f->sizecode);
+  h = fp_bytes(h, f->code, f->sizecode * sizeof(Instruction));
+  h = fp_int(h, f->lineinfo ? f->sizelineinfo : -1);
+  if (f->lineinfo)
+    h = fp_bytes(h, f->lineinfo, f->sizelineinfo);
+  h = fp_int(h, f->abslineinfo ? f->sizeabslineinfo : -1);
+  for (int i = 0; f->abslineinfo && i < f->sizeabslineinfo; i++) {
+    h = fp_int(h, f->abslineinfo[i].pc);
+    h = fp_int(h, f->abslineinfo[i].line - line);
+  }
+  h = fp_int(h, f->sizek);
+  for (int i = 0; i < f->sizek; i++) {
+    const TValue *tv = &f->k[i];
+    h = fp_int(h, ttypetag(tv));
+    if (ttisstring(tv))
+      h = fp_str(h, tsvalue(tv));
+    else if (ttisinteger(tv))
+      h = fp_int(h, ivalue(tv));
+    else if (ttisfloat(tv)) {
+      lua_Number d = fltvalue(tv);
+      h = fp_bytes(h, &d, sizeof(d));
     }
+  }
+  h = fp_int(h, f->sizep);
+  for (int i = 0; i < f->sizep; i++) {
+    uint64_t child = fingerprint_proto(f->p[i], fps, n);
+    h = fp_mix(h, child);
+    h = fp_int(h, f->p[i]->linedefined - line);
+  }
+  fps[my] = h;
+  return h;
+}
 
-    /* Any other writer — unknown */
-    break;
+static int cmp_fp_entry(const void *a, const void *b) {
+  uint64_t x = ((const FpEntry *)a)->fp, y = ((const FpEntry *)b)->fp;
+  return (x > y) - (x < y);
+}
+
+/*
+** Find a function of the previous report with fingerprint fp whose
+** results were not moved yet (moved entries are zeroed).
+*/
+static FunctionInfo *find_previous(const InterfaceReport *report,
+                                   uint64_t fp) {
+  int lo = 0, hi = report->num_previous - 1;
+  if (!report->fingerprints) return NULL;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    uint64_t x = report->previous[mid].fp;
+    if (x == fp) {
+      FunctionInfo *old =
+        &report->prev_report->functions[report->previous[mid].index];
+      return old->source ? old : NULL;
+    }
+    else if (x < fp) lo = mid + 1;
+    else hi = mid - 1;
   }
+  return NULL;
+}
+
+/*
+** Fill fi with the results of old, the FunctionInfo of an unchanged
+** function in the previous report, moving them over and shifting their
+** lines to where f is now. Children are filled in by the recursion, as
+** usual, and globals are recorded again (that only needs SETTABUP).
+*/
+static void reuse_function(const Proto *f, FunctionInfo *fi,
+                           FunctionInfo *old, InterfaceReport *report) {
+  int delta = f->linedefined - old->line_defined;
+  FunctionInfo moved = *old;
+  const RegDef *du;
+
+  memset(old, 0, sizeof(FunctionInfo));  /* results now belong to fi */
+  *fi = moved;
+  fi->line_defined = f->linedefined;
+  fi->last_line += delta;
+  fi->fingerprint = moved.fingerprint;
+  fi->child_proto_indices = NULL;
+  fi->num_children = fi->cap_children = 0;
+  free(moved.child_proto_indices);
+  for (int i = 0; i < fi->num_closures; i++)
+    fi->closures[i].line_defined += delta;
+  for (int i = 0; i < fi->num_call_sites; i++)
+    if (fi->call_sites[i].line != 0)  /* 0: no line information */
+      fi->call_sites[i].line += delta;
+
+  du = build_defs(f, report);
+  for (int pc = 0; pc < f->sizecode; pc++)
+    if (get_opcode(f->code[pc]) == OP_SETTABUP)
+      record_global(f, du, fi, report, pc);
 }
 
+
 /* -------------------------------------------------------------------------
 ** Core analysis pass over a single Proto
 ** ------------------------------------------------------------------------- */
 static void analyze_proto_recursive(const Proto *f, InterfaceReport *report);
 
-static void analyze_function(const Proto *f, InterfaceReport *report) {
-  FunctionInfo *fi = push_function(report);
+static void scan_function(const Proto *f, FunctionInfo *fi,
+                          InterfaceReport *report) {
+  const RegDef *du;
+  NameIndex reads_index = {NULL, 0};
+  int line = f->linedefined;  /* of pc, when there is no abslineinfo */
+  int last_newtable_arr = 0;
+  int last_newtable_hsh = 0;
 
   /* --- Identity --------------------------------------------------------- */
   fi->source       = f->source ? str_dup(getstr(f->source)) : str_dup("?");
@@ -810,19 +1164,18 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
   }
 
   /* --- Bytecode scan ---------------------------------------------------- */
-  int last_newtable_pc  = -1;
-  int last_newtable_arr = 0;
-  int last_newtable_hsh = 0;
+  du = build_defs(f, report);
   fi->return_kind = RETURN_KIND_UNKNOWN;
 
   for (int pc = 0; pc < f->sizecode; pc++) {
     Instruction ins = f->code[pc];
-    OpCode op = GET_OPCODE(ins);
+    OpCode op = get_opcode(ins);
+    if (f->lineinfo)
+      line += (signed char)f->lineinfo[pc];
 
     switch (op) {
 
       case OP_NEWTABLE: {
-        last_newtable_pc  = pc;
         last_newtable_arr = decode_array_size(f, pc);
         last_newtable_hsh = decode_hash_size(GETARG_B(ins));
         break;
@@ -831,7 +1184,7 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
       case OP_RETURN:
       case OP_RETURN0:
       case OP_RETURN1: {
-        ReturnKind kind = classify_return(f, pc, last_newtable_pc);
+        ReturnKind kind = classify_return(f, du, pc);
 
         /* Update return_kind:
         **   - UNKNOWN / VOID are weak: any stronger kind overwrites them.
@@ -868,8 +1221,7 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
         if (kind == RETURN_KIND_TABLE) {
           /* Use the specific NEWTABLE for the returned register so sizes
           ** are correct even when multiple tables exist in the function. */
-          int ret_reg = GETARG_A(ins);
-          int nt_pc   = find_newtable_for_reg(f, pc, ret_reg);
+          int nt_pc = find_newtable_for_reg(du, pc);
           if (nt_pc >= 0) {
             Instruction nt = f->code[nt_pc];
             fi->table_info.array_size = decode_array_size(f, nt_pc);
@@ -899,56 +1251,7 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
       }
 
       case OP_SETTABUP: {
-        /* UpValue[A][K[B]] := RK(C)
-        ** We only care about _ENV (upvalue 0) assignments at the top level.
-        ** When k==1, C is a constant index (not a register) — the value is
-        ** a literal, never a closure. */
-        if (GETARG_A(ins) != 0) break;
-
-        int key_idx = GETARG_B(ins);
-        int val_reg = GETARG_C(ins);
-        int k_flag  = GETARG_k(ins);
-
-        if (key_idx >= f->sizek) break;
-        TValue *kv = &f->k[key_idx];
-        if (!ttisstring(kv)) break;
-
-        const char *name = getstr(tsvalue(kv));
-
-        int         is_fn      = 0;
-        const Proto *child_proto = NULL;
-
-        if (!k_flag) {
-          int limit2 = (pc - 16 < 0) ? 0 : pc - 16;
-          for (int j = pc - 1; j >= limit2; j--) {
-            Instruction prev = f->code[j];
-            if (GET_OPCODE(prev) == OP_CLOSURE && GETARG_A(prev) == val_reg) {
-              is_fn = 1;
-              int bx = GETARG_Bx(prev);
-              if (bx < f->sizep)
-                child_proto = f->p[bx];
-              break;
-            }
-            if (GETARG_A(prev) == val_reg) break;
-          }
-        }
-
-        /* Record the global now; function_index resolved after recursion */
-        int global_slot = report->num_globals;
-        upsert_global(report, name, is_fn, -1);
-
-        /* If this was a new entry (not a duplicate) and we have a proto
-        ** pointer, stash it for post-recursion resolution */
-        if (child_proto && report->num_globals > global_slot) {
-          /* grow pending_proto to match globals array */
-          fi->pending_proto = (const Proto **)realloc(fi->pending_proto,
-                                report->num_globals * sizeof(const Proto *));
-          /* fill any gap for entries added without a proto */
-          for (int g = fi->num_pending; g < global_slot; g++)
-            fi->pending_proto[g] = NULL;
-          fi->pending_proto[global_slot] = child_proto;
-          fi->num_pending = report->num_globals;
-        }
+        record_global(f, du, fi, report, pc);
         break;
       }
 
@@ -970,7 +1273,7 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
             const char *tbl   = "_ENV";
             if (upv != 0 && upv < f->sizeupvalues && f->upvalues[upv].name)
               tbl = getstr(f->upvalues[upv].name);
-            push_read(fi, tbl, field);
+            push_read(fi, &reads_index, tbl, field);
           }
         }
         break;
@@ -983,7 +1286,7 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
         if (key_idx < f->sizek) {
           TValue *kv = &f->k[key_idx];
           if (ttisstring(kv)) {
-            push_read(fi, "?", getstr(tsvalue(kv)));
+            push_read(fi, &reads_index, "?", getstr(tsvalue(kv)));
           }
         }
         break;
@@ -991,7 +1294,6 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
 
       case OP_CALL:
       case OP_TAILCALL: {
-        int callee_reg = GETARG_A(ins);
         int b          = GETARG_B(ins);
         int is_tail    = (op == OP_TAILCALL) ? 1 : 0;
 
@@ -1017,22 +1319,22 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
             }
           }
           cs->line = best;
-        } else if (f->lineinfo && pc < f->sizecode) {
+        } else if (f->lineinfo) {
           /* Compact delta encoding: lineinfo[i] is a signed byte offset
-          ** from the previous line. Walk from the start. */
-          int line = f->linedefined;
-          for (int k = 0; k <= pc && k < f->sizecode; k++)
-            line += (signed char)f->lineinfo[k];
+          ** from the previous line, summed up by the loop. */
           cs->line = line;
         }
 
-        resolve_callee(f, pc, callee_reg, &cs->kind, &cs->callee);
+        resolve_callee(f, du, pc, &cs->kind, &cs->callee);
         break;
       }
 
-      /* OP_2Q (Diluvium null-coalescing): writes R[A], treat like a normal
-      ** register-producing instruction. No special analysis needed here. */
+      /* OP_FSTRING (Diluvium f-strings): writes R[A], treat like normal
+      ** register-producing instructions. Returned f-strings are
+      ** classified in classify_return(). OP_2Q (Diluvium null-coalescing)
+      ** is a test followed by a jump, like OP_TEST. */
       case OP_2Q:
+      case OP_FSTRING:
         break;
 
       default:
@@ -1040,14 +1342,28 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
     }
   }
 
+  free(reads_index.slots);
+
   /* If return_kind is still UNKNOWN and the function has no code that
   ** produces a value, call it VOID. */
   if (fi->return_kind == RETURN_KIND_UNKNOWN && f->sizecode > 0) {
     /* Leave as UNKNOWN — the caller may have multiple paths. */
   }
 
+}
+
+static void analyze_function(const Proto *f, InterfaceReport *report) {
+  int my_index = report->num_functions;
+  uint64_t fp = report->fingerprints ? report->fingerprints[my_index] : 0;
+  FunctionInfo *old = find_previous(report, fp);
+  FunctionInfo *fi = push_function(report);
+  fi->fingerprint = fp;
+  if (old)
+    reuse_function(f, fi, old, report);
+  else
+    scan_function(f, fi, report);
+
   /* --- Recurse into nested protos --------------------------------------- */
-  int my_index = report->num_functions - 1;
 
   for (int i = 0; i < f->sizep; i++) {
     int child_index = report->num_functions;
@@ -1057,28 +1373,14 @@ static void analyze_function(const Proto *f, InterfaceReport *report) {
 
   /* --- Resolve pending global → function_index mappings ---------------- */
   /* Now that all child protos have been pushed into report->functions,
-  ** match each stashed Proto pointer against the recorded FunctionInfo
-  ** entries by pointer identity on line_defined + source. Direct pointer
-  ** comparison against f->p[bx] would be ideal but FunctionInfo doesn't
-  ** store the Proto*; matching on linedefined is unambiguous for any
-  ** well-formed script (two sibling functions on the same line is
-  ** pathological). */
+  ** the FunctionInfo of child i of f is at child_proto_indices[i]. */
   fi = &report->functions[my_index]; /* re-fetch: may have moved due to realloc */
-  if (fi->num_pending > 0) {
-    for (int g = 0; g < fi->num_pending && g < report->num_globals; g++) {
-      if (!fi->pending_proto[g]) continue;
-      int target_line = fi->pending_proto[g]->linedefined;
-      for (int k = 0; k < report->num_functions; k++) {
-        if (report->functions[k].line_defined == target_line) {
-          report->globals[g].function_index = k;
-          break;
-        }
-      }
-    }
-    free(fi->pending_proto);
-    fi->pending_proto = NULL;
-    fi->num_pending   = 0;
-  }
+  for (int i = 0; i < fi->num_pending; i++)
+    report->globals[fi->pending[i].global].function_index =
+      fi->child_proto_indices[fi->pending[i].child];
+  free(fi->pending);
+  fi->pending = NULL;
+  fi->num_pending = fi->cap_pending = 0;
 }
 
 static void analyze_proto_recursive(const Proto *f, InterfaceReport *report) {
@@ -1087,14 +1389,48 @@ static void analyze_proto_recursive(const Proto *f, InterfaceReport *report) {
 
 
 /* -------------------------------------------------------------------------
-** Public entry point
+** Public entry points
 ** ------------------------------------------------------------------------- */
-InterfaceReport *analyze_proto(const Proto *f) {
+InterfaceReport *analyze_proto_incremental(const Proto *f,
+                                           InterfaceReport *previous) {
   InterfaceReport *report = create_report();
+  FpEntry *index = NULL;
+  int n = 0;
+  report->fingerprints = (uint64_t *)malloc(count_protos(f) * sizeof(uint64_t));
+  if (report->fingerprints)
+    fingerprint_proto(f, report->fingerprints, &n);
+  if (previous && previous->num_functions > 0 &&
+      (index = (FpEntry *)malloc(previous->num_functions * sizeof(FpEntry)))) {
+    for (int i = 0; i < previous->num_functions; i++) {
+      index[i].fp = previous->functions[i].fingerprint;
+      index[i].index = i;
+    }
+    qsort(index, previous->num_functions, sizeof(FpEntry), cmp_fp_entry);
+    report->previous = index;
+    report->num_previous = previous->num_functions;
+    report->prev_report = previous;
+  }
   analyze_proto_recursive(f, report);
+  free(report->fingerprints);
+  free(index);
+  free(report->global_index.slots);
+  free(report->defs);
+  report->global_index.slots = NULL;
+  report->global_index.size = 0;
+  report->defs = NULL;
+  report->cap_defs = 0;
+  report->fingerprints = NULL;
+  report->previous = NULL;
+  report->num_previous = 0;
+  report->prev_report = NULL;
+  free_report(previous);  /* what was not moved to the new report */
   return report;
 }
 
+InterfaceReport *analyze_proto(const Proto *f) {
+  return analyze_proto_incremental(f, NULL);
+}
+
 
 /* -------------------------------------------------------------------------
 ** JSON serialization
@@ -1105,248 +1441,446 @@ InterfaceReport *analyze_proto(const Proto *f) {
 ** so proto can decode them directly.
 ** ------------------------------------------------------------------------- */
 
-static void write_indent(FILE *out, int depth) {
-  for (int i = 0; i < depth * 2; i++) fputc(' ', out);
+static void write_indent(RBuffer *out, int depth) {
+  size_t n = (size_t)depth * 2;
+  if (!rb_reserve(out, n)) return;
+  memset(out->buf + out->len, ' ', n);
+  out->len += n;
 }
 
-static void write_string_array(FILE *out, const char **arr, int n, int depth) {
-  fprintf(out, "[\n");
+static void write_string_array(RBuffer *out, const char **arr, int n, int depth) {
+  rb_puts(out, "[\n");
   for (int i = 0; i < n; i++) {
     write_indent(out, depth + 1);
     json_write_string(out, arr[i]);
-    if (i < n - 1) fputc(',', out);
-    fputc('\n', out);
+    if (i < n - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
   write_indent(out, depth);
-  fputc(']', out);
+  rb_putc(out, ']');
 }
 
-static void write_table_info(FILE *out, const TableInfo *ti, int depth) {
-  fprintf(out, "{\n");
+static void write_table_info(RBuffer *out, const TableInfo *ti, int depth) {
+  rb_puts(out, "{\n");
   write_indent(out, depth + 1);
-  fprintf(out, "\"array_size\": %d,\n", ti->array_size);
+  rb_printf(out, "\"array_size\": %d,\n", ti->array_size);
   write_indent(out, depth + 1);
-  fprintf(out, "\"hash_size\": %d,\n", ti->hash_size);
+  rb_printf(out, "\"hash_size\": %d,\n", ti->hash_size);
   write_indent(out, depth + 1);
-  fprintf(out, "\"estimated_bytes\": %zu,\n", ti->estimated_bytes);
+  rb_printf(out, "\"estimated_bytes\": %zu,\n", ti->estimated_bytes);
   write_indent(out, depth + 1);
-  fprintf(out, "\"contains_closures\": %s\n", ti->contains_closures ? "true" : "false");
+  rb_printf(out, "\"contains_closures\": %s\n", ti->contains_closures ? "true" : "false");
   write_indent(out, depth);
-  fputc('}', out);
+  rb_putc(out, '}');
 }
 
-static void write_constant_array(FILE *out, const ConstantEntry *arr, int n, int depth) {
-  fprintf(out, "[\n");
+static void write_constant_array(RBuffer *out, const ConstantEntry *arr, int n, int depth) {
+  rb_puts(out, "[\n");
   for (int i = 0; i < n; i++) {
     const ConstantEntry *ce = &arr[i];
     write_indent(out, depth + 1);
-    fprintf(out, "{\"kind\": %d, ", (int)ce->kind);
+    rb_printf(out, "{\"kind\": %d, ", (int)ce->kind);
     switch (ce->kind) {
       case CONST_KIND_STRING:
-        fprintf(out, "\"s_val\": ");
+        rb_puts(out, "\"s_val\": ");
         json_write_string(out, ce->s_val);
-        fprintf(out, ", \"i_val\": 0, \"f_val\": 0.0, \"b_val\": false");
+        rb_puts(out, ", \"i_val\": 0, \"f_val\": 0.0, \"b_val\": false");
         break;
       case CONST_KIND_INTEGER:
-        fprintf(out, "\"s_val\": null, \"i_val\": " LUA_INTEGER_FMT
-                     ", \"f_val\": 0.0, \"b_val\": false",
-                (LUAI_UACINT)ce->i_val);
+        rb_printf(out, "\"s_val\": null, \"i_val\": " LUA_INTEGER_FMT
+                       ", \"f_val\": 0.0, \"b_val\": false",
+                  (LUAI_UACINT)ce->i_val);
         break;
       case CONST_KIND_FLOAT:
-        fprintf(out, "\"s_val\": null, \"i_val\": 0, \"f_val\": %.17g"
-                     ", \"b_val\": false",
-                (double)ce->f_val);
+        rb_printf(out, "\"s_val\": null, \"i_val\": 0, \"f_val\": %.17g"
+                       ", \"b_val\": false",
+                  (double)ce->f_val);
         break;
       case CONST_KIND_BOOL:
-        fprintf(out, "\"s_val\": null, \"i_val\": 0, \"f_val\": 0.0"
-                     ", \"b_val\": %s", ce->b_val ? "true" : "false");
+        rb_printf(out, "\"s_val\": null, \"i_val\": 0, \"f_val\": 0.0"
+                       ", \"b_val\": %s", ce->b_val ? "true" : "false");
         break;
       default: /* CONST_KIND_NULL */
-        fprintf(out, "\"s_val\": null, \"i_val\": 0, \"f_val\": 0.0"
-                     ", \"b_val\": false");
+        rb_printf(out, "\"s_val\": null, \"i_val\": 0, \"f_val\": 0.0"
+                       ", \"b_val\": false");
         break;
     }
-    fputc('}', out);
-    if (i < n - 1) fputc(',', out);
-    fputc('\n', out);
+    rb_putc(out, '}');
+    if (i < n - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
   write_indent(out, depth);
-  fputc(']', out);
+  rb_putc(out, ']');
 }
 
-static void write_int_array(FILE *out, const int *arr, int n, int depth) {
-  fprintf(out, "[\n");
+static void write_int_array(RBuffer *out, const int *arr, int n, int depth) {
+  rb_puts(out, "[\n");
   for (int i = 0; i < n; i++) {
     write_indent(out, depth + 1);
-    fprintf(out, "%d", arr[i]);
-    if (i < n - 1) fputc(',', out);
-    fputc('\n', out);
+    rb_printf(out, "%d", arr[i]);
+    if (i < n - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
   write_indent(out, depth);
-  fputc(']', out);
+  rb_putc(out, ']');
 }
 
-static void write_closure_array(FILE *out, const ClosureInfo *arr, int n, int depth) {
-  fprintf(out, "[\n");
+static void write_closure_array(RBuffer *out, const ClosureInfo *arr, int n, int depth) {
+  rb_puts(out, "[\n");
   for (int i = 0; i < n; i++) {
     write_indent(out, depth + 1);
-    fprintf(out, "{\"line_defined\": %d, \"upvalue_count\": %d}",
-            arr[i].line_defined, arr[i].upvalue_count);
-    if (i < n - 1) fputc(',', out);
-    fputc('\n', out);
+    rb_printf(out, "{\"line_defined\": %d, \"upvalue_count\": %d}",
+              arr[i].line_defined, arr[i].upvalue_count);
+    if (i < n - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
   write_indent(out, depth);
-  fputc(']', out);
+  rb_putc(out, ']');
 }
 
-static void write_call_site_array(FILE *out, const CallSite *arr, int n, int depth) {
-  fprintf(out, "[\n");
+static void write_call_site_array(RBuffer *out, const CallSite *arr, int n, int depth) {
+  rb_puts(out, "[\n");
   for (int i = 0; i < n; i++) {
     const CallSite *cs = &arr[i];
     write_indent(out, depth + 1);
-    fprintf(out, "{\"line\": %d, \"kind\": %d, \"callee\": ",
-            cs->line, (int)cs->kind);
+    rb_printf(out, "{\"line\": %d, \"kind\": %d, \"callee\": ",
+              cs->line, (int)cs->kind);
     json_write_string(out, cs->callee ? cs->callee : "");
-    fprintf(out, ", \"arg_count\": %d, \"is_tail\": %s}",
-            cs->arg_count, cs->is_tail ? "true" : "false");
-    if (i < n - 1) fputc(',', out);
-    fputc('\n', out);
+    rb_printf(out, ", \"arg_count\": %d, \"is_tail\": %s}",
+              cs->arg_count, cs->is_tail ? "true" : "false");
+    if (i < n - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
   write_indent(out, depth);
-  fputc(']', out);
+  rb_putc(out, ']');
 }
 
-static void write_read_array(FILE *out, const ReadEntry *arr, int n, int depth) {
-  fprintf(out, "[\n");
+static void write_read_array(RBuffer *out, const ReadEntry *arr, int n, int depth) {
+  rb_puts(out, "[\n");
   for (int i = 0; i < n; i++) {
     write_indent(out, depth + 1);
-    fprintf(out, "{\"table_name\": ");
+    rb_puts(out, "{\"table_name\": ");
     json_write_string(out, arr[i].table_name);
-    fprintf(out, ", \"field_name\": ");
+    rb_puts(out, ", \"field_name\": ");
     json_write_string(out, arr[i].field_name);
-    fputc('}', out);
-    if (i < n - 1) fputc(',', out);
-    fputc('\n', out);
+    rb_putc(out, '}');
+    if (i < n - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
   write_indent(out, depth);
-  fputc(']', out);
+  rb_putc(out, ']');
 }
 
-static void write_function_info(FILE *out, const FunctionInfo *fi, int depth) {
-  write_indent(out, depth); fprintf(out, "{\n");
+static void write_function_info(RBuffer *out, const FunctionInfo *fi, int depth) {
+  write_indent(out, depth); rb_puts(out, "{\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"source\": "); json_write_string(out, fi->source); fprintf(out, ",\n");
+  rb_puts(out, "\"source\": "); json_write_string(out, fi->source); rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"line_defined\": %d,\n", fi->line_defined);
+  rb_printf(out, "\"line_defined\": %d,\n", fi->line_defined);
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"last_line\": %d,\n", fi->last_line);
+  rb_printf(out, "\"last_line\": %d,\n", fi->last_line);
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"param_count\": %d,\n", fi->param_count);
+  rb_printf(out, "\"param_count\": %d,\n", fi->param_count);
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"is_vararg\": %s,\n", fi->is_vararg ? "true" : "false");
+  rb_printf(out, "\"is_vararg\": %s,\n", fi->is_vararg ? "true" : "false");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"is_method\": %s,\n", fi->is_method ? "true" : "false");
+  rb_printf(out, "\"is_method\": %s,\n", fi->is_method ? "true" : "false");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"param_names\": ");
+  rb_puts(out, "\"param_names\": ");
   if (fi->param_count > 0 && fi->param_names)
     write_string_array(out, fi->param_names, fi->param_count, depth + 1);
   else
-    fprintf(out, "[]");
-  fprintf(out, ",\n");
+    rb_puts(out, "[]");
+  rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"upvalue_names\": ");
+  rb_puts(out, "\"upvalue_names\": ");
   if (fi->upvalue_count > 0 && fi->upvalue_names)
     write_string_array(out, fi->upvalue_names, fi->upvalue_count, depth + 1);
   else
-    fprintf(out, "[]");
-  fprintf(out, ",\n");
+    rb_puts(out, "[]");
+  rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"return_kind\": %d,\n", (int)fi->return_kind);
+  rb_printf(out, "\"return_kind\": %d,\n", (int)fi->return_kind);
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"table_info\": ");
+  rb_puts(out, "\"table_info\": ");
   write_table_info(out, &fi->table_info, depth + 1);
-  fprintf(out, ",\n");
+  rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"is_vararg_used\": %s,\n", fi->is_vararg_used ? "true" : "false");
+  rb_printf(out, "\"is_vararg_used\": %s,\n", fi->is_vararg_used ? "true" : "false");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"closures\": ");
+  rb_puts(out, "\"closures\": ");
   write_closure_array(out, fi->closures, fi->num_closures, depth + 1);
-  fprintf(out, ",\n");
+  rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"constants\": ");
+  rb_puts(out, "\"constants\": ");
   write_constant_array(out, fi->constants, fi->num_constants, depth + 1);
-  fprintf(out, ",\n");
+  rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"child_proto_indices\": ");
+  rb_puts(out, "\"child_proto_indices\": ");
   write_int_array(out, fi->child_proto_indices, fi->num_children, depth + 1);
-  fprintf(out, ",\n");
+  rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"call_sites\": ");
+  rb_puts(out, "\"call_sites\": ");
   write_call_site_array(out, fi->call_sites, fi->num_call_sites, depth + 1);
-  fprintf(out, ",\n");
+  rb_puts(out, ",\n");
 
   write_indent(out, depth + 1);
-  fprintf(out, "\"reads\": ");
+  rb_puts(out, "\"reads\": ");
   write_read_array(out, fi->reads, fi->num_reads, depth + 1);
-  fprintf(out, "\n");
+  rb_puts(out, "\n");
 
-  write_indent(out, depth); fputc('}', out);
+  write_indent(out, depth); rb_putc(out, '}');
 }
 
-void print_report_json(InterfaceReport *report, FILE *out) {
-  fprintf(out, "{\n");
+static void write_report(RBuffer *out, InterfaceReport *report) {
+  rb_puts(out, "{\n");
 
   /* Version tag */
-  fprintf(out, "  \"lua_version\": \"%s\",\n", DILUVIUM_LUA_VERSION);
+  rb_printf(out, "  \"lua_version\": \"%s\",\n", DILUVIUM_LUA_VERSION);
 
   /* Functions array */
-  fprintf(out, "  \"functions\": [\n");
+  rb_puts(out, "  \"functions\": [\n");
   for (int i = 0; i < report->num_functions; i++) {
     write_function_info(out, &report->functions[i], 2);
-    if (i < report->num_functions - 1) fputc(',', out);
-    fputc('\n', out);
+    if (i < report->num_functions - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
-  fprintf(out, "  ],\n");
+  rb_puts(out, "  ],\n");
 
   /* Globals array */
-  fprintf(out, "  \"globals\": [\n");
+  rb_puts(out, "  \"globals\": [\n");
   for (int i = 0; i < report->num_globals; i++) {
-    fprintf(out, "    {\"name\": ");
+    rb_puts(out, "    {\"name\": ");
     json_write_string(out, report->globals[i].name);
-    fprintf(out, ", \"is_function\": %s, \"function_index\": %d}",
-            report->globals[i].is_function ? "true" : "false",
-            report->globals[i].function_index);
-    if (i < report->num_globals - 1) fputc(',', out);
-    fputc('\n', out);
+    rb_printf(out, ", \"is_function\": %s, \"function_index\": %d}",
+              report->globals[i].is_function ? "true" : "false",
+              report->globals[i].function_index);
+    if (i < report->num_globals - 1) rb_putc(out, ',');
+    rb_putc(out, '\n');
   }
-  fprintf(out, "  ]\n");
+  rb_puts(out, "  ]\n");
 
-  fprintf(out, "}\n");
+  rb_puts(out, "}\n");
+}
+
+static int file_writer(const void *p, size_t sz, void *ud) {
+  return fwrite(p, 1, sz, (FILE *)ud) != sz;
+}
+
+/*
+** Stream the JSON report through 'writer', which is called with
+** consecutive pieces of the output (like a lua_Writer). Return 0 on
+** success, or non-zero if out of memory or if 'writer' failed.
+*/
+int report_write_json(InterfaceReport *report, report_Writer writer, void *ud) {
+  RBuffer b = { NULL, 0, 0, writer, ud, 0 };
+  write_report(&b, report);
+  rb_flush(&b);
+  free(b.buf);
+  return b.failed;
+}
+
+void print_report_json(InterfaceReport *report, FILE *out) {
+  report_write_json(report, file_writer, out);
 }
 
 char *report_to_json_string(InterfaceReport *report) {
-  char  *buf    = NULL;
-  size_t size   = 0;
-  FILE  *stream = open_memstream(&buf, &size);
-  if (!stream) return NULL;
-  print_report_json(report, stream);
-  fclose(stream);
-  return buf; /* caller must free() */
+  RBuffer b = { NULL, 0, 0, NULL, NULL, 0 };
+  write_report(&b, report);
+  rb_putc(&b, '\0');
+  if (b.failed) {
+    free(b.buf);
+    return NULL;
+  }
+  return (char *)b.buf; /* caller must free() */
+}
+
+
+/* -------------------------------------------------------------------------
+** Protobuf serialization
+**
+** Encodes the report in protobuf wire format, using the field numbers of
+** the proto definitions at the top of this file. Scalar fields with their
+** default value are omitted as in proto3; repeated int32 fields are
+** packed. Nested messages are written in place and their bodies shifted
+** right once their length is known, so the buffer holds the whole report
+** (it has no writer).
+** ------------------------------------------------------------------------- */
+
+enum { PB_VARINT = 0, PB_FIXED64 = 1, PB_LEN = 2 };
+
+static int pb_varint_size(uint64_t v) {
+  int n = 1;
+  while (v >= 0x80) { v >>= 7; n++; }
+  return n;
+}
+
+static void pb_put_varint(unsigned char *p, uint64_t v) {
+  while (v >= 0x80) { *p++ = (unsigned char)(v | 0x80); v >>= 7; }
+  *p = (unsigned char)v;
+}
+
+static void pb_varint(RBuffer *b, uint64_t v) {
+  int n = pb_varint_size(v);
+  if (!rb_reserve(b, n)) return;
+  pb_put_varint(b->buf + b->len, v);
+  b->len += n;
+}
+
+static void pb_tag(RBuffer *b, int field, int wire) {
+  pb_varint(b, ((uint64_t)field << 3) | (uint64_t)wire);
+}
+
+/* int32/int64/enum/bool: negative values take ten bytes, as in proto */
+static void pb_int(RBuffer *b, int field, int64_t v) {
+  if (v == 0) return;
+  pb_tag(b, field, PB_VARINT);
+  pb_varint(b, (uint64_t)v);
+}
+
+static void pb_double(RBuffer *b, int field, double d) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  if (bits == 0) return;
+  pb_tag(b, field, PB_FIXED64);
+  if (!rb_reserve(b, 8)) return;
+  for (int i = 0; i < 8; i++)  /* little endian */
+    b->buf[b->len++] = (unsigned char)(bits >> (8 * i));
+}
+
+/* Always written: elements of repeated string fields may be empty. */
+static void pb_bytes(RBuffer *b, int field, const char *s) {
+  size_t n = s ? strlen(s) : 0;
+  pb_tag(b, field, PB_LEN);
+  pb_varint(b, n);
+  rb_write(b, s, n);
+}
+
+static void pb_string(RBuffer *b, int field, const char *s) {
+  if (s && *s) pb_bytes(b, field, s);
+}
+
+/* Start a length-delimited field; returns where its body starts. */
+static size_t pb_begin(RBuffer *b, int field) {
+  pb_tag(b, field, PB_LEN);
+  return b->len;
+}
+
+static void pb_end(RBuffer *b, size_t start) {
+  size_t body;
+  int n;
+  if (b->failed) return;
+  body = b->len - start;
+  n = pb_varint_size(body);
+  if (!rb_reserve(b, n)) return;
+  memmove(b->buf + start + n, b->buf + start, body);
+  pb_put_varint(b->buf + start, body);
+  b->len += n;
+}
+
+static void pb_function_info(RBuffer *b, const FunctionInfo *fi) {
+  size_t m;
+  pb_string(b, 1, fi->source);
+  pb_int(b, 2, fi->line_defined);
+  pb_int(b, 3, fi->last_line);
+  pb_int(b, 4, fi->param_count);
+  pb_int(b, 5, fi->is_vararg != 0);
+  pb_int(b, 6, fi->is_vararg_used != 0);
+  pb_int(b, 7, fi->is_method != 0);
+  if (fi->param_names)
+    for (int i = 0; i < fi->param_count; i++)
+      pb_bytes(b, 8, fi->param_names[i]);
+  if (fi->upvalue_names)
+    for (int i = 0; i < fi->upvalue_count; i++)
+      pb_bytes(b, 9, fi->upvalue_names[i]);
+  pb_int(b, 10, fi->return_kind);
+  m = pb_begin(b, 11);
+  pb_int(b, 1, fi->table_info.array_size);
+  pb_int(b, 2, fi->table_info.hash_size);
+  pb_int(b, 3, (int64_t)fi->table_info.estimated_bytes);
+  pb_int(b, 4, fi->table_info.contains_closures != 0);
+  pb_end(b, m);
+  for (int i = 0; i < fi->num_closures; i++) {
+    m = pb_begin(b, 12);
+    pb_int(b, 1, fi->closures[i].line_defined);
+    pb_int(b, 2, fi->closures[i].upvalue_count);
+    pb_end(b, m);
+  }
+  for (int i = 0; i < fi->num_constants; i++) {
+    const ConstantEntry *ce = &fi->constants[i];
+    m = pb_begin(b, 13);
+    pb_int(b, 1, ce->kind);
+    switch (ce->kind) {
+      case CONST_KIND_STRING:  pb_string(b, 2, ce->s_val); break;
+      case CONST_KIND_INTEGER: pb_int(b, 3, (int64_t)ce->i_val); break;
+      case CONST_KIND_FLOAT:   pb_double(b, 4, (double)ce->f_val); break;
+      case CONST_KIND_BOOL:    pb_int(b, 5, ce->b_val != 0); break;
+      default: break;
+    }
+    pb_end(b, m);
+  }
+  if (fi->num_children > 0) {
+    m = pb_begin(b, 14);  /* packed */
+    for (int i = 0; i < fi->num_children; i++)
+      pb_varint(b, (uint64_t)(int64_t)fi->child_proto_indices[i]);
+    pb_end(b, m);
+  }
+  for (int i = 0; i < fi->num_call_sites; i++) {
+    const CallSite *cs = &fi->call_sites[i];
+    m = pb_begin(b, 15);
+    pb_int(b, 1, cs->line);
+    pb_int(b, 2, cs->kind);
+    pb_string(b, 3, cs->callee);
+    pb_int(b, 4, cs->arg_count);
+    pb_int(b, 5, cs->is_tail != 0);
+    pb_end(b, m);
+  }
+  for (int i = 0; i < fi->num_reads; i++) {
+    m = pb_begin(b, 16);
+    pb_string(b, 1, fi->reads[i].table_name);
+    pb_string(b, 2, fi->reads[i].field_name);
+    pb_end(b, m);
+  }
+}
+
+unsigned char *report_to_protobuf(InterfaceReport *report, size_t *size) {
+  RBuffer b = { NULL, 0, 0, NULL, NULL, 0 };
+  size_t m;
+  pb_string(&b, 1, DILUVIUM_LUA_VERSION);
+  for (int i = 0; i < report->num_functions; i++) {
+    m = pb_begin(&b, 2);
+    pb_function_info(&b, &report->functions[i]);
+    pb_end(&b, m);
+  }
+  for (int i = 0; i < report->num_globals; i++) {
+    const GlobalEntry *ge = &report->globals[i];
+    m = pb_begin(&b, 3);
+    pb_string(&b, 1, ge->name);
+    pb_int(&b, 2, ge->is_function != 0);
+    pb_int(&b, 3, ge->function_index);
+    pb_end(&b, m);
+  }
+  if (b.failed) {
+    free(b.buf);
+    return NULL;
+  }
+  *size = b.len;
+  return b.buf; /* caller must free() */
 }
 
 
@@ -1370,7 +1904,7 @@ void free_report(InterfaceReport *report) {
       free((void *)fi->constants[j].s_val);
     free(fi->constants);
     free(fi->child_proto_indices);
-    free(fi->pending_proto);
+    free(fi->pending);
     for (int j = 0; j < fi->num_call_sites; j++)
       free((void *)fi->call_sites[j].callee);
     free(fi->call_sites);
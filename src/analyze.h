@@ -10,11 +10,82 @@
 #include "lobject.h"
 
 typedef struct InterfaceReport InterfaceReport;
+
+/* output sink for streamed reports; returns non-zero on error */
+typedef int (*report_Writer)(const void *p, size_t sz, void *ud);
+
 InterfaceReport *analyze_proto(const Proto *f);
+InterfaceReport *analyze_proto_incremental(const Proto *f,
+                                           InterfaceReport *previous);
 void print_report_json(InterfaceReport *report, FILE *out);
+int report_write_json(InterfaceReport *report, report_Writer writer, void *ud);
 void free_report(InterfaceReport *report);
 
 char *report_to_json_string(InterfaceReport *report);
+unsigned char *report_to_protobuf(InterfaceReport *report, size_t *size);
 char *diluvium_generate_report(const char *lua_source, size_t source_len, const char *chunkname);
 
+/*
+** Batch analysis (see diluvium_generate_reports). 'report' is the JSON
+** text or protobuf message of the job (caller free()s), or NULL, with
+** 'error' holding a message (caller free()s; NULL if out of memory).
+*/
+#define DILUVIUM_REPORT_JSON      0
+#define DILUVIUM_REPORT_PROTOBUF  1
+
+typedef struct {
+  const char *source;      /* in: source text or binary chunk */
+  size_t      source_len;
+  const char *chunkname;
+  char       *report;      /* out */
+  size_t      report_len;
+  char       *error;
+} DiluviumJob;
+
+int diluvium_generate_reports(DiluviumJob *jobs, int njobs, int nworkers, int format);
+
+/*
+** Batch compilation (see diluvium_compile). 'code' is the binary chunk
+** of the job (caller free()s), or NULL, with 'error' holding a message
+** (caller free()s; NULL if out of memory).
+*/
+#define DILUVIUM_COMPILE_STRIP     1  /* strip debug information */
+#define DILUVIUM_COMPILE_OPTIMIZE  2  /* run the optimizer */
+#define DILUVIUM_COMPILE_KEY       4  /* use 'key' for secure functions */
+
+typedef struct {
+  const char *source;      /* in: source text or binary chunk */
+  size_t      source_len;
+  const char *chunkname;
+  char       *code;        /* out */
+  size_t      code_len;
+  char       *error;
+} DiluviumCompileJob;
+
+int diluvium_compile(DiluviumCompileJob *jobs, int njobs, int nworkers,
+                     int flags, lua_Unsigned key);
+
+/*
+** Task pool (see diluvium_pool_new). A task carries a message for the
+** handler of the pool and gets back its reply in 'result' (caller
+** free()s; NULL if the handler returned nil), or NULL with 'error'
+** holding a message (caller free()s).
+*/
+typedef struct DiluviumPool DiluviumPool;
+
+typedef struct {
+  const char *message;     /* in */
+  size_t      message_len;
+  char       *result;      /* out */
+  size_t      result_len;
+  char       *error;
+  int         done;        /* private */
+} DiluviumTask;
+
+DiluviumPool *diluvium_pool_new(const char *source, size_t source_len,
+                                const char *chunkname, int nworkers, char **error);
+int diluvium_pool_submit(DiluviumPool *pool, DiluviumTask *task);
+int diluvium_pool_wait(DiluviumPool *pool, DiluviumTask *task);
+void diluvium_pool_close(DiluviumPool *pool);
+
 #endif
\ No newline at end of file
@@ -1,10 +1,22 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "lua.h"
 #include "lauxlib.h"   /* luaL_newstate, luaL_loadbuffer */
+#include "lualib.h"    /* luaL_openlazylibs */
 #include "lstate.h"    /* lua_State internals */
 #include "lfunc.h"     /* LClosure */
 #include "lobject.h"   /* Proto */
 #include "analyze.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(DILUVIUM_NO_THREADS) && !defined(__wasi__) && !defined(_WIN32)
+#define DILUVIUM_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 /* In a new diluvium_api.c, compiled without MAKE_LUAC */
 char *diluvium_generate_report(const char *lua_source, size_t source_len, const char *chunkname) {
   lua_State *L = luaL_newstate();
@@ -20,4 +32,531 @@ char *diluvium_generate_report(const char *lua_source, size_t source_len, const
   free_report(report);
   lua_close(L);
   return json; /* caller free()s */
-}
\ No newline at end of file
+}
+
+
+/*
+** Batch analysis: jobs are handed out to a pool of workers, each with
+** its own lua_State reused for all the jobs it takes, so the states
+** and the work on them are independent.
+*/
+typedef struct {
+  DiluviumJob *jobs;
+  DiluviumCompileJob *cjobs;  /* compilation jobs, if not NULL */
+  int          njobs;
+  int          format;      /* or compilation flags */
+  lua_Unsigned key;         /* key for secure functions */
+  int          next;        /* next job to hand out */
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_t lock;
+#endif
+} BatchState;
+
+static char *dup_message(const char *msg) {
+  size_t n = strlen(msg) + 1;
+  char *copy = (char *)malloc(n);
+  if (copy) memcpy(copy, msg, n);
+  return copy;
+}
+
+static void run_job(lua_State *L, DiluviumJob *job, int format) {
+  LClosure *cl;
+  InterfaceReport *report;
+  job->report = NULL;
+  job->report_len = 0;
+  job->error = NULL;
+  if (luaL_loadbuffer(L, job->source, job->source_len, job->chunkname) != LUA_OK) {
+    job->error = dup_message(lua_tostring(L, -1));
+    lua_settop(L, 0);
+    return;
+  }
+  cl = (LClosure *)lua_topointer(L, -1);
+  report = analyze_proto(cl->p);
+  if (format == DILUVIUM_REPORT_PROTOBUF)
+    job->report = (char *)report_to_protobuf(report, &job->report_len);
+  else {
+    job->report = report_to_json_string(report);
+    if (job->report) job->report_len = strlen(job->report);
+  }
+  if (!job->report) job->error = dup_message("not enough memory");
+  free_report(report);
+  lua_settop(L, 0);  /* release the chunk */
+}
+
+typedef struct {
+  char  *s;
+  size_t n, size;
+} DumpBuffer;
+
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+  DumpBuffer *b = (DumpBuffer *)ud;
+  (void)L;
+  if (b->n + sz > b->size) {
+    size_t size = (b->size > 0) ? b->size * 2 : 1024;
+    char *s;
+    while (size < b->n + sz) size *= 2;
+    if ((s = (char *)realloc(b->s, size)) == NULL) return 1;
+    b->s = s;
+    b->size = size;
+  }
+  memcpy(b->s + b->n, p, sz);
+  b->n += sz;
+  return 0;
+}
+
+/*
+** The state of a worker is its compiler context: the buffers of the
+** parser stay in it from one job to the next.
+*/
+static void compile_job(lua_State *L, DiluviumCompileJob *job, int flags) {
+  DumpBuffer b = {NULL, 0, 0};
+  job->code = NULL;
+  job->code_len = 0;
+  job->error = NULL;
+  if (luaL_loadbufferx(L, job->source, job->source_len, job->chunkname, NULL) != LUA_OK) {
+    job->error = dup_message(lua_tostring(L, -1));
+    lua_settop(L, 0);
+    return;
+  }
+  if (lua_dump(L, dump_writer, &b, (flags & DILUVIUM_COMPILE_STRIP) != 0) != 0) {
+    free(b.s);
+    job->error = dup_message("not enough memory");
+  }
+  else {
+    job->code = b.s;
+    job->code_len = b.n;
+  }
+  lua_settop(L, 0);  /* release the chunk */
+}
+
+static int take_job(BatchState *bs) {
+  int i;
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_lock(&bs->lock);
+#endif
+  i = (bs->next < bs->njobs) ? bs->next++ : -1;
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_unlock(&bs->lock);
+#endif
+  return i;
+}
+
+static void *batch_worker(void *ud) {
+  BatchState *bs = (BatchState *)ud;
+  lua_State *L = luaL_newstate();
+  int i;
+  if (L && bs->cjobs) {
+    if (bs->format & DILUVIUM_COMPILE_OPTIMIZE) lua_setoptlevel(L, 1);
+    if (bs->format & DILUVIUM_COMPILE_KEY) lua_setsecurekey(L, bs->key);
+  }
+  while ((i = take_job(bs)) >= 0) {
+    if (L && bs->cjobs) compile_job(L, &bs->cjobs[i], bs->format);
+    else if (L) run_job(L, &bs->jobs[i], bs->format);
+    else if (bs->cjobs) {
+      bs->cjobs[i].code = NULL;
+      bs->cjobs[i].code_len = 0;
+      bs->cjobs[i].error = dup_message("cannot create state: not enough memory");
+    }
+    else {
+      bs->jobs[i].report = NULL;
+      bs->jobs[i].report_len = 0;
+      bs->jobs[i].error = dup_message("cannot create state: not enough memory");
+    }
+  }
+  if (L) lua_close(L);
+  return NULL;
+}
+
+static void run_batch(BatchState *bs, int nworkers) {
+  bs->next = 0;
+#if defined(DILUVIUM_THREADS)
+  if (nworkers <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = (ncpu > 0) ? (int)ncpu : 1;
+  }
+  if (nworkers > bs->njobs) nworkers = bs->njobs;
+  if (nworkers > 1) {
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)nworkers);
+    int started = 0;
+    pthread_mutex_init(&bs->lock, NULL);
+    if (threads != NULL) {
+      for (; started < nworkers - 1; started++)
+        if (pthread_create(&threads[started], NULL, batch_worker, bs) != 0)
+          break;
+    }
+    batch_worker(bs);  /* this thread works too */
+    for (int i = 0; i < started; i++)
+      pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&bs->lock);
+  }
+  else
+#else
+  (void)nworkers;
+#endif
+  batch_worker(bs);
+}
+
+/*
+** Analyze 'njobs' sources on 'nworkers' workers (<= 0: one per online
+** CPU), the calling thread being one of them. Return the number of jobs
+** that produced a report.
+*/
+int diluvium_generate_reports(DiluviumJob *jobs, int njobs, int nworkers, int format) {
+  BatchState bs;
+  int ok = 0;
+  bs.jobs = jobs;
+  bs.cjobs = NULL;
+  bs.njobs = njobs;
+  bs.format = format;
+  bs.key = 0;
+  run_batch(&bs, nworkers);
+  for (int i = 0; i < njobs; i++)
+    if (jobs[i].report) ok++;
+  return ok;
+}
+
+/*
+** Compile 'njobs' sources into binary chunks on 'nworkers' workers, as
+** 'diluvium_generate_reports' does. Each worker has its own state and
+** reuses it for all its jobs. Return the number of jobs compiled.
+*/
+int diluvium_compile(DiluviumCompileJob *jobs, int njobs, int nworkers,
+                     int flags, lua_Unsigned key) {
+  BatchState bs;
+  int ok = 0;
+  bs.jobs = NULL;
+  bs.cjobs = jobs;
+  bs.njobs = njobs;
+  bs.format = flags;
+  bs.key = key;
+  run_batch(&bs, nworkers);
+  for (int i = 0; i < njobs; i++)
+    if (jobs[i].code) ok++;
+  return ok;
+}
+
+
+/*
+** Task pool: workers that each own a lua_State built from the same
+** template chunk, which is compiled once and shared as a binary chunk.
+** The template returns the handler, called with the message of each
+** task and returning its reply. Each worker has its own queue; tasks are
+** dealt among the queues, and a worker whose queue is empty steals the
+** oldest task of another one.
+*/
+typedef struct {
+  DiluviumTask **items;     /* ring buffer */
+  int            size;      /* power of 2 (or 0) */
+  int            first;     /* oldest task */
+  int            n;
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_t lock;
+#endif
+} TaskQueue;
+
+typedef struct {
+  DiluviumPool *pool;
+  int           id;
+  lua_State    *L;          /* handler at index 1; NULL if it failed */
+  char         *error;      /* why 'L' is NULL */
+  TaskQueue     q;
+#if defined(DILUVIUM_THREADS)
+  pthread_t     thread;
+#endif
+} PoolWorker;
+
+struct DiluviumPool {
+  char       *code;         /* template as a binary chunk */
+  size_t      code_len;
+  char       *chunkname;
+  PoolWorker *workers;
+  int         nqueues;      /* workers allocated */
+  int         nworkers;     /* workers running */
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_t lock;     /* protects the fields below and 'done' */
+  pthread_cond_t  work;     /* signaled when a task is queued */
+  pthread_cond_t  done;     /* broadcast when a task is done */
+  int         queued;       /* tasks waiting in the queues */
+  int         sleeping;     /* workers waiting for 'work' */
+  int         closing;
+  unsigned    next;         /* queue for the next task */
+#endif
+};
+
+
+static void start_worker(PoolWorker *w) {
+  DiluviumPool *pool = w->pool;
+  lua_State *L = luaL_newstate();
+  w->error = NULL;
+  w->L = NULL;
+  if (L == NULL) {
+    w->error = dup_message("cannot create state: not enough memory");
+    return;
+  }
+#if !defined(MAKE_LUAC)  /* luac is built without the libraries */
+  luaL_openlazylibs(L);  /* a template pays only for what it uses */
+#endif
+  if (luaL_loadbufferx(L, pool->code, pool->code_len, pool->chunkname, "b") != LUA_OK ||
+      lua_pcall(L, 0, 1, 0) != LUA_OK)
+    w->error = dup_message(lua_isstring(L, -1) ? lua_tostring(L, -1) : "template failed");
+  else if (!lua_isfunction(L, -1))
+    w->error = dup_message("template must return a function");
+  else {
+    w->L = L;  /* handler is at index 1 */
+    return;
+  }
+  lua_close(L);
+}
+
+static void run_task(PoolWorker *w, DiluviumTask *t) {
+  lua_State *L = w->L;
+  t->result = NULL;
+  t->result_len = 0;
+  t->error = NULL;
+  if (L == NULL) {
+    t->error = dup_message(w->error ? w->error : "not enough memory");
+    return;
+  }
+  lua_pushvalue(L, 1);
+  lua_pushlstring(L, t->message, t->message_len);
+  if (lua_pcall(L, 1, 1, 0) != LUA_OK)
+    t->error = dup_message(lua_isstring(L, -1) ? lua_tostring(L, -1)
+                                               : "error object is not a string");
+  else if (!lua_isstring(L, -1) && !lua_isnil(L, -1))
+    t->error = dup_message("handler must return a string");
+  else if (lua_isstring(L, -1)) {
+    size_t len;
+    const char *s = lua_tolstring(L, -1, &len);
+    t->result = (char *)malloc(len + 1);
+    if (t->result == NULL)
+      t->error = dup_message("not enough memory");
+    else {
+      memcpy(t->result, s, len + 1);
+      t->result_len = len;
+    }
+  }
+  lua_settop(L, 1);
+}
+
+#if defined(DILUVIUM_THREADS)
+
+static int queue_push(TaskQueue *q, DiluviumTask *t) {
+  if (q->n == q->size) {  /* full? */
+    int size = (q->size > 0) ? q->size * 2 : 16;
+    DiluviumTask **items = (DiluviumTask **)malloc(sizeof(DiluviumTask *) * (size_t)size);
+    if (items == NULL) return 0;
+    for (int i = 0; i < q->n; i++)
+      items[i] = q->items[(q->first + i) & (q->size - 1)];
+    free(q->items);
+    q->items = items;
+    q->size = size;
+    q->first = 0;
+  }
+  q->items[(q->first + q->n++) & (q->size - 1)] = t;
+  return 1;
+}
+
+/* the owner takes the newest task; thieves take the oldest one */
+static DiluviumTask *queue_take(TaskQueue *q, int steal) {
+  DiluviumTask *t = NULL;
+  pthread_mutex_lock(&q->lock);
+  if (q->n > 0) {
+    if (steal) {
+      t = q->items[q->first];
+      q->first = (q->first + 1) & (q->size - 1);
+    }
+    else
+      t = q->items[(q->first + q->n - 1) & (q->size - 1)];
+    q->n--;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return t;
+}
+
+static DiluviumTask *find_task(DiluviumPool *pool, PoolWorker *w) {
+  DiluviumTask *t = queue_take(&w->q, 0);
+  for (int i = 1; t == NULL && i < pool->nqueues; i++)
+    t = queue_take(&pool->workers[(w->id + i) % pool->nqueues].q, 1);
+  return t;
+}
+
+static void *pool_worker(void *ud) {
+  PoolWorker *w = (PoolWorker *)ud;
+  DiluviumPool *pool = w->pool;
+  start_worker(w);
+  for (;;) {
+    DiluviumTask *t = find_task(pool, w);
+    if (t != NULL) {
+      pthread_mutex_lock(&pool->lock);
+      pool->queued--;
+      pthread_mutex_unlock(&pool->lock);
+      run_task(w, t);
+      pthread_mutex_lock(&pool->lock);
+      t->done = 1;
+      pthread_cond_broadcast(&pool->done);
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued == 0 && !pool->closing) {
+      pool->sleeping++;
+      pthread_cond_wait(&pool->work, &pool->lock);
+      pool->sleeping--;
+    }
+    if (pool->queued == 0) {  /* closing and nothing left? */
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  if (w->L) lua_close(w->L);
+  return NULL;
+}
+
+#endif
+
+/*
+** Create a pool of 'nworkers' workers (<= 0: one per online CPU) whose
+** handler is returned by the given chunk. On errors, return NULL and
+** set '*error' to a message (caller free()s; NULL if out of memory).
+*/
+DiluviumPool *diluvium_pool_new(const char *source, size_t source_len,
+                                const char *chunkname, int nworkers, char **error) {
+  DiluviumPool *pool;
+  lua_State *L;
+  DumpBuffer b = {NULL, 0, 0};
+  *error = NULL;
+  if ((L = luaL_newstate()) == NULL) return NULL;
+  if (luaL_loadbuffer(L, source, source_len, chunkname) != LUA_OK) {
+    *error = dup_message(lua_tostring(L, -1));
+    lua_close(L);
+    return NULL;
+  }
+  if (lua_dump(L, dump_writer, &b, 0) != 0) {
+    free(b.s);
+    lua_close(L);
+    return NULL;
+  }
+  lua_close(L);
+  pool = (DiluviumPool *)calloc(1, sizeof(DiluviumPool));
+#if defined(DILUVIUM_THREADS)
+  if (nworkers <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = (ncpu > 0) ? (int)ncpu : 1;
+  }
+#else
+  nworkers = 1;
+#endif
+  if (pool != NULL) {
+    pool->chunkname = dup_message(chunkname ? chunkname : "=pool");
+    pool->workers = (PoolWorker *)calloc((size_t)nworkers, sizeof(PoolWorker));
+  }
+  if (pool == NULL || pool->chunkname == NULL || pool->workers == NULL) {
+    if (pool) { free(pool->chunkname); free(pool->workers); }
+    free(pool);
+    free(b.s);
+    return NULL;
+  }
+  pool->code = b.s;
+  pool->code_len = b.n;
+  pool->nqueues = nworkers;
+  for (int i = 0; i < nworkers; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+  }
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (int i = 0; i < nworkers; i++)
+    pthread_mutex_init(&pool->workers[i].q.lock, NULL);
+  for (; pool->nworkers < nworkers; pool->nworkers++) {
+    PoolWorker *w = &pool->workers[pool->nworkers];
+    if (pthread_create(&w->thread, NULL, pool_worker, w) != 0)
+      break;
+  }
+  if (pool->nworkers == 0) {
+    *error = dup_message("cannot create worker threads");
+    diluvium_pool_close(pool);
+    return NULL;
+  }
+#else
+  start_worker(&pool->workers[0]);
+  pool->nworkers = 1;
+#endif
+  return pool;
+}
+
+/*
+** Queue a task; its fields 'result', 'result_len' and 'error' are valid
+** after 'diluvium_pool_wait' returns for it. The message must stay
+** alive until then. Return 0 if there is not enough memory to queue it.
+** (Without threads, the task runs right here.)
+*/
+int diluvium_pool_submit(DiluviumPool *pool, DiluviumTask *task) {
+  task->done = 0;
+#if defined(DILUVIUM_THREADS)
+  {
+    PoolWorker *w;
+    int ok;
+    pthread_mutex_lock(&pool->lock);
+    w = &pool->workers[pool->next++ % (unsigned)pool->nworkers];
+    pthread_mutex_lock(&w->q.lock);
+    ok = queue_push(&w->q, task);
+    pthread_mutex_unlock(&w->q.lock);
+    if (ok) {
+      pool->queued++;
+      if (pool->sleeping > 0)
+        pthread_cond_signal(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return ok;
+  }
+#else
+  run_task(&pool->workers[0], task);
+  task->done = 1;
+  return 1;
+#endif
+}
+
+/* Wait for a task to finish; return whether it produced no error */
+int diluvium_pool_wait(DiluviumPool *pool, DiluviumTask *task) {
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_lock(&pool->lock);
+  while (!task->done)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+#else
+  (void)pool;
+#endif
+  return (task->error == NULL);
+}
+
+/* Run the tasks still queued, stop the workers and free the pool */
+void diluvium_pool_close(DiluviumPool *pool) {
+  if (pool == NULL) return;
+#if defined(DILUVIUM_THREADS)
+  pthread_mutex_lock(&pool->lock);
+  pool->closing = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->nworkers; i++)
+    pthread_join(pool->workers[i].thread, NULL);
+  for (int i = 0; i < pool->nqueues; i++)
+    pthread_mutex_destroy(&pool->workers[i].q.lock);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+#else
+  if (pool->workers[0].L) lua_close(pool->workers[0].L);
+#endif
+  for (int i = 0; i < pool->nqueues; i++) {
+    free(pool->workers[i].q.items);
+    free(pool->workers[i].error);
+  }
+  free(pool->workers);
+  free(pool->chunkname);
+  free(pool->code);
+  free(pool);
+}
@@ -125,6 +125,30 @@ LUA_API int lua_checkstack (lua_State *L, int n) {
 }
 
 
+/*
+** Preallocate a stack of 'nslots' slots and 'ncalls' CallInfo
+** structures for thread 'L', and keep them across collections, so
+** that recursion up to that depth never reallocates.
+*/
+LUA_API int lua_reservestack (lua_State *L, int nslots, int ncalls) {
+  int res = 1;
+  lua_lock(L);
+  api_check(L, nslots >= 0 && ncalls >= 0, "negative reservation");
+  if (nslots > LUAI_MAXSTACK || ncalls > USHRT_MAX)
+    res = 0;  /* reservation too large */
+  else {
+    L->stackreserve = nslots;
+    L->cireserve = cast(unsigned short, ncalls);
+    if (stacksize(L) < nslots)
+      res = luaD_reallocstack(L, nslots, 0);
+    if (res)
+      res = luaE_reserveCI(L, ncalls);
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_xmove (lua_State *from, lua_State *to, int n) {
   int i;
   if (from == to) return;
@@ -416,6 +440,7 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     luaC_checkGC(L);
     o = index2value(L, idx);  /* previous call may reallocate the stack */
   }
+  luaS_terminate(L, tsvalue(o));  /* C code gets a terminated string */
   if (len != NULL)
     *len = tsslen(tsvalue(o));
   lua_unlock(L);
@@ -459,6 +484,19 @@ LUA_API void *lua_touserdata (lua_State *L, int idx) {
 }
 
 
+LUA_API void *lua_totypedarray (lua_State *L, int idx, int *kind,
+                                size_t *n) {
+  const TValue *o = index2value(L, idx);
+  TArray *ta;
+  if (!ttistarray(L, o))
+    return NULL;
+  ta = cast(TArray *, getudatamem(uvalue(o)));
+  if (kind) *kind = ta->kind;
+  if (n) *n = ta->n;
+  return tadata(ta);
+}
+
+
 LUA_API lua_State *lua_tothread (lua_State *L, int idx) {
   const TValue *o = index2value(L, idx);
   return (!ttisthread(o)) ? NULL : thvalue(o);
@@ -475,7 +513,7 @@ LUA_API lua_State *lua_tothread (lua_State *L, int idx) {
 LUA_API const void *lua_topointer (lua_State *L, int idx) {
   const TValue *o = index2value(L, idx);
   switch (ttypetag(o)) {
-    case LUA_VLCF: return cast_voidp(cast_sizet(fvalue(o)));
+    case LUA_VLCF: case LUA_VFCF: return cast_voidp(cast_sizet(fvalue(o)));
     case LUA_VUSERDATA: case LUA_VLIGHTUSERDATA:
       return touserdata(o);
     default: {
@@ -535,6 +573,29 @@ LUA_API const char *lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** Pushes the substring with 'len' bytes starting at byte 'i' (counting
+** from 0) of the string at index 'idx'. Long enough substrings are
+** slices of the string, sharing its contents.
+*/
+LUA_API void lua_pushslice (lua_State *L, int idx, size_t i, size_t len) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, ttisstring(index2value(L, idx)), "string expected");
+  ts = tsvalue(index2value(L, idx));
+  api_check(L, i <= tsslen(ts) && len <= tsslen(ts) - i,
+               "substring out of bounds");
+  if (len >= LUAI_MINSLICE)
+    ts = luaS_newslice(L, ts, i, len);
+  else
+    ts = (len == 0) ? luaS_new(L, "") : luaS_newlstr(L, getstr(ts) + i, len);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
   if (s == NULL)
@@ -602,6 +663,20 @@ LUA_API void lua_pushcclosure (lua_State *L, lua_CFunction fn, int n) {
 }
 
 
+/*
+** Push a light C function that Lua code calls through a lighter path
+** (see 'luaD_callfast'). The function must not yield; it runs as a
+** non-yieldable call, so a yield raises an error. It is equal to (and
+** the same table key as) the function pushed with 'lua_pushcfunction'.
+*/
+LUA_API void lua_pushfastcfunction (lua_State *L, lua_CFunction fn) {
+  lua_lock(L);
+  setfcfvalue(s2v(L->top.p), fn);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_pushboolean (lua_State *L, int b) {
   lua_lock(L);
   if (b)
@@ -759,6 +834,129 @@ LUA_API int lua_rawgetp (lua_State *L, int idx, const void *p) {
 }
 
 
+/*
+** Copy the numbers at t[i], t[i+1], ..., t[i+n-1] into 'v', stopping at
+** the first value that is not a number. Returns how many were copied.
+*/
+LUA_API int lua_getarray (lua_State *L, int idx, lua_Integer i,
+                          lua_Number *v, int n) {
+  Table *t;
+  unsigned int asize;
+  int k;
+  lua_lock(L);
+  t = gettable(L, idx);
+  asize = luaH_realasize(t);
+  for (k = 0; k < n; k++) {
+    lua_Unsigned key = l_castS2U(i) + cast(unsigned int, k);
+    const TValue *o = (key - 1u < asize) ? &t->array[key - 1]
+                                         : luaH_getint(t, l_castU2S(key));
+    if (!tonumberns(o, v[k]))
+      break;
+  }
+  lua_unlock(L);
+  return k;
+}
+
+
+/*
+** Sort t[1..n] in place, if they all are integers, floats, or strings
+** in the array part of the table. Returns 0 (and does nothing) when
+** that does not apply.
+*/
+LUA_API int lua_sortarray (lua_State *L, int idx, lua_Integer n) {
+  const TValue *o;
+  int res = 0;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (ttistable(o) && 0 <= n && l_castS2U(n) <= luaH_realasize(hvalue(o)))
+    res = luaH_sortarray(L, hvalue(o), cast_uint(n));
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Tables whose missing fields 'event' would not go to a metamethod
+*/
+#define nomethod(L,t,event)  \
+	((t)->metatable == NULL || fasttm(L, (t)->metatable, event) == NULL)
+
+
+/*
+** Push t[i], ..., t[i + n - 1] if they all are in the array part of
+** the table at 'idx' and reading them would not call '__index'.
+** Returns 0 (and pushes nothing) when that does not apply.
+*/
+LUA_API int lua_pusharray (lua_State *L, int idx, lua_Integer i, int n) {
+  const TValue *o;
+  int res = 0;
+  lua_lock(L);
+  api_check(L, n >= 0 && n <= L->stack_last.p - L->top.p, "stack overflow");
+  o = index2value(L, idx);
+  if (ttistable(o) && i > 0 &&
+      l_castS2U(i) - 1u + l_castS2U(n) <= luaH_realasize(hvalue(o))) {
+    Table *t = hvalue(o);
+    const TValue *a = &t->array[i - 1];
+    int k = n;
+    if (!nomethod(L, t, TM_INDEX))  /* '__index' would see empty slots? */
+      for (k = 0; k < n && !isempty(&a[k]); k++) ;
+    if (k == n) {
+      for (k = 0; k < n; k++) {
+        if (isempty(&a[k]))
+          setnilvalue(s2v(L->top.p));  /* empty slots are nils */
+        else
+          setobj2s(L, L->top.p, &a[k]);
+        L->top.p++;
+      }
+      res = 1;
+    }
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Copy t1[f..e] into t2[t..], where 't1' and 't2' are the tables at
+** 'from' and 'to', directly between their array parts (see
+** 'luaH_movearray'), if reading 't1' would not call '__index' and
+** writing 't2' would not call '__newindex'. Returns 0 (and does
+** nothing) when that does not apply.
+*/
+LUA_API int lua_movearray (lua_State *L, int from, lua_Integer f,
+                           lua_Integer e, lua_Integer t, int to) {
+  const TValue *o1, *o2;
+  int res = 0;
+  lua_lock(L);
+  o1 = index2value(L, from);
+  o2 = index2value(L, to);
+  if (ttistable(o1) && ttistable(o2) && 0 < f && f <= e && 0 < t &&
+      nomethod(L, hvalue(o1), TM_INDEX) &&
+      nomethod(L, hvalue(o2), TM_NEWINDEX))
+    res = luaH_movearray(L, hvalue(o1), l_castS2U(f),
+                         l_castS2U(e) - l_castS2U(f) + 1u,
+                         hvalue(o2), l_castS2U(t));
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API void lua_freeze (lua_State *L, int idx) {
+  Table *t;
+  lua_lock(L);
+  t = gettable(L, idx);
+  if (!luaH_isfrozen(L, t))
+    luaH_freeze(L, t);
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_isfrozen (lua_State *L, int idx) {
+  const TValue *o = index2value(L, idx);
+  return (ttistable(o) && luaH_isfrozen(L, hvalue(o)));
+}
+
+
 LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   Table *t;
   lua_lock(L);
@@ -918,6 +1116,30 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
 }
 
 
+/*
+** Set t[i], t[i+1], ..., t[i+n-1] to the numbers in 'v', growing the
+** array part of the table once, if needed, to hold them all. Numbers
+** are not collectable, so the stores need no barrier.
+*/
+LUA_API void lua_setarray (lua_State *L, int idx, lua_Integer i,
+                           const lua_Number *v, int n) {
+  Table *t;
+  unsigned int last;
+  int k;
+  lua_lock(L);
+  api_check(L, n >= 0 && 0 < i && i <= INT_MAX - n + 1, "invalid range");
+  t = gettable(L, idx);
+  last = cast(unsigned int, i) + cast(unsigned int, n) - 1u;
+  if (last > luaH_realasize(t))
+    luaH_resizearray(L, t, last);
+  else
+    luaH_changed(L, t);
+  for (k = 0; k < n; k++)
+    setfltvalue(&t->array[i - 1 + k], v[k]);
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
   Table *t;
   lua_lock(L);
@@ -944,6 +1166,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUA_TTABLE: {
+      luaH_changed(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1122,6 +1345,46 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+/*
+** Write a snapshot of the heap through 'writer', after a full
+** collection (so that it has only live objects). Returns -1 if it
+** cannot collect (inside a finalizer), else the writer status.
+*/
+LUA_API int lua_snapshot (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  lua_lock(L);
+  if (G(L)->gcstp & (GCSTPGC | GCSTPCLS))  /* cannot collect now? */
+    status = -1;
+  else {
+    luaC_fullgc(L, 0);
+    status = luaC_snapshot(L, writer, data);
+  }
+  lua_unlock(L);
+  return status;
+}
+
+
+LUA_API void lua_setcoverage (lua_State *L, int on) {
+  lua_lock(L);
+  luaG_setcoverage(L, on);
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_coverage (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  lua_lock(L);
+  if (G(L)->gcstp & (GCSTPGC | GCSTPCLS))  /* cannot collect now? */
+    status = -1;
+  else {
+    luaC_fullgc(L, 0);  /* report only live functions */
+    status = luaG_writecoverage(L, writer, data);
+  }
+  lua_unlock(L);
+  return status;
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -1199,7 +1462,9 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
     case LUA_GCGEN: {
       int minormul = va_arg(argp, int);
       int majormul = va_arg(argp, int);
-      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      res = g->gcadaptive ? LUA_GCADAPT
+          : isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      g->gcadaptive = 0;
       if (minormul != 0)
         g->genminormul = minormul;
       if (majormul != 0)
@@ -1211,7 +1476,9 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       int pause = va_arg(argp, int);
       int stepmul = va_arg(argp, int);
       int stepsize = va_arg(argp, int);
-      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      res = g->gcadaptive ? LUA_GCADAPT
+          : isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      g->gcadaptive = 0;
       if (pause != 0)
         setgcparam(g->gcpause, pause);
       if (stepmul != 0)
@@ -1221,6 +1488,51 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       luaC_changemode(L, KGC_INC);
       break;
     }
+    case LUA_GCADAPT: {
+      res = g->gcadaptive ? LUA_GCADAPT
+          : isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+      if (!g->gcadaptive) {  /* start measuring from now */
+        g->gcadapt.base = gettotalbytes(g);
+        g->gcadapt.live = 0;
+        g->gcadapt.survival = 0;
+        g->gcadapt.streak = 0;
+      }
+      g->gcadaptive = 1;  /* keep current mode as the starting one */
+      break;
+    }
+    case LUA_GCADAPTINFO: {
+      int which = va_arg(argp, int);
+      if (0 <= which && which < LUA_GCANUMCOUNTS) {
+        lu_mem c = g->gcadapt.count[which];
+        res = (c > cast(lu_mem, INT_MAX)) ? INT_MAX : cast_int(c);
+      }
+      else if (which == LUA_GCASURVIVAL)
+        res = g->gcadapt.survival;
+      else if (which == LUA_GCAMINORMUL)
+        res = g->genminormul;
+      else if (which == LUA_GCAMAJORMUL)
+        res = getgcparam(g->genmajormul);
+      else
+        res = -1;  /* invalid value */
+      break;
+    }
+    case LUA_GCTHREADPOOL: {
+      int size = va_arg(argp, int);
+      int stacksize = va_arg(argp, int);
+      res = g->maxthreadpool;
+      if (size >= 0) {
+        g->maxthreadpool = size;
+        luaE_flushthreadpool(L, size);  /* drop extra threads */
+      }
+      if (stacksize > 0) {  /* applies to threads pooled from now on */
+        if (stacksize < BASIC_STACK_SIZE)
+          stacksize = BASIC_STACK_SIZE;
+        else if (stacksize > LUAI_MAXSTACK)
+          stacksize = LUAI_MAXSTACK;
+        g->poolstacksize = stacksize;
+      }
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1229,6 +1541,13 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
 }
 
 
+LUA_API void lua_gcstats (lua_State *L, lua_GCStats *stats) {
+  lua_lock(L);
+  luaC_getstats(L, stats);
+  lua_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1318,12 +1637,32 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  /* released blocks belong to the old allocator, and a release function
+     may keep using it; so, the state frees its blocks itself from now on */
+  luaC_setreleasef(L, NULL, NULL);
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
 }
 
 
+LUA_API lua_Release lua_getreleasef (lua_State *L, void **ud) {
+  lua_Release f;
+  lua_lock(L);
+  if (ud) *ud = G(L)->ud_release;
+  f = G(L)->releasef;
+  lua_unlock(L);
+  return f;
+}
+
+
+LUA_API void lua_setreleasef (lua_State *L, lua_Release f, void *ud) {
+  lua_lock(L);
+  luaC_setreleasef(L, f, ud);
+  lua_unlock(L);
+}
+
+
 void lua_setwarnf (lua_State *L, lua_WarnFunction f, void *ud) {
   lua_lock(L);
   G(L)->ud_warn = ud;
@@ -1353,6 +1692,29 @@ LUA_API void *lua_newuserdatauv (lua_State *L, size_t size, int nuvalue) {
 }
 
 
+LUA_API void *lua_newtypedarray (lua_State *L, int kind, size_t n) {
+  Udata *u;
+  TArray *ta;
+  size_t esize;
+  lua_lock(L);
+  api_check(L, 0 <= kind && kind < LUA_NUMTAKINDS, "invalid kind");
+  esize = tasize(kind);
+  if (l_unlikely(n > (MAX_SIZE - sizeof(TArray)) / esize))
+    luaM_toobig(L);
+  u = luaS_newudata(L, sizeof(TArray) + n * esize, 0);
+  setuvalue(L, s2v(L->top.p), u);
+  api_incr_top(L);
+  u->metatable = G(L)->tamt;
+  ta = cast(TArray *, getudatamem(u));
+  ta->n = n;
+  ta->kind = kind;
+  memset(tadata(ta), 0, n * esize);
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return tadata(ta);
+}
+
+
 
 static const char *aux_upvalue (TValue *fi, int n, TValue **val,
                                 GCObject **owner) {
@@ -1440,7 +1802,7 @@ LUA_API void *lua_upvalueid (lua_State *L, int fidx, int n) {
         return &f->upvalue[n - 1];
       /* else */
     }  /* FALLTHROUGH */
-    case LUA_VLCF:
+    case LUA_VLCF: case LUA_VFCF:
       return NULL;  /* light C functions have no upvalues */
     default: {
       api_check(L, 0, "function expected");
@@ -1461,3 +1823,186 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
 }
 
 
+/*
+** Get execution counts of the interpreter: with 'op' equal to -1, the
+** count of each opcode; otherwise, how many times each opcode ran right
+** after 'op'. 'counts' (if not NULL) must have room for one entry per
+** opcode. Returns the number of opcodes, or 0 when Lua was built
+** without LUAI_VMSTATS.
+*/
+LUA_API int lua_getvmstats (lua_State *L, int op, lua_Unsigned *counts) {
+#if defined(LUAI_VMSTATS)
+  global_State *g = G(L);
+  const lu_mem *src;
+  int i;
+  api_check(L, -1 <= op && op < NUM_OPCODES, "invalid opcode");
+  src = (op < 0) ? g->vmops : g->vmpairs[op];
+  if (counts != NULL) {
+    for (i = 0; i < NUM_OPCODES; i++)
+      counts[i] = cast(lua_Unsigned, src[i]);
+  }
+  return NUM_OPCODES;
+#else
+  UNUSED(L); UNUSED(op); UNUSED(counts);
+  return 0;
+#endif
+}
+
+
+/*
+** Get the hit and miss counts of the inline caches for field accesses.
+** Returns 0 (and zero counts) when Lua was built without LUAI_ICSTATS.
+*/
+LUA_API int lua_icstats (lua_State *L, lua_Unsigned *hits,
+                                       lua_Unsigned *misses) {
+#if defined(LUAI_ICSTATS)
+  global_State *g = G(L);
+  *hits = cast(lua_Unsigned, g->ichits);
+  *misses = cast(lua_Unsigned, g->icmisses);
+  return 1;
+#else
+  UNUSED(L);
+  *hits = *misses = 0;
+  return 0;
+#endif
+}
+
+
+/*
+** Set the key used to scramble and unscramble secure functions in
+** binary chunks (see 'luaU_scramble').
+*/
+LUA_API void lua_setsecurekey (lua_State *L, lua_Unsigned key) {
+  lua_lock(L);
+  G(L)->securekey = cast(l_uint32, key);
+  lua_unlock(L);
+}
+
+
+/*
+** Set the level of the optimizer run over functions compiled from
+** source (0 turns it off); return the previous level.
+*/
+LUA_API int lua_setoptlevel (lua_State *L, int level) {
+  int old;
+  lua_lock(L);
+  old = G(L)->optlevel;
+  G(L)->optlevel = cast_byte((level < 0) ? 0 : (level > 1) ? 1 : level);
+  lua_unlock(L);
+  return old;
+}
+
+
+/*
+** Set the instruction budget of the state: after about 'steps' loop
+** iterations and calls, the running code gets an error. A non-positive
+** 'steps' removes the budget.
+*/
+LUA_API void lua_setbudget (lua_State *L, lua_Integer steps) {
+  global_State *g = G(L);
+  lua_lock(L);
+  if (steps <= 0) {
+    g->budget = MAX_LMEM;
+    g->hasbudget = 0;
+  }
+  else {
+    g->budget = (steps > cast(lua_Integer, MAX_LMEM)) ? MAX_LMEM
+                                                   : cast(l_mem, steps);
+    g->hasbudget = 1;
+  }
+  lua_unlock(L);
+}
+
+
+LUA_API lua_Integer lua_getbudget (lua_State *L) {
+  global_State *g = G(L);
+  if (!g->hasbudget)
+    return -1;
+  return (g->budget < 0) ? 0 : cast(lua_Integer, g->budget);
+}
+
+
+/*
+** Set a limit for the memory in use by the state; allocations beyond
+** it fail as if the system were out of memory. Zero removes the limit.
+*/
+LUA_API void lua_setmemlimit (lua_State *L, size_t limit) {
+  lua_lock(L);
+  G(L)->memlimit = limit;
+  lua_unlock(L);
+}
+
+
+/*
+** Set the accounting context of thread 'L' (and of the threads it will
+** create), returning the previous one. The first call allocates the
+** counters of all contexts, turning accounting on for the state.
+*/
+LUA_API int lua_setmemctx (lua_State *L, int ctx) {
+  global_State *g = G(L);
+  int old;
+  lua_lock(L);
+  api_check(L, 0 <= ctx && ctx < LUA_NUMMEMCTX, "invalid context");
+  if (g->memctx == NULL) {
+    MemCtx *mc = luaM_newvector(L, LUA_NUMMEMCTX, MemCtx);
+    memset(mc, 0, LUA_NUMMEMCTX * sizeof(MemCtx));
+    g->memctx = mc;
+  }
+  old = L->memctx;
+  L->memctx = cast_byte(ctx);
+  lua_unlock(L);
+  return old;
+}
+
+
+LUA_API int lua_getmemctx (lua_State *L) {
+  return L->memctx;
+}
+
+
+/*
+** Get the bytes and the number of allocations charged to context
+** 'ctx'. Returns 0 (and no counts) if accounting is off.
+*/
+LUA_API int lua_memctxstats (lua_State *L, int ctx, lua_Unsigned *bytes,
+                                                    lua_Unsigned *count) {
+  global_State *g = G(L);
+  api_check(L, 0 <= ctx && ctx < LUA_NUMMEMCTX, "invalid context");
+  if (g->memctx == NULL)
+    return 0;
+  if (bytes) *bytes = cast(lua_Unsigned, g->memctx[ctx].bytes);
+  if (count) *count = cast(lua_Unsigned, g->memctx[ctx].count);
+  return 1;
+}
+
+
+/*
+** Call 'f' from inside the allocator after every 'rate' bytes allocated
+** (or so); NULL turns sampling off. 'f' cannot allocate memory, so it
+** cannot use the API except for 'lua_sethook' and 'lua_gethook'.
+*/
+LUA_API void lua_setallocsampler (lua_State *L, lua_AllocSampler f,
+                                                size_t rate) {
+  global_State *g = G(L);
+  lua_lock(L);
+  api_check(L, f == NULL || rate > 0, "invalid sampling rate");
+  if (rate > cast_sizet(MAX_LMEM))
+    rate = cast_sizet(MAX_LMEM);
+  g->allocsampler = f;
+  g->allocrate = g->allocnext = cast(l_mem, rate);
+  lua_unlock(L);
+}
+
+
+/*
+** Tell the VM that 'f' is the function that the intrinsic opcode for
+** 'intr' (one of LUA_INTRFLOOR, ...) computes inline. The opcode runs
+** its computation only when it is about to call 'f'; NULL turns it off.
+*/
+LUA_API void lua_setintrinsic (lua_State *L, int intr, lua_CFunction f) {
+  lua_lock(L);
+  api_check(L, 0 <= intr && intr < LUA_NUMINTRS, "invalid intrinsic");
+  G(L)->intrinsics[intr] = f;
+  lua_unlock(L);
+}
+
@@ -0,0 +1,396 @@
+/*
+** $Id: larraylib.c $
+** Library for typed arrays
+** See Copyright Notice in lua.h
+*/
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A typed array stores its elements unboxed, in one block of memory
+** (see 'lua_newtypedarray'). Indexing an array with an integer inside
+** it is done directly by the virtual machine; this library provides
+** the metamethods for everything else, plus bulk operations written as
+** plain loops over the elements.
+*/
+
+static const char *const kindnames[] = {"float64", "int64", "int32", NULL};
+
+
+/* layout of the element types of each kind */
+typedef lua_Number f64_t;
+typedef lua_Integer i64_t;
+#if ((UINT_MAX >> 30) >= 3)  /* same as 'l_int32' in the core */
+typedef int i32_t;
+#else
+typedef long i32_t;
+#endif
+
+
+typedef struct Array {
+  void *data;
+  size_t n;
+  int kind;
+} Array;
+
+
+#define F64(a)		((f64_t *)(a)->data)
+#define I64(a)		((i64_t *)(a)->data)
+#define I32(a)		((i32_t *)(a)->data)
+
+
+/* integer arithmetic wraps around, as in Lua */
+#define wrapop(op,v1,v2)  \
+	((lua_Integer)((lua_Unsigned)(v1) op (lua_Unsigned)(v2)))
+
+
+static Array checkarray (lua_State *L, int arg) {
+  Array a;
+  a.data = lua_totypedarray(L, arg, &a.kind, &a.n);
+  luaL_argexpected(L, a.data != NULL, arg, "array");
+  return a;
+}
+
+
+static lua_Number elemnum (const Array *a, size_t i) {
+  switch (a->kind) {
+    case LUA_TAF64: return F64(a)[i];
+    case LUA_TAI64: return (lua_Number)I64(a)[i];
+    default: return (lua_Number)I32(a)[i];
+  }
+}
+
+
+static lua_Integer elemint (const Array *a, size_t i) {
+  return (a->kind == LUA_TAI64) ? I64(a)[i] : (lua_Integer)I32(a)[i];
+}
+
+
+static void pushelem (lua_State *L, const Array *a, size_t i) {
+  if (a->kind == LUA_TAF64)
+    lua_pushnumber(L, F64(a)[i]);
+  else
+    lua_pushinteger(L, elemint(a, i));
+}
+
+
+/*
+** Store the value at stack index 'idx' into element 'i' of 'a',
+** raising an error if it does not fit.
+*/
+static void setelem (lua_State *L, const Array *a, size_t i, int idx) {
+  if (lua_type(L, idx) != LUA_TNUMBER)
+    luaL_error(L, "number expected, got %s", luaL_typename(L, idx));
+  if (a->kind == LUA_TAF64)
+    F64(a)[i] = lua_tonumber(L, idx);
+  else {
+    int isint;
+    lua_Integer v = lua_tointegerx(L, idx, &isint);
+    if (!isint)
+      luaL_error(L, "number has no integer representation");
+    if (a->kind == LUA_TAI64)
+      I64(a)[i] = v;
+    else if ((lua_Unsigned)v + 0x80000000u <= 0xFFFFFFFFu)
+      I32(a)[i] = (i32_t)v;
+    else
+      luaL_error(L, "value out of range for an int32 array");
+  }
+}
+
+
+/*
+** index of element 'k' in an array of size 'n', or 'n' if 'k' is not
+** an integer inside the array
+*/
+static size_t checkindex (lua_State *L, int idx, size_t n) {
+  int isint;
+  lua_Integer k = lua_tointegerx(L, idx, &isint);
+  if (lua_type(L, idx) == LUA_TNUMBER && isint &&
+      (lua_Unsigned)k - 1u < (lua_Unsigned)n)
+    return (size_t)(k - 1);
+  return n;
+}
+
+
+/*
+** array.new(kind, n | list)
+*/
+static int arr_new (lua_State *L) {
+  int kind = luaL_checkoption(L, 1, NULL, kindnames);
+  Array a;
+  a.kind = kind;
+  if (lua_istable(L, 2)) {
+    size_t i;
+    a.n = (size_t)luaL_len(L, 2);
+    a.data = lua_newtypedarray(L, kind, a.n);
+    for (i = 0; i < a.n; i++) {
+      lua_geti(L, 2, (lua_Integer)i + 1);
+      setelem(L, &a, i, -1);
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    lua_Integer n = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n >= 0, 2, "invalid size");
+    a.n = (size_t)n;
+    a.data = lua_newtypedarray(L, kind, a.n);
+  }
+  return 1;
+}
+
+
+/*
+** Reads that the virtual machine did not do itself: method names,
+** indices out of the array, and non-integer keys.
+*/
+static int arr_index (lua_State *L) {
+  Array a = checkarray(L, 1);
+  size_t i;
+  if (lua_type(L, 2) == LUA_TSTRING) {
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));  /* method */
+    return 1;
+  }
+  i = checkindex(L, 2, a.n);
+  if (i == a.n)
+    lua_pushnil(L);
+  else
+    pushelem(L, &a, i);
+  return 1;
+}
+
+
+static int arr_newindex (lua_State *L) {
+  Array a = checkarray(L, 1);
+  size_t i = checkindex(L, 2, a.n);
+  if (i == a.n)
+    return luaL_error(L, "index out of range");
+  setelem(L, &a, i, 3);
+  return 0;
+}
+
+
+static int arr_len (lua_State *L) {
+  Array a = checkarray(L, 1);
+  lua_pushinteger(L, (lua_Integer)a.n);
+  return 1;
+}
+
+
+static int arr_tostring (lua_State *L) {
+  Array a = checkarray(L, 1);
+  lua_pushfstring(L, "%s array (%I): %p", kindnames[a.kind],
+                     (lua_Integer)a.n, a.data);
+  return 1;
+}
+
+
+static int arr_kind (lua_State *L) {
+  Array a = checkarray(L, 1);
+  lua_pushstring(L, kindnames[a.kind]);
+  return 1;
+}
+
+
+/*
+** Float sums use four partial sums, so that the loop does not wait on
+** each addition; the order of the additions is thus unspecified.
+*/
+static lua_Number sumf64 (const f64_t *x, size_t n) {
+  lua_Number s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i;
+  for (i = 0; i + 4 <= n; i += 4) {
+    s0 += x[i]; s1 += x[i + 1]; s2 += x[i + 2]; s3 += x[i + 3];
+  }
+  for (; i < n; i++)
+    s0 += x[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+
+static int arr_sum (lua_State *L) {
+  Array a = checkarray(L, 1);
+  size_t i;
+  if (a.kind == LUA_TAF64)
+    lua_pushnumber(L, sumf64(F64(&a), a.n));
+  else {
+    lua_Unsigned s = 0;
+    if (a.kind == LUA_TAI64) {
+      const i64_t *x = I64(&a);
+      for (i = 0; i < a.n; i++) s += (lua_Unsigned)x[i];
+    }
+    else {
+      const i32_t *x = I32(&a);
+      for (i = 0; i < a.n; i++) s += (lua_Unsigned)x[i];
+    }
+    lua_pushinteger(L, (lua_Integer)s);
+  }
+  return 1;
+}
+
+
+/*
+** a:dot(b): a float if any of them holds floats, an integer otherwise
+*/
+static int arr_dot (lua_State *L) {
+  Array a = checkarray(L, 1);
+  Array b = checkarray(L, 2);
+  size_t i;
+  luaL_argcheck(L, a.n == b.n, 2, "arrays have different sizes");
+  if (a.kind == LUA_TAF64 && b.kind == LUA_TAF64) {
+    const f64_t *x = F64(&a), *y = F64(&b);
+    lua_Number s0 = 0, s1 = 0;
+    for (i = 0; i + 2 <= a.n; i += 2) {
+      s0 += x[i] * y[i]; s1 += x[i + 1] * y[i + 1];
+    }
+    if (i < a.n)
+      s0 += x[i] * y[i];
+    lua_pushnumber(L, s0 + s1);
+  }
+  else if (a.kind == LUA_TAF64 || b.kind == LUA_TAF64) {
+    lua_Number s = 0;
+    for (i = 0; i < a.n; i++)
+      s += elemnum(&a, i) * elemnum(&b, i);
+    lua_pushnumber(L, s);
+  }
+  else {
+    lua_Integer s = 0;
+    for (i = 0; i < a.n; i++)
+      s = wrapop(+, s, wrapop(*, elemint(&a, i), elemint(&b, i)));
+    lua_pushinteger(L, s);
+  }
+  return 1;
+}
+
+
+/*
+** a:scale(x): multiply all elements by 'x' in place (an integer for
+** integer arrays, whose elements wrap around)
+*/
+static int arr_scale (lua_State *L) {
+  Array a = checkarray(L, 1);
+  size_t i;
+  if (a.kind == LUA_TAF64) {
+    lua_Number x = luaL_checknumber(L, 2);
+    f64_t *e = F64(&a);
+    for (i = 0; i < a.n; i++) e[i] *= x;
+  }
+  else {
+    lua_Integer x = luaL_checkinteger(L, 2);
+    if (a.kind == LUA_TAI64) {
+      i64_t *e = I64(&a);
+      for (i = 0; i < a.n; i++) e[i] = wrapop(*, e[i], x);
+    }
+    else {
+      i32_t *e = I32(&a);
+      for (i = 0; i < a.n; i++)  /* keep the low 32 bits */
+        e[i] = (i32_t)((lua_Unsigned)e[i] * (lua_Unsigned)x);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_fill (lua_State *L) {
+  Array a = checkarray(L, 1);
+  size_t i;
+  if (a.n > 0) {
+    setelem(L, &a, 0, 2);
+    if (a.kind == LUA_TAF64)
+      for (i = 1; i < a.n; i++) F64(&a)[i] = F64(&a)[0];
+    else if (a.kind == LUA_TAI64)
+      for (i = 1; i < a.n; i++) I64(&a)[i] = I64(&a)[0];
+    else
+      for (i = 1; i < a.n; i++) I32(&a)[i] = I32(&a)[0];
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** a:map(f): new array of the same kind with f(a[i]) for each element
+*/
+static int arr_map (lua_State *L) {
+  Array a = checkarray(L, 1);
+  Array r;
+  size_t i;
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  r.kind = a.kind;
+  r.n = a.n;
+  r.data = lua_newtypedarray(L, r.kind, r.n);
+  for (i = 0; i < a.n; i++) {
+    lua_pushvalue(L, 2);
+    pushelem(L, &a, i);
+    lua_call(L, 1, 1);
+    setelem(L, &r, i, -1);
+    lua_pop(L, 1);
+  }
+  return 1;
+}
+
+
+static int arr_totable (lua_State *L) {
+  Array a = checkarray(L, 1);
+  size_t i;
+  luaL_argcheck(L, a.n < (size_t)(~0u >> 1), 1, "array too big");
+  lua_createtable(L, (int)a.n, 0);
+  for (i = 0; i < a.n; i++) {
+    pushelem(L, &a, i);
+    lua_rawseti(L, -2, (lua_Integer)i + 1);
+  }
+  return 1;
+}
+
+
+static const luaL_Reg arr_funcs[] = {
+  {"new", arr_new},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg arr_methods[] = {
+  {"dot", arr_dot},
+  {"fill", arr_fill},
+  {"kind", arr_kind},
+  {"map", arr_map},
+  {"scale", arr_scale},
+  {"sum", arr_sum},
+  {"totable", arr_totable},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg arr_meta[] = {
+  {"__index", arr_index},
+  {"__newindex", arr_newindex},
+  {"__len", arr_len},
+  {"__tostring", arr_tostring},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_array (lua_State *L) {
+  luaL_newlib(L, arr_funcs);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_TYPEDARRAY);
+  luaL_newlib(L, arr_methods);  /* upvalue for '__index' */
+  luaL_setfuncs(L, arr_meta, 1);
+  lua_pushliteral(L, "array");
+  lua_setfield(L, -2, "__name");
+  lua_pop(L, 1);  /* metatable */
+  return 1;
+}
+
@@ -27,6 +27,16 @@
 #include "lauxlib.h"
 
 
+/* background release of dead objects (see 'luaL_bgsweep') needs threads */
+#if !defined(LUAI_BGSWEEP) && defined(LUA_USE_POSIX) && !defined(__wasm__)
+#define LUAI_BGSWEEP
+#endif
+
+#if defined(LUAI_BGSWEEP)
+#include <pthread.h>
+#endif
+
+
 #if !defined(MAX_SIZET)
 /* maximum value for size_t */
 #define MAX_SIZET	((size_t)(~(size_t)0))
@@ -781,27 +791,233 @@ static int skipcomment (FILE *f, int *cp) {
 }
 
 
+/*
+** {======================================================
+** Bytecode cache
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+** With a directory in 'package.cachedir', 'luaL_loadfilex' keeps there
+** the compiled chunks of the text files it loads, so that the next
+** load of an unchanged file skips the parser. A cached file, named
+** after a hash of the file name, has a header with the identity of
+** the source file when it was compiled (device, inode, size, and
+** modification and change times) and its name, followed by its chunk
+** as written by 'lua_dump' (so that secure functions stay encrypted).
+** A header that does not match the source file, or a chunk that does
+** not load (e.g., from another version of Lua), is a miss: the source
+** is parsed and its entry written again, into a temporary file that is
+** then renamed over the old entry, so that a concurrent reader sees
+** either one entirely. Anyone who can write into that directory can
+** make Lua run any bytecode, so it should be private. As entries are
+** loaded as binary chunks, the cache is used only when the mode allows
+** both kinds of chunks.
+*/
+
+#define CACHE_SIGNATURE	"\x1b" "Lch" LUA_VERSION_MAJOR LUA_VERSION_MINOR
+
+
+/*
+** 'l_mtimensec' and 'l_ctimensec' give the nanoseconds of the file
+** times, so that a change within the same second is not missed. Where
+** 'st_mtime' is a macro, the times are 'struct timespec' fields (POSIX
+** 2008); XSI systems before that (as glibc and macOS with the
+** '_XOPEN_SOURCE' of 'lprefix.h') have separate fields. Elsewhere, the
+** times are compared in whole seconds.
+*/
+#if !defined(l_mtimensec)	/* { */
+#if defined(st_mtime) && defined(__APPLE__)
+#define l_mtimensec(st)		((st).st_mtimespec.tv_nsec)
+#define l_ctimensec(st)		((st).st_ctimespec.tv_nsec)
+#elif defined(st_mtime)
+#define l_mtimensec(st)		((st).st_mtim.tv_nsec)
+#define l_ctimensec(st)		((st).st_ctim.tv_nsec)
+#elif defined(__GLIBC__) || defined(__APPLE__)
+#define l_mtimensec(st)		((st).st_mtimensec)
+#define l_ctimensec(st)		((st).st_ctimensec)
+#else
+#define l_mtimensec(st)		0
+#define l_ctimensec(st)		0
+#endif
+#endif				/* } */
+
+
+typedef struct CacheHeader {
+  char signature[sizeof(CACHE_SIGNATURE)];
+  lua_Unsigned dev, ino, size, mtime, ctime, mtimensec, ctimensec;
+  size_t lname;  /* length of the file name, which follows the header */
+} CacheHeader;
+
+
+/*
+** Push the name of the cache entry for 'filename' and fill 'h' with the
+** header it must have; return 0 (pushing nothing) if there is no cache
+** or 'filename' is not a regular file.
+*/
+static int cacheentry (lua_State *L, const char *filename, CacheHeader *h) {
+  struct stat st;
+  const char *dir;
+  char hex[17];
+  lua_Unsigned hash = 0xcbf29ce484222325u;  /* FNV-1a */
+  const char *s;
+  int top = lua_gettop(L);
+  int i;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE) != LUA_TTABLE ||
+      lua_getfield(L, -1, "package") != LUA_TTABLE ||
+      lua_getfield(L, -1, "cachedir") != LUA_TSTRING ||
+      strlen(filename) > BUFSIZ ||  /* (see 'loadcached') */
+      stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) {
+    lua_settop(L, top);  /* remove everything pushed */
+    return 0;
+  }
+  dir = lua_tostring(L, -1);
+  for (s = filename; *s != '\0'; s++)
+    hash = (hash ^ (unsigned char)*s) * 0x100000001b3u;
+  for (i = 15; i >= 0; i--, hash >>= 4)
+    hex[i] = "0123456789abcdef"[hash & 0xf];
+  hex[16] = '\0';
+  lua_pushfstring(L, "%s/%s.luac", dir, hex);
+  lua_replace(L, top + 1);
+  lua_settop(L, top + 1);  /* keep only the entry name */
+  memset(h, 0, sizeof(CacheHeader));  /* (also its padding) */
+  memcpy(h->signature, CACHE_SIGNATURE, sizeof(CACHE_SIGNATURE));
+  h->dev = (lua_Unsigned)st.st_dev;
+  h->ino = (lua_Unsigned)st.st_ino;
+  h->size = (lua_Unsigned)st.st_size;
+  h->mtime = (lua_Unsigned)st.st_mtime;
+  h->ctime = (lua_Unsigned)st.st_ctime;
+  h->mtimensec = (lua_Unsigned)l_mtimensec(st);
+  h->ctimensec = (lua_Unsigned)l_ctimensec(st);
+  h->lname = strlen(filename);
+  return 1;
+}
+
+
+/*
+** Load the chunk in the cache entry named at the top of the stack, if
+** its header is 'h'; return whether it did (leaving the function at the
+** top of the stack).
+*/
+static int loadcached (lua_State *L, LoadF *lf, const char *filename,
+                       const CacheHeader *h, int fnameindex) {
+  CacheHeader ch;
+  int ok = 0;
+  lf->f = fopen(lua_tostring(L, -1), "rb");
+  if (lf->f == NULL)
+    return 0;
+  if (fread(&ch, sizeof(ch), 1, lf->f) == 1 &&
+      memcmp(&ch, h, sizeof(ch)) == 0 &&
+      fread(lf->buff, 1, h->lname, lf->f) == h->lname &&
+      memcmp(lf->buff, filename, h->lname) == 0) {
+    lf->n = 0;
+    ok = (lua_load(L, getF, lf, lua_tostring(L, fnameindex), "b") == LUA_OK
+          && !ferror(lf->f));
+    if (!ok)
+      lua_pop(L, 1);  /* remove error message (or function) */
+  }
+  fclose(lf->f);
+  return ok;
+}
+
+
+static int cachewriter (lua_State *L, const void *p, size_t size,
+                                      void *f) {
+  (void)L;
+  return (size != 0 && fwrite(p, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** Write the function at the top of the stack to the cache entry named
+** just below it, with header 'h'. Errors only mean that the entry is
+** not written.
+*/
+static void storecached (lua_State *L, const char *filename,
+                         const CacheHeader *h) {
+  const char *entry = lua_tostring(L, -2);
+  const char *tmp = lua_pushfstring(L, "%s.%d.%p", entry, (int)getpid(),
+                                               (void *)L);
+  FILE *f = fopen(tmp, "wb");
+  int ok;
+  if (f == NULL && errno == ENOENT) {  /* no cache directory yet? */
+    lua_pushlstring(L, entry, strrchr(entry, '/') - entry);
+    mkdir(lua_tostring(L, -1), 0700);
+    lua_pop(L, 1);
+    f = fopen(tmp, "wb");
+  }
+  if (f == NULL) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pushvalue(L, -2);  /* function to be dumped */
+  ok = (fwrite(h, sizeof(CacheHeader), 1, f) == 1 &&
+        fwrite(filename, 1, h->lname, f) == h->lname &&
+        lua_dump(L, cachewriter, f, 0) == 0);
+  lua_pop(L, 1);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp, entry) != 0)
+    remove(tmp);
+  lua_pop(L, 1);  /* remove 'tmp' */
+}
+
+#else				/* }{ */
+
+typedef struct CacheHeader { size_t lname; } CacheHeader;
+
+#define cacheentry(L,filename,h)	((void)(filename), (void)(h), 0)
+#define loadcached(L,lf,filename,h,idx)	((void)(lf), (void)(h), 0)
+#define storecached(L,filename,h)	((void)(h))
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
   int status, readstatus;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+  int cached = 0;  /* has a cache entry? */
+  CacheHeader ch;
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
     lf.f = stdin;
   }
   else {
     lua_pushfstring(L, "@%s", filename);
+    if ((mode == NULL ||
+         (strchr(mode, 't') != NULL && strchr(mode, 'b') != NULL)) &&
+        (cached = cacheentry(L, filename, &ch)) != 0) {
+      if (loadcached(L, &lf, filename, &ch, fnameindex)) {  /* hit? */
+        lua_replace(L, fnameindex);  /* function replaces the name */
+        lua_settop(L, fnameindex);
+        return LUA_OK;
+      }
+    }
     errno = 0;
     lf.f = fopen(filename, "r");
-    if (lf.f == NULL) return errfile(L, "open", fnameindex);
+    if (lf.f == NULL) {
+      lua_settop(L, fnameindex);  /* remove name of a cache entry */
+      return errfile(L, "open", fnameindex);
+    }
   }
   lf.n = 0;
   if (skipcomment(lf.f, &c))  /* read initial portion */
     lf.buff[lf.n++] = '\n';  /* add newline to correct line numbers */
   if (c == LUA_SIGNATURE[0]) {  /* binary file? */
     lf.n = 0;  /* remove possible newline */
+    if (cached) {  /* no cache for a compiled file */
+      lua_settop(L, fnameindex);  /* remove name of the cache entry */
+      cached = 0;
+    }
     if (filename) {  /* "real" file? */
       errno = 0;
       lf.f = freopen(filename, "rb", lf.f);  /* reopen in binary mode */
@@ -812,13 +1028,18 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
   if (c != EOF)
     lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
   errno = 0;
-  status = lua_load(L, getF, &lf, lua_tostring(L, -1), mode);
+  status = lua_load(L, getF, &lf, lua_tostring(L, fnameindex), mode);
   readstatus = ferror(lf.f);
   if (filename) fclose(lf.f);  /* close file (even in case of errors) */
   if (readstatus) {
     lua_settop(L, fnameindex);  /* ignore results from 'lua_load' */
     return errfile(L, "read", fnameindex);
   }
+  if (cached) {
+    if (status == LUA_OK)
+      storecached(L, filename, &ch);
+    lua_remove(L, fnameindex + 1);  /* remove name of the cache entry */
+  }
   lua_remove(L, fnameindex);
   return status;
 }
@@ -956,6 +1177,21 @@ LUALIB_API void luaL_setfuncs (lua_State *L, const luaL_Reg *l, int nup) {
 }
 
 
+/*
+** set functions from list 'l' into table at top as fast C functions
+** (see 'lua_pushfastcfunction'), for functions that do not yield.
+*/
+LUALIB_API void luaL_setfastfuncs (lua_State *L, const luaL_Reg *l) {
+  for (; l->name != NULL; l++) {  /* fill the table with given functions */
+    if (l->func == NULL)  /* placeholder? */
+      lua_pushboolean(L, 0);
+    else
+      lua_pushfastcfunction(L, l->func);
+    lua_setfield(L, -2, l->name);
+  }
+}
+
+
 /*
 ** ensure that stack[idx][fname] has a table and push that table
 ** into the stack
@@ -1115,6 +1351,767 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+/*
+** {======================================================
+** Pool allocator
+** =======================================================
+*/
+
+/*
+** Small blocks (most GC objects: tables, closures, upvalues, short
+** strings, small node arrays) come from size classes with free lists,
+** carved from large chunks; bigger blocks go to 'realloc'. Freed small
+** blocks go back to their lists, and all chunks are released at once
+** when the last block of the state is freed (at the end of 'lua_close').
+*/
+
+#define POOLGRAIN	16	/* granularity of size classes */
+#define POOLCLASSES	16	/* classes for sizes up to 16 * 16 bytes */
+#define POOLCHUNK	(64 * 1024)	/* size of a chunk */
+
+#define sizeclass(sz)	(((sz) - 1) / POOLGRAIN)  /* class of a small size */
+#define issmall(sz)	((sz) <= POOLGRAIN * POOLCLASSES)
+
+
+typedef union PoolBlock {
+  union PoolBlock *next;  /* next free block in its class */
+  LUAI_MAXALIGN;  /* ensure maximum alignment for blocks */
+} PoolBlock;
+
+
+typedef struct PoolChunk {
+  struct PoolChunk *previous;
+  PoolBlock mem[1];  /* start of allocatable memory */
+} PoolChunk;
+
+
+typedef struct PoolClass {
+  PoolBlock *free;  /* list of free blocks */
+  size_t allocs;  /* total number of allocations */
+  size_t inuse;  /* blocks currently in use */
+  size_t nfree;  /* blocks in the free list */
+} PoolClass;
+
+
+typedef struct Pool {
+  PoolClass classes[POOLCLASSES];
+  PoolChunk *chunks;  /* list of chunks */
+  char *avail;  /* unused memory in the current chunk */
+  size_t navail;  /* size of 'avail' */
+  size_t nchunks;  /* number of chunks */
+  size_t large;  /* large blocks currently in use */
+  size_t live;  /* blocks currently in use (small and large) */
+} Pool;
+
+
+static void pool_release (Pool *p) {
+  PoolChunk *c = p->chunks;
+  while (c != NULL) {
+    PoolChunk *previous = c->previous;
+    free(c);
+    c = previous;
+  }
+  free(p);
+}
+
+
+static void *pool_getsmall (Pool *p, size_t nsize) {
+  size_t sz = (sizeclass(nsize) + 1) * POOLGRAIN;
+  PoolClass *pc = &p->classes[sizeclass(nsize)];
+  PoolBlock *b = pc->free;
+  if (b != NULL) {  /* reuse a free block? */
+    pc->free = b->next;
+    pc->nfree--;
+  }
+  else {
+    if (p->navail < sz) {  /* no room in current chunk? */
+      PoolChunk *c = (PoolChunk *)malloc(POOLCHUNK);
+      if (c == NULL)
+        return NULL;
+      c->previous = p->chunks;
+      p->chunks = c;
+      p->nchunks++;
+      p->avail = (char *)c->mem;  /* rest of old chunk is wasted */
+      p->navail = POOLCHUNK - offsetof(PoolChunk, mem);
+    }
+    b = (PoolBlock *)p->avail;
+    p->avail += sz;
+    p->navail -= sz;
+  }
+  pc->allocs++;
+  pc->inuse++;
+  return b;
+}
+
+
+static void pool_putsmall (Pool *p, void *ptr, size_t osize) {
+  PoolClass *pc = &p->classes[sizeclass(osize)];
+  PoolBlock *b = (PoolBlock *)ptr;
+  b->next = pc->free;
+  pc->free = b;
+  pc->nfree++;
+  pc->inuse--;
+}
+
+
+static void *pool_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *nptr;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' may be a type tag */
+  if (nsize == 0) {  /* free block? */
+    if (ptr == NULL)
+      return NULL;
+    if (issmall(osize))
+      pool_putsmall(p, ptr, osize);
+    else {
+      free(ptr);
+      p->large--;
+    }
+    if (--p->live == 0)  /* state closed? */
+      pool_release(p);
+    return NULL;
+  }
+  else if (ptr != NULL && issmall(osize) && issmall(nsize) &&
+           sizeclass(osize) == sizeclass(nsize))
+    return ptr;  /* same class; nothing to be done */
+  else if (ptr != NULL && !issmall(osize) && !issmall(nsize))
+    return realloc(ptr, nsize);  /* large to large */
+  if (issmall(nsize))
+    nptr = pool_getsmall(p, nsize);
+  else {
+    nptr = malloc(nsize);
+    if (nptr != NULL)
+      p->large++;
+  }
+  if (nptr == NULL) {
+    if (p->live == 0)  /* state could not be created? */
+      pool_release(p);
+    return NULL;
+  }
+  if (ptr == NULL)
+    p->live++;
+  else {  /* move block to another class (or to/from a large block) */
+    memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+    if (issmall(osize))
+      pool_putsmall(p, ptr, osize);
+    else {
+      free(ptr);
+      p->large--;
+    }
+  }
+  return nptr;
+}
+
+
+/*
+** Create a state that uses the pool allocator; the pool belongs to the
+** state and is released by 'lua_close'.
+*/
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  lua_State *L;
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  if (p == NULL)
+    return NULL;
+  memset(p, 0, sizeof(Pool));
+  L = lua_newstate(pool_alloc, p);  /* if it fails, 'p' is already freed */
+  if (l_likely(L)) {
+    lua_atpanic(L, &panic);
+    lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
+  }
+  return L;
+}
+
+
+/*
+** Push a table with statistics about the pool of state 'L': one entry
+** per size class (fields 'size', 'allocs', 'inuse', and 'free') plus
+** fields 'chunks' and 'large'. Return 0 (pushing nothing) if 'L' does
+** not use the pool allocator.
+*/
+LUALIB_API int luaL_poolstats (lua_State *L) {
+  void *ud;
+  Pool *p;
+  int i;
+  if (lua_getallocf(L, &ud) != pool_alloc)
+    return 0;
+  p = (Pool *)ud;
+  lua_createtable(L, POOLCLASSES, 2);
+  for (i = 0; i < POOLCLASSES; i++) {
+    PoolClass *pc = &p->classes[i];
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, (i + 1) * POOLGRAIN);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, (lua_Integer)pc->allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_pushinteger(L, (lua_Integer)pc->inuse);
+    lua_setfield(L, -2, "inuse");
+    lua_pushinteger(L, (lua_Integer)pc->nfree);
+    lua_setfield(L, -2, "free");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushinteger(L, (lua_Integer)p->nchunks);
+  lua_setfield(L, -2, "chunks");
+  lua_pushinteger(L, (lua_Integer)p->large);
+  lua_setfield(L, -2, "large");
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Sandboxes
+** =======================================================
+*/
+
+/*
+** A state with its libraries (and any preloaded modules) already set
+** works as a template: a sandbox is a thread of that state with its own
+** global table, so creating one costs a thread and a few tables, and
+** the template's strings, functions, and compiled code are shared. The
+** sandbox global table is a copy of the template one, where each table
+** is itself copied (shallowly), so that a sandbox never changes the
+** template library tables it sees through its globals. The package
+** library gets its own 'loaded', 'preload', and 'searchers' tables, and
+** 'require' loads modules into the sandbox (see 'sandbox_require').
+** What a state cannot have once per sandbox, as the metatable for
+** strings, is frozen when a sandbox is created (see 'sandbox_seal');
+** frozen tables cannot change, so sandboxes share them instead of
+** copying. (The debug library reaches everything, so a sandbox that
+** should be isolated must not have it.)
+*/
+
+#define SANDBOXES	"_SANDBOXES"	/* registry key for sandbox table */
+
+
+/*
+** Push a shallow copy of the table at index 'idx' (with the same
+** metatable).
+*/
+static void sandbox_copy (lua_State *L, int idx) {
+  int n = 0;
+  idx = lua_absindex(L, idx);
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {  /* count fields */
+    lua_pop(L, 1);
+    n++;
+  }
+  lua_createtable(L, 0, n);
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {  /* copy all fields */
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, -4);
+  }
+  if (lua_getmetatable(L, idx))
+    lua_setmetatable(L, -2);
+}
+
+
+/*
+** Replace the value on the top of the stack by its sandbox version:
+** a table that is not frozen is copied only once, as 'copies' (at
+** index 'copies') maps each template table to its copy.
+*/
+static void sandbox_value (lua_State *L, int copies) {
+  if (lua_type(L, -1) == LUA_TTABLE && !lua_isfrozen(L, -1)) {
+    lua_pushvalue(L, -1);
+    if (lua_rawget(L, copies) != LUA_TNIL)  /* already copied? */
+      lua_remove(L, -2);  /* replace table by its copy */
+    else {
+      lua_pop(L, 1);  /* nil */
+      sandbox_copy(L, -1);
+      lua_pushvalue(L, -2);
+      lua_pushvalue(L, -2);
+      lua_rawset(L, copies);  /* copies[table] = copy */
+      lua_remove(L, -2);  /* replace table by its copy */
+    }
+  }
+}
+
+
+/*
+** Replace each field of the table at index 'idx' by its sandbox version.
+*/
+static void sandbox_fields (lua_State *L, int idx, int copies) {
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    sandbox_value(L, copies);
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, idx);  /* change of an existing field keeps 'next' valid */
+  }
+}
+
+
+/*
+** Freeze the metatable on the top of the stack and the table at its
+** '__index' field, if any, and pop it.
+*/
+static void sandbox_freeze (lua_State *L) {
+  lua_pushliteral(L, "__index");
+  if (lua_rawget(L, -2) == LUA_TTABLE)
+    lua_freeze(L, -1);
+  lua_pop(L, 1);
+  lua_freeze(L, -1);
+  lua_pop(L, 1);
+}
+
+
+/*
+** If the function on the top of the stack is a C closure whose only
+** upvalue is the template 'package' table (at index 'tpkg'), as all
+** the functions of the package library are, replace it by the same
+** function with the sandbox 'package' table (at index 'pkg') instead.
+*/
+static void sandbox_rebind (lua_State *L, int tpkg, int pkg) {
+  lua_CFunction f = lua_tocfunction(L, -1);
+  if (f != NULL && lua_getupvalue(L, -1, 1) != NULL) {
+    int own = lua_rawequal(L, -1, tpkg);
+    lua_pop(L, 1);
+    if (own && lua_getupvalue(L, -1, 2) != NULL) {  /* more upvalues? */
+      lua_pop(L, 1);
+      own = 0;
+    }
+    if (own) {
+      lua_pop(L, 1);
+      lua_pushvalue(L, pkg);
+      lua_pushcclosure(L, f, 1);
+    }
+  }
+}
+
+
+/*
+** 'require' for sandboxes: calls the sandbox 'require' (upvalue 1) with
+** its 'loaded', 'preload', and global tables (upvalues 2-4) in place of
+** the template ones in the registry, so that modules load into the
+** sandbox and run with its globals.
+*/
+static int sandbox_require (lua_State *L) {
+  int status;
+  lua_settop(L, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);  /* 2 */
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);  /* 3 */
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);  /* 4 */
+  lua_pushvalue(L, lua_upvalueindex(2));
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+  lua_pushvalue(L, lua_upvalueindex(3));
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  lua_pushvalue(L, lua_upvalueindex(4));
+  lua_rawseti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_pushvalue(L, 1);
+  status = lua_pcall(L, 1, 2, 0);
+  lua_pushvalue(L, 2);  /* restore the template tables */
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+  lua_pushvalue(L, 3);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  lua_pushvalue(L, 4);
+  lua_rawseti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+  if (status != LUA_OK)
+    return lua_error(L);  /* error message is on the top */
+  return 2;
+}
+
+
+/*
+** Freeze what all sandboxes of template 'L' share: the metatables for
+** whole types (as the one for strings, whose '__index' is the string
+** library), the one for typed arrays, and the metatables for userdata
+** that libraries keep in the registry (named after their key). The
+** template's libraries not open yet are opened first, as opening them
+** may create such metatables. After that, neither the template nor
+** its sandboxes can change these tables.
+*/
+static void sandbox_seal (lua_State *L) {
+  int i;
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {  /* open lazy libraries */
+    if (luaL_getmetafield(L, -1, "__pairs") != LUA_TNIL) {
+      lua_pushvalue(L, -2);
+      lua_call(L, 1, 0);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);  /* LOADED table */
+  lua_pushnil(L);
+  lua_pushboolean(L, 0);
+  lua_pushlightuserdata(L, NULL);
+  lua_pushinteger(L, 0);
+  lua_pushliteral(L, "");
+  lua_pushcfunction(L, sandbox_require);
+  lua_pushthread(L);
+  for (i = 0; i < 7; i++) {  /* one value of each type with a metatable */
+    if (lua_getmetatable(L, -1 - i))
+      sandbox_freeze(L);
+  }
+  lua_pop(L, 7);
+  if (lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_TYPEDARRAY) == LUA_TTABLE)
+    sandbox_freeze(L);
+  else
+    lua_pop(L, 1);
+  lua_pushnil(L);
+  while (lua_next(L, LUA_REGISTRYINDEX)) {  /* userdata metatables */
+    if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TTABLE) {
+      lua_pushliteral(L, "__name");
+      lua_rawget(L, -2);
+      if (lua_rawequal(L, -1, -3)) {  /* from 'luaL_newmetatable'? */
+        lua_pop(L, 1);  /* name */
+        sandbox_freeze(L);
+        continue;
+      }
+      lua_pop(L, 1);  /* name */
+    }
+    lua_pop(L, 1);  /* value */
+  }
+}
+
+
+/*
+** Give the sandbox with global table at index 'g' its own package
+** library: the copy of 'package' gets copies of its tables, 'loaded'
+** maps each library to the sandbox's version of it, and the functions
+** of the library work on the sandbox 'package'.
+*/
+static void sandbox_package (lua_State *L, int g, int copies) {
+  int tpkg = lua_gettop(L) + 1;
+  int pkg = tpkg + 1;
+  lua_getglobal(L, "package");
+  lua_getfield(L, g, "package");
+  if (!lua_istable(L, tpkg) || !lua_istable(L, pkg) ||
+      lua_rawequal(L, tpkg, pkg)) {  /* no package library to copy? */
+    lua_pop(L, 2);
+    return;
+  }
+  sandbox_fields(L, pkg, copies);  /* copy 'loaded', 'searchers', etc. */
+  if (lua_getfield(L, pkg, "loaded") == LUA_TTABLE)
+    sandbox_fields(L, lua_gettop(L), copies);  /* sandbox libraries */
+  lua_getfield(L, pkg, "preload");
+  lua_pushnil(L);
+  while (lua_next(L, pkg)) {  /* rebind package functions */
+    sandbox_rebind(L, tpkg, pkg);
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, pkg);
+  }
+  if (lua_getfield(L, pkg, "searchers") == LUA_TTABLE) {
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      sandbox_rebind(L, tpkg, pkg);
+      lua_pushvalue(L, -2);
+      lua_insert(L, -2);
+      lua_rawset(L, -4);
+    }
+  }
+  lua_pop(L, 1);  /* searchers */
+  if (lua_getfield(L, g, "require") != LUA_TFUNCTION)
+    lua_pop(L, 3);  /* require, preload, loaded */
+  else {
+    sandbox_rebind(L, tpkg, pkg);
+    lua_insert(L, -3);  /* require, loaded, preload */
+    lua_pushvalue(L, g);
+    lua_pushcclosure(L, sandbox_require, 4);
+    lua_setfield(L, g, "require");
+  }
+  lua_pop(L, 2);  /* package tables */
+}
+
+
+/*
+** 'load' for sandboxes: without an explicit environment, chunks get
+** the sandbox global table (upvalue 2) instead of the template one.
+*/
+static int sandbox_load (lua_State *L) {
+  if (lua_gettop(L) < 4) {
+    lua_settop(L, 3);
+    lua_pushvalue(L, lua_upvalueindex(2));
+  }
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 1);
+  lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+  return lua_gettop(L);
+}
+
+
+static int sandbox_loadfile (lua_State *L) {
+  if (lua_gettop(L) < 3) {
+    lua_settop(L, 2);
+    lua_pushvalue(L, lua_upvalueindex(2));
+  }
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 1);
+  lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+  return lua_gettop(L);
+}
+
+
+static int sandbox_dofile (lua_State *L) {
+  lua_settop(L, 1);
+  lua_pushvalue(L, lua_upvalueindex(1));  /* 'loadfile' */
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  lua_pushvalue(L, lua_upvalueindex(2));
+  lua_call(L, 3, 2);
+  if (lua_isnil(L, -2))
+    return lua_error(L);  /* error message is on the top */
+  lua_pop(L, 1);
+  lua_call(L, 0, LUA_MULTRET);
+  return lua_gettop(L) - 1;
+}
+
+
+/* loaders replaced in each sandbox: name, original, and replacement */
+static const struct {
+  const char *name;
+  const char *original;
+  lua_CFunction f;
+} sandboxloaders[] = {
+  {"load", "load", sandbox_load},
+  {"loadfile", "loadfile", sandbox_loadfile},
+  {"dofile", "loadfile", sandbox_dofile}
+};
+
+
+/*
+** Create a sandbox of template 'L', pushing its thread onto the stack
+** of 'L'. The sandbox lives until 'luaL_closesandbox'. From then on,
+** the metatables frozen by 'sandbox_seal' cannot change, not even in
+** the template.
+*/
+LUALIB_API lua_State *luaL_newsandbox (lua_State *L) {
+  lua_State *S;
+  int copies, g;
+  size_t i;
+  sandbox_seal(L);
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, SANDBOXES);
+  S = lua_newthread(L);
+  lua_newtable(L);  /* template tables -> sandbox copies */
+  copies = lua_gettop(L);
+  lua_pushglobaltable(L);
+  sandbox_value(L, copies);  /* sandbox global table */
+  g = lua_gettop(L);
+  sandbox_fields(L, g, copies);  /* copy its tables */
+  sandbox_package(L, g, copies);
+  lua_remove(L, copies);
+  for (i = 0; i < sizeof(sandboxloaders) / sizeof(sandboxloaders[0]); i++) {
+    if (lua_getglobal(L, sandboxloaders[i].original) != LUA_TFUNCTION)
+      lua_pop(L, 1);  /* library not open; nothing to replace */
+    else {
+      lua_pushvalue(L, -2);
+      lua_pushcclosure(L, sandboxloaders[i].f, 2);
+      lua_setfield(L, -2, sandboxloaders[i].name);
+    }
+  }
+  lua_pushvalue(L, -2);
+  lua_insert(L, -2);
+  lua_rawset(L, -4);  /* SANDBOXES[thread] = globals */
+  lua_remove(L, -2);  /* remove SANDBOXES table */
+  return S;
+}
+
+
+/*
+** Load a chunk in sandbox 'S', with the sandbox global table as its
+** environment; otherwise like 'luaL_loadbufferx'.
+*/
+LUALIB_API int luaL_loadsandbox (lua_State *S, const char *buff, size_t sz,
+                                 const char *name, const char *mode) {
+  int status = luaL_loadbufferx(S, buff, sz, name, mode);
+  if (status == LUA_OK) {
+    luaL_getsubtable(S, LUA_REGISTRYINDEX, SANDBOXES);
+    lua_pushthread(S);
+    if (lua_rawget(S, -2) != LUA_TTABLE)  /* not a sandbox? */
+      lua_pop(S, 2);  /* keep default environment */
+    else {
+      lua_remove(S, -2);  /* remove SANDBOXES table */
+      if (lua_setupvalue(S, -2, 1) == NULL)  /* no '_ENV' upvalue? */
+        lua_pop(S, 1);
+    }
+  }
+  return status;
+}
+
+
+/*
+** Close sandbox 'S' and release it, so that the collector can reclaim
+** it and its global table.
+*/
+LUALIB_API void luaL_closesandbox (lua_State *S) {
+  lua_closethread(S, NULL);
+  luaL_getsubtable(S, LUA_REGISTRYINDEX, SANDBOXES);
+  lua_pushthread(S);
+  lua_pushnil(S);
+  lua_rawset(S, -3);
+  lua_pop(S, 1);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Background sweep
+** A thread that frees the memory of dead objects, handed over by the
+** collector through a release function (see 'lua_setreleasef').
+** =======================================================
+*/
+
+#if defined(LUAI_BGSWEEP)
+
+typedef struct RelBatch {
+  struct RelBatch *next;
+  int n;
+  size_t *sizes;  /* sizes of the blocks (stored after them) */
+  void *blocks[];
+} RelBatch;
+
+typedef struct BgSweep {
+  lua_Alloc f;  /* allocator of the state */
+  void *ud;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* signals new batches or 'stop' */
+  pthread_cond_t idle;  /* signals that all batches were freed */
+  RelBatch *first, *last;  /* batches waiting to be freed */
+  int busy;  /* true while the thread frees a batch */
+  int stop;
+} BgSweep;
+
+
+static void *bgsweep_thread (void *ud) {
+  BgSweep *bg = (BgSweep *)ud;
+  pthread_mutex_lock(&bg->lock);
+  for (;;) {
+    RelBatch *b;
+    while (bg->first == NULL && !bg->stop)
+      pthread_cond_wait(&bg->work, &bg->lock);
+    if ((b = bg->first) == NULL)  /* stopped with nothing left? */
+      break;
+    if ((bg->first = b->next) == NULL)
+      bg->last = NULL;
+    bg->busy = 1;
+    pthread_mutex_unlock(&bg->lock);
+    while (b->n > 0) {
+      b->n--;
+      bg->f(bg->ud, b->blocks[b->n], b->sizes[b->n], 0);
+    }
+    free(b);
+    pthread_mutex_lock(&bg->lock);
+    bg->busy = 0;
+    if (bg->first == NULL)
+      pthread_cond_broadcast(&bg->idle);
+  }
+  pthread_mutex_unlock(&bg->lock);
+  return NULL;
+}
+
+
+/*
+** Release function given to the state: queue the batch for the thread
+** (freeing it here if there is no memory for that), wait for the thread
+** to go idle, or stop it.
+*/
+static void bgsweep_release (void *ud, void *const *blocks,
+                             const size_t *sizes, int n) {
+  BgSweep *bg = (BgSweep *)ud;
+  if (n > 0) {
+    RelBatch *b = (RelBatch *)malloc(sizeof(RelBatch) +
+                                     n * (sizeof(void *) + sizeof(size_t)));
+    int i;
+    if (b == NULL) {  /* cannot queue? free them now */
+      for (i = 0; i < n; i++)
+        bg->f(bg->ud, blocks[i], sizes[i], 0);
+      return;
+    }
+    b->next = NULL;
+    b->n = n;
+    b->sizes = (size_t *)(b->blocks + n);
+    memcpy(b->blocks, blocks, n * sizeof(void *));
+    memcpy(b->sizes, sizes, n * sizeof(size_t));
+    pthread_mutex_lock(&bg->lock);
+    if (bg->last) bg->last->next = b;
+    else bg->first = b;
+    bg->last = b;
+    pthread_cond_signal(&bg->work);
+    pthread_mutex_unlock(&bg->lock);
+  }
+  else {
+    pthread_mutex_lock(&bg->lock);
+    while (bg->first != NULL || bg->busy)
+      pthread_cond_wait(&bg->idle, &bg->lock);
+    if (n < 0) {  /* detached from the state? */
+      bg->stop = 1;
+      pthread_cond_signal(&bg->work);
+    }
+    pthread_mutex_unlock(&bg->lock);
+    if (n < 0) {
+      pthread_join(bg->thread, NULL);
+      pthread_cond_destroy(&bg->work);
+      pthread_cond_destroy(&bg->idle);
+      pthread_mutex_destroy(&bg->lock);
+      free(bg);
+    }
+  }
+}
+
+
+/*
+** Start ('on') or stop freeing dead objects of 'L' in a background
+** thread. The allocator of 'L' must be thread safe (as the default one
+** is); the pool allocator is not, so a pool state cannot use this.
+** Returns whether the background sweep is now on.
+*/
+LUALIB_API int luaL_bgsweep (lua_State *L, int on) {
+  void *ud;
+  lua_Release f = lua_getreleasef(L, &ud);
+  BgSweep *bg;
+  if (!on) {
+    if (f == bgsweep_release)
+      lua_setreleasef(L, NULL, NULL);  /* flushes and stops the thread */
+    return 0;
+  }
+  if (f == bgsweep_release)  /* already on? */
+    return 1;
+  if (f != NULL || lua_getallocf(L, NULL) == pool_alloc)
+    return 0;
+  bg = (BgSweep *)malloc(sizeof(BgSweep));
+  if (bg == NULL)
+    return 0;
+  bg->f = lua_getallocf(L, &bg->ud);
+  bg->first = bg->last = NULL;
+  bg->busy = bg->stop = 0;
+  pthread_mutex_init(&bg->lock, NULL);
+  pthread_cond_init(&bg->work, NULL);
+  pthread_cond_init(&bg->idle, NULL);
+  if (pthread_create(&bg->thread, NULL, bgsweep_thread, bg) != 0) {
+    pthread_cond_destroy(&bg->work);
+    pthread_cond_destroy(&bg->idle);
+    pthread_mutex_destroy(&bg->lock);
+    free(bg);
+    return 0;
+  }
+  lua_setreleasef(L, bgsweep_release, bg);
+  return 1;
+}
+
+#else
+
+LUALIB_API int luaL_bgsweep (lua_State *L, int on) {
+  (void)L; (void)on;
+  return 0;  /* no threads */
+}
+
+#endif
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   lua_Number v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
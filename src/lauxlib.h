@@ -99,6 +99,15 @@ LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_newpoolstate) (void);
+LUALIB_API int (luaL_poolstats) (lua_State *L);
+
+LUALIB_API lua_State *(luaL_newsandbox) (lua_State *L);
+LUALIB_API int (luaL_loadsandbox) (lua_State *S, const char *buff, size_t sz,
+                                   const char *name, const char *mode);
+LUALIB_API void (luaL_closesandbox) (lua_State *S);
+
+LUALIB_API int (luaL_bgsweep) (lua_State *L, int on);
 
 LUALIB_API lua_Integer (luaL_len) (lua_State *L, int idx);
 
@@ -108,6 +117,7 @@ LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s,
                                     const char *p, const char *r);
 
 LUALIB_API void (luaL_setfuncs) (lua_State *L, const luaL_Reg *l, int nup);
+LUALIB_API void (luaL_setfastfuncs) (lua_State *L, const luaL_Reg *l);
 
 LUALIB_API int (luaL_getsubtable) (lua_State *L, int idx, const char *fname);
 
@@ -130,6 +140,9 @@ LUALIB_API void (luaL_requiref) (lua_State *L, const char *modname,
 #define luaL_newlib(L,l)  \
   (luaL_checkversion(L), luaL_newlibtable(L,l), luaL_setfuncs(L,l,0))
 
+#define luaL_newfastlib(L,l)  \
+  (luaL_checkversion(L), luaL_newlibtable(L,l), luaL_setfastfuncs(L,l))
+
 #define luaL_argcheck(L, cond,arg,extramsg)	\
 	((void)(luai_likely(cond) || luaL_argerror(L, (arg), (extramsg))))
 
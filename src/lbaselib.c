@@ -21,16 +21,28 @@
 #include "lualib.h"
 
 
+/*
+** With several arguments, 'print' gathers them (and the tabs between
+** them) in a buffer, to write the whole line with a single call.
+*/
 static int luaB_print (lua_State *L) {
   int n = lua_gettop(L);  /* number of arguments */
-  int i;
-  for (i = 1; i <= n; i++) {  /* for each argument */
+  if (n == 1) {  /* common case: nothing to gather */
     size_t l;
-    const char *s = luaL_tolstring(L, i, &l);  /* convert it to string */
-    if (i > 1)  /* not the first element? */
-      lua_writestring("\t", 1);  /* add a tab before it */
+    const char *s = luaL_tolstring(L, 1, &l);  /* convert it to string */
     lua_writestring(s, l);  /* print it */
-    lua_pop(L, 1);  /* pop result */
+  }
+  else if (n > 1) {
+    int i;
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (i = 1; i <= n; i++) {  /* for each argument */
+      if (i > 1)  /* not the first element? */
+        luaL_addchar(&b, '\t');  /* add a tab before it */
+      luaL_tolstring(L, i, NULL);  /* convert it to string */
+      luaL_addvalue(&b);  /* add it to the line */
+    }
+    lua_writestring(luaL_buffaddr(&b), luaL_bufflen(&b));  /* print it */
   }
   lua_writeline();
   return 0;
@@ -186,11 +198,118 @@ static int pushmode (lua_State *L, int oldmode) {
     luaL_pushfail(L);  /* invalid call to 'lua_gc' */
   else
     lua_pushstring(L, (oldmode == LUA_GCINC) ? "incremental"
-                                             : "generational");
+                    : (oldmode == LUA_GCGEN) ? "generational"
+                                             : "adaptive");
+  return 1;
+}
+
+
+/*
+** Push a table with the counters and parameters of the adaptive
+** collector (see LUA_GCADAPTINFO).
+*/
+static int pushadaptinfo (lua_State *L) {
+  static const char *const names[] = {"minor", "major", "badmajor",
+    "toinc", "togen", "minorup", "minordown", "majorup", "majordown",
+    "survival", "minormul", "majormul", NULL};
+  int i;
+  lua_createtable(L, 0, sizeof(names) / sizeof(names[0]) - 1);
+  for (i = 0; names[i] != NULL; i++) {
+    int v = lua_gc(L, LUA_GCADAPTINFO, i);
+    if (v == -1) {  /* invalid call (inside a finalizer) */
+      luaL_pushfail(L);
+      return 1;
+    }
+    lua_pushinteger(L, v);
+    lua_setfield(L, -2, names[i]);
+  }
+  return 1;
+}
+
+
+static void setphasefield (lua_State *L, const char *name,
+                          const lua_GCPhase *total, const lua_GCPhase *last) {
+  lua_createtable(L, 0, 4);
+  lua_pushnumber(L, (lua_Number)total->time);
+  lua_setfield(L, -2, "time");
+  lua_pushinteger(L, (lua_Integer)total->freed);
+  lua_setfield(L, -2, "freed");
+  lua_pushnumber(L, (lua_Number)last->time);
+  lua_setfield(L, -2, "lasttime");
+  lua_pushinteger(L, (lua_Integer)last->freed);
+  lua_setfield(L, -2, "lastfreed");
+  lua_setfield(L, -2, name);
+}
+
+
+/*
+** Push a table with the statistics of the collector (see 'lua_gcstats').
+*/
+static int pushgcstats (lua_State *L) {
+  static const char *const phases[] = {"propagate", "atomic", "sweep",
+    "finalize"};
+  lua_GCStats st;
+  int i;
+  lua_gcstats(L, &st);
+  lua_createtable(L, 0, 8);
+  lua_pushinteger(L, (lua_Integer)st.minor);
+  lua_setfield(L, -2, "minor");
+  lua_pushinteger(L, (lua_Integer)st.major);
+  lua_setfield(L, -2, "major");
+  lua_pushinteger(L, (lua_Integer)st.finalized);
+  lua_setfield(L, -2, "finalized");
+  for (i = 0; i < LUA_GCNUMPHASES; i++)
+    setphasefield(L, phases[i], &st.total[i], &st.last[i]);
+  lua_createtable(L, 0, 8);
+  lua_pushinteger(L, (lua_Integer)st.strings);
+  lua_setfield(L, -2, "string");
+  lua_pushinteger(L, (lua_Integer)st.tables);
+  lua_setfield(L, -2, "table");
+  lua_pushinteger(L, (lua_Integer)st.lclosures);
+  lua_setfield(L, -2, "lclosure");
+  lua_pushinteger(L, (lua_Integer)st.cclosures);
+  lua_setfield(L, -2, "cclosure");
+  lua_pushinteger(L, (lua_Integer)st.userdata);
+  lua_setfield(L, -2, "userdata");
+  lua_pushinteger(L, (lua_Integer)st.threads);
+  lua_setfield(L, -2, "thread");
+  lua_pushinteger(L, (lua_Integer)st.protos);
+  lua_setfield(L, -2, "proto");
+  lua_pushinteger(L, (lua_Integer)st.upvalues);
+  lua_setfield(L, -2, "upvalue");
+  lua_setfield(L, -2, "traversed");
   return 1;
 }
 
 
+static int snapwriter (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;  /* not used */
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** Write a heap snapshot to the file 'path'. Returns true, or fail plus
+** an error message.
+*/
+static int snapshot (lua_State *L) {
+  const char *path = luaL_checkstring(L, 2);
+  int res;
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+    return luaL_fileresult(L, 0, path);
+  res = lua_snapshot(L, snapwriter, f);
+  if (fclose(f) != 0 && res == 0)
+    res = 1;
+  if (res == -1) {  /* invalid call (inside a finalizer)? */
+    remove(path);
+    luaL_pushfail(L);
+    return 1;
+  }
+  return luaL_fileresult(L, res == 0, path);
+}
+
+
 /*
 ** check whether call to 'lua_gc' was valid (not inside a finalizer)
 */
@@ -199,10 +318,13 @@ static int pushmode (lua_State *L, int oldmode) {
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "adaptive", "adaptinfo",
+    "threadpool", "stats", "snapshot", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCADAPT, LUA_GCADAPTINFO,
+    LUA_GCTHREADPOOL, -1, -2};  /* "stats" and "snapshot" are not
+                                   'lua_gc' options */
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -244,6 +366,26 @@ static int luaB_collectgarbage (lua_State *L) {
       int stepsize = (int)luaL_optinteger(L, 4, 0);
       return pushmode(L, lua_gc(L, o, pause, stepmul, stepsize));
     }
+    case LUA_GCADAPT: {
+      return pushmode(L, lua_gc(L, o));
+    }
+    case LUA_GCADAPTINFO: {
+      return pushadaptinfo(L);
+    }
+    case LUA_GCTHREADPOOL: {
+      int size = (int)luaL_optinteger(L, 2, -1);
+      int stacksize = (int)luaL_optinteger(L, 3, 0);
+      int previous = lua_gc(L, o, size, stacksize);
+      checkvalres(previous);
+      lua_pushinteger(L, previous);
+      return 1;
+    }
+    case -1: {
+      return pushgcstats(L);
+    }
+    case -2: {
+      return snapshot(L);
+    }
     default: {
       int res = lua_gc(L, o);
       checkvalres(res);
@@ -284,7 +426,7 @@ static int pairscont (lua_State *L, int status, lua_KContext k) {
 static int luaB_pairs (lua_State *L) {
   luaL_checkany(L, 1);
   if (luaL_getmetafield(L, 1, "__pairs") == LUA_TNIL) {  /* no metamethod? */
-    lua_pushcfunction(L, luaB_next);  /* will return generator, */
+    lua_pushfastcfunction(L, luaB_next);  /* will return generator, */
     lua_pushvalue(L, 1);  /* state, */
     lua_pushnil(L);  /* and initial value */
   }
@@ -337,9 +479,21 @@ static int load_aux (lua_State *L, int status, int envidx) {
 }
 
 
+/*
+** Get the mode argument of 'load'/'loadfile'. Mode 'F' (fixed buffer)
+** is only for C code, which controls the lifetime of the buffer.
+*/
+static const char *getmode (lua_State *L, int arg, const char *def) {
+  const char *mode = luaL_optstring(L, arg, def);
+  luaL_argcheck(L, mode == NULL || strchr(mode, 'F') == NULL, arg,
+                   "invalid mode");
+  return mode;
+}
+
+
 static int luaB_loadfile (lua_State *L) {
   const char *fname = luaL_optstring(L, 1, NULL);
-  const char *mode = luaL_optstring(L, 2, NULL);
+  const char *mode = getmode(L, 2, NULL);
   int env = (!lua_isnone(L, 3) ? 3 : 0);  /* 'env' index or 0 if no 'env' */
   int status = luaL_loadfilex(L, fname, mode);
   return load_aux(L, status, env);
@@ -388,7 +542,7 @@ static int luaB_load (lua_State *L) {
   int status;
   size_t l;
   const char *s = lua_tolstring(L, 1, &l);
-  const char *mode = luaL_optstring(L, 3, "bt");
+  const char *mode = getmode(L, 3, "bt");
   int env = (!lua_isnone(L, 4) ? 4 : 0);  /* 'env' index or 0 if no 'env' */
   if (s != NULL) {  /* loading a string? */
     const char *chunkname = luaL_optstring(L, 2, s);
@@ -504,19 +658,33 @@ static int luaB_tostring (lua_State *L) {
 
 
 static const luaL_Reg base_funcs[] = {
-  {"assert", luaB_assert},
   {"collectgarbage", luaB_collectgarbage},
   {"dofile", luaB_dofile},
-  {"error", luaB_error},
-  {"getmetatable", luaB_getmetatable},
-  {"ipairs", luaB_ipairs},
   {"loadfile", luaB_loadfile},
   {"load", luaB_load},
-  {"next", luaB_next},
   {"pairs", luaB_pairs},
   {"pcall", luaB_pcall},
   {"print", luaB_print},
+  {"tostring", luaB_tostring},
   {"warn", luaB_warn},
+  {"xpcall", luaB_xpcall},
+  /* placeholders */
+  {LUA_GNAME, NULL},
+  {"_VERSION", NULL},
+  {NULL, NULL}
+};
+
+
+/*
+** functions that do not yield (see 'lua_pushfastcfunction') nor call
+** back into Lua
+*/
+static const luaL_Reg base_fastfuncs[] = {
+  {"assert", luaB_assert},
+  {"error", luaB_error},
+  {"getmetatable", luaB_getmetatable},
+  {"ipairs", luaB_ipairs},
+  {"next", luaB_next},
   {"rawequal", luaB_rawequal},
   {"rawlen", luaB_rawlen},
   {"rawget", luaB_rawget},
@@ -524,12 +692,7 @@ static const luaL_Reg base_funcs[] = {
   {"select", luaB_select},
   {"setmetatable", luaB_setmetatable},
   {"tonumber", luaB_tonumber},
-  {"tostring", luaB_tostring},
   {"type", luaB_type},
-  {"xpcall", luaB_xpcall},
-  /* placeholders */
-  {LUA_GNAME, NULL},
-  {"_VERSION", NULL},
   {NULL, NULL}
 };
 
@@ -538,6 +701,9 @@ LUAMOD_API int luaopen_base (lua_State *L) {
   /* open lib into global table */
   lua_pushglobaltable(L);
   luaL_setfuncs(L, base_funcs, 0);
+  luaL_setfastfuncs(L, base_fastfuncs);
+  lua_setintrinsic(L, LUA_INTRNEXT, luaB_next);
+  lua_setintrinsic(L, LUA_INTRIPAIRS, ipairsaux);
   /* set global _G */
   lua_pushvalue(L, -1);
   lua_setfield(L, -2, LUA_GNAME);
@@ -14,12 +14,14 @@
 #include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
 #include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
+#include "lfunc.h"
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
@@ -578,10 +580,6 @@ static int stringK (FuncState *fs, TString *s) {
   return addk(fs, &o, &o);  /* use string itself as key */
 }
 
-int luaK_stringK (FuncState *fs, TString *s) {
-  return stringK(fs,s);
-}
-
 /*
 ** Add an integer to list of constants and return its index.
 */
@@ -1083,6 +1081,39 @@ void luaK_storevar (FuncState *fs, expdesc *var, expdesc *ex) {
 }
 
 
+/*
+** Read the value of variable 'var' into 'e', keeping the registers
+** of its table and key, so that 'var' can still be assigned with
+** 'luaK_storevar' (used by compound assignments).
+*/
+void luaK_readvar (FuncState *fs, expdesc *var, expdesc *e) {
+  *e = *var;
+  switch (var->k) {
+    case VINDEXI: {
+      e->u.info = luaK_codeABC(fs, OP_GETI, 0, var->u.ind.t, var->u.ind.idx);
+      e->k = VRELOC;
+      break;
+    }
+    case VINDEXSTR: {
+      e->u.info = luaK_codeABC(fs, OP_GETFIELD, 0, var->u.ind.t,
+                                                   var->u.ind.idx);
+      e->k = VRELOC;
+      break;
+    }
+    case VINDEXED: {
+      e->u.info = luaK_codeABC(fs, OP_GETTABLE, 0, var->u.ind.t,
+                                                   var->u.ind.idx);
+      e->k = VRELOC;
+      break;
+    }
+    default: {  /* locals, upvalues, and globals use no registers */
+      luaK_dischargevars(fs, e);
+      break;
+    }
+  }
+}
+
+
 /*
 ** Emit SELF instruction (convert expression 'e' into 'e:key(e,').
 */
@@ -1651,6 +1682,12 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
       luaK_exp2nextreg(fs, v);  /* operand must be on the stack */
       break;
     }
+    case OPR_2Q: {
+      luaK_exp2nextreg(fs, v);  /* operand must be on the stack */
+      /* skip 2nd operand if 'v' is not nil; list closed by 'luaK_posfix' */
+      v->t = condjump(fs, OP_2Q, v->u.info, 0, 0, 1);
+      break;
+    }
     case OPR_ADD: case OPR_SUB:
     case OPR_MUL: case OPR_DIV: case OPR_IDIV:
     case OPR_MOD: case OPR_POW:
@@ -1687,7 +1724,8 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
 */
 static void codeconcat (FuncState *fs, expdesc *e1, expdesc *e2, int line) {
   Instruction *ie2 = previousinstruction(fs);
-  if (GET_OPCODE(*ie2) == OP_CONCAT) {  /* is 'e2' a concatenation? */
+  if (GET_OPCODE(*ie2) == OP_CONCAT ||  /* is 'e2' a concatenation? */
+      GET_OPCODE(*ie2) == OP_FSTRING) {  /* (an f-string is one too) */
     int n = GETARG_B(*ie2);  /* # of elements concatenated in 'e2' */
     lua_assert(e1->u.info + 1 == GETARG_A(*ie2));
     freeexp(fs, e2);
@@ -1723,18 +1761,13 @@ void luaK_posfix (FuncState *fs, BinOpr opr,
       *e1 = *e2;
       break;
     }
-    case OPR_2Q: {
-        luaK_exp2nextreg(fs, e1); /* Ensure e1 is a value */
-        luaK_exp2nextreg(fs, e2); /* Ensure e2 is a value */
-        /* Generate the VM OpCode OP_QQ */
-        luaK_codeABC(fs, OP_2Q, 0, e1->u.info, e2->u.info);
-        /* Update the expression descriptor 'e1' to point to new instruction */
-        freeexp(fs, e2); /* Free the right operand's register */
-        freeexp(fs, e1); /* Free the left operand (IF it was a temp register) */
-        
-        e1->u.info = fs->pc - 1;
-        e1->k = VRELOC; /* relocatable instruction result */
-        break;
+    case OPR_2Q: {  /* e1 ?? e2 */
+      lua_assert(e1->k == VNONRELOC && e1->f == NO_JUMP);
+      freeexp(fs, e2);
+      exp2reg(fs, e2, e1->u.info);  /* nil in 'e1' is replaced by 'e2' */
+      luaK_patchtohere(fs, e1->t);  /* non-nil 'e1' jumps here */
+      e1->t = NO_JUMP;
+      break;
     }
     case OPR_CONCAT: {  /* e1 .. e2 */
       luaK_exp2nextreg(fs, e2);
@@ -1839,6 +1872,67 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
 }
 
 
+/*
+** Start a 'switch' over the value of 'e': add a jump table to the
+** function and code the OP_SWITCH that uses it. Return the index of
+** the table, to add its cases. (The next instruction must be the jump
+** to the 'else' part.)
+*/
+int luaK_switch (FuncState *fs, expdesc *e) {
+  Proto *f = fs->f;
+  int oldsize = f->sizeswtabs;
+  int r = luaK_exp2anyreg(fs, e);
+  luaM_growvector(fs->ls->L, f->swtabs, fs->nsw, f->sizeswtabs, SwitchTable,
+                  MAXARG_Bx, "switch statements");
+  while (oldsize < f->sizeswtabs) {
+    SwitchTable *sw = &f->swtabs[oldsize++];
+    sw->h = NULL;
+    sw->cases = NULL;
+    sw->ncases = sw->sizecases = 0;
+  }
+  freeexp(fs, e);
+  luaK_codeABx(fs, OP_SWITCH, r, fs->nsw);
+  return fs->nsw++;
+}
+
+
+/* add constant value 'v' to the list of constants */
+static int const2K (FuncState *fs, TValue *v) {
+  switch (ttypetag(v)) {
+    case LUA_VNUMINT: return luaK_intK(fs, ivalue(v));
+    case LUA_VNUMFLT: return luaK_numberK(fs, fltvalue(v));
+    case LUA_VFALSE: return boolF(fs);
+    case LUA_VTRUE: return boolT(fs);
+    default: lua_assert(ttisstring(v)); return stringK(fs, tsvalue(v));
+  }
+}
+
+
+/*
+** Add to jump table 'sw' a case for the value of 'e', which must be a
+** constant, whose code starts at 'pc'.
+*/
+void luaK_switchcase (FuncState *fs, int sw, expdesc *e, int pc) {
+  Proto *f = fs->f;
+  SwitchTable *st = &f->swtabs[sw];
+  TValue v;
+  int c;
+  if (!luaK_exp2const(fs, e, &v) || ttisnil(&v) ||
+      (ttisfloat(&v) && luai_numisnan(fltvalue(&v))))
+    luaK_semerror(fs->ls, "case value must be a constant (not nil or NaN)");
+  for (c = 0; c < st->ncases; c++) {
+    if (luaV_rawequalobj(&f->k[st->cases[c].k], &v))
+      luaK_semerror(fs->ls, "duplicate case value");
+  }
+  c = const2K(fs, &v);
+  luaM_growvector(fs->ls->L, st->cases, st->ncases, st->sizecases,
+                  SwitchCase, MAX_INT, "cases");
+  st->cases[st->ncases].k = c;
+  st->cases[st->ncases].pc = pc;
+  st->ncases++;
+}
+
+
 /*
 ** return the final target of a jump (skipping jumps to jumps)
 */
@@ -1855,6 +1949,24 @@ static int finaltarget (Instruction *code, int i) {
 }
 
 
+/*
+** In a chain like (a ?? b ?? c), the jump taken when 'a' is not nil
+** lands on an identical test of the same register, which will jump
+** too; go directly to the final target of that other jump.
+*/
+static int chaintarget (Instruction *code, int i, int target) {
+  int count;
+  for (count = 0; i > 0 && count < 100; count++) {  /* avoid infinite loops */
+    Instruction test = code[i - 1];
+    if (GET_OPCODE(test) != OP_2Q || code[target] != test)
+      break;
+    i = target + 1;  /* the jump following the other test */
+    target = finaltarget(code, i);
+  }
+  return target;
+}
+
+
 /*
 ** Do a final pass over the code of a function, doing small peephole
 ** optimizations and adjustments.
@@ -1880,11 +1992,631 @@ void luaK_finish (FuncState *fs) {
         break;
       }
       case OP_JMP: {
-        int target = finaltarget(p->code, i);
+        int target = chaintarget(p->code, i, finaltarget(p->code, i));
         fixjump(fs, i, target);
         break;
       }
       default: break;
     }
   }
+  for (i = 0; i < fs->nsw; i++)  /* build the jump tables */
+    luaF_buildswitch(fs->ls->L, p, i);
+  luaP_fuse(p, p->code, fs->pc);  /* create superinstructions */
 }
+
+
+/*
+** {======================================================
+** Optimizer
+** =======================================================
+*/
+
+/*
+** An optional pass over the code of a function, run just before
+** 'luaK_finish' when the optimizer level (see 'lua_setoptlevel') is
+** not zero. It finds local variables that start with a constant and
+** are never assigned, and registers just loaded with a constant; it
+** folds operations and tests over these values;
+** then it removes the code that no path runs and the jumps to the
+** next instruction, adjusting jumps, line information, and the ranges
+** of local variables.
+*/
+
+/* flags of each instruction in the optimizer */
+#define OPT_TARGET	1	/* some jump (or skip) may land here */
+#define OPT_REACHED	2	/* some path from the entry runs it */
+#define OPT_REMOVED	4	/* instruction was removed */
+
+#define optlive(os,pc)	(((os)->flags[pc] & (OPT_REACHED | OPT_REMOVED)) \
+                            == OPT_REACHED)
+
+typedef struct OptState {
+  FuncState *fs;
+  Instruction *code;
+  int n;  /* number of instructions */
+  TValue *kval;  /* known value of each register ... */
+  int *kstart;  /* ... from this position ... */
+  int *kend;  /* ... up to (but not including) this one */
+  int *vreg;  /* register of each constant local variable (or -1) */
+  int *aux;  /* stack for the traversal; then new positions */
+  int *lines;  /* line of each instruction */
+  lu_byte *flags;  /* flags of each instruction */
+} OptState;
+
+
+/*
+** Destination of the jump (or loop) instruction 'i', at position 'pc',
+** or -1 if it does not jump. (For OP_FORPREP, it is the instruction
+** after the loop.)
+*/
+static int optdest (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: return pc + 1 + GETARG_sJ(i);
+    case OP_FORPREP: return pc + GETARG_Bx(i) + 2;
+    case OP_TFORPREP: return pc + GETARG_Bx(i) + 1;
+    case OP_FORLOOP: case OP_TFORLOOP: return pc + 1 - GETARG_Bx(i);
+    default: return -1;
+  }
+}
+
+
+/* change the destination of instruction 'i', at 'pc', to 'dest' */
+static void optsetdest (Instruction *i, int pc, int dest) {
+  switch (GET_OPCODE(*i)) {
+    case OP_JMP: SETARG_sJ(*i, dest - pc - 1); break;
+    case OP_FORPREP: SETARG_Bx(*i, dest - pc - 2); break;
+    case OP_TFORPREP: SETARG_Bx(*i, dest - pc - 1); break;
+    default: SETARG_Bx(*i, pc + 1 - dest); break;  /* loops jump back */
+  }
+}
+
+
+static void marktargets (OptState *os) {
+  int pc;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = os->code[pc];
+    int dest = optdest(i, pc);
+    if (dest >= 0)
+      os->flags[dest] |= OPT_TARGET;
+    if (GET_OPCODE(i) == OP_SWITCH) {
+      const SwitchTable *sw = &os->fs->f->swtabs[GETARG_Bx(i)];
+      int c;
+      for (c = 0; c < sw->ncases; c++)
+        os->flags[sw->cases[c].pc] |= OPT_TARGET;
+    }
+    if (GET_OPCODE(i) == OP_LFALSESKIP || testTMode(GET_OPCODE(i)))
+      os->flags[pc + 2] |= OPT_TARGET;  /* skips next instruction */
+  }
+}
+
+
+/*
+** Check whether instruction 'i' may change register 'r', assuming the
+** worst for instructions that change a range of registers.
+*/
+static int changesreg (Instruction i, int r) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_LOADNIL:
+      return (a <= r && r <= a + GETARG_B(i));
+    case OP_SELF: case OP_CONCAT: case OP_FSTRING: case OP_TBC:
+    case OP_CALL: case OP_TAILCALL: case OP_VARARG:
+    case OP_FORPREP: case OP_FORLOOP:
+    case OP_TFORPREP: case OP_TFORCALL: case OP_TFORLOOP:
+      return (a <= r);
+    default:
+      return (testAMode(op) && a == r);
+  }
+}
+
+
+/* check whether instruction 'i' creates a closure with register 'r' */
+static int capturesreg (FuncState *fs, Instruction i, int r) {
+  if (GET_OPCODE(i) == OP_CLOSURE) {
+    Proto *p = fs->f->p[GETARG_Bx(i)];
+    int u;
+    for (u = 0; u < p->sizeupvalues; u++) {
+      if (p->upvalues[u].instack && p->upvalues[u].idx == r)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Find the register of each local variable, as 'luaF_getlocalname'
+** does, and keep it only for variables whose register nothing changes
+** (or captures) while they are active.
+*/
+static void findconstvars (OptState *os) {
+  Proto *f = os->fs->f;
+  int *active = os->aux;  /* active variables */
+  int nactive = 0;
+  int v;
+  for (v = 0; v < os->fs->ndebugvars; v++) {
+    LocVar *var = &f->locvars[v];
+    int reg, pc, j, k;
+    for (j = k = 0; j < nactive; j++) {  /* remove variables that ended */
+      if (f->locvars[active[j]].endpc > var->startpc)
+        active[k++] = active[j];
+    }
+    nactive = k;
+    reg = nactive;
+    active[nactive++] = v;
+    for (pc = var->startpc; pc < var->endpc; pc++) {
+      if (changesreg(os->code[pc], reg) ||
+          capturesreg(os->fs, os->code[pc], reg)) {
+        reg = -1;
+        break;
+      }
+    }
+    os->vreg[v] = reg;
+  }
+}
+
+
+/*
+** If 'i' loads a constant into registers 'first' to 'last', put that
+** constant in 'v' and return true.
+*/
+static int isload (FuncState *fs, Instruction i, int *first, int *last,
+                   TValue *v) {
+  *first = *last = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADI: setivalue(v, GETARG_sBx(i)); return 1;
+    case OP_LOADF: setfltvalue(v, cast_num(GETARG_sBx(i))); return 1;
+    case OP_LOADK: setobj(fs->ls->L, v, &fs->f->k[GETARG_Bx(i)]); return 1;
+    case OP_LOADFALSE: setbfvalue(v); return 1;
+    case OP_LOADTRUE: setbtvalue(v); return 1;
+    case OP_LOADNIL:
+      *last += GETARG_B(i);
+      setnilvalue(v);
+      return 1;
+    default: return 0;
+  }
+}
+
+
+static int knownreg (OptState *os, int pc, int r, TValue *v);
+
+
+/*
+** Find the constant that register 'r' has when the code reaches 'pc'
+** from the instruction before it: the code before 'pc' must be a
+** sequence of loads and moves (as in 'local a, b = 1, x') with a load
+** into 'r' (or a move of a known value), and no jumps into it. (Moves
+** are not changed into loads, so that error messages still name the
+** variables.)
+*/
+static int findload (OptState *os, int pc, int r, TValue *v) {
+  for (;;) {
+    Instruction i;
+    int first, last;
+    if (os->flags[pc] & OPT_TARGET)
+      return 0;  /* some path may skip the load */
+    do {  /* go to previous instruction (skipping removed ones) */
+      if (--pc < 0) return 0;
+    } while (os->flags[pc] & OPT_REMOVED);
+    i = os->code[pc];
+    if (GET_OPCODE(i) == OP_MOVE) {
+      if (GETARG_A(i) == r)
+        return knownreg(os, pc, GETARG_B(i), v);
+    }
+    else if (!isload(os->fs, i, &first, &last, v))
+      return 0;
+    else if (first <= r && r <= last)
+      return 1;
+  }
+}
+
+
+/* get the known value of register 'r' at 'pc', if there is one */
+static int knownreg (OptState *os, int pc, int r, TValue *v) {
+  if (os->kstart[r] <= pc && pc < os->kend[r]) {  /* constant variable? */
+    setobj(os->fs->ls->L, v, &os->kval[r]);
+    return 1;
+  }
+  return findload(os, pc, r, v);
+}
+
+
+/*
+** Change the instruction at 'pc' into a load of 'v' into its register
+** 'A'; return false if it cannot.
+*/
+static int setload (OptState *os, int pc, const TValue *v) {
+  FuncState *fs = os->fs;
+  int a = GETARG_A(os->code[pc]);
+  int k;
+  switch (ttypetag(v)) {
+    case LUA_VNUMINT: {
+      if (fitsBx(ivalue(v))) {
+        os->code[pc] = CREATE_ABx(OP_LOADI, a,
+                                  cast_int(ivalue(v)) + OFFSET_sBx);
+        return 1;
+      }
+      k = luaK_intK(fs, ivalue(v));
+      break;
+    }
+    case LUA_VNUMFLT: {
+      lua_Integer fi;
+      if (fltvalue(v) == 0)
+        return 0;  /* avoid problems with -0.0 */
+      if (luaV_flttointeger(fltvalue(v), &fi, F2Ieq) && fitsBx(fi)) {
+        os->code[pc] = CREATE_ABx(OP_LOADF, a, cast_int(fi) + OFFSET_sBx);
+        return 1;
+      }
+      k = luaK_numberK(fs, fltvalue(v));
+      break;
+    }
+    case LUA_VFALSE:
+      os->code[pc] = CREATE_ABCk(OP_LOADFALSE, a, 0, 0, 0);
+      return 1;
+    case LUA_VTRUE:
+      os->code[pc] = CREATE_ABCk(OP_LOADTRUE, a, 0, 0, 0);
+      return 1;
+    case LUA_VNIL:
+      os->code[pc] = CREATE_ABCk(OP_LOADNIL, a, 0, 0, 0);
+      return 1;
+    default:
+      lua_assert(ttisstring(v));
+      k = stringK(fs, tsvalue(v));
+      break;
+  }
+  if (k > MAXARG_Bx)
+    return 0;  /* would need OP_LOADKX */
+  os->code[pc] = CREATE_ABx(OP_LOADK, a, k);
+  return 1;
+}
+
+
+/* fold an arithmetic operation (as 'constfolding' does) */
+static int foldarith (OptState *os, int op, TValue *v1, TValue *v2,
+                      TValue *res) {
+  if (!ttisnumber(v1) || !ttisnumber(v2) || !validop(op, v1, v2))
+    return 0;  /* non-numeric operands or not safe to fold */
+  luaO_rawarith(os->fs->ls->L, op, v1, v2, res);
+  if (ttisfloat(res)) {  /* folds neither NaN nor 0.0 */
+    lua_Number n = fltvalue(res);
+    if (luai_numisnan(n) || n == 0)
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Set the result of a binary operation at 'pc'; its following
+** OP_MMBIN* instruction will not run.
+*/
+static void setbinresult (OptState *os, int pc, const TValue *res) {
+  lua_assert(testMMMode(GET_OPCODE(os->code[pc + 1])));
+  if (setload(os, pc, res))
+    os->flags[pc + 1] |= OPT_REMOVED;
+}
+
+
+/*
+** The test at 'pc' (followed by a jump) has a known result 'cond':
+** change it into a jump that goes where the test would go.
+*/
+static void foldtest (OptState *os, int pc, int cond) {
+  Instruction jmp = os->code[pc + 1];
+  int offset = 1;  /* skip the jump */
+  lua_assert(GET_OPCODE(jmp) == OP_JMP);
+  if (cond == GETARG_k(os->code[pc])) {  /* test would do the jump? */
+    offset = GETARG_sJ(jmp) + 1;  /* go directly to its destination */
+    if (offset > MAXARG_sJ - OFFSET_sJ)
+      return;  /* does not fit */
+  }
+  os->code[pc] = CREATE_sJ(OP_JMP, offset + OFFSET_sJ, 0);
+}
+
+
+/* compare number 'v' with the immediate 'im', as the VM does */
+static int cmpimm (OpCode op, const TValue *v, int im) {
+  lua_Number n = nvalue(v);
+  if (ttisinteger(v)) {
+    lua_Integer i = ivalue(v);
+    switch (op) {
+      case OP_EQI: return (i == im);
+      case OP_LTI: return (i < im);
+      case OP_LEI: return (i <= im);
+      case OP_GTI: return (i > im);
+      default: return (i >= im);
+    }
+  }
+  switch (op) {
+    case OP_EQI: return luai_numeq(n, cast_num(im));
+    case OP_LTI: return luai_numlt(n, cast_num(im));
+    case OP_LEI: return luai_numle(n, cast_num(im));
+    case OP_GTI: return luai_numgt(n, cast_num(im));
+    default: return luai_numge(n, cast_num(im));
+  }
+}
+
+
+static void foldinstr (OptState *os, int pc) {
+  Instruction i = os->code[pc];
+  OpCode op = GET_OPCODE(i);
+  TValue v1, v2, res;
+  switch (op) {
+    case OP_NOT: {
+      if (knownreg(os, pc, GETARG_B(i), &v1)) {
+        if (l_isfalse(&v1)) setbtvalue(&res);
+        else setbfvalue(&res);
+        setload(os, pc, &res);
+      }
+      break;
+    }
+    case OP_UNM: case OP_BNOT: {
+      int aop = (op == OP_UNM) ? LUA_OPUNM : LUA_OPBNOT;
+      if (knownreg(os, pc, GETARG_B(i), &v1) &&
+          foldarith(os, aop, &v1, &v1, &res))
+        setload(os, pc, &res);
+      break;
+    }
+    case OP_ADDI: case OP_SHRI: case OP_SHLI: {
+      int aop = (op == OP_ADDI) ? LUA_OPADD
+              : (op == OP_SHRI) ? LUA_OPSHR : LUA_OPSHL;
+      if (!knownreg(os, pc, GETARG_B(i), &v1))
+        break;
+      setivalue(&v2, GETARG_sC(i));
+      if (op == OP_SHLI ? foldarith(os, aop, &v2, &v1, &res)  /* sC << R[B] */
+                        : foldarith(os, aop, &v1, &v2, &res))
+        setbinresult(os, pc, &res);
+      break;
+    }
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK: {
+      if (knownreg(os, pc, GETARG_B(i), &v1) &&
+          foldarith(os, cast_int(op - OP_ADDK) + LUA_OPADD, &v1,
+                        &os->fs->f->k[GETARG_C(i)], &res))
+        setbinresult(os, pc, &res);
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_POW: case OP_DIV: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: {
+      if (knownreg(os, pc, GETARG_B(i), &v1) &&
+          knownreg(os, pc, GETARG_C(i), &v2) &&
+          foldarith(os, cast_int(op - OP_ADD) + LUA_OPADD, &v1, &v2, &res))
+        setbinresult(os, pc, &res);
+      break;
+    }
+    case OP_TEST: {
+      if (knownreg(os, pc, GETARG_A(i), &v1))
+        foldtest(os, pc, !l_isfalse(&v1));
+      break;
+    }
+    case OP_2Q: {
+      if (knownreg(os, pc, GETARG_A(i), &v1))
+        foldtest(os, pc, !ttisnil(&v1));
+      break;
+    }
+    case OP_EQK: {
+      if (knownreg(os, pc, GETARG_A(i), &v1))
+        foldtest(os, pc, luaV_rawequalobj(&v1, &os->fs->f->k[GETARG_B(i)]));
+      break;
+    }
+    case OP_EQ: {
+      if (knownreg(os, pc, GETARG_A(i), &v1) &&
+          knownreg(os, pc, GETARG_B(i), &v2))
+        foldtest(os, pc, luaV_rawequalobj(&v1, &v2));
+      break;
+    }
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      if (knownreg(os, pc, GETARG_A(i), &v1)) {
+        if (ttisnumber(&v1))
+          foldtest(os, pc, cmpimm(op, &v1, GETARG_sB(i)));
+        else if (op == OP_EQI)
+          foldtest(os, pc, 0);  /* a non-number is not equal to sB */
+      }
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/*
+** Fold instructions in order, so that a folded result may be used by
+** the following instructions; 'kstart' and 'kend' track the variables
+** that get a known constant when they enter their scopes.
+*/
+static void foldcode (OptState *os) {
+  Proto *f = os->fs->f;
+  int v = 0;
+  int pc;
+  for (pc = 0; pc < os->n; pc++) {
+    for (; v < os->fs->ndebugvars && f->locvars[v].startpc <= pc; v++) {
+      int r = os->vreg[v];
+      if (r >= 0 && f->locvars[v].startpc < f->locvars[v].endpc &&
+          findload(os, pc, r, &os->kval[r])) {
+        os->kstart[r] = pc;
+        os->kend[r] = f->locvars[v].endpc;
+      }
+    }
+    if (!(os->flags[pc] & OPT_REMOVED))
+      foldinstr(os, pc);
+  }
+}
+
+
+/* mark all instructions that some path from the entry runs */
+static void markreached (OptState *os) {
+  int *stack = os->aux;
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    int pc = stack[--top];
+    while (!(os->flags[pc] & OPT_REACHED)) {  /* follow this path */
+      Instruction i = os->code[pc];
+      OpCode op = GET_OPCODE(i);
+      os->flags[pc] |= OPT_REACHED;
+      switch (op) {
+        case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+          pc = -1;  /* path ends */
+          break;
+        case OP_JMP: case OP_TFORPREP:
+          pc = optdest(i, pc);
+          break;
+        case OP_FORPREP:  /* keep the loop instruction */
+          stack[top++] = optdest(i, pc) - 1;
+          stack[top++] = optdest(i, pc);
+          pc++;
+          break;
+        case OP_FORLOOP: case OP_TFORLOOP:
+          stack[top++] = optdest(i, pc);
+          pc++;
+          break;
+        case OP_LFALSESKIP:
+          pc += 2;
+          break;
+        case OP_SWITCH: {
+          const SwitchTable *sw = &os->fs->f->swtabs[GETARG_Bx(i)];
+          int c;
+          for (c = 0; c < sw->ncases; c++)
+            stack[top++] = sw->cases[c].pc;
+          pc++;
+          break;
+        }
+        default:
+          if (testTMode(op))
+            stack[top++] = pc + 2;
+          pc++;
+          break;
+      }
+      if (pc < 0) break;
+    }
+  }
+}
+
+
+/*
+** Remove live jumps to the next live instruction. Also, an
+** OP_LFALSESKIP must skip its OP_LOADTRUE; if that one is gone, it
+** becomes a plain OP_LOADFALSE.
+*/
+static void removenopjumps (OptState *os) {
+  int pc;
+  for (pc = os->n - 1; pc >= 0; pc--) {
+    Instruction i = os->code[pc];
+    if (GET_OPCODE(i) == OP_LFALSESKIP && !optlive(os, pc + 1))
+      SET_OPCODE(os->code[pc], OP_LOADFALSE);
+    else if (optlive(os, pc) && GET_OPCODE(i) == OP_JMP) {
+      int dest = optdest(i, pc);
+      int q;
+      for (q = pc + 1; q < dest && !optlive(os, q); q++) ;
+      if (q < dest || dest <= pc)
+        continue;  /* not a jump to the next live instruction */
+      for (q = pc - 1; q >= 0 && !optlive(os, q); q--) ;
+      if (q >= 0 && testTMode(GET_OPCODE(os->code[q])))
+        continue;  /* a test must be followed by its jump */
+      os->flags[pc] |= OPT_REMOVED;
+    }
+  }
+}
+
+
+/* remove instructions that are not live anymore */
+static void compactcode (OptState *os) {
+  FuncState *fs = os->fs;
+  Proto *f = fs->f;
+  int *newpc = os->aux;
+  int line = f->linedefined;
+  int nabs = 0;
+  int n = 0;
+  int pc, v;
+  for (pc = 0; pc < os->n; pc++) {
+    newpc[pc] = n;
+    if (optlive(os, pc)) n++;
+    if (f->lineinfo[pc] != ABSLINEINFO)  /* decode line information */
+      line += f->lineinfo[pc];
+    else {
+      lua_assert(f->abslineinfo[nabs].pc == pc);
+      line = f->abslineinfo[nabs++].line;
+    }
+    os->lines[pc] = line;
+  }
+  newpc[os->n] = n;
+  if (n == os->n)
+    return;  /* nothing to remove */
+  fs->previousline = f->linedefined;  /* restart line information */
+  fs->iwthabs = 0;
+  fs->nabslineinfo = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    if (optlive(os, pc)) {
+      Instruction i = os->code[pc];
+      int dest = optdest(i, pc);
+      if (dest >= 0)
+        optsetdest(&i, newpc[pc], newpc[dest]);
+      os->code[newpc[pc]] = i;
+      fs->pc = newpc[pc] + 1;
+      savelineinfo(fs, f, os->lines[pc]);
+    }
+  }
+  for (v = 0; v < fs->ndebugvars; v++) {
+    f->locvars[v].startpc = newpc[f->locvars[v].startpc];
+    f->locvars[v].endpc = newpc[f->locvars[v].endpc];
+  }
+  for (v = 0; v < fs->nsw; v++) {  /* cases of the jump tables */
+    SwitchTable *sw = &f->swtabs[v];
+    int c;
+    for (c = 0; c < sw->ncases; c++)
+      sw->cases[c].pc = newpc[sw->cases[c].pc];
+  }
+  fs->pc = n;
+}
+
+
+/* total number of cases in the jump tables of the function */
+static size_t ncases (FuncState *fs) {
+  size_t n = 0;
+  int i;
+  for (i = 0; i < fs->nsw; i++)
+    n += cast_sizet(fs->f->swtabs[i].ncases);
+  return n;
+}
+
+
+void luaK_optimize (FuncState *fs) {
+  Mbuffer *buff = fs->ls->buff;
+  OptState os;
+  size_t nregs = cast_sizet(fs->f->maxstacksize) + 1;
+  size_t ninstr = cast_sizet(fs->pc) + 1;
+  size_t naux = 2 * ninstr + cast_sizet(fs->ndebugvars) + ncases(fs);
+  size_t size = nregs * (sizeof(TValue) + 2 * sizeof(int)) +
+                cast_sizet(fs->ndebugvars) * sizeof(int) +
+                naux * sizeof(int) + ninstr * (sizeof(int) + 1);
+  char *mem;
+  /* use the scanner buffer for the work arrays, as it is free between
+     tokens and the parser frees it in case of errors */
+  if (luaZ_sizebuffer(buff) < size)
+    luaZ_resizebuffer(fs->ls->L, buff, size);
+  mem = luaZ_buffer(buff);
+  os.fs = fs;
+  os.code = fs->f->code;
+  os.n = fs->pc;
+  os.kval = (TValue *)mem; mem += nregs * sizeof(TValue);
+  os.kstart = (int *)mem; mem += nregs * sizeof(int);
+  os.kend = (int *)mem; mem += nregs * sizeof(int);
+  os.vreg = (int *)mem; mem += cast_sizet(fs->ndebugvars) * sizeof(int);
+  os.aux = (int *)mem; mem += naux * sizeof(int);
+  os.lines = (int *)mem; mem += ninstr * sizeof(int);
+  os.flags = (lu_byte *)mem;
+  memset(os.kstart, 0, nregs * sizeof(int));
+  memset(os.kend, 0, nregs * sizeof(int));
+  memset(os.flags, 0, ninstr);
+  marktargets(&os);
+  findconstvars(&os);
+  foldcode(&os);
+  markreached(&os);
+  removenopjumps(&os);
+  compactcode(&os);
+}
+
+/* }====================================================== */
@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <limits.h>
 #include <stdlib.h>
 
 #include "lua.h"
@@ -167,6 +168,17 @@ static int luaB_corunning (lua_State *L) {
 }
 
 
+static int luaB_reserve (lua_State *L) {
+  lua_State *co = getco(L);
+  lua_Integer nslots = luaL_checkinteger(L, 2);
+  lua_Integer ncalls = luaL_optinteger(L, 3, 0);
+  luaL_argcheck(L, 0 <= nslots && nslots <= INT_MAX, 2, "out of range");
+  luaL_argcheck(L, 0 <= ncalls && ncalls <= INT_MAX, 3, "out of range");
+  lua_pushboolean(L, lua_reservestack(co, (int)nslots, (int)ncalls));
+  return 1;
+}
+
+
 static int luaB_close (lua_State *L) {
   lua_State *co = getco(L);
   int status = auxstatus(L, co);
@@ -198,6 +210,7 @@ static const luaL_Reg co_funcs[] = {
   {"yield", luaB_yield},
   {"isyieldable", luaB_yieldable},
   {"close", luaB_close},
+  {"reserve", luaB_reserve},
   {NULL, NULL}
 };
 
@@ -12,6 +12,8 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "lua.h"
@@ -136,6 +138,7 @@ LUA_API void lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
   L->hook = func;
   L->basehookcount = count;
   resethookcount(L);
+  mask |= L->hookmask & MASKCOVER;  /* coverage is not a hook */
   L->hookmask = cast_byte(mask);
   if (mask)
     settraps(L->ci);  /* to trace inside 'luaV_execute' */
@@ -148,7 +151,7 @@ LUA_API lua_Hook lua_gethook (lua_State *L) {
 
 
 LUA_API int lua_gethookmask (lua_State *L) {
-  return L->hookmask;
+  return L->hookmask & ~MASKCOVER;
 }
 
 
@@ -230,7 +233,10 @@ LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
     StkId pos = NULL;  /* to avoid warnings */
     name = luaG_findlocal(L, ar->i_ci, n, &pos);
     if (name) {
-      setobjs2s(L, L->top.p, pos);
+      if (ttiscursor(s2v(pos)))  /* control variable of a 'pairs' loop? */
+        luaV_cursorkey(L, pos, s2v(L->top.p));
+      else
+        setobjs2s(L, L->top.p, pos);
       api_incr_top(L);
     }
   }
@@ -465,6 +471,17 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
         change = 0;
         break;
       }
+      case OP_SWITCH: {  /* jumps to its cases, as OP_JMP does */
+        const SwitchTable *sw = &p->swtabs[GETARG_Bx(i)];
+        int c;
+        for (c = 0; c < sw->ncases; c++) {
+          int dest = sw->cases[c].pc;
+          if (dest <= lastpc && dest > jmptarget)
+            jmptarget = dest;
+        }
+        change = 0;
+        break;
+      }
       default:  /* any instruction that sets A */
         change = (testAMode(op) && reg == a);
         break;
@@ -570,7 +587,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
     return kind;
   else if (lastpc != -1) {  /* could find instruction? */
     Instruction i = p->code[lastpc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = unfusedop(GET_OPCODE(i));
     switch (op) {
       case OP_GETTABUP: {
         int k = GETARG_C(i);  /* key index */
@@ -612,7 +629,7 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
                                      int pc, const char **name) {
   TMS tm = (TMS)0;  /* (initial value avoids warnings) */
   Instruction i = p->code[pc];  /* calling instruction */
-  switch (GET_OPCODE(i)) {
+  switch (unfusedop(GET_OPCODE(i))) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
@@ -635,7 +652,7 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
     case OP_UNM: tm = TM_UNM; break;
     case OP_BNOT: tm = TM_BNOT; break;
     case OP_LEN: tm = TM_LEN; break;
-    case OP_CONCAT: tm = TM_CONCAT; break;
+    case OP_CONCAT: case OP_FSTRING: tm = TM_CONCAT; break;
     case OP_EQ: tm = TM_EQ; break;
     /* no cases for OP_EQI and OP_EQK, as they don't call metamethods */
     case OP_LT: case OP_LTI: case OP_GTI: tm = TM_LT; break;
@@ -737,35 +754,121 @@ static const char *varinfo (lua_State *L, const TValue *o) {
 
 
 /*
-** Raise a type error
+** Identify operand 'o' of the current instruction of Lua function
+** 'ci': a register (non negative), an upvalue (below -1), or something
+** else (-1), which 'varinfo' does not describe.
 */
-static l_noret typeerror (lua_State *L, const TValue *o, const char *op,
-                          const char *extra) {
-  const char *t = luaT_objtypename(L, o);
-  luaG_runerror(L, "attempt to %s a %s value%s", op, t, extra);
+static int operandslot (CallInfo *ci, const TValue *o) {
+  LClosure *c = ci_func(ci);
+  int i;
+  for (i = 0; i < c->nupvalues; i++) {
+    if (c->upvals[i]->v.p == o)
+      return -2 - i;
+  }
+  return instack(ci, o);
+}
+
+
+/*
+** Entry of the error cache for the current instruction of Lua function
+** 'ci', or NULL if there is no cache.
+*/
+static ErrorEntry *errorentry (lua_State *L, CallInfo *ci) {
+  global_State *g = G(L);
+  if (l_unlikely(g->errcache == NULL)) {  /* first use? */
+    size_t size = LUAI_ERRCACHE * sizeof(ErrorEntry);
+    /* (an emergency collection here does not move the stack) */
+    void *block = luaM_realloc_(L, NULL, 0, size);
+    if (block == NULL)
+      return NULL;  /* no cache; build the message */
+    memset(block, 0, size);  /* all entries empty */
+    g->errcache = cast(ErrorEntry *, block);
+  }
+  return &g->errcache[(point2uint(ci->u.l.savedpc) / sizeof(Instruction))
+                      & (LUAI_ERRCACHE - 1)];
 }
 
 
 /*
-** Raise a type error with "standard" information about the faulty
-** object 'o' (using 'varinfo').
+** Raise a type error for operation 'op' on the faulty object 'o', with
+** "standard" information about 'o' (using 'varinfo'). For a call, try
+** first to find a name for the object based on how it was called
+** ('funcnamefromcall'). In a Lua function, the message comes from the
+** error cache when possible, as decoding the bytecode to describe 'o'
+** is much more expensive than raising the error. The collector runs
+** only after 'o' has been described, as it can move the stack.
 */
+static l_noret typeerror (lua_State *L, const TValue *o, const char *op,
+                          int call) {
+  CallInfo *ci = L->ci;
+  const char *t = luaT_objtypename(L, o);
+  const char *extra = NULL;
+  const char *msg;
+  ErrorEntry *e = NULL;
+  int slot = 0;
+  if (isLua(ci) && !(ci->callstatus & (CIST_HOOKED | CIST_FIN))) {
+    slot = operandslot(ci, o);
+    e = errorentry(L, ci);
+    if (e != NULL && e->msg != NULL && e->pc == ci->u.l.savedpc &&
+        e->slot == slot && e->op == op && e->tname == t) {  /* hit? */
+      setsvalue2s(L, L->top.p, e->msg);
+      L->top.p++;  /* assume EXTRA_STACK */
+      luaG_errormsg(L);
+    }
+  }
+  if (call) {
+    const char *name = NULL;  /* to avoid warnings */
+    const char *kind = funcnamefromcall(L, ci, &name);
+    if (kind)
+      extra = formatvarinfo(L, kind, name);
+  }
+  if (extra == NULL)
+    extra = varinfo(L, o);
+  luaC_checkGC(L);  /* error message uses memory ('o' is not used anymore) */
+  msg = luaO_pushfstring(L, "attempt to %s a %s value%s", op, t, extra);
+  if (isLua(ci)) {  /* add source:line information */
+    luaG_addinfo(L, msg, ci_func(ci)->p->source, getcurrentline(ci));
+    setobjs2s(L, L->top.p - 2, L->top.p - 1);  /* remove plain message */
+    L->top.p--;
+  }
+  if (e != NULL) {  /* keep message for next time */
+    e->pc = ci->u.l.savedpc;
+    e->op = op;
+    e->tname = t;
+    e->msg = tsvalue(s2v(L->top.p - 1));
+    e->slot = slot;
+  }
+  luaG_errormsg(L);
+}
+
+
 l_noret luaG_typeerror (lua_State *L, const TValue *o, const char *op) {
-  typeerror(L, o, op, varinfo(L, o));
+  typeerror(L, o, op, 0);
 }
 
 
 /*
-** Raise an error for calling a non-callable object. Try to find a name
-** for the object based on how it was called ('funcnamefromcall'); if it
-** cannot get a name there, try 'varinfo'.
+** Raise an error for calling a non-callable object.
 */
 l_noret luaG_callerror (lua_State *L, const TValue *o) {
-  CallInfo *ci = L->ci;
-  const char *name = NULL;  /* to avoid warnings */
-  const char *kind = funcnamefromcall(L, ci, &name);
-  const char *extra = kind ? formatvarinfo(L, kind, name) : varinfo(L, o);
-  typeerror(L, o, "call", extra);
+  typeerror(L, o, "call", 1);
+}
+
+
+/*
+** Called when the instruction budget goes below zero. Without a budget
+** this only means the (huge) initial count wrapped around, so it is
+** refilled; otherwise the budget stays spent, so that an error handler
+** that keeps running also fails at its next check.
+*/
+void luaG_outofbudget (lua_State *L) {
+  global_State *g = G(L);
+  if (!g->hasbudget)
+    g->budget = MAX_LMEM;
+  else {
+    g->budget = 0;
+    luaG_runerror(L, "instruction budget exceeded");
+  }
 }
 
 
@@ -882,6 +985,18 @@ static int changedline (const Proto *p, int oldpc, int newpc) {
 }
 
 
+/*
+** Mark instruction 'pc' of 'p' as executed.
+*/
+static void covermark (lua_State *L, Proto *p, const Instruction *pc) {
+  if (l_unlikely(p->coverage == NULL)) {  /* first mark? */
+    p->coverage = luaM_newvector(L, p->sizecode, lu_byte);
+    memset(p->coverage, 0, cast_sizet(p->sizecode));
+  }
+  p->coverage[pc - p->code] = 1;
+}
+
+
 /*
 ** Traces Lua calls. If code is running the first instruction of a function,
 ** and function is not vararg, and it is not coming from an yield,
@@ -895,8 +1010,11 @@ int luaG_tracecall (lua_State *L) {
   Proto *p = ci_func(ci)->p;
   ci->u.l.trap = 1;  /* ensure hooks will be checked */
   if (ci->u.l.savedpc == p->code) {  /* first instruction (not resuming)? */
-    if (p->is_vararg)
+    if (p->is_vararg) {
+      if (L->hookmask & MASKCOVER)
+        covermark(L, p, p->code);  /* VARARGPREP is not traced */
       return 0;  /* hooks will start at VARARGPREP instruction */
+    }
     else if (!(ci->callstatus & CIST_HOOKYIELD))  /* not yieded? */
       luaD_hookcall(L, ci);  /* check 'call' hook */
   }
@@ -921,7 +1039,11 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   lu_byte mask = L->hookmask;
   const Proto *p = ci_func(ci)->p;
   int counthook;
+  if (mask & MASKCOVER)
+    covermark(L, ci_func(ci)->p, pc);
   if (!(mask & (LUA_MASKLINE | LUA_MASKCOUNT))) {  /* no hooks? */
+    if (mask & MASKCOVER)
+      return 1;  /* keep 'trap' on for coverage */
     ci->u.l.trap = 0;  /* don't need to stop again */
     return 0;  /* turn off 'trap' */
   }
@@ -960,3 +1082,268 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   return 1;  /* keep 'trap' on */
 }
 
+
+
+
+/*
+** {======================================================
+** Coverage
+** =======================================================
+*/
+
+/*
+** While coverage is on, every thread has MASKCOVER in its 'hookmask',
+** so 'trap' stays on in all Lua functions and 'luaG_traceexec' marks
+** each instruction before it runs, in the 'coverage' array of its
+** prototype; no hook is called and no 'lua_Debug' is filled. Chunks
+** loaded meanwhile are kept in 'g->covered', so that their results
+** outlive them. Prototypes with no 'coverage' array were never run.
+*/
+
+
+/* call 'f' for every object with tag 'tag' (except the main thread) */
+static void foreachobj (lua_State *L, int tag, void *ud,
+                        void (*f) (lua_State *L, GCObject *o, void *ud)) {
+  global_State *g = G(L);
+  GCObject *lists[3];
+  int i;
+  lists[0] = g->allgc; lists[1] = g->finobj; lists[2] = g->tobefnz;
+  for (i = 0; i < 3; i++) {
+    GCObject *o;
+    for (o = lists[i]; o != NULL; o = o->next) {
+      if (o->tt == tag)
+        f(L, o, ud);
+    }
+  }
+}
+
+
+static void setcovermask (lua_State *L, GCObject *o, void *ud) {
+  lua_State *L1 = gco2th(o);
+  UNUSED(ud);
+  if (G(L)->coverage) {
+    L1->hookmask |= MASKCOVER;
+    settraps(L1->ci);
+  }
+  else
+    L1->hookmask &= ~MASKCOVER;
+}
+
+
+static void clearcoverage (lua_State *L, GCObject *o, void *ud) {
+  Proto *p = gco2p(o);
+  UNUSED(ud);
+  if (p->coverage != NULL) {
+    luaM_freearray(L, p->coverage, p->sizecode);
+    p->coverage = NULL;
+  }
+}
+
+
+/*
+** Turn coverage on or off. Turning it on discards previous results.
+*/
+void luaG_setcoverage (lua_State *L, int on) {
+  global_State *g = G(L);
+  if (on) {
+    foreachobj(L, LUA_VPROTO, NULL, clearcoverage);
+    g->ncovered = 0;  /* release previous chunks */
+  }
+  g->coverage = cast_byte(on != 0);
+  setcovermask(L, obj2gco(g->mainthread), NULL);
+  foreachobj(L, LUA_VTHREAD, NULL, setcovermask);
+}
+
+
+/*
+** Keep the main prototype 'p' of a chunk loaded while coverage is on.
+*/
+void luaG_keepcovered (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  luaM_growvector(L, g->covered, g->ncovered, g->sizecovered, Proto *,
+                  MAX_INT, "covered chunks");
+  g->covered[g->ncovered++] = p;
+}
+
+
+typedef struct CovState {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  int nprotos;
+  size_t ncode;  /* total number of instructions in 'protos' */
+  Proto **protos;  /* prototypes to report */
+  int *lines;  /* work area for the lines of a source */
+  size_t n;  /* bytes in 'buff' */
+  char buff[512];
+} CovState;
+
+
+static void covflush (CovState *C) {
+  if (C->n > 0 && C->status == 0) {
+    lua_unlock(C->L);
+    C->status = (*C->writer)(C->L, C->buff, C->n, C->data);
+    lua_lock(C->L);
+  }
+  C->n = 0;
+}
+
+
+static void covstr (CovState *C, const char *s) {
+  for (; *s != '\0'; s++) {
+    if (C->n == sizeof(C->buff))
+      covflush(C);
+    C->buff[C->n++] = *s;
+  }
+}
+
+
+static void covint (CovState *C, int x) {
+  char b[LUAI_MAXSHORTLEN];
+  lua_integer2str(b, sizeof(b), cast(lua_Integer, x));
+  covstr(C, b);
+}
+
+
+/* write a record "key:x,s" (or "key:x" when 's' is NULL) */
+static void covrecord (CovState *C, const char *key, int x,
+                                    const char *s) {
+  covstr(C, key);
+  covint(C, x);
+  if (s != NULL) {
+    covstr(C, ",");
+    covstr(C, s);
+  }
+  covstr(C, "\n");
+}
+
+
+static int reportable (const Proto *p) {
+  return (p->source != NULL && getstr(p->source)[0] == '@' &&
+          p->lineinfo != NULL);
+}
+
+
+static void collectproto (lua_State *L, GCObject *o, void *ud) {
+  CovState *C = cast(CovState *, ud);
+  Proto *p = gco2p(o);
+  UNUSED(L);
+  if (reportable(p)) {
+    if (C->protos != NULL)  /* collecting? */
+      C->protos[C->nprotos] = p;
+    C->nprotos++;
+    C->ncode += cast_sizet(p->sizecode);
+  }
+}
+
+
+static int cmpproto (const void *a, const void *b) {
+  const Proto *p1 = *cast(const Proto *const *, a);
+  const Proto *p2 = *cast(const Proto *const *, b);
+  int res = strcmp(getstr(p1->source), getstr(p2->source));
+  if (res != 0)
+    return res;
+  else if (p1->linedefined != p2->linedefined)
+    return (p1->linedefined < p2->linedefined) ? -1 : 1;
+  else if (p1->lastlinedefined != p2->lastlinedefined)
+    return (p1->lastlinedefined < p2->lastlinedefined) ? -1 : 1;
+  else
+    return 0;
+}
+
+
+static int cmpint (const void *a, const void *b) {
+  int x = *cast(const int *, a);
+  int y = *cast(const int *, b);
+  return (x > y) - (x < y);
+}
+
+
+/*
+** Write the record of one source, with its prototypes in 'v[0..n-1]'
+** (sorted by 'cmpproto'). Prototypes with the same lines (e.g., from
+** a file loaded more than once) count as the same function.
+*/
+static void covsource (CovState *C, Proto **v, int n) {
+  int i, j;
+  int nf = 0, nfhit = 0, nl = 0, nlhit = 0, nlines = 0;
+  covstr(C, "TN:\nSF:");
+  covstr(C, getstr(v[0]->source) + 1);
+  covstr(C, "\n");
+  for (i = 0; i < n; i = j) {  /* functions */
+    char name[32];
+    int line = (v[i]->linedefined > 0) ? v[i]->linedefined : 1;
+    int hit = 0;
+    for (j = i; j < n && cmpproto(&v[i], &v[j]) == 0; j++)
+      hit |= (v[j]->coverage != NULL);
+    if (v[i]->linedefined == 0)
+      strcpy(name, "main chunk");
+    else
+      l_sprintf(name, sizeof(name), "function <%d>", v[i]->linedefined);
+    covrecord(C, "FN:", line, name);
+    covrecord(C, "FNDA:", hit, name);
+    nf++;
+    nfhit += hit;
+  }
+  covrecord(C, "FNF:", nf, NULL);
+  covrecord(C, "FNH:", nfhit, NULL);
+  for (i = 0; i < n; i++) {  /* collect (line, hit) pairs */
+    Proto *p = v[i];
+    int pc;
+    for (pc = 0; pc < p->sizecode; pc++) {
+      int hit = (p->coverage != NULL && p->coverage[pc]);
+      C->lines[nlines++] = luaG_getfuncline(p, pc) * 2 + hit;
+    }
+  }
+  qsort(C->lines, cast_sizet(nlines), sizeof(int), cmpint);
+  for (i = 0; i < nlines; i = j) {  /* lines */
+    int line = C->lines[i] / 2;
+    int hit = 0;
+    for (j = i; j < nlines && C->lines[j] / 2 == line; j++)
+      hit |= C->lines[j] & 1;
+    if (line > 0) {
+      covrecord(C, "DA:", line, hit ? "1" : "0");
+      nl++;
+      nlhit += hit;
+    }
+  }
+  covrecord(C, "LF:", nl, NULL);
+  covrecord(C, "LH:", nlhit, NULL);
+  covstr(C, "end_of_record\n");
+}
+
+
+/*
+** Write the results of coverage in lcov format, as a record for each
+** source file of the live functions (chunks loaded from strings and
+** functions without debug information are not reported). Returns the
+** status of the last call to 'writer'.
+*/
+int luaG_writecoverage (lua_State *L, lua_Writer writer, void *data) {
+  CovState C;
+  size_t size;
+  int i, j;
+  C.L = L; C.writer = writer; C.data = data;
+  C.status = 0; C.n = 0;
+  C.nprotos = 0; C.ncode = 0; C.protos = NULL;
+  foreachobj(L, LUA_VPROTO, &C, collectproto);  /* count prototypes */
+  /* one block for the prototypes and the lines of all of them */
+  size = cast_sizet(C.nprotos) * sizeof(Proto *) + C.ncode * sizeof(int);
+  C.protos = cast(Proto **, luaM_malloc_(L, size + 1, 0));
+  C.lines = cast(int *, C.protos + C.nprotos);
+  C.nprotos = 0;
+  foreachobj(L, LUA_VPROTO, &C, collectproto);  /* collect them */
+  qsort(C.protos, cast_sizet(C.nprotos), sizeof(Proto *), cmpproto);
+  for (i = 0; i < C.nprotos; i = j) {
+    for (j = i; j < C.nprotos && strcmp(getstr(C.protos[i]->source),
+                                       getstr(C.protos[j]->source)) == 0; j++)
+      ;
+    covsource(&C, C.protos + i, j - i);
+  }
+  covflush(&C);
+  luaM_freemem(L, C.protos, size + 1);
+  return C.status;
+}
+
+/* }====================================================== */
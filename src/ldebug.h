@@ -14,6 +14,14 @@
 #define pcRel(pc, p)	(cast_int((pc) - (p)->code) - 1)
 
 
+/*
+** Bit of 'hookmask' set in every thread while coverage is on (see
+** 'luaG_setcoverage'). It is not a hook: 'lua_sethook' keeps it and
+** 'lua_gethookmask' hides it.
+*/
+#define MASKCOVER	(1 << 6)
+
+
 /* Active Lua function (given call info) */
 #define ci_func(ci)		(clLvalue(s2v((ci)->func.p)))
 
@@ -42,6 +50,7 @@ LUAI_FUNC const char *luaG_findlocal (lua_State *L, CallInfo *ci, int n,
 LUAI_FUNC l_noret luaG_typeerror (lua_State *L, const TValue *o,
                                                 const char *opname);
 LUAI_FUNC l_noret luaG_callerror (lua_State *L, const TValue *o);
+LUAI_FUNC void luaG_outofbudget (lua_State *L);
 LUAI_FUNC l_noret luaG_forerror (lua_State *L, const TValue *o,
                                                const char *what);
 LUAI_FUNC l_noret luaG_concaterror (lua_State *L, const TValue *p1,
@@ -59,6 +68,10 @@ LUAI_FUNC const char *luaG_addinfo (lua_State *L, const char *msg,
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNC int luaG_traceexec (lua_State *L, const Instruction *pc);
 LUAI_FUNC int luaG_tracecall (lua_State *L);
+LUAI_FUNC void luaG_setcoverage (lua_State *L, int on);
+LUAI_FUNC void luaG_keepcovered (lua_State *L, Proto *p);
+LUAI_FUNC int luaG_writecoverage (lua_State *L, lua_Writer writer,
+                                                void *data);
 
 
 #endif
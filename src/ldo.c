@@ -47,8 +47,9 @@
 /*
 ** LUAI_THROW/LUAI_TRY define how Lua does exception handling. By
 ** default, Lua handles errors with exceptions when compiling as
-** C++ code, with _longjmp/_setjmp when asked to use them, and with
-** longjmp/setjmp otherwise.
+** C++ code or when asked to use WebAssembly exceptions, with
+** _longjmp/_setjmp when asked to use them, and with longjmp/setjmp
+** otherwise.
 */
 #if !defined(LUAI_THROW)				/* { */
 
@@ -60,6 +61,23 @@
 	try { a } catch(...) { if ((c)->status == 0) (c)->status = -1; }
 #define luai_jmpbuf		int  /* dummy variable */
 
+#elif defined(LUA_USE_WASMEH)				/* }{ */
+
+/*
+** WebAssembly exceptions, thrown and caught by the C++ functions in
+** 'lwasmeh.cpp' (build every unit with -fwasm-exceptions). Unlike the
+** emulation of setjmp, a protected call costs nothing when there are
+** no errors. ('LUAI_TRY' is used only by 'luaD_rawrunprotected',
+** whose body is the call 'f(L, ud)'.)
+*/
+extern int luai_wasmtry (lua_State *L, Pfunc f, void *ud);
+extern l_noret luai_wasmthrow (void *c);
+
+#define LUAI_THROW(L,c)		luai_wasmthrow(c)
+#define LUAI_TRY(L,c,a) \
+	if (luai_wasmtry(L, f, ud) != 0 && (c)->status == 0) (c)->status = -1;
+#define luai_jmpbuf		int  /* dummy variable */
+
 #elif defined(LUA_USE_POSIX)				/* }{ */
 
 /* in POSIX, try _longjmp/_setjmp (more efficient) */
@@ -257,8 +275,10 @@ int luaD_growstack (lua_State *L, int n, int raiseerror) {
       newsize = LUAI_MAXSTACK;
     if (newsize < needed)  /* but must respect what was asked for */
       newsize = needed;
-    if (l_likely(newsize <= LUAI_MAXSTACK))
+    if (l_likely(newsize <= LUAI_MAXSTACK)) {
+      L->stackgrew = 1;
       return luaD_reallocstack(L, newsize, raiseerror);
+    }
   }
   /* else stack overflow */
   /* add extra size to be able to handle the error message */
@@ -296,18 +316,28 @@ static int stackinuse (lua_State *L) {
 ** it is not, 'max' (limited by LUAI_MAXSTACK) will be smaller than
 ** stacksize (equal to ERRORSTACKSIZE in this case), and so the stack
 ** will be reduced to a "regular" size.
+** A stack that grew since the previous call keeps its size until the
+** next one, so that a workload oscillating around a given depth does
+** not reallocate its stack at every collection. The stack also never
+** goes below the size reserved by 'lua_reservestack'.
 */
 void luaD_shrinkstack (lua_State *L) {
   int inuse = stackinuse(L);
   int max = (inuse > LUAI_MAXSTACK / 3) ? LUAI_MAXSTACK : inuse * 3;
+  if (max < L->stackreserve)
+    max = L->stackreserve;
   /* if thread is currently not handling a stack overflow and its
      size is larger than maximum "reasonable" size, shrink it */
-  if (inuse <= LUAI_MAXSTACK && stacksize(L) > max) {
+  if (inuse <= LUAI_MAXSTACK && stacksize(L) > max &&
+      (!L->stackgrew || stacksize(L) > LUAI_MAXSTACK)) {
     int nsize = (inuse > LUAI_MAXSTACK / 2) ? LUAI_MAXSTACK : inuse * 2;
+    if (nsize < L->stackreserve)
+      nsize = L->stackreserve;
     luaD_reallocstack(L, nsize, 0);  /* ok if that fails */
   }
   else  /* don't change stack */
     condmovestack(L,{},{});  /* (change only for debugging) */
+  L->stackgrew = 0;
   luaE_shrinkCI(L);  /* shrink CI list */
 }
 
@@ -534,6 +564,34 @@ l_sinline int precallC (lua_State *L, StkId func, int nresults,
 }
 
 
+/*
+** Call a fast C function (see 'lua_pushfastcfunction') from OP_CALL.
+** As these functions do not yield, the call can skip the generic
+** dispatch of 'luaD_precall' and 'luaD_poscall': it only builds the
+** CallInfo the API needs and moves the results. Returns 0, doing
+** nothing, when the call must take the generic path, because hooks are
+** active or the stack has no room for LUA_MINSTACK slots.
+*/
+int luaD_callfast (lua_State *L, StkId func, int nresults) {
+  CallInfo *ci;
+  int n;
+  if (l_unlikely(L->hookmask || L->stack_last.p - L->top.p <= LUA_MINSTACK))
+    return 0;
+  L->ci = ci = prepCallInfo(L, func, nresults, CIST_C,
+                               L->top.p + LUA_MINSTACK);
+  incnny(L);  /* a yield here is an error */
+  lua_unlock(L);
+  n = (*fvalue(s2v(func)))(L);  /* do the actual call */
+  lua_lock(L);
+  decnny(L);
+  api_checknelems(L, n);
+  /* stack may have moved, and 'lua_toclose' may have changed 'nresults' */
+  moveresults(L, ci->func.p, n, ci->nresults);
+  L->ci = ci->previous;
+  return 1;
+}
+
+
 /*
 ** Prepare a function for a tail call, building its call info on top
 ** of the current call info. 'narg1' is the number of arguments plus 1
@@ -546,13 +604,15 @@ int luaD_pretailcall (lua_State *L, CallInfo *ci, StkId func,
   switch (ttypetag(s2v(func))) {
     case LUA_VCCL:  /* C closure */
       return precallC(L, func, LUA_MULTRET, clCvalue(s2v(func))->f);
-    case LUA_VLCF:  /* light C function */
+    case LUA_VLCF: case LUA_VFCF:  /* light C function */
       return precallC(L, func, LUA_MULTRET, fvalue(s2v(func)));
     case LUA_VLCL: {  /* Lua function */
       Proto *p = clLvalue(s2v(func))->p;
       int fsize = p->maxstacksize;  /* frame size */
       int nfixparams = p->numparams;
       int i;
+      if (l_unlikely(p->kblob != NULL))  /* secure constants not decoded? */
+        luaU_decodek(L, p);
       checkstackGCp(L, fsize - delta, func);
       ci->func.p -= delta;  /* restore 'func' (if vararg) */
       for (i = 0; i < narg1; i++)  /* move down function and arguments */
@@ -591,7 +651,7 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
     case LUA_VCCL:  /* C closure */
       precallC(L, func, nresults, clCvalue(s2v(func))->f);
       return NULL;
-    case LUA_VLCF:  /* light C function */
+    case LUA_VLCF: case LUA_VFCF:  /* light C function */
       precallC(L, func, nresults, fvalue(s2v(func)));
       return NULL;
     case LUA_VLCL: {  /* Lua function */
@@ -600,6 +660,8 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
       int narg = cast_int(L->top.p - func) - 1;  /* number of real arguments */
       int nfixparams = p->numparams;
       int fsize = p->maxstacksize;  /* frame size */
+      if (l_unlikely(p->kblob != NULL))  /* secure constants not decoded? */
+        luaU_decodek(L, p);
       checkstackGCp(L, fsize, func);
       L->ci = ci = prepCallInfo(L, func, nresults, 0, func + 1 + fsize);
       ci->u.l.savedpc = p->code;  /* starting point */
@@ -995,7 +1057,8 @@ static void f_parser (lua_State *L, void *ud) {
   int c = zgetc(p->z);  /* read first character */
   if (c == LUA_SIGNATURE[0]) {
     checkmode(L, p->mode, "binary");
-    cl = luaU_undump(L, p->z, p->name);
+    cl = luaU_undump(L, p->z, p->name,
+                     (p->mode != NULL && strchr(p->mode, 'F') != NULL));
   }
   else {
     checkmode(L, p->mode, "text");
@@ -1003,24 +1066,79 @@ static void f_parser (lua_State *L, void *ud) {
   }
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luaF_initupvals(L, cl);
+  if (G(L)->coverage)
+    luaG_keepcovered(L, cl->p);
+}
+
+
+/*
+** Buffers of the scanner and the parser, kept by the state after a
+** parse so that a state compiling many chunks does not allocate them
+** again for each one. A parse takes them out of the state, so that a
+** nested parse (e.g., from a finalizer) gets its own buffers. A scanner
+** buffer larger than MAXKEPTBUFF is not kept.
+*/
+struct ParseBuffers {
+  Mbuffer buff;
+  Dyndata dyd;
+};
+
+#if !defined(MAXKEPTBUFF)
+#define MAXKEPTBUFF	(64 * 1024)
+#endif
+
+
+static void freebuffers (lua_State *L, Mbuffer *buff, Dyndata *dyd) {
+  luaZ_freebuffer(L, buff);
+  luaM_freearray(L, dyd->actvar.arr, dyd->actvar.size);
+  luaM_freearray(L, dyd->gt.arr, dyd->gt.size);
+  luaM_freearray(L, dyd->label.arr, dyd->label.size);
+}
+
+
+void luaD_freeparsebuffers (lua_State *L) {
+  struct ParseBuffers *pb = G(L)->parsebuffers;
+  if (pb != NULL) {
+    G(L)->parsebuffers = NULL;
+    freebuffers(L, &pb->buff, &pb->dyd);
+    luaM_free(L, pb);
+  }
 }
 
 
 int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
                                         const char *mode) {
   struct SParser p;
+  struct ParseBuffers *pb = G(L)->parsebuffers;
   int status;
   incnny(L);  /* cannot yield during parsing */
   p.z = z; p.name = name; p.mode = mode;
-  p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
-  p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
-  p.dyd.label.arr = NULL; p.dyd.label.size = 0;
-  luaZ_initbuffer(L, &p.buff);
+  if (pb != NULL) {  /* reuse kept buffers */
+    G(L)->parsebuffers = NULL;  /* they are in use now */
+    p.buff = pb->buff;
+    p.dyd = pb->dyd;
+  }
+  else {
+    p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
+    p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
+    p.dyd.label.arr = NULL; p.dyd.label.size = 0;
+    luaZ_initbuffer(L, &p.buff);
+  }
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top.p), L->errfunc);
-  luaZ_freebuffer(L, &p.buff);
-  luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
-  luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
-  luaM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
+  if (luaZ_sizebuffer(&p.buff) > MAXKEPTBUFF)
+    luaZ_freebuffer(L, &p.buff);
+  if (pb == NULL)  /* try to keep the buffers (no error if it fails) */
+    pb = cast(struct ParseBuffers *,
+              luaM_realloc_(L, NULL, 0, sizeof(struct ParseBuffers)));
+  if (pb != NULL && G(L)->parsebuffers == NULL) {
+    pb->buff = p.buff;
+    pb->dyd = p.dyd;
+    G(L)->parsebuffers = pb;
+  }
+  else {  /* a nested parse kept its own buffers */
+    freebuffers(L, &p.buff, &p.dyd);
+    if (pb != NULL) luaM_free(L, pb);
+  }
   decnny(L);
   return status;
 }
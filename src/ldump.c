@@ -17,19 +17,52 @@
 
 #include "lua.h"
 
+#include "ldo.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "lundump.h"
 
+
+/*
+** A string of the chunk (see 'countStrings'); 'idx' is its index in the
+** pool, or -1 if it is not in the pool.
+*/
+typedef struct StrEntry {
+  TString *s;
+  int count;  /* number of uses of 's' in the dump */
+  int idx;
+} StrEntry;
+
+
 typedef struct {
   lua_State *L;
   lua_Writer writer;
   void *data;
   int strip;
   int status;
+  size_t offset;  /* current position relative to beginning of dump */
+  StrEntry *strs;  /* strings of the chunk, in order of first use */
+  int nstrs;  /* number of entries in 'strs' */
+  int sizestrs;  /* size of 'strs' */
+  int *slots;  /* hash of 'strs': index + 1 of an entry, or 0 when free */
+  int sizeslots;  /* size of 'slots' (a power of 2) */
+  const Proto *f;  /* function being dumped */
+  struct Scratch *scratch;  /* buffer for code and secure constants */
 } DumpState;
 
 
+/*
+** Scratch buffer of a dump, shared by the copies of the state used to
+** compute sizes (see 'functionSize').
+*/
+typedef struct Scratch {
+  void *p;
+  size_t size;
+} Scratch;
+
+
 /*
 ** All high-level dumps go through dumpVector; you can change it to
 ** change the endianness of the result
@@ -41,13 +74,31 @@ typedef struct {
 
 static void dumpBlock (DumpState *D, const void *b, size_t size) {
   if (D->status == 0 && size > 0) {
-    lua_unlock(D->L);
-    D->status = (*D->writer)(D->L, b, size, D->data);
-    lua_lock(D->L);
+    if (D->writer != NULL) {  /* not only counting? (see 'functionSize') */
+      lua_unlock(D->L);
+      D->status = (*D->writer)(D->L, b, size, D->data);
+      lua_lock(D->L);
+    }
+    D->offset += size;
   }
 }
 
 
+/*
+** Dump enough zeros to ensure that current position is a multiple of
+** 'align'.
+*/
+static void dumpAlign (DumpState *D, unsigned int align) {
+  unsigned int padding = align - cast_uint(D->offset % align);
+  if (padding < align) {  /* padding == align means no padding */
+    static const lua_Integer paddingContent = 0;
+    lua_assert(align <= sizeof(lua_Integer));
+    dumpBlock(D, &paddingContent, padding);
+  }
+  lua_assert(D->status != 0 || D->offset % align == 0);
+}
+
+
 #define dumpVar(D,x)		dumpVector(D,&x,1)
 
 
@@ -80,6 +131,13 @@ static void dumpInt (DumpState *D, int x) {
 }
 
 
+/* signed integers go in zigzag order, so that small ones are short */
+static void dumpSigned (DumpState *D, int x) {
+  unsigned int u = cast_uint(x);
+  dumpSize(D, (x < 0) ? ~(u << 1) : u << 1);
+}
+
+
 static void dumpNumber (DumpState *D, lua_Number x) {
   dumpVar(D, x);
 }
@@ -90,36 +148,205 @@ static void dumpInteger (DumpState *D, lua_Integer x) {
 }
 
 
+/*
+** {======================================================
+** String pool
+** =======================================================
+*/
+
+/*
+** Strings used more than once in a chunk, as constants of plain
+** functions or in its debug information, are dumped only once, in a
+** pool before the main function; each use is then dumped as its index
+** in the pool. The pool keeps the order of first use, so that the dump
+** of a chunk does not depend on addresses or on the hash seed.
+*/
+
+static unsigned int strhash (TString *s) {
+  return (s->tt == LUA_VSHRSTR) ? s->hash : luaS_hashlongstr(s);
+}
+
+
+static int eqstr (TString *a, TString *b) {
+  return (a == b) || (a->tt == LUA_VLNGSTR && b->tt == LUA_VLNGSTR &&
+                      luaS_eqlngstr(a, b));
+}
+
+
+static StrEntry *findstr (DumpState *D, TString *s) {
+  if (D->sizeslots > 0) {
+    unsigned int mask = cast_uint(D->sizeslots - 1);
+    unsigned int i = strhash(s) & mask;
+    int e;
+    while ((e = D->slots[i]) != 0) {
+      if (eqstr(D->strs[e - 1].s, s))
+        return &D->strs[e - 1];
+      i = (i + 1) & mask;
+    }
+  }
+  return NULL;
+}
+
+
+static void insertslot (DumpState *D, int e) {
+  unsigned int mask = cast_uint(D->sizeslots - 1);
+  unsigned int i = strhash(D->strs[e].s) & mask;
+  while (D->slots[i] != 0)
+    i = (i + 1) & mask;
+  D->slots[i] = e + 1;
+}
+
+
+/* keep 'slots' at most half full */
+static void growslots (DumpState *D) {
+  int newsize = (D->sizeslots == 0) ? 32 : D->sizeslots * 2;
+  int i;
+  if (newsize <= 0 || newsize > MAX_INT / 2)
+    luaM_toobig(D->L);
+  luaM_freearray(D->L, D->slots, D->sizeslots);
+  D->slots = NULL; D->sizeslots = 0;  /* in case the allocation fails */
+  D->slots = luaM_newvector(D->L, newsize, int);
+  D->sizeslots = newsize;
+  for (i = 0; i < newsize; i++)
+    D->slots[i] = 0;
+  for (i = 0; i < D->nstrs; i++)
+    insertslot(D, i);
+}
+
+
+static void countString (DumpState *D, TString *s) {
+  StrEntry *e;
+  if (s == NULL)
+    return;
+  e = findstr(D, s);
+  if (e != NULL)
+    e->count++;
+  else {
+    if (D->nstrs + 1 > D->sizeslots / 2)
+      growslots(D);
+    luaM_growvector(D->L, D->strs, D->nstrs, D->sizestrs, StrEntry,
+                    MAX_INT, "strings");
+    D->strs[D->nstrs].s = s;
+    D->strs[D->nstrs].count = 1;
+    D->strs[D->nstrs].idx = -1;
+    insertslot(D, D->nstrs++);
+  }
+}
+
+
+/*
+** Count the uses of each string that 'dumpString' will dump for 'f'
+** and its nested functions.
+*/
+static void countStrings (DumpState *D, const Proto *f, TString *psource) {
+  int i;
+  if (!(D->strip || f->source == psource))
+    countString(D, f->source);
+  if (!f->is_encrypted) {  /* (constants of secure functions are not) */
+    for (i = 0; i < f->sizek; i++) {
+      if (ttisstring(&f->k[i]))
+        countString(D, tsvalue(&f->k[i]));
+    }
+  }
+  for (i = 0; i < f->sizep; i++)
+    countStrings(D, luaU_getproto(D->L, cast(Proto *, f), i), f->source);
+  if (!D->strip) {
+    for (i = 0; i < f->sizelocvars; i++)
+      countString(D, f->locvars[i].varname);
+    for (i = 0; i < f->sizeupvalues; i++)
+      countString(D, f->upvalues[i].name);
+  }
+}
+
+
+static void freeDumpState (DumpState *D) {
+  luaM_freearray(D->L, D->strs, D->sizestrs);
+  luaM_freearray(D->L, D->slots, D->sizeslots);
+  luaM_freemem(D->L, D->scratch->p, D->scratch->size);
+}
+
+
+/*
+** Scratch buffer with at least 'size' bytes, kept in the dump state so
+** that it is freed even if the writer raises an error.
+*/
+static void *dumpBuffer (DumpState *D, size_t size) {
+  Scratch *sb = D->scratch;
+  if (size > sb->size) {
+    luaM_freemem(D->L, sb->p, sb->size);
+    sb->p = NULL; sb->size = 0;  /* in case the allocation fails */
+    sb->p = luaM_malloc_(D->L, size, 0);
+    sb->size = size;
+  }
+  return sb->p;
+}
+
+
+/*
+** A string is dumped as a size: 0 for NULL, '2 * i + 1' for the string
+** with index 'i' in the pool, or '2 * (len + 1)' for a string of length
+** 'len', which then follows.
+*/
 static void dumpString (DumpState *D, const TString *s) {
   if (s == NULL)
     dumpSize(D, 0);
   else {
-    size_t size = tsslen(s);
-    const char *str = getstr(s);
-    dumpSize(D, size + 1);
-    dumpVector(D, str, size);
+    StrEntry *e = findstr(D, cast(TString *, s));
+    if (e != NULL && e->idx >= 0)
+      dumpSize(D, cast_sizet(e->idx) * 2 + 1);
+    else {
+      size_t size = tsslen(s);
+      dumpSize(D, (size + 1) * 2);
+      dumpVector(D, getstr(s), size);
+    }
   }
 }
 
-static void scramble_bytes(void *data, size_t size) {
-  unsigned char *p = (unsigned char *)data;
-  unsigned char key = 0xBE;
-  for (size_t i = 0; i < size; i++) {
-    p[i] ^= key;
+
+static void dumpPool (DumpState *D) {
+  int i, n = 0;
+  for (i = 0; i < D->nstrs; i++) {
+    if (D->strs[i].count > 1)
+      n++;
   }
+  dumpInt(D, n);
+  n = 0;
+  for (i = 0; i < D->nstrs; i++) {
+    if (D->strs[i].count > 1) {
+      dumpString(D, D->strs[i].s);  /* not in the pool yet */
+      D->strs[i].idx = n++;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** Check value for the key of a secure function (see 'checkKey').
+*/
+static void dumpKeyCheck (DumpState *D) {
+  l_uint32 check = LUAC_KEYCHECK;
+  luaU_scramble(&check, sizeof(check), ~G(D->L)->securekey);
+  dumpVar(D, check);
 }
 
+/*
+** Code is always dumped without superinstructions (see 'luaP_fuse');
+** they are recreated when the chunk is loaded. The vector is aligned,
+** so that a chunk loaded from a fixed buffer can use it in place.
+*/
 static void dumpCode (DumpState *D, const Proto *f) {
+  Instruction *buff = cast(Instruction *,
+                  dumpBuffer(D, f->sizecode * sizeof(Instruction)));
+  memcpy(buff, f->code, f->sizecode * sizeof(Instruction));
+  luaP_unfuse(buff, f->sizecode);
   dumpInt(D, f->sizecode);
-  if (f->is_encrypted) {
-      Instruction *buff = luaM_newvector(D->L, f->sizecode, Instruction);
-      memcpy(buff, f->code, f->sizecode * sizeof(Instruction));
-      scramble_bytes(buff, f->sizecode);
-      dumpVector(D, buff, f->sizecode);
-      luaM_freearray(D->L, buff, f->sizecode);
-  } else {
-    dumpVector(D, f->code, f->sizecode);
-  }
+  dumpAlign(D, sizeof(Instruction));
+  if (f->is_encrypted)
+    luaU_scramble(buff, f->sizecode * sizeof(Instruction),
+                  G(D->L)->securekey);
+  dumpVector(D, buff, f->sizecode);
 }
 
 
@@ -128,6 +355,8 @@ static void dumpFunction(DumpState *D, const Proto *f, TString *psource);
 static void dumpConstants (DumpState *D, const Proto *f) {
   int i;
   int n = f->sizek;
+  if (f->kblob != NULL)  /* secure constants not decoded yet? */
+    luaU_decodek(D->L, cast(Proto *, f));
   dumpInt(D, n);
   for (i = 0; i < n; i++) {
     const TValue *o = &f->k[i];
@@ -135,15 +364,13 @@ static void dumpConstants (DumpState *D, const Proto *f) {
     if (f->is_encrypted && ttisstring(o)) {
       TString *ts = tsvalue(o);
       size_t len = tsslen(ts);
-      char *encrypted = luaM_newvector(D->L, len, char);
+      char *encrypted = cast_charp(dumpBuffer(D, len));
       memcpy(encrypted, getstr(ts), len);
-      // Simple XOR scramble. (not secure)
-      scramble_bytes(encrypted, len);
+      luaU_scramble(encrypted, len, G(D->L)->securekey);
       int tt = ttypetag(o);
       dumpByte(D, tt);
       dumpSize(D, len);
       dumpVector(D, encrypted, len);
-      luaM_freearray(D->L, encrypted, len);
     } else {
       int tt = ttypetag(o);
       dumpByte(D, tt);
@@ -165,12 +392,52 @@ static void dumpConstants (DumpState *D, const Proto *f) {
   }
 }
 
+/*
+** Size of the dump of function 'f', computed without writing it.
+*/
+static size_t functionSize (DumpState *D, const Proto *f, TString *psource) {
+  DumpState C = *D;
+  C.writer = NULL;  /* only count */
+  C.status = 0;
+  C.offset = 0;
+  dumpFunction(&C, f, psource);
+  return C.offset;
+}
+
+
+/*
+** Each nested function is preceded by its size, so that the loader can
+** keep it without decoding it (see 'loadLazy'), and is aligned, so that
+** its size does not depend on where it starts.
+*/
 static void dumpProtos (DumpState *D, const Proto *f) {
   int i;
   int n = f->sizep;
   dumpInt(D, n);
-  for (i = 0; i < n; i++)
-    dumpFunction(D, f->p[i], f->source);
+  for (i = 0; i < n; i++) {
+    const Proto *p = luaU_getproto(D->L, cast(Proto *, f), i);
+    size_t size = functionSize(D, p, f->source);
+    dumpSize(D, size);
+    dumpAlign(D, sizeof(Instruction));
+    if (D->writer == NULL)  /* only counting? */
+      D->offset += size;  /* no need to go deeper */
+    else
+      dumpFunction(D, p, f->source);
+  }
+}
+
+
+static void dumpSwitches (DumpState *D, const Proto *f) {
+  int i, c;
+  dumpInt(D, f->sizeswtabs);
+  for (i = 0; i < f->sizeswtabs; i++) {
+    const SwitchTable *sw = &f->swtabs[i];
+    dumpInt(D, sw->ncases);
+    for (c = 0; c < sw->ncases; c++) {
+      dumpInt(D, sw->cases[c].k);
+      dumpInt(D, sw->cases[c].pc);
+    }
+  }
 }
 
 
@@ -192,9 +459,11 @@ static void dumpDebug (DumpState *D, const Proto *f) {
   dumpVector(D, f->lineinfo, n);
   n = (D->strip) ? 0 : f->sizeabslineinfo;
   dumpInt(D, n);
-  for (i = 0; i < n; i++) {
-    dumpInt(D, f->abslineinfo[i].pc);
-    dumpInt(D, f->abslineinfo[i].line);
+  for (i = 0; i < n; i++) {  /* differences from the previous entry */
+    int pc = (i == 0) ? 0 : f->abslineinfo[i - 1].pc;
+    int line = (i == 0) ? f->linedefined : f->abslineinfo[i - 1].line;
+    dumpInt(D, f->abslineinfo[i].pc - pc);
+    dumpSigned(D, f->abslineinfo[i].line - line);
   }
   n = (D->strip) ? 0 : f->sizelocvars;
   dumpInt(D, n);
@@ -212,6 +481,8 @@ static void dumpDebug (DumpState *D, const Proto *f) {
 
 static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
   dumpByte(D, f->is_encrypted);
+  if (f->is_encrypted)
+    dumpKeyCheck(D);
   if (D->strip || f->source == psource)
     dumpString(D, NULL);  /* no debug info or same source as its parent */
   else
@@ -223,6 +494,7 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
   dumpByte(D, f->maxstacksize);
   dumpCode(D, f);
   dumpConstants(D, f);
+  dumpSwitches(D, f);
   dumpUpvalues(D, f);
   dumpProtos(D, f);
   dumpDebug(D, f);
@@ -245,17 +517,46 @@ static void dumpHeader (DumpState *D) {
 /*
 ** dump Lua function as precompiled chunk
 */
+static void f_dump (lua_State *L, void *ud) {
+  DumpState *D = cast(DumpState *, ud);
+  const Proto *f = D->f;
+  UNUSED(L);
+  countStrings(D, f, NULL);
+  dumpHeader(D);
+  dumpByte(D, f->sizeupvalues);
+  dumpPool(D);
+  dumpFunction(D, f, NULL);
+}
+
+
+/*
+** Dump the function; the string pool is freed even if the dump raises
+** an error (e.g., a memory error in the writer), which is then
+** propagated.
+*/
 int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
               int strip) {
   DumpState D;
+  Scratch sb;
+  int status;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
   D.status = 0;
-  dumpHeader(&D);
-  dumpByte(&D, f->sizeupvalues);
-  dumpFunction(&D, f, NULL);
+  D.offset = 0;
+  D.strs = NULL;
+  D.nstrs = D.sizestrs = 0;
+  D.slots = NULL;
+  D.sizeslots = 0;
+  D.f = f;
+  sb.p = NULL;
+  sb.size = 0;
+  D.scratch = &sb;
+  status = luaD_rawrunprotected(L, f_dump, &D);
+  freeDumpState(&D);
+  if (l_unlikely(status != LUA_OK))
+    luaD_throw(L, status);
   return D.status;
 }
 
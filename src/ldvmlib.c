@@ -0,0 +1,411 @@
+/*
+** $Id: ldvmlib.c $
+** Binary serialization of Lua values
+** See Copyright Notice in lua.h
+*/
+
+#define ldvmlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A packed value is a tag byte followed by its payload. Integers and
+** lengths are varints (integers in zigzag order); floats are the bytes
+** of a 'lua_Number', so packed data is meant to be unpacked by the same
+** kind of build. A table is packed as the size of its sequence and the
+** number of its other pairs, followed by the values of the sequence and
+** then by the pairs. Each table packed gets the next number, starting
+** from 1, and a table met again is packed as a reference to its number,
+** so shared tables stay shared and cycles work.
+*/
+enum {
+  DVM_NIL, DVM_FALSE, DVM_TRUE, DVM_INT, DVM_FLOAT, DVM_STR, DVM_TABLE,
+  DVM_REF
+};
+
+
+/* maximum nesting of tables packed or unpacked */
+#if !defined(DVM_MAXDEPTH)
+#define DVM_MAXDEPTH	200
+#endif
+
+
+/* maximum size of a varint */
+#define MAXVARINT	((sizeof(lua_Unsigned) * 8 + 6) / 7)
+
+
+/*
+** {======================================================
+** Packing
+** =======================================================
+*/
+
+/*
+** The packed bytes grow in a userdata at stack index 'box'. (A
+** 'luaL_Buffer' needs a balanced stack at each operation, which the
+** table traversal cannot keep.)
+*/
+typedef struct Packer {
+  lua_State *L;
+  char *b;
+  size_t n;  /* bytes in use */
+  size_t size;
+  int box;  /* index of the userdata holding 'b' */
+  int seen;  /* index of the table mapping tables to their numbers */
+  lua_Integer ntables;
+} Packer;
+
+
+static char *reserve (Packer *p, size_t sz) {
+  if (p->size - p->n < sz) {
+    size_t newsize = p->size * 2;
+    char *newb;
+    if (newsize - p->n < sz) {
+      if (~(size_t)0 - sz < p->n)
+        luaL_error(p->L, "packed data too large");
+      newsize = p->n + sz;
+    }
+    newb = (char *)lua_newuserdatauv(p->L, newsize, 0);
+    memcpy(newb, p->b, p->n);
+    lua_replace(p->L, p->box);  /* old block is garbage now */
+    p->b = newb;
+    p->size = newsize;
+  }
+  return p->b + p->n;
+}
+
+
+static void putbyte (Packer *p, int c) {
+  *reserve(p, 1) = (char)c;
+  p->n++;
+}
+
+
+static void putvarint (Packer *p, lua_Unsigned x) {
+  char *s = reserve(p, MAXVARINT);
+  size_t n = 0;
+  while (x >= 0x80) {
+    s[n++] = (char)((x & 0x7f) | 0x80);
+    x >>= 7;
+  }
+  s[n++] = (char)x;
+  p->n += n;
+}
+
+
+static void putbytes (Packer *p, const void *s, size_t l) {
+  memcpy(reserve(p, l), s, l);
+  p->n += l;
+}
+
+
+/* whether the key at 'k' is in the sequence '1..n' of its table */
+static int inseq (lua_State *L, int k, lua_Unsigned n) {
+  if (lua_type(L, k) == LUA_TNUMBER && lua_isinteger(L, k)) {
+    lua_Integer i = lua_tointeger(L, k);
+    return (i >= 1 && (lua_Unsigned)i <= n);
+  }
+  return 0;
+}
+
+
+static void packvalue (Packer *p, int idx, int depth);
+
+
+static void packtable (Packer *p, int idx, int depth) {
+  lua_State *L = p->L;
+  lua_Unsigned n, nh = 0, i;
+  lua_pushvalue(L, idx);
+  if (lua_rawget(L, p->seen) == LUA_TNUMBER) {  /* already packed? */
+    putbyte(p, DVM_REF);
+    putvarint(p, (lua_Unsigned)lua_tointeger(L, -1));
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pop(L, 1);
+  if (depth >= DVM_MAXDEPTH)
+    luaL_error(L, "tables nested too deep");
+  luaL_checkstack(L, 4, "tables nested too deep");
+  lua_pushvalue(L, idx);
+  lua_pushinteger(L, ++p->ntables);
+  lua_rawset(L, p->seen);
+  n = (lua_Unsigned)lua_rawlen(L, idx);
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {  /* count the other pairs */
+    lua_pop(L, 1);
+    if (!inseq(L, -1, n)) nh++;
+  }
+  putbyte(p, DVM_TABLE);
+  putvarint(p, n);
+  putvarint(p, nh);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, idx, (lua_Integer)i);
+    packvalue(p, lua_gettop(L), depth + 1);
+    lua_pop(L, 1);
+  }
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    int v = lua_gettop(L);
+    if (!inseq(L, v - 1, n)) {
+      packvalue(p, v - 1, depth + 1);
+      packvalue(p, v, depth + 1);
+    }
+    lua_pop(L, 1);
+  }
+}
+
+
+static void packvalue (Packer *p, int idx, int depth) {
+  lua_State *L = p->L;
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      putbyte(p, DVM_NIL);
+      break;
+    case LUA_TBOOLEAN:
+      putbyte(p, lua_toboolean(L, idx) ? DVM_TRUE : DVM_FALSE);
+      break;
+    case LUA_TNUMBER: {
+      if (lua_isinteger(L, idx)) {
+        lua_Integer i = lua_tointeger(L, idx);
+        lua_Unsigned u = (lua_Unsigned)i << 1;
+        putbyte(p, DVM_INT);
+        putvarint(p, (i < 0) ? ~u : u);
+      }
+      else {
+        lua_Number f = lua_tonumber(L, idx);
+        putbyte(p, DVM_FLOAT);
+        putbytes(p, &f, sizeof(f));
+      }
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, idx, &l);
+      putbyte(p, DVM_STR);
+      putvarint(p, (lua_Unsigned)l);
+      putbytes(p, s, l);
+      break;
+    }
+    case LUA_TTABLE:
+      packtable(p, idx, depth);
+      break;
+    default:
+      luaL_error(L, "cannot pack a %s value", luaL_typename(L, idx));
+  }
+}
+
+
+static int dvm_pack (lua_State *L) {
+  Packer p;
+  luaL_checkany(L, 1);
+  lua_settop(L, 1);
+  p.L = L;
+  p.size = LUAL_BUFFERSIZE;
+  p.b = (char *)lua_newuserdatauv(L, p.size, 0);
+  p.n = 0;
+  p.box = 2;
+  lua_newtable(L);
+  p.seen = 3;
+  p.ntables = 0;
+  packvalue(&p, 1, 0);
+  lua_pushlstring(L, p.b, p.n);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Unpacking
+** =======================================================
+*/
+
+typedef struct Unpacker {
+  lua_State *L;
+  const char *s;
+  size_t n;  /* size of 's' */
+  size_t pos;  /* next byte to read */
+  int src;  /* index of 's' */
+  int refs;  /* index of the sequence of unpacked tables */
+  lua_Integer ntables;
+  int share;  /* push long strings as slices of 's'? */
+} Unpacker;
+
+
+static int truncated (Unpacker *u) {
+  return luaL_error(u->L, "truncated data");
+}
+
+
+static int invalid (Unpacker *u) {
+  return luaL_error(u->L, "invalid data at position %I",
+                          (lua_Integer)u->pos + 1);
+}
+
+
+static int getbyte (Unpacker *u) {
+  if (u->pos >= u->n)
+    return truncated(u);
+  return (unsigned char)u->s[u->pos++];
+}
+
+
+static lua_Unsigned getvarint (Unpacker *u) {
+  lua_Unsigned x = 0;
+  unsigned int shift = 0;
+  int c;
+  do {
+    if (shift >= sizeof(lua_Unsigned) * 8)
+      invalid(u);
+    c = getbyte(u);
+    x |= (lua_Unsigned)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return x;
+}
+
+
+/* read a count of items that take at least 'sz' bytes each */
+static lua_Unsigned getcount (Unpacker *u, size_t sz) {
+  lua_Unsigned c = getvarint(u);
+  if (c > (lua_Unsigned)((u->n - u->pos) / sz))
+    truncated(u);
+  return c;
+}
+
+
+static void unpackvalue (Unpacker *u, int depth);
+
+
+static void unpacktable (Unpacker *u, int depth) {
+  lua_State *L = u->L;
+  lua_Unsigned na, nh, i;
+  int t;
+  if (depth >= DVM_MAXDEPTH)
+    luaL_error(L, "tables nested too deep");
+  luaL_checkstack(L, 4, "tables nested too deep");
+  na = getcount(u, 1);
+  nh = getcount(u, 2);
+  lua_createtable(L, (na < INT_MAX) ? (int)na : INT_MAX,
+                     (nh < INT_MAX) ? (int)nh : INT_MAX);
+  t = lua_gettop(L);
+  lua_pushvalue(L, t);
+  lua_rawseti(L, u->refs, ++u->ntables);
+  for (i = 1; i <= na; i++) {
+    unpackvalue(u, depth + 1);
+    lua_rawseti(L, t, (lua_Integer)i);
+  }
+  for (i = 0; i < nh; i++) {
+    size_t pos = u->pos;
+    unpackvalue(u, depth + 1);
+    if (lua_isnil(L, -1) ||
+        (lua_type(L, -1) == LUA_TNUMBER &&
+         lua_tonumber(L, -1) != lua_tonumber(L, -1))) {
+      u->pos = pos;
+      invalid(u);  /* nil or NaN key */
+    }
+    unpackvalue(u, depth + 1);
+    lua_rawset(L, t);
+  }
+}
+
+
+static void unpackvalue (Unpacker *u, int depth) {
+  lua_State *L = u->L;
+  switch (getbyte(u)) {
+    case DVM_NIL:
+      lua_pushnil(L);
+      break;
+    case DVM_FALSE:
+      lua_pushboolean(L, 0);
+      break;
+    case DVM_TRUE:
+      lua_pushboolean(L, 1);
+      break;
+    case DVM_INT: {
+      lua_Unsigned x = getvarint(u);
+      lua_pushinteger(L, (lua_Integer)((x & 1) ? ~(x >> 1) : (x >> 1)));
+      break;
+    }
+    case DVM_FLOAT: {
+      lua_Number f;
+      if (u->n - u->pos < sizeof(f))
+        truncated(u);
+      memcpy(&f, u->s + u->pos, sizeof(f));
+      u->pos += sizeof(f);
+      lua_pushnumber(L, f);
+      break;
+    }
+    case DVM_STR: {
+      size_t l = (size_t)getcount(u, 1);
+      if (u->share)
+        lua_pushslice(L, u->src, u->pos, l);
+      else
+        lua_pushlstring(L, u->s + u->pos, l);
+      u->pos += l;
+      break;
+    }
+    case DVM_TABLE:
+      unpacktable(u, depth);
+      break;
+    case DVM_REF: {
+      lua_Unsigned k = getvarint(u);
+      if (k < 1 || k > (lua_Unsigned)u->ntables)
+        invalid(u);
+      lua_rawgeti(L, u->refs, (lua_Integer)k);
+      break;
+    }
+    default:
+      u->pos--;
+      invalid(u);
+  }
+}
+
+
+static int dvm_unpack (lua_State *L) {
+  Unpacker u;
+  lua_Integer init;
+  u.s = luaL_checklstring(L, 1, &u.n);
+  init = luaL_optinteger(L, 2, 1);
+  luaL_argcheck(L, 1 <= init && (lua_Unsigned)init - 1 <= u.n, 2,
+                   "initial position out of string");
+  u.share = lua_toboolean(L, 3);
+  lua_settop(L, 1);
+  u.L = L;
+  u.pos = (size_t)init - 1;
+  u.src = 1;
+  lua_newtable(L);
+  u.refs = 2;
+  u.ntables = 0;
+  unpackvalue(&u, 0);
+  lua_pushinteger(L, (lua_Integer)u.pos + 1);
+  return 2;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg dvm_funcs[] = {
+  {"pack", dvm_pack},
+  {"unpack", dvm_unpack},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_dvm (lua_State *L) {
+  luaL_newlib(L, dvm_funcs);
+  return 1;
+}
+
@@ -20,7 +20,9 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "ltable.h"
 
 
 
@@ -133,6 +135,32 @@ static void checkclosemth (lua_State *L, StkId level) {
 }
 
 
+/*
+** Make the deferred call at 'level', which has 'nargs' arguments after
+** it. The call is copied to the top of the stack. If status is not
+** CLOSEKTOP, the error object goes right after the arguments, and it
+** stays at the top after the call, as with 'prepcallclosemth'.
+*/
+static void calldeferred (lua_State *L, StkId level, int nargs, int status,
+                                       int yy) {
+  ptrdiff_t levelrel = savestack(L, level);
+  StkId func;
+  int i;
+  if (status != CLOSEKTOP)  /* 'luaD_seterrorobj' will set top */
+    luaD_seterrorobj(L, status, level + nargs + 1);
+  luaD_checkstack(L, nargs + 1);  /* may reallocate the stack */
+  level = restorestack(L, levelrel);
+  func = L->top.p;
+  for (i = 0; i <= nargs; i++)
+    setobjs2s(L, func + i, level + i);
+  L->top.p = func + nargs + 1;
+  if (yy)
+    luaD_call(L, func, 0);
+  else
+    luaD_callnoyield(L, func, 0);
+}
+
+
 /*
 ** Prepare and call a closing method.
 ** If status is CLOSEKTOP, the call to the closing method will be pushed
@@ -143,6 +171,10 @@ static void checkclosemth (lua_State *L, StkId level) {
 static void prepcallclosemth (lua_State *L, StkId level, int status, int yy) {
   TValue *uv = s2v(level);  /* value being closed */
   TValue *errobj;
+  if (level->tbclist.nargs > 0) {  /* deferred call? */
+    calldeferred(L, level, level->tbclist.nargs - 1, status, yy);
+    return;
+  }
   if (status == CLOSEKTOP)
     errobj = &G(L)->nilvalue;  /* error object is nil */
   else {  /* 'luaD_seterrorobj' will set top to level + 2 */
@@ -163,22 +195,45 @@ static void prepcallclosemth (lua_State *L, StkId level, int status, int yy) {
 
 
 /*
-** Insert a variable in the list of to-be-closed variables.
+** Insert an entry in the list of to-be-closed variables.
 */
-void luaF_newtbcupval (lua_State *L, StkId level) {
+static void inserttbc (lua_State *L, StkId level, int nargs) {
   lua_assert(level > L->tbclist.p);
-  if (l_isfalse(s2v(level)))
-    return;  /* false doesn't need to be closed */
-  checkclosemth(L, level);  /* value must have a close method */
   while (cast_uint(level - L->tbclist.p) > MAXDELTA) {
     L->tbclist.p += MAXDELTA;  /* create a dummy node at maximum delta */
     L->tbclist.p->tbclist.delta = 0;
   }
   level->tbclist.delta = cast(unsigned short, level - L->tbclist.p);
+  level->tbclist.nargs = cast(unsigned short, nargs);
   L->tbclist.p = level;
 }
 
 
+/*
+** Insert a variable in the list of to-be-closed variables.
+*/
+void luaF_newtbcupval (lua_State *L, StkId level) {
+  if (l_isfalse(s2v(level)))
+    return;  /* false doesn't need to be closed */
+  checkclosemth(L, level);  /* value must have a close method */
+  inserttbc(L, level, 0);
+}
+
+
+/*
+** Insert a deferred call in the list of to-be-closed variables: the
+** function at 'level' will be called with the 'nargs' values after it
+** when the variable goes out of scope. (Nothing is allocated; the
+** function and its arguments stay in the stack until then.)
+*/
+void luaF_newdefer (lua_State *L, StkId level, int nargs) {
+  const TValue *f = s2v(level);
+  if (!ttisfunction(f) && notm(luaT_gettmbyobj(L, f, TM_CALL)))
+    luaG_callerror(L, f);
+  inserttbc(L, level, nargs + 1);
+}
+
+
 void luaF_unlinkupval (UpVal *uv) {
   lua_assert(upisopen(uv));
   *uv->u.open.previous = uv->u.open.next;
@@ -245,6 +300,8 @@ Proto *luaF_newproto (lua_State *L) {
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
+  f->icache = NULL;
+  f->coverage = NULL;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -257,26 +314,95 @@ Proto *luaF_newproto (lua_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->swtabs = NULL;
+  f->sizeswtabs = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
   f->is_encrypted = 0;
+  f->kblob = NULL;
+  f->sizekblob = 0;
+  f->lazy = NULL;
+  f->sizelazy = 0;
+  f->pool = NULL;
+  f->is_fixed = 0;
+  f->cachemiss = 0;
+  f->cache = NULL;
   return f;
 }
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  int i;
+  if (!f->is_fixed) {  /* else these arrays belong to the buffer */
+    luaM_freearray(L, f->code, f->sizecode);
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+    if (f->lazy != NULL)
+      luaM_freearray(L, cast(char *, f->lazy), f->sizelazy);
+  }
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, f->sizecode);
+  if (f->coverage != NULL)
+    luaM_freearray(L, f->coverage, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+  if (f->kblob != NULL)
+    luaM_freearray(L, f->kblob, f->sizekblob);
   luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
+  for (i = 0; i < f->sizeswtabs; i++)
+    luaM_freearray(L, f->swtabs[i].cases, f->swtabs[i].sizecases);
+  luaM_freearray(L, f->swtabs, f->sizeswtabs);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
   luaM_free(L, f);
 }
 
 
+/*
+** Build the map of jump table 'i' of 'f' from its cases. (Dense integer
+** cases go to the array part of the map, as in any table.)
+*/
+void luaF_buildswitch (lua_State *L, Proto *f, int i) {
+  SwitchTable *sw = &f->swtabs[i];
+  Table *h = luaH_new(L);
+  int c;
+  sw->h = h;
+  luaC_objbarrier(L, f, h);
+  for (c = 0; c < sw->ncases; c++) {
+    TValue pc;
+    setivalue(&pc, sw->cases[c].pc);
+    luaH_set(L, h, &f->k[sw->cases[c].k], &pc);
+  }
+}
+
+
+/*
+** Create the inline caches of a prototype, if it has any field access
+** with a constant short-string key (OP_GETFIELD, OP_SETFIELD, OP_SELF,
+** and the global accesses OP_GETTABUP and OP_SETTABUP).
+** There is one slot per instruction, holding the index of the node
+** where the key was last found. Slots are checked against the table
+** at each use (see 'luaH_ichit'), so a stale slot only costs a miss;
+** resizing or rehashing a table needs no invalidation.
+*/
+void luaF_initcache (lua_State *L, Proto *f) {
+  int i;
+  lua_assert(f->icache == NULL);
+  for (i = 0; i < f->sizecode; i++) {
+    switch (unfusedop(GET_OPCODE(f->code[i]))) {
+      case OP_GETFIELD: case OP_SETFIELD: case OP_SELF:
+      case OP_GETTABUP: case OP_SETTABUP: {
+        f->icache = luaM_newvector(L, f->sizecode, unsigned int);
+        for (i = 0; i < f->sizecode; i++)
+          f->icache[i] = 0;
+        return;
+      }
+      default: break;
+    }
+  }
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
@@ -256,14 +256,23 @@ void luaC_fix (lua_State *L, GCObject *o) {
 ** and link it to 'allgc' list.
 */
 GCObject *luaC_newobjdt (lua_State *L, int tt, size_t sz, size_t offset) {
-  global_State *g = G(L);
   char *p = cast_charp(luaM_newobject(L, novariant(tt), sz));
   GCObject *o = cast(GCObject *, p + offset);
+  luaC_linkobj(G(L), o, tt);
+  return o;
+}
+
+
+/*
+** Link 'o' into the list of all objects as a new object. (Used also
+** to bring back objects that were kept for reuse after being
+** collected, such as the threads in the thread pool.)
+*/
+void luaC_linkobj (global_State *g, GCObject *o, int tt) {
   o->marked = luaC_white(g);
   o->tt = tt;
   o->next = g->allgc;
   g->allgc = o;
-  return o;
 }
 
 
@@ -275,6 +284,110 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 
 
 
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+
+/*
+** Clock used to time the phases of a collection, in seconds. It is
+** read only when the collector changes phase, so it should be cheap
+** but need not be very precise.
+*/
+#if !defined(l_gcclock)
+
+#include <time.h>
+
+#if defined(CLOCK_MONOTONIC)
+static double l_gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast_num(ts.tv_sec) + cast_num(ts.tv_nsec) * 1e-9;
+}
+#else
+#define l_gcclock()	(cast_num(clock()) / CLOCKS_PER_SEC)
+#endif
+
+#endif
+
+
+/*
+** Phase of a collection (for statistics) that each state belongs to.
+*/
+static const lu_byte statephase[] = {
+  LUA_GCPPROPAGATE,  /* GCSpropagate */
+  LUA_GCPATOMIC,  /* GCSenteratomic */
+  LUA_GCPATOMIC,  /* GCSatomic */
+  LUA_GCPSWEEP,  /* GCSswpallgc */
+  LUA_GCPSWEEP,  /* GCSswpfinobj */
+  LUA_GCPSWEEP,  /* GCSswptobefnz */
+  LUA_GCPSWEEP,  /* GCSswpend */
+  LUA_GCPFINALIZE,  /* GCScallfin */
+  LUA_GCPPROPAGATE  /* GCSpause (restart of a cycle) */
+};
+
+
+/*
+** Charge the time and the memory released since the last change of
+** phase to the phase being timed, and start timing 'phase'. 'GCPNONE'
+** stops the timing; entry points into the collector save the current
+** phase, time their own work, and restore it when they finish, so
+** that nested calls (e.g., an emergency collection inside a finalizer)
+** are charged only once.
+*/
+static void setphase (global_State *g, lu_byte phase) {
+  double now = l_gcclock();
+  lu_mem bytes = gettotalbytes(g);
+  if (g->gcphase != GCPNONE) {
+    double dt = now - g->gcclock;
+    ptrdiff_t freed = cast(ptrdiff_t, g->gcbytes - bytes);
+    g->gccycle[g->gcphase].time += dt;
+    g->gccycle[g->gcphase].freed += freed;
+    g->gcstats.total[g->gcphase].time += dt;
+    g->gcstats.total[g->gcphase].freed += freed;
+  }
+  g->gcclock = now;
+  g->gcbytes = bytes;
+  g->gcphase = phase;
+}
+
+
+/*
+** Change the phase being timed, if there is one.
+*/
+#define switchphase(g,p)  \
+	{ if ((g)->gcphase != GCPNONE && (g)->gcphase != (p)) setphase(g,p); }
+
+
+/*
+** Finish the statistics of a collection: a major collection (or a
+** complete incremental cycle) if 'major', a minor one otherwise.
+*/
+static void endcollection (global_State *g, int major) {
+  if (g->gcphase != GCPNONE)
+    setphase(g, g->gcphase);  /* charge what was done up to now */
+  if (major)
+    g->gcstats.major++;
+  else
+    g->gcstats.minor++;
+  memcpy(g->gcstats.last, g->gccycle, sizeof(g->gccycle));
+  memset(g->gccycle, 0, sizeof(g->gccycle));
+}
+
+
+void luaC_getstats (lua_State *L, lua_GCStats *stats) {
+  global_State *g = G(L);
+  if (g->gcphase != GCPNONE)  /* called from inside a collection? */
+    setphase(g, g->gcphase);  /* bring totals up to date */
+  *stats = g->gcstats;
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Mark functions
@@ -296,13 +409,22 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
   switch (o->tt) {
-    case LUA_VSHRSTR:
-    case LUA_VLNGSTR: {
+    case LUA_VSHRSTR: {
       set2black(o);  /* nothing to visit */
+      g->gcstats.strings++;
+      break;
+    }
+    case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      set2black(o);
+      g->gcstats.strings++;
+      if (isslice(ts) && slicedata(ts)->parent != NULL)
+        markobject(g, slicedata(ts)->parent);
       break;
     }
     case LUA_VUPVAL: {
       UpVal *uv = gco2upv(o);
+      g->gcstats.upvalues++;
       if (upisopen(uv))
         set2gray(uv);  /* open upvalues are kept gray */
       else
@@ -315,6 +437,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       if (u->nuvalue == 0) {  /* no user values? */
         markobjectN(g, u->metatable);  /* mark its metatable */
         set2black(u);  /* nothing else to mark */
+        g->gcstats.userdata++;
         break;
       }
       /* else... */
@@ -332,10 +455,21 @@ static void reallymarkobject (global_State *g, GCObject *o) {
 /*
 ** mark metamethods for basic types
 */
+/*
+** mark chunks kept for coverage (see 'luaG_keepcovered')
+*/
+static void markcovered (global_State *g) {
+  int i;
+  for (i = 0; i < g->ncovered; i++)
+    markobject(g, g->covered[i]);
+}
+
+
 static void markmt (global_State *g) {
   int i;
   for (i=0; i < LUA_NUMTAGS; i++)
     markobjectN(g, g->mt[i]);
+  markobjectN(g, g->tamt);
 }
 
 
@@ -405,6 +539,8 @@ static void restartcollection (global_State *g) {
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
+  markobjectN(g, g->frozen);
+  markcovered(g);
   markbeingfnz(g);  /* mark any finalizing object left from previous cycle */
 }
 
@@ -465,6 +601,41 @@ static void traverseweakvalue (global_State *g, Table *h) {
 }
 
 
+/*
+** In the atomic phase, traversals of ephemeron tables record their
+** white->white entries, so that 'convergeephemerons' revisits only
+** these entries after its first round, instead of whole tables. If the
+** array of entries cannot grow, 'ephoverflow' tells 'convergeephemerons'
+** to traverse the tables again, as they are all in the 'ephemeron' list
+** anyway.
+*/
+static void addpending (global_State *g, Table *h, unsigned int i) {
+  if (g->nephpending >= g->sizeephpending) {  /* array is full? */
+    unsigned int osize = g->sizeephpending;
+    unsigned int nsize = (osize == 0) ? 64 : osize * 2;
+    lu_byte oldstopem = g->gcstopem;
+    EphEntry *p = NULL;
+    if (g->ephoverflow)
+      return;
+    g->gcstopem = 1;  /* no emergency collections */
+    if (nsize > osize && !luaM_testsize(nsize, sizeof(EphEntry)))
+      p = cast(EphEntry *, luaM_realloc_(g->mainthread, g->ephpending,
+                                         osize * sizeof(EphEntry),
+                                         nsize * sizeof(EphEntry)));
+    g->gcstopem = oldstopem;
+    if (p == NULL) {  /* allocation failed? */
+      g->ephoverflow = 1;
+      return;
+    }
+    g->ephpending = p;
+    g->sizeephpending = nsize;
+  }
+  g->ephpending[g->nephpending].h = h;
+  g->ephpending[g->nephpending].i = i;
+  g->nephpending++;
+}
+
+
 /*
 ** Traverse an ephemeron table and link it to proper list. Returns true
 ** iff any object was marked during this traversal (which implies that
@@ -499,8 +670,11 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
       clearkey(n);  /* clear its key */
     else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
       hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
+      if (valiswhite(gval(n))) {  /* value not marked yet? */
         hasww = 1;  /* white-white entry */
+        if (g->gcstate == GCSatomic)
+          addpending(g, h, cast_uint(n - gnode(h, 0)));
+      }
     }
     else if (valiswhite(gval(n))) {  /* value not marked yet? */
       marked = 1;
@@ -577,9 +751,18 @@ static int traverseudata (global_State *g, Udata *u) {
 ** arrays can be larger than needed; the extra slots are filled with
 ** NULL, so the use of 'markobjectN')
 */
+/*
+** The cache of closures is a weak reference: a closure that is not
+** marked elsewhere by the time its prototype is traversed is dropped
+** from the cache. (It is safe to keep a closure that is marked later,
+** as the cache is not set in black prototypes; see 'pushclosure'.)
+*/
 static int traverseproto (global_State *g, Proto *f) {
   int i;
+  if (f->cache && iswhite(f->cache))
+    f->cache = NULL;  /* allow cache to be collected */
   markobjectN(g, f->source);
+  markobjectN(g, f->pool);
   for (i = 0; i < f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
   for (i = 0; i < f->sizeupvalues; i++)  /* mark upvalue names */
@@ -588,7 +771,10 @@ static int traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
-  return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
+  for (i = 0; i < f->sizeswtabs; i++)  /* mark jump tables */
+    markobjectN(g, f->swtabs[i].h);
+  return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars +
+             f->sizeswtabs;
 }
 
 
@@ -662,12 +848,24 @@ static lu_mem propagatemark (global_State *g) {
   nw2black(o);
   g->gray = *getgclist(o);  /* remove from 'gray' list */
   switch (o->tt) {
-    case LUA_VTABLE: return traversetable(g, gco2t(o));
-    case LUA_VUSERDATA: return traverseudata(g, gco2u(o));
-    case LUA_VLCL: return traverseLclosure(g, gco2lcl(o));
-    case LUA_VCCL: return traverseCclosure(g, gco2ccl(o));
-    case LUA_VPROTO: return traverseproto(g, gco2p(o));
-    case LUA_VTHREAD: return traversethread(g, gco2th(o));
+    case LUA_VTABLE:
+      g->gcstats.tables++;
+      return traversetable(g, gco2t(o));
+    case LUA_VUSERDATA:
+      g->gcstats.userdata++;
+      return traverseudata(g, gco2u(o));
+    case LUA_VLCL:
+      g->gcstats.lclosures++;
+      return traverseLclosure(g, gco2lcl(o));
+    case LUA_VCCL:
+      g->gcstats.cclosures++;
+      return traverseCclosure(g, gco2ccl(o));
+    case LUA_VPROTO:
+      g->gcstats.protos++;
+      return traverseproto(g, gco2p(o));
+    case LUA_VTHREAD:
+      g->gcstats.threads++;
+      return traversethread(g, gco2th(o));
     default: lua_assert(0); return 0;
   }
 }
@@ -681,31 +879,68 @@ static lu_mem propagateall (global_State *g) {
 }
 
 
+/*
+** Revisit the pending white->white entries of ephemeron tables: mark
+** the values whose keys are now marked and drop the entries that are
+** no longer white->white. Returns true iff it marked some value. (The
+** tables stay in the 'ephemeron' list, to be cleared at the end.)
+*/
+static int markpending (global_State *g) {
+  int marked = 0;
+  unsigned int i, n = 0;
+  for (i = 0; i < g->nephpending; i++) {
+    EphEntry *e = &g->ephpending[i];
+    Node *node = gnode(e->h, e->i);
+    if (!valiswhite(gval(node)))  /* value got marked? */
+      continue;  /* entry is done */
+    else if (!iscleared(g, gckeyN(node))) {  /* key got marked? */
+      marked = 1;
+      reallymarkobject(g, gcvalue(gval(node)));  /* mark value now */
+    }
+    else
+      g->ephpending[n++] = *e;  /* still white->white */
+  }
+  g->nephpending = n;
+  return marked;
+}
+
+
 /*
 ** Traverse all ephemeron tables propagating marks from keys to values.
 ** Repeat until it converges, that is, nothing new is marked. 'dir'
 ** inverts the direction of the traversals, trying to speed up
-** convergence on chains in the same table.
-**
+** convergence on chains in the same table. After a first round over
+** all tables, later rounds only revisit their pending entries, unless
+** the array of pending entries overflowed.
 */
 static void convergeephemerons (global_State *g) {
   int changed;
   int dir = 0;
+  int full = 1;  /* first round must visit all tables in the list */
+  g->nephpending = 0;  /* first round will record all pending entries */
   do {
-    GCObject *w;
-    GCObject *next = g->ephemeron;  /* get ephemeron list */
-    g->ephemeron = NULL;  /* tables may return to this list when traversed */
-    changed = 0;
-    while ((w = next) != NULL) {  /* for each ephemeron table */
-      Table *h = gco2t(w);
-      next = h->gclist;  /* list is rebuilt during loop */
-      nw2black(h);  /* out of the list (for now) */
-      if (traverseephemeron(g, h, dir)) {  /* marked some value? */
-        propagateall(g);  /* propagate changes */
-        changed = 1;  /* will have to revisit all ephemeron tables */
+    if (!full && !g->ephoverflow) {  /* all white->white entries pending? */
+      changed = markpending(g);
+      if (changed)
+        propagateall(g);  /* propagate changes (may add pending entries) */
+    }
+    else {  /* traverse all ephemeron tables */
+      GCObject *w;
+      GCObject *next = g->ephemeron;  /* get ephemeron list */
+      g->ephemeron = NULL;  /* tables may return to this list when traversed */
+      changed = 0;
+      while ((w = next) != NULL) {  /* for each ephemeron table */
+        Table *h = gco2t(w);
+        next = h->gclist;  /* list is rebuilt during loop */
+        nw2black(h);  /* out of the list (for now) */
+        if (traverseephemeron(g, h, dir)) {  /* marked some value? */
+          propagateall(g);  /* propagate changes */
+          changed = 1;  /* will have to revisit all ephemeron tables */
+        }
       }
+      dir = !dir;  /* invert direction next time */
+      full = 0;
     }
-    dir = !dir;  /* invert direction next time */
   } while (changed);  /* repeat until no more changes */
 }
 
@@ -762,6 +997,77 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
 }
 
 
+/*
+** {======================================================
+** Release of dead objects
+**
+** With a 'releasef' set (see 'lua_setreleasef'), 'freeobj' does not
+** give the memory of dead tables, closures, prototypes, and upvalues
+** back to the allocator itself: 'luaM_free_' queues the blocks, and
+** they go to 'releasef' in batches, typically to be freed by another
+** thread. The collector only unlinks the objects. Objects whose freeing
+** touches shared state (strings, in the string table; threads) and
+** userdata, which C code may still point into, are freed as usual, as
+** is everything during emergency collections, which need the memory
+** back right away.
+** =======================================================
+*/
+
+static int canrelease (GCObject *o) {
+  switch (o->tt) {
+    case LUA_VTABLE: case LUA_VLCL: case LUA_VCCL:
+    case LUA_VPROTO: case LUA_VUPVAL:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Queue a block freed while 'g->gcreleasing'.
+*/
+void luaC_release (lua_State *L, void *block, size_t osize) {
+  global_State *g = G(L);
+  if (block == NULL)
+    return;
+  g->relblocks[g->nrelease] = block;
+  g->relsizes[g->nrelease] = osize;
+  if (++g->nrelease == LUAI_RELEASEBATCH)  /* batch is full? */
+    luaC_flushrelease(L, 0);
+}
+
+
+/*
+** Give the queued blocks to 'releasef'; if 'wait', also wait until it
+** freed all blocks it got so far.
+*/
+void luaC_flushrelease (lua_State *L, int wait) {
+  global_State *g = G(L);
+  if (g->releasef == NULL)
+    return;
+  if (g->nrelease > 0) {
+    g->releasef(g->ud_release, g->relblocks, g->relsizes, g->nrelease);
+    g->nrelease = 0;
+  }
+  if (wait)
+    g->releasef(g->ud_release, NULL, NULL, 0);
+}
+
+
+void luaC_setreleasef (lua_State *L, lua_Release f, void *ud) {
+  global_State *g = G(L);
+  if (g->releasef != NULL) {
+    luaC_flushrelease(L, 0);
+    g->releasef(g->ud_release, NULL, NULL, -1);  /* detach it */
+  }
+  g->releasef = f;
+  g->ud_release = ud;
+}
+
+/* }====================================================== */
+
+
 static void freeupval (lua_State *L, UpVal *uv) {
   if (upisopen(uv))
     luaF_unlinkupval(uv);
@@ -770,6 +1076,9 @@ static void freeupval (lua_State *L, UpVal *uv) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  g->gcreleasing = (g->releasef != NULL && !g->gcemergency &&
+                    canrelease(o));
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
@@ -806,11 +1115,15 @@ static void freeobj (lua_State *L, GCObject *o) {
     }
     case LUA_VLNGSTR: {
       TString *ts = gco2ts(o);
-      luaM_freemem(L, ts, sizelstring(ts->u.lnglen));
+      if (isslice(ts))
+        luaS_freeslice(L, ts);
+      else
+        luaM_freemem(L, ts, sizelstring(ts->u.lnglen));
       break;
     }
     default: lua_assert(0);
   }
+  g->gcreleasing = 0;
 }
 
 
@@ -915,6 +1228,9 @@ static void GCTM (lua_State *L) {
     int status;
     lu_byte oldah = L->allowhook;
     int oldgcstp  = g->gcstp;
+    lu_byte oldphase = g->gcphase;
+    setphase(g, LUA_GCPFINALIZE);
+    g->gcstats.finalized++;
     g->gcstp |= GCSTPGC;  /* avoid GC steps */
     L->allowhook = 0;  /* stop debug hooks during GC metamethod */
     setobj2s(L, L->top.p++, tm);  /* push finalizer... */
@@ -928,6 +1244,7 @@ static void GCTM (lua_State *L) {
       luaE_warnerror(L, "__gc");
       L->top.p--;  /* pops error object */
     }
+    setphase(g, oldphase);
   }
 }
 
@@ -1246,11 +1563,12 @@ static void finishgencycle (lua_State *L, global_State *g) {
 /*
 ** Does a young collection. First, mark 'OLD1' objects. Then does the
 ** atomic step. Then, sweep all lists and advance pointers. Finally,
-** finish the collection.
+** finish the collection. Returns the number of objects traversed.
 */
-static void youngcollection (lua_State *L, global_State *g) {
+static lu_mem youngcollection (lua_State *L, global_State *g) {
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
+  lu_mem work;
   lua_assert(g->gcstate == GCSpropagate);
   if (g->firstold1) {  /* are there regular OLD1 objects? */
     markold(g, g->firstold1, g->reallyold);  /* mark them */
@@ -1258,10 +1576,12 @@ static void youngcollection (lua_State *L, global_State *g) {
   }
   markold(g, g->finobj, g->finobjrold);
   markold(g, g->tobefnz, NULL);
-  atomic(L);
+  switchphase(g, LUA_GCPATOMIC);
+  work = atomic(L);
 
   /* sweep nursery and get a pointer to its last live element */
   g->gcstate = GCSswpallgc;
+  switchphase(g, LUA_GCPSWEEP);
   psurvival = sweepgen(L, g, &g->allgc, g->survival, &g->firstold1);
   /* sweep 'survival' */
   sweepgen(L, g, psurvival, g->old1, &g->firstold1);
@@ -1280,6 +1600,8 @@ static void youngcollection (lua_State *L, global_State *g) {
 
   sweepgen(L, g, &g->tobefnz, NULL, &dummy);
   finishgencycle(L, g);
+  endcollection(g, 0);
+  return work;
 }
 
 
@@ -1293,6 +1615,7 @@ static void atomic2gen (lua_State *L, global_State *g) {
   cleargraylists(g);
   /* sweep all elements making them old */
   g->gcstate = GCSswpallgc;
+  switchphase(g, LUA_GCPSWEEP);
   sweep2old(L, &g->allgc);
   /* everything alive now is old */
   g->reallyold = g->old1 = g->survival = g->allgc;
@@ -1308,6 +1631,7 @@ static void atomic2gen (lua_State *L, global_State *g) {
   g->lastatomic = 0;
   g->GCestimate = gettotalbytes(g);  /* base for memory control */
   finishgencycle(L, g);
+  endcollection(g, 1);
 }
 
 
@@ -1316,6 +1640,7 @@ static void atomic2gen (lua_State *L, global_State *g) {
 ** memory grows 'genminormul'%.
 */
 static void setminordebt (global_State *g) {
+  g->gcadapt.base = gettotalbytes(g);
   luaE_setdebt(g, -(cast(l_mem, (gettotalbytes(g) / 100)) * g->genminormul));
 }
 
@@ -1330,9 +1655,11 @@ static lu_mem entergen (lua_State *L, global_State *g) {
   lu_mem numobjs;
   luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  switchphase(g, LUA_GCPATOMIC);
   numobjs = atomic(L);  /* propagates all and then do the atomic stuff */
   atomic2gen(L, g);
   setminordebt(g);  /* set debt assuming next cycle will be minor */
+  g->gcadapt.majorwork = numobjs;
   return numobjs;
 }
 
@@ -1360,8 +1687,12 @@ static void enterinc (global_State *g) {
 void luaC_changemode (lua_State *L, int newmode) {
   global_State *g = G(L);
   if (newmode != g->gckind) {
-    if (newmode == KGC_GEN)  /* entering generational mode? */
-      entergen(L, g);
+    if (newmode == KGC_GEN) {  /* entering generational mode? */
+      lu_byte oldphase = g->gcphase;
+      setphase(g, statephase[g->gcstate]);
+      entergen(L, g);  /* (does a full collection) */
+      setphase(g, oldphase);
+    }
     else
       enterinc(g);  /* entering incremental mode */
   }
@@ -1378,6 +1709,143 @@ static lu_mem fullgen (lua_State *L, global_State *g) {
 }
 
 
+/*
+** Adaptive mode
+**
+** With 'g->gcadaptive' set, the collector picks its mode and the
+** generational multipliers by itself, from what it sees at each
+** collection:
+** - In generational mode, after each minor collection, the survival
+** rate: the fraction of the memory allocated since the previous
+** collection that is still in use. A high rate means that young objects
+** do not die young (the program is building a structure), so minor
+** collections are wasted work; so is a minor collection that traverses
+** over half as many objects as a major one (the cost of 'atomic'). After
+** LUAI_GCASTREAK such collections in a row, the collector switches to
+** incremental mode. Short of that, a high rate raises the minor
+** multiplier, to give young objects more time to die, and a low one cuts
+** it back, to keep minor collections small.
+** - Each major collection that frees too little (a "bad collection")
+** raises the major multiplier, as the program is growing its heap; good
+** ones take it back towards its default. While it keeps having bad
+** collections, the collector does them as full, non-incremental ones
+** (see 'stepgenfull'), so it also switches to incremental mode after
+** LUAI_GCASTREAK of them in a row.
+** - In incremental mode, at the end of each cycle, the memory in use.
+** After LUAI_GCASTREAK cycles without its changing by more than 1/8,
+** the program has reached a steady state, where the generational mode
+** does better, so the collector switches to it.
+** Each decision is counted in 'g->gcadapt.count' (see LUA_GCADAPTINFO).
+*/
+
+
+/*
+** Account for a major collection, 'bad' if it freed too little. Returns
+** true if the collector should switch to incremental mode.
+*/
+static int adaptmajor (global_State *g, int bad) {
+  GCAdapt *a = &g->gcadapt;
+  int majormul = getgcparam(g->genmajormul);
+  if (bad) {
+    a->count[LUA_GCABADMAJOR]++;
+    if (majormul < LUAI_GCAMAXMAJOR) {
+      majormul += majormul / 2;
+      setgcparam(g->genmajormul, (majormul < LUAI_GCAMAXMAJOR)
+                                 ? majormul : LUAI_GCAMAXMAJOR);
+      a->count[LUA_GCAMAJORUP]++;
+    }
+    return (++a->streak >= LUAI_GCASTREAK);
+  }
+  else {
+    a->count[LUA_GCAMAJOR]++;
+    a->streak = 0;
+    if (majormul > LUAI_GENMAJORMUL) {
+      majormul -= majormul / 4;
+      setgcparam(g->genmajormul, (majormul > LUAI_GENMAJORMUL)
+                                 ? majormul : LUAI_GENMAJORMUL);
+      a->count[LUA_GCAMAJORDOWN]++;
+    }
+    return 0;
+  }
+}
+
+
+/*
+** Account for a minor collection that started with 'before' bytes in
+** use and traversed 'work' objects. Returns true if the collector
+** should switch to incremental mode.
+*/
+static int adaptminor (global_State *g, lu_mem before, lu_mem work) {
+  GCAdapt *a = &g->gcadapt;
+  lu_mem after = gettotalbytes(g);
+  int minormul = g->genminormul;
+  int rate;  /* survival rate (%) */
+  a->count[LUA_GCAMINOR]++;
+  if (before <= a->base)  /* nothing allocated? (explicit step) */
+    return 0;
+  rate = (after <= a->base) ? 0
+       : cast_int(((after - a->base) * 100) / (before - a->base));
+  if (rate > 100) rate = 100;  /* finalizers may have allocated */
+  a->survival = cast_byte((3 * a->survival + rate) / 4);
+  if (a->survival >= LUAI_GCAHIGHSURV ||
+      (a->majorwork > 0 && work > a->majorwork / 2)) {
+    if (++a->streak >= LUAI_GCASTREAK)
+      return 1;
+  }
+  else
+    a->streak = 0;
+  if (rate >= (LUAI_GCAHIGHSURV + LUAI_GCALOWSURV) / 2 &&
+      minormul < LUAI_GCAMAXMINOR) {
+    minormul += minormul / 4 + 1;
+    g->genminormul = cast_byte((minormul < LUAI_GCAMAXMINOR)
+                               ? minormul : LUAI_GCAMAXMINOR);
+    a->count[LUA_GCAMINORUP]++;
+  }
+  else if (rate < LUAI_GCALOWSURV && minormul > LUAI_GENMINORMUL / 2) {
+    minormul -= minormul / 4;
+    g->genminormul = cast_byte((minormul > LUAI_GENMINORMUL / 2)
+                               ? minormul : LUAI_GENMINORMUL / 2);
+    a->count[LUA_GCAMINORDOWN]++;
+  }
+  return 0;
+}
+
+
+/*
+** Leave generational mode by decision of the adaptive collector.
+*/
+static void adapttoinc (global_State *g) {
+  enterinc(g);
+  g->GCestimate = gettotalbytes(g);
+  setpause(g);
+  g->gcadapt.live = 0;  /* no cycle measured yet */
+  g->gcadapt.streak = 0;
+  g->gcadapt.count[LUA_GCATOINC]++;
+}
+
+
+/*
+** Account for the end of an incremental cycle, switching to
+** generational mode after LUAI_GCASTREAK cycles in a steady state.
+*/
+static void adaptcycle (lua_State *L, global_State *g) {
+  GCAdapt *a = &g->gcadapt;
+  lu_mem live = g->GCestimate;
+  lu_mem prev = a->live;
+  a->live = live;
+  if (prev > 0 && live <= prev + (prev >> 3) && live + (prev >> 3) >= prev) {
+    if (++a->streak >= LUAI_GCASTREAK) {
+      a->streak = 0;
+      a->survival = 0;
+      a->count[LUA_GCATOGEN]++;
+      entergen(L, g);
+    }
+  }
+  else
+    a->streak = 0;
+}
+
+
 /*
 ** Does a major collection after last collection was a "bad collection".
 **
@@ -1405,7 +1873,9 @@ static void stepgenfull (lua_State *L, global_State *g) {
   if (g->gckind == KGC_GEN)  /* still in generational mode? */
     enterinc(g);  /* enter incremental mode */
   luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  switchphase(g, LUA_GCPATOMIC);
   newatomic = atomic(L);  /* mark everybody */
+  g->gcadapt.majorwork = newatomic;
   if (newatomic < lastatomic + (lastatomic >> 3)) {  /* good collection? */
     atomic2gen(L, g);  /* return to generational mode */
     setminordebt(g);
@@ -1440,8 +1910,11 @@ static void stepgenfull (lua_State *L, global_State *g) {
 ** in that case, do a minor collection.
 */
 static void genstep (lua_State *L, global_State *g) {
-  if (g->lastatomic != 0)  /* last collection was a bad one? */
+  int toinc = 0;  /* adaptive collector asks for incremental mode? */
+  if (g->lastatomic != 0) {  /* last collection was a bad one? */
     stepgenfull(L, g);  /* do a full step */
+    toinc = g->gcadaptive && adaptmajor(g, g->lastatomic != 0);
+  }
   else {
     lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
     lu_mem majorinc = (majorbase / 100) * getgcparam(g->genmajormul);
@@ -1451,19 +1924,25 @@ static void genstep (lua_State *L, global_State *g) {
         /* collected at least half of memory growth since last major
            collection; keep doing minor collections. */
         lua_assert(g->lastatomic == 0);
+        if (g->gcadaptive) adaptmajor(g, 0);
       }
       else {  /* bad collection */
         g->lastatomic = numobjs;  /* signal that last collection was bad */
         setpause(g);  /* do a long wait for next (major) collection */
+        toinc = g->gcadaptive && adaptmajor(g, 1);
       }
     }
     else {  /* regular case; do a minor collection */
-      youngcollection(L, g);
+      lu_mem before = gettotalbytes(g);
+      lu_mem work = youngcollection(L, g);
+      toinc = g->gcadaptive && adaptminor(g, before, work);
       setminordebt(g);
       g->GCestimate = majorbase;  /* preserve base value */
     }
   }
   lua_assert(isdecGCmodegen(g));
+  if (toinc)
+    adapttoinc(g);
 }
 
 /* }====================================================== */
@@ -1531,10 +2010,14 @@ static lu_mem atomic (lua_State *L) {
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSatomic;
+  g->nephpending = 0;  /* no pending ephemeron entries yet */
+  g->ephoverflow = 0;
   markobject(g, L);  /* mark running thread */
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  markobjectN(g, g->frozen);
+  markcovered(g);
   work += propagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   work += remarkupvals(g);
@@ -1559,6 +2042,12 @@ static lu_mem atomic (lua_State *L) {
   clearbyvalues(g, g->weak, origweak);
   clearbyvalues(g, g->allweak, origall);
   luaS_clearcache(g);
+  luaH_resetlookups(L);  /* cached slots may be in dead or cleared tables */
+  if (g->errcache != NULL)  /* cached messages may be dead */
+    memset(g->errcache, 0, LUAI_ERRCACHE * sizeof(ErrorEntry));
+  luaM_freearray(L, g->ephpending, g->sizeephpending);
+  g->ephpending = NULL;
+  g->nephpending = g->sizeephpending = 0;
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   lua_assert(g->gray == NULL);
   return work;  /* estimate of slots marked by 'atomic' */
@@ -1587,6 +2076,7 @@ static lu_mem singlestep (lua_State *L) {
   lu_mem work;
   lua_assert(!g->gcstopem);  /* collector is not reentrant */
   g->gcstopem = 1;  /* no emergency collections while collecting */
+  switchphase(g, statephase[g->gcstate]);
   switch (g->gcstate) {
     case GCSpause: {
       restartcollection(g);
@@ -1634,6 +2124,7 @@ static lu_mem singlestep (lua_State *L) {
       }
       else {  /* emergency mode or no more finalizers */
         g->gcstate = GCSpause;  /* finish collection */
+        endcollection(g, 1);
         work = 0;
       }
       break;
@@ -1674,8 +2165,11 @@ static void incstep (lua_State *L, global_State *g) {
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
   } while (debt > -stepsize && g->gcstate != GCSpause);
-  if (g->gcstate == GCSpause)
+  if (g->gcstate == GCSpause) {
     setpause(g);  /* pause until next cycle */
+    if (g->gcadaptive)
+      adaptcycle(L, g);
+  }
   else {
     debt = (debt / stepmul) * WORK2MEM;  /* convert 'work units' to bytes */
     luaE_setdebt(g, debt);
@@ -1692,10 +2186,14 @@ void luaC_step (lua_State *L) {
   if (!gcrunning(g))  /* not running? */
     luaE_setdebt(g, -2000);
   else {
+    lu_byte oldphase = g->gcphase;
+    setphase(g, statephase[g->gcstate]);
     if(isdecGCmodegen(g))
       genstep(L, g);
     else
       incstep(L, g);
+    setphase(g, oldphase);
+    luaC_flushrelease(L, 0);
   }
 }
 
@@ -1729,13 +2227,345 @@ static void fullinc (lua_State *L, global_State *g) {
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
+  lu_byte oldphase = g->gcphase;
   lua_assert(!g->gcemergency);
+  if (isemergency)  /* memory given to 'releasef' must be free by now */
+    luaC_flushrelease(L, 1);
   g->gcemergency = isemergency;  /* set flag */
+  if (isemergency)  /* pooled threads are not worth their memory now */
+    luaE_flushthreadpool(L, 0);
+  setphase(g, statephase[g->gcstate]);
   if (g->gckind == KGC_INC)
     fullinc(L, g);
   else
     fullgen(L, g);
+  setphase(g, oldphase);
   g->gcemergency = 0;
+  luaC_flushrelease(L, 0);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Heap snapshots
+** =======================================================
+*/
+
+/*
+** A snapshot is a header ("\x1bLSNAP", a version byte, and the size of
+** object ids) followed by records, all integers in little-endian order:
+**   'O' id:8 tag:1 size:8 namelen:2 name nrefs:4 ref:8...
+**   'R' id:8 namelen:2 name
+**   'E' nobjects:8
+** 'O' describes a live object: its variant tag, the bytes it owns, a
+** short name (a prefix of strings, "source:line" of prototypes), and
+** the objects it references strongly. 'R' names a root. Ids are object
+** addresses, unique only within the snapshot.
+*/
+
+#define SNAPVERSION	1
+
+/* maximum length kept of names */
+#define SNAPNAMELEN	64
+
+
+typedef struct SnapState {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  int counting;  /* true while only counting references */
+  l_uint32 nrefs;
+  lu_mem nobjs;
+  size_t n;  /* bytes in 'buff' */
+  char buff[512];
+} SnapState;
+
+
+static void snapflush (SnapState *S) {
+  if (S->n > 0 && S->status == 0) {
+    lua_unlock(S->L);
+    S->status = (*S->writer)(S->L, S->buff, S->n, S->data);
+    lua_lock(S->L);
+  }
+  S->n = 0;
+}
+
+
+static void snapbytes (SnapState *S, const void *b, size_t size) {
+  const char *p = cast_charp(b);
+  while (size > 0) {
+    size_t m = sizeof(S->buff) - S->n;
+    if (m == 0) {
+      snapflush(S);
+      m = sizeof(S->buff);
+    }
+    if (m > size) m = size;
+    memcpy(S->buff + S->n, p, m);
+    S->n += m;
+    p += m;
+    size -= m;
+  }
+}
+
+
+static void snapint (SnapState *S, lu_mem x, int size) {
+  char b[8];
+  int i;
+  for (i = 0; i < size; i++) {
+    b[i] = cast_char(x & 0xff);
+    x >>= 4; x >>= 4;  /* (lu_mem may have only 32 bits) */
+  }
+  snapbytes(S, b, cast_sizet(size));
+}
+
+
+#define snapid(S,o)	snapint(S, cast(lu_mem, cast_sizet(o)), 8)
+
+
+static void snapname (SnapState *S, const char *s, size_t len) {
+  if (len > SNAPNAMELEN) len = SNAPNAMELEN;
+  snapint(S, len, 2);
+  snapbytes(S, s, len);
+}
+
+
+static void snapref (SnapState *S, GCObject *o) {
+  if (o == NULL)
+    return;
+  else if (S->counting)
+    S->nrefs++;
+  else
+    snapid(S, o);
+}
+
+
+#define snapvalue(S,v)	{ if (iscollectable(v)) snapref(S, gcvalue(v)); }
+
+#define snapobjN(S,p)	{ if ((p) != NULL) snapref(S, obj2gco(p)); }
+
+
+/*
+** References of a table, except the weak ones
+*/
+static void snaptable (SnapState *S, Table *h) {
+  const TValue *mode = gfasttm(G(S->L), h->metatable, TM_MODE);
+  int weakkey = 0, weakvalue = 0;
+  Node *n, *limit = gnodelast(h);
+  unsigned int i, asize = luaH_realasize(h);
+  if (mode && ttisshrstring(mode)) {
+    weakkey = (strchr(getshrstr(tsvalue(mode)), 'k') != NULL);
+    weakvalue = (strchr(getshrstr(tsvalue(mode)), 'v') != NULL);
+  }
+  snapobjN(S, h->metatable);
+  if (!weakvalue) {
+    for (i = 0; i < asize; i++)
+      snapvalue(S, &h->array[i]);
+  }
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (!isempty(gval(n))) {
+      if (!weakkey && keyiscollectable(n))
+        snapref(S, gckey(n));
+      if (!weakvalue)
+        snapvalue(S, gval(n));
+    }
+  }
+}
+
+
+static void snaprefs (SnapState *S, GCObject *o) {
+  int i;
+  switch (o->tt) {
+    case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      if (isslice(ts))
+        snapobjN(S, slicedata(ts)->parent);
+      break;
+    }
+    case LUA_VTABLE: snaptable(S, gco2t(o)); break;
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      snapobjN(S, u->metatable);
+      for (i = 0; i < u->nuvalue; i++)
+        snapvalue(S, &u->uv[i].uv);
+      break;
+    }
+    case LUA_VLCL: {
+      LClosure *cl = gco2lcl(o);
+      snapobjN(S, cl->p);
+      for (i = 0; i < cl->nupvalues; i++)
+        snapobjN(S, cl->upvals[i]);
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        snapvalue(S, &cl->upvalue[i]);
+      break;
+    }
+    case LUA_VUPVAL: snapvalue(S, gco2upv(o)->v.p); break;
+    case LUA_VPROTO: {
+      Proto *f = gco2p(o);
+      snapobjN(S, f->source);
+      snapobjN(S, f->pool);
+      for (i = 0; i < f->sizek; i++)
+        snapvalue(S, &f->k[i]);
+      for (i = 0; i < f->sizeupvalues; i++)
+        snapobjN(S, f->upvalues[i].name);
+      for (i = 0; i < f->sizep; i++)
+        snapobjN(S, f->p[i]);
+      for (i = 0; i < f->sizelocvars; i++)
+        snapobjN(S, f->locvars[i].varname);
+      for (i = 0; i < f->sizeswtabs; i++)
+        snapobjN(S, f->swtabs[i].h);
+      break;
+    }
+    case LUA_VTHREAD: {
+      lua_State *th = gco2th(o);
+      StkId p;
+      UpVal *uv;
+      if (th->stack.p == NULL)
+        break;
+      for (p = th->stack.p; p < th->top.p; p++)
+        snapvalue(S, s2v(p));
+      for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
+        snapobjN(S, uv);
+      break;
+    }
+    default: break;  /* short strings have no references */
+  }
+}
+
+
+/*
+** Bytes owned by object 'o' (as freed by 'freeobj')
+*/
+static lu_mem snapsize (GCObject *o) {
+  switch (o->tt) {
+    case LUA_VSHRSTR: return sizelstring(gco2ts(o)->shrlen);
+    case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      if (!isslice(ts))
+        return sizelstring(ts->u.lnglen);
+      else if (slicedata(ts)->parent == NULL)  /* has its own copy? */
+        return sizeslice + ts->u.lnglen + 1;
+      else
+        return sizeslice;
+    }
+    case LUA_VTABLE: {
+      Table *h = gco2t(o);
+      return sizeof(Table) + luaH_realasize(h) * sizeof(TValue) +
+             (isdummy(h) ? 0 : sizenode(h) * sizeof(Node));
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      return sizeudata(u->nuvalue, u->len);
+    }
+    case LUA_VLCL: return sizeLclosure(gco2lcl(o)->nupvalues);
+    case LUA_VCCL: return sizeCclosure(gco2ccl(o)->nupvalues);
+    case LUA_VUPVAL: return sizeof(UpVal);
+    case LUA_VPROTO: {
+      Proto *f = gco2p(o);
+      lu_mem sz = sizeof(Proto) + f->sizep * sizeof(Proto *) +
+                  f->sizek * sizeof(TValue) +
+                  f->sizeabslineinfo * sizeof(AbsLineInfo) +
+                  f->sizelocvars * sizeof(LocVar) +
+                  f->sizeupvalues * sizeof(Upvaldesc);
+      if (!f->is_fixed)
+        sz += f->sizecode * sizeof(Instruction) + f->sizelineinfo;
+      return sz;
+    }
+    case LUA_VTHREAD: {
+      lua_State *th = gco2th(o);
+      lu_mem sz = LUA_EXTRASPACE + sizeof(lua_State) +
+                  th->nci * sizeof(CallInfo);
+      if (th->stack.p != NULL)
+        sz += (stacksize(th) + EXTRA_STACK) * sizeof(StackValue);
+      return sz;
+    }
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+static void snapobject (SnapState *S, GCObject *o) {
+  snapint(S, 'O', 1);
+  snapid(S, o);
+  snapint(S, o->tt, 1);
+  snapint(S, snapsize(o), 8);
+  if (o->tt == LUA_VSHRSTR || o->tt == LUA_VLNGSTR)
+    snapname(S, getstr(gco2ts(o)), tsslen(gco2ts(o)));
+  else if (o->tt == LUA_VPROTO) {
+    Proto *f = gco2p(o);
+    char line[LUAI_MAXSHORTLEN];
+    int len = l_sprintf(line, sizeof(line), ":%d", f->linedefined);
+    const char *src = (f->source) ? getstr(f->source) : "=?";
+    size_t srclen = (f->source) ? tsslen(f->source) : 2;
+    if (srclen > SNAPNAMELEN - cast_sizet(len))
+      srclen = SNAPNAMELEN - cast_sizet(len);
+    snapint(S, srclen + cast_sizet(len), 2);
+    snapbytes(S, src, srclen);
+    snapbytes(S, line, cast_sizet(len));
+  }
+  else
+    snapname(S, "", 0);
+  S->counting = 1;
+  S->nrefs = 0;
+  snaprefs(S, o);
+  S->counting = 0;
+  snapint(S, S->nrefs, 4);
+  snaprefs(S, o);
+  S->nobjs++;
+}
+
+
+static void snaplist (SnapState *S, GCObject *p) {
+  for (; p != NULL; p = p->next)
+    snapobject(S, p);
+}
+
+
+static void snaproot (SnapState *S, GCObject *o, const char *name) {
+  snapint(S, 'R', 1);
+  snapid(S, o);
+  snapname(S, name, strlen(name));
+}
+
+
+/*
+** Write a snapshot of all objects in the state. Objects are not
+** collected meanwhile, as writing does not allocate memory. Returns
+** the first error of the writer (0 if none).
+*/
+int luaC_snapshot (lua_State *L, lua_Writer writer, void *data) {
+  global_State *g = G(L);
+  SnapState S;
+  int i;
+  S.L = L; S.writer = writer; S.data = data;
+  S.status = 0; S.counting = 0; S.nobjs = 0; S.n = 0;
+  snapbytes(&S, "\x1bLSNAP", 6);
+  snapint(&S, SNAPVERSION, 1);
+  snapint(&S, 8, 1);  /* size of ids */
+  snaplist(&S, g->allgc);
+  snaplist(&S, g->finobj);
+  snaplist(&S, g->tobefnz);
+  snaplist(&S, g->fixedgc);
+  snaproot(&S, gcvalue(&g->l_registry), "registry");
+  snaproot(&S, obj2gco(g->mainthread), "main thread");
+  for (i = 0; i < LUA_NUMTYPES; i++) {
+    static const char *const mtnames[LUA_NUMTYPES] = {"nil metatable",
+      "boolean metatable", "userdata metatable", "number metatable",
+      "string metatable", "table metatable", "function metatable",
+      "userdata metatable", "thread metatable"};
+    if (g->mt[i] != NULL)
+      snaproot(&S, obj2gco(g->mt[i]), mtnames[i]);
+  }
+  snapint(&S, 'E', 1);
+  snapint(&S, S.nobjs, 8);
+  snapflush(&S);
+  return S.status;
 }
 
 /* }====================================================== */
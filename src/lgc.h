@@ -43,6 +43,10 @@
 	(GCSswpallgc <= (g)->gcstate && (g)->gcstate <= GCSswpend)
 
 
+/* value of 'gcphase' when no phase is being timed */
+#define GCPNONE		LUA_GCNUMPHASES
+
+
 /*
 ** macro to tell when main invariant (white objects cannot point to black
 ** ones) must be kept. During a collection, the sweep
@@ -125,6 +129,13 @@
 #define LUAI_GENMAJORMUL         100
 #define LUAI_GENMINORMUL         20
 
+/* Parameters of the adaptive collector (see 'adaptminor' in lgc.c) */
+#define LUAI_GCAHIGHSURV         50   /* survival (%) too high for minors */
+#define LUAI_GCALOWSURV          10   /* survival (%) low enough for minors */
+#define LUAI_GCASTREAK           3    /* collections before a mode switch */
+#define LUAI_GCAMAXMINOR         100  /* maximum minor multiplier */
+#define LUAI_GCAMAXMAJOR         400  /* maximum major multiplier */
+
 /* wait memory to double before starting new cycle */
 #define LUAI_GCPAUSE    200
 
@@ -190,13 +201,19 @@ LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC int luaC_snapshot (lua_State *L, lua_Writer writer, void *data);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC GCObject *luaC_newobjdt (lua_State *L, int tt, size_t sz,
                                                  size_t offset);
+LUAI_FUNC void luaC_linkobj (global_State *g, GCObject *o, int tt);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC void luaC_getstats (lua_State *L, lua_GCStats *stats);
+LUAI_FUNC void luaC_release (lua_State *L, void *block, size_t osize);
+LUAI_FUNC void luaC_flushrelease (lua_State *L, int wait);
+LUAI_FUNC void luaC_setreleasef (lua_State *L, lua_Release f, void *ud);
 
 
 #endif
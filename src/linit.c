@@ -50,6 +50,11 @@ static const luaL_Reg loadedlibs[] = {
   {LUA_MATHLIBNAME, luaopen_math},
   {LUA_UTF8LIBNAME, luaopen_utf8},
   {LUA_DBLIBNAME, luaopen_debug},
+  {LUA_PROFLIBNAME, luaopen_profiler},
+  {LUA_ARRAYLIBNAME, luaopen_array},
+  {LUA_DVMLIBNAME, luaopen_dvm},
+  {LUA_JSONLIBNAME, luaopen_json},
+  {LUA_PERFLIBNAME, luaopen_perf},
   {NULL, NULL}
 };
 
@@ -63,3 +68,137 @@ LUALIB_API void luaL_openlibs (lua_State *L) {
   }
 }
 
+
+/*
+** {======================================================
+** Lazy opening
+** =======================================================
+*/
+
+/*
+** 'luaL_openlazylibs' opens only the libraries that other values need
+** (strings and typed arrays have their methods there). Each other
+** library starts as an empty table, both as its global and in
+** 'package.loaded', with a metatable that has, at index 1, its entry
+** in 'lazylibs'. The first index, assignment, or 'pairs' opens the
+** library and copies its fields into that same table, which then
+** loses its metatable; from there on, it is a plain library table.
+** (A copy of a table still not open, as sandboxes make, has the same
+** metatable, and so it opens its own instance of the library.)
+*/
+
+static const luaL_Reg eagerlibs[] = {
+  {LUA_GNAME, luaopen_base},
+  {LUA_LOADLIBNAME, luaopen_package},
+  {LUA_STRLIBNAME, luaopen_string},
+  {LUA_ARRAYLIBNAME, luaopen_array},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg lazylibs[] = {
+  {LUA_COLIBNAME, luaopen_coroutine},
+  {LUA_TABLIBNAME, luaopen_table},
+  {LUA_IOLIBNAME, luaopen_io},
+  {LUA_OSLIBNAME, luaopen_os},
+  {LUA_MATHLIBNAME, luaopen_math},
+  {LUA_UTF8LIBNAME, luaopen_utf8},
+  {LUA_DBLIBNAME, luaopen_debug},
+  {LUA_PROFLIBNAME, luaopen_profiler},
+  {LUA_DVMLIBNAME, luaopen_dvm},
+  {LUA_JSONLIBNAME, luaopen_json},
+  {LUA_PERFLIBNAME, luaopen_perf},
+  {NULL, NULL}
+};
+
+
+/*
+** Open the library of the table at index 1, if still not open.
+*/
+static void openlazy (lua_State *L) {
+  if (lua_getmetatable(L, 1)) {  /* not open yet? */
+    const luaL_Reg *lib;
+    lua_rawgeti(L, -1, 1);
+    lib = (const luaL_Reg *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (lib != NULL) {
+      lua_pushcfunction(L, lib->func);
+      lua_pushstring(L, lib->name);
+      lua_call(L, 1, 1);  /* open library */
+      lua_pushnil(L);
+      while (lua_next(L, -2)) {  /* copy its fields */
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, 1);
+      }
+      lua_pop(L, 1);  /* library */
+      lua_pushnil(L);
+      lua_setmetatable(L, 1);
+    }
+    lua_pop(L, 1);  /* metatable */
+  }
+}
+
+
+static int lazy_index (lua_State *L) {
+  openlazy(L);
+  lua_settop(L, 2);
+  lua_rawget(L, 1);
+  return 1;
+}
+
+
+static int lazy_newindex (lua_State *L) {
+  openlazy(L);
+  lua_settop(L, 3);
+  lua_rawset(L, 1);
+  return 0;
+}
+
+
+static int lazy_next (lua_State *L) {
+  lua_settop(L, 2);
+  if (lua_next(L, 1))
+    return 2;
+  lua_pushnil(L);
+  return 1;
+}
+
+
+static int lazy_pairs (lua_State *L) {
+  openlazy(L);
+  lua_pushcfunction(L, lazy_next);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+
+LUALIB_API void luaL_openlazylibs (lua_State *L) {
+  const luaL_Reg *lib;
+  static const luaL_Reg lazymeta[] = {
+    {"__index", lazy_index},
+    {"__newindex", lazy_newindex},
+    {"__pairs", lazy_pairs},
+    {NULL, NULL}
+  };
+  for (lib = eagerlibs; lib->func; lib++) {
+    luaL_requiref(L, lib->name, lib->func, 1);
+    lua_pop(L, 1);  /* remove lib */
+  }
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+  for (lib = lazylibs; lib->func; lib++) {
+    lua_newtable(L);  /* table for the library */
+    luaL_newlib(L, lazymeta);  /* its metatable */
+    lua_pushlightuserdata(L, (void *)lib);
+    lua_rawseti(L, -2, 1);
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -3, lib->name);  /* LOADED[name] = table */
+    lua_setglobal(L, lib->name);
+  }
+  lua_pop(L, 1);  /* LOADED table */
+}
+
+/* }====================================================== */
+
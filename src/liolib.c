@@ -107,6 +107,48 @@ static int l_checkmode (const char *mode) {
 #endif				/* } */
 
 
+/*
+** {======================================================
+** l_mapfile maps the contents of a file into memory, returning NULL
+** when it cannot (and then Lua reads the contents instead)
+** =======================================================
+*/
+
+#if !defined(l_mapfile)		/* { */
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char *l_mapfile (FILE *f, size_t *size) {
+  struct stat st;
+  void *s;
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size <= 0 || (unsigned long long)st.st_size > (size_t)-1)
+    return NULL;  /* not a regular file, empty, or too large */
+  s = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (s == MAP_FAILED)
+    return NULL;
+  *size = (size_t)st.st_size;
+  return (const char *)s;
+}
+
+#define l_unmapfile(s,size)	munmap((void *)(s), size)
+
+#else				/* }{ */
+
+/* ISO C definitions */
+#define l_mapfile(f,size)	((void)(f), (void)(size), (const char *)NULL)
+#define l_unmapfile(s,size)	((void)(s), (void)(size))
+
+#endif				/* } */
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** l_fseek: configuration for longer offsets
@@ -155,10 +197,29 @@ static int l_checkmode (const char *mode) {
 typedef luaL_Stream LStream;
 
 
+/*
+** A file opened with mode "rm" is read from memory: its whole contents
+** are mapped (or, where that is not possible, read into a string kept
+** as the user value of the handle) when it is opened, and reading
+** functions serve them from there, with no calls to 'stdio'.
+*/
+typedef struct MStream {
+  LStream p;  /* must be the first field */
+  const char *s;  /* contents */
+  size_t size;  /* size of contents */
+  size_t pos;  /* current position */
+  int mapped;  /* true iff 's' is mapped into memory */
+} MStream;
+
+
 #define tolstream(L)	((LStream *)luaL_checkudata(L, 1, LUA_FILEHANDLE))
 
 #define isclosed(p)	((p)->closef == NULL)
 
+static int io_mclose (lua_State *L);
+
+#define ismemstream(p)	((p)->closef == &io_mclose)
+
 
 static int io_type (lua_State *L) {
   LStream *p;
@@ -184,12 +245,17 @@ static int f_tostring (lua_State *L) {
 }
 
 
-static FILE *tofile (lua_State *L) {
+static LStream *toopenstream (lua_State *L) {
   LStream *p = tolstream(L);
   if (l_unlikely(isclosed(p)))
     luaL_error(L, "attempt to use a closed file");
   lua_assert(p->f);
-  return p->f;
+  return p;
+}
+
+
+static FILE *tofile (lua_State *L) {
+  return toopenstream(L)->f;
 }
 
 
@@ -266,12 +332,63 @@ static void opencheck (lua_State *L, const char *fname, const char *mode) {
 }
 
 
+/*
+** function to close files read from memory
+*/
+static int io_mclose (lua_State *L) {
+  MStream *m = (MStream *)tolstream(L);
+  if (m->mapped)
+    l_unmapfile(m->s, m->size);
+  m->s = NULL;
+  m->size = m->pos = 0;
+  m->mapped = 0;
+  errno = 0;
+  return luaL_fileresult(L, (fclose(m->p.f) == 0), NULL);
+}
+
+
+static void read_all (lua_State *L, FILE *f);
+
+/*
+** Opens a file to be read from memory (mode "rm" or "rbm").
+*/
+static int io_openmem (lua_State *L, const char *filename, int binary) {
+  MStream *m = (MStream *)lua_newuserdatauv(L, sizeof(MStream), 1);
+  m->p.closef = NULL;  /* mark file handle as 'closed' */
+  m->p.f = NULL;
+  m->s = NULL;
+  m->size = m->pos = 0;
+  m->mapped = 0;
+  luaL_setmetatable(L, LUA_FILEHANDLE);
+  errno = 0;
+  m->p.f = fopen(filename, binary ? "rb" : "r");
+  if (m->p.f == NULL)
+    return luaL_fileresult(L, 0, filename);
+  m->p.closef = &io_mclose;
+  m->s = l_mapfile(m->p.f, &m->size);
+  if (m->s != NULL)
+    m->mapped = 1;
+  else {  /* cannot map it; read the contents into a string */
+    clearerr(m->p.f);
+    read_all(L, m->p.f);
+    if (ferror(m->p.f))
+      return luaL_fileresult(L, 0, filename);
+    m->s = lua_tolstring(L, -1, &m->size);
+    lua_setiuservalue(L, -2, 1);  /* keep the string with the handle */
+  }
+  return 1;
+}
+
+
 static int io_open (lua_State *L) {
   const char *filename = luaL_checkstring(L, 1);
   const char *mode = luaL_optstring(L, 2, "r");
-  LStream *p = newfile(L);
+  LStream *p;
   const char *md = mode;  /* to traverse/check mode */
+  if (strcmp(mode, "rm") == 0 || strcmp(mode, "rbm") == 0)
+    return io_openmem(L, filename, mode[1] == 'b');
   luaL_argcheck(L, l_checkmode(md), 2, "invalid mode");
+  p = newfile(L);
   errno = 0;
   p->f = fopen(filename, mode);
   return (p->f == NULL) ? luaL_fileresult(L, 0, filename) : 1;
@@ -308,13 +425,18 @@ static int io_tmpfile (lua_State *L) {
 }
 
 
-static FILE *getiofile (lua_State *L, const char *findex) {
+static LStream *getiostream (lua_State *L, const char *findex) {
   LStream *p;
   lua_getfield(L, LUA_REGISTRYINDEX, findex);
   p = (LStream *)lua_touserdata(L, -1);
   if (l_unlikely(isclosed(p)))
     luaL_error(L, "default %s file is closed", findex + IOPREF_LEN);
-  return p->f;
+  return p;
+}
+
+
+static FILE *getiofile (lua_State *L, const char *findex) {
+  return getiostream(L, findex)->f;
 }
 
 
@@ -428,13 +550,22 @@ static int io_lines (lua_State *L) {
 
 /* auxiliary structure used by 'read_number' */
 typedef struct {
-  FILE *f;  /* file being read */
+  FILE *f;  /* file being read (NULL when reading from memory) */
+  const char *s, *e;  /* current position and end of memory being read */
   int c;  /* current character (look ahead) */
   int n;  /* number of elements in buffer 'buff' */
   char buff[L_MAXLENNUM + 1];  /* +1 for ending '\0' */
 } RN;
 
 
+static int rn_getc (RN *rn) {
+  if (rn->f != NULL)
+    return l_getc(rn->f);
+  else
+    return (rn->s < rn->e) ? (unsigned char)*rn->s++ : EOF;
+}
+
+
 /*
 ** Add current char to buffer (if not out of space) and read next one
 */
@@ -445,7 +576,7 @@ static int nextc (RN *rn) {
   }
   else {
     rn->buff[rn->n++] = rn->c;  /* save current char */
-    rn->c = l_getc(rn->f);  /* read next one */
+    rn->c = rn_getc(rn);  /* read next one */
     return 1;
   }
 }
@@ -475,18 +606,26 @@ static int readdigits (RN *rn, int hex) {
 /*
 ** Read a number: first reads a valid prefix of a numeral into a buffer.
 ** Then it calls 'lua_stringtonumber' to check whether the format is
-** correct and to convert it to a Lua number.
+** correct and to convert it to a Lua number. Reads from 'm' instead of
+** 'f' when it is not NULL.
 */
-static int read_number (lua_State *L, FILE *f) {
+static int read_number (lua_State *L, FILE *f, MStream *m) {
   RN rn;
   int count = 0;
   int hex = 0;
   char decp[2];
-  rn.f = f; rn.n = 0;
+  rn.n = 0;
+  if (m != NULL) {
+    rn.f = NULL;
+    rn.s = m->s + m->pos; rn.e = m->s + m->size;
+  }
+  else {
+    rn.f = f;
+    l_lockfile(rn.f);
+  }
   decp[0] = lua_getlocaledecpoint();  /* get decimal point from locale */
   decp[1] = '.';  /* always accept a dot */
-  l_lockfile(rn.f);
-  do { rn.c = l_getc(rn.f); } while (isspace(rn.c));  /* skip spaces */
+  do { rn.c = rn_getc(&rn); } while (isspace(rn.c));  /* skip spaces */
   test2(&rn, "-+");  /* optional sign */
   if (test2(&rn, "00")) {
     if (test2(&rn, "xX")) hex = 1;  /* numeral is hexadecimal */
@@ -499,8 +638,12 @@ static int read_number (lua_State *L, FILE *f) {
     test2(&rn, "-+");  /* exponent sign */
     readdigits(&rn, 0);  /* exponent digits */
   }
-  ungetc(rn.c, rn.f);  /* unread look-ahead char */
-  l_unlockfile(rn.f);
+  if (m != NULL)  /* unread look-ahead char */
+    m->pos = (size_t)(rn.s - m->s) - (rn.c != EOF);
+  else {
+    ungetc(rn.c, rn.f);  /* unread look-ahead char */
+    l_unlockfile(rn.f);
+  }
   rn.buff[rn.n] = '\0';  /* finish string */
   if (l_likely(lua_stringtonumber(L, rn.buff)))
     return 1;  /* ok, it is a valid number */
@@ -566,13 +709,51 @@ static int read_chars (lua_State *L, FILE *f, size_t n) {
 }
 
 
-static int g_read (lua_State *L, FILE *f, int first) {
+/*
+** Reading functions for files read from memory (mode "rm").
+*/
+static int mread_line (lua_State *L, MStream *m, int chop) {
+  const char *s = m->s + m->pos;
+  size_t avail = m->size - m->pos;
+  const char *nl = (const char *)memchr(s, '\n', avail);
+  if (nl == NULL) {  /* last line, with no newline */
+    lua_pushlstring(L, s, avail);
+    m->pos = m->size;
+    return (avail > 0);
+  }
+  else {
+    size_t l = (size_t)(nl - s);
+    lua_pushlstring(L, s, chop ? l : l + 1);
+    m->pos += l + 1;
+    return 1;
+  }
+}
+
+
+static int mread_chars (lua_State *L, MStream *m, size_t n) {
+  size_t avail = m->size - m->pos;
+  if (n > avail) n = avail;
+  lua_pushlstring(L, m->s + m->pos, n);
+  m->pos += n;
+  return (n > 0);
+}
+
+
+static int mtest_eof (lua_State *L, MStream *m) {
+  lua_pushliteral(L, "");
+  return (m->pos < m->size);
+}
+
+
+static int g_read (lua_State *L, LStream *ls, int first) {
   int nargs = lua_gettop(L) - 1;
   int n, success;
+  FILE *f = ls->f;
+  MStream *m = ismemstream(ls) ? (MStream *)ls : NULL;
   clearerr(f);
   errno = 0;
   if (nargs == 0) {  /* no arguments? */
-    success = read_line(L, f, 1);
+    success = m ? mread_line(L, m, 1) : read_line(L, f, 1);
     n = first + 1;  /* to return 1 result */
   }
   else {
@@ -582,23 +763,29 @@ static int g_read (lua_State *L, FILE *f, int first) {
     for (n = first; nargs-- && success; n++) {
       if (lua_type(L, n) == LUA_TNUMBER) {
         size_t l = (size_t)luaL_checkinteger(L, n);
-        success = (l == 0) ? test_eof(L, f) : read_chars(L, f, l);
+        if (m != NULL)
+          success = (l == 0) ? mtest_eof(L, m) : mread_chars(L, m, l);
+        else
+          success = (l == 0) ? test_eof(L, f) : read_chars(L, f, l);
       }
       else {
         const char *p = luaL_checkstring(L, n);
         if (*p == '*') p++;  /* skip optional '*' (for compatibility) */
         switch (*p) {
           case 'n':  /* number */
-            success = read_number(L, f);
+            success = read_number(L, f, m);
             break;
           case 'l':  /* line */
-            success = read_line(L, f, 1);
+            success = m ? mread_line(L, m, 1) : read_line(L, f, 1);
             break;
           case 'L':  /* line with end-of-line */
-            success = read_line(L, f, 0);
+            success = m ? mread_line(L, m, 0) : read_line(L, f, 0);
             break;
           case 'a':  /* file */
-            read_all(L, f);  /* read entire file */
+            if (m != NULL)
+              mread_chars(L, m, m->size - m->pos);  /* rest of contents */
+            else
+              read_all(L, f);  /* read entire file */
             success = 1; /* always success */
             break;
           default:
@@ -618,12 +805,12 @@ static int g_read (lua_State *L, FILE *f, int first) {
 
 
 static int io_read (lua_State *L) {
-  return g_read(L, getiofile(L, IO_INPUT), 1);
+  return g_read(L, getiostream(L, IO_INPUT), 1);
 }
 
 
 static int f_read (lua_State *L) {
-  return g_read(L, tofile(L), 2);
+  return g_read(L, toopenstream(L), 2);
 }
 
 
@@ -640,7 +827,7 @@ static int io_readline (lua_State *L) {
   luaL_checkstack(L, n, "too many arguments");
   for (i = 1; i <= n; i++)  /* push arguments to 'g_read' */
     lua_pushvalue(L, lua_upvalueindex(3 + i));
-  n = g_read(L, p->f, 2);  /* 'n' is number of results */
+  n = g_read(L, p, 2);  /* 'n' is number of results */
   lua_assert(n > 0);  /* should return at least a nil */
   if (lua_toboolean(L, -n))  /* read at least one value? */
     return n;  /* return them */
@@ -661,30 +848,75 @@ static int io_readline (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** Auxiliary structure for 'g_write', which gathers small arguments in
+** 'buff' to write them with a single call to 'fwrite'.
+*/
+typedef struct WB {
+  FILE *f;
+  int status;  /* false after any failed write */
+  size_t n;  /* number of bytes in 'buff' */
+  char buff[LUAL_BUFFERSIZE];
+} WB;
+
+
+static void wflush (WB *wb) {
+  if (wb->n > 0) {
+    wb->status = wb->status && (fwrite(wb->buff, sizeof(char), wb->n, wb->f)
+                                == wb->n);
+    wb->n = 0;
+  }
+}
+
+
+static void wnumber (lua_State *L, WB *wb, int arg) {
+  int len;
+  size_t room;
+  if (sizeof(wb->buff) - wb->n < L_MAXLENNUM)
+    wflush(wb);  /* ensure room for the numeral */
+  room = sizeof(wb->buff) - wb->n;
+  len = lua_isinteger(L, arg)
+        ? l_sprintf(wb->buff + wb->n, room, LUA_INTEGER_FMT,
+                                      (LUAI_UACINT)lua_tointeger(L, arg))
+        : l_sprintf(wb->buff + wb->n, room, LUA_NUMBER_FMT,
+                                      (LUAI_UACNUMBER)lua_tonumber(L, arg));
+  if (l_likely(0 < len && (size_t)len < room))
+    wb->n += (size_t)len;
+  else
+    wb->status = 0;
+}
+
+
 static int g_write (lua_State *L, FILE *f, int arg) {
   int nargs = lua_gettop(L) - arg;
-  int status = 1;
+  WB wb;
+  wb.f = f; wb.status = 1; wb.n = 0;
   errno = 0;
   for (; nargs--; arg++) {
-    if (lua_type(L, arg) == LUA_TNUMBER) {
-      /* optimization: could be done exactly as for strings */
-      int len = lua_isinteger(L, arg)
-                ? fprintf(f, LUA_INTEGER_FMT,
-                             (LUAI_UACINT)lua_tointeger(L, arg))
-                : fprintf(f, LUA_NUMBER_FMT,
-                             (LUAI_UACNUMBER)lua_tonumber(L, arg));
-      status = status && (len > 0);
-    }
+    if (lua_type(L, arg) == LUA_TNUMBER)
+      wnumber(L, &wb, arg);
     else {
       size_t l;
-      const char *s = luaL_checklstring(L, arg, &l);
-      status = status && (fwrite(s, sizeof(char), l, f) == l);
+      const char *s = lua_tolstring(L, arg, &l);
+      if (l_unlikely(s == NULL)) {  /* not a string? */
+        wflush(&wb);  /* write previous arguments before the error */
+        luaL_checklstring(L, arg, &l);  /* raise the error */
+      }
+      if (l <= sizeof(wb.buff) - wb.n) {  /* fits in the buffer? */
+        memcpy(wb.buff + wb.n, s, l * sizeof(char));
+        wb.n += l;
+      }
+      else {  /* write it directly */
+        wflush(&wb);
+        wb.status = wb.status && (fwrite(s, sizeof(char), l, f) == l);
+      }
     }
   }
-  if (l_likely(status))
+  wflush(&wb);
+  if (l_likely(wb.status))
     return 1;  /* file handle already on stack top */
   else
-    return luaL_fileresult(L, status, NULL);
+    return luaL_fileresult(L, wb.status, NULL);
 }
 
 
@@ -700,13 +932,34 @@ static int f_write (lua_State *L) {
 }
 
 
+/*
+** 'seek' in a file read from memory: positions past the end of the
+** contents are errors, as the file cannot grow.
+*/
+static int mseek (lua_State *L, MStream *m, int op, lua_Integer offset) {
+  lua_Integer base = (op == 0) ? 0
+                   : (lua_Integer)((op == 1) ? m->pos : m->size);
+  if ((offset < 0) ? offset < -base
+                   : (lua_Unsigned)offset > m->size - (lua_Unsigned)base) {
+    errno = EINVAL;
+    return luaL_fileresult(L, 0, NULL);
+  }
+  m->pos = (size_t)(base + offset);
+  lua_pushinteger(L, (lua_Integer)m->pos);
+  return 1;
+}
+
+
 static int f_seek (lua_State *L) {
   static const int mode[] = {SEEK_SET, SEEK_CUR, SEEK_END};
   static const char *const modenames[] = {"set", "cur", "end", NULL};
-  FILE *f = tofile(L);
+  LStream *p = toopenstream(L);
+  FILE *f = p->f;
   int op = luaL_checkoption(L, 2, "cur", modenames);
   lua_Integer p3 = luaL_optinteger(L, 3, 0);
   l_seeknum offset = (l_seeknum)p3;
+  if (ismemstream(p))
+    return mseek(L, (MStream *)p, op, p3);
   luaL_argcheck(L, (lua_Integer)offset == p3, 3,
                   "not an integer in proper range");
   errno = 0;
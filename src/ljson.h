@@ -0,0 +1,61 @@
+/*
+** $Id: ljson.h $
+** Escaping of JSON strings, shared by the json library and the
+** report analyzer
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljson_h
+#define ljson_h
+
+#include <stddef.h>
+
+#include "lsimd.h"
+
+
+/*
+** Bytes that go into a JSON string as they are. Bytes from 0x80 on are
+** copied too, so that UTF-8 text passes unchanged (RFC 8259).
+*/
+#define ljson_isplain(c)  \
+	((unsigned char)(c) >= 0x20 && (c) != '"' && (c) != '\\')
+
+
+/* length of the longest prefix of 's' made of plain bytes */
+static size_t ljson_plainlen (const char *s, size_t n) {
+  size_t i = lsimd_jsonlen(s, n);
+  while (i < n && ljson_isplain(s[i]))
+    i++;
+  return i;
+}
+
+
+/*
+** Write into 'buff' (with at least 6 bytes) the escape sequence of the
+** byte 'c', which is not plain; return its length.
+*/
+static int ljson_escape (int c, char *buff) {
+  static const char hex[] = "0123456789abcdef";
+  char e = 0;
+  switch (c) {
+    case '"': e = '"'; break;
+    case '\\': e = '\\'; break;
+    case '\b': e = 'b'; break;
+    case '\f': e = 'f'; break;
+    case '\n': e = 'n'; break;
+    case '\r': e = 'r'; break;
+    case '\t': e = 't'; break;
+  }
+  buff[0] = '\\';
+  if (e != 0) {
+    buff[1] = e;
+    return 2;
+  }
+  buff[1] = 'u';
+  buff[2] = buff[3] = '0';
+  buff[4] = hex[(c >> 4) & 0xF];
+  buff[5] = hex[c & 0xF];
+  return 6;
+}
+
+#endif
@@ -0,0 +1,621 @@
+/*
+** $Id: ljsonlib.c $
+** Library for JSON encoding and decoding
+** See Copyright Notice in lua.h
+*/
+
+#define ljsonlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "ljson.h"
+#include "lnumfmt.h"
+
+
+/* maximum nesting of arrays and objects */
+#if !defined(JSON_MAXDEPTH)
+#define JSON_MAXDEPTH	128
+#endif
+
+
+/*
+** Elements of an array (or members of an object) decoded onto the
+** stack before the table is created, so that small containers get
+** tables of their exact sizes.
+*/
+#if !defined(JSON_BATCH)
+#define JSON_BATCH	64
+#endif
+
+
+/* 'json.null' is a light userdata with a NULL pointer */
+#define isnull(L,idx)	(lua_islightuserdata(L, idx) && \
+			 lua_touserdata(L, idx) == NULL)
+
+
+/*
+** {======================================================
+** Encoding
+** =======================================================
+*/
+
+/*
+** The encoder writes into a 'luaL_Buffer', which needs a balanced
+** stack at each operation. So, the keys and values of the tables being
+** traversed live in 2 * JSON_MAXDEPTH slots reserved below the buffer,
+** two for each level of nesting.
+*/
+typedef struct Encoder {
+  lua_State *L;
+  int slots;  /* index of the first reserved slot */
+  luaL_Buffer b;
+} Encoder;
+
+
+static void addstring (luaL_Buffer *b, const char *s, size_t n) {
+  luaL_addchar(b, '"');
+  while (n > 0) {
+    size_t k = ljson_plainlen(s, n);
+    char e[6];
+    luaL_addlstring(b, s, k);
+    if (k == n) break;
+    luaL_addlstring(b, e, (size_t)ljson_escape((unsigned char)s[k], e));
+    s += k + 1;
+    n -= k + 1;
+  }
+  luaL_addchar(b, '"');
+}
+
+
+/*
+** Format number at 'idx' into 'buff'. Floats get the shortest of 15 or
+** 17 digits that reads back as the same value, and a '.0' if they look
+** like integers, so that they decode as floats.
+*/
+static int fmtnumber (lua_State *L, int idx, char *buff, size_t sz) {
+  int n;
+  if (lua_isinteger(L, idx))
+    n = lnum_fmtint(buff, lua_tointeger(L, idx));
+  else {
+    double f = (double)lua_tonumber(L, idx);
+    if (f != f || f == HUGE_VAL || f == -HUGE_VAL)
+      return luaL_error(L, "cannot encode NaN or infinity");
+    n = lnum_fmtg(buff, f, 15, 1, lua_getlocaledecpoint());
+    if (n < 0) {  /* fast formatter could not do it? */
+      n = snprintf(buff, sz, "%.15g", f);
+      if (strtod(buff, NULL) != f)
+        n = snprintf(buff, sz, "%.17g", f);
+    }
+    if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
+      buff[n++] = '.';
+      buff[n++] = '0';
+    }
+  }
+  return n;
+}
+
+
+/* go to the next pair of table 't', with key slot 'k' and value 'k + 1' */
+static int nextpair (lua_State *L, int t, int k) {
+  lua_pushvalue(L, k);
+  if (!lua_next(L, t))
+    return 0;
+  lua_replace(L, k + 1);
+  lua_replace(L, k);
+  return 1;
+}
+
+
+/* whether the key at 'k' is in the sequence '1..n' */
+static int isseqkey (lua_State *L, int k, lua_Unsigned n) {
+  if (lua_type(L, k) == LUA_TNUMBER && lua_isinteger(L, k)) {
+    lua_Integer i = lua_tointeger(L, k);
+    return (i >= 1 && (lua_Unsigned)i <= n);
+  }
+  return 0;
+}
+
+
+static void encode (Encoder *e, int idx, int depth);
+
+
+static void encodetable (Encoder *e, int idx, int depth) {
+  lua_State *L = e->L;
+  int k = e->slots + 2 * depth;  /* slots for this level */
+  lua_Unsigned n = lua_rawlen(L, idx);
+  int first = 1;
+  if (depth >= JSON_MAXDEPTH)
+    luaL_error(L, "tables nested too deep (or with cycles)");
+  if (n > 0) {  /* check whether it is a sequence */
+    lua_pushnil(L);
+    lua_replace(L, k);
+    while (nextpair(L, idx, k)) {
+      if (!isseqkey(L, k, n)) {
+        n = 0;  /* not a sequence */
+        break;
+      }
+    }
+  }
+  if (n > 0) {
+    lua_Unsigned i;
+    luaL_addchar(&e->b, '[');
+    for (i = 1; i <= n; i++) {
+      if (i > 1) luaL_addchar(&e->b, ',');
+      lua_rawgeti(L, idx, (lua_Integer)i);
+      lua_replace(L, k + 1);
+      encode(e, k + 1, depth + 1);
+    }
+    luaL_addchar(&e->b, ']');
+    return;
+  }
+  luaL_addchar(&e->b, '{');
+  lua_pushnil(L);
+  lua_replace(L, k);
+  while (nextpair(L, idx, k)) {
+    if (!first) luaL_addchar(&e->b, ',');
+    first = 0;
+    switch (lua_type(L, k)) {
+      case LUA_TSTRING: {
+        size_t l;
+        const char *s = lua_tolstring(L, k, &l);
+        addstring(&e->b, s, l);
+        break;
+      }
+      case LUA_TNUMBER: {  /* keys are always strings in JSON */
+        char buff[64];
+        int l = fmtnumber(L, k, buff, sizeof(buff) - 2);
+        addstring(&e->b, buff, (size_t)l);
+        break;
+      }
+      default:
+        luaL_error(L, "cannot encode a key of type %s", luaL_typename(L, k));
+    }
+    luaL_addchar(&e->b, ':');
+    encode(e, k + 1, depth + 1);
+  }
+  luaL_addchar(&e->b, '}');
+}
+
+
+static void encode (Encoder *e, int idx, int depth) {
+  lua_State *L = e->L;
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      luaL_addstring(&e->b, "null");
+      break;
+    case LUA_TBOOLEAN:
+      luaL_addstring(&e->b, lua_toboolean(L, idx) ? "true" : "false");
+      break;
+    case LUA_TNUMBER: {
+      char buff[64];
+      int l = fmtnumber(L, idx, buff, sizeof(buff) - 2);
+      luaL_addlstring(&e->b, buff, (size_t)l);
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, idx, &l);
+      addstring(&e->b, s, l);
+      break;
+    }
+    case LUA_TTABLE:
+      encodetable(e, idx, depth);
+      break;
+    default:
+      if (isnull(L, idx))
+        luaL_addstring(&e->b, "null");
+      else
+        luaL_error(L, "cannot encode a %s value", luaL_typename(L, idx));
+  }
+}
+
+
+static int json_encode (lua_State *L) {
+  Encoder e;
+  luaL_checkany(L, 1);
+  lua_settop(L, 1);
+  luaL_checkstack(L, 2 * JSON_MAXDEPTH + LUA_MINSTACK,
+                     "too many nested tables");
+  lua_settop(L, 1 + 2 * JSON_MAXDEPTH);
+  e.L = L;
+  e.slots = 2;
+  luaL_buffinit(L, &e.b);
+  encode(&e, 1, 0);
+  luaL_pushresult(&e.b);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Decoding
+** =======================================================
+*/
+
+typedef struct Decoder {
+  lua_State *L;
+  const char *s;  /* start of the text */
+  const char *p;  /* next byte to read */
+  const char *e;  /* end of the text */
+} Decoder;
+
+
+static int decodeerror (Decoder *d, const char *msg) {
+  return luaL_error(d->L, "%s at position %I", msg,
+                          (lua_Integer)(d->p - d->s) + 1);
+}
+
+
+static void skipspace (Decoder *d) {
+  while (d->p < d->e &&
+         (*d->p == ' ' || *d->p == '\n' || *d->p == '\r' || *d->p == '\t'))
+    d->p++;
+}
+
+
+/* skip spaces and return the next byte (or -1 at the end) */
+static int peek (Decoder *d) {
+  skipspace(d);
+  return (d->p < d->e) ? (unsigned char)*d->p : -1;
+}
+
+
+static int gethex (Decoder *d) {
+  int i, c = 0;
+  if (d->e - d->p < 4)
+    decodeerror(d, "invalid escape");
+  for (i = 0; i < 4; i++) {
+    int h = (unsigned char)*d->p++;
+    if ('0' <= h && h <= '9') h -= '0';
+    else if ('a' <= (h | 0x20) && (h | 0x20) <= 'f') h = (h | 0x20) - 'a' + 10;
+    else decodeerror(d, "invalid escape");
+    c = c * 16 + h;
+  }
+  return c;
+}
+
+
+static void addutf8 (luaL_Buffer *b, unsigned long x) {
+  char buff[4];
+  int n;
+  if (x < 0x80) { buff[0] = (char)x; n = 1; }
+  else if (x < 0x800) {
+    buff[0] = (char)(0xC0 | (x >> 6));
+    buff[1] = (char)(0x80 | (x & 0x3F));
+    n = 2;
+  }
+  else if (x < 0x10000) {
+    buff[0] = (char)(0xE0 | (x >> 12));
+    buff[1] = (char)(0x80 | ((x >> 6) & 0x3F));
+    buff[2] = (char)(0x80 | (x & 0x3F));
+    n = 3;
+  }
+  else {
+    buff[0] = (char)(0xF0 | (x >> 18));
+    buff[1] = (char)(0x80 | ((x >> 12) & 0x3F));
+    buff[2] = (char)(0x80 | ((x >> 6) & 0x3F));
+    buff[3] = (char)(0x80 | (x & 0x3F));
+    n = 4;
+  }
+  luaL_addlstring(b, buff, (size_t)n);
+}
+
+
+/* decode a '\u' escape (after the 'u'), joining surrogate pairs */
+static void decodeunicode (Decoder *d, luaL_Buffer *b) {
+  unsigned long x = (unsigned long)gethex(d);
+  if (0xDC00 <= x && x <= 0xDFFF)
+    decodeerror(d, "invalid escape");
+  if (0xD800 <= x && x <= 0xDBFF) {  /* high surrogate? */
+    unsigned long lo;
+    if (d->e - d->p < 2 || d->p[0] != '\\' || d->p[1] != 'u')
+      decodeerror(d, "invalid escape");
+    d->p += 2;
+    lo = (unsigned long)gethex(d);
+    if (!(0xDC00 <= lo && lo <= 0xDFFF))
+      decodeerror(d, "invalid escape");
+    x = 0x10000 + ((x - 0xD800) << 10) + (lo - 0xDC00);
+  }
+  addutf8(b, x);
+}
+
+
+/*
+** Decode a string (after its opening quote). Strings without escapes,
+** found with one scan, are pushed straight from the text.
+*/
+static void decodestring (Decoder *d) {
+  lua_State *L = d->L;
+  const char *start = d->p;
+  luaL_Buffer b;
+  d->p += ljson_plainlen(d->p, (size_t)(d->e - d->p));
+  if (d->p < d->e && *d->p == '"') {
+    lua_pushlstring(L, start, (size_t)(d->p - start));
+    d->p++;
+    return;
+  }
+  luaL_buffinit(L, &b);
+  luaL_addlstring(&b, start, (size_t)(d->p - start));
+  for (;;) {
+    if (d->p >= d->e)
+      decodeerror(d, "unfinished string");
+    else if (*d->p == '"')
+      break;
+    else if (*d->p == '\\') {
+      char c;
+      if (++d->p >= d->e)
+        decodeerror(d, "unfinished string");
+      switch (c = *d->p++) {
+        case '"': case '\\': case '/': luaL_addchar(&b, c); break;
+        case 'b': luaL_addchar(&b, '\b'); break;
+        case 'f': luaL_addchar(&b, '\f'); break;
+        case 'n': luaL_addchar(&b, '\n'); break;
+        case 'r': luaL_addchar(&b, '\r'); break;
+        case 't': luaL_addchar(&b, '\t'); break;
+        case 'u': decodeunicode(d, &b); break;
+        default:
+          d->p--;
+          decodeerror(d, "invalid escape");
+      }
+    }
+    else if ((unsigned char)*d->p < 0x20)
+      decodeerror(d, "control character in string");
+    else {
+      size_t k = ljson_plainlen(d->p, (size_t)(d->e - d->p));
+      luaL_addlstring(&b, d->p, k);
+      d->p += k;
+    }
+  }
+  d->p++;  /* skip closing quote */
+  luaL_pushresult(&b);
+}
+
+
+#define isdigit_(c)	('0' <= (c) && (c) <= '9')
+
+/* digits of integers that are read directly (others are converted) */
+#define MAXINTDIGITS	((sizeof(lua_Integer) >= 8) ? 18 : 9)
+
+/* numerals up to this length are converted without a Lua string */
+#define MAXNUMLEN	64
+
+static void decodenumber (Decoder *d) {
+  lua_State *L = d->L;
+  const char *start = d->p;
+  int isint = 1;
+  if (*d->p == '-') d->p++;
+  if (d->p < d->e && *d->p == '0')
+    d->p++;
+  else if (d->p < d->e && isdigit_(*d->p)) {
+    while (d->p < d->e && isdigit_(*d->p)) d->p++;
+  }
+  else
+    decodeerror(d, "invalid number");
+  if (d->p < d->e && *d->p == '.') {
+    d->p++;
+    if (!(d->p < d->e && isdigit_(*d->p)))
+      decodeerror(d, "invalid number");
+    while (d->p < d->e && isdigit_(*d->p)) d->p++;
+    isint = 0;
+  }
+  if (d->p < d->e && (*d->p == 'e' || *d->p == 'E')) {
+    d->p++;
+    if (d->p < d->e && (*d->p == '+' || *d->p == '-')) d->p++;
+    if (!(d->p < d->e && isdigit_(*d->p)))
+      decodeerror(d, "invalid number");
+    while (d->p < d->e && isdigit_(*d->p)) d->p++;
+    isint = 0;
+  }
+  if (isint && d->p - start <= MAXINTDIGITS) {  /* surely fits? */
+    const char *s = start + (*start == '-');
+    lua_Integer i = 0;
+    for (; s < d->p; s++)
+      i = i * 10 + (*s - '0');
+    lua_pushinteger(L, (*start == '-') ? -i : i);
+    return;
+  }
+  if (d->p - start <= MAXNUMLEN) {  /* convert it from a copy in C? */
+    char buff[MAXNUMLEN + 1];
+    memcpy(buff, start, (size_t)(d->p - start));
+    buff[d->p - start] = '\0';
+    if (lua_stringtonumber(L, buff) == 0)
+      decodeerror(d, "invalid number");
+    return;
+  }
+  lua_pushlstring(L, start, (size_t)(d->p - start));
+  if (lua_stringtonumber(L, lua_tostring(L, -1)) == 0)
+    decodeerror(d, "invalid number");
+  lua_remove(L, -2);  /* remove text */
+}
+
+
+static void decodevalue (Decoder *d, int depth);
+
+
+/*
+** Move the 'n' values on top of the stack into table 't' (created
+** with room for them if 't' is 0), from index 'first' on. Return the
+** index of the table.
+*/
+static int flusharray (lua_State *L, int t, int n, lua_Integer first) {
+  int i, base = lua_gettop(L) - n;
+  if (t == 0) {
+    lua_createtable(L, n, 0);
+    lua_insert(L, base + 1);
+    t = base++ + 1;
+  }
+  for (i = 1; i <= n; i++) {
+    lua_pushvalue(L, base + i);
+    lua_rawseti(L, t, first + i - 1);
+  }
+  lua_settop(L, base);
+  return t;
+}
+
+
+static void decodearray (Decoder *d, int depth) {
+  lua_State *L = d->L;
+  int t = 0, n = 0;  /* table (once created) and values pending */
+  lua_Integer size = 0;  /* values already in the table */
+  luaL_checkstack(L, JSON_BATCH + LUA_MINSTACK, "arrays nested too deep");
+  if (peek(d) == ']') {
+    d->p++;
+    lua_createtable(L, 0, 0);
+    return;
+  }
+  for (;;) {
+    int c;
+    decodevalue(d, depth + 1);
+    if (++n == JSON_BATCH) {
+      t = flusharray(L, t, n, size + 1);
+      size += n;
+      n = 0;
+    }
+    if ((c = peek(d)) == ']') break;
+    else if (c != ',')
+      decodeerror(d, "',' or ']' expected");
+    d->p++;
+  }
+  d->p++;
+  flusharray(L, t, n, size + 1);
+}
+
+
+/* move the 'n' key-value pairs on top of the stack into table 't' */
+static int flushobject (lua_State *L, int t, int n) {
+  int i, base = lua_gettop(L) - 2 * n;
+  if (t == 0) {
+    lua_createtable(L, 0, n);
+    lua_insert(L, base + 1);
+    t = base++ + 1;
+  }
+  for (i = 1; i <= 2 * n; i += 2) {
+    lua_pushvalue(L, base + i);
+    lua_pushvalue(L, base + i + 1);
+    lua_rawset(L, t);
+  }
+  lua_settop(L, base);
+  return t;
+}
+
+
+static void decodeobject (Decoder *d, int depth) {
+  lua_State *L = d->L;
+  int t = 0, n = 0;
+  luaL_checkstack(L, 2 * JSON_BATCH + LUA_MINSTACK, "objects nested too deep");
+  if (peek(d) == '}') {
+    d->p++;
+    lua_createtable(L, 0, 0);
+    return;
+  }
+  for (;;) {
+    int c;
+    if (peek(d) != '"')
+      decodeerror(d, "string expected");
+    d->p++;
+    decodestring(d);
+    if (peek(d) != ':')
+      decodeerror(d, "':' expected");
+    d->p++;
+    decodevalue(d, depth + 1);
+    if (++n == JSON_BATCH) {
+      t = flushobject(L, t, n);
+      n = 0;
+    }
+    if ((c = peek(d)) == '}') break;
+    else if (c != ',')
+      decodeerror(d, "',' or '}' expected");
+    d->p++;
+  }
+  d->p++;
+  flushobject(L, t, n);
+}
+
+
+static int literal (Decoder *d, const char *lit, size_t l) {
+  if ((size_t)(d->e - d->p) >= l && memcmp(d->p, lit, l) == 0) {
+    d->p += l;
+    return 1;
+  }
+  return 0;
+}
+
+
+static void decodevalue (Decoder *d, int depth) {
+  lua_State *L = d->L;
+  int c = peek(d);
+  if (depth >= JSON_MAXDEPTH)
+    decodeerror(d, "values nested too deep");
+  switch (c) {
+    case '{': d->p++; decodeobject(d, depth); break;
+    case '[': d->p++; decodearray(d, depth); break;
+    case '"': d->p++; decodestring(d); break;
+    case 't':
+      if (!literal(d, "true", 4)) decodeerror(d, "invalid value");
+      lua_pushboolean(L, 1);
+      break;
+    case 'f':
+      if (!literal(d, "false", 5)) decodeerror(d, "invalid value");
+      lua_pushboolean(L, 0);
+      break;
+    case 'n':
+      if (!literal(d, "null", 4)) decodeerror(d, "invalid value");
+      lua_pushlightuserdata(L, NULL);
+      break;
+    case -1:
+      decodeerror(d, "unexpected end of text");
+      break;
+    default:
+      if (c == '-' || isdigit_(c))
+        decodenumber(d);
+      else
+        decodeerror(d, "invalid value");
+  }
+}
+
+
+static int json_decode (lua_State *L) {
+  Decoder d;
+  size_t l;
+  d.L = L;
+  d.s = d.p = luaL_checklstring(L, 1, &l);
+  d.e = d.s + l;
+  decodevalue(&d, 0);
+  if (peek(&d) != -1)
+    decodeerror(&d, "unexpected text after value");
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg json_funcs[] = {
+  {"encode", json_encode},
+  {"decode", json_decode},
+  {"null", NULL},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_json (lua_State *L) {
+  luaL_newlib(L, json_funcs);
+  lua_pushlightuserdata(L, NULL);
+  lua_setfield(L, -2, "null");
+  return 1;
+}
+
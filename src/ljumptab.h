@@ -108,5 +108,23 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
 &&L_OP_EXTRAARG,
-&&L_OP_2Q
+&&L_OP_2Q,
+&&L_OP_FSTRING,
+&&L_OP_SWITCH,
+&&L_OP_GETTABUPF,
+&&L_OP_GETFIELDC,
+&&L_OP_CALLFLOOR,
+&&L_OP_CALLCEIL,
+&&L_OP_CALLABS,
+&&L_OP_CALLSQRT,
+&&L_OP_CALLMIN,
+&&L_OP_CALLMAX,
+&&L_OP_ADDII,
+&&L_OP_SUBII,
+&&L_OP_MULII,
+&&L_OP_ADDKI,
+&&L_OP_SUBKI,
+&&L_OP_MULKI,
+&&L_OP_MODKI,
+&&L_OP_IDIVKI
 };
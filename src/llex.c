@@ -67,14 +67,98 @@ static void save (LexState *ls, int c) {
 }
 
 
+/*
+** {======================================================
+** Fast paths over the input buffer: 'ls->current' is always the byte
+** right before 'z->p' (or EOZ), so a span of characters starting at
+** 'current' that is already in the ZIO buffer (all of the input, for
+** a chunk loaded from a string) can be scanned in place and saved at
+** once, instead of one 'save_and_next' per character.
+** =======================================================
+*/
+
+/* start of the input span that begins with the current character */
+#define spanstart(ls)	((ls)->z->p - 1)
+
+/* end of the input span available in the ZIO buffer */
+#define spanend(ls)	((ls)->z->p + (ls)->z->n)
+
+
+/* move past the 'n' characters starting at the current one */
+static void skipspan (LexState *ls, size_t n) {
+  ZIO *z = ls->z;
+  lua_assert(n > 0 && n <= z->n + 1 && cast_uchar(z->p[-1]) == ls->current);
+  z->p += n - 1;
+  z->n -= n - 1;
+  next(ls);
+}
+
+
+/*
+** Save the 'n' characters starting at the current one and move past
+** them.
+*/
+static void savespan (LexState *ls, size_t n) {
+  Mbuffer *b = ls->buff;
+  if (luaZ_sizebuffer(b) - luaZ_bufflen(b) < n) {
+    size_t newsize = luaZ_sizebuffer(b);
+    do {
+      if (newsize >= MAX_SIZE/2)
+        lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    } while (newsize - luaZ_bufflen(b) < n);
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + luaZ_bufflen(b), spanstart(ls), n);
+  luaZ_bufflen(b) += n;
+  skipspan(ls, n);
+}
+
+
+/*
+** Reserved words are classified by a perfect hash over their first
+** and last characters and their length, so that they are not
+** interned. 'kwhash' gives the reserved word (plus 1) for each hash
+** value, or 0. (ORDER RESERVED; 'luaX_init' checks this table.)
+*/
+#define KWHASH(s,l)  \
+	((cast_uint(cast_uchar((s)[0])) * 3u + \
+	  cast_uint(cast_uchar((s)[(l) - 1])) * 13u + cast_uint(l)) & 63u)
+
+static const lu_byte kwhash[64] = {
+  17, 20,  0,  0,  0, 13,  6,  0,  0, 14,  0, 22,  0,  0,  0,  0,
+   9,  3,  0, 12,  4,  0,  0,  0,  7, 16,  2,  0, 10,  0,  0,  0,
+  21,  0,  0,  5,  0,  0,  0,  0,  0,  0,  0, 11,  0,  0,  0,  0,
+   0, 15, 18,  0,  0,  0, 19,  0,  0,  0,  1,  0,  0,  0,  0,  8
+};
+
+
+/* Return the token of reserved word 's' (with length 'l') or 0. */
+static int reservedword (const char *s, size_t l) {
+  if (2 <= l && l <= 8) {  /* lengths of reserved words */
+    int i = kwhash[KWHASH(s, l)];
+    if (i != 0 && strncmp(luaX_tokens[i - 1], s, l) == 0 &&
+        luaX_tokens[i - 1][l] == '\0')
+      return i - 1 + FIRST_RESERVED;
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
 void luaX_init (lua_State *L) {
   int i;
   TString *e = luaS_newliteral(L, LUA_ENV);  /* create env name */
   luaC_fix(L, obj2gco(e));  /* never collect this name */
+  luaC_fix(L, obj2gco(luaS_newliteral(L, "switch")));  /* nor these ones */
+  luaC_fix(L, obj2gco(luaS_newliteral(L, "case")));
+  luaC_fix(L, obj2gco(luaS_newliteral(L, "defer")));
   for (i=0; i<NUM_RESERVED; i++) {
     TString *ts = luaS_new(L, luaX_tokens[i]);
     luaC_fix(L, obj2gco(ts));  /* reserved words are never collected */
     ts->extra = cast_byte(i+1);  /* reserved word */
+    lua_assert(reservedword(getstr(ts), tsslen(ts)) == i + FIRST_RESERVED);
   }
 }
 
@@ -178,8 +262,13 @@ void luaX_setinput (lua_State *L, LexState *ls, ZIO *z, TString *source,
   ls->linenumber = 1;
   ls->lastline = 1;
   ls->source = source;
+  ls->encrypted_flag = 0;
   ls->envn = luaS_newliteral(L, LUA_ENV);  /* get env name */
-  luaZ_resizebuffer(ls->L, ls->buff, LUA_MINBUFFER);  /* initialize buffer */
+  ls->switchn = luaS_newliteral(L, "switch");
+  ls->casen = luaS_newliteral(L, "case");
+  ls->defern = luaS_newliteral(L, "defer");
+  if (luaZ_sizebuffer(ls->buff) < LUA_MINBUFFER)  /* buffer not kept? */
+    luaZ_resizebuffer(ls->L, ls->buff, LUA_MINBUFFER);  /* initialize it */
 }
 
 
@@ -236,7 +325,9 @@ static int read_numeral (LexState *ls, SemInfo *seminfo) {
   if (first == '0' && check_next2(ls, "xX"))  /* hexadecimal? */
     expo = "Pp";
   for (;;) {
-    if (check_next2(ls, expo))  /* exponent mark? */
+    if (lisdigit(ls->current))  /* the common case first */
+      save_and_next(ls);
+    else if (check_next2(ls, expo))  /* exponent mark? */
       check_next2(ls, "-+");  /* optional exponent sign */
     else if (lisxdigit(ls->current) || ls->current == '.')  /* '%x|%.' */
       save_and_next(ls);
@@ -435,8 +526,14 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
          /* go through */
        no_save: break;
       }
-      default:
-        save_and_next(ls);
+      default: {  /* save all plain characters in the buffer at once */
+        const char *s = spanstart(ls);
+        const char *e = spanend(ls);
+        const char *q = s + 1;
+        while (q < e && *q != del && *q != '\\' && *q != '\n' && *q != '\r')
+          q++;
+        savespan(ls, q - s);
+      }
     }
   }
   save_and_next(ls);  /* skip delimiter */
@@ -566,8 +663,15 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           }
         }
         /* else short comment */
-        while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+        while (!currIsNewline(ls) && ls->current != EOZ) {
+          /* skip until end of line (or end of file) */
+          const char *s = spanstart(ls);
+          const char *e = spanend(ls);
+          const char *q = s + 1;
+          while (q < e && *q != '\n' && *q != '\r')
+            q++;
+          skipspan(ls, q - s);
+        }
         break;
       }
       case '[': {  /* long string or simply '[' */
@@ -635,18 +739,21 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       }
       default: {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
-          TString *ts;
-          do {
+          const char *s = spanstart(ls);
+          const char *e = spanend(ls);
+          const char *q = s + 1;
+          int rw;
+          while (q < e && lislalnum(cast_uchar(*q)))
+            q++;
+          savespan(ls, q - s);
+          while (lislalnum(ls->current))  /* name goes past the buffer? */
             save_and_next(ls);
-          } while (lislalnum(ls->current));
-          ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
-                                  luaZ_bufflen(ls->buff));
-          seminfo->ts = ts;
-          if (isreserved(ts))  /* reserved word? */
-            return ts->extra - 1 + FIRST_RESERVED;
-          else {
-            return TK_NAME;
-          }
+          rw = reservedword(luaZ_buffer(ls->buff), luaZ_bufflen(ls->buff));
+          if (rw != 0)  /* reserved word? */
+            return rw;
+          seminfo->ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
+                                           luaZ_bufflen(ls->buff));
+          return TK_NAME;
         }
         else {  /* single-char tokens ('+', '*', '%', '{', '}', ...) */
           int c = ls->current;
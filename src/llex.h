@@ -75,6 +75,9 @@ typedef struct LexState {
   struct Dyndata *dyd;  /* dynamic structures used by the parser */
   TString *source;  /* current source name */
   TString *envn;  /* environment variable name */
+  TString *switchn;  /* "switch", "case", and "defer", which are not */
+  TString *casen;    /* reserved words */
+  TString *defern;
   int fstring_del;
   int encrypted_flag;
 } LexState;
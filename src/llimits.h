@@ -192,14 +192,32 @@ typedef LUAI_UACINT l_uacInt;
 #define l_sinline	static l_inline
 
 
+/*
+** mark of code that is never reached (lets the compiler drop checks)
+*/
+#if !defined(l_unreachable)
+
+#if defined(__GNUC__)
+#define l_unreachable()		__builtin_unreachable()
+#elif defined(_MSC_VER)
+#define l_unreachable()		__assume(0)
+#else
+#define l_unreachable()		((void)0)
+#endif
+
+#endif
+
+
 /*
 ** type for virtual-machine instructions;
 ** must be an unsigned with (at least) 4 bytes (see details in lopcodes.h)
 */
 #if LUAI_IS32INT
 typedef unsigned int l_uint32;
+typedef int l_int32;
 #else
 typedef unsigned long l_uint32;
+typedef long l_int32;
 #endif
 
 typedef l_uint32 Instruction;
@@ -217,6 +235,16 @@ typedef l_uint32 Instruction;
 #endif
 
 
+/*
+** Minimum length for a substring to be a slice of its string instead
+** of a copy (see 'luaS_newslice'). Must be larger than
+** LUAI_MAXSHORTLEN, as slices are long strings.
+*/
+#if !defined(LUAI_MINSLICE)
+#define LUAI_MINSLICE	256
+#endif
+
+
 /*
 ** Initial size for the string table (must be power of 2).
 ** The Lua core alone registers ~50 strings (reserved words +
@@ -228,6 +256,16 @@ typedef l_uint32 Instruction;
 #endif
 
 
+/*
+** Number of buckets moved to the new array of a growing string table
+** for each new short string. It must be at least 1, so that growth
+** ends before the table fills again.
+*/
+#if !defined(STRTABMOVE)
+#define STRTABMOVE	2
+#endif
+
+
 /*
 ** Size of cache for strings in the API. 'N' is the number of
 ** sets (better be a prime) and "M" is the size of each set (M == 1
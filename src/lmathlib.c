@@ -766,7 +766,7 @@ static const luaL_Reg mathlib[] = {
 ** Open math library
 */
 LUAMOD_API int luaopen_math (lua_State *L) {
-  luaL_newlib(L, mathlib);
+  luaL_newfastlib(L, mathlib);
   lua_pushnumber(L, PI);
   lua_setfield(L, -2, "pi");
   lua_pushnumber(L, (lua_Number)HUGE_VAL);
@@ -776,6 +776,13 @@ LUAMOD_API int luaopen_math (lua_State *L) {
   lua_pushinteger(L, LUA_MININTEGER);
   lua_setfield(L, -2, "mininteger");
   setrandfunc(L);
+  /* let the VM compute these functions inline */
+  lua_setintrinsic(L, LUA_INTRFLOOR, math_floor);
+  lua_setintrinsic(L, LUA_INTRCEIL, math_ceil);
+  lua_setintrinsic(L, LUA_INTRABS, math_abs);
+  lua_setintrinsic(L, LUA_INTRSQRT, math_sqrt);
+  lua_setintrinsic(L, LUA_INTRMIN, math_min);
+  lua_setintrinsic(L, LUA_INTRMAX, math_max);
   return 1;
 }
 
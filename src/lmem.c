@@ -47,6 +47,22 @@
 #define callfrealloc(g,block,os,ns)    ((*g->frealloc)(g->ud, block, os, ns))
 
 
+/*
+** With a memory limit (see 'lua_setmemlimit'), an allocation that would
+** take the total in use past it fails as if the allocator had failed.
+** ('os' is a tag, not a size, when 'block' is NULL.)
+*/
+static void *limitedfrealloc (global_State *g, void *block,
+                                               size_t os, size_t ns) {
+  if (l_unlikely(g->memlimit > 0)) {
+    size_t old = (block == NULL) ? 0 : os;
+    if (ns > old && gettotalbytes(g) + (ns - old) > g->memlimit)
+      return NULL;
+  }
+  return callfrealloc(g, block, os, ns);
+}
+
+
 /*
 ** When an allocation fails, it will try again after an emergency
 ** collection, except when it cannot run a collection.  The GC should
@@ -70,10 +86,10 @@ static void *firsttry (global_State *g, void *block, size_t os, size_t ns) {
   if (ns > 0 && cantryagain(g))
     return NULL;  /* fail */
   else  /* normal allocation */
-    return callfrealloc(g, block, os, ns);
+    return limitedfrealloc(g, block, os, ns);
 }
 #else
-#define firsttry(g,block,os,ns)    callfrealloc(g, block, os, ns)
+#define firsttry(g,block,os,ns)    limitedfrealloc(g, block, os, ns)
 #endif
 
 
@@ -150,7 +166,10 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  callfrealloc(g, block, osize, 0);
+  if (l_unlikely(g->gcreleasing))  /* freeing a dead object? */
+    luaC_release(L, block, osize);  /* let 'releasef' do it */
+  else
+    callfrealloc(g, block, osize, 0);
   g->GCdebt -= osize;
 }
 
@@ -164,12 +183,42 @@ static void *tryagain (lua_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
-    return callfrealloc(g, block, osize, nsize);  /* try again */
+    return limitedfrealloc(g, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
 }
 
 
+/*
+** Memory accounting is on when some thread has set an accounting
+** context or when there is an allocation sampler.
+*/
+#define accounting(g)	((g)->memctx != NULL || (g)->allocsampler != NULL)
+
+
+/*
+** Charge a new allocation of 'n' bytes to the accounting context of
+** 'L' and count it towards the next sample. A sample reports all bytes
+** allocated since the previous one.
+*/
+static void accountalloc (lua_State *L, size_t n) {
+  global_State *g = G(L);
+  if (g->memctx != NULL) {
+    MemCtx *mc = &g->memctx[L->memctx];
+    mc->bytes += n;
+    mc->count++;
+  }
+  if (g->allocsampler != NULL) {
+    g->allocnext -= cast(l_mem, n);
+    if (g->allocnext <= 0) {  /* time for a sample? */
+      size_t bytes = cast_sizet(g->allocrate - g->allocnext);
+      g->allocnext = g->allocrate;
+      (*g->allocsampler)(L, bytes);
+    }
+  }
+}
+
+
 /*
 ** Generic allocation routine.
 */
@@ -185,6 +234,8 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt = (g->GCdebt + nsize) - osize;
+  if (l_unlikely(accounting(g)) && nsize > osize)
+    accountalloc(L, nsize - osize);
   return newblock;
 }
 
@@ -210,6 +261,8 @@ void *luaM_malloc_ (lua_State *L, size_t size, int tag) {
         luaM_error(L);
     }
     g->GCdebt += size;
+    if (l_unlikely(accounting(g)))
+      accountalloc(L, size);
     return newblock;
   }
 }
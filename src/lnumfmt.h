@@ -0,0 +1,255 @@
+/*
+** $Id: lnumfmt.h $
+** Fast conversions between numbers and strings, shared by the core and
+** the string and json libraries
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lnumfmt_h
+#define lnumfmt_h
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "lua.h"
+
+
+/*
+** 'lnum_fmtg' writes a float as 'printf' would with the format "%.<p>g"
+** (for 'p' up to LNUM_MAXPREC), giving the same bytes. It scales the
+** number by a power of 10 that is exact as a double, so that its first
+** 'p' digits are the integer part of the result, and gets the exact
+** error of that scaling (with 'fma' or Dekker's product), so that it
+** can round that integer correctly, ties to even. When the power of 10
+** would not be exact (for numbers far from 1), it gives up (returning
+** -1) and the caller uses 'printf'.
+**
+** With 'exact', it also gives up when the result does not read back as
+** the same float. A result with LNUM_MAXPREC digits that reads back is
+** also the shortest numeral that does so, once its trailing zeros are
+** removed, as those numerals are farther apart than doubles.
+*/
+
+#define LNUM_MAXPREC	15
+
+
+/*
+** The fast path needs doubles evaluated as doubles (for exact errors,
+** so not with FLT_EVAL_METHOD 2, as in x87) and 64-bit integers for
+** the digits.
+*/
+#if !defined(LUA_NOFASTNUMFMT) && LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && \
+    defined(LLONG_MAX) && defined(FLT_EVAL_METHOD) && \
+    FLT_EVAL_METHOD >= 0 && FLT_EVAL_METHOD != 2
+#define LNUM_FASTFMT
+#endif
+
+
+/* maximum size of a result, for doubles */
+#define LNUM_MAXSIZE	32
+
+
+/*
+** Extract a usable precision from a format like "%.14g" (or return 0
+** if the format is not like that); works with constant folding.
+*/
+#define lnum_gprec(f)  \
+  ((sizeof(f) == 6 && (f)[0] == '%' && (f)[1] == '.' && (f)[4] == 'g' && \
+    (f)[2] >= '0' && (f)[2] <= '9' && (f)[3] >= '0' && (f)[3] <= '9') ? \
+       ((f)[2] - '0') * 10 + ((f)[3] - '0') : \
+   (sizeof(f) == 5 && (f)[0] == '%' && (f)[1] == '.' && (f)[3] == 'g' && \
+    (f)[2] >= '0' && (f)[2] <= '9') ? (f)[2] - '0' : 0)
+
+
+static const char lnum_digits2[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233"
+  "34353637383940414243444546474849505152535455565758596061626364656667"
+  "6869707172737475767778798081828384858687888990919293949596979899";
+
+
+/*
+** Write the decimal digits of 'u' ending just before 'end'; return
+** where they start.
+*/
+static char *lnum_utoa (char *end, lua_Unsigned u) {
+  while (u >= 100) {
+    const char *d = lnum_digits2 + (u % 100) * 2;
+    u /= 100;
+    *--end = d[1];
+    *--end = d[0];
+  }
+  if (u >= 10) {
+    const char *d = lnum_digits2 + u * 2;
+    *--end = d[1];
+    *--end = d[0];
+  }
+  else
+    *--end = (char)('0' + u);
+  return end;
+}
+
+
+/*
+** Write integer 'i' into 'buff' (with room for LNUM_MAXSIZE bytes), as
+** 'printf' would with LUA_INTEGER_FMT; return its length.
+*/
+static int lnum_fmtint (char *buff, lua_Integer i) {
+  char tmp[3 * sizeof(lua_Integer) + 2];
+  char *end = tmp + sizeof(tmp);
+  lua_Unsigned u = (i < 0) ? 0u - (lua_Unsigned)i : (lua_Unsigned)i;
+  char *s = lnum_utoa(end, u);
+  int len;
+  if (i < 0)
+    *--s = '-';
+  len = (int)(end - s);
+  memcpy(buff, s, (size_t)len);
+  buff[len] = '\0';
+  return len;
+}
+
+
+#if defined(LNUM_FASTFMT)	/* { */
+
+/* powers of 10 that are exact as doubles */
+static const double lnum_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+  1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define LNUM_MAXPOW10	22
+
+
+/* exact error of the product 'a * b', which rounded to 'ab' */
+static double lnum_mulerr (double a, double b, double ab) {
+#if defined(FP_FAST_FMA)
+  return fma(a, b, -ab);
+#else  /* Dekker's product (exact without contractions into 'fma') */
+  const double c = 134217729.0;  /* 2^27 + 1, to split in halves */
+  double t, ah, al, bh, bl;
+  t = c * a; ah = t - (t - a); al = a - ah;
+  t = c * b; bh = t - (t - b); bl = b - bh;
+  return ((ah * bh - ab) + ah * bl + al * bh) + al * bl;
+#endif
+}
+
+
+static int lnum_fmtg (char *buff, double x, int p, int exact, int point) {
+  char digits[LNUM_MAXPREC];
+  char *s = buff;
+  unsigned long long d;
+  double ax, t, r;
+  int e, e10, k, nd, tries;
+  if (p == 0) p = 1;  /* as in 'printf' */
+  if (p > LNUM_MAXPREC || !(x == x) || x == HUGE_VAL || x == -HUGE_VAL)
+    return -1;
+  if (x < 0 || (x == 0 && 1 / x < 0))  /* negative (or -0)? */
+    *s++ = '-';
+  ax = fabs(x);
+  if (ax == 0) {
+    *s++ = '0';
+    *s = '\0';
+    return (int)(s - buff);
+  }
+  (void)frexp(ax, &e);  /* 2^(e - 1) <= ax < 2^e */
+  e10 = (int)floor((e - 1) * 0.30102999566398119521);  /* log10(ax) */
+  for (tries = 0; ; tries++) {  /* 'e10' may be off by one */
+    if (tries == 3)
+      return -1;
+    k = p - 1 - e10;
+    if (k > LNUM_MAXPOW10 || k < -LNUM_MAXPOW10)
+      return -1;
+    t = (k >= 0) ? ax * lnum_pow10[k] : ax / lnum_pow10[-k];
+    if (t >= lnum_pow10[p])
+      e10++;
+    else if (t < lnum_pow10[p - 1] - 1)
+      e10--;
+    else {
+      double err, half;
+      if (k >= 0)  /* t + err == ax * 10^k */
+        err = lnum_mulerr(ax, lnum_pow10[k], t);
+      else {  /* err has the sign of ax - t * 10^-k */
+        double h = t * lnum_pow10[-k];
+        err = (ax - h) - lnum_mulerr(t, lnum_pow10[-k], h);
+      }
+      r = floor(t);
+      /* 'half' is exact unless far from a tie, and then larger than
+         the error, as both 't' and 0.5 are multiples of ulp(t) */
+      half = (t - r) - 0.5;
+      if (half > 0 ||
+          (half == 0 && (err > 0 ||
+                         (err == 0 && ((unsigned long long)r & 1)))))
+        r += 1;
+      if (r >= lnum_pow10[p]) {  /* rounded up to a new digit? */
+        r = lnum_pow10[p - 1];
+        e10++;
+        k--;
+        if (k < -LNUM_MAXPOW10)
+          return -1;
+      }
+      if (r >= lnum_pow10[p - 1])
+        break;
+      e10--;  /* it has less than 'p' digits */
+    }
+  }
+  if (exact && ((k >= 0) ? r / lnum_pow10[k] : r * lnum_pow10[-k]) != ax)
+    return -1;  /* does not read back as 'x' */
+  d = (unsigned long long)r;
+  for (nd = p; nd > 0; nd--) {  /* extract its 'p' digits */
+    digits[nd - 1] = (char)('0' + (int)(d % 10));
+    d /= 10;
+  }
+  nd = p;
+  while (nd > 1 && digits[nd - 1] == '0')  /* remove trailing zeros */
+    nd--;
+  if (e10 < -4 || e10 >= p) {  /* exponential notation? */
+    int ae = (e10 < 0) ? -e10 : e10;
+    *s++ = digits[0];
+    if (nd > 1) {
+      *s++ = (char)point;
+      memcpy(s, digits + 1, (size_t)(nd - 1));
+      s += nd - 1;
+    }
+    *s++ = 'e';
+    *s++ = (e10 < 0) ? '-' : '+';
+    if (ae >= 100)
+      *s++ = (char)('0' + ae / 100);
+    *s++ = (char)('0' + ae / 10 % 10);
+    *s++ = (char)('0' + ae % 10);
+  }
+  else if (e10 >= 0) {  /* integer part has 'e10 + 1' digits */
+    int ni = e10 + 1;
+    if (nd <= ni) {
+      memcpy(s, digits, (size_t)nd);
+      memset(s + nd, '0', (size_t)(ni - nd));
+      s += ni;
+    }
+    else {
+      memcpy(s, digits, (size_t)ni);
+      s += ni;
+      *s++ = (char)point;
+      memcpy(s, digits + ni, (size_t)(nd - ni));
+      s += nd - ni;
+    }
+  }
+  else {  /* 0.000ddd */
+    *s++ = '0';
+    *s++ = (char)point;
+    memset(s, '0', (size_t)(-e10 - 1));
+    s += -e10 - 1;
+    memcpy(s, digits, (size_t)nd);
+    s += nd;
+  }
+  *s = '\0';
+  return (int)(s - buff);
+}
+
+#else				/* }{ */
+
+#define lnum_fmtg(buff,x,p,exact,point)	\
+	((void)(buff), (void)(x), (void)(p), (void)(exact), (void)(point), -1)
+
+#endif				/* } */
+
+#endif
@@ -14,6 +14,7 @@
 #include "lprefix.h"
 
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -268,6 +269,22 @@ static lua_CFunction lsys_sym (lua_State *L, void *lib, const char *sym) {
 #define LUA_CPATH_VAR   "LUA_CPATH"
 #endif
 
+/*
+** LUA_BUNDLE_VAR is the name of the environment variable that Lua
+** checks to set 'package.bundle'.
+*/
+#if !defined(LUA_BUNDLE_VAR)
+#define LUA_BUNDLE_VAR  "LUA_BUNDLE"
+#endif
+
+/*
+** LUA_CACHEDIR_VAR is the name of the environment variable that Lua
+** checks to set 'package.cachedir'.
+*/
+#if !defined(LUA_CACHEDIR_VAR)
+#define LUA_CACHEDIR_VAR  "LUA_CACHEDIR"
+#endif
+
 
 
 /*
@@ -282,6 +299,31 @@ static int noenv (lua_State *L) {
 }
 
 
+/*
+** Set 'package.bundle' from the environment variable LUA_BUNDLE_VAR
+*/
+static void setbundle (lua_State *L) {
+  const char *bundle = getenv(LUA_BUNDLE_VAR);
+  if (bundle != NULL && !noenv(L)) {
+    lua_pushstring(L, bundle);
+    lua_setfield(L, -2, "bundle");
+  }
+}
+
+
+/*
+** Set 'package.cachedir' (used by 'luaL_loadfilex') from the
+** environment variable LUA_CACHEDIR_VAR
+*/
+static void setcachedir (lua_State *L) {
+  const char *dir = getenv(LUA_CACHEDIR_VAR);
+  if (dir != NULL && !noenv(L)) {
+    lua_pushstring(L, dir);
+    lua_setfield(L, -2, "cachedir");
+  }
+}
+
+
 /*
 ** Set a path
 */
@@ -422,9 +464,27 @@ static int ll_loadlib (lua_State *L) {
 */
 
 
-static int readable (const char *filename) {
-  FILE *f = fopen(filename, "r");  /* try to open file */
-  if (f == NULL) return 0;  /* open failed */
+/*
+** Check whether file 'filename' exists and is readable. If 'cache' is
+** not zero, it is the index of a table with the names of the files
+** that could not be opened before, which are not tried again.
+*/
+static int readable (lua_State *L, const char *filename, int cache) {
+  FILE *f;
+  if (cache != 0) {
+    int notfound = (lua_getfield(L, cache, filename) != LUA_TNIL);
+    lua_pop(L, 1);
+    if (notfound)
+      return 0;
+  }
+  f = fopen(filename, "r");  /* try to open file */
+  if (f == NULL) {  /* open failed */
+    if (cache != 0) {
+      lua_pushboolean(L, 0);
+      lua_setfield(L, cache, filename);  /* cache[filename] = false */
+    }
+    return 0;
+  }
   fclose(f);
   return 1;
 }
@@ -472,7 +532,8 @@ static void pusherrornotfound (lua_State *L, const char *path) {
 static const char *searchpath (lua_State *L, const char *name,
                                              const char *path,
                                              const char *sep,
-                                             const char *dirsep) {
+                                             const char *dirsep,
+                                             int cache) {
   luaL_Buffer buff;
   char *pathname;  /* path with name inserted */
   char *endpathname;  /* its end */
@@ -487,7 +548,7 @@ static const char *searchpath (lua_State *L, const char *name,
   pathname = luaL_buffaddr(&buff);  /* writable list of file names */
   endpathname = pathname + luaL_bufflen(&buff) - 1;
   while ((filename = getnextfilename(&pathname, endpathname)) != NULL) {
-    if (readable(filename))  /* does file exist and is readable? */
+    if (readable(L, filename, cache))  /* does file exist and is readable? */
       return lua_pushstring(L, filename);  /* save and return name */
   }
   luaL_pushresult(&buff);  /* push path to create error message */
@@ -500,7 +561,7 @@ static int ll_searchpath (lua_State *L) {
   const char *f = searchpath(L, luaL_checkstring(L, 1),
                                 luaL_checkstring(L, 2),
                                 luaL_optstring(L, 3, "."),
-                                luaL_optstring(L, 4, LUA_DIRSEP));
+                                luaL_optstring(L, 4, LUA_DIRSEP), 0);
   if (f != NULL) return 1;
   else {  /* error message is on top of the stack */
     luaL_pushfail(L);
@@ -510,15 +571,22 @@ static int ll_searchpath (lua_State *L) {
 }
 
 
+/*
+** Search 'name' in the path 'package[pname]', skipping the files
+** listed in 'package.pathcache' (when it is a table).
+*/
 static const char *findfile (lua_State *L, const char *name,
                                            const char *pname,
                                            const char *dirsep) {
   const char *path;
+  int cache = 0;
   lua_getfield(L, lua_upvalueindex(1), pname);
   path = lua_tostring(L, -1);
   if (l_unlikely(path == NULL))
     luaL_error(L, "'package.%s' must be a string", pname);
-  return searchpath(L, name, path, ".", dirsep);
+  if (lua_getfield(L, lua_upvalueindex(1), "pathcache") == LUA_TTABLE)
+    cache = lua_gettop(L);
+  return searchpath(L, name, path, ".", dirsep, cache);
 }
 
 
@@ -612,6 +680,336 @@ static int searcher_preload (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Bundles
+** =======================================================
+*/
+
+/*
+** A bundle is a single file with the chunks of several modules, so
+** that they can be loaded with one open and no search through the
+** path. It starts with BUNDLE_SIGNATURE and the number of modules,
+** followed by an index with, for each module, the size of its name,
+** the name, and the offset and size of its chunk in the file. The
+** chunks come after the index. All numbers are 4-byte little-endian
+** integers.
+*/
+#define BUNDLE_SIGNATURE	"\x1b" "Bdl"
+
+/* size of the numbers in a bundle */
+#define BUNDLE_INTSIZE		4
+
+
+/*
+** key for table in the registry that keeps the bundles already opened
+** (or the message explaining why they could not be opened)
+*/
+static const char *const BUNDLES = "_BUNDLES";
+
+
+typedef struct Bundle {
+  const char *data;  /* contents of the bundle file */
+  size_t size;
+  int mapped;  /* true iff 'data' is a memory map of the file */
+} Bundle;
+
+
+#if defined(LUA_USE_POSIX)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* map the contents of file 'f' into memory */
+static int mapbundle (Bundle *b, FILE *f) {
+  struct stat st;
+  void *p;
+  if (fstat(fileno(f), &st) != 0 || st.st_size <= 0)
+    return 0;
+  p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (p == MAP_FAILED)
+    return 0;
+  b->data = (const char *)p;
+  b->size = (size_t)st.st_size;
+  b->mapped = 1;
+  return 1;
+}
+
+#define unmapbundle(b)	munmap((void *)(b)->data, (b)->size)
+
+#else
+
+#define mapbundle(b,f)	((void)(b), (void)(f), 0)
+#define unmapbundle(b)	((void)0)
+
+#endif
+
+
+static int gcbundle (lua_State *L) {
+  Bundle *b = (Bundle *)lua_touserdata(L, 1);
+  if (b->mapped) {
+    unmapbundle(b);
+    b->mapped = 0;
+  }
+  return 0;
+}
+
+
+static lua_Unsigned bundleint (const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  return (lua_Unsigned)u[0] | ((lua_Unsigned)u[1] << 8) |
+         ((lua_Unsigned)u[2] << 16) | ((lua_Unsigned)u[3] << 24);
+}
+
+
+/*
+** Build the index of bundle 'b' (at the top of the stack) as a table
+** mapping each module name to the position of its offset in the
+** index, and keep it as the first user value of the bundle. Return
+** false if the bundle is malformed.
+*/
+static int indexbundle (lua_State *L, Bundle *b) {
+  size_t pos = sizeof(BUNDLE_SIGNATURE) - 1;
+  lua_Unsigned n, i;
+  if (b->size < pos + BUNDLE_INTSIZE ||
+      memcmp(b->data, BUNDLE_SIGNATURE, pos) != 0)
+    return 0;
+  n = bundleint(b->data + pos);
+  pos += BUNDLE_INTSIZE;
+  if (n > (b->size - pos) / (3 * BUNDLE_INTSIZE) || n > INT_MAX)
+    return 0;
+  lua_createtable(L, 0, (int)n);
+  for (i = 0; i < n; i++) {
+    lua_Unsigned l, offset, size;
+    if (b->size - pos < BUNDLE_INTSIZE)
+      return 0;
+    l = bundleint(b->data + pos);
+    pos += BUNDLE_INTSIZE;
+    if ((b->size - pos) / 2 < BUNDLE_INTSIZE ||
+        l > b->size - pos - 2 * BUNDLE_INTSIZE)
+      return 0;
+    lua_pushlstring(L, b->data + pos, (size_t)l);
+    pos += (size_t)l;
+    offset = bundleint(b->data + pos);
+    size = bundleint(b->data + pos + BUNDLE_INTSIZE);
+    if (offset > b->size || size > b->size - offset)
+      return 0;
+    lua_pushinteger(L, (lua_Integer)pos);
+    lua_rawset(L, -3);
+    pos += 2 * BUNDLE_INTSIZE;
+  }
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+
+/*
+** Open the bundle in file 'filename', pushing it; in case of errors,
+** push an error message instead.
+*/
+static void openbundle (lua_State *L, const char *filename) {
+  Bundle *b = (Bundle *)lua_newuserdatauv(L, sizeof(Bundle), 2);
+  int ud = lua_gettop(L);
+  FILE *f;
+  b->data = NULL;
+  b->size = 0;
+  b->mapped = 0;
+  if (luaL_newmetatable(L, BUNDLES)) {
+    lua_pushcfunction(L, gcbundle);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  f = fopen(filename, "rb");
+  if (f == NULL) {
+    lua_pushfstring(L, "cannot open bundle '%s'", filename);
+    return;
+  }
+  if (!mapbundle(b, f)) {  /* read the whole file into a string */
+    luaL_Buffer buff;
+    size_t nr;
+    luaL_buffinit(L, &buff);
+    do {
+      char *p = luaL_prepbuffer(&buff);
+      nr = fread(p, sizeof(char), LUAL_BUFFERSIZE, f);
+      luaL_addsize(&buff, nr);
+    } while (nr == LUAL_BUFFERSIZE);
+    luaL_pushresult(&buff);
+    b->data = lua_tolstring(L, -1, &b->size);
+    lua_setiuservalue(L, -2, 2);  /* keep the string with the bundle */
+  }
+  if (ferror(f)) {
+    fclose(f);
+    lua_pushfstring(L, "cannot read bundle '%s'", filename);
+    return;
+  }
+  fclose(f);
+  if (!indexbundle(L, b)) {
+    lua_settop(L, ud);  /* remove incomplete index */
+    lua_pushfstring(L, "malformed bundle '%s'", filename);
+  }
+}
+
+
+/*
+** Push the bundle in file 'filename' (or the error message saying why
+** it could not be opened), opening it only once in each state.
+*/
+static void getbundle (lua_State *L, const char *filename) {
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, BUNDLES);
+  if (lua_getfield(L, -1, filename) == LUA_TNIL) {  /* not opened yet? */
+    int top;
+    lua_pop(L, 1);
+    top = lua_gettop(L);
+    openbundle(L, filename);
+    if (lua_isstring(L, -1))  /* error? */
+      lua_replace(L, top + 1);  /* keep only the message */
+    lua_settop(L, top + 1);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -3, filename);  /* BUNDLES[filename] = result */
+  }
+  lua_remove(L, -2);  /* remove BUNDLES table */
+}
+
+
+static int searcher_bundle (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const char *filename;
+  Bundle *b;
+  size_t pos;
+  if (lua_getfield(L, lua_upvalueindex(1), "bundle") == LUA_TNIL)
+    return 0;  /* no bundle */
+  filename = lua_tostring(L, -1);
+  if (l_unlikely(filename == NULL))
+    luaL_error(L, "'package.bundle' must be a string");
+  getbundle(L, filename);
+  if (lua_isstring(L, -1))  /* bundle could not be opened? */
+    return 1;  /* error message is the result */
+  b = (Bundle *)lua_touserdata(L, -1);
+  lua_getiuservalue(L, -1, 1);  /* get index */
+  if (lua_getfield(L, -1, name) != LUA_TNUMBER) {
+    lua_pushfstring(L, "no module '%s' in bundle '%s'", name, filename);
+    return 1;
+  }
+  pos = (size_t)lua_tointeger(L, -1);
+  lua_pushfstring(L, "@%s", name);
+  return checkload(L, (luaL_loadbuffer(L,
+                         b->data + bundleint(b->data + pos),
+                         (size_t)bundleint(b->data + pos + BUNDLE_INTSIZE),
+                         lua_tostring(L, -1)) == LUA_OK), filename);
+}
+
+
+static void writebundleint (FILE *f, lua_Unsigned x) {
+  char p[BUNDLE_INTSIZE];
+  int i;
+  for (i = 0; i < BUNDLE_INTSIZE; i++) {
+    p[i] = (char)(x & 0xff);
+    x >>= 8;
+  }
+  fwrite(p, 1, BUNDLE_INTSIZE, f);
+}
+
+
+/*
+** Write the index of a bundle with the 'n' modules named in the
+** table at index 2, whose chunk offsets and sizes are in 'pos' (zeros
+** in a first pass, as they are not known yet).
+*/
+static void writebundleindex (lua_State *L, FILE *f, lua_Integer n,
+                              const lua_Unsigned *pos) {
+  lua_Integer i;
+  fwrite(BUNDLE_SIGNATURE, 1, sizeof(BUNDLE_SIGNATURE) - 1, f);
+  writebundleint(f, (lua_Unsigned)n);
+  for (i = 1; i <= n; i++) {
+    size_t l;
+    const char *name;
+    lua_geti(L, 2, i);
+    name = lua_tolstring(L, -1, &l);
+    writebundleint(f, (lua_Unsigned)l);
+    fwrite(name, 1, l, f);
+    writebundleint(f, pos[2 * (i - 1)]);
+    writebundleint(f, pos[2 * (i - 1) + 1]);
+    lua_pop(L, 1);
+  }
+}
+
+
+static int bundlewriter (lua_State *L, const void *p, size_t size,
+                                       void *f) {
+  (void)L;
+  return (size != 0 && fwrite(p, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** package.makebundle(filename, modules [, strip]): write into file
+** 'filename' a bundle with the modules named in the sequence
+** 'modules', each one found through 'package.path' and precompiled.
+*/
+static int ll_makebundle (lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  int strip = lua_toboolean(L, 3);
+  const char *path;
+  lua_Unsigned *pos;
+  lua_Integer n, i;
+  FILE *f;
+  int ok;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  n = luaL_len(L, 2);
+  luaL_argcheck(L, 0 <= n && n <= INT_MAX / 2, 2, "too many modules");
+  lua_settop(L, 3);
+  lua_getfield(L, lua_upvalueindex(1), "path");
+  path = lua_tostring(L, 4);
+  if (l_unlikely(path == NULL))
+    luaL_error(L, "'package.path' must be a string");
+  lua_createtable(L, (int)n, 0);  /* 5: loaded chunks */
+  for (i = 1; i <= n; i++) {  /* find and load all modules */
+    const char *fname;
+    const char *name;
+    lua_geti(L, 2, i);
+    name = lua_tostring(L, -1);
+    if (l_unlikely(name == NULL))
+      luaL_error(L, "module names must be strings");
+    fname = searchpath(L, name, path, ".", LUA_LSUBSEP, 0);
+    if (fname == NULL)
+      luaL_error(L, "module '%s' not found:\n\t%s", name, lua_tostring(L, -1));
+    if (luaL_loadfile(L, fname) != LUA_OK)
+      lua_error(L);
+    lua_rawseti(L, 5, i);
+    lua_settop(L, 5);
+  }
+  pos = (lua_Unsigned *)lua_newuserdatauv(L,
+                             (size_t)(2 * n) * sizeof(lua_Unsigned), 0);
+  memset(pos, 0, (size_t)(2 * n) * sizeof(lua_Unsigned));
+  f = fopen(filename, "wb");
+  if (f == NULL)
+    return luaL_fileresult(L, 0, filename);
+  writebundleindex(L, f, n, pos);  /* placeholder for the index */
+  ok = 1;
+  for (i = 0; ok && i < n; i++) {
+    long start = ftell(f);
+    lua_rawgeti(L, 5, i + 1);
+    ok = (lua_dump(L, bundlewriter, f, strip) == 0 && start >= 0);
+    lua_pop(L, 1);
+    pos[2 * i] = (lua_Unsigned)start;
+    pos[2 * i + 1] = (lua_Unsigned)(ftell(f) - start);
+    /* positions must fit in the index */
+    ok = ok && pos[2 * i] + pos[2 * i + 1] <= 0xffffffffu;
+  }
+  if (ok && fseek(f, 0, SEEK_SET) == 0)
+    writebundleindex(L, f, n, pos);  /* now with the actual positions */
+  ok = ok && !ferror(f);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok)
+    remove(filename);
+  return luaL_fileresult(L, ok, filename);
+}
+
+/* }====================================================== */
+
+
 static void findloader (lua_State *L, const char *name) {
   int i;
   luaL_Buffer msg;  /* to build error message */
@@ -683,6 +1081,8 @@ static const luaL_Reg pk_funcs[] = {
   {"loadlib", ll_loadlib},
   {"searchpath", ll_searchpath},
   /* placeholders */
+  {"makebundle", NULL},
+  {"pathcache", NULL},
   {"preload", NULL},
   {"cpath", NULL},
   {"path", NULL},
@@ -701,6 +1101,7 @@ static const luaL_Reg ll_funcs[] = {
 static void createsearcherstable (lua_State *L) {
   static const lua_CFunction searchers[] = {
     searcher_preload,
+    searcher_bundle,
     searcher_Lua,
     searcher_C,
     searcher_Croot,
@@ -739,6 +1140,14 @@ LUAMOD_API int luaopen_package (lua_State *L) {
   /* set paths */
   setpath(L, "path", LUA_PATH_VAR, LUA_PATH_DEFAULT);
   setpath(L, "cpath", LUA_CPATH_VAR, LUA_CPATH_DEFAULT);
+  setbundle(L);
+  setcachedir(L);
+  /* set cache of files not found and bundle maker */
+  lua_newtable(L);
+  lua_setfield(L, -2, "pathcache");
+  lua_pushvalue(L, -1);
+  lua_pushcclosure(L, ll_makebundle, 1);
+  lua_setfield(L, -2, "makebundle");
   /* store config information */
   lua_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
                      LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
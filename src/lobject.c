@@ -23,6 +23,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lmem.h"
+#include "lnumfmt.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -235,6 +236,79 @@ static const char *l_str2dloc (const char *s, lua_Number *result, int mode) {
 }
 
 
+#if defined(LNUM_FASTFMT)
+
+/* add a digit to the significand, giving up past 19 digits */
+#define addsigdigit(w,nd,c)  \
+  { if ((nd) > 0 || (c) != '0') { \
+      if ((nd)++ == 19) return NULL; \
+      (w) = (w) * 10 + cast_uint((c) - '0'); } }
+
+/*
+** Fast path for decimal floats (Clinger's): when the significand has
+** at most 19 digits and is exact as a float, and the power of 10 is
+** exact too, one multiplication or division rounds the result
+** correctly. It returns NULL for anything else (hexadecimals, 'inf',
+** malformed numerals, too many digits, etc.), which then goes to
+** 'lua_str2number'.
+*/
+static const char *l_str2dfast (const char *s, lua_Number *result) {
+  unsigned long long w = 0;  /* significand */
+  int nd = 0;  /* number of digits in 'w' */
+  int e10 = 0;  /* decimal exponent */
+  int any = 0;  /* read any digit? */
+  int neg;
+  double x;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (; lisdigit(cast_uchar(*s)); s++, any = 1)
+    addsigdigit(w, nd, *s);
+  if (*s == '.') {
+    for (s++; lisdigit(cast_uchar(*s)); s++, any = 1) {
+      addsigdigit(w, nd, *s);
+      if (e10-- < -L_MAXLENNUM) return NULL;
+    }
+  }
+  if (!any) return NULL;
+  if (*s == 'e' || *s == 'E') {
+    int ex = 0;
+    int eneg;
+    s++;
+    eneg = isneg(&s);
+    if (!lisdigit(cast_uchar(*s))) return NULL;
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (ex >= L_MAXLENNUM) return NULL;
+      ex = ex * 10 + (*s - '0');
+    }
+    e10 += (eneg) ? -ex : ex;
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0') return NULL;
+  if (w > ((unsigned long long)1 << 53))  /* not exact as a float? */
+    return NULL;
+  x = (double)w;
+  if (w == 0)
+    e10 = 0;  /* any exponent gives zero */
+  if (e10 < 0) {
+    if (e10 < -LNUM_MAXPOW10) return NULL;
+    x /= lnum_pow10[-e10];
+  }
+  else if (e10 > 0) {
+    if (e10 > LNUM_MAXPOW10) {  /* try to move some zeros into 'x' */
+      if (e10 > LNUM_MAXPOW10 + 15) return NULL;
+      x *= lnum_pow10[e10 - LNUM_MAXPOW10];
+      if (x > 9007199254740992.0) return NULL;  /* past 2^53? */
+      e10 = LNUM_MAXPOW10;
+    }
+    x *= lnum_pow10[e10];
+  }
+  *result = (neg) ? -x : x;
+  return s;
+}
+
+#endif
+
+
 /*
 ** Convert string 's' to a Lua number (put in 'result') handling the
 ** current locale.
@@ -250,8 +324,14 @@ static const char *l_str2dloc (const char *s, lua_Number *result, int mode) {
 */
 static const char *l_str2d (const char *s, lua_Number *result) {
   const char *endptr;
-  const char *pmode = strpbrk(s, ".xXnN");  /* look for special chars */
-  int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
+  const char *pmode;
+  int mode;
+#if defined(LNUM_FASTFMT)
+  if ((endptr = l_str2dfast(s, result)) != NULL)
+    return endptr;
+#endif
+  pmode = strpbrk(s, ".xXnN");  /* look for special chars */
+  mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
@@ -338,27 +418,62 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 }
 
 
+#if defined(LUA_NUMBER_SHORTEST)
+/* convert float 'n' with 'p' significant digits */
+static int fmtdigits (char *buff, lua_Number n, int p) {
+  char fmt[16];
+  l_sprintf(fmt, sizeof(fmt), "%%.%d" LUA_NUMBER_FRMLEN "g", p);
+  return l_sprintf(buff, MAXNUMBER2STR, fmt, (LUAI_UACNUMBER)n);
+}
+#endif
+
+
 /*
-** Maximum length of the conversion of a number to a string. Must be
-** enough to accommodate both LUA_INTEGER_FMT and LUA_NUMBER_FMT.
-** (For a long long int, this is 19 digits plus a sign and a final '\0',
-** adding to 21. For a long double, it can go to a sign, 33 digits,
-** the dot, an exponent letter, an exponent sign, 5 exponent digits,
-** and a final '\0', adding to 43.)
+** Convert a float to a string with LUA_NUMBER_FMT or, with option
+** LUA_NUMBER_SHORTEST, as the shortest numeral that reads back as the
+** same float. Both try the fast formatter first (see 'lnumfmt.h').
 */
-#define MAXNUMBER2STR	44
+static int tostringflt (char *buff, lua_Number n) {
+  int len;
+#if defined(LUA_NUMBER_SHORTEST)
+  len = lnum_fmtg(buff, n, LNUM_MAXPREC, 1, lua_getlocaledecpoint());
+  if (len < 0) {  /* search the number of digits with 'printf' */
+    int lo = 1;  /* fewest digits that may read back */
+    int hi = cast_int(l_floatatt(MANT_DIG) * 0.30103) + 2;  /* enough */
+    while (lo < hi) {  /* more digits never make it worse */
+      int p = (lo + hi) / 2;
+      if (fmtdigits(buff, n, p) > 0 && lua_str2number(buff, NULL) == n)
+        hi = p;
+      else
+        lo = p + 1;
+    }
+    len = fmtdigits(buff, n, lo);
+  }
+#else
+  len = lnum_fmtg(buff, n, lnum_gprec(LUA_NUMBER_FMT), 0,
+                  lua_getlocaledecpoint());
+  if (len < 0)  /* fast formatter could not do it? */
+    len = lua_number2str(buff, MAXNUMBER2STR, n);
+#endif
+  return len;
+}
 
 
 /*
 ** Convert a number object to a string, adding it to a buffer
+** (which must have at least MAXNUMBER2STR bytes)
 */
-static int tostringbuff (TValue *obj, char *buff) {
+int luaO_tostringbuff (const TValue *obj, char *buff) {
   int len;
   lua_assert(ttisnumber(obj));
   if (ttisinteger(obj))
+#if !defined(LUA_NOFASTNUMFMT)
+    len = lnum_fmtint(buff, ivalue(obj));
+#else
     len = lua_integer2str(buff, MAXNUMBER2STR, ivalue(obj));
+#endif
   else {
-    len = lua_number2str(buff, MAXNUMBER2STR, fltvalue(obj));
+    len = tostringflt(buff, fltvalue(obj));
     if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
       buff[len++] = lua_getlocaledecpoint();
       buff[len++] = '0';  /* adds '.0' to result */
@@ -373,7 +488,7 @@ static int tostringbuff (TValue *obj, char *buff) {
 */
 void luaO_tostring (lua_State *L, TValue *obj) {
   char buff[MAXNUMBER2STR];
-  int len = tostringbuff(obj, buff);
+  int len = luaO_tostringbuff(obj, buff);
   setsvalue(L, obj, luaS_newlstr(L, buff, len));
 }
 
@@ -468,7 +583,7 @@ static void addstr2buff (BuffFS *buff, const char *str, size_t slen) {
 */
 static void addnum2buff (BuffFS *buff, TValue *num) {
   char *numbuff = getbuff(buff, MAXNUMBER2STR);
-  int len = tostringbuff(num, numbuff);  /* format number into 'numbuff' */
+  int len = luaO_tostringbuff(num, numbuff);  /* format number into 'numbuff' */
   addsize(buff, len);
 }
 
@@ -143,13 +143,16 @@ typedef struct TValue {
 ** used when the distance between two tbc variables does not fit
 ** in an unsigned short. They are represented by delta==0, and
 ** their real delta is always the maximum value that fits in
-** that field.
+** that field. Field 'nargs' is zero for a to-be-closed variable;
+** for a deferred call, the function is in the entry itself, followed
+** by 'nargs' - 1 arguments.
 */
 typedef union StackValue {
   TValue val;
   struct {
     TValuefields;
     unsigned short delta;
+    unsigned short nargs;
   } tbclist;
 } StackValue;
 
@@ -396,13 +399,37 @@ typedef struct TString {
 } TString;
 
 
+/*
+** A long string may be a slice of another one: instead of contents, it
+** has a pointer into the contents of that string, its 'parent', which
+** it keeps alive. A slice is not '\0'-terminated; 'luaS_termslice'
+** gives it its own terminated copy of the contents (with no parent).
+*/
+typedef struct Slice {
+  char *s;  /* contents */
+  TString *parent;  /* string with the contents, or NULL if own copy */
+} Slice;
+
+
+/* bit in 'extra' marking slices (above the indices of reserved words) */
+#define STRSLICE	0x80
+
+#define isslice(ts)	((ts)->extra & STRSLICE)
+#define slicedata(ts)	check_exp(isslice(ts), (Slice *)(void *)(ts)->contents)
+
+/* a function, so that 'getstr' evaluates its argument only once */
+l_sinline char *strcontents (TString *ts) {
+  return luai_unlikely(isslice(ts)) ? slicedata(ts)->s : ts->contents;
+}
+
+
 
 /*
 ** Get the actual string (array of bytes) from a 'TString'. (Generic
 ** version and specialized versions for long and short strings.)
 */
-#define getstr(ts)	((ts)->contents)
-#define getlngstr(ts)	check_exp((ts)->shrlen == 0xFF, (ts)->contents)
+#define getstr(ts)	strcontents(cast(TString *, (ts)))
+#define getlngstr(ts)	check_exp((ts)->shrlen == 0xFF, getstr(ts))
 #define getshrstr(ts)	check_exp((ts)->shrlen != 0xFF, (ts)->contents)
 
 
@@ -426,9 +453,16 @@ typedef struct TString {
 */
 #define LUA_VLIGHTUSERDATA	makevariant(LUA_TLIGHTUSERDATA, 0)
 
+/*
+** Private variant for the cursors of 'pairs' loops (see 'setcursor' in
+** lvm.c); Lua code and the API never see values with this tag.
+*/
+#define LUA_VCURSOR		makevariant(LUA_TLIGHTUSERDATA, 1)
+
 #define LUA_VUSERDATA		makevariant(LUA_TUSERDATA, 0)
 
 #define ttislightuserdata(o)	checktag((o), LUA_VLIGHTUSERDATA)
+#define ttiscursor(o)		checktag((o), LUA_VCURSOR)
 #define ttisfulluserdata(o)	checktag((o), ctb(LUA_VUSERDATA))
 
 #define pvalue(o)	check_exp(ttislightuserdata(o), val_(o).p)
@@ -484,6 +518,26 @@ typedef struct Udata0 {
 } Udata0;
 
 
+/*
+** Typed arrays are full userdata with no user values whose metatable
+** is 'G(L)->tamt' (registry[LUA_RIDX_TYPEDARRAY]). Their memory block
+** is a 'TArray' header followed by 'n' unboxed elements of the given
+** kind, which the VM reads and writes directly (see 'arrayget' in lvm.c).
+*/
+typedef struct TArray {
+  size_t n;  /* number of elements */
+  int kind;  /* LUA_TAF64, LUA_TAI64, or LUA_TAI32 */
+} TArray;
+
+/* size of each element of a typed array of the given kind */
+#define tasize(k)  \
+	((k) == LUA_TAF64 ? sizeof(lua_Number) : \
+	 (k) == LUA_TAI64 ? sizeof(lua_Integer) : sizeof(l_int32))
+
+/* elements of a typed array */
+#define tadata(ta)	cast_voidp((ta) + 1)
+
+
 /* compute the offset of the memory area of a userdata */
 #define udatamemoffset(nuv) \
 	((nuv) == 0 ? offsetof(Udata0, bindata)  \
@@ -544,6 +598,26 @@ typedef struct AbsLineInfo {
   int line;
 } AbsLineInfo;
 
+
+/*
+** Jump table of a 'switch' statement (see OP_SWITCH). Each case has a
+** constant of the function and the position of its code; 'h' maps the
+** constants to their positions, and it is built from the cases when
+** the function is compiled or, for loaded functions, when the switch
+** first runs.
+*/
+typedef struct SwitchCase {
+  int k;  /* index of the constant in 'k' */
+  int pc;  /* position of the code of the case */
+} SwitchCase;
+
+typedef struct SwitchTable {
+  struct Table *h;  /* map from constants to positions (or NULL) */
+  SwitchCase *cases;
+  int ncases;  /* number of cases in 'cases' */
+  int sizecases;  /* size of 'cases' */
+} SwitchTable;
+
 /*
 ** Function Prototypes
 */
@@ -559,18 +633,30 @@ typedef struct Proto {
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int sizeabslineinfo;  /* size of 'abslineinfo' */
+  int sizeswtabs;  /* size of 'swtabs' */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  unsigned int *icache;  /* inline caches for field accesses (or NULL) */
+  lu_byte *coverage;  /* instructions run under coverage (or NULL) */
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
+  SwitchTable *swtabs;  /* jump tables of 'switch' statements */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
+  char *kblob;  /* scrambled string constants not decoded yet (or NULL) */
+  size_t sizekblob;  /* size of 'kblob' */
+  const char *lazy;  /* dump of a function not decoded yet (or NULL) */
+  size_t sizelazy;  /* size of 'lazy' */
+  struct Proto *pool;  /* strings shared by the functions of a dump (or NULL) */
   lu_byte is_encrypted;
+  lu_byte is_fixed;  /* 'code', 'lineinfo' and 'lazy' live in a fixed buffer */
+  lu_byte cachemiss;  /* number of misses of 'cache' */
+  struct LClosure *cache;  /* last-created closure with this prototype */
 } Proto;
 
 /* }================================================================== */
@@ -589,10 +675,12 @@ typedef struct Proto {
 #define LUA_VLCL	makevariant(LUA_TFUNCTION, 0)  /* Lua closure */
 #define LUA_VLCF	makevariant(LUA_TFUNCTION, 1)  /* light C function */
 #define LUA_VCCL	makevariant(LUA_TFUNCTION, 2)  /* C closure */
+#define LUA_VFCF	makevariant(LUA_TFUNCTION, 3)  /* fast light C function */
 
 #define ttisfunction(o)		checktype(o, LUA_TFUNCTION)
 #define ttisLclosure(o)		checktag((o), ctb(LUA_VLCL))
-#define ttislcf(o)		checktag((o), LUA_VLCF)
+#define ttislcf(o)		(checktag((o), LUA_VLCF) || ttisfcf(o))
+#define ttisfcf(o)		checktag((o), LUA_VFCF)
 #define ttisCclosure(o)		checktag((o), ctb(LUA_VCCL))
 #define ttisclosure(o)         (ttisLclosure(o) || ttisCclosure(o))
 
@@ -616,6 +704,9 @@ typedef struct Proto {
 #define setfvalue(obj,x) \
   { TValue *io=(obj); val_(io).f=(x); settt_(io, LUA_VLCF); }
 
+#define setfcfvalue(obj,x) \
+  { TValue *io=(obj); val_(io).f=(x); settt_(io, LUA_VFCF); }
+
 #define setclCvalue(L,obj,x) \
   { TValue *io = (obj); CClosure *x_ = (x); \
     val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VCCL)); \
@@ -735,6 +826,14 @@ typedef union Node {
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
 
+/*
+** Bit 6 of 'flags' marks a table that took part in a cached '__index'
+** lookup (see 'luaV_finishget'); any change to such a table
+** invalidates the lookup cache (see 'luaH_changed').
+*/
+#define BITLOOKUP		(1 << 6)
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -795,6 +894,16 @@ typedef struct Table {
 /* size of buffer for 'luaO_utf8esc' function */
 #define UTF8BUFFSZ	8
 
+/*
+** Maximum length of the conversion of a number to a string. Must be
+** enough to accommodate both LUA_INTEGER_FMT and LUA_NUMBER_FMT.
+** (For a long long int, this is 19 digits plus a sign and a final '\0',
+** adding to 21. For a long double, it can go to a sign, 33 digits,
+** the dot, an exponent letter, an exponent sign, 5 exponent digits,
+** and a final '\0', adding to 43.)
+*/
+#define MAXNUMBER2STR	44
+
 LUAI_FUNC int luaO_utf8esc (char *buff, unsigned long x);
 LUAI_FUNC int luaO_ceillog2 (unsigned int x);
 LUAI_FUNC int luaO_rawarith (lua_State *L, int op, const TValue *p1,
@@ -803,6 +912,7 @@ LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, StkId res);
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
+LUAI_FUNC int luaO_tostringbuff (const TValue *obj, char *buff);
 LUAI_FUNC void luaO_tostring (lua_State *L, TValue *obj);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
@@ -10,7 +10,12 @@
 #include "lprefix.h"
 
 
+#include <string.h>
+
 #include "lopcodes.h"
+#include "lobject.h"
+#include "lfunc.h"
+#include "lstate.h"
 
 
 /* ORDER OP */
@@ -100,6 +105,323 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
- ,opmode(0, 1, 1, 0, 1, iABC)		/* OP_2Q */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_2Q */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_FSTRING */
+ ,opmode(0, 0, 0, 0, 0, iABx)		/* OP_SWITCH */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUPF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETFIELDC */
+ ,opmode(0, 1, 1, 0, 1, iABC)		/* OP_CALLFLOOR */
+ ,opmode(0, 1, 1, 0, 1, iABC)		/* OP_CALLCEIL */
+ ,opmode(0, 1, 1, 0, 1, iABC)		/* OP_CALLABS */
+ ,opmode(0, 1, 1, 0, 1, iABC)		/* OP_CALLSQRT */
+ ,opmode(0, 1, 1, 0, 1, iABC)		/* OP_CALLMIN */
+ ,opmode(0, 1, 1, 0, 1, iABC)		/* OP_CALLMAX */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDKI */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBKI */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULKI */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MODKI */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_IDIVKI */
 };
 
+
+
+/* number of intrinsics computed by calls (the others are for loops) */
+#define NUMCALLINTRS	(LUA_INTRMAX + 1)
+
+/*
+** Functions with intrinsic opcodes, in the order of LUA_INTRFLOOR...,
+** with their number of arguments
+*/
+static const struct {
+  const char *name;
+  int nargs;
+} intrinsics[NUMCALLINTRS] = {
+  {"floor", 1}, {"ceil", 1}, {"abs", 1}, {"sqrt", 1}, {"min", 2}, {"max", 2}
+};
+
+
+/*
+** Name of the value stored in register 'reg' by instruction 'pc' of 'f',
+** when it is a field with a constant name, an upvalue or a local
+** variable (if there is debug information), or NULL.
+*/
+static const char *calleename (const struct Proto *f, const Instruction *code,
+                               int pc) {
+  Instruction i = code[pc];
+  switch (unfusedop(GET_OPCODE(i))) {
+    case OP_GETFIELD: {
+      const TValue *kc = &f->k[GETARG_C(i)];
+      return ttisshrstring(kc) ? getstr(tsvalue(kc)) : NULL;
+    }
+    case OP_GETUPVAL: {
+      TString *name = f->upvalues[GETARG_B(i)].name;
+      return (name != NULL) ? getstr(name) : NULL;
+    }
+    case OP_MOVE:
+      return luaF_getlocalname(f, GETARG_B(i) + 1, pc);
+    default:
+      return NULL;
+  }
+}
+
+
+/*
+** Intrinsic opcode for the OP_CALL at 'pc', or OP_CALL. The function
+** called is the value last stored in its register before the call,
+** whose name gives the guess; the VM checks the actual function. ('f'
+** may not have all its constants and debug information yet, as long
+** as the missing ones are nil or NULL.)
+*/
+static OpCode intrinsicop (const struct Proto *f, const Instruction *code,
+                           int pc) {
+  Instruction call = code[pc];
+  int a = GETARG_A(call);
+  int j;
+  if (GETARG_C(call) != 2)  /* not a call with one result? */
+    return OP_CALL;
+  for (j = pc - 1; j >= 0; j--) {  /* look for the callee */
+    OpCode op = unfusedop(GET_OPCODE(code[j]));
+    if (testAMode(op) && GETARG_A(code[j]) == a) {
+      const char *name = calleename(f, code, j);
+      int intr;
+      if (name == NULL)
+        return OP_CALL;
+      for (intr = 0; intr < NUMCALLINTRS; intr++) {
+        if (strcmp(name, intrinsics[intr].name) == 0)
+          return (GETARG_B(call) == intrinsics[intr].nargs + 1)
+                 ? cast(OpCode, OP_CALLFLOOR + intr) : OP_CALL;
+      }
+      return OP_CALL;
+    }
+  }
+  return OP_CALL;
+}
+
+
+/*
+** {======================================================
+** Typed integer arithmetic
+** =======================================================
+*/
+
+/*
+** Sets of registers, as bit vectors. A register is "known" to hold an
+** integer at some point of the code when it was last written by
+** OP_LOADI, by an integer instruction whose operands are known, or
+** by the loop of an integer 'for'. This is only an expectation: typed
+** instructions check their operands (see 'OP_ADDII').
+*/
+typedef unsigned char RegSet[(MAXARG_A + 1) / CHAR_BIT];
+
+#define inset(s,r)	((s)[(r) / CHAR_BIT] & (1u << ((r) % CHAR_BIT)))
+#define addset(s,r)	((s)[(r) / CHAR_BIT] |= cast_byte(1u << ((r) % CHAR_BIT)))
+#define delset(s,r)  \
+	((s)[(r) / CHAR_BIT] &= cast_byte(~(1u << ((r) % CHAR_BIT))))
+
+/* maximum nesting of 'for' loops analyzed */
+#define MAXTYPEDLOOPS	32
+
+
+/* remove from 's' the registers written by instruction 'i' */
+static void delwrites (RegSet s, Instruction i) {
+  OpCode op = unfusedop(GET_OPCODE(i));
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_LOADNIL: case OP_SELF: case OP_CALL: case OP_TAILCALL:
+    case OP_VARARG: case OP_FORPREP: case OP_FORLOOP: case OP_TFORPREP:
+    case OP_TFORCALL: case OP_TFORLOOP: {  /* write several registers */
+      int r;
+      for (r = a; r <= MAXARG_A; r++)
+        delset(s, r);
+      break;
+    }
+    default: {
+      if (testAMode(op))
+        delset(s, a);
+      break;
+    }
+  }
+}
+
+
+/* remove from 's' the registers written by instructions in [from, to) */
+static void delrange (RegSet s, const Instruction *code, int from, int to) {
+  for (; from < to; from++)
+    delwrites(s, code[from]);
+}
+
+
+/* true if K[c] is an integer (for OP_MODK/OP_IDIVK, also not 0 or -1) */
+static int intconst (const struct Proto *f, int c, int nozero) {
+  const TValue *k;
+  if (f->k == NULL || c >= f->sizek)
+    return 0;
+  k = &f->k[c];
+  return ttisinteger(k) && (!nozero || l_castS2U(ivalue(k)) + 1u > 1u);
+}
+
+
+/*
+** True if register 'reg' surely holds an integer constant when the
+** code reaches 'pc', as it is loaded by the straight-line code just
+** before it.
+*/
+static int loadsint (const struct Proto *f, const Instruction *code,
+                     int pc, int reg) {
+  int j;
+  for (j = pc - 1; j >= 0; j--) {
+    Instruction i = code[j];
+    OpCode op = unfusedop(GET_OPCODE(i));
+    if (op == OP_JMP || testTMode(op))
+      return 0;  /* not straight-line code */
+    else if (testAMode(op) && GETARG_A(i) == reg)
+      return op == OP_LOADI ||
+             (op == OP_LOADK && intconst(f, GETARG_Bx(i), 0));
+  }
+  return 0;
+}
+
+
+/*
+** Typed opcode for instruction 'i', given the registers known to hold
+** integers, or its own opcode.
+*/
+static OpCode typedop (const struct Proto *f, Instruction i, RegSet known) {
+  OpCode op = GET_OPCODE(i);
+  switch (op) {
+    case OP_ADD: case OP_SUB: case OP_MUL:
+      return (inset(known, GETARG_B(i)) && inset(known, GETARG_C(i)))
+             ? cast(OpCode, OP_ADDII + (op - OP_ADD)) : op;
+    case OP_ADDK: case OP_SUBK: case OP_MULK:
+      return (inset(known, GETARG_B(i)) && intconst(f, GETARG_C(i), 0))
+             ? cast(OpCode, OP_ADDKI + (op - OP_ADDK)) : op;
+    case OP_MODK:
+      return (inset(known, GETARG_B(i)) && intconst(f, GETARG_C(i), 1))
+             ? OP_MODKI : op;
+    case OP_IDIVK:
+      return (inset(known, GETARG_B(i)) && intconst(f, GETARG_C(i), 1))
+             ? OP_IDIVKI : op;
+    default:
+      return op;
+  }
+}
+
+
+/*
+** Give typed opcodes to the instructions in [from, to), where the
+** registers in 'known' hold integers at 'from'. Registers written
+** inside loops other than 'for' loops are never known, as their
+** values may come from a later iteration. Each 'for' loop is handled
+** by a recursive call, where the registers written by the loop are
+** not known at the start of its body, but its control variable is
+** when the loop is an integer one.
+*/
+static void typerange (const struct Proto *f, Instruction *code,
+                       int from, int to, RegSet known, int depth) {
+  RegSet unstable;
+  int pc;
+  memset(unstable, 0, sizeof(unstable));
+  for (pc = from; pc < to; pc++) {  /* collect 'unstable' */
+    Instruction i = code[pc];
+    int target = -1;
+    if (GET_OPCODE(i) == OP_JMP && GETARG_sJ(i) < 0)
+      target = pc + 1 + GETARG_sJ(i);
+    else if (GET_OPCODE(i) == OP_TFORLOOP)
+      target = pc + 1 - GETARG_Bx(i);
+    if (target >= from) {  /* a backward jump inside the range? */
+      RegSet w;
+      int r;
+      memset(w, 0xFF, sizeof(w));
+      delrange(w, code, target, pc + 1);
+      for (r = 0; r <= MAXARG_A; r++) {
+        if (!inset(w, r))  /* written inside the loop? */
+          addset(unstable, r);
+      }
+    }
+  }
+  for (pc = from; pc < to; pc++) {
+    Instruction i = code[pc];
+    OpCode op = typedop(f, i, known);
+    int a = GETARG_A(i);
+    if (op == OP_FORPREP) {
+      int last = pc + GETARG_Bx(i) + 1;  /* its OP_FORLOOP */
+      if (last < pc || last >= to)
+        return;  /* malformed code; give up */
+      if (depth < MAXTYPEDLOOPS) {
+        RegSet inner;
+        memcpy(inner, known, sizeof(inner));
+        delrange(inner, code, pc, last + 1);
+        if (a + 3 <= MAXARG_A && !inset(unstable, a + 3) &&
+            loadsint(f, code, pc, a) && loadsint(f, code, pc, a + 2))
+          addset(inner, a + 3);  /* integer control variable */
+        typerange(f, code, pc + 1, last, inner, depth + 1);
+      }
+      delrange(known, code, pc, last + 1);
+      pc = last;
+    }
+    else {
+      int isint = (op >= OP_ADDII || op == OP_LOADI ||
+                   ((op == OP_ADDI || op == OP_MOVE) &&
+                    inset(known, GETARG_B(i))));
+      SET_OPCODE(code[pc], op);
+      delwrites(known, i);
+      if (isint && !inset(unstable, a))
+        addset(known, a);
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** Rewrite the first instruction of common instruction pairs into the
+** corresponding superinstruction. Superinstructions only change the
+** opcode of the first instruction, so jumps into the second one, line
+** information and symbolic execution all keep working. Calls that seem
+** to be calls to functions with intrinsic opcodes get these opcodes,
+** and arithmetic on integers gets typed opcodes.
+*/
+void luaP_fuse (const struct Proto *f, Instruction *code, int n) {
+  RegSet known;
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    if (GET_OPCODE(code[pc]) == OP_CALL)
+      SET_OPCODE(code[pc], intrinsicop(f, code, pc));
+  }
+  memset(known, 0, sizeof(known));
+  typerange(f, code, 0, n, known, 0);
+  for (pc = 0; pc + 1 < n; pc++) {
+    OpCode next = GET_OPCODE(code[pc + 1]);
+    switch (GET_OPCODE(code[pc])) {
+      case OP_GETTABUP: {  /* module.func */
+        if (next == OP_GETFIELD)
+          SET_OPCODE(code[pc], OP_GETTABUPF);
+        break;
+      }
+      case OP_GETFIELD: {  /* obj.func() */
+        if (next == OP_CALL)
+          SET_OPCODE(code[pc], OP_GETFIELDC);
+        break;
+      }
+      default: break;
+    }
+  }
+}
+
+
+/*
+** Undo 'luaP_fuse', giving back the original instructions.
+*/
+void luaP_unfuse (Instruction *code, int n) {
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    OpCode op = GET_OPCODE(code[pc]);
+    if (unfusedop(op) != op)
+      SET_OPCODE(code[pc], unfusedop(op));
+  }
+}
+
@@ -267,7 +267,7 @@ OP_LEN,/*	A B	R[A] := #R[B] (length operator)			*/
 OP_CONCAT,/*	A B	R[A] := R[A].. ... ..R[A + B - 1]		*/
 
 OP_CLOSE,/*	A	close all upvalues >= R[A]			*/
-OP_TBC,/*	A	mark variable A "to be closed"			*/
+OP_TBC,/*	A B	mark variable A "to be closed"	(*)		*/
 OP_JMP,/*	sJ	pc += sJ					*/
 OP_EQ,/*	A B k	if ((R[A] == R[B]) ~= k) then pc++		*/
 OP_LT,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++		*/
@@ -308,10 +308,33 @@ OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
 OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
 
-OP_2Q
+OP_2Q,/*	A k	if ((R[A] ~= nil) ~= k) then pc++		*/
+
+OP_FSTRING,/*	A B	R[A] := R[A].. ... ..R[A + B - 1] (f-string)	*/
+
+OP_SWITCH,/*	A Bx	if R[A] is a case of SWITCHES[Bx] then pc := its code */
+
+OP_GETTABUPF,/*	A B C	OP_GETTABUP followed by OP_GETFIELD		*/
+OP_GETFIELDC,/*	A B C	OP_GETFIELD followed by OP_CALL			*/
+
+OP_CALLFLOOR,/*	A B C	OP_CALL of 'math.floor' (intrinsic)		*/
+OP_CALLCEIL,/*	A B C	OP_CALL of 'math.ceil' (intrinsic)		*/
+OP_CALLABS,/*	A B C	OP_CALL of 'math.abs' (intrinsic)		*/
+OP_CALLSQRT,/*	A B C	OP_CALL of 'math.sqrt' (intrinsic)		*/
+OP_CALLMIN,/*	A B C	OP_CALL of 'math.min' (intrinsic)		*/
+OP_CALLMAX,/*	A B C	OP_CALL of 'math.max' (intrinsic)		*/
+
+OP_ADDII,/*	A B C	OP_ADD of two integers				*/
+OP_SUBII,/*	A B C	OP_SUB of two integers				*/
+OP_MULII,/*	A B C	OP_MUL of two integers				*/
+OP_ADDKI,/*	A B C	OP_ADDK of an integer and an integer constant	*/
+OP_SUBKI,/*	A B C	OP_SUBK of an integer and an integer constant	*/
+OP_MULKI,/*	A B C	OP_MULK of an integer and an integer constant	*/
+OP_MODKI,/*	A B C	OP_MODK of an integer and an integer constant	*/
+OP_IDIVKI/*	A B C	OP_IDIVK of an integer and an integer constant	*/
 } OpCode;
 
-#define NUM_OPCODES	((int)(OP_2Q) + 1)
+#define NUM_OPCODES	((int)(OP_IDIVKI) + 1)
 
 
 
@@ -329,6 +352,9 @@ OP_2Q
   (*) Opcode OP_TESTSET is used in short-circuit expressions that need
   both to jump and to produce a value, such as (a = b or c).
 
+  (*) Opcode OP_2Q implements (a ?? b): it tests the register holding
+  'a' and the following jump skips the code for 'b' when 'a' is not nil.
+
   (*) In OP_CALL, if (B == 0) then B = top - A. If (C == 0), then
   'top' is set to last_result+1, so next open instruction (OP_CALL,
   OP_RETURN*, OP_SETLIST) may use 'top'.
@@ -341,6 +367,37 @@ OP_2Q
   (*) In OP_LOADKX and OP_NEWTABLE, the next instruction is always
   OP_EXTRAARG.
 
+  (*) OP_FSTRING has the same semantics as OP_CONCAT, but it formats
+  string and number operands directly into the result.
+
+  (*) In OP_TBC, if B > 0, R[A] is not a variable but a deferred call:
+  R[A](R[A+1], ..., R[A+B-1]) is called when the variable would be
+  closed.
+
+  (*) OP_SWITCH looks up R[A] in the jump table SWITCHES[Bx] of the
+  function (see 'SwitchTable'); if it is not there, the next instruction
+  (a jump to the 'else' part) runs.
+
+  (*) OP_GETTABUPF and OP_GETFIELDC are superinstructions, created only
+  by 'luaP_fuse'. Each one behaves exactly like the opcode it replaces
+  and signals that the next instruction has the given opcode, so that
+  the VM can run both with a single dispatch. The next instruction is
+  kept intact; precompiled chunks never contain superinstructions.
+
+  (*) OP_CALLFLOOR ... OP_CALLMAX are OP_CALLs with one result that
+  'luaP_fuse' guesses call a function with an intrinsic opcode (see
+  'lua_setintrinsic'), from the name of the callee. When R[A] is that
+  function, the arguments are numbers, and there are no hooks, the VM
+  computes the result inline; otherwise it runs a plain OP_CALL.
+
+  (*) OP_ADDII ... OP_IDIVKI are arithmetic instructions whose register
+  operands 'luaP_fuse' expects to be integers, such as the control
+  variable of a 'for' loop with integer initial value and step. Their
+  constants are integers (non-zero and not -1 for OP_MODKI and
+  OP_IDIVKI). When the operands are integers the VM computes the result
+  directly and skips the following OP_MMBIN*; otherwise it runs the
+  original instruction.
+
   (*) In OP_SETLIST, if (B == 0) then real B = 'top'; if k, then
   real C = EXTRAARG _ C (the bits of EXTRAARG concatenated with the
   bits of C).
@@ -400,6 +457,20 @@ LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
     (((mm) << 7) | ((ot) << 6) | ((it) << 5) | ((t) << 4) | ((a) << 3) | (m))
 
 
+/* original opcode of a (possibly fused) opcode */
+#define unfusedop(o)  \
+	((o) < OP_GETTABUPF ? (o) : \
+	 (o) == OP_GETTABUPF ? OP_GETTABUP : \
+	 (o) == OP_GETFIELDC ? OP_GETFIELD : \
+	 (o) == OP_IDIVKI ? OP_IDIVK : \
+	 (o) >= OP_ADDKI ? cast(OpCode, OP_ADDK + ((o) - OP_ADDKI)) : \
+	 (o) >= OP_ADDII ? cast(OpCode, OP_ADD + ((o) - OP_ADDII)) : OP_CALL)
+
+struct Proto;
+LUAI_FUNC void luaP_fuse (const struct Proto *f, Instruction *code, int n);
+LUAI_FUNC void luaP_unfuse (Instruction *code, int n);
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
 
@@ -96,6 +96,25 @@ static const char *const opnames[] = {
   "VARARG",
   "VARARGPREP",
   "EXTRAARG",
+  "2Q",
+  "FSTRING",
+  "SWITCH",
+  "GETTABUPF",
+  "GETFIELDC",
+  "CALLFLOOR",
+  "CALLCEIL",
+  "CALLABS",
+  "CALLSQRT",
+  "CALLMIN",
+  "CALLMAX",
+  "ADDII",
+  "SUBII",
+  "MULII",
+  "ADDKI",
+  "SUBKI",
+  "MULKI",
+  "MODKI",
+  "IDIVKI",
   NULL
 };
 
@@ -745,6 +745,7 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->nk = 0;
   fs->nabslineinfo = 0;
   fs->np = 0;
+  fs->nsw = 0;
   fs->nups = 0;
   fs->ndebugvars = 0;
   fs->nactvar = 0;
@@ -766,14 +767,18 @@ static void close_func (LexState *ls) {
   luaK_ret(fs, luaY_nvarstack(fs), 0);  /* final return */
   leaveblock(fs);
   lua_assert(fs->bl == NULL);
+  if (G(L)->optlevel > 0)  /* optimizer on? */
+    luaK_optimize(fs);
   luaK_finish(fs);
   luaM_shrinkvector(L, f->code, f->sizecode, fs->pc, Instruction);
+  luaF_initcache(L, f);
   luaM_shrinkvector(L, f->lineinfo, f->sizelineinfo, fs->pc, ls_byte);
   luaM_shrinkvector(L, f->abslineinfo, f->sizeabslineinfo,
                        fs->nabslineinfo, AbsLineInfo);
   luaM_shrinkvector(L, f->k, f->sizek, fs->nk, TValue);
   luaM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   luaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
+  luaM_shrinkvector(L, f->swtabs, f->sizeswtabs, fs->nsw, SwitchTable);
   luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
   ls->fs = fs->prev;
   luaC_checkGC(L);
@@ -1143,6 +1148,48 @@ static void suffixedexp (LexState *ls, expdesc *v) {
 }
 
 
+/*
+** fstring -> FPART expr { '}' FPART expr } '}' STRING
+** All literal parts and holes go to consecutive registers and are
+** joined by a single OP_FSTRING, which builds the result in one pass.
+** Like in constructors, parts are flushed every LFIELDS_PER_FLUSH
+** items. Empty literal parts after the first are not loaded at all.
+*/
+static void fstring (LexState *ls, expdesc *v) {
+  FuncState *fs = ls->fs;
+  int del = ls->fstring_del;  /* a hole may contain another f-string */
+  int line = ls->linenumber;
+  int base, n = 1;
+  expdesc e;
+  codestring(v, ls->t.seminfo.ts);
+  luaK_exp2nextreg(fs, v);
+  base = v->u.info;
+  while (ls->t.token == TK_FPART) {
+    if (n + 2 > LFIELDS_PER_FLUSH) {  /* limit register pressure */
+      luaK_codeABC(fs, OP_FSTRING, base, n, 0);
+      luaK_fixline(fs, line);
+      fs->freereg = base + 1;
+      n = 1;
+    }
+    luaX_next(ls);  /* skip the part before the hole */
+    expr(ls, &e);
+    luaK_exp2nextreg(fs, &e);
+    n++;
+    if (ls->t.token != '}')
+      luaX_syntaxerror(ls, "expected '}' in f-string");
+    luaX_read_fstring(ls, del);
+    if (tsslen(ls->t.seminfo.ts) > 0) {
+      codestring(&e, ls->t.seminfo.ts);
+      luaK_exp2nextreg(fs, &e);
+      n++;
+    }
+  }
+  luaK_codeABC(fs, OP_FSTRING, base, n, 0);
+  luaK_fixline(fs, line);
+  fs->freereg = base + 1;
+}
+
+
 static void simpleexp (LexState *ls, expdesc *v) {
   /* simpleexp -> FLT | INT | STRING | NIL | TRUE | FALSE | ... |
                   constructor | FUNCTION body | suffixedexp */
@@ -1189,26 +1236,9 @@ static void simpleexp (LexState *ls, expdesc *v) {
       body(ls, v, 0, ls->linenumber);
       return;
     }
-    case TK_FPART: {
-        init_exp(v, VK, 0);
-        v->u.info = luaK_stringK(ls->fs, ls->t.seminfo.ts);
-        while (ls->t.token == TK_FPART) {
-            luaK_exp2nextreg(ls->fs, v);
-            expdesc e2;
-            luaX_next(ls);
-            expr(ls, &e2);
-            luaK_exp2nextreg(ls->fs, &e2);
-            luaK_posfix(ls->fs, OPR_CONCAT, v, &e2, ls->linenumber);
-            if (ls->t.token != '}') {
-                luaX_syntaxerror(ls, "expected '}' in f-string");
-            }
-            luaX_read_fstring(ls, ls->fstring_del);
-            init_exp(&e2, VK, 0);
-            e2.u.info = luaK_stringK(ls->fs, ls->t.seminfo.ts);
-            luaK_exp2nextreg(ls->fs, &e2);
-            luaK_posfix(ls->fs, OPR_CONCAT, v, &e2, ls->linenumber);
-        }   
-        break;
+    case TK_FPART: {  /* interpolated string */
+      fstring(ls, v);
+      break;
     }
     default: {
       suffixedexp(ls, v);
@@ -1715,6 +1745,94 @@ static void ifstat (LexState *ls, int line) {
 }
 
 
+/*
+** 'switch', 'case', and 'defer' are not reserved words, so that old code using
+** them as names keeps working: such a name starts one of these
+** constructs only when the token after it cannot continue a call or
+** an assignment. (Inside a switch, 'case' followed by a string or a
+** table constructor is a case too.) An operator right before a '='
+** is a compound assignment.
+*/
+static int isword (LexState *ls, TString *word) {
+  if (ls->t.token != TK_NAME || ls->t.seminfo.ts != word)
+    return 0;
+  if (ls->lookahead.token == TK_EOS)  /* not looked ahead yet? */
+    luaX_lookahead(ls);
+  switch (ls->lookahead.token) {
+    case '=': case ',': case '.': case ':': case '[': case '(':
+      return 0;
+    case TK_STRING: case '{':
+      return (word == ls->casen);
+    case '+': case '-': case '*': case '%': case '^': case '/':
+    case TK_IDIV: case '&': case '|': case TK_SHL: case TK_SHR:
+    case TK_CONCAT: case TK_2Q:
+      return (ls->current != '=');
+    default:
+      return 1;
+  }
+}
+
+
+static void caseblock (LexState *ls) {
+  /* caseblock -> { stat [';'] } */
+  FuncState *fs = ls->fs;
+  BlockCnt bl;
+  enterblock(fs, &bl, 0);
+  while (!block_follow(ls, 0) && !isword(ls, ls->casen)) {
+    if (ls->t.token == TK_RETURN) {
+      statement(ls);
+      break;  /* 'return' must be last statement */
+    }
+    statement(ls);
+  }
+  leaveblock(fs);
+}
+
+
+/*
+** Each case jumps from the OP_SWITCH through a jump table to its block;
+** a value that is not a case goes to the 'else' part (or to the end)
+** through the jump that follows the OP_SWITCH.
+*/
+static void switchstat (LexState *ls, int line) {
+  /* switchstat -> SWITCH exp DO {CASE exp {',' exp} THEN caseblock}
+                   [ELSE block] END */
+  FuncState *fs = ls->fs;
+  int escapelist = NO_JUMP;  /* exit list for finished cases */
+  int deflt;  /* jump for values that are not cases */
+  int sw;
+  expdesc v;
+  luaX_next(ls);  /* skip 'switch' */
+  expr(ls, &v);
+  checknext(ls, TK_DO);
+  sw = luaK_switch(fs, &v);
+  deflt = luaK_jump(fs);
+  while (isword(ls, ls->casen)) {
+    int pc = luaK_getlabel(fs);
+    luaX_next(ls);  /* skip 'case' */
+    do {
+      expr(ls, &v);
+      luaK_switchcase(fs, sw, &v, pc);
+    } while (testnext(ls, ','));
+    checknext(ls, TK_THEN);
+    caseblock(ls);
+    if (isword(ls, ls->casen) || ls->t.token == TK_ELSE)
+      luaK_concat(fs, &escapelist, luaK_jump(fs));  /* jump over the rest */
+  }
+  luaK_patchtohere(fs, deflt);
+  if (testnext(ls, TK_ELSE))
+    block(ls);  /* 'else' part */
+  if (!testnext(ls, TK_END)) {
+    if (line == ls->linenumber)
+      error_expected(ls, TK_END);
+    luaX_syntaxerror(ls, luaO_pushfstring(ls->L,
+        "%s expected (to close 'switch' at line %d)",
+        luaX_token2str(ls, TK_END), line));
+  }
+  luaK_patchtohere(fs, escapelist);  /* patch escape list to 'switch' end */
+}
+
+
 static void localfunc (LexState *ls) {
   expdesc b;
   FuncState *fs = ls->fs;
@@ -1821,15 +1939,132 @@ static void funcstat (LexState *ls, int line) {
 }
 
 
+/*
+** Operator of a compound assignment ('op=') starting at the current
+** token, or OPR_NOBINOPR if there is none. ('~=' is the inequality,
+** so there is no compound form for '~'.)
+*/
+static BinOpr compoundopr (LexState *ls) {
+  BinOpr op = getbinopr(ls->t.token);
+  switch (op) {
+    case OPR_ADD: case OPR_SUB: case OPR_MUL: case OPR_MOD:
+    case OPR_POW: case OPR_DIV: case OPR_IDIV:
+    case OPR_BAND: case OPR_BOR: case OPR_SHL: case OPR_SHR:
+    case OPR_CONCAT: case OPR_2Q: {
+      if (ls->lookahead.token == TK_EOS && luaX_lookahead(ls) == '=')
+        return op;
+      return OPR_NOBINOPR;
+    }
+    default: return OPR_NOBINOPR;
+  }
+}
+
+
+/*
+** Compound assignment. The table and key of an indexed variable are
+** evaluated only once: the same registers are used to read the old
+** value and to store the new one.
+**
+** assignment -> suffixedexp op '=' expr
+*/
+static void compoundassign (LexState *ls, expdesc *v, BinOpr op) {
+  FuncState *fs = ls->fs;
+  expdesc e, e2;
+  int line = ls->linenumber;
+  check_condition(ls, vkisvar(v->k), "syntax error");
+  check_readonly(ls, v);
+  luaX_next(ls);  /* skip operator */
+  luaX_next(ls);  /* skip '=' */
+  luaK_readvar(fs, v, &e);
+  luaK_infix(fs, op, &e);
+  expr(ls, &e2);
+  luaK_posfix(fs, op, &e, &e2, line);
+  luaK_storevar(fs, v, &e);
+}
+
+
+/*
+** Body of 'defer do ... end', compiled as a function without
+** parameters.
+*/
+static void deferbody (LexState *ls, expdesc *e, int line) {
+  FuncState new_fs;
+  BlockCnt bl;
+  new_fs.f = addprototype(ls);
+  new_fs.f->linedefined = line;
+  open_func(ls, &new_fs, &bl);
+  statlist(ls);
+  new_fs.f->lastlinedefined = ls->linenumber;
+  check_match(ls, TK_END, TK_DO, line);
+  codeclosure(ls, e);
+  close_func(ls);
+}
+
+
+/*
+** A deferred call evaluates the function and its arguments at once,
+** into hidden local variables, and makes the call when these
+** variables go out of scope (see OP_TBC), as for to-be-closed
+** variables. The call itself is changed into the OP_TBC, so that
+** nothing is allocated at run time. A multiple-results last argument
+** is adjusted to one value, as the number of hidden variables must be
+** fixed. The block form defers the call of an anonymous function.
+*/
+static void deferstat (LexState *ls, int line) {
+  /* stat -> DEFER suffixedexp | DEFER DO block END */
+  FuncState *fs = ls->fs;
+  int base = luaY_nvarstack(fs);
+  int nargs = 0;
+  int i;
+  expdesc e;
+  luaX_next(ls);  /* skip 'defer' */
+  if (testnext(ls, TK_DO)) {
+    deferbody(ls, &e, line);
+    luaK_exp2nextreg(fs, &e);
+    luaK_codeABC(fs, OP_TBC, base, 1, 0);
+  }
+  else {
+    Instruction *inst;
+    suffixedexp(ls, &e);
+    check_condition(ls, e.k == VCALL, "function call expected");
+    inst = &getinstruction(fs, &e);
+    lua_assert(GET_OPCODE(*inst) == OP_CALL && GETARG_A(*inst) == base);
+    if (GETARG_B(*inst) == 0) {  /* open last argument? */
+      expdesc last;  /* it is the instruction right before the call */
+      Instruction *open = inst - 1;
+      init_exp(&last, (GET_OPCODE(*open) == OP_VARARG) ? VVARARG : VCALL,
+                      e.u.info - 1);
+      if (last.k == VCALL)
+        luaK_setreturns(fs, &last, 1);
+      luaK_setoneret(fs, &last);
+      SETARG_B(*inst, GETARG_A(*open) - base + 1);
+    }
+    nargs = GETARG_B(*inst) - 1;
+    checklimit(fs, ls->dyd->actvar.n + nargs + 1 - fs->firstlocal,
+                   MAXVARS, "local variables (with deferred arguments)");
+    SET_OPCODE(*inst, OP_TBC);
+    SETARG_C(*inst, 0);
+    luaK_reserveregs(fs, nargs);  /* arguments stay in their registers */
+  }
+  for (i = 0; i <= nargs; i++)
+    new_localvarliteral(ls, "(defer)");
+  adjustlocalvars(ls, nargs + 1);
+  marktobeclosed(fs);
+}
+
+
 static void exprstat (LexState *ls) {
   /* stat -> func | assignment */
   FuncState *fs = ls->fs;
   struct LHS_assign v;
+  BinOpr op;
   suffixedexp(ls, &v.v);
   if (ls->t.token == '=' || ls->t.token == ',') { /* stat -> assignment ? */
     v.prev = NULL;
     restassign(ls, &v, 1);
   }
+  else if ((op = compoundopr(ls)) != OPR_NOBINOPR)
+    compoundassign(ls, &v.v, op);
   else {  /* stat -> func */
     Instruction *inst;
     check_condition(ls, v.v.k == VCALL, "syntax error");
@@ -1953,7 +2188,12 @@ static void statement (LexState *ls) {
       break;
     }
     default: {  /* stat -> func | assignment */
-      exprstat(ls);
+      if (isword(ls, ls->switchn))  /* stat -> switchstat */
+        switchstat(ls, line);
+      else if (isword(ls, ls->defern))  /* stat -> deferstat */
+        deferstat(ls, line);
+      else
+        exprstat(ls);
       break;
     }
   }
@@ -0,0 +1,395 @@
+/*
+** $Id: lperflib.c $
+** Monotonic clock and tracing spans
+** See Copyright Notice in lua.h
+*/
+
+#define lperflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "ljson.h"
+
+
+/*
+** 'perf.span' appends an event to a trace buffer and returns the trace
+** itself, whose '__close' appends the event that ends the span. So, a
+** span costs two fixed-size records and no allocation: the buffer is a
+** ring of events, created with the first one, and the name of a span
+** and the thread where it runs are kept as small integers, registered
+** the first time each one is seen. When the ring is full, each new
+** event overwrites the oldest one.
+*/
+
+/* default number of events kept in the trace buffer */
+#if !defined(PERF_TRACESIZE)
+#define PERF_TRACESIZE	4096
+#endif
+
+/* key, in the registry, for the trace */
+#define PERFTRACE	"_PERFTRACE"
+
+/* name of the metatable of the trace */
+#define PERFMETA	"perf.trace"
+
+/* room for a formatted integer */
+#define INTSIZE	32
+
+/* the user values of the trace */
+#define UV_RING		1	/* ring of events */
+#define UV_NAMES	2	/* table mapping names to their ids */
+#define UV_NAMEREFS	3	/* array of names, indexed by their ids */
+#define UV_THREADS	4	/* weak table mapping threads to their ids */
+
+
+/*
+** Clock for 'perf.now', in nanoseconds. Browsers give no C clock, so
+** there it comes from the host, which must provide 'env.perf_now'
+** returning milliseconds, as 'performance.now' does.
+*/
+#if !defined(LUA_PERF_HOSTCLOCK) && defined(__wasm__) && !defined(__wasi__)
+#define LUA_PERF_HOSTCLOCK
+#endif
+
+#if defined(LUA_PERF_HOSTCLOCK)		/* { */
+
+__attribute__((import_module("env"), import_name("perf_now")))
+extern double perf_hostnow (void);
+
+static lua_Integer perfclock (void) {
+  return (lua_Integer)(perf_hostnow() * 1e6);
+}
+
+#elif defined(LUA_USE_POSIX) || defined(__wasi__)	/* }{ */
+
+static lua_Integer perfclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (lua_Integer)ts.tv_sec * 1000000000 + (lua_Integer)ts.tv_nsec;
+}
+
+#elif defined(_WIN32)			/* }{ */
+
+#include <windows.h>
+
+static lua_Integer perfclock (void) {
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter(&c);
+  QueryPerformanceFrequency(&f);
+  return (lua_Integer)(c.QuadPart / f.QuadPart) * 1000000000 +
+         (lua_Integer)((c.QuadPart % f.QuadPart) * 1000000000 / f.QuadPart);
+}
+
+#else					/* }{ */
+
+/* ISO C has no monotonic clock; use CPU time */
+static lua_Integer perfclock (void) {
+  return (lua_Integer)((double)clock() * (1e9 / CLOCKS_PER_SEC));
+}
+
+#endif					/* } */
+
+
+
+typedef struct Event {
+  lua_Integer time;
+  int name;  /* id of the name of the span begun (0 at its end) */
+  int thread;  /* id of its thread */
+} Event;
+
+
+typedef struct NameRef {
+  const char *s;  /* (anchored in the table of names) */
+  size_t len;
+} NameRef;
+
+
+typedef struct Trace {
+  Event *ring;  /* NULL until the first event */
+  NameRef *names;
+  unsigned int size;  /* size of 'ring' */
+  unsigned int first;  /* index of the oldest event */
+  unsigned int count;  /* number of events in 'ring' */
+  int nnames;  /* number of names registered */
+  int sizenames;  /* size of 'names' */
+  int nthreads;  /* number of coroutines registered */
+  lua_Integer dropped;  /* events overwritten since the last 'clear' */
+} Trace;
+
+
+#define totrace(L,idx)	((Trace *)lua_touserdata(L, idx))
+
+
+/*
+** Create a ring of 'size' events for the trace at 'tidx'.
+*/
+static void newring (lua_State *L, int tidx, unsigned int size) {
+  Trace *t = totrace(L, tidx);
+  t->ring = (Event *)lua_newuserdatauv(L, size * sizeof(Event), 0);
+  lua_setiuservalue(L, tidx, UV_RING);
+  t->size = size;
+  t->first = t->count = 0;
+  t->dropped = 0;
+}
+
+
+/*
+** Id of the name at 'arg', registering it if it is new.
+*/
+static int nameid (lua_State *L, int tidx, int arg) {
+  Trace *t = totrace(L, tidx);
+  int id;
+  lua_getiuservalue(L, tidx, UV_NAMES);
+  lua_pushvalue(L, arg);
+  if (lua_rawget(L, -2) == LUA_TNUMBER)
+    id = (int)lua_tointeger(L, -1);
+  else {
+    if (t->nnames == t->sizenames) {  /* grow array of names? */
+      int newsize = (t->sizenames == 0) ? 16 : t->sizenames * 2;
+      NameRef *names = (NameRef *)lua_newuserdatauv(L,
+                                    (size_t)newsize * sizeof(NameRef), 0);
+      if (t->nnames > 0)
+        memcpy(names, t->names, (size_t)t->nnames * sizeof(NameRef));
+      t->names = names;
+      t->sizenames = newsize;
+      lua_setiuservalue(L, tidx, UV_NAMEREFS);
+    }
+    id = ++t->nnames;
+    t->names[id - 1].s = lua_tolstring(L, arg, &t->names[id - 1].len);
+    lua_pushvalue(L, arg);
+    lua_pushinteger(L, id);
+    lua_rawset(L, -4);  /* names[name] = id */
+  }
+  lua_pop(L, 2);  /* id and table of names */
+  return id;
+}
+
+
+/*
+** Id of the running thread: 1 for the main one, and the next ones,
+** from 2 on, for coroutines in the order they are seen.
+*/
+static int threadid (lua_State *L, int tidx) {
+  int id;
+  if (lua_pushthread(L)) {  /* main thread? */
+    lua_pop(L, 1);
+    return 1;
+  }
+  lua_getiuservalue(L, tidx, UV_THREADS);
+  lua_pushvalue(L, -2);
+  if (lua_rawget(L, -2) == LUA_TNUMBER)
+    id = (int)lua_tointeger(L, -1);
+  else {
+    id = ++totrace(L, tidx)->nthreads + 1;
+    lua_pushvalue(L, -3);
+    lua_pushinteger(L, id);
+    lua_rawset(L, -4);  /* threads[L] = id */
+  }
+  lua_pop(L, 3);  /* id, table of threads, and thread */
+  return id;
+}
+
+
+static void addevent (lua_State *L, int tidx, int name) {
+  Trace *t = totrace(L, tidx);
+  int thread = threadid(L, tidx);
+  Event *e;
+  if (t->ring == NULL)
+    newring(L, tidx, PERF_TRACESIZE);
+  if (t->count < t->size)
+    e = &t->ring[(t->first + t->count++) % t->size];
+  else {  /* ring is full; overwrite its oldest event */
+    e = &t->ring[t->first];
+    t->first = (t->first + 1) % t->size;
+    t->dropped++;
+  }
+  e->name = name;
+  e->thread = thread;
+  e->time = perfclock();
+}
+
+
+static int perf_now (lua_State *L) {
+  lua_pushinteger(L, perfclock());
+  return 1;
+}
+
+
+static int perf_span (lua_State *L) {
+  int tidx = lua_upvalueindex(1);
+  luaL_checkstring(L, 1);
+  addevent(L, tidx, nameid(L, tidx, 1));
+  lua_pushvalue(L, tidx);  /* to be closed at the end of the span */
+  return 1;
+}
+
+
+static int trace_close (lua_State *L) {
+  luaL_checkudata(L, 1, PERFMETA);
+  addevent(L, 1, 0);
+  return 0;
+}
+
+
+static int perf_clear (lua_State *L) {
+  int tidx = lua_upvalueindex(1);
+  Trace *t = totrace(L, tidx);
+  if (!lua_isnoneornil(L, 1)) {
+    lua_Integer size = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, 0 < size && size <= (lua_Integer)(~0u / sizeof(Event)),
+                     1, "invalid size");
+    newring(L, tidx, (unsigned int)size);
+  }
+  else {
+    t->first = t->count = 0;
+    t->dropped = 0;
+  }
+  return 0;
+}
+
+
+static void addjsonstring (luaL_Buffer *b, const char *s, size_t n) {
+  luaL_addchar(b, '"');
+  while (n > 0) {
+    size_t k = ljson_plainlen(s, n);
+    char e[6];
+    luaL_addlstring(b, s, k);
+    if (k == n) break;
+    luaL_addlstring(b, e, (size_t)ljson_escape((unsigned char)s[k], e));
+    s += k + 1;
+    n -= k + 1;
+  }
+  luaL_addchar(b, '"');
+}
+
+
+/*
+** Add a time, in nanoseconds, as microseconds with three decimals.
+*/
+static void addmicros (luaL_Buffer *b, lua_Integer ns) {
+  char *buff = luaL_prepbuffsize(b, INTSIZE + 4);
+  int len = lua_integer2str(buff, INTSIZE, ns / 1000);
+  int frac = (int)(ns % 1000);
+  if (frac < 0) frac = -frac;
+  buff[len++] = '.';
+  buff[len++] = (char)('0' + frac / 100);
+  buff[len++] = (char)('0' + frac / 10 % 10);
+  buff[len++] = (char)('0' + frac % 10);
+  luaL_addsize(b, (size_t)len);
+}
+
+
+/*
+** Return the events in the trace as the JSON text of a Chrome trace
+** ("Trace Event Format"), with one "B" event at the beginning of each
+** span and one "E" event at its end, plus the number of events lost.
+*/
+static int perf_trace (lua_State *L) {
+  Trace *t = totrace(L, lua_upvalueindex(1));
+  luaL_Buffer b;
+  unsigned int i;
+  luaL_buffinit(L, &b);
+  luaL_addstring(&b, "{\"traceEvents\":[");
+  for (i = 0; i < t->count; i++) {
+    const Event *e = &t->ring[(t->first + i) % t->size];
+    char buff[INTSIZE];
+    if (i > 0)
+      luaL_addchar(&b, ',');
+    if (e->name != 0) {
+      const NameRef *n = &t->names[e->name - 1];
+      luaL_addstring(&b, "\n{\"ph\":\"B\",\"name\":");
+      addjsonstring(&b, n->s, n->len);
+    }
+    else
+      luaL_addstring(&b, "\n{\"ph\":\"E\"");
+    luaL_addstring(&b, ",\"pid\":1,\"tid\":");
+    luaL_addlstring(&b, buff,
+                       (size_t)lua_integer2str(buff, INTSIZE, e->thread));
+    luaL_addstring(&b, ",\"ts\":");
+    addmicros(&b, e->time);
+    luaL_addchar(&b, '}');
+  }
+  luaL_addstring(&b, "],\n\"displayTimeUnit\":\"ns\"}\n");
+  luaL_pushresult(&b);
+  lua_pushinteger(L, t->dropped);
+  return 2;
+}
+
+
+LUALIB_API int luaL_perfdrain (lua_State *L, luaL_PerfEvent *ev, int n) {
+  Trace *t;
+  int i;
+  lua_getfield(L, LUA_REGISTRYINDEX, PERFTRACE);
+  t = (Trace *)luaL_testudata(L, -1, PERFMETA);
+  lua_pop(L, 1);  /* the trace stays anchored in the registry */
+  if (t == NULL)  /* library not open? */
+    return 0;
+  for (i = 0; i < n && t->count > 0; i++) {
+    const Event *e = &t->ring[t->first];
+    ev[i].time = e->time;
+    ev[i].name = (e->name != 0) ? t->names[e->name - 1].s : NULL;
+    ev[i].thread = e->thread;
+    t->first = (t->first + 1) % t->size;
+    t->count--;
+  }
+  return i;
+}
+
+
+static const luaL_Reg perf_funcs[] = {
+  {"now", perf_now},
+  {"span", perf_span},
+  {"trace", perf_trace},
+  {"clear", perf_clear},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg trace_meta[] = {
+  {"__close", trace_close},
+  {NULL, NULL}
+};
+
+
+/*
+** Create the trace of the state, unless another instance of the
+** library already did, and leave it on the stack.
+*/
+static void gettrace (lua_State *L) {
+  if (lua_getfield(L, LUA_REGISTRYINDEX, PERFTRACE) == LUA_TUSERDATA)
+    return;
+  lua_pop(L, 1);
+  memset(lua_newuserdatauv(L, sizeof(Trace), UV_THREADS), 0, sizeof(Trace));
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, UV_NAMES);
+  lua_newtable(L);
+  lua_pushliteral(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_pushvalue(L, -1);
+  lua_setmetatable(L, -2);  /* weak keys */
+  lua_setiuservalue(L, -2, UV_THREADS);
+  if (luaL_newmetatable(L, PERFMETA))
+    luaL_setfuncs(L, trace_meta, 0);
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, PERFTRACE);
+}
+
+
+LUAMOD_API int luaopen_perf (lua_State *L) {
+  luaL_newlibtable(L, perf_funcs);
+  gettrace(L);
+  luaL_setfuncs(L, perf_funcs, 1);
+  return 1;
+}
+
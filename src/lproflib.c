@@ -0,0 +1,557 @@
+/*
+** $Id: lproflib.c $
+** Sampling profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lproflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** The profiler takes samples of the call stack of the main thread at
+** regular intervals. Where POSIX timers are available, a SIGPROF timer
+** ticks every 'interval' milliseconds of CPU time; its handler only
+** sets a one-shot hook (as 'lua.c' does for SIGINT), and that hook,
+** run at the next instruction, call, or return, records the stack. So,
+** the interpreter runs at full speed between samples. Elsewhere, a
+** count hook records a sample every 'interval' * PROFCOUNT
+** instructions, which is much slower.
+**
+** Samples are kept in a table in the registry mapping each stack, in
+** collapsed format ("outer;...;inner"), to the number of times it was
+** seen. Time spent inside a coroutine is charged to the 'resume' that
+** started it, as only the main thread is sampled.
+**
+** The heap profiler works the same way, but its ticks come from the
+** allocator (see 'lua_setallocsampler'): every 'rate' bytes or so, the
+** thread allocating gets the one-shot hook, which charges the bytes
+** allocated since the last sample to its current stack.
+**
+** Coverage is collected by the interpreter itself (see 'lua_coverage'),
+** without hooks, so it works along with the profilers.
+*/
+
+#if !defined(LUA_PROFILE_TIMER)
+
+#if defined(LUA_USE_POSIX) && !defined(__wasm__)
+#define LUA_PROFILE_TIMER
+#endif
+
+#endif
+
+
+#if defined(LUA_PROFILE_TIMER)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+
+/* key, in the registry, for the table of samples */
+#define PROFTABLE	"_PROFILE"
+
+/* key, in the registry, for the table of heap samples */
+#define HEAPTABLE	"_HEAPPROFILE"
+
+/* default heap sampling rate, in bytes */
+#define HEAPRATE	(512 * 1024)
+
+/* default sampling interval, in milliseconds */
+#define PROFINTERVAL	10
+
+/* instructions per millisecond of 'interval' without timers */
+#define PROFCOUNT	1000
+
+/* maximum number of (innermost) frames kept in each sample */
+#define PROFMAXDEPTH	128
+
+
+/* thread being sampled (NULL if the profiler is not running) */
+static lua_State *volatile profL = NULL;
+
+/* number of samples taken since the last 'start' */
+static lua_Integer nsamples = 0;
+
+/* main thread of the state being heap profiled (or NULL) */
+static lua_State *heapL = NULL;
+
+/* number of heap samples taken since the last 'heapstart' */
+static lua_Integer nheapsamples = 0;
+
+/* bytes allocated since the last heap sample was recorded */
+static size_t heappending = 0;
+
+/* true while recording a heap sample (its own allocations do not count) */
+static int inheapsample = 0;
+
+
+/*
+** Append to 'b' the name of the function running at 'level'.
+*/
+static void addframe (lua_State *L, luaL_Buffer *b, int level) {
+  lua_Debug ar;
+  lua_getstack(L, level, &ar);
+  lua_getinfo(L, "Sn", &ar);
+  if (*ar.what == 'm')  /* main chunk? */
+    luaL_addstring(b, "main chunk");
+  else
+    luaL_addstring(b, (ar.name != NULL) ? ar.name : "?");
+  if (*ar.what == 'C')
+    luaL_addstring(b, " [C]");
+  else {
+    lua_pushfstring(L, " (%s:%d)", ar.short_src, ar.linedefined);
+    luaL_addvalue(b);
+  }
+}
+
+
+/*
+** Add 'weight' to the count of the current stack of 'L' in the table
+** of samples 'tname'. Returns false if it recorded nothing.
+*/
+static int addsample (lua_State *L, const char *tname, lua_Integer weight) {
+  luaL_Buffer b;
+  lua_Debug ar;
+  int depth = 0;
+  int level;
+  while (depth < PROFMAXDEPTH && lua_getstack(L, depth, &ar))
+    depth++;
+  if (depth == 0 || !lua_checkstack(L, LUA_MINSTACK))
+    return 0;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, tname) != LUA_TTABLE) {
+    lua_pop(L, 1);  /* not running anymore */
+    return 0;
+  }
+  luaL_buffinit(L, &b);
+  if (lua_getstack(L, depth, &ar))  /* stack was truncated? */
+    luaL_addstring(&b, "...;");
+  for (level = depth - 1; level >= 0; level--) {
+    addframe(L, &b, level);
+    if (level > 0)
+      luaL_addchar(&b, ';');
+  }
+  luaL_pushresult(&b);
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);
+  lua_pushinteger(L, lua_tointeger(L, -1) + weight);
+  lua_remove(L, -2);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);  /* table of samples */
+  return 1;
+}
+
+
+/*
+** Record the current stack of 'L' in the table of samples.
+*/
+static void takesample (lua_State *L) {
+  if (addsample(L, PROFTABLE, 1))
+    nsamples++;
+}
+
+
+#if defined(LUA_PROFILE_TIMER)
+
+static struct sigaction oldaction;
+
+
+/*
+** Hook set by the timer: take one sample and remove itself.
+*/
+static void profhook (lua_State *L, lua_Debug *ar) {
+  (void)ar;  /* not used */
+  lua_sethook(L, NULL, 0, 0);
+  takesample(L);
+}
+
+
+/*
+** Signal handler for the timer. Only sets a hook, as that is all
+** that is safe to do here ('lua_sethook' is signal safe).
+*/
+static void proftick (int i) {
+  lua_State *L = profL;
+  (void)i;  /* not used */
+  if (L != NULL)
+    lua_sethook(L, profhook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+}
+
+
+static int starttimer (lua_State *L, int interval) {
+  struct sigaction sa;
+  struct itimerval it;
+  (void)L;  /* not used */
+  sa.sa_handler = proftick;
+  sa.sa_flags = SA_RESTART;  /* do not break system calls */
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, &oldaction) != 0)
+    return 0;
+  it.it_interval.tv_sec = interval / 1000;
+  it.it_interval.tv_usec = (interval % 1000) * 1000;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    sigaction(SIGPROF, &oldaction, NULL);
+    return 0;
+  }
+  return 1;
+}
+
+
+static void stoptimer (lua_State *L) {
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+  sigaction(SIGPROF, &oldaction, NULL);
+  if (lua_gethook(L) == profhook)  /* a tick still pending? */
+    lua_sethook(L, NULL, 0, 0);
+}
+
+#else
+
+/*
+** Without timers, sample at every 'interval' * PROFCOUNT instructions.
+*/
+static void profhook (lua_State *L, lua_Debug *ar) {
+  (void)ar;  /* not used */
+  takesample(L);
+}
+
+
+static int starttimer (lua_State *L, int interval) {
+  lua_sethook(L, profhook, LUA_MASKCOUNT, interval * PROFCOUNT);
+  return 1;
+}
+
+
+static void stoptimer (lua_State *L) {
+  if (lua_gethook(L) == profhook)
+    lua_sethook(L, NULL, 0, 0);
+}
+
+#endif
+
+
+static void stopsampling (void) {
+  lua_State *co = profL;
+  if (co != NULL) {
+    profL = NULL;
+    stoptimer(co);
+  }
+}
+
+
+/*
+** Finalizer of the table of samples: closing a state being profiled
+** stops the timer. (A table left by a previous 'stop' is not current
+** anymore, and so it does not stop a newer profile.)
+*/
+static int prof_gc (lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, PROFTABLE);
+  if (lua_rawequal(L, -1, 1))
+    stopsampling();
+  return 0;
+}
+
+
+static int prof_start (lua_State *L) {
+  lua_Integer interval = luaL_optinteger(L, 1, PROFINTERVAL);
+  lua_State *mainth;
+  luaL_argcheck(L, 0 < interval && interval <= 60000, 1,
+                   "interval out of range");
+  if (profL != NULL)
+    return luaL_error(L, "profiler already running");
+  if (heapL != NULL)
+    return luaL_error(L, "cannot run the profiler while profiling the heap");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  mainth = lua_tothread(L, -1);
+  if (lua_gethook(mainth) != NULL)
+    return luaL_error(L, "cannot profile while a debug hook is set");
+  lua_newtable(L);  /* new table of samples */
+  lua_createtable(L, 0, 1);  /* its metatable */
+  lua_pushcfunction(L, prof_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, PROFTABLE);
+  nsamples = 0;
+  profL = mainth;
+  if (!starttimer(mainth, (int)interval)) {
+    profL = NULL;
+    return luaL_error(L, "cannot start profiler timer");
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int cmpstack (const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+
+/*
+** Replace the table of samples on the top of the stack by its contents
+** in collapsed-stack format (one "stack count" line per distinct stack,
+** sorted by stack).
+*/
+static void collapse (lua_State *L) {
+  luaL_Buffer b;
+  const char **stacks;
+  size_t n = 0, i;
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    n++;
+    lua_pop(L, 1);
+  }
+  stacks = (const char **)lua_newuserdatauv(L,
+                                            (n + 1) * sizeof(const char *), 0);
+  n = 0;
+  lua_pushnil(L);
+  while (lua_next(L, -3)) {  /* strings are anchored in the table */
+    stacks[n++] = lua_tostring(L, -2);
+    lua_pop(L, 1);
+  }
+  qsort(stacks, n, sizeof(const char *), cmpstack);
+  luaL_buffinit(L, &b);
+  for (i = 0; i < n; i++) {
+    lua_getfield(L, -3, stacks[i]);  /* stacks[i]'s count */
+    lua_pushfstring(L, "%s %I\n", stacks[i], lua_tointeger(L, -1));
+    lua_remove(L, -2);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  lua_replace(L, -3);  /* result replaces the table */
+  lua_pop(L, 1);  /* array of stacks */
+}
+
+
+/*
+** Stop the profiler and return its samples in collapsed-stack format,
+** plus the number of samples taken.
+*/
+static int prof_stop (lua_State *L) {
+  if (profL == NULL ||
+      lua_getfield(L, LUA_REGISTRYINDEX, PROFTABLE) != LUA_TTABLE)
+    return luaL_error(L, "profiler not running");
+  stopsampling();
+  collapse(L);
+  lua_pushinteger(L, nsamples);
+  lua_pushnil(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, PROFTABLE);  /* release samples */
+  return 2;
+}
+
+
+/*
+** {======================================================
+** Heap profiler and memory accounting
+** =======================================================
+*/
+
+
+/*
+** Hook set by the sampler: charge the pending bytes to the current
+** stack and remove itself.
+*/
+static void heaphook (lua_State *L, lua_Debug *ar) {
+  lua_Integer bytes = (lua_Integer)heappending;
+  (void)ar;  /* not used */
+  lua_sethook(L, NULL, 0, 0);
+  inheapsample = 1;
+  if (addsample(L, HEAPTABLE, bytes)) {
+    nheapsamples++;
+    heappending = 0;
+  }
+  inheapsample = 0;
+}
+
+
+/*
+** Allocation sampler. Runs inside the allocator, so it only sets a
+** hook, unless the thread already has one (its bytes then go to the
+** next sample).
+*/
+static void heapsampler (lua_State *L, size_t bytes) {
+  if (inheapsample)
+    return;
+  heappending += bytes;
+  if (lua_gethook(L) == NULL)
+    lua_sethook(L, heaphook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+}
+
+
+static void stopheap (lua_State *L) {
+  if (heapL != NULL) {
+    heapL = NULL;
+    lua_setallocsampler(L, NULL, 0);
+    if (lua_gethook(L) == heaphook)  /* a sample still pending? */
+      lua_sethook(L, NULL, 0, 0);
+  }
+}
+
+
+/*
+** Finalizer of the table of heap samples (see 'prof_gc').
+*/
+static int heap_gc (lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, HEAPTABLE);
+  if (lua_rawequal(L, -1, 1))
+    heapL = NULL;  /* the state (and its sampler) is going away */
+  return 0;
+}
+
+
+static int prof_heapstart (lua_State *L) {
+  lua_Integer rate = luaL_optinteger(L, 1, HEAPRATE);
+  lua_State *mainth;
+  luaL_argcheck(L, 0 < rate && rate <= 0x7fffffff, 1, "rate out of range");
+  if (heapL != NULL)
+    return luaL_error(L, "heap profiler already running");
+  if (profL != NULL)
+    return luaL_error(L, "cannot profile the heap while the profiler runs");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  mainth = lua_tothread(L, -1);
+  if (lua_gethook(mainth) != NULL)
+    return luaL_error(L, "cannot profile while a debug hook is set");
+  lua_newtable(L);  /* new table of samples */
+  lua_createtable(L, 0, 1);  /* its metatable */
+  lua_pushcfunction(L, heap_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, HEAPTABLE);
+  nheapsamples = 0;
+  heappending = 0;
+  heapL = mainth;
+  lua_setallocsampler(L, heapsampler, (size_t)rate);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/*
+** Stop the heap profiler and return, in collapsed-stack format, the
+** bytes allocated by each stack, plus the number of samples taken.
+*/
+static int prof_heapstop (lua_State *L) {
+  if (heapL == NULL ||
+      lua_getfield(L, LUA_REGISTRYINDEX, HEAPTABLE) != LUA_TTABLE)
+    return luaL_error(L, "heap profiler not running");
+  stopheap(heapL);
+  collapse(L);
+  lua_pushinteger(L, nheapsamples);
+  lua_pushnil(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, HEAPTABLE);  /* release samples */
+  return 2;
+}
+
+
+static lua_State *optthread (lua_State *L, int arg) {
+  if (lua_isnoneornil(L, arg))
+    return L;
+  luaL_argexpected(L, lua_type(L, arg) == LUA_TTHREAD, arg, "coroutine");
+  return lua_tothread(L, arg);
+}
+
+
+static int prof_setcontext (lua_State *L) {
+  lua_Integer ctx = luaL_checkinteger(L, 1);
+  lua_State *co = optthread(L, 2);
+  luaL_argcheck(L, 0 <= ctx && ctx < LUA_NUMMEMCTX, 1,
+                   "context out of range");
+  lua_pushinteger(L, lua_setmemctx(co, (int)ctx));
+  return 1;
+}
+
+
+static int prof_context (lua_State *L) {
+  lua_pushinteger(L, lua_getmemctx(optthread(L, 1)));
+  return 1;
+}
+
+
+static int prof_memstats (lua_State *L) {
+  lua_Integer ctx = luaL_checkinteger(L, 1);
+  lua_Unsigned bytes, count;
+  luaL_argcheck(L, 0 <= ctx && ctx < LUA_NUMMEMCTX, 1,
+                   "context out of range");
+  if (!lua_memctxstats(L, (int)ctx, &bytes, &count))
+    bytes = count = 0;  /* accounting is off */
+  lua_pushinteger(L, (lua_Integer)bytes);
+  lua_pushinteger(L, (lua_Integer)count);
+  return 2;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Coverage
+** =======================================================
+*/
+
+
+static int covwriter (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;  /* not used */
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+/*
+** Return the coverage results so far, in lcov format.
+*/
+static int prof_coverage (lua_State *L) {
+  luaL_Buffer B;
+  luaL_buffinit(L, &B);
+  if (lua_coverage(L, covwriter, &B) != 0)
+    return luaL_error(L, "cannot report coverage now");
+  luaL_pushresult(&B);
+  return 1;
+}
+
+
+static int prof_coveragestart (lua_State *L) {
+  lua_setcoverage(L, 1);
+  return 0;
+}
+
+
+static int prof_coveragestop (lua_State *L) {
+  lua_setcoverage(L, 0);
+  return prof_coverage(L);
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg prof_funcs[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"heapstart", prof_heapstart},
+  {"heapstop", prof_heapstop},
+  {"setcontext", prof_setcontext},
+  {"context", prof_context},
+  {"memstats", prof_memstats},
+  {"coveragestart", prof_coveragestart},
+  {"coveragestop", prof_coveragestop},
+  {"coverage", prof_coverage},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_profiler (lua_State *L) {
+  luaL_newlib(L, prof_funcs);
+  return 1;
+}
+
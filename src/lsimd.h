@@ -0,0 +1,244 @@
+/*
+** $Id: lsimd.h $
+** Vectorized kernels for string operations
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lsimd_h
+#define lsimd_h
+
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+
+
+/*
+** Each kernel handles a prefix of its input, 16 bytes at a time, and
+** returns how much of it was handled; the caller does the rest with
+** its usual scalar code. Vectors are SSE2 on x86_64, NEON on ARM64,
+** or simd128 on WebAssembly (when compiled with '-msimd128'). On other
+** targets, or with LUA_NOSIMD defined, the kernels handle nothing.
+*/
+
+#if !defined(LUA_NOSIMD) && defined(__GNUC__)
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define LUAI_SIMD	"sse2"
+
+typedef __m128i lsimd_V;
+
+#define vload(p)	_mm_loadu_si128((const __m128i *)(const void *)(p))
+#define vstore(p,v)	_mm_storeu_si128((__m128i *)(void *)(p), v)
+#define vsplat(c)	_mm_set1_epi8((char)(c))
+#define veq(a,b)	_mm_cmpeq_epi8(a, b)
+#define vgt(a,b)	_mm_cmpgt_epi8(a, b)  /* signed bytes */
+#define vand(a,b)	_mm_and_si128(a, b)
+#define vor(a,b)	_mm_or_si128(a, b)
+#define vxor(a,b)	_mm_xor_si128(a, b)
+#define vmask(v)	((unsigned)_mm_movemask_epi8(v))
+
+static __inline__ lsimd_V vrev (lsimd_V v) {
+  v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+#define LUAI_SIMD	"neon"
+
+typedef uint8x16_t lsimd_V;
+
+#define vload(p)	vld1q_u8((const uint8_t *)(const void *)(p))
+#define vstore(p,v)	vst1q_u8((uint8_t *)(void *)(p), v)
+#define vsplat(c)	vdupq_n_u8((uint8_t)(c))
+#define veq(a,b)	vceqq_u8(a, b)
+#define vgt(a,b)	vcgtq_s8(vreinterpretq_s8_u8(a), vreinterpretq_s8_u8(b))
+#define vand(a,b)	vandq_u8(a, b)
+#define vor(a,b)	vorrq_u8(a, b)
+#define vxor(a,b)	veorq_u8(a, b)
+
+/* NEON has no 'movemask': shift each high bit to its place in a byte */
+static __inline__ unsigned vmask (lsimd_V v) {
+  static const int8_t shifts[16] =
+    {0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7};
+  uint8x16_t b = vshlq_u8(vshrq_n_u8(v, 7), vld1q_s8(shifts));
+  return (unsigned)vaddv_u8(vget_low_u8(b)) |
+         ((unsigned)vaddv_u8(vget_high_u8(b)) << 8);
+}
+
+static __inline__ lsimd_V vrev (lsimd_V v) {
+  v = vrev64q_u8(v);
+  return vextq_u8(v, v, 8);
+}
+
+#elif defined(__wasm_simd128__)
+
+#include <wasm_simd128.h>
+
+#define LUAI_SIMD	"simd128"
+
+typedef v128_t lsimd_V;
+
+#define vload(p)	wasm_v128_load(p)
+#define vstore(p,v)	wasm_v128_store(p, v)
+#define vsplat(c)	wasm_i8x16_splat((int8_t)(c))
+#define veq(a,b)	wasm_i8x16_eq(a, b)
+#define vgt(a,b)	wasm_i8x16_gt(a, b)  /* signed bytes */
+#define vand(a,b)	wasm_v128_and(a, b)
+#define vor(a,b)	wasm_v128_or(a, b)
+#define vxor(a,b)	wasm_v128_xor(a, b)
+#define vmask(v)	((unsigned)wasm_i8x16_bitmask(v))
+#define vrev(v)  \
+	wasm_i8x16_shuffle(v, v, 15, 14, 13, 12, 11, 10, 9, 8, \
+	                         7, 6, 5, 4, 3, 2, 1, 0)
+
+#endif
+
+#endif
+
+
+#if defined(LUAI_SIMD)
+
+#define VSIZE		16
+#define lsimd_ctz(m)	__builtin_ctz(m)
+
+
+/*
+** Length of the longest prefix of 's' with only ASCII bytes.
+*/
+static __inline__ size_t lsimd_asciilen (const char *s, size_t n) {
+  size_t i;
+  for (i = 0; i + VSIZE <= n; i += VSIZE) {
+    unsigned m = vmask(vload(s + i));  /* bytes with the high bit set */
+    if (m != 0)
+      return i + (size_t)lsimd_ctz(m);
+  }
+  return i;
+}
+
+
+/*
+** Length of the longest prefix of 's' with only printable ASCII bytes
+** other than '"' and '\\' (bytes that '%q' copies as they are).
+*/
+static __inline__ size_t lsimd_plainlen (const char *s, size_t n) {
+  const lsimd_V lo = vsplat(0x1F), hi = vsplat(0x7F);
+  const lsimd_V quote = vsplat('"'), bslash = vsplat('\\');
+  size_t i;
+  for (i = 0; i + VSIZE <= n; i += VSIZE) {
+    lsimd_V v = vload(s + i);
+    lsimd_V ok = vand(vgt(v, lo), vgt(hi, v));
+    lsimd_V bad = vor(veq(v, quote), veq(v, bslash));
+    unsigned m = (~vmask(ok) | vmask(bad)) & 0xFFFFu;
+    if (m != 0)
+      return i + (size_t)lsimd_ctz(m);
+  }
+  return i;
+}
+
+
+/*
+** Length of the longest prefix of 's' that a JSON string holds as it
+** is: bytes from 0x20 on, other than '"' and '\\' (see 'ljson.h').
+*/
+static __inline__ size_t lsimd_jsonlen (const char *s, size_t n) {
+  const lsimd_V neg = vsplat(-1), space = vsplat(0x20);
+  const lsimd_V quote = vsplat('"'), bslash = vsplat('\\');
+  size_t i;
+  for (i = 0; i + VSIZE <= n; i += VSIZE) {
+    lsimd_V v = vload(s + i);
+    lsimd_V ctrl = vand(vgt(v, neg), vgt(space, v));  /* 0x00-0x1F */
+    unsigned m = vmask(vor(ctrl, vor(veq(v, quote), veq(v, bslash))));
+    if (m != 0)
+      return i + (size_t)lsimd_ctz(m);
+  }
+  return i;
+}
+
+
+/*
+** Convert the case of 's' into 'd' ('upper' selects the direction).
+** Blocks with only ASCII bytes are converted as vectors, which the
+** caller must allow only if the locale maps ASCII letters as ASCII
+** does; other blocks go through 'tolower'/'toupper'.
+*/
+static __inline__ size_t lsimd_case (char *d, const char *s, size_t n,
+                                      int upper) {
+  const lsimd_V first = vsplat(upper ? 'a' - 1 : 'A' - 1);
+  const lsimd_V last = vsplat(upper ? 'z' + 1 : 'Z' + 1);
+  const lsimd_V bit = vsplat(0x20);  /* case bit of ASCII letters */
+  size_t i;
+  for (i = 0; i + VSIZE <= n; i += VSIZE) {
+    lsimd_V v = vload(s + i);
+    if (vmask(v) == 0) {  /* only ASCII? */
+      lsimd_V letter = vand(vgt(v, first), vgt(last, v));
+      vstore(d + i, vxor(v, vand(letter, bit)));
+    }
+    else {
+      size_t k;
+      for (k = i; k < i + VSIZE; k++)
+        d[k] = (char)(upper ? toupper((unsigned char)s[k])
+                             : tolower((unsigned char)s[k]));
+    }
+  }
+  return i;
+}
+
+
+/*
+** Write into 'd' the last bytes of 's' in reverse order.
+*/
+static __inline__ size_t lsimd_reverse (char *d, const char *s, size_t n) {
+  size_t i;
+  for (i = 0; i + VSIZE <= n; i += VSIZE)
+    vstore(d + i, vrev(vload(s + n - i - VSIZE)));
+  return i;
+}
+
+
+/*
+** Search for 'p' (with 'm' >= 2 bytes) in 's', testing its first and
+** last bytes at 16 positions at a time, and comparing the whole pattern
+** only where both match. Sets '*done' to the number of positions
+** already searched when not found.
+*/
+static __inline__ const char *lsimd_find (const char *s, size_t n,
+                                          const char *p, size_t m,
+                                          size_t *done) {
+  const lsimd_V first = vsplat(p[0]);
+  const lsimd_V last = vsplat(p[m - 1]);
+  size_t i;
+  for (i = 0; i + m - 1 + VSIZE <= n; i += VSIZE) {
+    unsigned mask = vmask(vand(veq(vload(s + i), first),
+                               veq(vload(s + i + m - 1), last)));
+    while (mask != 0) {
+      size_t pos = i + (size_t)lsimd_ctz(mask);
+      if (memcmp(s + pos + 1, p + 1, m - 2) == 0)
+        return s + pos;
+      mask &= mask - 1;  /* clear lowest bit */
+    }
+  }
+  *done = i;
+  return NULL;
+}
+
+#else
+
+#define lsimd_asciilen(s,n)		((void)(s), (void)(n), 0)
+#define lsimd_plainlen(s,n)		((void)(s), (void)(n), 0)
+#define lsimd_jsonlen(s,n)		((void)(s), (void)(n), 0)
+#define lsimd_case(d,s,n,u)		((void)(d), (void)(s), (void)(n), 0)
+#define lsimd_reverse(d,s,n)		((void)(d), (void)(s), (void)(n), 0)
+#define lsimd_find(s,n,p,m,done)	((void)(s), (void)(n), (void)(p), \
+					 (void)(m), *(done) = 0, NULL)
+
+#endif
+
+#endif
@@ -26,6 +26,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 
 
 
@@ -116,6 +117,31 @@ CallInfo *luaE_extendCI (lua_State *L) {
 }
 
 
+/*
+** Append free CallInfo structures to the end of the 'ci' list until
+** it has at least 'n' items, so that calls up to that depth do not
+** allocate. Does not raise errors; returns 0 if memory runs out.
+*/
+int luaE_reserveCI (lua_State *L, int n) {
+  CallInfo *ci = L->ci;
+  while (ci->next != NULL)  /* go to the end of the list */
+    ci = ci->next;
+  while (L->nci < n) {
+    CallInfo *nci = cast(CallInfo *,
+                         luaM_realloc_(L, NULL, 0, sizeof(CallInfo)));
+    if (l_unlikely(nci == NULL))
+      return 0;
+    ci->next = nci;
+    nci->previous = ci;
+    nci->next = NULL;
+    nci->u.l.trap = 0;
+    L->nci++;
+    ci = nci;
+  }
+  return 1;
+}
+
+
 /*
 ** free all CallInfo structures not in use by a thread
 */
@@ -133,14 +159,15 @@ static void freeCI (lua_State *L) {
 
 /*
 ** free half of the CallInfo structures not in use by a thread,
-** keeping the first one.
+** keeping the first one and never going below 'L->cireserve' items.
 */
 void luaE_shrinkCI (lua_State *L) {
   CallInfo *ci = L->ci->next;  /* first free CallInfo */
   CallInfo *next;
   if (ci == NULL)
     return;  /* no extra elements */
-  while ((next = ci->next) != NULL) {  /* two extra elements? */
+  while (L->nci > L->cireserve &&  /* not below reserved size? */
+         (next = ci->next) != NULL) {  /* two extra elements? */
     CallInfo *next2 = next->next;  /* next's next */
     ci->next = next2;  /* remove next from the list */
     L->nci--;
@@ -177,15 +204,16 @@ LUAI_FUNC void luaE_incCstack (lua_State *L) {
 }
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
+/*
+** Erase the whole stack of 'L1' and make its first 'ci' the only one.
+*/
+static void resetstack (lua_State *L1) {
   int i; CallInfo *ci;
-  /* initialize stack array */
-  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
-  L1->tbclist.p = L1->stack.p;
-  for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
-    setnilvalue(s2v(L1->stack.p + i));  /* erase new stack */
-  L1->top.p = L1->stack.p;
-  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
+  StkId st = L1->stack.p;
+  for (i = 0; i < stacksize(L1) + EXTRA_STACK; i++)
+    setnilvalue(s2v(st + i));  /* erase stack */
+  L1->tbclist.p = st;
+  L1->top.p = st;
   /* initialize first ci */
   ci = &L1->base_ci;
   ci->next = ci->previous = NULL;
@@ -200,6 +228,14 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+static void stack_init (lua_State *L1, lua_State *L) {
+  /* initialize stack array */
+  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
+  resetstack(L1);
+}
+
+
 static void freestack (lua_State *L) {
   if (L->stack.p == NULL)
     return;  /* stack not completely built yet */
@@ -222,6 +258,9 @@ static void init_registry (lua_State *L, global_State *g) {
   setthvalue(L, &registry->array[LUA_RIDX_MAINTHREAD - 1], L);
   /* registry[LUA_RIDX_GLOBALS] = new table (table of globals) */
   sethvalue(L, &registry->array[LUA_RIDX_GLOBALS - 1], luaH_new(L));
+  /* registry[LUA_RIDX_TYPEDARRAY] = metatable for typed arrays */
+  g->tamt = luaH_new(L);
+  sethvalue(L, &registry->array[LUA_RIDX_TYPEDARRAY - 1], g->tamt);
 }
 
 
@@ -251,6 +290,9 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->stack.p = NULL;
   L->ci = NULL;
   L->nci = 0;
+  L->cireserve = 0;
+  L->stackreserve = 0;
+  L->stackgrew = 0;
   L->twups = L;  /* thread has no upvalues */
   L->nCcalls = 0;
   L->errorJmp = NULL;
@@ -263,11 +305,13 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->status = LUA_OK;
   L->errfunc = 0;
   L->oldpc = 0;
+  L->memctx = 0;
 }
 
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  g->maxthreadpool = 0;  /* no more threads kept for reuse */
   if (!completestate(g))  /* closing a partially built state? */
     luaC_freeallobjects(L);  /* just collect its objects */
   else {  /* closing a fully built state */
@@ -276,8 +320,23 @@ static void close_state (lua_State *L) {
     luaC_freeallobjects(L);  /* collect all objects */
     luai_userstateclose(L);
   }
+  luaE_flushthreadpool(L, 0);
+  luaD_freeparsebuffers(L);
+  if (G(L)->lookups != NULL)
+    luaM_freearray(L, G(L)->lookups, LUAI_LOOKUPCACHE);
+  if (G(L)->errcache != NULL)
+    luaM_freearray(L, G(L)->errcache, LUAI_ERRCACHE);
+  luaM_freearray(L, G(L)->covered, G(L)->sizecovered);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  if (G(L)->memctx != NULL) {
+    MemCtx *mc = G(L)->memctx;
+    G(L)->memctx = NULL;  /* stop accounting */
+    luaM_freearray(L, mc, LUA_NUMMEMCTX);
+  }
+  if (G(L)->strt.ohash != NULL)
+    luaM_freearray(L, G(L)->strt.ohash, G(L)->strt.osize);
   freestack(L);
+  luaC_setreleasef(L, NULL, NULL);  /* release pending blocks */
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
@@ -285,38 +344,96 @@ static void close_state (lua_State *L) {
 
 LUA_API lua_State *lua_newthread (lua_State *L) {
   global_State *g = G(L);
-  GCObject *o;
   lua_State *L1;
   lua_lock(L);
   luaC_checkGC(L);
-  /* create new thread */
-  o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
-  L1 = gco2th(o);
+  L1 = g->threadpool;
+  if (L1 != NULL) {  /* reuse a collected thread? */
+    StkIdRel stack = L1->stack;
+    StkIdRel stack_last = L1->stack_last;
+    g->threadpool = L1->twups;
+    g->nthreadpool--;
+    luaC_linkobj(g, obj2gco(L1), LUA_VTHREAD);
+    preinit_thread(L1, g);
+    L1->stack = stack;  /* keep its stack */
+    L1->stack_last = stack_last;
+  }
+  else {  /* create new thread */
+    GCObject *o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
+    L1 = gco2th(o);
+    preinit_thread(L1, g);
+  }
   /* anchor it on L stack */
   setthvalue2s(L, L->top.p, L1);
   api_incr_top(L);
-  preinit_thread(L1, g);
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
   resethookcount(L1);
+  L1->memctx = L->memctx;  /* allocate in the same context */
   /* initialize L1 extra space */
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (L1->stack.p != NULL)  /* reused thread? */
+    resetstack(L1);
+  else
+    stack_init(L1, L);  /* init stack */
   lua_unlock(L);
   return L1;
 }
 
 
+/*
+** Try to keep collected thread 'L1' in the thread pool, with its
+** stack shrunk to at most 'g->poolstacksize'. Emergency collections
+** do not keep threads, as they need all the memory they can get.
+*/
+static int poolthread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
+  if (g->nthreadpool >= g->maxthreadpool || g->gcemergency ||
+      L1->stack.p == NULL)
+    return 0;
+  L1->ci = &L1->base_ci;  /* free the entire 'ci' list */
+  freeCI(L1);
+  lua_assert(L1->nci == 0);
+  L1->top.p = L1->tbclist.p = L1->stack.p;
+  if (stacksize(L1) > g->poolstacksize &&
+      !luaD_reallocstack(L1, g->poolstacksize, 0))
+    return 0;
+  L1->twups = g->threadpool;
+  g->threadpool = L1;
+  g->nthreadpool++;
+  return 1;
+}
+
+
 void luaE_freethread (lua_State *L, lua_State *L1) {
-  LX *l = fromstate(L1);
   luaF_closeupval(L1, L1->stack.p);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
-  freestack(L1);
-  luaM_free(L, l);
+  if (!poolthread(L, L1)) {
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
+}
+
+
+/*
+** Free the threads in the thread pool beyond the first 'keep' ones.
+*/
+void luaE_flushthreadpool (lua_State *L, int keep) {
+  global_State *g = G(L);
+  lua_State **p = &g->threadpool;
+  while (*p != NULL && keep-- > 0)
+    p = &(*p)->twups;
+  while (*p != NULL) {
+    lua_State *L1 = *p;
+    *p = L1->twups;
+    g->nthreadpool--;
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
 }
 
 
@@ -376,11 +493,17 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->ud = ud;
   g->warnf = NULL;
   g->ud_warn = NULL;
+  g->releasef = NULL;
+  g->ud_release = NULL;
+  g->nrelease = 0;
+  g->gcreleasing = 0;
   g->mainthread = L;
   g->seed = luai_makeseed(L);
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.ohash = NULL;
+  g->strt.osize = g->strt.moved = 0;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->gcstate = GCSpause;
@@ -397,13 +520,54 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->lastatomic = 0;
+  g->securekey = LUAI_SECUREKEY;
+  g->optlevel = 0;
+  g->budget = MAX_LMEM;  /* no budget */
+  g->hasbudget = 0;
+  g->memlimit = 0;
+  g->memctx = NULL;
+  g->allocsampler = NULL;
+  g->allocrate = g->allocnext = 0;
+  for (i = 0; i < LUA_NUMINTRS; i++)
+    g->intrinsics[i] = NULL;
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
+  g->maxthreadpool = LUAI_THREADPOOL;
+  g->poolstacksize = LUAI_POOLSTACK;
+  g->parsebuffers = NULL;
+  g->lookupepoch = 1;
+  g->lookups = NULL;
+  g->frozen = NULL;
+  g->errcache = NULL;
+  g->coverage = 0;
+  g->ncovered = g->sizecovered = 0;
+  g->covered = NULL;
+  g->ephpending = NULL;
+  g->nephpending = g->sizeephpending = 0;
+  g->ephoverflow = 0;
+#if defined(LUAI_ICSTATS)
+  g->ichits = g->icmisses = 0;
+#endif
+#if defined(LUAI_VMSTATS)
+  g->vmlastop = NUM_OPCODES;
+  memset(g->vmops, 0, sizeof(g->vmops));
+  memset(g->vmpairs, 0, sizeof(g->vmpairs));
+#endif
   setivalue(&g->nilvalue, 0);  /* to signal that state is not yet built */
   setgcparam(g->gcpause, LUAI_GCPAUSE);
   setgcparam(g->gcstepmul, LUAI_GCMUL);
   g->gcstepsize = LUAI_GCSTEPSIZE;
   setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
   g->genminormul = LUAI_GENMINORMUL;
+  g->gcadaptive = 0;
+  memset(&g->gcadapt, 0, sizeof(g->gcadapt));
+  g->gcphase = GCPNONE;
+  g->gcclock = 0;
+  g->gcbytes = 0;
+  memset(g->gccycle, 0, sizeof(g->gccycle));
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+  g->tamt = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
@@ -18,6 +18,10 @@ typedef struct CallInfo CallInfo;
 #include "ltm.h"
 #include "lzio.h"
 
+#if defined(LUAI_VMSTATS)
+#include "lopcodes.h"
+#endif
+
 
 /*
 ** Some notes about garbage-collected objects: All objects in Lua must
@@ -120,6 +124,7 @@ typedef struct CallInfo CallInfo;
 
 
 struct lua_longjmp;  /* defined in ldo.c */
+struct ParseBuffers;  /* defined in ldo.c */
 
 
 /*
@@ -147,15 +152,37 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define stacksize(th)	cast_int((th)->stack_last.p - (th)->stack.p)
 
 
+/*
+** Collected threads are kept in a pool, to be reused by 'lua_newthread'.
+** LUAI_THREADPOOL is the default number of threads kept, and
+** LUAI_POOLSTACK is the default size to which their stacks are shrunk.
+** (Both can be changed with option LUA_GCTHREADPOOL of 'lua_gc'.)
+*/
+#if !defined(LUAI_THREADPOOL)
+#define LUAI_THREADPOOL		64
+#endif
+
+#if !defined(LUAI_POOLSTACK)
+#define LUAI_POOLSTACK		(8*LUA_MINSTACK)
+#endif
+
+
 /* kinds of Garbage Collection */
 #define KGC_INC		0	/* incremental gc */
 #define KGC_GEN		1	/* generational gc */
 
 
+/*
+** While the table grows, strings move incrementally from 'ohash' to
+** 'hash': buckets of 'ohash' below 'moved' are already empty.
+*/
 typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
   int size;
+  TString **ohash;  /* array being rehashed into 'hash' (or NULL) */
+  int osize;  /* size of 'ohash' */
+  int moved;  /* number of buckets of 'ohash' already rehashed */
 } stringtable;
 
 
@@ -248,6 +275,87 @@ struct CallInfo {
 #define getoah(st)	((st) & CIST_OAH)
 
 
+/* number of blocks given at once to 'releasef' (see 'lua_setreleasef') */
+#if !defined(LUAI_RELEASEBATCH)
+#define LUAI_RELEASEBATCH	128
+#endif
+
+
+/*
+** State of the adaptive collector (see 'adaptminor' in file 'lgc.c')
+*/
+typedef struct GCAdapt {
+  lu_mem base;  /* memory in use after the last collection */
+  lu_mem majorwork;  /* objects traversed by the last major collection */
+  lu_mem live;  /* memory in use after the last incremental cycle */
+  lu_mem count[LUA_GCANUMCOUNTS];  /* decisions taken */
+  lu_byte survival;  /* moving average of the survival rate (%) */
+  lu_byte streak;  /* consecutive collections suggesting a mode switch */
+} GCAdapt;
+
+
+/*
+** Cache of '__index' lookups through chains of tables (see
+** 'luaV_finishget'). An entry maps a metatable and a short-string key
+** to the slot holding the result, or to NULL when the result is nil.
+** An entry is valid only while its 'epoch' is the current one, which
+** changes when a table in a cached chain changes (see 'BITLOOKUP') and
+** at each collection. LUAI_LOOKUPCACHE (a power of 2) is the number of
+** entries; the cache is allocated by the first lookup that uses it.
+*/
+#if !defined(LUAI_LOOKUPCACHE)
+#define LUAI_LOOKUPCACHE	256
+#endif
+
+typedef struct LookupEntry {
+  struct Table *mt;
+  TString *key;
+  const TValue *slot;
+  unsigned int epoch;
+} LookupEntry;
+
+
+/*
+** Cache of messages of type errors raised by Lua functions (see
+** 'typeerror' in ldebug.c). Such a message depends only on the faulty
+** instruction and operand, the operation, and the type name, so code
+** that keeps catching the same error builds its message only once.
+** Entries hold no references to collectable objects: each collection
+** empties the cache. LUAI_ERRCACHE (a power of 2) is the number of
+** entries; the cache is allocated by the first error that uses it.
+*/
+#if !defined(LUAI_ERRCACHE)
+#define LUAI_ERRCACHE	64
+#endif
+
+typedef struct ErrorEntry {
+  const Instruction *pc;  /* 'savedpc' at the error */
+  const char *op;  /* operation */
+  const char *tname;  /* type name of the operand */
+  TString *msg;  /* message (NULL for an empty entry) */
+  int slot;  /* operand (see 'operandslot') */
+} ErrorEntry;
+
+
+/*
+** Entry 'i' of the hash part of ephemeron table 'h', with a white key
+** and a white value when recorded (see 'convergeephemerons').
+*/
+typedef struct EphEntry {
+  struct Table *h;
+  unsigned int i;
+} EphEntry;
+
+
+/*
+** Allocations made under one accounting context (see 'lua_setmemctx')
+*/
+typedef struct MemCtx {
+  lu_mem bytes;  /* bytes allocated */
+  lu_mem count;  /* number of allocations */
+} MemCtx;
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -273,6 +381,14 @@ typedef struct global_State {
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
   lu_byte gcstepsize;  /* (log2 of) GC granularity */
+  lu_byte gcadaptive;  /* true if the collector chooses its mode */
+  lu_byte gcreleasing;  /* true if frees go to 'releasef' */
+  GCAdapt gcadapt;  /* state of the adaptive collector */
+  lu_byte gcphase;  /* phase being timed (see 'setphase' in file 'lgc.c') */
+  double gcclock;  /* time when 'gcphase' started */
+  lu_mem gcbytes;  /* memory in use when 'gcphase' started */
+  lua_GCPhase gccycle[LUA_GCNUMPHASES];  /* current collection */
+  lua_GCStats gcstats;  /* statistics of the collector */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -281,6 +397,10 @@ typedef struct global_State {
   GCObject *weak;  /* list of tables with weak values */
   GCObject *ephemeron;  /* list of ephemeron tables (weak keys) */
   GCObject *allweak;  /* list of all-weak tables */
+  EphEntry *ephpending;  /* white->white entries found in atomic phase */
+  unsigned int nephpending;  /* number of entries in 'ephpending' */
+  unsigned int sizeephpending;  /* size of 'ephpending' */
+  lu_byte ephoverflow;  /* true if 'ephpending' could not grow */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
   /* fields for generational collector */
@@ -297,9 +417,47 @@ typedef struct global_State {
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTYPES];  /* metatables for basic types */
+  struct Table *tamt;  /* metatable shared by all typed arrays */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  lua_Release releasef;  /* releases memory of dead objects (if not NULL) */
+  void *ud_release;      /* auxiliary data to 'releasef' */
+  int nrelease;  /* number of blocks in 'relblocks' */
+  void *relblocks[LUAI_RELEASEBATCH];  /* blocks waiting for 'releasef' */
+  size_t relsizes[LUAI_RELEASEBATCH];  /* their sizes */
+  l_uint32 securekey;  /* key for secure functions (see 'luaU_scramble') */
+  lu_byte optlevel;  /* level of the optimizer (see 'luaK_optimize') */
+  l_mem budget;  /* steps left to run (see 'lua_setbudget') */
+  lu_byte hasbudget;  /* true iff 'budget' was set */
+  size_t memlimit;  /* limit for 'totalbytes' (0 if none) */
+  MemCtx *memctx;  /* counters per accounting context (NULL if unused) */
+  lua_AllocSampler allocsampler;  /* called every 'allocrate' bytes */
+  l_mem allocrate;  /* bytes between samples */
+  l_mem allocnext;  /* bytes until next sample */
+  lua_CFunction intrinsics[LUA_NUMINTRS];  /* see 'lua_setintrinsic' */
+  struct lua_State *threadpool;  /* collected threads kept for reuse */
+  int nthreadpool;  /* number of threads in 'threadpool' */
+  int maxthreadpool;  /* maximum number of threads in 'threadpool' */
+  int poolstacksize;  /* maximum stack size of threads in 'threadpool' */
+  struct ParseBuffers *parsebuffers;  /* kept for the next parse */
+#if defined(LUAI_ICSTATS)
+  lu_mem ichits;  /* inline-cache hits (see 'luaV_fastgetic') */
+  lu_mem icmisses;  /* inline-cache misses */
+#endif
+  unsigned int lookupepoch;  /* current epoch of 'lookups' */
+  LookupEntry *lookups;  /* lookup cache (NULL until first used) */
+  struct Table *frozen;  /* set of frozen tables (NULL until first used) */
+  ErrorEntry *errcache;  /* error cache (NULL until first used) */
+  lu_byte coverage;  /* true while collecting coverage */
+  int ncovered;  /* number of chunks in 'covered' */
+  int sizecovered;  /* size of 'covered' */
+  struct Proto **covered;  /* chunks loaded under coverage */
+#if defined(LUAI_VMSTATS)
+  lu_byte vmlastop;  /* last opcode executed (NUM_OPCODES at start) */
+  lu_mem vmops[NUM_OPCODES];  /* executions of each opcode */
+  lu_mem vmpairs[NUM_OPCODES + 1][NUM_OPCODES];  /* ... of each pair */
+#endif
 } global_State;
 
 
@@ -310,7 +468,11 @@ struct lua_State {
   CommonHeader;
   lu_byte status;
   lu_byte allowhook;
+  lu_byte stackgrew;  /* stack grew since last call to 'luaD_shrinkstack' */
+  lu_byte memctx;  /* accounting context for its allocations */
   unsigned short nci;  /* number of items in 'ci' list */
+  unsigned short cireserve;  /* minimum number of items in 'ci' list */
+  int stackreserve;  /* minimum stack size kept by 'luaD_shrinkstack' */
   StkIdRel top;  /* first free slot in the stack */
   global_State *l_G;
   CallInfo *ci;  /* call info for current function */
@@ -395,8 +557,10 @@ union GCUnion {
 
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaE_flushthreadpool (lua_State *L, int keep);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
+LUAI_FUNC int luaE_reserveCI (lua_State *L, int n);
 LUAI_FUNC void luaE_checkcstack (lua_State *L);
 LUAI_FUNC void luaE_incCstack (lua_State *L);
 LUAI_FUNC void luaE_warning (lua_State *L, const char *msg, int tocont);
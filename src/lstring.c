@@ -40,6 +40,32 @@ int luaS_eqlngstr (TString *a, TString *b) {
 }
 
 
+/*
+** {======================================================
+** Hash functions for strings. LUAI_STRHASH selects one at build time:
+** 0: the original Lua hash, one byte at a time;
+** 1: a multiply-and-fold hash that reads eight bytes at a time
+**    (default when there is a 64-bit integer type);
+** 2: SipHash-1-3, a keyed hash for strings from untrusted sources,
+**    which resists hash flooding. Its 128-bit key comes from the
+**    seed of the state (see 'luai_makeseed') and LUAI_HASHKEY, a
+**    secret that can be set at build time.
+** All of them depend on the seed, and none on the byte order other
+** than through the values they produce.
+** =======================================================
+*/
+
+#if !defined(LUAI_STRHASH)
+#if defined(UINT64_MAX)
+#define LUAI_STRHASH	1
+#else
+#define LUAI_STRHASH	0
+#endif
+#endif
+
+
+#if LUAI_STRHASH == 0
+
 unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   unsigned int h = seed ^ cast_uint(l);
   for (; l > 0; l--)
@@ -47,13 +73,140 @@ unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   return h;
 }
 
+#else
+
+typedef uint64_t l_uint64;
+
+static l_uint64 read64 (const char *p) {
+  l_uint64 w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+#endif
+
+
+#if LUAI_STRHASH == 1
+
+#define HK1	UINT64_C(0x9e3779b97f4a7c15)
+#define HK2	UINT64_C(0xd6e8feb86659fd93)
+
+static l_uint64 read32 (const char *p) {
+  l_uint32 w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static l_uint64 hashmix (l_uint64 a, l_uint64 b) {
+  a ^= b * HK1;
+  a ^= a >> 32;
+  a *= HK2;
+  return a ^ (a >> 29);
+}
+
+
+/*
+** Strings up to 16 bytes are read as two (possibly overlapping) words
+** at their start and end; the bytes of strings up to 3 bytes long
+** form a single word. Longer strings are read 16 bytes at a time.
+*/
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  l_uint64 h = hashmix(seed, l);
+  l_uint64 a, b;
+  if (l <= 16) {
+    if (l >= 8) {
+      a = read64(str);
+      b = read64(str + l - 8);
+    }
+    else if (l >= 4) {
+      a = read32(str);
+      b = read32(str + l - 4);
+    }
+    else if (l > 0) {
+      a = (cast(l_uint64, cast_byte(str[0])) << 16) |
+          (cast(l_uint64, cast_byte(str[l >> 1])) << 8) |
+          cast_byte(str[l - 1]);
+      b = 0;
+    }
+    else
+      a = b = 0;
+  }
+  else {
+    const char *p = str;
+    size_t n = l;
+    for (; n > 16; p += 16, n -= 16)
+      h = hashmix(h ^ read64(p), read64(p + 8));
+    a = read64(str + l - 16);  /* last 16 bytes (may overlap) */
+    b = read64(str + l - 8);
+  }
+  h = hashmix(h ^ a, b);
+  return cast_uint(h ^ (h >> 32));
+}
+
+#elif LUAI_STRHASH == 2
+
+#if !defined(LUAI_HASHKEY)
+#define LUAI_HASHKEY	UINT64_C(0x736f6d6570736575)
+#endif
+
+#define rotl64(x,b)	(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define sipround(v0,v1,v2,v3) { \
+  v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32); \
+  v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2; \
+  v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0; \
+  v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32); }
+
+
+/* SipHash-1-3 of 'str' with key (k0, k1) */
+static l_uint64 siphash (const char *str, size_t l, l_uint64 k0,
+                                                    l_uint64 k1) {
+  l_uint64 v0 = k0 ^ UINT64_C(0x736f6d6570736575);
+  l_uint64 v1 = k1 ^ UINT64_C(0x646f72616e646f6d);
+  l_uint64 v2 = k0 ^ UINT64_C(0x6c7967656e657261);
+  l_uint64 v3 = k1 ^ UINT64_C(0x7465646279746573);
+  l_uint64 m = cast(l_uint64, l) << 56;
+  size_t n = l;
+  int i;
+  for (; n >= 8; str += 8, n -= 8) {
+    l_uint64 w = read64(str);
+    v3 ^= w;
+    sipround(v0, v1, v2, v3);
+    v0 ^= w;
+  }
+  for (i = 0; i < cast_int(n); i++)  /* last bytes, little endian */
+    m |= cast(l_uint64, cast_byte(str[i])) << (8 * i);
+  v3 ^= m;
+  sipround(v0, v1, v2, v3);
+  v0 ^= m;
+  v2 ^= 0xff;
+  sipround(v0, v1, v2, v3);
+  sipround(v0, v1, v2, v3);
+  sipround(v0, v1, v2, v3);
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  l_uint64 k0 = LUAI_HASHKEY ^ (seed * UINT64_C(0x9e3779b97f4a7c15));
+  l_uint64 k1 = rotl64(k0, 29) ^ UINT64_C(0xbf58476d1ce4e5b9);
+  l_uint64 h = siphash(str, l, k0, k1);
+  return cast_uint(h ^ (h >> 32));
+}
+
+#elif LUAI_STRHASH != 0
+#error "invalid value for LUAI_STRHASH"
+#endif
+
+/* }====================================================== */
+
 
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_VLNGSTR);
-  if (ts->extra == 0) {  /* no hash? */
+  if ((ts->extra & 1) == 0) {  /* no hash? */
     size_t len = ts->u.lnglen;
     ts->hash = luaS_hash(getlngstr(ts), len, ts->hash);
-    ts->extra = 1;  /* now it has its hash */
+    ts->extra |= 1;  /* now it has its hash */
   }
   return ts->hash;
 }
@@ -77,6 +230,67 @@ static void tablerehash (TString **vect, int osize, int nsize) {
 }
 
 
+/*
+** Bucket for hash 'h': while the table grows, buckets of 'ohash' not
+** yet moved still hold their strings.
+*/
+static TString **strbucket (stringtable *tb, unsigned int h) {
+  if (tb->ohash != NULL) {
+    int i = lmod(h, tb->osize);
+    if (i >= tb->moved)
+      return &tb->ohash[i];
+  }
+  return &tb->hash[lmod(h, tb->size)];
+}
+
+
+/*
+** Move up to 'n' buckets of 'ohash' into 'hash', freeing 'ohash' when
+** it is empty.
+*/
+static void movebuckets (lua_State *L, stringtable *tb, int n) {
+  while (tb->ohash != NULL && n-- > 0) {
+    TString *p = tb->ohash[tb->moved];
+    tb->ohash[tb->moved] = NULL;
+    while (p) {  /* for each string in the list */
+      TString *hnext = p->u.hnext;  /* save next */
+      unsigned int h = lmod(p->hash, tb->size);  /* new position */
+      p->u.hnext = tb->hash[h];  /* chain it into new array */
+      tb->hash[h] = p;
+      p = hnext;
+    }
+    if (++tb->moved == tb->osize) {  /* moved all buckets? */
+      luaM_freearray(L, tb->ohash, tb->osize);
+      tb->ohash = NULL;
+      tb->osize = tb->moved = 0;
+    }
+  }
+}
+
+
+/*
+** Start growing the string table to size 'nsize'. The strings move to
+** the new array a few buckets at a time (see 'internshrstr'), so that
+** a large table does not stop the program to rehash all its strings.
+** If allocation fails, keep the current size.
+*/
+static void startgrowth (lua_State *L, stringtable *tb, int nsize) {
+  TString **newvect;
+  int i;
+  movebuckets(L, tb, tb->osize);  /* finish previous growth */
+  newvect = luaM_reallocvector(L, NULL, 0, nsize, TString*);
+  if (l_likely(newvect != NULL)) {
+    for (i = 0; i < nsize; i++)
+      newvect[i] = NULL;
+    tb->ohash = tb->hash;
+    tb->osize = tb->size;
+    tb->moved = 0;
+    tb->hash = newvect;
+    tb->size = nsize;
+  }
+}
+
+
 /*
 ** Resize the string table. If allocation fails, keep the current size.
 ** (This can degrade performance, but any non-zero size should work
@@ -84,8 +298,10 @@ static void tablerehash (TString **vect, int osize, int nsize) {
 */
 void luaS_resize (lua_State *L, int nsize) {
   stringtable *tb = &G(L)->strt;
-  int osize = tb->size;
+  int osize;
   TString **newvect;
+  movebuckets(L, tb, tb->osize);  /* finish any incremental growth */
+  osize = tb->size;
   if (nsize < osize)  /* shrinking table? */
     tablerehash(tb->hash, osize, nsize);  /* depopulate shrinking part */
   newvect = luaM_reallocvector(L, tb->hash, osize, nsize, TString*);
@@ -162,9 +378,58 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 }
 
 
+/*
+** Creates a slice with the 'l' bytes of long string 'ts' starting at
+** position 'i'. A slice of a slice shares the parent of the latter,
+** so that slices never form chains.
+*/
+TString *luaS_newslice (lua_State *L, TString *ts, size_t i, size_t l) {
+  char *s = getlngstr(ts) + i;
+  GCObject *o;
+  TString *sl;
+  lua_assert(l >= LUAI_MINSLICE && i + l <= ts->u.lnglen);
+  if (isslice(ts) && slicedata(ts)->parent != NULL)
+    ts = slicedata(ts)->parent;
+  o = luaC_newobj(L, LUA_VLNGSTR, sizeslice);
+  sl = gco2ts(o);
+  sl->hash = G(L)->seed;
+  sl->extra = STRSLICE;
+  sl->shrlen = 0xFF;
+  sl->u.lnglen = l;
+  slicedata(sl)->s = s;
+  slicedata(sl)->parent = ts;
+  return sl;
+}
+
+
+/*
+** Ensures that the contents of slice 'ts' are '\0'-terminated, giving
+** it its own copy of them when they are not the end of its parent.
+*/
+void luaS_termslice (lua_State *L, TString *ts) {
+  Slice *sd = slicedata(ts);
+  TString *p = sd->parent;
+  if (p != NULL && sd->s + ts->u.lnglen != getlngstr(p) + p->u.lnglen) {
+    char *s = luaM_newvector(L, ts->u.lnglen + 1, char);
+    memcpy(s, sd->s, ts->u.lnglen * sizeof(char));
+    s[ts->u.lnglen] = '\0';
+    sd->s = s;
+    sd->parent = NULL;  /* parent is no longer needed */
+  }
+}
+
+
+void luaS_freeslice (lua_State *L, TString *ts) {
+  Slice *sd = slicedata(ts);
+  if (sd->parent == NULL)  /* has its own copy? */
+    luaM_freearray(L, sd->s, ts->u.lnglen + 1);
+  luaM_freemem(L, ts, sizeslice);
+}
+
+
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = strbucket(tb, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -179,7 +444,7 @@ static void growstrtab (lua_State *L, stringtable *tb) {
       luaM_error(L);  /* cannot even create a message... */
   }
   if (tb->size <= MAXSTRTB / 2)  /* can grow string table? */
-    luaS_resize(L, tb->size * 2);
+    startgrowth(L, tb, tb->size * 2);
 }
 
 
@@ -191,7 +456,7 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   global_State *g = G(L);
   stringtable *tb = &g->strt;
   unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &tb->hash[lmod(h, tb->size)];
+  TString **list = strbucket(tb, h);
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == ts->shrlen && (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)) {
@@ -204,7 +469,11 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   /* else must create a new string */
   if (tb->nuse >= tb->size) {  /* need to grow string table? */
     growstrtab(L, tb);
-    list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
+    list = strbucket(tb, h);  /* rehash with new size */
+  }
+  else if (tb->ohash != NULL) {  /* table is growing? */
+    movebuckets(L, tb, STRTABMOVE);
+    list = strbucket(tb, h);  /* string may have moved */
   }
   ts = createstrobj(L, l, LUA_VSHRSTR, h);
   ts->shrlen = cast_byte(l);
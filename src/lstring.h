@@ -25,6 +25,9 @@
 */
 #define sizelstring(l)  (offsetof(TString, contents) + ((l) + 1) * sizeof(char))
 
+/* size of a slice */
+#define sizeslice	(offsetof(TString, contents) + sizeof(Slice))
+
 #define luaS_newliteral(L, s)	(luaS_newlstr(L, "" s, \
                                  (sizeof(s)/sizeof(char))-1))
 
@@ -41,6 +44,13 @@
 #define eqshrstr(a,b)	check_exp((a)->tt == LUA_VSHRSTR, (a) == (b))
 
 
+/*
+** ensure that the contents of string 'ts' are '\0'-terminated
+*/
+#define luaS_terminate(L,ts)  \
+	{ if (l_unlikely(isslice(ts))) luaS_termslice(L, ts); }
+
+
 LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
 LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
@@ -52,6 +62,10 @@ LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, int nuvalue);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_newslice (lua_State *L, TString *ts, size_t i,
+                                                             size_t l);
+LUAI_FUNC void luaS_termslice (lua_State *L, TString *ts);
+LUAI_FUNC void luaS_freeslice (lua_State *L, TString *ts);
 
 
 #endif
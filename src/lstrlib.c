@@ -24,6 +24,8 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lnumfmt.h"
+#include "lsimd.h"
 
 
 /*
@@ -97,13 +99,22 @@ static size_t getendpos (lua_State *L, int arg, lua_Integer def,
 }
 
 
+/*
+** Long substrings are slices of the subject (see 'lua_pushslice'); the
+** subject is not converted with 'luaL_checklstring', which would give
+** it a copy of its own if it were itself a slice.
+*/
 static int str_sub (lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
-  size_t start = posrelatI(luaL_checkinteger(L, 2), l);
-  size_t end = getendpos(L, 3, -1, l);
+  size_t start, end;
+  if (lua_type(L, 1) == LUA_TSTRING)
+    l = lua_rawlen(L, 1);
+  else
+    luaL_checklstring(L, 1, &l);  /* a number (or an error) */
+  start = posrelatI(luaL_checkinteger(L, 2), l);
+  end = getendpos(L, 3, -1, l);
   if (start <= end)
-    lua_pushlstring(L, s + start - 1, (end - start) + 1);
+    lua_pushslice(L, 1, start - 1, (end - start) + 1);
   else lua_pushliteral(L, "");
   return 1;
 }
@@ -114,20 +125,42 @@ static int str_reverse (lua_State *L) {
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i = 0; i < l; i++)
+  i = lsimd_reverse(p, s, l);
+  for (; i < l; i++)
     p[i] = s[l - i - 1];
   luaL_pushresultsize(&b, l);
   return 1;
 }
 
 
+/*
+** Whether the current locale converts case of ASCII letters only by
+** their case bit (as the C locale does), so that 'lsimd_case' gives
+** the same results as 'tolower'/'toupper'.
+*/
+static int asciicase (void) {
+  int c;
+  for (c = 'A'; c <= 'Z'; c++) {
+    if (tolower(c) != c + ('a' - 'A') || toupper(c + ('a' - 'A')) != c)
+      return 0;
+  }
+  return 1;
+}
+
+
+/* minimum length for a vectorized case conversion */
+#define MINSIMDCASE	64
+
+
 static int str_lower (lua_State *L) {
   size_t l;
-  size_t i;
+  size_t i = 0;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
+  if (l >= MINSIMDCASE && asciicase())
+    i = lsimd_case(p, s, l, 0);
+  for (; i<l; i++)
     p[i] = tolower(uchar(s[i]));
   luaL_pushresultsize(&b, l);
   return 1;
@@ -136,11 +169,13 @@ static int str_lower (lua_State *L) {
 
 static int str_upper (lua_State *L) {
   size_t l;
-  size_t i;
+  size_t i = 0;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
+  if (l >= MINSIMDCASE && asciicase())
+    i = lsimd_case(p, s, l, 1);
+  for (; i<l; i++)
     p[i] = toupper(uchar(s[i]));
   luaL_pushresultsize(&b, l);
   return 1;
@@ -355,11 +390,50 @@ static const luaL_Reg stringmetamethods[] = {
 #define CAP_POSITION	(-2)
 
 
+/* number of bytes in a set of characters */
+#define CSETSIZE	(UCHAR_MAX / CHAR_BIT + 1)
+
+#define cstest(cs,c)	((cs)[(c) / CHAR_BIT] & (1u << ((c) % CHAR_BIT)))
+
+
+/*
+** A single-character class of a compiled pattern ('.', 'x', '%a' or
+** '[...]'), with its characters as a bitmap.
+*/
+typedef struct CClass {
+  size_t end;  /* offset in the pattern of what follows the class */
+  unsigned char set[CSETSIZE];
+} CClass;
+
+
+/*
+** A compiled pattern (see 'string.compile'): the pattern itself plus,
+** for each offset in it where 'match' may find a single-character
+** class, the index of that class in 'classes' (or -1).
+*/
+typedef struct CPattern {
+  const char *p;  /* pattern */
+  size_t lp;  /* its length */
+  const char *prefix;  /* literal text that starts every match */
+  size_t lprefix;  /* its length */
+  int first;  /* class that starts every match, or -1 */
+  int plain;  /* pattern has no special characters */
+  int *item;  /* class at each offset of the pattern */
+  CClass *classes;
+  int nclasses;
+} CPattern;
+
+
+#define cpclass(cp,p)	(&(cp)->classes[(cp)->item[(p) - (cp)->p]])
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
   lua_State *L;
+  int srcidx;  /* stack index of source string */
+  const CPattern *cp;  /* compiled form of the pattern, or NULL */
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -473,6 +547,8 @@ static int singlematch (MatchState *ms, const char *s, const char *p,
     return 0;
   else {
     int c = uchar(*s);
+    if (ms->cp != NULL)
+      return cstest(cpclass(ms->cp, p)->set, c);
     switch (*p) {
       case '.': return 1;  /* matches any char */
       case L_ESC: return match_class(c, uchar(*(p+1)));
@@ -601,13 +677,23 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
           }
           case 'f': {  /* frontier? */
             const char *ep; char previous;
+            int before, here;  /* whether chars around 's' are in the set */
             p += 2;
             if (l_unlikely(*p != '['))
               luaL_error(ms->L, "missing '[' after '%%f' in pattern");
-            ep = classend(ms, p);  /* points to what is next */
             previous = (s == ms->src_init) ? '\0' : *(s - 1);
-            if (!matchbracketclass(uchar(previous), p, ep - 1) &&
-               matchbracketclass(uchar(*s), p, ep - 1)) {
+            if (ms->cp != NULL) {
+              const CClass *cc = cpclass(ms->cp, p);
+              ep = ms->cp->p + cc->end;
+              before = cstest(cc->set, uchar(previous));
+              here = cstest(cc->set, uchar(*s));
+            }
+            else {
+              ep = classend(ms, p);  /* points to what is next */
+              before = matchbracketclass(uchar(previous), p, ep - 1);
+              here = matchbracketclass(uchar(*s), p, ep - 1);
+            }
+            if (!before && here) {
               p = ep; goto init;  /* return match(ms, s, ep); */
             }
             s = NULL;  /* match failed */
@@ -627,7 +713,9 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
         break;
       }
       default: dflt: {  /* pattern class plus optional suffix */
-        const char *ep = classend(ms, p);  /* points to optional suffix */
+        const char *ep = (ms->cp != NULL)  /* points to optional suffix */
+                       ? ms->cp->p + cpclass(ms->cp, p)->end
+                       : classend(ms, p);
         /* does not match at least once? */
         if (!singlematch(ms, s, p, ep)) {
           if (*ep == '*' || *ep == '?' || *ep == '-') {  /* accept empty? */
@@ -676,6 +764,11 @@ static const char *lmemfind (const char *s1, size_t l1,
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
   else {
     const char *init;  /* to search for a '*s2' inside 's1' */
+    size_t done = 0;  /* positions already searched by 'lsimd_find' */
+    if (l2 >= 2 && (init = lsimd_find(s1, l1, s2, l2, &done)) != NULL)
+      return init;
+    s1 += done;
+    l1 -= done;
     l2--;  /* 1st char will be checked by 'memchr' */
     l1 = l1-l2;  /* 's2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
@@ -692,6 +785,27 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
+/*
+** First position from 's' where a match may start, or NULL if there
+** is none. Without a compiled pattern, that is 's' itself.
+*/
+static const char *nextstart (MatchState *ms, const char *s) {
+  const CPattern *cp = ms->cp;
+  if (cp == NULL)
+    return s;
+  else if (cp->lprefix > 0)
+    return lmemfind(s, ms->src_end - s, cp->prefix, cp->lprefix);
+  else if (cp->first >= 0) {
+    const unsigned char *set = cp->classes[cp->first].set;
+    while (s < ms->src_end && !cstest(set, uchar(*s)))
+      s++;
+    return (s < ms->src_end) ? s : NULL;
+  }
+  else
+    return s;
+}
+
+
 /*
 ** get information about the i-th capture. If there are no captures
 ** and 'i==0', return information about the whole match, which
@@ -726,8 +840,8 @@ static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   const char *cap;
   ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
-  if (l != CAP_POSITION)
-    lua_pushlstring(ms->L, cap, l);
+  if (l != CAP_POSITION)  /* a substring of the source */
+    lua_pushslice(ms->L, ms->srcidx, cap - ms->src_init, l);
   /* else position was already pushed */
 }
 
@@ -757,6 +871,8 @@ static int nospecials (const char *p, size_t l) {
 static void prepstate (MatchState *ms, lua_State *L,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
+  ms->srcidx = 1;
+  ms->cp = NULL;
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
@@ -770,17 +886,39 @@ static void reprepstate (MatchState *ms) {
 }
 
 
+#define STRPATTERN	"strpattern"
+
+
+/*
+** Get the pattern at index 'arg', either a string or a compiled
+** pattern; in the later case, set '*cp' to it.
+*/
+static const char *checkpattern (lua_State *L, int arg, size_t *lp,
+                                 const CPattern **cp) {
+  const CPattern *c = (const CPattern *)luaL_testudata(L, arg, STRPATTERN);
+  *cp = c;
+  if (c != NULL) {
+    *lp = c->lp;
+    return c->p;
+  }
+  else
+    return luaL_checklstring(L, arg, lp);
+}
+
+
 static int str_find_aux (lua_State *L, int find) {
   size_t ls, lp;
+  const CPattern *cp;
   const char *s = luaL_checklstring(L, 1, &ls);
-  const char *p = luaL_checklstring(L, 2, &lp);
+  const char *p = checkpattern(L, 2, &lp, &cp);
   size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
   if (init > ls) {  /* start after string's end? */
     luaL_pushfail(L);  /* cannot find anything */
     return 1;
   }
   /* explicit request or no special characters? */
-  if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
+  if (find && (lua_toboolean(L, 4) ||
+               (cp ? cp->plain : nospecials(p, lp)))) {
     /* do a plain search */
     const char *s2 = lmemfind(s + init, ls - init, p, lp);
     if (s2) {
@@ -797,8 +935,11 @@ static int str_find_aux (lua_State *L, int find) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
+    ms.cp = cp;
     do {
       const char *res;
+      if (!anchor && (s1 = nextstart(&ms, s1)) == NULL)
+        break;  /* no more possible matches */
       reprepstate(&ms);
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -841,6 +982,8 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if ((src = nextstart(&gm->ms, src)) == NULL)
+      break;  /* no more possible matches */
     reprepstate(&gm->ms);
     if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
@@ -853,8 +996,9 @@ static int gmatch_aux (lua_State *L) {
 
 static int gmatch (lua_State *L) {
   size_t ls, lp;
+  const CPattern *cp;
   const char *s = luaL_checklstring(L, 1, &ls);
-  const char *p = luaL_checklstring(L, 2, &lp);
+  const char *p = checkpattern(L, 2, &lp, &cp);
   size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
   GMatchState *gm;
   lua_settop(L, 2);  /* keep strings on closure to avoid being collected */
@@ -862,6 +1006,9 @@ static int gmatch (lua_State *L) {
   if (init > ls)  /* start after string's end? */
     init = ls + 1;  /* avoid overflows in 's + init' */
   prepstate(&gm->ms, L, s, ls, p, lp);
+  gm->ms.srcidx = lua_upvalueindex(1);
+  if (cp != NULL && *p != '^')  /* (compiled without the anchor) */
+    gm->ms.cp = cp;
   gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
   lua_pushcclosure(L, gmatch_aux, 3);
   return 1;
@@ -941,8 +1088,9 @@ static int add_value (MatchState *ms, luaL_Buffer *b, const char *s,
 
 static int str_gsub (lua_State *L) {
   size_t srcl, lp;
+  const CPattern *cp;
   const char *src = luaL_checklstring(L, 1, &srcl);  /* subject */
-  const char *p = luaL_checklstring(L, 2, &lp);  /* pattern */
+  const char *p = checkpattern(L, 2, &lp, &cp);  /* pattern */
   const char *lastmatch = NULL;  /* end of last match */
   int tr = lua_type(L, 3);  /* replacement type */
   lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
@@ -959,8 +1107,15 @@ static int str_gsub (lua_State *L) {
     p++; lp--;  /* skip anchor character */
   }
   prepstate(&ms, L, src, srcl, p, lp);
+  ms.cp = cp;
   while (n < max_s) {
     const char *e;
+    if (!anchor) {  /* skip what cannot start a match */
+      const char *next = nextstart(&ms, src);
+      if (next == NULL) break;  /* no more possible matches */
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
     if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
@@ -985,6 +1140,330 @@ static int str_gsub (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** COMPILED PATTERNS
+** =======================================================
+*/
+
+/*
+** 'string.compile' walks a pattern once, as 'match' would, and keeps
+** each of its single-character classes as a bitmap, so that matching
+** a character is a bit test instead of an interpretation of the class.
+** It also finds what every match must start with (a literal prefix or
+** a class), so that searches skip positions where no match can start.
+** Classes are computed with the locale at compile time.
+*/
+
+
+/*
+** Set class 'k' of 'cp' to the characters matched by the class at 'p',
+** which ends at 'ep'. (Does nothing when only counting classes.)
+*/
+static void setclass (CPattern *cp, int k, const char *p, const char *ep) {
+  if (cp->classes != NULL) {
+    CClass *cc = &cp->classes[k];
+    int c;
+    memset(cc->set, 0, CSETSIZE);
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      int in;
+      switch (*p) {
+        case '.': in = 1; break;
+        case L_ESC: in = match_class(c, uchar(*(p + 1))); break;
+        case '[': in = matchbracketclass(c, p, ep - 1); break;
+        default: in = (uchar(*p) == c); break;
+      }
+      if (in)
+        cc->set[c / CHAR_BIT] |= (unsigned char)(1u << (c % CHAR_BIT));
+    }
+    cc->end = ep - cp->p;
+    cp->item[p - cp->p] = k;
+  }
+}
+
+
+/*
+** Go through pattern 'p' as 'match' does, setting its classes in 'cp'.
+** Returns the number of classes. Raises the errors that 'match' would
+** raise for a malformed pattern, including wrong uses of captures
+** (as searches with the compiled pattern may never try them).
+*/
+static int walkpattern (MatchState *ms, CPattern *cp, const char *p) {
+  int n = 0;
+  int level = 0;  /* number of captures */
+  char closed[LUA_MAXCAPTURES];  /* whether each capture is closed */
+  while (p < ms->p_end) {
+    const char *ep;
+    switch (*p) {
+      case '(': {
+        if (level >= LUA_MAXCAPTURES)
+          luaL_error(ms->L, "too many captures");
+        closed[level] = (*(p + 1) == ')');  /* position capture? */
+        p += closed[level++] ? 2 : 1;
+        continue;
+      }
+      case ')': {
+        int l = level - 1;
+        while (l >= 0 && closed[l])
+          l--;
+        if (l_unlikely(l < 0))
+          luaL_error(ms->L, "invalid pattern capture");
+        closed[l] = 1;
+        p++;
+        continue;
+      }
+      case '$': {
+        if (p + 1 == ms->p_end) {  /* end anchor? */
+          p++;
+          continue;
+        }
+        break;  /* else a class */
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (l_unlikely(p + 3 >= ms->p_end))
+              luaL_error(ms->L, "malformed pattern "
+                                "(missing arguments to '%%b')");
+            p += 4;
+            continue;
+          }
+          case 'f': {
+            p += 2;
+            if (l_unlikely(*p != '['))
+              luaL_error(ms->L, "missing '[' after '%%f' in pattern");
+            ep = classend(ms, p);
+            setclass(cp, n++, p, ep);
+            p = ep;
+            continue;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            int l = *(p + 1) - '1';
+            if (l_unlikely(l < 0 || l >= level || !closed[l]))
+              luaL_error(ms->L, "invalid capture index %%%d", l + 1);
+            p += 2;
+            continue;
+          }
+          default: break;
+        }
+        break;
+      }
+      default: break;
+    }
+    ep = classend(ms, p);  /* class plus optional suffix */
+    setclass(cp, n++, p, ep);
+    p = (*ep == '*' || *ep == '+' || *ep == '?' || *ep == '-') ? ep + 1 : ep;
+  }
+  return n;
+}
+
+
+/* whether suffix 'c' accepts an empty match of its class */
+#define optsuffix(c)	((c) == '*' || (c) == '?' || (c) == '-')
+
+
+/*
+** Put in 'prefix' the leading characters of pattern 'p' that match
+** only themselves, exactly once; captures between them do not count.
+** Returns the length of the prefix.
+*/
+static size_t getprefix (MatchState *ms, const char *p, char *prefix) {
+  size_t n = 0;
+  while (p < ms->p_end) {
+    const char *ep;
+    char c;
+    if (*p == '(' || *p == ')') {
+      p++;
+      continue;
+    }
+    else if (*p == L_ESC) {
+      if (isalnum(uchar(*(p + 1))))
+        break;  /* a class, '%b', '%f', or a back reference */
+      c = *(p + 1);
+      ep = p + 2;
+    }
+    else if (*p == '.' || *p == '[' || (*p == '$' && p + 1 == ms->p_end))
+      break;
+    else {
+      c = *p;
+      ep = p + 1;
+    }
+    if (optsuffix(*ep))
+      break;  /* character may be absent */
+    prefix[n++] = c;
+    if (*ep == '+')
+      break;  /* character may repeat */
+    p = ep;
+  }
+  return n;
+}
+
+
+/*
+** The class that every match of 'cp' must start with, or -1.
+*/
+static int getfirst (const CPattern *cp, const char *p) {
+  const char *p_end = cp->p + cp->lp;
+  int k;
+  while (p < p_end && (*p == '(' || *p == ')'))
+    p++;
+  if (p == p_end || (k = cp->item[p - cp->p]) < 0)
+    return -1;  /* not a class (or a frontier) */
+  else if (optsuffix(cp->p[cp->classes[k].end]))
+    return -1;
+  else
+    return k;
+}
+
+
+/*
+** string.compile(pattern): a compiled pattern, which all functions
+** that take a pattern accept. Compiled patterns are kept in a cache
+** (weak table at upvalue 1), so compiling the same pattern again
+** returns the same object while it is alive.
+*/
+static int str_compile (lua_State *L) {
+  size_t lp, i, sz;
+  const char *p;
+  MatchState ms;
+  CPattern *cp;
+  char *buff;
+  int nclasses, anchor;
+  if (luaL_testudata(L, 1, STRPATTERN) != NULL) {  /* already compiled? */
+    lua_settop(L, 1);
+    return 1;
+  }
+  p = luaL_checklstring(L, 1, &lp);
+  lua_settop(L, 1);
+  lua_pushvalue(L, 1);
+  if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNIL)
+    return 1;  /* cached */
+  anchor = (*p == '^');
+  prepstate(&ms, L, p, 0, p, lp);
+  {  /* count classes (and check the pattern) */
+    CPattern temp;
+    temp.classes = NULL;
+    nclasses = walkpattern(&ms, &temp, p + anchor);
+  }
+  sz = sizeof(CPattern) + nclasses * sizeof(CClass) +
+       lp * sizeof(int) + 2 * (lp + 1);  /* pattern and prefix */
+  cp = (CPattern *)lua_newuserdatauv(L, sz, 0);
+  cp->classes = (CClass *)(cp + 1);
+  cp->nclasses = nclasses;
+  cp->item = (int *)(cp->classes + nclasses);
+  buff = (char *)(cp->item + lp);
+  memcpy(buff, p, lp);
+  buff[lp] = '\0';
+  cp->p = buff;
+  cp->lp = lp;
+  for (i = 0; i < lp; i++)
+    cp->item[i] = -1;
+  prepstate(&ms, L, cp->p, 0, cp->p, lp);
+  walkpattern(&ms, cp, cp->p + anchor);
+  cp->plain = nospecials(cp->p, lp);
+  buff += lp + 1;
+  cp->prefix = buff;
+  if (anchor) {  /* only one position to try; nothing to skip */
+    cp->lprefix = 0;
+    cp->first = -1;
+  }
+  else {
+    cp->lprefix = getprefix(&ms, cp->p, buff);
+    cp->first = getfirst(cp, cp->p);
+  }
+  luaL_setmetatable(L, STRPATTERN);
+  lua_pushvalue(L, 1);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, lua_upvalueindex(1));  /* cache[pattern] = compiled */
+  return 1;
+}
+
+
+/*
+** Methods call the library functions with the subject and the pattern
+** swapped: 'p:find(s, ...)' is 'string.find(s, p, ...)'.
+*/
+static void swapargs (lua_State *L) {
+  luaL_checkudata(L, 1, STRPATTERN);
+  if (lua_gettop(L) < 2)
+    lua_settop(L, 2);
+  lua_pushvalue(L, 1);
+  lua_copy(L, 2, 1);
+  lua_replace(L, 2);
+}
+
+
+static int pat_find (lua_State *L) {
+  swapargs(L);
+  return str_find(L);
+}
+
+
+static int pat_match (lua_State *L) {
+  swapargs(L);
+  return str_match(L);
+}
+
+
+static int pat_gmatch (lua_State *L) {
+  swapargs(L);
+  return gmatch(L);
+}
+
+
+static int pat_gsub (lua_State *L) {
+  swapargs(L);
+  return str_gsub(L);
+}
+
+
+static int pat_tostring (lua_State *L) {
+  const CPattern *cp = (const CPattern *)luaL_checkudata(L, 1, STRPATTERN);
+  lua_pushfstring(L, STRPATTERN ": %s", cp->p);
+  return 1;
+}
+
+
+static const luaL_Reg pat_methods[] = {
+  {"find", pat_find},
+  {"gmatch", pat_gmatch},
+  {"gsub", pat_gsub},
+  {"match", pat_match},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg pat_meta[] = {
+  {"__tostring", pat_tostring},
+  {"__index", NULL},  /* placeholder */
+  {NULL, NULL}
+};
+
+
+/*
+** Create the metatable of compiled patterns and set 'compile' (with
+** its cache) in the library at the top of the stack.
+*/
+static void createpatmeta (lua_State *L) {
+  luaL_newmetatable(L, STRPATTERN);
+  luaL_setfuncs(L, pat_meta, 0);
+  luaL_newlib(L, pat_methods);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = methods */
+  lua_pop(L, 1);  /* pop metatable */
+  lua_newtable(L);  /* cache */
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);  /* cache has weak values */
+  lua_pushcclosure(L, str_compile, 1);
+  lua_setfield(L, -2, "compile");
+}
+
+/* }====================================================== */
+
+
 
 /*
 ** {======================================================
@@ -1122,6 +1601,13 @@ static int lua_number2strx (lua_State *L, char *buff, int sz,
 static void addquoted (luaL_Buffer *b, const char *s, size_t len) {
   luaL_addchar(b, '"');
   while (len--) {
+    size_t plain = lsimd_plainlen(s, len + 1);  /* bytes copied as is */
+    if (plain > 0) {
+      luaL_addlstring(b, s, plain);
+      s += plain;
+      len -= plain - 1;
+      continue;
+    }
     if (*s == '"' || *s == '\\' || *s == '\n') {
       luaL_addchar(b, '\\');
       luaL_addchar(b, *s);
@@ -1207,6 +1693,63 @@ static void addliteral (lua_State *L, luaL_Buffer *b, int arg) {
 }
 
 
+#if defined(LNUM_FASTFMT)
+
+/*
+** Write 'x' as 'printf' would with the format "%.<p>f" (for 'p' up to
+** LNUM_MAXPREC), rounding as 'lnum_fmtg' does; return -1 when the
+** scaled number is not below 2^52, where its fraction would not have
+** the bits to tell a tie.
+*/
+static int fmtfixed (char *buff, double x, int p, int point) {
+  char tmp[LNUM_MAXSIZE];
+  char *end = tmp + sizeof(tmp);
+  char *s = buff;
+  char *q;
+  unsigned long long d, scale, frac;
+  double ax, t, r, err, half;
+  int i;
+  if (p > LNUM_MAXPREC || !(x == x))
+    return -1;
+  ax = fabs(x);
+  t = ax * lnum_pow10[p];
+  if (!(t < 4503599627370496.0))  /* not below 2^52 (or inf)? */
+    return -1;
+  if (x < 0 || (x == 0 && 1 / x < 0))  /* negative (or -0)? */
+    *s++ = '-';
+  err = lnum_mulerr(ax, lnum_pow10[p], t);  /* t + err == ax * 10^p */
+  r = floor(t);
+  half = (t - r) - 0.5;
+  if (half > 0 ||
+      (half == 0 && (err > 0 ||
+                     (err == 0 && ((unsigned long long)r & 1)))))
+    r += 1;
+  d = (unsigned long long)r;
+  scale = (unsigned long long)lnum_pow10[p];
+  q = lnum_utoa(end, (lua_Unsigned)(d / scale));  /* integer part */
+  memcpy(s, q, (size_t)(end - q));
+  s += end - q;
+  if (p > 0) {
+    *s++ = (char)point;
+    frac = d % scale;
+    for (i = p; i > 0; i--) {  /* 'p' digits, with leading zeros */
+      s[i - 1] = (char)('0' + (int)(frac % 10));
+      frac /= 10;
+    }
+    s += p;
+  }
+  *s = '\0';
+  return (int)(s - buff);
+}
+
+#else
+
+#define fmtfixed(buff,x,p,point)  \
+	((void)(buff), (void)(x), (void)(p), (void)(point), -1)
+
+#endif
+
+
 static const char *get2digits (const char *s) {
   if (isdigit(uchar(*s))) {
     s++;
@@ -1222,8 +1765,8 @@ static const char *get2digits (const char *s) {
 ** be a valid conversion specifier. 'flags' are the accepted flags;
 ** 'precision' signals whether to accept a precision.
 */
-static void checkformat (lua_State *L, const char *form, const char *flags,
-                                       int precision) {
+static int checkformat (const char *form, const char *flags,
+                        int precision) {
   const char *spec = form + 1;  /* skip '%' */
   spec += strspn(spec, flags);  /* skip flags */
   if (*spec != '0') {  /* a width cannot start with '0' */
@@ -1233,23 +1776,21 @@ static void checkformat (lua_State *L, const char *form, const char *flags,
       spec = get2digits(spec);  /* skip precision */
     }
   }
-  if (!isalpha(uchar(*spec)))  /* did not go to the end? */
-    luaL_error(L, "invalid conversion specification: '%s'", form);
+  return isalpha(uchar(*spec));  /* went to the end? */
 }
 
 
 /*
 ** Get a conversion specification and copy it to 'form'.
-** Return the address of its last character.
+** Return the address of its last character, or NULL if it is too long.
 */
-static const char *getformat (lua_State *L, const char *strfrmt,
-                                            char *form) {
+static const char *getformat (const char *strfrmt, char *form) {
   /* spans flags, width, and precision ('0' is included as a flag) */
   size_t len = strspn(strfrmt, L_FMTFLAGSF "123456789.");
   len++;  /* adds following character (should be the specifier) */
   /* still needs space for '%', '\0', plus a length modifier */
   if (len >= MAX_FORMAT - 10)
-    luaL_error(L, "invalid format (too long)");
+    return NULL;
   *(form++) = '%';
   memcpy(form, strfrmt, len * sizeof(char));
   *(form + len) = '\0';
@@ -1270,113 +1811,458 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
+/*
+** {------------------------------------------------------
+** Format programs
+**
+** 'string.format' compiles each format into a list of items, kept in
+** a cache in the registry (with weak values, so that programs for
+** formats not in use go away with each collection). An item is either
+** a run of literal text or a conversion, already validated, so that a
+** call only walks the items. Both keep only their slice of the format
+** itself, so that a program is small; conversions that go through
+** 'l_sprintf' rebuild their format, with its length modifier, on the C
+** stack. The common conversions ('%d', '%s', '%f',
+** and '%g', with an optional width and '-' flag) are written directly
+** into the buffer; the others go through 'l_sprintf'. A malformed
+** conversion compiles into an item that raises its error, so that
+** errors come in the same order as when formatting left to right.
+** -------------------------------------------------------
+*/
+
+#define FMTCACHE	"_FMTCACHE"
+
+/* kinds of items */
+#define FI_LIT		0	/* literal text */
+#define FI_INT		1	/* integer conversion, with 'l_sprintf' */
+#define FI_D		2	/* '%d' or '%i', written directly */
+#define FI_FLOAT	3	/* float conversion, with 'l_sprintf' */
+#define FI_F		4	/* '%f', written directly when possible */
+#define FI_G		5	/* '%g', written directly when possible */
+#define FI_A		6	/* '%a' or '%A' */
+#define FI_C		7	/* '%c' */
+#define FI_P		8	/* '%p' */
+#define FI_Q		9	/* '%q' */
+#define FI_S		10	/* plain '%s' */
+#define FI_SPAD		11	/* '%s' with only a width */
+#define FI_SFORM	12	/* '%s' with a precision */
+#define FI_TOOLONG	13	/* errors... */
+#define FI_BADSPEC	14
+#define FI_BADCONV	15
+#define FI_BADQ		16
+
+
+typedef struct FmtItem {
+  unsigned char kind;
+  char conv;  /* conversion specifier */
+  unsigned char left;  /* direct items: justify to the left? */
+  unsigned char width;  /* direct items: minimum width */
+  int prec;  /* direct items: precision */
+  size_t start, len;  /* slice of the format (for a conversion, after '%') */
+} FmtItem;
+
+
+typedef struct FmtProgram {
+  int n;  /* number of items */
+  FmtItem item[1];
+} FmtProgram;
+
+
+/*
+** Build in 'form' the format of conversion item 'it' of format
+** 'strfrmt', with the length modifier that its kind needs.
+*/
+static const char *buildform (char *form, const char *strfrmt,
+                              const FmtItem *it) {
+  form[0] = '%';
+  memcpy(form + 1, strfrmt + it->start, it->len * sizeof(char));
+  form[it->len + 1] = '\0';
+  switch (it->kind) {
+    case FI_INT:
+      addlenmod(form, LUA_INTEGER_FRMLEN);
+      break;
+    case FI_FLOAT: case FI_F: case FI_G: case FI_A:
+      addlenmod(form, LUA_NUMBER_FRMLEN);
+      break;
+  }
+  return form;
+}
+
+
+/*
+** If 'form' has only '-' flags, a width, and (when 'precision') a
+** precision, fill the fields of a direct item and return true. 'prec'
+** is -1 when there is no precision.
+*/
+static int directspec (FmtItem *it, const char *form, int precision) {
+  const char *s = form + 1;
+  int w = 0;
+  it->left = 0;
+  while (*s == '-') {
+    it->left = 1;
+    s++;
+  }
+  if (*s == '0')  /* flag '0'? */
+    return 0;
+  while (isdigit(uchar(*s)))
+    w = w * 10 + (*s++ - '0');
+  it->width = (unsigned char)w;
+  it->prec = -1;
+  if (*s == '.') {
+    if (!precision)
+      return 0;
+    it->prec = 0;
+    for (s++; isdigit(uchar(*s)); s++)
+      it->prec = it->prec * 10 + (*s - '0');
+  }
+  return (*s == it->conv && s[1] == '\0');
+}
+
+
+/*
+** Compile the conversion in 'form'; its flags are 'flags' and it
+** accepts a precision if 'precision'.
+*/
+static void compileconv (FmtItem *it, const char *form, int k, int kfast,
+                         const char *flags, int precision) {
+  if (!checkformat(form, flags, precision))
+    it->kind = FI_BADSPEC;
+  else {
+#if !defined(LUA_NOFASTNUMFMT)
+    if (kfast != k && directspec(it, form, 1))
+      k = kfast;
+#else
+    (void)kfast;
+#endif
+    it->kind = (unsigned char)k;
+  }
+}
+
+
+/*
+** Compile the conversion that starts after the '%' at 'strfrmt' into
+** 'it'; return where the format goes on, or NULL after an error item.
+*/
+static const char *compilespec (FmtItem *it, const char *strfrmt) {
+  char form[MAX_FORMAT];  /* to check the conversion */
+  const char *spec = strfrmt;
+  strfrmt = getformat(strfrmt, form);
+  if (strfrmt == NULL) {
+    it->kind = FI_TOOLONG;
+    return NULL;
+  }
+  it->len = strfrmt - spec + 1;
+  it->conv = *strfrmt++;
+  switch (it->conv) {
+    case 'c':
+      compileconv(it, form, FI_C, FI_C, L_FMTFLAGSC, 0);
+      break;
+    case 'd': case 'i':
+      compileconv(it, form, FI_INT, FI_D, L_FMTFLAGSI, 1);
+      if (it->kind == FI_D && it->prec >= 0)  /* precision for integer? */
+        it->kind = FI_INT;  /* let 'printf' pad it with zeros */
+      break;
+    case 'u':
+      compileconv(it, form, FI_INT, FI_INT, L_FMTFLAGSU, 1);
+      break;
+    case 'o': case 'x': case 'X':
+      compileconv(it, form, FI_INT, FI_INT, L_FMTFLAGSX, 1);
+      break;
+    case 'a': case 'A':
+      compileconv(it, form, FI_A, FI_A, L_FMTFLAGSF, 1);
+      break;
+    case 'f':
+      compileconv(it, form, FI_FLOAT, FI_F, L_FMTFLAGSF, 1);
+      if (it->kind == FI_F && it->prec < 0)
+        it->prec = 6;  /* default precision */
+      break;
+    case 'g':
+      compileconv(it, form, FI_FLOAT, FI_G, L_FMTFLAGSF, 1);
+      if (it->kind == FI_G && it->prec < 0)
+        it->prec = 6;  /* default precision */
+      break;
+    case 'e': case 'E': case 'G':
+      compileconv(it, form, FI_FLOAT, FI_FLOAT, L_FMTFLAGSF, 1);
+      break;
+    case 'p':
+      compileconv(it, form, FI_P, FI_P, L_FMTFLAGSC, 0);
+      break;
+    case 'q':
+      it->kind = (form[2] != '\0') ? FI_BADQ : FI_Q;  /* modifiers? */
+      break;
+    case 's':
+      if (form[2] == '\0')  /* no modifiers? */
+        it->kind = FI_S;
+      else {
+        compileconv(it, form, FI_SFORM, FI_SFORM, L_FMTFLAGSC, 1);
+        if (it->kind == FI_SFORM && directspec(it, form, 0))
+          it->kind = FI_SPAD;
+      }
+      break;
+    default:  /* also treat cases 'pnLlh' */
+      it->kind = FI_BADCONV;
+      break;
+  }
+  return (it->kind >= FI_TOOLONG) ? NULL : strfrmt;
+}
+
+
+/*
+** Compile format 'strfrmt' (with length 'sfl') into a new program,
+** left on the top of the stack.
+*/
+static FmtProgram *compileformat (lua_State *L, const char *strfrmt,
+                                                size_t sfl) {
+  const char *strfrmt_end = strfrmt + sfl;
+  const char *s = strfrmt;
+  int nmax = 1;  /* items are at most 1 + 2 * number of '%' */
+  FmtProgram *prog;
+  FmtItem *it;
+  while ((s = (const char *)memchr(s, L_ESC, strfrmt_end - s)) != NULL) {
+    nmax += 2;
+    s++;
+  }
+  prog = (FmtProgram *)lua_newuserdatauv(L,
+           offsetof(FmtProgram, item) + nmax * sizeof(FmtItem), 0);
+  it = prog->item;
+  s = strfrmt;
+  while (s < strfrmt_end) {
+    const char *e = (const char *)memchr(s, L_ESC, strfrmt_end - s);
+    if (e != s) {  /* literal text before next '%' (or the end)? */
+      if (e == NULL) e = strfrmt_end;
+      it->kind = FI_LIT;
+      it->start = s - strfrmt;
+      it->len = e - s;
+      it++;
+      s = e;
+    }
+    else if (s[1] == L_ESC) {  /* %% */
+      it->kind = FI_LIT;
+      it->start = s - strfrmt;
+      it->len = 1;
+      it++;
+      s += 2;
+    }
+    else {  /* format item */
+      it->start = (s + 1) - strfrmt;
+      s = compilespec(it++, s + 1);
+      if (s == NULL)  /* an error item? */
+        break;  /* it ends the program */
+    }
+  }
+  lua_assert(it - prog->item <= nmax);
+  prog->n = (int)(it - prog->item);
+  return prog;
+}
+
+
+/*
+** Get the program for the format at index 1 (a string), compiling it
+** if it is not in the cache; leave it on the top of the stack, which
+** keeps it alive while it runs.
+*/
+static const FmtProgram *getprogram (lua_State *L, const char *strfrmt,
+                                                   size_t sfl) {
+  FmtProgram *prog;
+  if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, FMTCACHE)) {  /* new? */
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);  /* cache has weak values */
+  }
+  lua_pushvalue(L, 1);
+  lua_rawget(L, -2);
+  prog = (FmtProgram *)lua_touserdata(L, -1);
+  if (prog == NULL) {  /* not compiled yet? */
+    lua_pop(L, 1);
+    prog = compileformat(L, strfrmt, sfl);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);  /* cache[format] = program */
+  }
+  lua_remove(L, -2);  /* remove cache */
+  return prog;
+}
+
+
+/*
+** Add 's' to the buffer, padded with spaces to the width of 'it'.
+*/
+static void addpadded (luaL_Buffer *b, const FmtItem *it,
+                       const char *s, size_t l) {
+  size_t pad = (it->width > l) ? it->width - l : 0;
+  if (pad > 0 && !it->left) {
+    memset(luaL_prepbuffsize(b, pad), ' ', pad);
+    luaL_addsize(b, pad);
+  }
+  luaL_addlstring(b, s, l);
+  if (pad > 0 && it->left) {
+    memset(luaL_prepbuffsize(b, pad), ' ', pad);
+    luaL_addsize(b, pad);
+  }
+}
+
+
+/*
+** Raise the error of an error item of format 'strfrmt', after checking
+** the argument as its conversion would (as that comes first).
+*/
+static int formaterror (lua_State *L, const char *strfrmt,
+                        const FmtItem *it, int arg) {
+  char form[MAX_FORMAT];
+  switch (it->kind) {
+    case FI_TOOLONG:
+      return luaL_error(L, "invalid format (too long)");
+    case FI_BADSPEC: {
+      switch (it->conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+          luaL_checkinteger(L, arg);
+          break;
+        case 'e': case 'E': case 'f': case 'g': case 'G':
+          luaL_checknumber(L, arg);
+          break;
+        case 's': {
+          size_t l;
+          const char *s = luaL_tolstring(L, arg, &l);
+          luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+          break;
+        }
+      }
+      return luaL_error(L, "invalid conversion specification: '%s'",
+                           buildform(form, strfrmt, it));
+    }
+    case FI_BADQ:
+      return luaL_error(L, "specifier '%%q' cannot have modifiers");
+    default:
+      lua_assert(it->kind == FI_BADCONV);
+      return luaL_error(L, "invalid conversion '%s' to 'format'",
+                           buildform(form, strfrmt, it));
+  }
+}
+
+
 static int str_format (lua_State *L) {
   int top = lua_gettop(L);
   int arg = 1;
   size_t sfl;
   const char *strfrmt = luaL_checklstring(L, arg, &sfl);
-  const char *strfrmt_end = strfrmt+sfl;
-  const char *flags;
+  const FmtProgram *prog = getprogram(L, strfrmt, sfl);
+  const FmtItem *it = prog->item;
+  const FmtItem *last = it + prog->n;
   luaL_Buffer b;
   luaL_buffinit(L, &b);
-  while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
-    else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
-    else { /* format item */
-      char form[MAX_FORMAT];  /* to store the format ('%...') */
-      int maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = luaL_prepbuffsize(&b, maxitem);  /* to put result */
-      int nb = 0;  /* number of bytes in result */
-      if (++arg > top)
-        return luaL_argerror(L, arg, "no value");
-      strfrmt = getformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          nb = l_sprintf(buff, maxitem, form, (int)luaL_checkinteger(L, arg));
-          break;
-        }
-        case 'd': case 'i':
-          flags = L_FMTFLAGSI;
-          goto intcase;
-        case 'u':
-          flags = L_FMTFLAGSU;
-          goto intcase;
-        case 'o': case 'x': case 'X':
-          flags = L_FMTFLAGSX;
-         intcase: {
-          lua_Integer n = luaL_checkinteger(L, arg);
-          checkformat(L, form, flags, 1);
-          addlenmod(form, LUA_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUAI_UACINT)n);
-          break;
-        }
-        case 'a': case 'A':
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = lua_number2strx(L, buff, maxitem, form,
-                                  luaL_checknumber(L, arg));
-          break;
-        case 'f':
-          maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = luaL_prepbuffsize(&b, maxitem);
-          /* FALLTHROUGH */
-        case 'e': case 'E': case 'g': case 'G': {
-          lua_Number n = luaL_checknumber(L, arg);
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUAI_UACNUMBER)n);
-          break;
-        }
-        case 'p': {
-          const void *p = lua_topointer(L, arg);
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
-            p = "(null)";  /* result */
-            form[strlen(form) - 1] = 's';  /* format it as a string */
-          }
-          nb = l_sprintf(buff, maxitem, form, p);
-          break;
+  for (; it < last; it++) {
+    char tmp[LNUM_MAXSIZE];  /* for direct items */
+    char form[MAX_FORMAT];  /* for items formatted with 'l_sprintf' */
+    char *buff;  /* to put result */
+    int nb = 0;  /* number of bytes in result */
+    if (it->kind == FI_LIT) {
+      luaL_addlstring(&b, strfrmt + it->start, it->len);
+      continue;
+    }
+    if (++arg > top)
+      return luaL_argerror(L, arg, "no value");
+    switch (it->kind) {
+      case FI_D: {
+        nb = lnum_fmtint(tmp, luaL_checkinteger(L, arg));
+        addpadded(&b, it, tmp, nb);
+        continue;
+      }
+      case FI_INT: {
+        lua_Integer n = luaL_checkinteger(L, arg);
+        buff = luaL_prepbuffsize(&b, MAX_ITEM);
+        nb = l_sprintf(buff, MAX_ITEM, buildform(form, strfrmt, it),
+                             (LUAI_UACINT)n);
+        break;
+      }
+      case FI_F: case FI_G: {
+        lua_Number n = luaL_checknumber(L, arg);
+        nb = (it->kind == FI_F)
+           ? fmtfixed(tmp, n, it->prec, lua_getlocaledecpoint())
+           : lnum_fmtg(tmp, n, it->prec, 0, lua_getlocaledecpoint());
+        if (nb >= 0) {
+          addpadded(&b, it, tmp, nb);
+          continue;
         }
-        case 'q': {
-          if (form[2] != '\0')  /* modifiers? */
-            return luaL_error(L, "specifier '%%q' cannot have modifiers");
-          addliteral(L, &b, arg);
-          break;
+        buff = luaL_prepbuffsize(&b, MAX_ITEMF);
+        nb = l_sprintf(buff, MAX_ITEMF, buildform(form, strfrmt, it),
+                              (LUAI_UACNUMBER)n);
+        break;
+      }
+      case FI_FLOAT: {
+        lua_Number n = luaL_checknumber(L, arg);
+        int maxitem = (it->conv == 'f') ? MAX_ITEMF : MAX_ITEM;
+        buff = luaL_prepbuffsize(&b, maxitem);
+        nb = l_sprintf(buff, maxitem, buildform(form, strfrmt, it),
+                             (LUAI_UACNUMBER)n);
+        break;
+      }
+      case FI_A: {
+        lua_Number n = luaL_checknumber(L, arg);
+        buff = luaL_prepbuffsize(&b, MAX_ITEM);
+        nb = lua_number2strx(L, buff, MAX_ITEM,
+                                buildform(form, strfrmt, it), n);
+        break;
+      }
+      case FI_C: {
+        int c = (int)luaL_checkinteger(L, arg);
+        buff = luaL_prepbuffsize(&b, MAX_ITEM);
+        nb = l_sprintf(buff, MAX_ITEM, buildform(form, strfrmt, it), c);
+        break;
+      }
+      case FI_P: {
+        const void *p = lua_topointer(L, arg);
+        buff = luaL_prepbuffsize(&b, MAX_ITEM);
+        buildform(form, strfrmt, it);
+        if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
+          form[strlen(form) - 1] = 's';  /* format it as a string */
+          nb = l_sprintf(buff, MAX_ITEM, form, "(null)");
         }
-        case 's': {
-          size_t l;
-          const char *s = luaL_tolstring(L, arg, &l);
-          if (form[2] == '\0')  /* no modifiers? */
-            luaL_addvalue(&b);  /* keep entire string */
-          else {
-            luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            checkformat(L, form, L_FMTFLAGSC, 1);
-            if (strchr(form, '.') == NULL && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, maxitem, form, s);
-              lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
-            }
-          }
-          break;
+        else
+          nb = l_sprintf(buff, MAX_ITEM, form, p);
+        break;
+      }
+      case FI_Q: {
+        addliteral(L, &b, arg);
+        continue;
+      }
+      case FI_S: {
+        luaL_tolstring(L, arg, NULL);
+        luaL_addvalue(&b);  /* keep entire string */
+        continue;
+      }
+      case FI_SPAD: case FI_SFORM: {
+        size_t l;
+        const char *s;
+        buff = luaL_prepbuffsize(&b, MAX_ITEM);  /* before pushing 's' */
+        s = luaL_tolstring(L, arg, &l);
+        luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        if (it->kind == FI_SFORM)  /* with precision? */
+          nb = l_sprintf(buff, MAX_ITEM, buildform(form, strfrmt, it), s);
+        else if (l < it->width) {  /* pad it */
+          nb = it->width;
+          memset(buff, ' ', nb);
+          memcpy(buff + (it->left ? 0 : nb - l), s, l);
         }
-        default: {  /* also treat cases 'pnLlh' */
-          return luaL_error(L, "invalid conversion '%s' to 'format'", form);
+        else {  /* (also for strings too long to be formatted) */
+          luaL_addvalue(&b);  /* keep entire string */
+          continue;
         }
+        lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+        break;
       }
-      lua_assert(nb < maxitem);
-      luaL_addsize(&b, nb);
+      default:
+        return formaterror(L, strfrmt, it, arg);
     }
+    lua_assert(nb < MAX_ITEMF);
+    luaL_addsize(&b, nb);
   }
   luaL_pushresult(&b);
   return 1;
 }
 
+/* }------------------------------------------------------ */
+
 /* }====================================================== */
 
 
@@ -1827,14 +2713,274 @@ static int str_unpack (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+/*
+** A string buffer is a userdata that owns a growable block of memory,
+** as the box of a 'luaL_Buffer', but survives between calls. Appending
+** to it is amortized constant time, so that 'b = b .. x' in a loop (see
+** 'buf_concat') is linear in the length of the result.
+*/
+
+#define STRBUF		"strbuf"
+
+typedef struct StrBuf {
+  char *b;  /* contents */
+  size_t n;  /* number of bytes in use */
+  size_t size;  /* size of block 'b' */
+} StrBuf;
+
+
+#define checkbuf(L,i)	((StrBuf *)luaL_checkudata(L, i, STRBUF))
+
+
+static void resizebuf (lua_State *L, StrBuf *sb, size_t newsize) {
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  char *temp = (char *)allocf(ud, sb->b, sb->size, newsize);
+  if (l_unlikely(temp == NULL && newsize > 0)) {  /* allocation error? */
+    lua_pushliteral(L, "not enough memory");
+    lua_error(L);  /* raise a memory error */
+  }
+  sb->b = temp;
+  sb->size = newsize;
+}
+
+
+/*
+** Returns a pointer to a free area with at least 'sz' bytes at the end
+** of the buffer, growing it by a factor of 1.5 (as 'luaL_Buffer').
+*/
+static char *prepbuf (lua_State *L, StrBuf *sb, size_t sz) {
+  if (sb->size - sb->n < sz) {  /* not enough space? */
+    size_t newsize = (sb->size / 2) * 3;
+    if (l_unlikely(MAX_SIZET - sz < sb->n))  /* overflow in (n + sz)? */
+      luaL_error(L, "resulting string too large");
+    if (newsize < sb->n + sz)
+      newsize = sb->n + sz;
+    if (newsize < LUAL_BUFFERSIZE)
+      newsize = LUAL_BUFFERSIZE;
+    resizebuf(L, sb, newsize);
+  }
+  return sb->b + sb->n;
+}
+
+
+static void addbuf (lua_State *L, StrBuf *sb, const char *s, size_t l) {
+  if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+    memcpy(prepbuf(L, sb, l), s, l * sizeof(char));
+    sb->n += l;
+  }
+}
+
+
+/*
+** Append the value at index 'idx', which must be a string, a number,
+** or a string buffer (maybe 'sb' itself).
+*/
+static void addbufvalue (lua_State *L, StrBuf *sb, int idx) {
+  StrBuf *other = (StrBuf *)luaL_testudata(L, idx, STRBUF);
+  if (other != NULL) {
+    size_t l = other->n;
+    char *p = prepbuf(L, sb, l);  /* may move 'other->b' if it is 'sb' */
+    if (l > 0) memcpy(p, other->b, l * sizeof(char));
+    sb->n += l;
+  }
+  else {
+    size_t l;
+    const char *s = lua_tolstring(L, idx, &l);
+    if (l_unlikely(s == NULL))
+      luaL_error(L, "attempt to concatenate a %s value",
+                    luaL_typename(L, idx));
+    addbuf(L, sb, s, l);
+  }
+}
+
+
+/*
+** string.buffer(...): new buffer with the given strings
+*/
+static int buf_new (lua_State *L) {
+  int n = lua_gettop(L);
+  int i;
+  StrBuf *sb = (StrBuf *)lua_newuserdatauv(L, sizeof(StrBuf), 0);
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_setmetatable(L, STRBUF);
+  for (i = 1; i <= n; i++)
+    addbufvalue(L, sb, i);
+  return 1;
+}
+
+
+static int buf_append (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  int n = lua_gettop(L);
+  int i;
+  for (i = 2; i <= n; i++)
+    addbufvalue(L, sb, i);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_appendf (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  size_t l;
+  const char *s;
+  luaL_checkstring(L, 2);
+  lua_pushcfunction(L, str_format);
+  lua_rotate(L, 2, 1);  /* put 'format' below its arguments */
+  lua_call(L, lua_gettop(L) - 2, 1);
+  s = lua_tolstring(L, -1, &l);
+  addbuf(L, sb, s, l);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_rep (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  size_t l, lsep;
+  const char *s = luaL_checklstring(L, 2, &l);
+  lua_Integer n = luaL_checkinteger(L, 3);
+  const char *sep = luaL_optlstring(L, 4, "", &lsep);
+  if (n > 0) {
+    char *p;
+    if (l_unlikely(l + lsep < l || l + lsep > MAXSIZE / n))
+      return luaL_error(L, "resulting string too large");
+    p = prepbuf(L, sb, (size_t)n * l + (size_t)(n - 1) * lsep);
+    while (n-- > 1) {  /* first n-1 copies (followed by separator) */
+      memcpy(p, s, l * sizeof(char)); p += l;
+      if (lsep > 0) {
+        memcpy(p, sep, lsep * sizeof(char));
+        p += lsep;
+      }
+    }
+    memcpy(p, s, l * sizeof(char));
+    sb->n = (size_t)(p + l - sb->b);
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_tostring (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  lua_pushlstring(L, sb->b, sb->n);
+  return 1;
+}
+
+
+/*
+** Empty the buffer for reuse, keeping its memory.
+*/
+static int buf_reset (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sb->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  lua_pushinteger(L, (lua_Integer)sb->n);
+  return 1;
+}
+
+
+/*
+** 'b .. x' appends 'x' to 'b' in place and results in 'b' itself;
+** 'x .. b' results in a new string.
+*/
+static int buf_concat (lua_State *L) {
+  StrBuf *sb = (StrBuf *)luaL_testudata(L, 1, STRBUF);
+  if (sb != NULL) {
+    addbufvalue(L, sb, 2);
+    lua_settop(L, 1);
+  }
+  else {
+    StrBuf *right = checkbuf(L, 2);
+    luaL_Buffer b;
+    size_t l;
+    const char *s = lua_tolstring(L, 1, &l);
+    if (l_unlikely(s == NULL))
+      return luaL_error(L, "attempt to concatenate a %s value",
+                           luaL_typename(L, 1));
+    luaL_buffinit(L, &b);
+    luaL_addlstring(&b, s, l);
+    luaL_addlstring(&b, right->b, right->n);
+    luaL_pushresult(&b);
+  }
+  return 1;
+}
+
+
+static int buf_gc (lua_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  resizebuf(L, sb, 0);
+  sb->n = 0;
+  return 0;
+}
+
+
+static const luaL_Reg buf_methods[] = {
+  {"append", buf_append},
+  {"appendf", buf_appendf},
+  {"rep", buf_rep},
+  {"reset", buf_reset},
+  {"tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg buf_meta[] = {
+  {"__concat", buf_concat},
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {"__gc", buf_gc},
+  {"__close", buf_gc},
+  {"__index", NULL},  /* placeholder */
+  {NULL, NULL}
+};
+
+
+static void createbufmeta (lua_State *L) {
+  luaL_newmetatable(L, STRBUF);
+  luaL_setfuncs(L, buf_meta, 0);
+  luaL_newlib(L, buf_methods);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = methods */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg strlib[] = {
+  {"format", str_format},
+  {"gsub", str_gsub},
+  /* placeholders */
+  {"compile", NULL},
+  {NULL, NULL}
+};
+
+
+/*
+** functions that do not yield (see 'lua_pushfastcfunction') nor call
+** back into Lua
+*/
+static const luaL_Reg str_fastfuncs[] = {
+  {"buffer", buf_new},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
   {"find", str_find},
-  {"format", str_format},
   {"gmatch", gmatch},
-  {"gsub", str_gsub},
   {"len", str_len},
   {"lower", str_lower},
   {"match", str_match},
@@ -1868,7 +3014,10 @@ static void createmetatable (lua_State *L) {
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
   luaL_newlib(L, strlib);
+  luaL_setfastfuncs(L, str_fastfuncs);
   createmetatable(L);
+  createbufmeta(L);
+  createpatmeta(L);
   return 1;
 }
 
@@ -25,6 +25,8 @@
 
 #include <math.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -174,7 +176,7 @@ static Node *mainpositionTV (const Table *t, const TValue *key) {
       void *p = pvalue(key);
       return hashpointer(t, p);
     }
-    case LUA_VLCF: {
+    case LUA_VLCF: case LUA_VFCF: {
       lua_CFunction f = fvalue(key);
       return hashpointer(t, f);
     }
@@ -215,7 +217,9 @@ l_sinline Node *mainpositionfromnode (const Table *t, Node *nd) {
 */
 static int equalkey (const TValue *k1, const Node *n2, int deadok) {
   if ((rawtt(k1) != keytt(n2)) &&  /* not the same variants? */
-       !(deadok && keyisdead(n2) && iscollectable(k1)))
+       !(deadok && keyisdead(n2) && iscollectable(k1)) &&
+       !(ttislcf(k1) &&  /* fast and plain C functions are the same key */
+         (keytt(n2) == LUA_VLCF || keytt(n2) == LUA_VFCF)))
    return 0;  /* cannot be same key */
   switch (keytt(n2)) {
     case LUA_VNIL: case LUA_VFALSE: case LUA_VTRUE:
@@ -226,7 +230,7 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
       return luai_numeq(fltvalue(k1), fltvalueraw(keyval(n2)));
     case LUA_VLIGHTUSERDATA:
       return pvalue(k1) == pvalueraw(keyval(n2));
-    case LUA_VLCF:
+    case LUA_VLCF: case LUA_VFCF:
       return fvalue(k1) == fvalueraw(keyval(n2));
     case ctb(LUA_VLNGSTR):
       return luaS_eqlngstr(tsvalue(k1), keystrval(n2));
@@ -347,13 +351,26 @@ static unsigned int findindex (lua_State *L, Table *t, TValue *key,
 
 
 int luaH_next (lua_State *L, Table *t, StkId key) {
+  unsigned int i = findindex(L, t, s2v(key), luaH_realasize(t));
+  return luaH_nextat(L, t, i, key) != 0;
+}
+
+
+/*
+** Traversal from index 'i' (0 for the first entry): puts the next
+** entry in 'key' and 'key + 1' and returns the index that continues
+** the traversal, or 0 if there are no more entries. The VM iterates
+** with these indices ('pairs' loops), so it does not look up each key
+** again as 'luaH_next' must.
+*/
+unsigned int luaH_nextat (lua_State *L, Table *t, unsigned int i,
+                          StkId key) {
   unsigned int asize = luaH_realasize(t);
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
     if (!isempty(&t->array[i])) {  /* a non-empty entry? */
       setivalue(s2v(key), i + 1);
       setobj2s(L, key + 1, &t->array[i]);
-      return 1;
+      return i + 1;
     }
   }
   for (i -= asize; cast_int(i) < sizenode(t); i++) {  /* hash part */
@@ -361,13 +378,32 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
-      return 1;
+      return (i + 1) + asize;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+/*
+** Key of the entry before traversal index 'i' (index 'i' as returned
+** by 'luaH_nextat'), or nil if there is no such entry or its key is
+** dead.
+*/
+void luaH_keyat (lua_State *L, Table *t, unsigned int i, TValue *key) {
+  unsigned int asize = luaH_realasize(t);
+  if (i > 0 && i <= asize) {  /* array part? */
+    setivalue(key, i);
+  }
+  else if (i > asize && i - asize <= cast_uint(sizenode(t)) &&
+           !keyisdead(gnode(t, i - asize - 1))) {  /* hash part? */
+    getnodekey(L, key, gnode(t, i - asize - 1));
+  }
+  else  /* traversal not started (or no such entry) */
+    setnilvalue(key);
+}
+
+
 static void freehash (lua_State *L, Table *t) {
   if (!isdummy(t))
     luaM_freearray(L, t->node, cast_sizet(sizenode(t)));
@@ -556,6 +592,7 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
   Table newt;  /* to keep the new hash part */
   unsigned int oldasize = setlimittosize(t);
   TValue *newarray;
+  luaH_changed(L, t);  /* cached slots into 't' will move */
   /* create new hash part with appropriate size into 'newt' */
   setnodevector(L, &newt, nhsize);
   if (newasize < oldasize) {  /* will array shrink? */
@@ -666,6 +703,7 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
   Node *mp;
   TValue aux;
+  luaH_changed(L, t);
   if (l_unlikely(ttisnil(key)))
     luaG_runerror(L, "table index is nil");
   else if (ttisfloat(key)) {
@@ -786,6 +824,29 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 }
 
 
+/*
+** Search function for short strings that also updates an inline
+** cache: when the key is found, 'ic' gets the index of its node.
+** Called when 'luaH_ichit' fails.
+*/
+const TValue *luaH_getshortstric (Table *t, TString *key, unsigned int *ic) {
+  Node *n = hashstr(t, key);
+  lua_assert(key->tt == LUA_VSHRSTR);
+  for (;;) {
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key)) {
+      *ic = cast_uint(n - gnode(t, 0));  /* remember where it is */
+      return gval(n);
+    }
+    else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return &absentkey;  /* not found */
+      n += nx;
+    }
+  }
+}
+
+
 const TValue *luaH_getstr (Table *t, TString *key) {
   if (key->tt == LUA_VSHRSTR)
     return luaH_getshortstr(t, key);
@@ -827,8 +888,10 @@ void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                    const TValue *slot, TValue *value) {
   if (isabstkey(slot))
     luaH_newkey(L, t, key, value);
-  else
+  else {
+    luaH_changed(L, t);
     setobj2t(L, cast(TValue *, slot), value);
+  }
 }
 
 
@@ -849,8 +912,10 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
     setivalue(&k, key);
     luaH_newkey(L, t, &k, value);
   }
-  else
+  else {
+    luaH_changed(L, t);
     setobj2t(L, cast(TValue *, p), value);
+  }
 }
 
 
@@ -983,6 +1048,263 @@ lua_Unsigned luaH_getn (Table *t) {
 }
 
 
+/*
+** {======================================================
+** Sorting
+** =======================================================
+*/
+
+/*
+** 'luaH_sortarray' sorts t[1..n], all in the array part, when they are
+** all integers, all floats (none of them NaN), or all strings, without
+** calling back Lua for each comparison. Numbers are mapped to unsigned
+** keys that compare in the same order as the numbers and then sorted
+** with a radix sort; strings are sorted by 'qsort'. For any other
+** contents, it returns 0 and leaves the table untouched.
+*/
+
+#define SORTNONE	0
+#define SORTINT		1
+#define SORTFLT		2
+#define SORTSTR		3
+
+#define SIGNBIT		(~(~(lua_Unsigned)0 >> 1))
+
+/* order-preserving maps between integers and unsigned keys */
+#define int2key(i)	(l_castS2U(i) ^ SIGNBIT)
+#define key2int(u)	l_castU2S((u) ^ SIGNBIT)
+
+/* only IEEE floats with the size of a key are mapped */
+#define fltsortable	(sizeof(lua_Number) == sizeof(lua_Unsigned))
+
+
+static lua_Unsigned flt2key (lua_Number f) {
+  lua_Unsigned u;
+  memcpy(&u, &f, sizeof(u));
+  return (u & SIGNBIT) ? ~u : u | SIGNBIT;  /* negatives in reverse */
+}
+
+
+static lua_Number key2flt (lua_Unsigned u) {
+  lua_Number f;
+  u = (u & SIGNBIT) ? u ^ SIGNBIT : ~u;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+
+static int sortkind (const TValue *a, unsigned int n) {
+  unsigned int i;
+  if (ttisinteger(&a[0])) {
+    for (i = 1; i < n; i++)
+      if (!ttisinteger(&a[i])) return SORTNONE;
+    return SORTINT;
+  }
+  else if (ttisfloat(&a[0]) && fltsortable) {
+    for (i = 0; i < n; i++)
+      if (!ttisfloat(&a[i]) || luai_numisnan(fltvalue(&a[i])))
+        return SORTNONE;
+    return SORTFLT;
+  }
+  else if (ttisstring(&a[0])) {
+    for (i = 1; i < n; i++)
+      if (!ttisstring(&a[i])) return SORTNONE;
+    return SORTSTR;
+  }
+  return SORTNONE;
+}
+
+
+#define RADIXBITS	8
+#define RADIXN		(1 << RADIXBITS)
+#define NDIGITS		(cast_int(sizeof(lua_Unsigned)) * CHAR_BIT / RADIXBITS)
+
+#define rdigit(k,d)	cast_uint(((k) >> ((d) * RADIXBITS)) & (RADIXN - 1))
+
+
+/*
+** LSD radix sort of 'a[0..n-1]' using 'aux' as scratch space; digits
+** where all keys are equal are skipped. Returns the buffer holding the
+** result ('a' or 'aux').
+*/
+static lua_Unsigned *radixsort (lua_Unsigned *a, lua_Unsigned *aux,
+                                unsigned int n) {
+  unsigned int count[NDIGITS][RADIXN];
+  unsigned int i;
+  int d;
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < n; i++) {
+    for (d = 0; d < NDIGITS; d++)
+      count[d][rdigit(a[i], d)]++;
+  }
+  for (d = 0; d < NDIGITS; d++) {
+    unsigned int *c = count[d];
+    unsigned int sum = 0;
+    int b;
+    lua_Unsigned *temp;
+    if (c[rdigit(a[0], d)] == n)  /* all keys have the same digit? */
+      continue;
+    for (b = 0; b < RADIXN; b++) {  /* count -> first position */
+      unsigned int k = c[b];
+      c[b] = sum;
+      sum += k;
+    }
+    for (i = 0; i < n; i++)
+      aux[c[rdigit(a[i], d)]++] = a[i];
+    temp = a; a = aux; aux = temp;
+  }
+  return a;
+}
+
+
+static int cmpstr (const void *a, const void *b) {
+  const TString *s1 = *cast(const TString *const *, a);
+  const TString *s2 = *cast(const TString *const *, b);
+  return (s1 == s2) ? 0 : luaV_strcmp(s1, s2);
+}
+
+
+/*
+** Invalidate all entries of the lookup cache (see 'LookupEntry').
+** Entries from an old epoch never match, so this only needs a new
+** epoch, except when the counter wraps around.
+*/
+void luaH_resetlookups (lua_State *L) {
+  global_State *g = G(L);
+  if (l_unlikely(++g->lookupepoch == 0)) {  /* wrapped around? */
+    int i;
+    for (i = 0; g->lookups != NULL && i < LUAI_LOOKUPCACHE; i++)
+      g->lookups[i].epoch = 0;
+    g->lookupepoch = 1;
+  }
+}
+
+
+/*
+** A frozen table rejects any change: it is a key of the weak-keyed
+** table 'g->frozen' (created by the first freeze) and has BITLOOKUP
+** set for good, so that all its changes reach 'luaH_changing'. Other
+** tables in cached lookups pay a test of 'g->frozen' on each change.
+*/
+int luaH_isfrozen (lua_State *L, Table *t) {
+  Table *ft = G(L)->frozen;
+  if (ft == NULL || !(t->flags & BITLOOKUP))
+    return 0;
+  else {
+    TValue k;
+    sethvalue(L, &k, t);
+    return !isempty(luaH_get(ft, &k));
+  }
+}
+
+
+void luaH_changing (lua_State *L, Table *t) {
+  if (l_unlikely(luaH_isfrozen(L, t)))
+    luaG_runerror(L, "attempt to modify a frozen table");
+  luaH_resetlookups(L);
+}
+
+
+void luaH_freeze (lua_State *L, Table *t) {
+  global_State *g = G(L);
+  TValue k, v;
+  if (g->frozen == NULL) {  /* first freeze? */
+    Table *mt;
+    g->frozen = luaH_new(L);
+    mt = luaH_new(L);
+    g->frozen->metatable = mt;  /* both are new, so no barrier */
+    setsvalue(L, &k, g->tmname[TM_MODE]);
+    setsvalue(L, &v, luaS_newliteral(L, "k"));
+    luaH_set(L, mt, &k, &v);
+    invalidateTMcache(mt);
+  }
+  sethvalue(L, &k, t);
+  setbtvalue(&v);
+  luaH_set(L, g->frozen, &k, &v);
+  luaC_barrierback(L, obj2gco(g->frozen), &k);
+  t->flags |= BITLOOKUP;
+}
+
+
+int luaH_sortarray (lua_State *L, Table *t, unsigned int n) {
+  TValue *a = t->array;
+  unsigned int i;
+  int kind;
+  lua_assert(n <= luaH_realasize(t));
+  if (n < 2 || (kind = sortkind(a, n)) == SORTNONE)
+    return 0;
+  luaH_changed(L, t);
+  if (kind == SORTSTR) {
+    TString **s;
+    for (i = 0; i < n; i++)  /* 'luaV_strcmp' needs terminated strings */
+      luaS_terminate(L, tsvalue(&a[i]));
+    s = luaM_newvector(L, n, TString *);
+    for (i = 0; i < n; i++)
+      s[i] = tsvalue(&a[i]);
+    qsort(s, n, sizeof(TString *), cmpstr);
+    for (i = 0; i < n; i++)  /* same strings; no barrier needed */
+      setsvalue(L, &a[i], s[i]);
+    luaM_freearray(L, s, n);
+  }
+  else {
+    lua_Unsigned *keys = luaM_newvector(L, cast_sizet(n) * 2, lua_Unsigned);
+    lua_Unsigned *res;
+    for (i = 0; i < n; i++)
+      keys[i] = (kind == SORTINT) ? int2key(ivalue(&a[i]))
+                                  : flt2key(fltvalue(&a[i]));
+    res = radixsort(keys, keys + n, n);
+    if (kind == SORTINT) {
+      for (i = 0; i < n; i++)
+        setivalue(&a[i], key2int(res[i]));
+    }
+    else {
+      for (i = 0; i < n; i++)
+        setfltvalue(&a[i], key2flt(res[i]));
+    }
+    luaM_freearray(L, keys, cast_sizet(n) * 2);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** 'luaH_movearray' copies src[f..f+n-1], all in the array part of
+** 'src', into dst[t..t+n-1], with a single 'memmove' (so 'src' and
+** 'dst' can be the same table, with overlapping ranges). The copy must
+** start inside the array part of 'dst' or right after it; when it goes
+** past its end, the array part grows to the next power of 2 that fits
+** it, so that repeated insertions move the array only now and then.
+** Otherwise, it returns 0 and does nothing. (The caller checks for
+** metamethods; empty slots are copied as they are, as nils.)
+*/
+int luaH_movearray (lua_State *L, Table *src, lua_Unsigned f,
+                    lua_Unsigned n, Table *dst, lua_Unsigned t) {
+  unsigned int asize = luaH_realasize(dst);
+  lua_Unsigned last = t + n - 1;  /* last destination index */
+  TValue *to;
+  lua_Unsigned i;
+  if (n == 0 || n > luaH_realasize(src) || f == 0 ||
+      f - 1 > luaH_realasize(src) - n || t == 0 || t - 1 > asize ||
+      last > MAXASIZE)
+    return 0;
+  if (last > asize) {  /* must grow 'dst'? */
+    unsigned int size = 1u << luaO_ceillog2(cast_uint(last));
+    luaH_resizearray(L, dst, (size <= MAXASIZE) ? size : MAXASIZE);
+  }
+  else
+    luaH_changed(L, dst);
+  to = &dst->array[t - 1];
+  memmove(to, &src->array[f - 1], cast_sizet(n) * sizeof(TValue));
+  if (src != dst) {  /* new values to 'dst'? */
+    for (i = 0; i < n && isblack(dst); i++)
+      luaC_barrierback(L, obj2gco(dst), &to[i]);
+  }
+  return 1;
+}
+
+
 
 #if defined(LUA_DEBUG)
 
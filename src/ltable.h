@@ -23,6 +23,15 @@
 #define invalidateTMcache(t)	((t)->flags &= ~maskflags)
 
 
+/*
+** Signal that table 't' is about to change, invalidating the lookup
+** cache if the table is part of a cached lookup. (Frozen tables also
+** have BITLOOKUP set, so that 'luaH_changing' can reject the change.)
+*/
+#define luaH_changed(L,t)  \
+	{ if (l_unlikely((t)->flags & BITLOOKUP)) luaH_changing(L, t); }
+
+
 /* true when 't' is using 'dummynode' as its hash part */
 #define isdummy(t)		((t)->lastfree == NULL)
 
@@ -35,10 +44,21 @@
 #define nodefromval(v)	cast(Node *, (v))
 
 
+/*
+** true when the node at index 'ic' (an inline-cache slot) holds the
+** short string 'k'; any table with 'k' at that position is a hit
+*/
+#define luaH_ichit(t,k,ic)  \
+	(cast_uint(ic) < cast_uint(sizenode(t)) &&  \
+	 keyisshrstr(gnode(t, ic)) && keystrval(gnode(t, ic)) == (k))
+
+
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getshortstric (Table *t, TString *key,
+                                            unsigned int *ic);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC void luaH_set (lua_State *L, Table *t, const TValue *key,
@@ -51,8 +71,19 @@ LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC unsigned int luaH_nextat (lua_State *L, Table *t, unsigned int i,
+                                    StkId key);
+LUAI_FUNC void luaH_keyat (lua_State *L, Table *t, unsigned int i,
+                           TValue *key);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
 LUAI_FUNC unsigned int luaH_realasize (const Table *t);
+LUAI_FUNC int luaH_sortarray (lua_State *L, Table *t, unsigned int n);
+LUAI_FUNC int luaH_movearray (lua_State *L, Table *src, lua_Unsigned f,
+                              lua_Unsigned n, Table *dst, lua_Unsigned t);
+LUAI_FUNC void luaH_resetlookups (lua_State *L);
+LUAI_FUNC void luaH_changing (lua_State *L, Table *t);
+LUAI_FUNC void luaH_freeze (lua_State *L, Table *t);
+LUAI_FUNC int luaH_isfrozen (lua_State *L, Table *t);
 
 
 #if defined(LUA_DEBUG)
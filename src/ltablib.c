@@ -73,6 +73,8 @@ static int tinsert (lua_State *L) {
       /* check whether 'pos' is in [1, e] */
       luaL_argcheck(L, (lua_Unsigned)pos - 1u < (lua_Unsigned)e, 2,
                        "position out of bounds");
+      if (pos < e && lua_movearray(L, 1, pos, e - 1, pos + 1, 1))
+        break;  /* moved up directly by the core */
       for (i = e; i > pos; i--) {  /* move up elements */
         lua_geti(L, 1, i - 1);
         lua_seti(L, 1, i);  /* t[i] = t[i - 1] */
@@ -96,6 +98,8 @@ static int tremove (lua_State *L) {
     luaL_argcheck(L, (lua_Unsigned)pos - 1u <= (lua_Unsigned)size, 2,
                      "position out of bounds");
   lua_geti(L, 1, pos);  /* result = t[pos] */
+  if (pos < size && lua_movearray(L, 1, pos + 1, size, pos, 1))
+    pos = size;  /* moved down directly by the core */
   for ( ; pos < size; pos++) {
     lua_geti(L, 1, pos + 1);
     lua_seti(L, 1, pos);  /* t[pos] = t[pos + 1] */
@@ -126,16 +130,19 @@ static int tmove (lua_State *L) {
     n = e - f + 1;  /* number of elements to move */
     luaL_argcheck(L, t <= LUA_MAXINTEGER - n + 1, 4,
                   "destination wrap around");
-    if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
-      for (i = 0; i < n; i++) {
-        lua_geti(L, 1, f + i);
-        lua_seti(L, tt, t + i);
+    if (!lua_movearray(L, 1, f, e, t, tt)) {  /* not done by the core? */
+      if (t > e || t <= f ||
+          (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
+        for (i = 0; i < n; i++) {
+          lua_geti(L, 1, f + i);
+          lua_seti(L, tt, t + i);
+        }
       }
-    }
-    else {
-      for (i = n - 1; i >= 0; i--) {
-        lua_geti(L, 1, f + i);
-        lua_seti(L, tt, t + i);
+      else {
+        for (i = n - 1; i >= 0; i--) {
+          lua_geti(L, 1, f + i);
+          lua_seti(L, tt, t + i);
+        }
       }
     }
   }
@@ -172,6 +179,39 @@ static int tconcat (lua_State *L) {
 }
 
 
+/*
+** Create a table with preallocated space for 'narr' array elements
+** and 'nrec' other fields, for code that is about to fill it.
+*/
+static int tnew (lua_State *L) {
+  lua_Integer narr = luaL_checkinteger(L, 1);
+  lua_Integer nrec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nrec && nrec <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)narr, (int)nrec);
+  return 1;
+}
+
+
+/*
+** Make a table read-only for good; any later change to it (even a raw
+** one) raises an error.
+*/
+static int tfreeze (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  lua_freeze(L, 1);
+  return 1;
+}
+
+
+static int tisfrozen (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_pushboolean(L, lua_isfrozen(L, 1));
+  return 1;
+}
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -200,6 +240,8 @@ static int tunpack (lua_State *L) {
   if (l_unlikely(n >= (unsigned int)INT_MAX  ||
                  !lua_checkstack(L, (int)(++n))))
     return luaL_error(L, "too many results to unpack");
+  if (lua_pusharray(L, 1, i, (int)n))
+    return (int)n;  /* pushed directly by the core */
   for (; i < e; i++) {  /* push arg[i..e - 1] (to avoid overflows) */
     lua_geti(L, 1, i);
   }
@@ -403,6 +445,8 @@ static int sort (lua_State *L) {
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
+    if (lua_isnil(L, 2) && lua_sortarray(L, 1, n))
+      return 0;  /* sorted directly by the core */
     auxsort(L, 1, (IdxT)n, 0);
   }
   return 0;
@@ -414,7 +458,6 @@ static int sort (lua_State *L) {
 static const luaL_Reg tab_funcs[] = {
   {"concat", tconcat},
   {"insert", tinsert},
-  {"pack", tpack},
   {"unpack", tunpack},
   {"remove", tremove},
   {"move", tmove},
@@ -423,8 +466,22 @@ static const luaL_Reg tab_funcs[] = {
 };
 
 
+/*
+** functions that do not yield (see 'lua_pushfastcfunction') nor call
+** back into Lua
+*/
+static const luaL_Reg tab_fastfuncs[] = {
+  {"pack", tpack},
+  {"new", tnew},
+  {"freeze", tfreeze},
+  {"isfrozen", tisfrozen},
+  {NULL, NULL}
+};
+
+
 LUAMOD_API int luaopen_table (lua_State *L) {
   luaL_newlib(L, tab_funcs);
+  luaL_setfastfuncs(L, tab_fastfuncs);
   return 1;
 }
 
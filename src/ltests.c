@@ -390,6 +390,7 @@ static void checkproto (global_State *g, Proto *f) {
   int i;
   GCObject *fgc = obj2gco(f);
   checkobjrefN(g, fgc, f->source);
+  checkobjrefN(g, fgc, f->pool);
   for (i=0; i<f->sizek; i++) {
     if (iscollectable(f->k + i))
       checkobjref(g, fgc, gcvalue(f->k + i));
@@ -400,6 +401,8 @@ static void checkproto (global_State *g, Proto *f) {
     checkobjrefN(g, fgc, f->p[i]);
   for (i=0; i<f->sizelocvars; i++)
     checkobjrefN(g, fgc, f->locvars[i].varname);
+  for (i=0; i<f->sizeswtabs; i++)
+    checkobjrefN(g, fgc, f->swtabs[i].h);
 }
 
 
@@ -1029,6 +1032,11 @@ static int table_query (lua_State *L) {
 }
 
 
+/*
+** While the table grows, bucket 's' of 'ohash' is reported with
+** bucket 's' of 'hash' if it was not moved yet, so that each string
+** in the table appears in exactly one query.
+*/
 static int string_query (lua_State *L) {
   stringtable *tb = &G(L)->strt;
   int s = cast_int(luaL_optinteger(L, 1, 0)) - 1;
@@ -1045,6 +1053,13 @@ static int string_query (lua_State *L) {
       api_incr_top(L);
       n++;
     }
+    if (tb->ohash != NULL && tb->moved <= s && s < tb->osize) {
+      for (ts = tb->ohash[s]; ts != NULL; ts = ts->u.hnext) {
+        setsvalue2s(L, L->top.p, ts);
+        api_incr_top(L);
+        n++;
+      }
+    }
     return n;
   }
   else return 0;
@@ -1198,12 +1213,102 @@ static int loadlib (lua_State *L) {
   return 0;
 }
 
+static int openlazylibs (lua_State *L) {
+  luaL_openlazylibs(getstate(L));
+  return 0;
+}
+
 static int closestate (lua_State *L) {
   lua_State *L1 = getstate(L);
   lua_close(L1);
   return 0;
 }
 
+
+/*
+** Allocator for 'bgsweep' (the one of the tests is not thread safe).
+** Its user data tells apart its two instances, and only the current
+** one may be called.
+*/
+static char sysallocs[2];
+static char *volatile cursysalloc;
+
+static void *sysalloc (void *ud, void *block, size_t osize, size_t nsize) {
+  (void)osize;
+  lua_assert(ud == cast_voidp(cursysalloc));
+  if (nsize == 0) {
+    free(block);
+    return NULL;
+  }
+  return realloc(block, nsize);
+}
+
+
+/*
+** Run 'code' in a new state whose dead objects are freed by a background
+** thread ('luaL_bgsweep'), change its allocator, run 'code' again, and
+** close the state. Returns whether the thread was running and whether
+** 'lua_setallocf' stopped it.
+*/
+static int bgsweep (lua_State *L) {
+  size_t lcode;
+  const char *code = luaL_checklstring(L, 1, &lcode);
+  lua_State *L1;
+  int on, i;
+  cursysalloc = &sysallocs[0];
+  L1 = lua_newstate(sysalloc, cursysalloc);
+  lua_atpanic(L1, tpanic);
+  luaL_openlibs(L1);
+  on = luaL_bgsweep(L1, 1);
+  for (i = 0; i < 2; i++) {
+    if (luaL_loadbuffer(L1, code, lcode, code) != LUA_OK ||
+        lua_pcall(L1, 0, 0, 0) != LUA_OK) {
+      lua_pushstring(L, lua_tostring(L1, -1));
+      lua_close(L1);
+      return lua_error(L);
+    }
+    if (i == 0) {
+      lua_setallocf(L1, sysalloc, &sysallocs[1]);
+      cursysalloc = &sysallocs[1];
+    }
+  }
+  lua_pushboolean(L, on);
+  lua_pushboolean(L, lua_getreleasef(L1, NULL) == NULL);
+  lua_close(L1);
+  return 2;
+}
+
+/*
+** Create a template state with the standard libraries and run each
+** given chunk but the last in a new sandbox of it, created just before
+** the chunk runs; then run the last chunk in the template itself.
+** Returns the result of each chunk (or its error), as a string.
+*/
+static int sandbox (lua_State *L) {
+  int n = lua_gettop(L);
+  int i;
+  lua_State *L1;
+  for (i = 1; i <= n; i++)
+    luaL_checkstring(L, i);
+  L1 = luaL_newstate();
+  lua_atpanic(L1, tpanic);
+  luaL_openlazylibs(L1);
+  for (i = 1; i <= n; i++) {
+    size_t l;
+    const char *code = lua_tolstring(L, i, &l);
+    lua_State *S = (i < n) ? luaL_newsandbox(L1) : L1;
+    int status = (i < n) ? luaL_loadsandbox(S, code, l, code, NULL)
+                         : luaL_loadbuffer(S, code, l, code);
+    if (status == LUA_OK)
+      lua_pcall(S, 0, 1, 0);
+    lua_pushstring(L, luaL_tolstring(S, -1, NULL));
+    lua_pop(S, 2);  /* result and its string */
+  }
+  lua_close(L1);
+  return n;
+}
+
+
 static int doremote (lua_State *L) {
   lua_State *L1 = getstate(L);
   size_t lcode;
@@ -1915,6 +2020,7 @@ static int coresume (lua_State *L) {
 
 static const struct luaL_Reg tests_funcs[] = {
   {"checkmemory", lua_checkmemory},
+  {"bgsweep", bgsweep},
   {"closestate", closestate},
   {"d2s", d2s},
   {"doonnewstack", doonnewstack},
@@ -1933,6 +2039,7 @@ static const struct luaL_Reg tests_funcs[] = {
   {"listabslineinfo", listabslineinfo},
   {"listlocals", listlocals},
   {"loadlib", loadlib},
+  {"openlazylibs", openlazylibs},
   {"checkpanic", checkpanic},
   {"newstate", newstate},
   {"newuserdata", newuserdata},
@@ -1943,6 +2050,7 @@ static const struct luaL_Reg tests_funcs[] = {
   {"ref", tref},
   {"resume", coresume},
   {"s2d", s2d},
+  {"sandbox", sandbox},
   {"sethook", sethook},
   {"stacklevel", stacklevel},
   {"testC", testC},
@@ -36,6 +36,10 @@
 #endif
 
 
+/* count hits and misses of inline caches */
+#define LUAI_ICSTATS
+
+
 /* get a chance to test code without jump tables */
 #define LUA_USE_JUMPTABLE	0
 
@@ -36,6 +36,10 @@ static lua_State *globalL = NULL;
 
 static const char *progname = LUA_PROGNAME;
 
+static const char *proffile = NULL;  /* output of option '-P' */
+static int profiling = 0;  /* true after the profiler started */
+static const char *covfile = NULL;  /* output of option '-C' */
+
 
 #if defined(LUA_USE_POSIX)   /* { */
 
@@ -82,7 +86,8 @@ static void laction (int i) {
 
 static void print_usage (const char *badoption) {
   lua_writestringerror("%s: ", progname);
-  if (badoption[1] == 'e' || badoption[1] == 'l')
+  if (badoption[1] == 'e' || badoption[1] == 'l' || badoption[1] == 'P' ||
+      badoption[1] == 'C')
     lua_writestringerror("'%s' needs argument\n", badoption);
   else
     lua_writestringerror("unrecognized option '%s'\n", badoption);
@@ -94,8 +99,11 @@ static void print_usage (const char *badoption) {
   "  -l mod    require library 'mod' into global 'mod'\n"
   "  -l g=mod  require library 'mod' into global 'g'\n"
   "  -v        show version information\n"
+  "  -P file   profile the run and write its samples to 'file'\n"
+  "  -C file   write the coverage of the run to 'file' (lcov format)\n"
   "  -E        ignore environment variables\n"
   "  -W        turn warnings on\n"
+  "  -O        optimize the code compiled from source\n"
   "  --        stop handling options\n"
   "  -         stop handling options and execute stdin\n"
   ,
@@ -311,7 +319,7 @@ static int collectargs (char **argv, int *first) {
           return has_error;  /* invalid option */
         args |= has_E;
         break;
-      case 'W':
+      case 'W': case 'O':
         if (argv[i][2] != '\0')  /* extra characters? */
           return has_error;  /* invalid option */
         break;
@@ -331,6 +339,16 @@ static int collectargs (char **argv, int *first) {
             return has_error;  /* no next argument or it is another option */
         }
         break;
+      case 'P': case 'C': {  /* need an argument, too */
+        const char **file = (argv[i][1] == 'P') ? &proffile : &covfile;
+        if (argv[i][2] != '\0')  /* concatenated argument? */
+          *file = argv[i] + 2;
+        else if (argv[i + 1] == NULL || argv[i + 1][0] == '-')
+          return has_error;  /* no next argument or it is another option */
+        else
+          *file = argv[++i];
+        break;
+      }
       default:  /* invalid option */
         return has_error;
     }
@@ -342,7 +360,7 @@ static int collectargs (char **argv, int *first) {
 
 /*
 ** Processes options 'e' and 'l', which involve running Lua code, and
-** 'W', which also affects the state.
+** 'W' and 'O', which also affect the state.
 ** Returns 0 if some code raises an error.
 */
 static int runargs (lua_State *L, char **argv, int n) {
@@ -365,12 +383,156 @@ static int runargs (lua_State *L, char **argv, int n) {
       case 'W':
         lua_warning(L, "@on", 0);  /* warnings on */
         break;
+      case 'O':
+        lua_setoptlevel(L, 1);  /* optimizer on */
+        break;
+      case 'P': case 'C':
+        if (argv[i][2] == '\0') i++;  /* skip its argument */
+        break;
     }
   }
   return 1;
 }
 
 
+/*
+** Push function 'name' from the profiler library.
+*/
+static void pushprofiler (lua_State *L, const char *name) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+  lua_getfield(L, -1, LUA_PROFLIBNAME);
+  lua_getfield(L, -1, name);
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+}
+
+
+/*
+** Option '-P': start the profiler before running any code.
+*/
+static int startprofile (lua_State *L) {
+  int status;
+  pushprofiler(L, "start");
+  status = report(L, docall(L, 0, 0));
+  profiling = (status == LUA_OK);
+  return status;
+}
+
+
+#if defined(LUAI_VMSTATS)	/* { */
+
+#include "lopnames.h"
+
+typedef struct OpCount {
+  int op, next;  /* opcode and, for pairs, the one that followed it */
+  lua_Unsigned count;
+} OpCount;
+
+
+static int cmpcount (const void *a, const void *b) {
+  lua_Unsigned ca = ((const OpCount *)a)->count;
+  lua_Unsigned cb = ((const OpCount *)b)->count;
+  return (ca < cb) - (ca > cb);  /* larger counts first */
+}
+
+
+/*
+** Write the opcode and opcode-pair counts of a LUAI_VMSTATS build to
+** 'stderr', largest first, as tab-separated lines ("op NAME count" and
+** "pair NAME NAME count").
+*/
+static void dumpvmstats (lua_State *L) {
+  int nops = lua_getvmstats(L, -1, NULL);
+  lua_Unsigned *counts = (lua_Unsigned *)malloc(nops * sizeof(lua_Unsigned));
+  OpCount *all = (OpCount *)malloc(nops * nops * sizeof(OpCount));
+  int n = 0, op, i;
+  if (counts == NULL || all == NULL) {
+    free(counts); free(all);
+    return;
+  }
+  lua_getvmstats(L, -1, counts);
+  for (op = 0; op < nops; op++) {
+    if (counts[op] > 0) {
+      all[n].op = op; all[n].next = -1; all[n++].count = counts[op];
+    }
+  }
+  qsort(all, n, sizeof(OpCount), cmpcount);
+  for (i = 0; i < n; i++)
+    fprintf(stderr, "op\t%s\t" LUA_INTEGER_FMT "\n", opnames[all[i].op],
+                    (LUAI_UACINT)all[i].count);
+  n = 0;
+  for (op = 0; op < nops; op++) {
+    int next;
+    lua_getvmstats(L, op, counts);
+    for (next = 0; next < nops; next++) {
+      if (counts[next] > 0) {
+        all[n].op = op; all[n].next = next; all[n++].count = counts[next];
+      }
+    }
+  }
+  qsort(all, n, sizeof(OpCount), cmpcount);
+  for (i = 0; i < n; i++)
+    fprintf(stderr, "pair\t%s\t%s\t" LUA_INTEGER_FMT "\n",
+                    opnames[all[i].op], opnames[all[i].next],
+                    (LUAI_UACINT)all[i].count);
+  free(counts);
+  free(all);
+}
+
+#else				/* }{ */
+
+#define dumpvmstats(L)	((void)0)
+
+#endif				/* } */
+
+
+/*
+** Stop the profiler and write its samples to 'proffile'.
+*/
+static void finishprofile (lua_State *L) {
+  FILE *f;
+  size_t len;
+  const char *s;
+  int ok;
+  pushprofiler(L, "stop");
+  if (report(L, docall(L, 0, 1)) != LUA_OK)
+    return;
+  s = lua_tolstring(L, -1, &len);
+  f = fopen(proffile, "w");
+  ok = (f != NULL && fwrite(s, 1, len, f) == len);
+  if (f != NULL && fclose(f) != 0)
+    ok = 0;
+  if (!ok) {
+    lua_pushfstring(L, "cannot write profile '%s'", proffile);
+    l_message(progname, lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+}
+
+
+static int coverwriter (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;  /* not used */
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** Option '-C': write the coverage of the run to 'covfile'.
+*/
+static void finishcoverage (lua_State *L) {
+  FILE *f = fopen(covfile, "w");
+  int ok = (f != NULL && lua_coverage(L, coverwriter, f) == 0);
+  if (f != NULL && fclose(f) != 0)
+    ok = 0;
+  if (!ok) {
+    lua_pushfstring(L, "cannot write coverage '%s'", covfile);
+    l_message(progname, lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+
 static int handle_luainit (lua_State *L) {
   const char *name = "=" LUA_INITVARVERSION;
   const char *init = getenv(name + 1);
@@ -644,6 +806,10 @@ static int pmain (lua_State *L) {
   createargtable(L, argv, argc, script);  /* create table 'arg' */
   lua_gc(L, LUA_GCRESTART);  /* start GC... */
   lua_gc(L, LUA_GCGEN, 0, 0);  /* ...in generational mode */
+  if (proffile != NULL && startprofile(L) != LUA_OK)
+    return 0;
+  if (covfile != NULL)
+    lua_setcoverage(L, 1);
   if (!(args & has_E)) {  /* no option '-E'? */
     if (handle_luainit(L) != LUA_OK)  /* run LUA_INIT */
       return 0;  /* error running LUA_INIT */
@@ -682,6 +848,11 @@ int main (int argc, char **argv) {
   status = lua_pcall(L, 2, 1, 0);  /* do the call */
   result = lua_toboolean(L, -1);  /* get result */
   report(L, status);
+  if (profiling)
+    finishprofile(L);  /* write samples of option '-P' */
+  if (covfile != NULL)
+    finishcoverage(L);  /* write results of option '-C' */
+  dumpvmstats(L);
   lua_close(L);
   return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
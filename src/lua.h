@@ -82,7 +82,16 @@ typedef struct lua_State lua_State;
 /* predefined values in the registry */
 #define LUA_RIDX_MAINTHREAD	1
 #define LUA_RIDX_GLOBALS	2
-#define LUA_RIDX_LAST		LUA_RIDX_GLOBALS
+#define LUA_RIDX_TYPEDARRAY	3
+#define LUA_RIDX_LAST		LUA_RIDX_TYPEDARRAY
+
+
+/* kinds of elements of typed arrays (see 'lua_newtypedarray') */
+#define LUA_TAF64	0
+#define LUA_TAI64	1
+#define LUA_TAI32	2
+
+#define LUA_NUMTAKINDS	3
 
 
 /* type of numbers in Lua */
@@ -124,6 +133,20 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** Type for functions that release memory of dead objects on behalf of
+** the collector (see 'lua_setreleasef')
+*/
+typedef void (*lua_Release) (void *ud, void *const *blocks,
+                             const size_t *sizes, int n);
+
+
+/*
+** Type for functions sampling allocations (see 'lua_setallocsampler')
+*/
+typedef void (*lua_AllocSampler) (lua_State *L, size_t bytes);
+
+
 /*
 ** Type for warning functions
 */
@@ -181,6 +204,7 @@ LUA_API void  (lua_pushvalue) (lua_State *L, int idx);
 LUA_API void  (lua_rotate) (lua_State *L, int idx, int n);
 LUA_API void  (lua_copy) (lua_State *L, int fromidx, int toidx);
 LUA_API int   (lua_checkstack) (lua_State *L, int n);
+LUA_API int   (lua_reservestack) (lua_State *L, int nslots, int ncalls);
 
 LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
 
@@ -245,10 +269,13 @@ LUA_API void        (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
+LUA_API void        (lua_pushslice) (lua_State *L, int idx, size_t i,
+                                                    size_t len);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
 LUA_API void  (lua_pushcclosure) (lua_State *L, lua_CFunction fn, int n);
+LUA_API void  (lua_pushfastcfunction) (lua_State *L, lua_CFunction fn);
 LUA_API void  (lua_pushboolean) (lua_State *L, int b);
 LUA_API void  (lua_pushlightuserdata) (lua_State *L, void *p);
 LUA_API int   (lua_pushthread) (lua_State *L);
@@ -264,10 +291,16 @@ LUA_API int (lua_geti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawget) (lua_State *L, int idx);
 LUA_API int (lua_rawgeti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawgetp) (lua_State *L, int idx, const void *p);
+LUA_API int (lua_getarray) (lua_State *L, int idx, lua_Integer i,
+                            lua_Number *v, int n);
+LUA_API int (lua_pusharray) (lua_State *L, int idx, lua_Integer i, int n);
 
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
 LUA_API void *(lua_newuserdatauv) (lua_State *L, size_t sz, int nuvalue);
 LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
+LUA_API void *(lua_newtypedarray) (lua_State *L, int kind, size_t n);
+LUA_API void *(lua_totypedarray) (lua_State *L, int idx, int *kind,
+                                  size_t *n);
 LUA_API int  (lua_getiuservalue) (lua_State *L, int idx, int n);
 
 
@@ -281,6 +314,13 @@ LUA_API void  (lua_seti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
+LUA_API void  (lua_setarray) (lua_State *L, int idx, lua_Integer i,
+                              const lua_Number *v, int n);
+LUA_API int   (lua_sortarray) (lua_State *L, int idx, lua_Integer n);
+LUA_API int   (lua_movearray) (lua_State *L, int from, lua_Integer f,
+                               lua_Integer e, lua_Integer t, int to);
+LUA_API void  (lua_freeze) (lua_State *L, int idx);
+LUA_API int   (lua_isfrozen) (lua_State *L, int idx);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API int   (lua_setiuservalue) (lua_State *L, int idx, int n);
 
@@ -337,10 +377,57 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCADAPT		12
+#define LUA_GCADAPTINFO		13
+#define LUA_GCTHREADPOOL	14
+
+/* values of the adaptive collector (see LUA_GCADAPTINFO) */
+#define LUA_GCAMINOR		0	/* minor collections */
+#define LUA_GCAMAJOR		1	/* major collections */
+#define LUA_GCABADMAJOR		2	/* major collections that freed too little */
+#define LUA_GCATOINC		3	/* switches to incremental mode */
+#define LUA_GCATOGEN		4	/* switches to generational mode */
+#define LUA_GCAMINORUP		5	/* raises of the minor multiplier */
+#define LUA_GCAMINORDOWN	6	/* cuts of the minor multiplier */
+#define LUA_GCAMAJORUP		7	/* raises of the major multiplier */
+#define LUA_GCAMAJORDOWN	8	/* cuts of the major multiplier */
+#define LUA_GCANUMCOUNTS	9	/* number of counters */
+#define LUA_GCASURVIVAL		9	/* survival rate of young objects (%) */
+#define LUA_GCAMINORMUL		10	/* current minor multiplier */
+#define LUA_GCAMAJORMUL		11	/* current major multiplier */
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
 
 
+/* phases of a collection (see 'lua_gcstats') */
+#define LUA_GCPPROPAGATE	0	/* marking of reachable objects */
+#define LUA_GCPATOMIC		1	/* atomic step */
+#define LUA_GCPSWEEP		2	/* sweeping of dead objects */
+#define LUA_GCPFINALIZE		3	/* calls to finalizers */
+#define LUA_GCNUMPHASES		4
+
+typedef struct lua_GCPhase {
+  double time;  /* seconds spent in the phase */
+  ptrdiff_t freed;  /* bytes released while in the phase (net) */
+} lua_GCPhase;
+
+typedef struct lua_GCStats {
+  size_t minor;  /* minor (young) collections */
+  size_t major;  /* major collections and complete incremental cycles */
+  size_t finalized;  /* finalizers called */
+  lua_GCPhase total[LUA_GCNUMPHASES];  /* accumulated by all collections */
+  lua_GCPhase last[LUA_GCNUMPHASES];  /* last complete collection */
+  /* objects traversed, by type */
+  size_t strings, tables, lclosures, cclosures;
+  size_t userdata, threads, protos, upvalues;
+} lua_GCStats;
+
+LUA_API void (lua_gcstats) (lua_State *L, lua_GCStats *stats);
+LUA_API int (lua_snapshot) (lua_State *L, lua_Writer writer, void *data);
+LUA_API void (lua_setcoverage) (lua_State *L, int on);
+LUA_API int (lua_coverage) (lua_State *L, lua_Writer writer, void *data);
+
+
 /*
 ** miscellaneous functions
 */
@@ -357,9 +444,49 @@ LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
 
+LUA_API lua_Release (lua_getreleasef) (lua_State *L, void **ud);
+LUA_API void        (lua_setreleasef) (lua_State *L, lua_Release f, void *ud);
+
 LUA_API void (lua_toclose) (lua_State *L, int idx);
 LUA_API void (lua_closeslot) (lua_State *L, int idx);
 
+LUA_API int (lua_icstats) (lua_State *L, lua_Unsigned *hits,
+                                         lua_Unsigned *misses);
+LUA_API int (lua_getvmstats) (lua_State *L, int op, lua_Unsigned *counts);
+LUA_API void (lua_setsecurekey) (lua_State *L, lua_Unsigned key);
+LUA_API int (lua_setoptlevel) (lua_State *L, int level);
+LUA_API void (lua_setbudget) (lua_State *L, lua_Integer steps);
+LUA_API lua_Integer (lua_getbudget) (lua_State *L);
+LUA_API void (lua_setmemlimit) (lua_State *L, size_t limit);
+
+/*
+** Memory accounting contexts (see 'lua_setmemctx')
+*/
+#define LUA_NUMMEMCTX	256
+
+LUA_API int (lua_setmemctx) (lua_State *L, int ctx);
+LUA_API int (lua_getmemctx) (lua_State *L);
+LUA_API int (lua_memctxstats) (lua_State *L, int ctx, lua_Unsigned *bytes,
+                                                      lua_Unsigned *count);
+LUA_API void (lua_setallocsampler) (lua_State *L, lua_AllocSampler f,
+                                                  size_t rate);
+
+/*
+** Functions with intrinsic opcodes (see 'lua_setintrinsic')
+*/
+#define LUA_INTRFLOOR	0
+#define LUA_INTRCEIL	1
+#define LUA_INTRABS	2
+#define LUA_INTRSQRT	3
+#define LUA_INTRMIN	4
+#define LUA_INTRMAX	5
+#define LUA_INTRNEXT	6
+#define LUA_INTRIPAIRS	7
+
+#define LUA_NUMINTRS	8
+
+LUA_API void (lua_setintrinsic) (lua_State *L, int intr, lua_CFunction f);
+
 
 /*
 ** {==============================================================
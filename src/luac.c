@@ -36,7 +36,10 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
-static int report=0;			/* generate analysis report */
+static int optimizing=0;		/* run the optimizer? */
+static int report=0;			/* analysis report (1: JSON, 2: protobuf) */
+static const char* securekey=NULL;	/* key for secure functions */
+static int workers=0;			/* workers for many files (0: per CPU) */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -65,10 +68,14 @@ static void usage(const char* message)
   "Available options are:\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O       optimize the code\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
   "  -r       generate analysis report (JSON)\n"
+  "  -R       generate analysis report (protobuf)\n"
+  "  -k key   key for secure functions (number)\n"
+  "  -j n     use n workers for many files (reports or compilation)\n"
   "  --       stop handling options\n"
   "  -        stop handling options and process stdin\n"
   ,progname,Output);
@@ -103,6 +110,8 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -111,6 +120,18 @@ static int doargs(int argc, char* argv[])
    ++version;
   else if (IS("-r"))			/* generate report */
    report=1;
+  else if (IS("-R"))			/* generate binary report */
+   report=2;
+  else if (IS("-k"))			/* key for secure functions */
+  {
+   securekey=argv[++i];
+   if (securekey==NULL || *securekey==0) usage("'-k' needs argument");
+  }
+  else if (IS("-j"))			/* workers for many files */
+  {
+   const char* n=argv[++i];
+   if (n==NULL || (workers=atoi(n))<=0) usage("'-j' needs a positive number");
+  }
   else					/* unknown option */
    usage(argv[i]);
  }
@@ -165,6 +186,13 @@ static const Proto* combine(lua_State* L, int n)
  }
 }
 
+static void loadall(lua_State* L, Proto* f)	/* decode lazy parts */
+{
+ int i;
+ if (f->kblob!=NULL) luaU_decodek(L,f);
+ for (i=0; i<f->sizep; i++) loadall(L,luaU_getproto(L,f,i));
+}
+
 static int writer(lua_State* L, const void* p, size_t size, void* u)
 {
  UNUSED(L);
@@ -181,27 +209,230 @@ static void Report(lua_State* L, const Proto* f)
 	 */
 	int using_explicit_output = (output != Output); /* Output is the default array */
 	const char* report_path = using_explicit_output ? output : REPORT_OUTPUT;
-	FILE* out = (report_path==NULL) ? stdout : fopen(report_path,"w");
+	FILE* out = (report_path==NULL) ? stdout : fopen(report_path,"wb");
 	if (out==NULL) cannot("open");
-	print_report_json(rep, out);
+	if (report==2)
+	{
+		size_t size;
+		unsigned char* b = report_to_protobuf(rep, &size);
+		if (b==NULL) fatal("not enough memory");
+		if (fwrite(b,1,size,out)!=size) cannot("write");
+		free(b);
+	}
+	else
+		print_report_json(rep, out);
 	if (report_path) fclose(out);
 	free_report(rep);
 }
 
+static char* readfile(const char* filename, size_t* size)
+{
+ FILE* f= (filename==NULL) ? stdin : fopen(filename,"rb");
+ char* b=NULL;
+ size_t n=0,cap=0;
+ if (f==NULL)
+ {
+  fprintf(stderr,"%s: cannot open %s: %s\n",progname,filename,strerror(errno));
+  exit(EXIT_FAILURE);
+ }
+ for (;;)
+ {
+  if (n==cap)
+  {
+   cap= (cap==0) ? BUFSIZ : 2*cap;
+   b=(char*)realloc(b,cap);
+   if (b==NULL) fatal("not enough memory");
+  }
+  n+=fread(b+n,1,cap-n,f);
+  if (n<cap) break;
+ }
+ if (ferror(f)) fatal("cannot read input");
+ if (filename!=NULL) fclose(f);
+ *size=n;
+ return b;
+}
+
+static void writereport(FILE* out, const DiluviumJob* job, int sep)
+{
+ if (report==2)				/* length-delimited message */
+ {
+  unsigned char v[10];
+  size_t x=job->report_len;
+  int k=0;
+  do { v[k]=(unsigned char)((x&0x7f)|((x>0x7f)<<7)); x>>=7; k++; } while (x);
+  fwrite(v,1,k,out);
+  fwrite(job->report,1,job->report_len,out);
+ }
+ else					/* element of a JSON array */
+ {
+  size_t n=job->report_len;
+  while (n>0 && job->report[n-1]=='\n') n--;
+  if (sep) fputs(",\n",out);
+  fwrite(job->report,1,n,out);
+ }
+}
+
+/*
+** Read input file 'i' for a worker: its text (in 'bufs[i]'), without a
+** first line starting with '#' (but keeping its '\n'), and its chunk
+** name (in 'names[i]').
+*/
+static const char* readsource(char* argv[], int i, size_t* size,
+                              char** bufs, char** names)
+{
+ const char* filename=IS("-") ? NULL : argv[i];
+ const char* s=bufs[i]=readfile(filename,size);
+ if (*size>0 && *s=='#')		/* skip first line, keeping its '\n' */
+ {
+  while (*size>0 && *s!='\n') { s++; (*size)--; }
+ }
+ names[i]=(char*)malloc(filename ? strlen(filename)+2 : sizeof("=stdin"));
+ if (names[i]==NULL) fatal("not enough memory");
+ if (filename) { names[i][0]='@'; strcpy(names[i]+1,filename); }
+ else strcpy(names[i],"=stdin");
+ return s;
+}
+
+/*
+** Reports for many files: each file is analyzed on its own (not combined)
+** by a pool of workers. With '-o', all reports go to that file (a JSON
+** array, or length-delimited messages with '-R'); otherwise each one goes
+** to the file name plus ".json" (or ".pb").
+*/
+static void Reports(int argc, char* argv[])
+{
+ DiluviumJob* jobs=(DiluviumJob*)calloc(argc,sizeof(DiluviumJob));
+ char** bufs=(char**)calloc(argc,sizeof(char*));
+ char** names=(char**)calloc(argc,sizeof(char*));
+ const char* ext= (report==2) ? ".pb" : ".json";
+ int merged= (output!=Output);
+ FILE* out=NULL;
+ int i;
+ if (jobs==NULL || bufs==NULL || names==NULL) fatal("not enough memory");
+ for (i=0; i<argc; i++)
+ {
+  jobs[i].source=readsource(argv,i,&jobs[i].source_len,bufs,names);
+  jobs[i].chunkname=names[i];
+ }
+ diluvium_generate_reports(jobs,argc,workers,
+   (report==2) ? DILUVIUM_REPORT_PROTOBUF : DILUVIUM_REPORT_JSON);
+ for (i=0; i<argc; i++)
+  if (jobs[i].report==NULL)
+   fatal(jobs[i].error ? jobs[i].error : "not enough memory");
+ if (merged)
+ {
+  out= (output==NULL) ? stdout : fopen(output,"wb");
+  if (out==NULL) cannot("open");
+  if (report!=2) fputs("[\n",out);
+ }
+ for (i=0; i<argc; i++)
+ {
+  if (!merged)
+  {
+   const char* filename=IS("-") ? NULL : argv[i];
+   size_t size=filename ? strlen(filename)+strlen(ext)+1
+                        : sizeof(REPORT_OUTPUT);
+   char* path=(char*)malloc(size);
+   if (path==NULL) fatal("not enough memory");
+   if (filename) { strcpy(path,filename); strcat(path,ext); }
+   else strcpy(path,REPORT_OUTPUT);
+   out=fopen(path,"wb");
+   if (out==NULL) { output=path; cannot("open"); }
+   fwrite(jobs[i].report,1,jobs[i].report_len,out);
+   if (ferror(out) || fclose(out)) { output=path; cannot("write"); }
+   free(path);
+  }
+  else
+   writereport(out,&jobs[i],i>0);
+  free(jobs[i].report);
+  free(bufs[i]);
+  free(names[i]);
+ }
+ if (merged)
+ {
+  if (report!=2) fputs("\n]\n",out);
+  if (ferror(out)) cannot("write");
+  if (output!=NULL && fclose(out)) cannot("close");
+ }
+ free(bufs);
+ free(names);
+ free(jobs);
+}
+
+/*
+** Load many files compiled in parallel ('-j'): a pool of workers compiles
+** each file to a binary chunk, which is loaded back here to be combined.
+*/
+static void loadparallel(lua_State* L, int argc, char* argv[],
+                         int flags, lua_Unsigned key)
+{
+ DiluviumCompileJob* jobs=(DiluviumCompileJob*)calloc(argc,sizeof(*jobs));
+ char** bufs=(char**)calloc(argc,sizeof(char*));
+ char** names=(char**)calloc(argc,sizeof(char*));
+ int i;
+ if (jobs==NULL || bufs==NULL || names==NULL) fatal("not enough memory");
+ for (i=0; i<argc; i++)
+ {
+  jobs[i].source=readsource(argv,i,&jobs[i].source_len,bufs,names);
+  jobs[i].chunkname=names[i];
+ }
+ diluvium_compile(jobs,argc,workers,flags,key);
+ for (i=0; i<argc; i++)
+ {
+  if (jobs[i].code==NULL)
+   fatal(jobs[i].error ? jobs[i].error : "not enough memory");
+  if (luaL_loadbufferx(L,jobs[i].code,jobs[i].code_len,names[i],"b")!=LUA_OK)
+   fatal(lua_tostring(L,-1));
+  free(jobs[i].code);
+  free(bufs[i]);
+  free(names[i]);
+ }
+ free(bufs);
+ free(names);
+ free(jobs);
+}
+
 static int pmain(lua_State* L)
 {
  int argc=(int)lua_tointeger(L,1);
  char** argv=(char**)lua_touserdata(L,2);
  const Proto* f;
+ int flags=0;
  int i;
  tmname=G(L)->tmname;
+ if (securekey!=NULL)
+ {
+  lua_Integer key;
+  if (lua_stringtonumber(L,securekey)==0 || !lua_isinteger(L,-1))
+   usage("'-k' needs an integer key");
+  key=lua_tointeger(L,-1);
+  lua_pop(L,1);
+  lua_setsecurekey(L,(lua_Unsigned)key);
+  flags|=DILUVIUM_COMPILE_KEY;
+ }
+ if (optimizing)
+ {
+  lua_setoptlevel(L,1);
+  flags|=DILUVIUM_COMPILE_OPTIMIZE;
+ }
+ if (report && argc>1)
+ {
+  Reports(argc,argv);
+  return 0;
+ }
  if (!lua_checkstack(L,argc)) fatal("too many input files");
- for (i=0; i<argc; i++)
+ if (workers>0 && argc>1)
+  loadparallel(L,argc,argv,flags,(lua_Unsigned)G(L)->securekey);
+ else
  {
-  const char* filename=IS("-") ? NULL : argv[i];
-  if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
+  for (i=0; i<argc; i++)
+  {
+   const char* filename=IS("-") ? NULL : argv[i];
+   if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
+  }
  }
  f=combine(L,argc);
+ if (listing || report) loadall(L,(Proto*)f);
  if (listing) luaU_print(f,listing>1);
  if (dumping && !report)
  {
@@ -420,6 +651,7 @@ static void PrintCode(const Proto* f)
 	printf(COMMENT "%s",UPVALNAME(b));
 	break;
    case OP_GETTABUP:
+   case OP_GETTABUPF:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT "%s",UPVALNAME(b));
 	printf(" "); PrintConstant(f,c);
@@ -431,6 +663,7 @@ static void PrintCode(const Proto* f)
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_GETFIELD:
+   case OP_GETFIELDC:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
@@ -464,19 +697,19 @@ static void PrintCode(const Proto* f)
    case OP_ADDI:
 	printf("%d %d %d",a,b,sc);
 	break;
-   case OP_ADDK:
+   case OP_ADDK: case OP_ADDKI:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
-   case OP_SUBK:
+   case OP_SUBK: case OP_SUBKI:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
-   case OP_MULK:
+   case OP_MULK: case OP_MULKI:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
-   case OP_MODK:
+   case OP_MODK: case OP_MODKI:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
@@ -488,7 +721,7 @@ static void PrintCode(const Proto* f)
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
-   case OP_IDIVK:
+   case OP_IDIVK: case OP_IDIVKI:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
@@ -510,13 +743,13 @@ static void PrintCode(const Proto* f)
    case OP_SHLI:
 	printf("%d %d %d",a,b,sc);
 	break;
-   case OP_ADD:
+   case OP_ADD: case OP_ADDII:
 	printf("%d %d %d",a,b,c);
 	break;
-   case OP_SUB:
+   case OP_SUB: case OP_SUBII:
 	printf("%d %d %d",a,b,c);
 	break;
-   case OP_MUL:
+   case OP_MUL: case OP_MULII:
 	printf("%d %d %d",a,b,c);
 	break;
    case OP_MOD:
@@ -575,16 +808,24 @@ static void PrintCode(const Proto* f)
    case OP_CONCAT:
 	printf("%d %d",a,b);
 	break;
+   case OP_FSTRING:
+	printf("%d %d",a,b);
+	break;
    case OP_CLOSE:
 	printf("%d",a);
 	break;
    case OP_TBC:
 	printf("%d",a);
+	if (b) printf(" %d",b);
 	break;
    case OP_JMP:
 	printf("%d",GETARG_sJ(i));
 	printf(COMMENT "to %d",GETARG_sJ(i)+pc+2);
 	break;
+   case OP_SWITCH:
+	printf("%d %d",a,bx);
+	printf(COMMENT "%d cases",f->swtabs[bx].ncases);
+	break;
    case OP_EQ:
 	printf("%d %d %d",a,b,isk);
 	break;
@@ -620,6 +861,8 @@ static void PrintCode(const Proto* f)
 	printf("%d %d %d",a,b,isk);
 	break;
    case OP_CALL:
+   case OP_CALLFLOOR: case OP_CALLCEIL: case OP_CALLABS:
+   case OP_CALLSQRT: case OP_CALLMIN: case OP_CALLMAX:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT);
 	if (b==0) printf("all in "); else printf("%d in ",b-1);
@@ -677,6 +920,9 @@ static void PrintCode(const Proto* f)
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
+   case OP_2Q:
+	printf("%d %d",a,isk);
+	break;
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
@@ -738,6 +984,20 @@ static void PrintDebug(const Proto* f)
   printf("\t%d\t%s\t%d\t%d\n",
   i,UPVALNAME(i),f->upvalues[i].instack,f->upvalues[i].idx);
  }
+ n=f->sizeswtabs;
+ if (n>0) printf("switches (%d) for %p:\n",n,VOID(f));
+ for (i=0; i<n; i++)
+ {
+  int c;
+  printf("\t%d",i);
+  for (c=0; c<f->swtabs[i].ncases; c++)
+  {
+   printf("\t");
+   PrintConstant(f,f->swtabs[i].cases[c].k);
+   printf(":%d",f->swtabs[i].cases[c].pc+1);
+  }
+  printf("\n");
+ }
 }
 
 static void PrintFunction(const Proto* f, int full)
@@ -413,6 +413,16 @@
 */
 
 
+/*
+@@ LUA_NUMBER_SHORTEST makes Lua convert floats to strings with the
+** shortest numeral that reads back as the same float, instead of with
+** LUA_NUMBER_FMT (which loses precision, but is the format of the
+** standard Lua). It affects 'tostring', concatenation, and the like.
+@@ LUA_NOFASTNUMFMT makes Lua convert all numbers with 'printf' and
+** read all decimal floats with 'lua_str2number'.
+*/
+/* #define LUA_NUMBER_SHORTEST */
+
 /* The following definitions are good for most cases here */
 
 #define l_floor(x)		(l_mathop(floor)(x))
@@ -727,6 +737,15 @@
 #define luai_apicheck(l,e)	assert(e)
 #endif
 
+
+/*
+@@ LUAI_VMSTATS makes the interpreter count every opcode it executes
+** and every pair of consecutive opcodes (see 'lua_getvmstats'). It
+** slows the interpreter down; use it only to collect data ('make
+** diluvium_stats' builds such an interpreter).
+*/
+/* #define LUAI_VMSTATS */
+
 /* }================================================================== */
 
 
@@ -44,9 +44,34 @@ LUAMOD_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUAMOD_API int (luaopen_package) (lua_State *L);
 
+#define LUA_PROFLIBNAME	"profiler"
+LUAMOD_API int (luaopen_profiler) (lua_State *L);
+
+#define LUA_ARRAYLIBNAME	"array"
+LUAMOD_API int (luaopen_array) (lua_State *L);
+
+#define LUA_DVMLIBNAME	"dvm"
+LUAMOD_API int (luaopen_dvm) (lua_State *L);
+
+#define LUA_JSONLIBNAME	"json"
+LUAMOD_API int (luaopen_json) (lua_State *L);
+
+#define LUA_PERFLIBNAME	"perf"
+LUAMOD_API int (luaopen_perf) (lua_State *L);
+
+/* an event of the trace of the perf library */
+typedef struct luaL_PerfEvent {
+  lua_Integer time;  /* in nanoseconds, as given by 'perf.now' */
+  const char *name;  /* name of the span begun (NULL at its end) */
+  int thread;  /* 1 for the main thread; 2 on for coroutines */
+} luaL_PerfEvent;
+
+LUALIB_API int (luaL_perfdrain) (lua_State *L, luaL_PerfEvent *ev, int n);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
+LUALIB_API void (luaL_openlazylibs) (lua_State *L);
 
 
 #endif
@@ -20,15 +20,49 @@
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstring.h"
 #include "lundump.h"
 #include "lzio.h"
 
-static void unscramble_bytes(void *data, size_t size) {
-  unsigned char *p = (unsigned char *)data;
-  unsigned char key = 0xBE;
-  for (size_t i = 0; i < size; i++) {
-    p[i] ^= key;
+
+/*
+** Word 'i' of the keystream for 'key'. Each word depends only on its
+** position, so that 'luaU_scramble' can work on whole words with no
+** dependency between iterations.
+*/
+static l_uint32 keyword (l_uint32 key, size_t i) {
+  l_uint32 x = (key ^ (cast(l_uint32, i) * 0x9E3779B9u)) & 0xFFFFFFFFu;
+  x ^= x >> 16;
+  x = (x * 0x85EBCA6Bu) & 0xFFFFFFFFu;
+  x ^= x >> 13;
+  x = (x * 0xC2B2AE35u) & 0xFFFFFFFFu;
+  x ^= x >> 16;
+  return x;
+}
+
+
+/*
+** Keyed transform for secure functions: XOR the block with a keystream
+** derived from 'key'; the transform is its own inverse. (This hides the
+** contents of a dump, but it is not encryption.)
+*/
+void luaU_scramble (void *b, size_t size, l_uint32 key) {
+  char *p = cast(char *, b);
+  size_t nw = size / 4;  /* number of whole words */
+  size_t i;
+  for (i = 0; i < nw; i++) {
+    l_uint32 k = keyword(key, i);
+    unsigned char *w = cast(unsigned char *, p + i * 4);
+    w[0] ^= cast_byte(k);
+    w[1] ^= cast_byte(k >> 8);
+    w[2] ^= cast_byte(k >> 16);
+    w[3] ^= cast_byte(k >> 24);
+  }
+  if (nw * 4 < size) {  /* partial last word? */
+    l_uint32 k = keyword(key, nw);
+    for (i = nw * 4; i < size; i++, k >>= 8)
+      p[i] ^= cast_char(k & 0xFF);
   }
 }
 
@@ -41,6 +75,9 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  size_t offset;  /* current position relative to beginning of dump */
+  lu_byte fixed;  /* dump is fixed in memory (see 'loadFixed') */
+  Proto *pool;  /* strings shared by the functions of the dump */
 } LoadState;
 
 
@@ -59,6 +96,38 @@ static l_noret error (LoadState *S, const char *why) {
 static void loadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated chunk");
+  S->offset += size;
+}
+
+
+/*
+** Skip the padding that 'dumpAlign' added to the dump.
+*/
+static void loadAlign (LoadState *S, unsigned int align) {
+  unsigned int padding = align - cast_uint(S->offset % align);
+  if (padding < align) {  /* padding == align means no padding */
+    lua_Integer paddingContent;
+    lua_assert(align <= sizeof(lua_Integer));
+    loadBlock(S, &paddingContent, padding);
+  }
+  lua_assert(S->offset % align == 0);
+}
+
+
+/*
+** Get the address of the next 'size' bytes of a fixed dump, which has
+** to be in a single block. Instruction vectors are aligned in the dump,
+** but the buffer itself may not be; in that case, return NULL, and the
+** caller copies the block as usual.
+*/
+static const void *loadFixed (LoadState *S, size_t size, unsigned int align) {
+  const void *block = luaZ_getaddr(S->Z, 0);  /* peek at the current position */
+  if (block == NULL || point2uint(block) % align != 0)
+    return NULL;
+  if (luaZ_getaddr(S->Z, size) == NULL)
+    error(S, "truncated fixed buffer");
+  S->offset += size;
+  return block;
 }
 
 
@@ -69,6 +138,7 @@ static lu_byte loadByte (LoadState *S) {
   int b = zgetc(S->Z);
   if (b == EOZ)
     error(S, "truncated chunk");
+  S->offset++;
   return cast_byte(b);
 }
 
@@ -97,6 +167,12 @@ static int loadInt (LoadState *S) {
 }
 
 
+static int loadSigned (LoadState *S) {
+  unsigned int u = cast_uint(loadUnsigned(S, UINT_MAX));
+  return cast_int((u & 1) ? ~(u >> 1) : u >> 1);
+}
+
+
 static lua_Number loadNumber (LoadState *S) {
   lua_Number x;
   loadVar(S, x);
@@ -112,7 +188,7 @@ static lua_Integer loadInteger (LoadState *S) {
 
 
 /*
-** Load a nullable string into prototype 'p'.
+** Load a nullable string into prototype 'p' (see 'dumpString').
 */
 static TString *loadStringN (LoadState *S, Proto *p) {
   lua_State *L = S->L;
@@ -120,7 +196,13 @@ static TString *loadStringN (LoadState *S, Proto *p) {
   size_t size = loadSize(S);
   if (size == 0)  /* no string? */
     return NULL;
-  else if (--size <= LUAI_MAXSHORTLEN) {  /* short string? */
+  else if (size & 1) {  /* string from the pool? */
+    size_t i = size >> 1;
+    if (S->pool == NULL || i >= cast_sizet(S->pool->sizek))
+      error(S, "bad string index");
+    ts = tsvalue(&S->pool->k[i]);
+  }
+  else if ((size = size / 2 - 1) <= LUAI_MAXSHORTLEN) {  /* short string? */
     char buff[LUAI_MAXSHORTLEN];
     loadVector(S, buff, size);  /* load string into buffer */
     ts = luaS_newlstr(L, buff, size);  /* create string */
@@ -148,8 +230,23 @@ static TString *loadString (LoadState *S, Proto *p) {
 }
 
 
+/*
+** In a fixed dump, plain (not encrypted) functions use their code and
+** line information in place; the buffer must outlive them.
+*/
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
+  loadAlign(S, sizeof(Instruction));
+  if (S->fixed && !f->is_encrypted) {
+    luaM_checksize(S->L, n, sizeof(Instruction));
+    f->code = cast(Instruction *,
+                   loadFixed(S, n * sizeof(Instruction), sizeof(Instruction)));
+    if (f->code != NULL) {
+      f->sizecode = n;
+      f->is_fixed = 1;
+      return;
+    }
+  }
   f->code = luaM_newvectorchecked(S->L, n, Instruction);
   f->sizecode = n;
   loadVector(S, f->code, n);
@@ -159,26 +256,54 @@ static void loadCode (LoadState *S, Proto *f) {
 static void loadFunction(LoadState *S, Proto *f, TString *psource);
 
 
+/*
+** String constants of a secure function are not decoded at load time:
+** they stay scrambled in 'f->kblob' (their slots in 'f->k' are nil)
+** until the function is first called (see 'luaU_decodek'). The blob
+** holds the key followed by a record (index, length, contents) for each
+** string. While loading, 'f->sizekblob' is the allocated size and
+** 'used' is the part in use.
+*/
+static void loadSecureString (LoadState *S, Proto *f, int idx, size_t *used) {
+  size_t len = loadSize(S);
+  size_t need;
+  if (len > MAX_SIZE - *used - sizeof(int) - sizeof(size_t))
+    error(S, "bad format for constant string");
+  need = *used + sizeof(int) + sizeof(size_t) + len;
+  if (need > f->sizekblob) {  /* grow blob */
+    size_t newsize = (f->sizekblob <= MAX_SIZE / 2) ? f->sizekblob * 2 : need;
+    if (newsize < need)
+      newsize = need;
+    f->kblob = luaM_reallocvchar(S->L, f->kblob, f->sizekblob, newsize);
+    f->sizekblob = newsize;
+  }
+  memcpy(f->kblob + *used, &idx, sizeof(int));
+  memcpy(f->kblob + *used + sizeof(int), &len, sizeof(size_t));
+  loadBlock(S, f->kblob + *used + sizeof(int) + sizeof(size_t), len);
+  *used = need;
+}
+
+
 static void loadConstants (LoadState *S, Proto *f) {
   int i;
   int n = loadInt(S);
+  size_t used = 0;  /* bytes used in 'f->kblob' */
   f->k = luaM_newvectorchecked(S->L, n, TValue);
   f->sizek = n;
   for (i = 0; i < n; i++)
     setnilvalue(&f->k[i]);
+  if (f->is_encrypted) {  /* start blob with the key */
+    l_uint32 key = G(S->L)->securekey;
+    f->kblob = luaM_newvector(S->L, sizeof(key), char);
+    f->sizekblob = used = sizeof(key);
+    memcpy(f->kblob, &key, sizeof(key));
+  }
   for (i = 0; i < n; i++) {
     TValue *o = &f->k[i];
     int t = loadByte(S);
-    
-    if (f->is_encrypted && (t == LUA_VSHRSTR || t == LUA_VLNGSTR)) {
-      size_t len = loadSize(S);
-      char *encrypted = luaM_newvector(S->L, len, char);
-      loadVector(S, encrypted, len);
-      unscramble_bytes(encrypted, len);
-      TString *ts = luaS_newlstr(S->L, encrypted, len);
-      setsvalue2n(S->L, o, ts);
-      luaM_freearray(S->L, encrypted, len);
-    } else {
+    if (f->is_encrypted && (t == LUA_VSHRSTR || t == LUA_VLNGSTR))
+      loadSecureString(S, f, i, &used);
+    else {
       switch (t) {
         case LUA_VNIL:
           setnilvalue(o);
@@ -204,8 +329,135 @@ static void loadConstants (LoadState *S, Proto *f) {
       }
     }
   }
+  if (f->is_encrypted) {
+    if (used == sizeof(l_uint32)) {  /* no strings? */
+      luaM_freearray(S->L, f->kblob, f->sizekblob);
+      f->kblob = NULL;
+      f->sizekblob = 0;
+    }
+    else {  /* shrink blob to its used part */
+      f->kblob = luaM_reallocvchar(S->L, f->kblob, f->sizekblob, used);
+      f->sizekblob = used;
+    }
+  }
+}
+
+
+/*
+** Jump tables are loaded without their maps, which are built when
+** each switch first runs (see OP_SWITCH).
+*/
+static void loadSwitches (LoadState *S, Proto *f) {
+  int i, c;
+  int n = loadInt(S);
+  f->swtabs = luaM_newvectorchecked(S->L, n, SwitchTable);
+  f->sizeswtabs = n;
+  for (i = 0; i < n; i++) {  /* make array valid for GC */
+    f->swtabs[i].h = NULL;
+    f->swtabs[i].cases = NULL;
+    f->swtabs[i].ncases = f->swtabs[i].sizecases = 0;
+  }
+  for (i = 0; i < n; i++) {
+    SwitchTable *sw = &f->swtabs[i];
+    int nc = loadInt(S);
+    sw->cases = luaM_newvectorchecked(S->L, nc, SwitchCase);
+    sw->ncases = sw->sizecases = nc;
+    for (c = 0; c < nc; c++) {
+      sw->cases[c].k = loadInt(S);
+      sw->cases[c].pc = loadInt(S);
+      if (sw->cases[c].k >= f->sizek || sw->cases[c].pc >= f->sizecode)
+        error(S, "bad jump table");
+    }
+  }
+}
+
+
+/*
+** Decode the string constants of a secure function (see
+** 'loadSecureString'). An error here leaves the blob intact, so that
+** decoding can be tried again.
+*/
+void luaU_decodek (lua_State *L, Proto *f) {
+  const char *p = f->kblob;
+  const char *end = p + f->sizekblob;
+  l_uint32 key;
+  lua_assert(f->kblob != NULL);
+  memcpy(&key, p, sizeof(key));
+  p += sizeof(key);
+  while (p < end) {
+    int idx;
+    size_t len;
+    TString *ts;
+    memcpy(&idx, p, sizeof(int));
+    memcpy(&len, p + sizeof(int), sizeof(size_t));
+    p += sizeof(int) + sizeof(size_t);
+    if (len <= LUAI_MAXSHORTLEN) {  /* short string? */
+      char buff[LUAI_MAXSHORTLEN];
+      memcpy(buff, p, len);
+      luaU_scramble(buff, len, key);
+      ts = luaS_newlstr(L, buff, len);
+    }
+    else {  /* long string: decode directly in final place */
+      ts = luaS_createlngstrobj(L, len);
+      memcpy(getlngstr(ts), p, len);
+      luaU_scramble(getlngstr(ts), len, key);
+    }
+    setsvalue2n(L, &f->k[idx], ts);
+    luaC_objbarrier(L, f, ts);
+    p += len;
+  }
+  luaM_freearray(L, f->kblob, f->sizekblob);
+  f->kblob = NULL;
+  f->sizekblob = 0;
+}
+
+/*
+** Load the string pool of a dump (see 'dumpPool'), kept as the
+** constants of a prototype that all functions of the dump refer to;
+** 'f' anchors it while it is loaded.
+*/
+static void loadPool (LoadState *S, Proto *f) {
+  Proto *pool;
+  int i;
+  int n = loadInt(S);
+  if (n == 0)
+    return;
+  pool = luaF_newproto(S->L);
+  f->pool = pool;
+  luaC_objbarrier(S->L, f, pool);
+  pool->k = luaM_newvectorchecked(S->L, n, TValue);
+  pool->sizek = n;
+  for (i = 0; i < n; i++)
+    setnilvalue(&pool->k[i]);
+  for (i = 0; i < n; i++)
+    setsvalue2n(S->L, &pool->k[i], loadString(S, pool));
+  S->pool = pool;
+}
+
+
+/*
+** Nested functions are not decoded at load time: each one is kept as
+** a stub prototype holding its dump, which 'luaU_loadproto' decodes
+** the first time the function is needed. In a fixed dump, the stub
+** points into the buffer.
+*/
+static void loadLazy (LoadState *S, Proto *f) {
+  size_t size = loadSize(S);
+  loadAlign(S, sizeof(Instruction));
+  if (S->fixed) {
+    f->lazy = cast(const char *, loadFixed(S, size, sizeof(Instruction)));
+    if (f->lazy != NULL) {
+      f->sizelazy = size;
+      f->is_fixed = 1;
+      return;
+    }
+  }
+  f->lazy = luaM_newvectorchecked(S->L, size, char);
+  f->sizelazy = size;
+  loadVector(S, cast(char *, f->lazy), size);
 }
 
+
 static void loadProtos (LoadState *S, Proto *f) {
   int i;
   int n = loadInt(S);
@@ -216,7 +468,7 @@ static void loadProtos (LoadState *S, Proto *f) {
   for (i = 0; i < n; i++) {
     f->p[i] = luaF_newproto(S->L);
     luaC_objbarrier(S->L, f, f->p[i]);
-    loadFunction(S, f->p[i], f->source);
+    loadLazy(S, f->p[i]);
   }
 }
 
@@ -245,15 +497,25 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 static void loadDebug (LoadState *S, Proto *f) {
   int i, n;
   n = loadInt(S);
-  f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
+  if (f->is_fixed) {
+    f->lineinfo = (n == 0) ? NULL
+                : cast(ls_byte *, loadFixed(S, n, 1));
+    lua_assert(n == 0 || f->lineinfo != NULL);
+    f->sizelineinfo = n;
+  }
+  else {
+    f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
+    f->sizelineinfo = n;
+    loadVector(S, f->lineinfo, n);
+  }
   n = loadInt(S);
   f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
   f->sizeabslineinfo = n;
-  for (i = 0; i < n; i++) {
-    f->abslineinfo[i].pc = loadInt(S);
-    f->abslineinfo[i].line = loadInt(S);
+  for (i = 0; i < n; i++) {  /* differences from the previous entry */
+    int pc = (i == 0) ? 0 : f->abslineinfo[i - 1].pc;
+    int line = (i == 0) ? f->linedefined : f->abslineinfo[i - 1].line;
+    f->abslineinfo[i].pc = pc + loadInt(S);
+    f->abslineinfo[i].line = line + loadSigned(S);
   }
   n = loadInt(S);
   f->locvars = luaM_newvectorchecked(S->L, n, LocVar);
@@ -273,8 +535,26 @@ static void loadDebug (LoadState *S, Proto *f) {
 }
 
 
+/*
+** A secure function starts with a scrambled check value, so that a
+** wrong key gives an error instead of garbage code.
+*/
+static void checkKey (LoadState *S) {
+  l_uint32 check;
+  loadVar(S, check);
+  luaU_scramble(&check, sizeof(check), ~G(S->L)->securekey);
+  if (check != LUAC_KEYCHECK)
+    error(S, "wrong key for secure function");
+}
+
+
 static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   f->is_encrypted = loadByte(S);
+  if (f->is_encrypted)
+    checkKey(S);
+  f->pool = S->pool;
+  if (S->pool != NULL)
+    luaC_objbarrier(S->L, f, S->pool);
   f->source = loadStringN(S, f);
   if (f->source == NULL)  /* no source in dump? */
     f->source = psource;  /* reuse parent's source */
@@ -285,11 +565,16 @@ static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   f->maxstacksize = loadByte(S);
   loadCode(S, f);
   if (f->is_encrypted)
-    unscramble_bytes(f->code, f->sizecode);
+    luaU_scramble(f->code, f->sizecode * sizeof(Instruction),
+                  G(S->L)->securekey);
+  luaF_initcache(S->L, f);
   loadConstants(S, f);
+  loadSwitches(S, f);
   loadUpvalues(S, f);
   loadProtos(S, f);
   loadDebug(S, f);
+  if (!f->is_fixed)  /* fixed code may be read-only */
+    luaP_fuse(f, f->code, f->sizecode);  /* create superinstructions */
 }
 
 
@@ -328,10 +613,67 @@ static void checkHeader (LoadState *S) {
 }
 
 
+typedef struct LazyBlock {
+  const char *b;  /* dump of the function (NULL after read) */
+  size_t size;
+} LazyBlock;
+
+
+static const char *getlazy (lua_State *L, void *ud, size_t *size) {
+  LazyBlock *lb = cast(LazyBlock *, ud);
+  const char *b = lb->b;
+  UNUSED(L);
+  lb->b = NULL;  /* the whole block is read at once */
+  *size = lb->size;
+  return b;
+}
+
+
+/*
+** Decode the stub of nested function 'i' of 'f' (see 'loadLazy'). The
+** function is loaded into a new prototype, anchored by a closure until
+** it is complete, which then replaces the stub; so, an error leaves the
+** stub intact.
+*/
+Proto *luaU_loadproto (lua_State *L, Proto *f, int i) {
+  Proto *stub = f->p[i];
+  LoadState S;
+  LazyBlock lb;
+  ZIO z;
+  LClosure *cl;
+  lua_assert(stub->lazy != NULL);
+  lb.b = stub->lazy;
+  lb.size = stub->sizelazy;
+  luaZ_init(L, &z, getlazy, &lb);
+  S.L = L;
+  S.Z = &z;
+  S.name = (f->source != NULL) ? getstr(f->source) : "=?";
+  if (*S.name == '@' || *S.name == '=')
+    S.name++;
+  else
+    S.name = "binary string";
+  S.offset = 0;  /* nested functions are dumped aligned */
+  S.fixed = stub->is_fixed;
+  S.pool = f->pool;
+  cl = luaF_newLclosure(L, 0);
+  setclLvalue2s(L, L->top.p, cl);  /* anchor it */
+  luaD_inctop(L);
+  cl->p = luaF_newproto(L);
+  luaC_objbarrier(L, cl, cl->p);
+  loadFunction(&S, cl->p, f->source);
+  luai_verifycode(L, cl->p);
+  f->p[i] = cl->p;
+  luaC_objbarrier(L, f, cl->p);
+  L->top.p--;  /* remove closure */
+  return f->p[i];
+}
+
+
 /*
-** Load precompiled chunk.
+** Load precompiled chunk. If 'fixed', the chunk is in a single buffer
+** that stays unchanged while the loaded functions are alive.
 */
-LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
+LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int fixed) {
   LoadState S;
   LClosure *cl;
   if (*name == '@' || *name == '=')
@@ -342,12 +684,16 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.offset = 1;  /* first byte was already read */
+  S.fixed = cast_byte(fixed);
+  S.pool = NULL;
   checkHeader(&S);
   cl = luaF_newLclosure(L, loadByte(&S));
   setclLvalue2s(L, L->top.p, cl);
   luaD_inctop(L);
   cl->p = luaF_newproto(L);
   luaC_objbarrier(L, cl, cl->p);
+  loadPool(&S, cl->p);
   loadFunction(&S, cl->p, NULL);
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luai_verifycode(L, cl->p);
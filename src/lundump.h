@@ -23,10 +23,35 @@
 */
 #define LUAC_VERSION  (((LUA_VERSION_NUM / 100) * 16) + LUA_VERSION_NUM % 100)
 
-#define LUAC_FORMAT	0	/* this is the official format */
+#define LUAC_FORMAT	5	/* Diluvium format (aligned, sized, keyed, pooled) */
+
+/*
+@@ LUAI_SECUREKEY is the default key for secure functions ('~function')
+** in binary chunks; it can be changed per state with 'lua_setsecurekey'.
+*/
+#if !defined(LUAI_SECUREKEY)
+#define LUAI_SECUREKEY	0xBEBEBEBEu
+#endif
+
+/* value dumped (scrambled) before secure functions, to check the key */
+#define LUAC_KEYCHECK	0x5EC0DEu
 
 /* load one chunk; from lundump.c */
-LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
+LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name,
+                                 int fixed);
+
+/* scramble or unscramble a block; from lundump.c */
+LUAI_FUNC void luaU_scramble (void *b, size_t size, l_uint32 key);
+
+/* decode string constants of a secure function; from lundump.c */
+LUAI_FUNC void luaU_decodek (lua_State *L, Proto *f);
+
+/* decode nested function 'i' of 'f'; from lundump.c */
+LUAI_FUNC Proto *luaU_loadproto (lua_State *L, Proto *f, int i);
+
+/* get nested function 'i' of 'f', decoding it if needed */
+#define luaU_getproto(L,f,i)  \
+	((f)->p[i]->lazy == NULL ? (f)->p[i] : luaU_loadproto(L, f, i))
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
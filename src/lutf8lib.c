@@ -19,6 +19,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lsimd.h"
 
 
 #define MAXUNICODE	0x10FFFFu
@@ -105,7 +106,15 @@ static int utflen (lua_State *L) {
   luaL_argcheck(L, --posj < (lua_Integer)len, 3,
                    "final position out of bounds");
   while (posi <= posj) {
-    const char *s1 = utf8_decode(s + posi, NULL, !lax);
+    /* skip a run of ASCII characters, one byte each */
+    size_t ascii = lsimd_asciilen(s + posi, (size_t)(posj - posi + 1));
+    const char *s1;
+    if (ascii > 0) {
+      posi += (lua_Integer)ascii;
+      n += (lua_Integer)ascii;
+      continue;
+    }
+    s1 = utf8_decode(s + posi, NULL, !lax);
     if (s1 == NULL) {  /* conversion error? */
       luaL_pushfail(L);  /* return fail ... */
       lua_pushinteger(L, posi + 1);  /* ... and current position */
@@ -28,15 +28,18 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 #include "lvm.h"
 
 
 /*
 ** By default, use jump tables in the main interpreter loop on gcc
-** and compatible compilers.
+** and compatible compilers. WebAssembly has no indirect jumps, so
+** there clang turns the computed gotos back into a 'br_table' over
+** label indices, one more load per instruction than a plain switch.
 */
 #if !defined(LUA_USE_JUMPTABLE)
-#if defined(__GNUC__)
+#if defined(__GNUC__) && !defined(__wasm__)
 #define LUA_USE_JUMPTABLE	1
 #else
 #define LUA_USE_JUMPTABLE	0
@@ -80,6 +83,24 @@
 #endif
 
 
+/*
+** 'l_strton' for a slice, which may not be '\0'-terminated. (There is
+** no state here to give it its own copy, so the byte after the slice
+** is set to '\0' during the conversion and then restored; the byte
+** belongs to the slice's parent, which is not being read meanwhile.)
+*/
+static int slicetonum (TString *st, TValue *result) {
+  char *s = getlngstr(st);
+  size_t l = st->u.lnglen;
+  char c = s[l];
+  int res;
+  s[l] = '\0';
+  res = (luaO_str2num(s, result) == l + 1);
+  s[l] = c;
+  return res;
+}
+
+
 /*
 ** Try to convert a value from string to a number value.
 ** If the value is not a string or is a string not representing
@@ -93,6 +114,8 @@ static int l_strton (const TValue *obj, TValue *result) {
     return 0;
   else {
     TString *st = tsvalue(obj);
+    if (l_unlikely(isslice(st)))
+      return slicetonum(st, result);
     return (luaO_str2num(getstr(st), result) == tsslen(st) + 1);
   }
 }
@@ -281,15 +304,146 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Fast track for typed arrays (see 'TArray'): if 't' is a typed array
+** and 'k' is inside it, 'arrayget' copies 't[k]' to 'val' and returns
+** true. Otherwise, it returns false, and the access goes the usual
+** way through the metamethods of the array.
+*/
+l_sinline int arrayget (lua_State *L, const TValue *t, lua_Integer k,
+                        StkId val) {
+  TArray *ta;
+  if (!ttistarray(L, t))
+    return 0;
+  ta = cast(TArray *, getudatamem(uvalue(t)));
+  if (l_castS2U(k) - 1u >= ta->n)
+    return 0;
+  switch (ta->kind) {
+    case LUA_TAF64:
+      setfltvalue(s2v(val), cast(lua_Number *, tadata(ta))[k - 1]);
+      break;
+    case LUA_TAI64:
+      setivalue(s2v(val), cast(lua_Integer *, tadata(ta))[k - 1]);
+      break;
+    default:
+      setivalue(s2v(val), cast(l_int32 *, tadata(ta))[k - 1]);
+      break;
+  }
+  return 1;
+}
+
+
+/*
+** Fast track for 't[k] = v' with a typed array 't': returns false when
+** 't' is not a typed array, 'k' is not inside it, or 'v' does not fit
+** in its elements, so that its metamethod handles (or rejects) the
+** assignment. (Elements are not collectable, so there is no barrier.)
+*/
+l_sinline int arrayset (lua_State *L, const TValue *t, lua_Integer k,
+                        const TValue *v) {
+  TArray *ta;
+  if (!ttistarray(L, t))
+    return 0;
+  ta = cast(TArray *, getudatamem(uvalue(t)));
+  if (l_castS2U(k) - 1u >= ta->n)
+    return 0;
+  if (ta->kind == LUA_TAF64) {
+    lua_Number n;
+    if (!tonumberns(v, n))
+      return 0;
+    cast(lua_Number *, tadata(ta))[k - 1] = n;
+  }
+  else {
+    lua_Integer i;
+    if (!tointegerns(v, &i))
+      return 0;
+    if (ta->kind == LUA_TAI64)
+      cast(lua_Integer *, tadata(ta))[k - 1] = i;
+    else if (l_castS2U(i) + 0x80000000u <= 0xFFFFFFFFu)  /* fits? */
+      cast(l_int32 *, tadata(ta))[k - 1] = cast(l_int32, i);
+    else
+      return 0;
+  }
+  return 1;
+}
+
+
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
 ** t[k] entry (which must be empty).
 */
+/*
+** Index table 'h' with the short string 'key' through its chain of
+** '__index' tables, using the lookup cache (see 'LookupEntry'). ('key'
+** is known to be absent from 'h'.) On a miss, walks the chain and
+** records the result, marking every table of the chain so that a
+** change to any of them invalidates the cache. Returns 0, leaving the
+** work to the generic loop, if the chain has something other than
+** tables or is too long.
+*/
+static int cachedindex (lua_State *L, Table *h, TString *key, StkId val) {
+  global_State *g = G(L);
+  Table *mt0 = h->metatable;
+  Table *mt = mt0;
+  LookupEntry *e;
+  const TValue *slot = NULL;
+  int loop;
+  if (l_unlikely(g->lookups == NULL)) {  /* first use? */
+    size_t size = LUAI_LOOKUPCACHE * sizeof(LookupEntry);
+    /* (an emergency collection here does not move the stack) */
+    void *block = luaM_realloc_(L, NULL, 0, size);
+    if (block == NULL)
+      return 0;  /* no cache; use the generic loop */
+    memset(block, 0, size);  /* all entries invalid */
+    g->lookups = cast(LookupEntry *, block);
+  }
+  e = &g->lookups[(point2uint(mt0) ^ key->hash) & (LUAI_LOOKUPCACHE - 1)];
+  if (e->epoch == g->lookupepoch && e->mt == mt0 && e->key == key &&
+      (e->slot == NULL || !isempty(e->slot))) {  /* hit? */
+    if (e->slot == NULL)
+      setnilvalue(s2v(val));
+    else
+      setobj2s(L, val, e->slot);
+    return 1;
+  }
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *tm = fasttm(L, mt, TM_INDEX);
+    if (mt != NULL)
+      mt->flags |= BITLOOKUP;
+    if (tm == NULL)  /* end of the chain? */
+      break;  /* result is nil */
+    else if (!ttistable(tm))
+      return 0;  /* metamethod is not a table */
+    h = hvalue(tm);
+    h->flags |= BITLOOKUP;
+    slot = luaH_getshortstr(h, key);
+    if (!isempty(slot))  /* found? */
+      break;
+    slot = NULL;
+    mt = h->metatable;
+  }
+  if (loop == MAXTAGLOOP)
+    return 0;  /* let the generic loop raise the error */
+  e->mt = mt0;
+  e->key = key;
+  e->slot = slot;
+  e->epoch = g->lookupepoch;
+  if (slot == NULL)
+    setnilvalue(s2v(val));
+  else
+    setobj2s(L, val, slot);
+  return 1;
+}
+
+
 void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
                       const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
+  if (slot != NULL && ttisshrstring(key) && hvalue(t)->metatable != NULL &&
+      cachedindex(L, hvalue(t), tsvalue(key), val))
+    return;
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (slot == NULL) {  /* 't' is not a table? */
       lua_assert(!ttistable(t));
@@ -373,9 +527,10 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** The code is a little tricky because it allows '\0' in the strings
 ** and it uses 'strcoll' (to respect locales) for each segment
 ** of the strings. Note that segments can compare equal but still
-** have different lengths.
+** have different lengths. Both strings must be '\0'-terminated (see
+** 'luaS_terminate').
 */
-static int l_strcmp (const TString *ts1, const TString *ts2) {
+int luaV_strcmp (const TString *ts1, const TString *ts2) {
   const char *s1 = getstr(ts1);
   size_t rl1 = tsslen(ts1);  /* real length */
   const char *s2 = getstr(ts2);
@@ -523,8 +678,11 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 */
 static int lessthanothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
-  if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+  if (ttisstring(l) && ttisstring(r)) {  /* both are strings? */
+    luaS_terminate(L, tsvalue(l));
+    luaS_terminate(L, tsvalue(r));
+    return luaV_strcmp(tsvalue(l), tsvalue(r)) < 0;
+  }
   else
     return luaT_callorderTM(L, l, r, TM_LT);
 }
@@ -545,8 +703,11 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 */
 static int lessequalothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
-  if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+  if (ttisstring(l) && ttisstring(r)) {  /* both are strings? */
+    luaS_terminate(L, tsvalue(l));
+    luaS_terminate(L, tsvalue(r));
+    return luaV_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+  }
   else
     return luaT_callorderTM(L, l, r, TM_LE);
 }
@@ -569,6 +730,8 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
 int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
   const TValue *tm;
   if (ttypetag(t1) != ttypetag(t2)) {  /* not the same variant? */
+    if (ttislcf(t1) && ttislcf(t2))  /* a fast and a plain C function? */
+      return fvalue(t1) == fvalue(t2);
     if (ttype(t1) != ttype(t2) || ttype(t1) != LUA_TNUMBER)
       return 0;  /* only numbers can be equal with different variants */
     else {  /* two numbers with different variants */
@@ -587,7 +750,7 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
     case LUA_VNUMINT: return (ivalue(t1) == ivalue(t2));
     case LUA_VNUMFLT: return luai_numeq(fltvalue(t1), fltvalue(t2));
     case LUA_VLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
-    case LUA_VLCF: return fvalue(t1) == fvalue(t2);
+    case LUA_VLCF: case LUA_VFCF: return fvalue(t1) == fvalue(t2);
     case LUA_VSHRSTR: return eqshrstr(tsvalue(t1), tsvalue(t2));
     case LUA_VLNGSTR: return luaS_eqlngstr(tsvalue(t1), tsvalue(t2));
     case LUA_VUSERDATA: {
@@ -684,6 +847,79 @@ void luaV_concat (lua_State *L, int total) {
 }
 
 
+/*
+** Maximum number of number parts that 'fstringfast' formats in its
+** local buffer. F-strings with more numbers use the generic path.
+*/
+#define FSTRNUMS	16
+
+/*
+** Fast path for f-strings: when all 'total' values at the top of the
+** stack are strings or numbers, build the result with a single
+** allocation, formatting numbers straight into it. Returns 0, without
+** changing anything, when some value needs the generic path.
+*/
+static int fstringfast (lua_State *L, int total) {
+  char nbuff[FSTRNUMS][MAXNUMBER2STR];
+  int nlen[FSTRNUMS];
+  char sbuff[LUAI_MAXSHORTLEN];
+  StkId first = L->top.p - total;
+  size_t tl = 0;
+  int nn = 0;  /* number of numbers formatted */
+  int n;
+  TString *ts = NULL;
+  char *buff = sbuff;
+  for (n = 0; n < total; n++) {  /* collect total length */
+    TValue *o = s2v(first + n);
+    size_t l;
+    if (ttisstring(o))
+      l = tsslen(tsvalue(o));
+    else if (ttisnumber(o) && nn < FSTRNUMS) {
+      nlen[nn] = luaO_tostringbuff(o, nbuff[nn]);
+      l = cast_sizet(nlen[nn++]);
+    }
+    else
+      return 0;
+    if (l_unlikely(l >= MAX_SIZE - sizeof(TString) - tl))
+      return 0;  /* let the generic path raise the error */
+    tl += l;
+  }
+  if (tl > LUAI_MAXSHORTLEN) {  /* long string? */
+    ts = luaS_createlngstrobj(L, tl);
+    buff = getlngstr(ts);  /* copy parts directly to final result */
+  }
+  tl = 0;
+  nn = 0;
+  for (n = 0; n < total; n++) {  /* copy parts */
+    TValue *o = s2v(first + n);
+    if (ttisstring(o)) {
+      size_t l = tsslen(tsvalue(o));
+      memcpy(buff + tl, getstr(tsvalue(o)), l * sizeof(char));
+      tl += l;
+    }
+    else {
+      memcpy(buff + tl, nbuff[nn], nlen[nn] * sizeof(char));
+      tl += cast_sizet(nlen[nn++]);
+    }
+  }
+  if (ts == NULL)  /* short string? */
+    ts = luaS_newlstr(L, sbuff, tl);
+  setsvalue2s(L, first, ts);
+  L->top.p = first + 1;
+  return 1;
+}
+
+
+/*
+** Main operation for f-strings. Same contract as 'luaV_concat', which
+** handles the cases the fast path cannot (other types, metamethods).
+*/
+void luaV_fstring (lua_State *L, int total) {
+  if (!fstringfast(L, total))
+    luaV_concat(L, total);
+}
+
+
 /*
 ** Main operation 'ra = #rb'.
 */
@@ -790,6 +1026,42 @@ lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y) {
 ** create a new Lua closure, push it in the stack, and initialize
 ** its upvalues.
 */
+/*
+** check whether cached closure in prototype 'p' may be reused, that is,
+** whether there is a cached closure with the same upvalues needed by
+** new closure to be created.
+*/
+static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
+  LClosure *c = p->cache;
+  if (c != NULL) {  /* is there a cached closure? */
+    int nup = p->sizeupvalues;
+    Upvaldesc *uv = p->upvalues;
+    int i;
+    for (i = 0; i < nup; i++) {  /* check whether it has right upvalues */
+      TValue *v = uv[i].instack ? s2v(base + uv[i].idx)
+                                : encup[uv[i].idx]->v.p;
+      if (c->upvals[i]->v.p != v) {  /* wrong upvalue? */
+        if (++p->cachemiss >= MAXMISS)
+          p->cache = NULL;  /* give up caching closures for this prototype */
+        return NULL;  /* cannot reuse closure */
+      }
+    }
+    p->cachemiss = 0;
+  }
+  return c;  /* return cached closure (or NULL if no cached closure) */
+}
+
+
+/*
+** create a new Lua closure, push it in the stack, and initialize
+** its upvalues. Note that the closure is not cached if prototype is
+** already black (which would make it invisible for the collector).
+** In generational mode, that leaves only young prototypes, which are
+** traversed once more after getting old (see 'markold'), when the
+** cached closure is marked or dropped. A prototype whose closures keep
+** getting different upvalues (e.g., the control variable of a loop)
+** stops being cached after MAXMISS misses.
+*/
 static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
                          StkId ra) {
   int nup = p->sizeupvalues;
@@ -805,6 +1077,8 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
       ncl->upvals[i] = encup[uv[i].idx];
     luaC_objbarrier(L, ncl, ncl->upvals[i]);
   }
+  if (p->cachemiss < MAXMISS && !isblack(p))
+    p->cache = ncl;  /* save it on cache for reuse */
 }
 
 
@@ -815,7 +1089,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = unfusedop(GET_OPCODE(inst));
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
       setobjs2s(L, base + GETARG_A(*(ci->u.l.savedpc - 2)), --L->top.p);
@@ -844,7 +1118,7 @@ void luaV_finishOp (lua_State *L) {
         ci->u.l.savedpc++;  /* skip jump instruction */
       break;
     }
-    case OP_CONCAT: {
+    case OP_CONCAT: case OP_FSTRING: {
       StkId top = L->top.p - 1;  /* top when 'luaT_tryconcatTM' was called */
       int a = GETARG_A(inst);      /* first element to concatenate */
       int total = cast_int(top - 1 - (base + a));  /* yet to concatenate */
@@ -978,6 +1252,51 @@ void luaV_finishOp (lua_State *L) {
   op_arith_aux(L, v1, v2, iop, fop); }
 
 
+/*
+** Typed arithmetic operations, whose operands are expected to be
+** integers (see 'luaP_fuse'); otherwise, they fall back to the
+** generic instruction at 'l'.
+*/
+#define op_arithII(L,iop,l) {  \
+  StkId ra = RA(i); \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_unlikely(!ttisinteger(v1) || !ttisinteger(v2)))  \
+    goto l;  \
+  pc++; setivalue(s2v(ra), iop(L, ivalue(v1), ivalue(v2))); }
+
+
+/*
+** Typed arithmetic operations with K operands, which are integers
+** (for division and modulus, different from 0 and -1).
+*/
+#define op_arithKI(L,iop,l) {  \
+  StkId ra = RA(i); \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = KC(i); lua_assert(ttisinteger(v2));  \
+  if (l_unlikely(!ttisinteger(v1)))  \
+    goto l;  \
+  pc++; setivalue(s2v(ra), iop(L, ivalue(v1), ivalue(v2))); }
+
+
+/*
+** Integer modulus and floor division when 'n' is neither 0 nor -1.
+** (See 'luaV_mod' and 'luaV_idiv'.)
+*/
+#define l_modki(L,m,n)	modki(m, n)
+#define l_idivki(L,m,n)	idivki(m, n)
+
+l_sinline lua_Integer modki (lua_Integer m, lua_Integer n) {
+  lua_Integer r = m % n;
+  return (r != 0 && (r ^ n) < 0) ? r + n : r;
+}
+
+l_sinline lua_Integer idivki (lua_Integer m, lua_Integer n) {
+  lua_Integer q = m / n;
+  return ((m ^ n) < 0 && m % n != 0) ? q - 1 : q;
+}
+
+
 /*
 ** Bitwise operations with constant operand.
 */
@@ -1070,6 +1389,9 @@ void luaV_finishOp (lua_State *L) {
 #define KC(i)	(k+GETARG_C(i))
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
+/* inline-cache slot of the current instruction ('pc' already advanced) */
+#define icslot(p,pc)	(&(p)->icache[(pc) - (p)->code - 1])
+
 
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
@@ -1081,11 +1403,24 @@ void luaV_finishOp (lua_State *L) {
 	{ if (l_unlikely(trap)) { updatebase(ci); ra = RA(i); } }
 
 
+/*
+** Charge 'n' steps to the instruction budget (see 'lua_setbudget').
+** Loops are charged the length of their bodies on each backward jump,
+** and calls one step. Without a budget, the counter starts so high that
+** it seldom gets negative (and then 'luaG_outofbudget' refills it).
+*/
+#define spendbudget(L,n)  \
+	{ if (l_unlikely((G(L)->budget -= (n)) < 0)) \
+	    halfProtect(luaG_outofbudget(L)); }
+
+
 /*
 ** Execute a jump instruction. The 'updatetrap' allows signals to stop
 ** tight loops. (Without it, the local copy of 'trap' could never change.)
 */
-#define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); }
+#define dojump(ci,i,e)	{ int off_ = GETARG_sJ(i) + e; pc += off_; \
+  if (off_ < 0) spendbudget(L, -off_); \
+  updatetrap(ci); }
 
 
 /* for test instructions, execute the jump instruction that follows it */
@@ -1141,12 +1476,90 @@ void luaV_finishOp (lua_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  vmstat(L, i); \
 }
 
+
+/*
+** With LUAI_VMSTATS, count each instruction fetched for execution and
+** the pair it forms with the previous one (see 'lua_getvmstats').
+*/
+#if defined(LUAI_VMSTATS)
+#define vmstat(L,i)	{ global_State *g_ = G(L); \
+  OpCode op_ = GET_OPCODE(i); \
+  g_->vmops[op_]++; \
+  g_->vmpairs[g_->vmlastop][op_]++; \
+  g_->vmlastop = cast_byte(op_); }
+#else
+#define vmstat(L,i)	((void)0)
+#endif
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/*
+** End of the first half of a superinstruction: run the next
+** instruction, which starts at label 'l', without a new dispatch. With
+** hooks or a reallocated stack ('trap'), the superinstruction ends here
+** and the next instruction goes through the normal dispatch.
+*/
+#define vmfuse(l)  \
+	{ if (l_likely(!trap)) { i = *(pc++); vmstat(L, i); goto l; } }
+
+
+/*
+** Check for an intrinsic opcode (see 'lua_setintrinsic'): whether R[A]
+** is the function 'intr' stands for and there are no hooks (which must
+** see the call). Otherwise, the opcode runs as a plain OP_CALL.
+*/
+#define isintrinsic(L,ra,intr)  \
+	(ttislcf(s2v(ra)) && fvalue(s2v(ra)) == G(L)->intrinsics[intr] && \
+	 l_likely(!L->hookmask))
+
+
+/*
+** A 'pairs' loop over a table keeps in its control variable a cursor,
+** a value with the private tag LUA_VCURSOR, with the index of the
+** traversal (see 'luaH_nextat'). The VM then iterates without calling
+** 'next'; hooks set after the loop started do not see these calls, as
+** with the intrinsic opcodes. No Lua value is ever taken for a cursor,
+** and the debug library sees the current key instead (see
+** 'luaV_cursorkey').
+*/
+#define setcursor(o,n)  \
+	{ TValue *io_=(o); val_(io_).i = cast(lua_Integer, n); \
+	  settt_(io_, LUA_VCURSOR); }
+#define getcursor(o)	check_exp(ttiscursor(o), cast_uint(val_(o).i))
+
+
+/*
+** Put in 'key' the key that the cursor at 'ctl' stands for, which is
+** what the control variable would hold if the loop called 'next'. The
+** table of the loop is right below its control variable.
+*/
+void luaV_cursorkey (lua_State *L, StkId ctl, TValue *key) {
+  if (ttistable(s2v(ctl - 1)))
+    luaH_keyat(L, hvalue(s2v(ctl - 1)), getcursor(s2v(ctl)), key);
+  else {  /* state changed by the debug library */
+    setnilvalue(key);
+  }
+}
+
+/* set to nil the loop variables in [from, to) that got no value */
+#define nilresults(from,to)  \
+	{ StkId r_; for (r_ = (from); r_ < (to); r_++) setnilvalue(s2v(r_)); }
+
+
+/*
+** Result of the intrinsic for 'math.floor'/'math.ceil' over float 'f'
+** (see 'math_floor' in lmathlib.c).
+*/
+#define setnumint(o,f)  \
+	{ lua_Number f_ = (f); lua_Integer n_; \
+	  if (lua_numbertointeger(f_, &n_)) { setivalue(o, n_); } \
+	  else { setfltvalue(o, f_); } }
+
 
 void luaV_execute (lua_State *L, CallInfo *ci) {
   LClosure *cl;
@@ -1252,7 +1665,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (luaV_fastgetic(L, upval, key, slot, icslot(cl->p, pc))) {
           setobj2s(L, ra, slot);
         }
         else
@@ -1270,7 +1683,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             : luaV_fastget(L, rb, rc, slot, luaH_get)) {
           setobj2s(L, ra, slot);
         }
-        else
+        else if (!(ttisinteger(rc) && arrayget(L, rb, ivalue(rc), ra)))
           Protect(luaV_finishget(L, rb, rc, ra, slot));
         vmbreak;
       }
@@ -1282,33 +1695,164 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (luaV_fastgeti(L, rb, c, slot)) {
           setobj2s(L, ra, slot);
         }
-        else {
+        else if (!arrayget(L, rb, c, ra)) {
           TValue key;
           setivalue(&key, c);
           Protect(luaV_finishget(L, rb, &key, ra, slot));
         }
         vmbreak;
       }
-      vmcase(OP_GETFIELD) {
+      vmcase(OP_GETFIELD) l_getfield: {
         StkId ra = RA(i);
         const TValue *slot;
         TValue *rb = vRB(i);
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
+        if (luaV_fastgetic(L, rb, key, slot, icslot(cl->p, pc))) {
           setobj2s(L, ra, slot);
         }
         else
           Protect(luaV_finishget(L, rb, rc, ra, slot));
         vmbreak;
       }
+      vmcase(OP_GETTABUPF) {  /* OP_GETTABUP + OP_GETFIELD */
+        StkId ra = RA(i);
+        const TValue *slot;
+        TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
+        TValue *rc = KC(i);
+        TString *key = tsvalue(rc);  /* key must be a short string */
+        if (luaV_fastgetic(L, upval, key, slot, icslot(cl->p, pc))) {
+          setobj2s(L, ra, slot);
+        }
+        else
+          Protect(luaV_finishget(L, upval, rc, ra, slot));
+        vmfuse(l_getfield);
+        vmbreak;
+      }
+      vmcase(OP_GETFIELDC) {  /* OP_GETFIELD + OP_CALL */
+        StkId ra = RA(i);
+        const TValue *slot;
+        TValue *rb = vRB(i);
+        TValue *rc = KC(i);
+        TString *key = tsvalue(rc);  /* key must be a short string */
+        if (luaV_fastgetic(L, rb, key, slot, icslot(cl->p, pc))) {
+          setobj2s(L, ra, slot);
+        }
+        else
+          Protect(luaV_finishget(L, rb, rc, ra, slot));
+        vmfuse(l_call);
+        vmbreak;
+      }
+      vmcase(OP_CALLFLOOR) {
+        StkId ra = RA(i);
+        TValue *v = s2v(ra + 1);
+        if (!isintrinsic(L, ra, LUA_INTRFLOOR) || !ttisnumber(v))
+          goto l_call;
+        spendbudget(L, 1);
+        if (ttisinteger(v)) {
+          setobj2s(L, ra, v);  /* integer is its own floor */
+        }
+        else
+          setnumint(s2v(ra), l_floor(fltvalue(v)));
+        vmbreak;
+      }
+      vmcase(OP_CALLCEIL) {
+        StkId ra = RA(i);
+        TValue *v = s2v(ra + 1);
+        if (!isintrinsic(L, ra, LUA_INTRCEIL) || !ttisnumber(v))
+          goto l_call;
+        spendbudget(L, 1);
+        if (ttisinteger(v)) {
+          setobj2s(L, ra, v);  /* integer is its own ceiling */
+        }
+        else
+          setnumint(s2v(ra), l_mathop(ceil)(fltvalue(v)));
+        vmbreak;
+      }
+      vmcase(OP_CALLABS) {
+        StkId ra = RA(i);
+        TValue *v = s2v(ra + 1);
+        if (!isintrinsic(L, ra, LUA_INTRABS) || !ttisnumber(v))
+          goto l_call;
+        spendbudget(L, 1);
+        if (ttisinteger(v)) {
+          lua_Integer n = ivalue(v);
+          setivalue(s2v(ra), (n < 0) ? intop(-, 0, n) : n);
+        }
+        else
+          setfltvalue(s2v(ra), l_mathop(fabs)(fltvalue(v)));
+        vmbreak;
+      }
+      vmcase(OP_CALLSQRT) {
+        StkId ra = RA(i);
+        lua_Number n;
+        if (!isintrinsic(L, ra, LUA_INTRSQRT) || !tonumberns(s2v(ra + 1), n))
+          goto l_call;
+        spendbudget(L, 1);
+        setfltvalue(s2v(ra), l_mathop(sqrt)(n));
+        vmbreak;
+      }
+      vmcase(OP_CALLMIN) {
+        StkId ra = RA(i);
+        TValue *v1 = s2v(ra + 1);
+        TValue *v2 = s2v(ra + 2);
+        if (!isintrinsic(L, ra, LUA_INTRMIN) ||
+            !ttisnumber(v1) || !ttisnumber(v2))
+          goto l_call;
+        spendbudget(L, 1);
+        setobj2s(L, ra, LTnum(v2, v1) ? v2 : v1);
+        vmbreak;
+      }
+      vmcase(OP_CALLMAX) {
+        StkId ra = RA(i);
+        TValue *v1 = s2v(ra + 1);
+        TValue *v2 = s2v(ra + 2);
+        if (!isintrinsic(L, ra, LUA_INTRMAX) ||
+            !ttisnumber(v1) || !ttisnumber(v2))
+          goto l_call;
+        spendbudget(L, 1);
+        setobj2s(L, ra, LTnum(v1, v2) ? v2 : v1);
+        vmbreak;
+      }
+      vmcase(OP_ADDII) {
+        op_arithII(L, l_addi, l_add);
+        vmbreak;
+      }
+      vmcase(OP_SUBII) {
+        op_arithII(L, l_subi, l_sub);
+        vmbreak;
+      }
+      vmcase(OP_MULII) {
+        op_arithII(L, l_muli, l_mul);
+        vmbreak;
+      }
+      vmcase(OP_ADDKI) {
+        op_arithKI(L, l_addi, l_addk);
+        vmbreak;
+      }
+      vmcase(OP_SUBKI) {
+        op_arithKI(L, l_subi, l_subk);
+        vmbreak;
+      }
+      vmcase(OP_MULKI) {
+        op_arithKI(L, l_muli, l_mulk);
+        vmbreak;
+      }
+      vmcase(OP_MODKI) {
+        op_arithKI(L, l_modki, l_modk);
+        vmbreak;
+      }
+      vmcase(OP_IDIVKI) {
+        op_arithKI(L, l_idivki, l_idivk);
+        vmbreak;
+      }
       vmcase(OP_SETTABUP) {
         const TValue *slot;
         TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (luaV_fastgetic(L, upval, key, slot, icslot(cl->p, pc))) {
           luaV_finishfastset(L, upval, slot, rc);
         }
         else
@@ -1326,7 +1870,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             : luaV_fastget(L, s2v(ra), rb, slot, luaH_get)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
-        else
+        else if (!(ttisinteger(rb) && arrayset(L, s2v(ra), ivalue(rb), rc)))
           Protect(luaV_finishset(L, s2v(ra), rb, rc, slot));
         vmbreak;
       }
@@ -1338,7 +1882,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (luaV_fastgeti(L, s2v(ra), c, slot)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
-        else {
+        else if (!arrayset(L, s2v(ra), c, rc)) {
           TValue key;
           setivalue(&key, c);
           Protect(luaV_finishset(L, s2v(ra), &key, rc, slot));
@@ -1351,7 +1895,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {
+        if (luaV_fastgetic(L, s2v(ra), key, slot, icslot(cl->p, pc))) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
         else
@@ -1384,7 +1928,9 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobj2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
+        if (key->tt == LUA_VSHRSTR
+            ? luaV_fastgetic(L, rb, key, slot, icslot(cl->p, pc))
+            : luaV_fastget(L, rb, key, slot, luaH_getstr)) {
           setobj2s(L, ra, slot);
         }
         else
@@ -1395,19 +1941,19 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         op_arithI(L, l_addi, luai_numadd);
         vmbreak;
       }
-      vmcase(OP_ADDK) {
+      vmcase(OP_ADDK) l_addk: {
         op_arithK(L, l_addi, luai_numadd);
         vmbreak;
       }
-      vmcase(OP_SUBK) {
+      vmcase(OP_SUBK) l_subk: {
         op_arithK(L, l_subi, luai_numsub);
         vmbreak;
       }
-      vmcase(OP_MULK) {
+      vmcase(OP_MULK) l_mulk: {
         op_arithK(L, l_muli, luai_nummul);
         vmbreak;
       }
-      vmcase(OP_MODK) {
+      vmcase(OP_MODK) l_modk: {
         savestate(L, ci);  /* in case of division by 0 */
         op_arithK(L, luaV_mod, luaV_modf);
         vmbreak;
@@ -1420,7 +1966,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         op_arithfK(L, luai_numdiv);
         vmbreak;
       }
-      vmcase(OP_IDIVK) {
+      vmcase(OP_IDIVK) l_idivk: {
         savestate(L, ci);  /* in case of division by 0 */
         op_arithK(L, luaV_idiv, luai_numidiv);
         vmbreak;
@@ -1457,15 +2003,15 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         }
         vmbreak;
       }
-      vmcase(OP_ADD) {
+      vmcase(OP_ADD) l_add: {
         op_arith(L, l_addi, luai_numadd);
         vmbreak;
       }
-      vmcase(OP_SUB) {
+      vmcase(OP_SUB) l_sub: {
         op_arith(L, l_subi, luai_numsub);
         vmbreak;
       }
-      vmcase(OP_MUL) {
+      vmcase(OP_MUL) l_mul: {
         op_arith(L, l_muli, luai_nummul);
         vmbreak;
       }
@@ -1585,6 +2131,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         checkGC(L, L->top.p); /* 'luaV_concat' ensures correct top */
         vmbreak;
       }
+      vmcase(OP_FSTRING) {
+        StkId ra = RA(i);
+        int n = GETARG_B(i);  /* number of parts */
+        L->top.p = ra + n;  /* mark the end of the parts */
+        ProtectNT(luaV_fstring(L, n));
+        checkGC(L, L->top.p); /* 'luaV_fstring' ensures correct top */
+        vmbreak;
+      }
       vmcase(OP_CLOSE) {
         StkId ra = RA(i);
         Protect(luaF_close(L, ra, LUA_OK, 1));
@@ -1592,14 +2146,32 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_TBC) {
         StkId ra = RA(i);
-        /* create new to-be-closed upvalue */
-        halfProtect(luaF_newtbcupval(L, ra));
+        int b = GETARG_B(i);
+        if (b == 0)  /* create new to-be-closed upvalue */
+          halfProtect(luaF_newtbcupval(L, ra));
+        else  /* deferred call with 'b' - 1 arguments */
+          halfProtect(luaF_newdefer(L, ra, b - 1));
         vmbreak;
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
         vmbreak;
       }
+      vmcase(OP_SWITCH) {
+        StkId ra = RA(i);
+        SwitchTable *sw = &cl->p->swtabs[GETARG_Bx(i)];
+        const TValue *dest;
+        if (l_unlikely(sw->h == NULL)) {  /* loaded function? */
+          Protect(luaF_buildswitch(L, cl->p, GETARG_Bx(i)));
+          ra = RA(i);
+        }
+        dest = luaH_get(sw->h, s2v(ra));
+        if (ttisinteger(dest)) {  /* is it a case? */
+          pc = cl->p->code + ivalue(dest);
+          updatetrap(ci);
+        }
+        vmbreak;
+      }
       vmcase(OP_EQ) {
         StkId ra = RA(i);
         int cond;
@@ -1670,7 +2242,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         }
         vmbreak;
       }
-      vmcase(OP_CALL) {
+      vmcase(OP_CALL) l_call: {
         StkId ra = RA(i);
         CallInfo *newci;
         int b = GETARG_B(i);
@@ -1679,7 +2251,11 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           L->top.p = ra + b;  /* top signals number of arguments */
         /* else previous instruction set top */
         savepc(L);  /* in case of errors */
-        if ((newci = luaD_precall(L, ra, nresults)) == NULL)
+        if (l_unlikely(--G(L)->budget < 0))
+          luaG_outofbudget(L);  /* 'top' is already above live values */
+        if (ttisfcf(s2v(ra)) && luaD_callfast(L, ra, nresults))
+          updatetrap(ci);  /* fast C call; nothing else to be done */
+        else if ((newci = luaD_precall(L, ra, nresults)) == NULL)
           updatetrap(ci);  /* C call; nothing else to be done */
         else {  /* Lua call: run function in this same C frame */
           ci = newci;
@@ -1699,6 +2275,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         else  /* previous instruction set top */
           b = cast_int(L->top.p - ra);
         savepc(ci);  /* several calls here can raise errors */
+        if (l_unlikely(--G(L)->budget < 0))
+          luaG_outofbudget(L);
         if (TESTARG_k(i)) {
           luaF_closeupval(L, base);  /* close upvalues from current call */
           lua_assert(L->tbclist.p < base);  /* no pending tbc variables */
@@ -1793,10 +2371,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             chgivalue(s2v(ra), idx);  /* update internal index */
             setivalue(s2v(ra + 3), idx);  /* and control variable */
             pc -= GETARG_Bx(i);  /* jump back */
+            spendbudget(L, GETARG_Bx(i));
           }
         }
-        else if (floatforloop(ra))  /* float loop */
+        else if (floatforloop(ra)) {  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
+          spendbudget(L, GETARG_Bx(i));
+        }
         updatetrap(ci);  /* allows a signal to break the loop */
         vmbreak;
       }
@@ -1811,6 +2392,9 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
        StkId ra = RA(i);
         /* create to-be-closed upvalue (if needed) */
         halfProtect(luaF_newtbcupval(L, ra + 3));
+        if (isintrinsic(L, ra, LUA_INTRNEXT) && ttistable(s2v(ra + 1)) &&
+            ttisnil(s2v(ra + 2)))  /* a 'pairs' loop? */
+          setcursor(s2v(ra + 2), 0);  /* iterate with a cursor */
         pc += GETARG_Bx(i);
         i = *(pc++);  /* go to next instruction */
         lua_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
@@ -1824,6 +2408,45 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
            to-be-closed variable. The call will use the stack after
            these values (starting at 'ra + 4')
         */
+        if (ttiscursor(s2v(ra + 2))) {  /* a 'pairs' loop? */
+          unsigned int n;
+          StkId last = ra + 4 + GETARG_C(i);  /* after the loop variables */
+          if (l_unlikely(!ttistable(s2v(ra + 1)) || !ttislcf(s2v(ra)) ||
+                 fvalue(s2v(ra)) != G(L)->intrinsics[LUA_INTRNEXT])) {
+            /* state changed by the debug library; go on with the key */
+            luaV_cursorkey(L, ra + 2, s2v(ra + 2));
+            goto l_tforcallgeneric;
+          }
+          n = luaH_nextat(L, hvalue(s2v(ra + 1)), getcursor(s2v(ra + 2)),
+                          ra + 4);
+          i = *(pc++);  /* go to next instruction */
+          lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
+          if (n != 0) {  /* continue loop? */
+            setcursor(s2v(ra + 2), n);
+            nilresults(ra + 6, last);
+            pc -= GETARG_Bx(i);  /* jump back */
+            spendbudget(L, GETARG_Bx(i));
+          }
+          vmbreak;
+        }
+        else if (isintrinsic(L, ra, LUA_INTRIPAIRS) &&
+                 ttistable(s2v(ra + 1)) && ttisinteger(s2v(ra + 2))) {
+          lua_Integer n = intop(+, ivalue(s2v(ra + 2)), 1);
+          const TValue *slot;
+          if (luaV_fastgeti(L, s2v(ra + 1), n, slot)) {
+            setivalue(s2v(ra + 4), n);
+            setobj2s(L, ra + 5, slot);
+            nilresults(ra + 6, ra + 4 + GETARG_C(i));
+          }
+          else if (hvalue(s2v(ra + 1))->metatable == NULL)
+            setnilvalue(s2v(ra + 4));  /* end of the loop */
+          else
+            goto l_tforcallgeneric;  /* '__index' may give a value */
+          i = *(pc++);  /* go to next instruction */
+          lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
+          goto l_tforloop;
+        }
+       l_tforcallgeneric:
         /* push function, state, and control variable */
         memcpy(ra + 4, ra, 3 * sizeof(*ra));
         L->top.p = ra + 4 + 3;
@@ -1839,6 +2462,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
           setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
           pc -= GETARG_Bx(i);  /* jump back */
+          spendbudget(L, GETARG_Bx(i));
         }
         vmbreak;
       }}
@@ -1867,9 +2491,20 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_CLOSURE) {
-        StkId ra = RA(i);
+        StkId ra;
+        LClosure *ncl;
         Proto *p = cl->p->p[GETARG_Bx(i)];
-        halfProtect(pushclosure(L, p, cl->upvals, base, ra));
+        if (l_unlikely(p->lazy != NULL)) {  /* not decoded yet? */
+          Protect(p = luaU_loadproto(L, cl->p, GETARG_Bx(i)));
+          updatebase(ci);  /* stack may have been reallocated */
+        }
+        ra = RA(i);
+        ncl = getcached(p, cl->upvals, base);
+        if (ncl != NULL) {  /* can reuse a cached closure? */
+          setclLvalue2s(L, ra, ncl);
+        }
+        else
+          halfProtect(pushclosure(L, p, cl->upvals, base, ra));
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -1894,16 +2529,16 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_2Q) {
         StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = vRC(i);
-        /* If 'rb' is NOT nil */
-        if (!ttisnil(rb)) {
-          setobj(L, s2v(ra), rb);
-        } else {
-          setobj(L, s2v(ra), rc);
-        }
+        int cond = !ttisnil(s2v(ra));
+        docondjump();
         vmbreak;
       }
+#if !LUA_USE_JUMPTABLE
+      default: {  /* opcodes are always valid: no range check */
+        lua_assert(0);
+        l_unreachable();
+      }
+#endif
     }
   }
 }
@@ -89,6 +89,30 @@ typedef enum {
       !isempty(slot)))  /* result not empty? */
 
 
+/*
+** Special case of 'luaV_fastget' for constant short-string keys, using
+** the inline-cache slot 'ic' of the instruction (see 'luaF_initcache').
+*/
+#define luaV_fastgetic(L,t,k,slot,ic) \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
+   : (slot = luaH_ichit(hvalue(t), k, *(ic))  \
+              ? (icstat(L, ichits), gval(gnode(hvalue(t), *(ic))))  \
+              : (icstat(L, icmisses), luaH_getshortstric(hvalue(t), k, ic)), \
+      !isempty(slot)))  /* result not empty? */
+
+
+/*
+** Define LUAI_ICSTATS to count hits and misses of the inline caches
+** (see 'lua_icstats').
+*/
+#if defined(LUAI_ICSTATS)
+#define icstat(L,c)	(G(L)->c++)
+#else
+#define icstat(L,c)	((void)0)
+#endif
+
+
 /*
 ** Special case of 'luaV_fastget' for integers, inlining the fast case
 ** of 'luaH_getint'.
@@ -101,12 +125,18 @@ typedef enum {
       !isempty(slot)))  /* result not empty? */
 
 
+/* test whether 'o' is a typed array (see 'TArray') */
+#define ttistarray(L,o)  \
+  (ttisfulluserdata(o) && uvalue(o)->metatable == G(L)->tamt)
+
+
 /*
 ** Finish a fast set operation (when fast get succeeds). In that case,
 ** 'slot' points to the place to put the value.
 */
 #define luaV_finishfastset(L,t,slot,v) \
-    { setobj2t(L, cast(TValue *,slot), v); \
+    { luaH_changed(L, hvalue(t)); \
+      setobj2t(L, cast(TValue *,slot), v); \
       luaC_barrierback(L, gcvalue(t), v); }
 
 
@@ -119,6 +149,7 @@ typedef enum {
 
 LUAI_FUNC int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r);
+LUAI_FUNC int luaV_strcmp (const TString *ts1, const TString *ts2);
 LUAI_FUNC int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r);
 LUAI_FUNC int luaV_tonumber_ (const TValue *obj, lua_Number *n);
 LUAI_FUNC int luaV_tointeger (const TValue *obj, lua_Integer *p, F2Imod mode);
@@ -132,10 +163,12 @@ LUAI_FUNC void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 LUAI_FUNC void luaV_finishOp (lua_State *L);
 LUAI_FUNC void luaV_execute (lua_State *L, CallInfo *ci);
 LUAI_FUNC void luaV_concat (lua_State *L, int total);
+LUAI_FUNC void luaV_fstring (lua_State *L, int total);
 LUAI_FUNC lua_Integer luaV_idiv (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_mod (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Number luaV_modf (lua_State *L, lua_Number x, lua_Number y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
+LUAI_FUNC void luaV_cursorkey (lua_State *L, StkId ctl, TValue *key);
 
 #endif
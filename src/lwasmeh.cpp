@@ -0,0 +1,37 @@
+/*
+** $Id: lwasmeh.cpp $
+** Exception handling for protected calls with LUA_USE_WASMEH
+** See Copyright Notice in lua.h
+*/
+
+/*
+** With LUA_USE_WASMEH, 'ldo.c' raises and catches errors through these
+** functions, compiled as C++ with -fwasm-exceptions, so that protected
+** calls use native WebAssembly exceptions instead of the emulation of
+** setjmp/longjmp. The rest of Lua stays C; its frames are unwound by
+** the engine, as they need no cleanup.
+*/
+
+extern "C" {
+#include "lua.h"
+}
+
+
+typedef void (*Pfunc) (lua_State *L, void *ud);
+
+
+extern "C" int luai_wasmtry (lua_State *L, Pfunc f, void *ud) {
+  try {
+    (*f)(L, ud);
+    return 0;
+  }
+  catch (...) {  /* a Lua error or any other exception */
+    return 1;
+  }
+}
+
+
+extern "C" void luai_wasmthrow (void *c) {
+  throw c;
+}
+
@@ -66,3 +66,24 @@ size_t luaZ_read (ZIO *z, void *b, size_t n) {
   return 0;
 }
 
+
+/*
+** Get the address of the next 'n' bytes of the input and skip them.
+** Returns NULL if these bytes are not all in the current buffer.
+*/
+const void *luaZ_getaddr (ZIO *z, size_t n) {
+  const void *res;
+  if (z->n == 0) {  /* no bytes in buffer? */
+    if (luaZ_fill(z) == EOZ)  /* try to read more */
+      return NULL;  /* no more input */
+    z->n++;  /* luaZ_fill consumed first byte; put it back */
+    z->p--;
+  }
+  if (z->n < n)  /* block is not whole in the buffer? */
+    return NULL;
+  res = z->p;
+  z->n -= n;
+  z->p += n;
+  return res;
+}
+
@@ -107,6 +107,11 @@
 #include "lstrlib.c"
 #include "ltablib.c"
 #include "lutf8lib.c"
+#include "lproflib.c"
+#include "larraylib.c"
+#include "ldvmlib.c"
+#include "ljsonlib.c"
+#include "lperflib.c"
 #include "linit.c"
 #endif
 
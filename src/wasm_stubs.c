@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
@@ -22,26 +23,332 @@ WASM_EXPORT("init_lua") void init_lua()
     if (global_L == NULL)
     {
 
-        // Ensure Lua doesn't buffer internally
-        setvbuf(stdout, NULL, _IONBF, 0);
+        // Write stdout a line at a time (not a byte at a time); run_lua
+        // and run_sandbox flush it when they finish
+        setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
         setvbuf(stderr, NULL, _IONBF, 0);
 
         global_L = luaL_newstate();
-        luaL_openlibs(global_L);
+        luaL_openlazylibs(global_L);
     }
 }
 
+/*
+ * Compile cache for run_lua: compiled chunks are kept in the registry of
+ * global_L, keyed by their source, so running the same code again does
+ * not parse it again. The cache holds at most 'cache_size' chunks; when
+ * it is full, the least recently used one is dropped.
+ */
+#define CACHE_CHUNKS "_RUNCACHE"      /* source -> compiled chunk */
+#define CACHE_USES "_RUNCACHE_USES"   /* source -> time of last use */
+
+static int cache_size = 64;
+static int cache_count = 0;
+static lua_Integer cache_clock = 0;
+
+static void cache_evict(lua_State *L)
+{
+    lua_Integer oldest = 0;
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, CACHE_CHUNKS);
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, CACHE_USES);
+    lua_pushnil(L); /* source of oldest entry */
+    lua_pushnil(L);
+    while (lua_next(L, -3))
+    {
+        lua_Integer t = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        if (lua_isnil(L, -2) || t < oldest)
+        {
+            oldest = t;
+            lua_pushvalue(L, -1);
+            lua_replace(L, -3);
+        }
+    }
+    if (!lua_isnil(L, -1))
+    {
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, -4); /* uses[source] = nil */
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, -5); /* chunks[source] = nil */
+        cache_count--;
+    }
+    lua_pop(L, 3);
+}
+
+/* Push the compiled chunk for 'code', compiling it if needed. */
+static int load_cached(lua_State *L, const char *code)
+{
+    size_t len = strlen(code);
+    int res = LUA_OK;
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, CACHE_CHUNKS);
+    lua_pushlstring(L, code, len);
+    lua_pushvalue(L, -1);
+    if (lua_rawget(L, -3) != LUA_TFUNCTION)
+    {
+        lua_pop(L, 1);
+        res = luaL_loadbuffer(L, code, len, code);
+        if (res != LUA_OK)
+        {
+            lua_replace(L, -3); /* keep only the error message */
+            lua_pop(L, 1);
+            return res;
+        }
+        if (cache_size > 0)
+        {
+            if (cache_count >= cache_size)
+                cache_evict(L);
+            lua_pushvalue(L, -2);
+            lua_pushvalue(L, -2);
+            lua_rawset(L, -5); /* chunks[source] = chunk */
+            cache_count++;
+        }
+    }
+    if (cache_size > 0)
+    {
+        luaL_getsubtable(L, LUA_REGISTRYINDEX, CACHE_USES);
+        lua_pushvalue(L, -3);
+        lua_pushinteger(L, ++cache_clock);
+        lua_rawset(L, -3); /* uses[source] = clock */
+        lua_pop(L, 1);
+    }
+    lua_replace(L, -3); /* keep only the chunk */
+    lua_pop(L, 1);
+    return res;
+}
+
+/* Drop all compiled chunks from the cache. */
+WASM_EXPORT("clear_lua_cache") void clear_lua_cache()
+{
+    if (global_L != NULL)
+    {
+        lua_pushnil(global_L);
+        lua_setfield(global_L, LUA_REGISTRYINDEX, CACHE_CHUNKS);
+        lua_pushnil(global_L);
+        lua_setfield(global_L, LUA_REGISTRYINDEX, CACHE_USES);
+        cache_count = 0;
+    }
+}
+
+/* Set the maximum number of cached chunks (0 disables the cache). */
+WASM_EXPORT("set_lua_cache_size") void set_lua_cache_size(int size)
+{
+    cache_size = (size > 0) ? size : 0;
+    if (global_L != NULL)
+    {
+        while (cache_count > cache_size)
+            cache_evict(global_L);
+    }
+}
+
+/*
+ * Output buffer: once enabled with set_output_buffer, 'print' and
+ * 'io.write' (while the default output is io.stdout) append to a buffer
+ * in linear memory instead of writing to stdout. The host reads the
+ * output of a whole run at once with get_output and get_output_length,
+ * and then calls clear_output. Output that would grow the buffer past
+ * its limit first sends the buffer to stdout in a single write, so
+ * nothing is lost while streaming.
+ */
+#define OUTPUT_ORIG "_OUTPUT_ORIG" /* original 'print' and 'io.write' */
+
+static char *out_buf = NULL;
+static size_t out_len = 0;
+static size_t out_limit = 0; /* 0 when output is not buffered */
+
+static void out_flush(void)
+{
+    if (out_len > 0)
+    {
+        fwrite(out_buf, 1, out_len, stdout);
+        fflush(stdout);
+        out_len = 0;
+    }
+}
+
+static void out_append(const char *s, size_t l)
+{
+    if (out_len + l > out_limit)
+        out_flush();
+    if (l > out_limit)
+    {
+        fwrite(s, 1, l, stdout);
+        fflush(stdout);
+    }
+    else
+    {
+        memcpy(out_buf + out_len, s, l);
+        out_len += l;
+    }
+}
+
+static int out_print(lua_State *L)
+{
+    int n = lua_gettop(L);
+    int i;
+    for (i = 1; i <= n; i++)
+    {
+        size_t l;
+        const char *s = luaL_tolstring(L, i, &l);
+        if (i > 1)
+            out_append("\t", 1);
+        out_append(s, l);
+        lua_pop(L, 1);
+    }
+    out_append("\n", 1);
+    return 0;
+}
+
+/* upvalues: original 'io.write', 'io.stdout' and 'io.output' */
+static int out_write(lua_State *L)
+{
+    int n = lua_gettop(L);
+    int i;
+    lua_pushvalue(L, lua_upvalueindex(3));
+    lua_call(L, 0, 1); /* get default output */
+    if (!lua_rawequal(L, -1, lua_upvalueindex(2)))
+    {
+        /* not stdout: use the original function */
+        lua_pop(L, 1);
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_insert(L, 1);
+        lua_call(L, n, LUA_MULTRET);
+        return lua_gettop(L);
+    }
+    for (i = 1; i <= n; i++)
+    {
+        char num[64];
+        size_t l;
+        const char *s = num;
+        if (lua_type(L, i) == LUA_TNUMBER)
+        {
+            int len = lua_isinteger(L, i)
+                          ? snprintf(num, sizeof(num), LUA_INTEGER_FMT,
+                                     (LUAI_UACINT)lua_tointeger(L, i))
+                          : snprintf(num, sizeof(num), LUA_NUMBER_FMT,
+                                     (LUAI_UACNUMBER)lua_tonumber(L, i));
+            l = (len > 0 && (size_t)len < sizeof(num)) ? (size_t)len : 0;
+        }
+        else
+            s = luaL_checklstring(L, i, &l);
+        out_append(s, l);
+    }
+    return 1; /* io.stdout is on the top */
+}
+
+/* Install (on != 0) or remove the buffering 'print' and 'io.write'. */
+static void out_install(lua_State *L, int on)
+{
+    if (on)
+    {
+        lua_createtable(L, 0, 2); /* save the originals */
+        lua_getglobal(L, "print");
+        lua_setfield(L, -2, "print");
+        lua_pushcfunction(L, out_print);
+        lua_setglobal(L, "print");
+        if (lua_getglobal(L, "io") == LUA_TTABLE)
+        {
+            lua_getfield(L, -1, "write");
+            lua_pushvalue(L, -1);
+            lua_setfield(L, -4, "write");
+            lua_getfield(L, -2, "stdout");
+            lua_getfield(L, -3, "output");
+            lua_pushcclosure(L, out_write, 3);
+            lua_setfield(L, -2, "write");
+        }
+        lua_pop(L, 1);
+        lua_setfield(L, LUA_REGISTRYINDEX, OUTPUT_ORIG);
+    }
+    else
+    {
+        lua_getfield(L, LUA_REGISTRYINDEX, OUTPUT_ORIG);
+        lua_getfield(L, -1, "print");
+        lua_setglobal(L, "print");
+        if (lua_getglobal(L, "io") == LUA_TTABLE)
+        {
+            lua_getfield(L, -2, "write");
+            lua_setfield(L, -2, "write");
+        }
+        lua_pop(L, 2);
+        lua_pushnil(L);
+        lua_setfield(L, LUA_REGISTRYINDEX, OUTPUT_ORIG);
+    }
+}
+
+/*
+ * Buffer up to 'limit' bytes of output (0 sends output to stdout again).
+ * Sandboxes created after this call share the setting.
+ */
+WASM_EXPORT("set_output_buffer") void set_output_buffer(int limit)
+{
+    size_t newlimit = (limit > 0) ? (size_t)limit : 0;
+    if (global_L == NULL)
+        init_lua();
+    out_flush();
+    if (newlimit > 0)
+    {
+        char *b = (char *)realloc(out_buf, newlimit + 1);
+        if (b == NULL)
+            return; /* keep the current setting */
+        out_buf = b;
+    }
+    if ((newlimit > 0) != (out_limit > 0))
+        out_install(global_L, newlimit > 0);
+    if (newlimit == 0)
+    {
+        free(out_buf);
+        out_buf = NULL;
+    }
+    out_limit = newlimit;
+}
+
+/* Buffered output, as a '\0'-terminated string. */
+WASM_EXPORT("get_output") const char *get_output()
+{
+    if (out_buf == NULL)
+        return "";
+    out_buf[out_len] = '\0';
+    return out_buf;
+}
+
+WASM_EXPORT("get_output_length") int get_output_length()
+{
+    return (int)out_len;
+}
+
+WASM_EXPORT("clear_output") void clear_output()
+{
+    out_len = 0;
+}
+
+/* Errors of a run go after its output. */
+static void print_error(const char *err)
+{
+    if (err == NULL)
+        err = "(error object is not a string)";
+    if (out_limit > 0)
+    {
+        out_append("Error: ", 7);
+        out_append(err, strlen(err));
+        out_append("\n", 1);
+    }
+    else
+        printf("Error: %s\n", err);
+}
+
 WASM_EXPORT("run_lua") int run_lua(const char *code)
 {
     if (global_L == NULL)
         init_lua();
 
-    int res = luaL_dostring(global_L, code);
+    int res = load_cached(global_L, code);
+    if (res == LUA_OK)
+        res = lua_pcall(global_L, 0, LUA_MULTRET, 0);
 
     if (res != LUA_OK)
     {
-        const char *err = lua_tostring(global_L, -1);
-        printf("Error: %s\n", err);
+        print_error(lua_tostring(global_L, -1));
         lua_pop(global_L, 1);
     }
 
@@ -49,4 +356,172 @@ WASM_EXPORT("run_lua") int run_lua(const char *code)
     fflush(stderr);
 
     return res;
+}
+
+/*
+ * Asynchronous runs: run_lua_async compiles a chunk and returns a handle
+ * for a coroutine that runs it; each step_lua(handle, budget) resumes
+ * that coroutine until the chunk ends or until it has run about 'budget'
+ * VM instructions (0 means no limit), so the host can keep its event
+ * loop responsive and interleave several scripts. Coroutines are kept
+ * in the registry, referenced by their handles.
+ */
+#define ASYNC_RUNS "_RUNASYNC"
+
+static void budget_hook(lua_State *L, lua_Debug *ar)
+{
+    (void)ar;
+    if (lua_isyieldable(L)) /* else wait for the next count */
+        lua_yield(L, 0);
+}
+
+/* Returns a handle for the run, or 0 if the chunk does not compile. */
+WASM_EXPORT("run_lua_async") int run_lua_async(const char *code)
+{
+    lua_State *co;
+    int ref;
+    if (global_L == NULL)
+        init_lua();
+    if (load_cached(global_L, code) != LUA_OK)
+    {
+        print_error(lua_tostring(global_L, -1));
+        lua_pop(global_L, 1);
+        fflush(stdout);
+        return 0;
+    }
+    luaL_getsubtable(global_L, LUA_REGISTRYINDEX, ASYNC_RUNS);
+    co = lua_newthread(global_L);
+    lua_rotate(global_L, -3, -1); /* move chunk to the top */
+    lua_xmove(global_L, co, 1);
+    ref = luaL_ref(global_L, -2); /* runs[ref] = co */
+    lua_pop(global_L, 1);
+    return ref;
+}
+
+static lua_State *get_async(int run)
+{
+    lua_State *co;
+    luaL_getsubtable(global_L, LUA_REGISTRYINDEX, ASYNC_RUNS);
+    lua_rawgeti(global_L, -1, run);
+    co = lua_tothread(global_L, -1);
+    lua_pop(global_L, 2);
+    return co;
+}
+
+static void drop_async(int run)
+{
+    luaL_getsubtable(global_L, LUA_REGISTRYINDEX, ASYNC_RUNS);
+    luaL_unref(global_L, -1, run);
+    lua_pop(global_L, 1);
+}
+
+/*
+ * Returns LUA_YIELD (1) while the run is not finished, LUA_OK (0) when
+ * it ended, or an error code (after reporting the error).
+ */
+WASM_EXPORT("step_lua") int step_lua(int run, int budget)
+{
+    lua_State *co = (global_L != NULL && run > 0) ? get_async(run) : NULL;
+    int res, nres;
+
+    if (co == NULL)
+    {
+        print_error("invalid run");
+        return LUA_ERRRUN;
+    }
+
+    if (budget > 0)
+        lua_sethook(co, budget_hook, LUA_MASKCOUNT, budget);
+    else
+        lua_sethook(co, NULL, 0, 0);
+    res = lua_resume(co, global_L, 0, &nres);
+    if (res == LUA_YIELD)
+        lua_pop(co, nres); /* discard values yielded by the chunk */
+    else
+    {
+        if (res != LUA_OK)
+            print_error(lua_tostring(co, -1));
+        lua_closethread(co, global_L);
+        drop_async(run);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    return res;
+}
+
+/* Abandon an unfinished run, closing its pending to-be-closed variables. */
+WASM_EXPORT("cancel_lua") void cancel_lua(int run)
+{
+    lua_State *co = (global_L != NULL && run > 0) ? get_async(run) : NULL;
+
+    if (co != NULL)
+    {
+        lua_closethread(co, global_L);
+        drop_async(run);
+    }
+}
+
+/*
+ * Sandboxes: global_L (with its libraries) is the template; each sandbox
+ * has its own globals and package tables and shares everything else with
+ * the template, frozen where it could leak between sandboxes (such as the
+ * string metatable), so creating one is much cheaper than a new state
+ * with luaL_openlibs.
+ * Sandboxes are identified by registry references.
+ */
+WASM_EXPORT("new_sandbox") int new_sandbox()
+{
+    if (global_L == NULL)
+        init_lua();
+
+    luaL_newsandbox(global_L);
+    return luaL_ref(global_L, LUA_REGISTRYINDEX);
+}
+
+static lua_State *get_sandbox(int sb)
+{
+    lua_State *S;
+    lua_rawgeti(global_L, LUA_REGISTRYINDEX, sb);
+    S = lua_tothread(global_L, -1);
+    lua_pop(global_L, 1);
+    return S;
+}
+
+WASM_EXPORT("run_sandbox") int run_sandbox(int sb, const char *code)
+{
+    lua_State *S = (global_L != NULL) ? get_sandbox(sb) : NULL;
+
+    if (S == NULL)
+    {
+        printf("Error: invalid sandbox\n");
+        return LUA_ERRRUN;
+    }
+
+    int res = luaL_loadsandbox(S, code, strlen(code), code, NULL);
+    if (res == LUA_OK)
+        res = lua_pcall(S, 0, 0, 0);
+
+    if (res != LUA_OK)
+    {
+        print_error(lua_tostring(S, -1));
+        lua_pop(S, 1);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    return res;
+}
+
+WASM_EXPORT("close_sandbox") void close_sandbox(int sb)
+{
+    lua_State *S = (global_L != NULL) ? get_sandbox(sb) : NULL;
+
+    if (S != NULL)
+    {
+        luaL_closesandbox(S);
+        luaL_unref(global_L, LUA_REGISTRYINDEX, sb);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+-- analyze_bench.lua
+-- Scaling benchmark for the luac report analyzer (analyze.c).
+-- Generates modules of growing size and times `luac -r` on each; with
+-- the analysis linear in the size of the module, the time per
+-- function should stay flat as the module grows.
+-- Run: lua analyze_bench.lua [path/to/luac]
+
+local LUAC  = arg[1] or "luac"
+local SIZES = {1000, 2000, 4000, 8000, 16000}
+local SRC   = os.tmpname()
+local OUT   = os.tmpname()
+
+-- n global functions, each setting another global to a closure, plus a
+-- main function returning one table from n places
+local function make_module(n)
+    local parts = {}
+    for i = 1, n do
+        parts[#parts + 1] = string.format(
+            "function fn_%d(t)\n  handler_%d = function(x) return x.key_%d end\n" ..
+            "  if t then return mod_%d.field_%d(t) end\nend\n",
+            i, i, i, i % 97, i)
+    end
+    parts[#parts + 1] = "local function main(t)\n  local v = {}\n"
+    for i = 1, n do
+        parts[#parts + 1] = string.format("  if t[%d] then return v end\n", i)
+    end
+    parts[#parts + 1] = "end\nVAR_" .. n .. " = main\n"
+    return table.concat(parts)
+end
+
+-- wall-clock time of running cmd, in seconds
+local function wall_time(cmd)
+    local p = io.popen("s=$(date +%s%N); " .. cmd ..
+                       " >/dev/null 2>&1; e=$(date +%s%N); echo $((e - s))")
+    local ns = tonumber(p:read("l"))
+    p:close()
+    return ns / 1e9
+end
+
+print("--- Analyzer Scaling Benchmark ---")
+for _, n in ipairs(SIZES) do
+    local f = assert(io.open(SRC, "w"))
+    f:write(make_module(n))
+    f:close()
+    local cmd = string.format("%s -p -r -o %s %s", LUAC, OUT, SRC)
+    local t = wall_time(cmd)
+    print(string.format("[%6d functions] Time: %.6f sec | %.3f us/function",
+                        n, t, t / n * 1e6))
+end
+os.remove(SRC)
+os.remove(OUT)
@@ -1444,6 +1444,30 @@ do   -- closing state with no extra memory
   T.alloccount()
 end
 
+do   -- lazy opening of libraries
+  local L = T.newstate()
+  T.openlazylibs(L)
+  local res = T.doremote(L, [[
+    assert(getmetatable(os) and getmetatable(math))   -- not open yet
+    assert(("x"):rep(3) == "xxx" and string.format("%d", 1) == "1")
+    assert(require"os" == os and package.loaded.math == math)
+    local t = os.time()     -- first index opens 'os'...
+    assert(type(t) == "number")
+    assert(getmetatable(os) == nil)   -- ...which becomes a plain table
+    assert(getmetatable(math))   -- others are still not open
+    local n = 0
+    for k, v in pairs(coroutine) do n = n + 1 end   -- 'pairs' opens it
+    assert(n > 5 and getmetatable(coroutine) == nil)
+    utf8.extra = 10    -- so does an assignment
+    assert(utf8.extra == 10 and utf8.char(65) == "A")
+    assert(math.floor(3.5) == 3 and math.pi > 3)
+    return 'ok'
+  ]])
+  assert(res == 'ok')
+  T.closestate(L)
+end
+
+
 do   -- garbage collection with no extra memory
   local L = T.newstate()
   T.loadlib(L)
@@ -1539,5 +1563,41 @@ do
   r.xuxu = nil; r.xuxu1 = nil
 end
 
+
+do   print("testing sandboxes")
+  local f = os.tmpname()
+  local r1, r2, r3 = T.sandbox([==[
+    local up = pcall(function ()
+      getmetatable("").__index.upper = function () return "evil" end
+    end)
+    local mt = pcall(function () getmetatable("").__index = {} end)
+    require("table").insert = nil       -- the sandbox's own copy
+    package.loaded.mine = 10
+    package.preload.p = function () return 20 end
+    x = 1
+    local h = io.open("]==] .. f .. [==[", "w")
+    h:write("y = 5; return 'mod'")
+    h:close()
+    package.path = "]==] .. f .. [==["
+    local m = require("m")
+    return table.concat({tostring(up), tostring(mt),
+                         tostring(require("table") == table),
+                         tostring(table.insert), require("p"), m, y}, " ")
+  ]==], [==[
+    return table.concat({("a"):upper(), type(table.insert),
+                         tostring(require("table").insert == table.insert),
+                         tostring(package.loaded.mine), type(package.preload.p),
+                         tostring(x), tostring(pcall(require, "m"))}, " ")
+  ]==], [==[
+    return table.concat({type(table.insert), tostring(package.loaded.mine),
+                         tostring(x), tostring(y),
+                         tostring(package.loaded.m)}, " ")
+  ]==])
+  os.remove(f)
+  assert(r1 == "false false true nil 20 mod 5")
+  assert(r2 == "A function true nil nil nil false")
+  assert(r3 == "function nil nil nil nil")
+end
+
 print'OK'
 
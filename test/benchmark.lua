@@ -1,50 +1,495 @@
-local MATH_ITERS = 100000000
-local STR_ITERS  = 100000
-local FIB_N      = 35
+-- benchmark.lua
+-- Benchmark suite for the interpreter. Each case runs a few times to
+-- warm up and then several timed times; the report has one tab-separated
+-- line per case with the median, the 95th percentile and the minimum
+-- CPU time (os.clock) of the timed runs, in seconds.
+--
+-- Run: lua benchmark.lua [options] [pattern]
+--   --quick            small sizes and few runs (a smoke test)
+--   --runs N           timed runs per case (default 7)
+--   --warmup N         untimed runs per case (default 2)
+--   --out FILE         also write the report to FILE
+--   --compare FILE     compare medians with a report saved earlier and
+--                      fail if a case got slower than the threshold
+--   --threshold R      allowed ratio to the saved median (default 1.10)
+--   pattern            run only cases whose names match this Lua pattern
 
-local function bench_math()
+local RUNS, WARMUP, SCALE = 7, 2, 1
+local THRESHOLD = 1.10
+local outfile, basefile, filter
+
+do
+    local i = 1
+    while arg and arg[i] do
+        local a = arg[i]
+        if a == "--quick" then RUNS, WARMUP, SCALE = 3, 1, 0.01
+        elseif a == "--runs" then i = i + 1; RUNS = assert(tonumber(arg[i]))
+        elseif a == "--warmup" then i = i + 1; WARMUP = assert(tonumber(arg[i]))
+        elseif a == "--out" then i = i + 1; outfile = assert(arg[i])
+        elseif a == "--compare" then i = i + 1; basefile = assert(arg[i])
+        elseif a == "--threshold" then
+            i = i + 1; THRESHOLD = assert(tonumber(arg[i]))
+        elseif a:sub(1, 2) == "--" then error("unknown option " .. a)
+        else filter = a
+        end
+        i = i + 1
+    end
+end
+
+-- size of a workload, scaled by '--quick'
+local function N(n)
+    return math.max(1, math.floor(n * SCALE))
+end
+
+local cases = {}
+
+-- each case is a function with no arguments; the result is kept in
+-- 'sink' so that the work cannot be optimized away
+local function case(name, fn)
+    cases[#cases + 1] = {name = name, fn = fn}
+end
+
+local sink
+
+---------------------------------------------------------------------
+-- Arithmetic, strings and calls (the original three loops)
+---------------------------------------------------------------------
+case("math_loop", function ()
     local sum = 0
-    for i = 0, MATH_ITERS - 1 do
-        if i % 2 == 0 then
-            sum = sum + (i / 2)
-        else
-            sum = sum + (i * 3) + 1
+    for i = 0, N(20000000) - 1 do
+        if i % 2 == 0 then sum = sum + (i / 2)
+        else sum = sum + (i * 3) + 1
         end
     end
     return sum
-end
+end)
 
-local function bench_string()
+case("string_append", function ()
     local s = ""
-    for i = 0, STR_ITERS - 1 do
-        if #s > 100 then
-            s = ""
-        end
+    for i = 0, N(1000000) - 1 do
+        if #s > 100 then s = "" end
         s = s .. tostring(i)
     end
     return #s
-end
+end)
 
-local function fib(n)
-    if n <= 1 then
-        return n
+case("strbuf_append", function ()
+    local b = string.buffer()
+    for i = 0, N(1000000) - 1 do
+        if #b > 100 then b:reset() end
+        b = b .. i
     end
+    return #b
+end)
+
+local function fib(n)
+    if n <= 1 then return n end
     return fib(n - 1) + fib(n - 2)
 end
 
-local function run_bench(name, func, param)
-    local start_t = os.clock()
-    local res
-    if param then
-        res = func(param)
-    else
-        res = func()
+case("fib", function ()
+    return fib(SCALE < 1 and 20 or 30)
+end)
+
+---------------------------------------------------------------------
+-- Tables
+---------------------------------------------------------------------
+case("table_insert", function ()
+    local t = {}
+    for i = 1, N(3000000) do t[#t + 1] = i end
+    return #t
+end)
+
+local keys = {}
+for i = 1, 1000 do keys[i] = "key" .. i end
+
+case("table_lookup", function ()
+    local t = {}
+    for i = 1, #keys do t[keys[i]] = i end
+    local sum = 0
+    for _ = 1, N(3000) do
+        for i = 1, #keys do sum = sum + t[keys[i]] end
     end
-    local end_t = os.clock()
-    print(string.format("[%s] Result: %s | Time: %.6f sec", name, res, end_t - start_t))
+    return sum
+end)
+
+case("table_iterate", function ()
+    local t = {}
+    for i = 1, 100000 do t[i] = i end
+    local h = {}
+    for i = 1, #keys do h[keys[i]] = i end
+    local sum = 0
+    for _ = 1, N(50) do
+        for _, v in ipairs(t) do sum = sum + v end
+        for _, v in pairs(h) do sum = sum + v end
+    end
+    return sum
+end)
+
+-- large string-keyed tables; keys and table are made on first use
+local bigkeys, bigtable
+local function big()
+    if not bigkeys then
+        bigkeys, bigtable = {}, {}
+        for i = 1, N(1000000) do
+            bigkeys[i] = "k" .. i
+            bigtable[bigkeys[i]] = i
+        end
+    end
+    return bigkeys, bigtable
 end
 
-print("--- Lua Benchmark ---")
-run_bench("Math (Int Ops)", bench_math)
-run_bench("String (Alloc)", bench_string)
-run_bench("Recursion (Fib)", fib, FIB_N)
+case("hash_insert_1m", function ()
+    local ks = big()
+    local t = {}
+    for i = 1, #ks do t[ks[i]] = i end
+    return t
+end)
+
+case("hash_lookup_1m", function ()
+    local ks, t = big()
+    local sum = 0
+    for _ = 1, 3 do
+        for i = 1, #ks do sum = sum + t[ks[i]] end
+    end
+    return sum
+end)
+
+case("hash_miss_1m", function ()
+    local ks, t = big()
+    local n = 0
+    for _ = 1, 3 do   -- values as keys: integers are not in the table
+        for i = 1, #ks do if t[i] == nil then n = n + 1 end end
+    end
+    return n
+end)
+
+---------------------------------------------------------------------
+-- Functions
+---------------------------------------------------------------------
+local Point = {}
+Point.__index = Point
+function Point.new(x, y) return setmetatable({x = x, y = y}, Point) end
+function Point:add(o) self.x = self.x + o.x; self.y = self.y + o.y end
+function Point:norm1() return math.abs(self.x) + math.abs(self.y) end
+
+case("method_dispatch", function ()
+    local p, q = Point.new(0, 0), Point.new(1, -1)
+    local sum = 0
+    for _ = 1, N(3000000) do
+        p:add(q)
+        sum = sum + p:norm1()
+    end
+    return sum
+end)
+
+case("closures", function ()
+    local sum = 0
+    for i = 1, N(1000000) do
+        local f = function (x) return x + i end
+        sum = f(sum)
+    end
+    return sum
+end)
+
+case("upvalues", function ()
+    local a, b, c = 0, 1, 2
+    local function step() a = a + b; b = b + c; c = c - 1 end
+    for _ = 1, N(5000000) do step() end
+    return a
+end)
+
+case("coroutine_switch", function ()
+    local co = coroutine.wrap(function ()
+        local n = 0
+        while true do n = n + coroutine.yield(n) end
+    end)
+    co(0)
+    local last
+    for i = 1, N(1000000) do last = co(i) end
+    return last
+end)
+
+case("coroutine_create", function ()
+    local sum = 0
+    for i = 1, N(200000) do
+        local co = coroutine.wrap(function (x) return x + 1 end)
+        sum = sum + co(i)
+    end
+    return sum
+end)
+
+-- protected calls that succeed, as in 'run_lua' and finalizers
+case("pcall", function ()
+    local sum = 0
+    local function f(x) return x + 1 end
+    for i = 1, N(2000000) do
+        local _, r = pcall(f, i)
+        sum = sum + r
+    end
+    return sum
+end)
+
+case("pcall_error", function ()
+    local n = 0
+    local err = {}
+    local function f() error(err) end
+    for _ = 1, N(500000) do
+        if not pcall(f) then n = n + 1 end
+    end
+    return n
+end)
+
+case("finalizers", function ()
+    local n = 0
+    local mt = {__gc = function () n = n + 1 end}
+    for _ = 1, N(200000) do setmetatable({}, mt) end
+    collectgarbage()
+    return n
+end)
+
+---------------------------------------------------------------------
+-- String library and syntax extensions
+---------------------------------------------------------------------
+case("string_format", function ()
+    local len = 0
+    for i = 1, N(500000) do
+        len = len + #string.format("%d:%s:%.2f", i, "item", i / 3)
+    end
+    return len
+end)
+
+case("number_tostring", function ()
+    local len = 0
+    for i = 1, N(300000) do
+        len = len + #tostring(i / 7) + #(i .. "") + #string.format("%g", i * 0.37)
+    end
+    return len
+end)
+
+case("number_parse", function ()
+    local sum = 0
+    for i = 1, N(300000) do
+        sum = sum + tonumber("12." .. i % 1000) + tonumber("-3.5e-" .. i % 20)
+    end
+    return sum
+end)
+
+local text = string.rep("the quick brown fox jumps over the lazy dog ", 200)
+
+case("string_gsub", function ()
+    local n = 0
+    for _ = 1, N(500) do
+        local s, k = text:gsub("(%w+)", "<%1>")
+        n = n + k + #s
+    end
+    return n
+end)
+
+local logtext = {}
+for i = 1, 200 do
+    logtext[i] = string.format("12:%02d:%02d INFO [worker-%d] id=%d took %dms",
+                               i % 60, i % 60, i % 8, i * 7, i % 500)
+end
+logtext = table.concat(logtext, "\n")
+local idpat = string.compile("id=(%d+) took (%d+)ms")
+
+case("pattern_compiled", function ()
+    local n = 0
+    for _ = 1, N(2000) do
+        for id, ms in idpat:gmatch(logtext) do n = n + #id + #ms end
+    end
+    return n
+end)
+
+case("fstrings", function ()
+    local len = 0
+    for i = 1, N(500000) do
+        local name = "item"
+        len = len + #$"{name} number {i} of {i * 2}"
+    end
+    return len
+end)
+
+case("coalesce", function ()
+    local t = {a = 1, c = 3}
+    local sum = 0
+    for _ = 1, N(5000000) do
+        sum = sum + (t.a ?? 0) + (t.b ?? 2) + (t.c ?? 0)
+    end
+    return sum
+end)
+
+---------------------------------------------------------------------
+-- Memory, sorting and loading
+---------------------------------------------------------------------
+case("gc_alloc", function ()
+    local keep = {}
+    for i = 1, N(2000000) do
+        local t = {i, i + 1, name = "n"}
+        if i % 100 == 0 then keep[#keep + 1] = t end
+    end
+    return #keep
+end)
+
+case("table_sort", function ()
+    local t = {}
+    local x = 42
+    for i = 1, N(300000) do
+        x = (x * 1103515245 + 12345) % 2147483648
+        t[i] = x
+    end
+    table.sort(t)
+    return t[1]
+end)
+
+local chunk
+do
+    local parts = {"local M = {}"}
+    for i = 1, 300 do
+        parts[#parts + 1] = string.format(
+            "function M.f%d(a, b) if a > b then return a - b end " ..
+            "return {a, b, %d} end", i, i)
+    end
+    parts[#parts + 1] = "return M"
+    chunk = table.concat(parts, "\n")
+end
+local dumped = string.dump(assert(load(chunk)), true)
+
+case("bytecode_load", function ()
+    local n = 0
+    for _ = 1, N(500) do
+        n = n + (load(dumped, "=bench", "b") and 1 or 0)
+    end
+    return n
+end)
+
+case("source_load", function ()
+    local n = 0
+    for _ = 1, N(200) do
+        n = n + (load(chunk, "=bench", "t") and 1 or 0)
+    end
+    return n
+end)
+
+local linesfile = os.tmpname()
+do
+    local f = assert(io.open(linesfile, "w"))
+    for i = 1, N(200000) do
+        f:write("12:00:", i % 60, " INFO [worker] request ", i, " done\n")
+    end
+    f:close()
+end
+
+case("file_write", function ()
+    local f = assert(io.open(linesfile .. ".out", "w"))
+    for i = 1, N(300000) do
+        f:write("12:00:", i % 60, " INFO [worker] request ", i, " done\n")
+    end
+    f:close()
+    return os.remove(linesfile .. ".out")
+end)
+
+case("file_lines_mem", function ()
+    local n = 0
+    for _ = 1, 5 do
+        local f = assert(io.open(linesfile, "rm"))
+        for l in f:lines() do n = n + #l end
+        f:close()
+    end
+    return n
+end)
+
+case("dvm_pack", function ()
+    local t = {}
+    for i = 1, 500 do
+        t[i] = {id = i, name = "item" .. i, weight = i * 0.25, tags = {"a", "b"}}
+    end
+    local n = 0
+    for _ = 1, N(40) do
+        local v = dvm.unpack(dvm.pack(t))
+        n = n + #v
+    end
+    return n
+end)
+
+case("json", function ()
+    local t = {}
+    for i = 1, 500 do
+        t[i] = {id = i, name = "item " .. i, weight = i * 0.25, tags = {"a", "b"}}
+    end
+    local n = 0
+    for _ = 1, N(40) do
+        local v = json.decode(json.encode(t))
+        n = n + #v
+    end
+    return n
+end)
+
+---------------------------------------------------------------------
+-- Runner
+---------------------------------------------------------------------
+
+-- nearest-rank percentile of a sorted list
+local function percentile(sorted, p)
+    local k = math.max(1, math.ceil(p / 100 * #sorted))
+    return sorted[k]
+end
+
+local function measure(fn)
+    for _ = 1, WARMUP do sink = fn() end
+    local times = {}
+    for i = 1, RUNS do
+        collectgarbage()
+        local t0 = os.clock()
+        sink = fn()
+        times[i] = os.clock() - t0
+    end
+    table.sort(times)
+    return percentile(times, 50), percentile(times, 95), times[1]
+end
+
+local function readreport(file)
+    local medians = {}
+    for line in io.lines(file) do
+        local name, median = line:match("^([%w_]+)\t([%d.e+-]+)\t")
+        if name then medians[name] = tonumber(median) end
+    end
+    return medians
+end
+
+local baseline = basefile and readreport(basefile)
+local lines = {"# case\tmedian\tp95\tmin\truns"}
+local regressions = 0
+
+print(lines[1])
+for _, c in ipairs(cases) do
+    if not filter or c.name:find(filter) then
+        local median, p95, min = measure(c.fn)
+        local line = string.format("%s\t%.6f\t%.6f\t%.6f\t%d",
+                                   c.name, median, p95, min, RUNS)
+        lines[#lines + 1] = line
+        if baseline and baseline[c.name] and baseline[c.name] > 0 then
+            local ratio = median / baseline[c.name]
+            local slower = ratio > THRESHOLD
+            if slower then regressions = regressions + 1 end
+            line = string.format("%s\t# %.2fx%s", line, ratio,
+                                 slower and " REGRESSION" or "")
+        end
+        print(line)
+    end
+end
+
+os.remove(linesfile)
+
+if outfile then
+    local f = assert(io.open(outfile, "w"))
+    f:write(table.concat(lines, "\n"), "\n")
+    f:close()
+end
+
+if regressions > 0 then
+    io.stderr:write(string.format("%d case(s) slower than %.2fx baseline\n",
+                                  regressions, THRESHOLD))
+    os.exit(1)
+end
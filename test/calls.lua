@@ -455,7 +455,7 @@ do
   local header = string.pack("c4BBc6BBB",
     "\27Lua",                                  -- signature
     0x54,                                      -- version 5.4 (0x54)
-    0,                                         -- format
+    5,                                         -- format (Diluvium)
     "\x19\x93\r\n\x1a\n",                      -- data
     4,                                         -- size of instruction
     string.packsize("j"),                      -- sizeof(lua integer)
@@ -471,6 +471,32 @@ do
 
   assert(assert(load(c))() == 10)
 
+  -- nested functions are decoded lazily; dumping undecoded ones
+  -- must give back the same chunk
+  local nested = string.dump(function (x)
+    return function (y) return function (z) return x + y + z end end
+  end)
+  assert(string.dump(load(nested)) == nested)
+  assert(load(nested)(1)(2)(3) == 6)
+
+  -- strings used more than once are dumped only once
+  local long = string.rep("x", 100)
+  local function chunk (n, strip)  -- 'n' functions using 'long'
+    local src = {}
+    for i = 1, n do
+      src[i] = string.format("local f%d = function (%s) return %q end",
+                             i, string.rep("v", 50), long)
+    end
+    src[#src + 1] = "return f1()"
+    return string.dump(load(table.concat(src, "\n"), "=pool"), strip)
+  end
+  for _, strip in ipairs{false, true} do
+    local shared = chunk(3, strip)
+    assert(#shared - #chunk(1, strip) < #long)
+    assert(load(shared)() == long)
+    assert(string.dump(load(shared), strip) == shared)
+  end
+
   -- check header
   assert(string.sub(c, 1, #header) == header)
   -- check LUAC_INT and LUAC_NUM
@@ -493,5 +519,21 @@ do
   end
 end
 
+do  print("testing fast C functions")
+  -- library functions go through a lighter call path, but behave alike
+  assert(pairs({}) == next and math.floor == math.floor)
+  local t = {[math.abs] = 1}
+  assert(t[math.abs] == 1 and rawequal(string.byte, ("").byte))
+  local ok, msg = pcall(function () return math.floor("x") end)
+  assert(not ok and string.find(msg, "bad argument #1 to 'floor'"))
+  local s = string.rep("x", 300)
+  assert(select('#', string.byte(s, 1, -1)) == 300)   -- stack grows
+  local calls = 0
+  debug.sethook(function () calls = calls + 1 end, "c")
+  local x = math.abs(-1) + string.len("abc")
+  debug.sethook()
+  assert(x == 4 and calls >= 2)   -- hooks still see the calls
+end
+
 print('OK')
 return deep
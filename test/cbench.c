@@ -0,0 +1,381 @@
+/*
+** cbench.c
+** Benchmark driver for the C side of the interpreter: calls through the
+** embedding API, string traffic across the stack, chunk loading, and
+** the report analyzer. Built from the same amalgamation as the
+** interpreter (see target 'cbenchmark' in the Makefile):
+**
+**   gcc -O2 -std=c99 -DLUA_USE_LINUX -DMAKE_LIB -iquote src \
+**       -o cbench src/onelua.c src/analyze.c src/diluvium_api.c \
+**       test/cbench.c -lm -lpthread
+**
+** Usage: cbench [--quick] [--runs N] [file ...]
+** Without files, the corpus is a generated module of fixed contents.
+** Output has the columns of test/benchmark.lua (case, median, p95, min,
+** runs), plus the rate of the median run and its unit.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "analyze.h"
+
+
+static int runs = 7;
+static double scale = 1.0;
+
+static const char *corpus;  /* source analyzed and loaded */
+static size_t corpuslen;
+
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static long scaled (long n) {
+  long s = (long)(n * scale);
+  return (s > 0) ? s : 1;
+}
+
+
+static int cmpdouble (const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+/* nearest-rank percentile of 'n' sorted values */
+static double percentile (const double *t, int n, int p) {
+  int k = (p * n + 99) / 100;
+  return t[(k > 0 ? k : 1) - 1];
+}
+
+
+/*
+** Run 'fn' once to warm up and 'runs' timed times; 'fn' returns the
+** amount of work it did (in 'unit's), so that the rate is that work
+** over the median time.
+*/
+static void bench (const char *name, const char *unit, double div,
+                   double (*fn) (lua_State *L), lua_State *L) {
+  double *t = (double *)malloc(sizeof(double) * (size_t)runs);
+  double work = 0, median;
+  int i;
+  if (t == NULL) {
+    fprintf(stderr, "not enough memory\n");
+    exit(EXIT_FAILURE);
+  }
+  fn(L);  /* warm up */
+  for (i = 0; i < runs; i++) {
+    double t0;
+    lua_gc(L, LUA_GCCOLLECT);
+    t0 = now();
+    work = fn(L);
+    t[i] = now() - t0;
+  }
+  qsort(t, (size_t)runs, sizeof(double), cmpdouble);
+  median = percentile(t, runs, 50);
+  printf("%s\t%.6f\t%.6f\t%.6f\t%d\t%.2f\t%s\n", name, median,
+         percentile(t, runs, 95), t[0], runs,
+         (median > 0) ? work / div / median : 0.0, unit);
+  free(t);
+}
+
+
+/*
+** {======================================================
+** Cases
+** =======================================================
+*/
+
+/* lua_pcall of a small Lua function */
+static double pcall_lua (lua_State *L) {
+  long i, n = scaled(2000000);
+  lua_getglobal(L, "add");
+  for (i = 0; i < n; i++) {
+    lua_pushvalue(L, -1);
+    lua_pushinteger(L, i);
+    lua_pushinteger(L, 1);
+    if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      exit(EXIT_FAILURE);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return (double)n;
+}
+
+
+static int cadd (lua_State *L) {
+  lua_pushinteger(L, luaL_checkinteger(L, 1) + luaL_checkinteger(L, 2));
+  return 1;
+}
+
+
+/* lua_pcall of a C function */
+static double pcall_c (lua_State *L) {
+  long i, n = scaled(2000000);
+  for (i = 0; i < n; i++) {
+    lua_pushcfunction(L, cadd);
+    lua_pushinteger(L, i);
+    lua_pushinteger(L, 1);
+    lua_pcall(L, 2, 1, 0);
+    lua_pop(L, 1);
+  }
+  return (double)n;
+}
+
+
+/* Lua calling a C function (through a loaded chunk) */
+static double call_from_lua (lua_State *L) {
+  lua_getglobal(L, "callc");
+  lua_pushinteger(L, scaled(2000000));
+  lua_call(L, 1, 0);
+  return (double)scaled(2000000);
+}
+
+
+/* push short strings (interned) and read them back */
+static double strings_short (lua_State *L) {
+  char buff[32];
+  long i, n = scaled(2000000);
+  size_t total = 0;
+  for (i = 0; i < n; i++) {
+    size_t len;
+    int l = snprintf(buff, sizeof(buff), "key%ld", i % 5000);
+    lua_pushlstring(L, buff, (size_t)l);
+    total += strlen(lua_tolstring(L, -1, &len)) + len;
+    lua_pop(L, 1);
+  }
+  return (total > 0) ? (double)n : 0;
+}
+
+
+/* push long strings (not interned) and read them back */
+static double strings_long (lua_State *L) {
+  static char buff[1024];
+  long i, n = scaled(500000);
+  double bytes = 0;
+  if (buff[0] == '\0') memset(buff, 'x', sizeof(buff) - 1);
+  for (i = 0; i < n; i++) {
+    size_t len;
+    buff[i % 1000] = (char)('a' + i % 26);
+    lua_pushstring(L, buff);
+    lua_tolstring(L, -1, &len);
+    bytes += (double)len;
+    lua_pop(L, 1);
+  }
+  return bytes;
+}
+
+
+/* numbers converted to strings through the API */
+static double strings_numbers (lua_State *L) {
+  long i, n = scaled(1000000);
+  size_t total = 0;
+  for (i = 0; i < n; i++) {
+    size_t len;
+    lua_pushnumber(L, (lua_Number)i / 7);
+    lua_tolstring(L, -1, &len);
+    total += len;
+    lua_pop(L, 1);
+  }
+  return (total > 0) ? (double)n : 0;
+}
+
+
+/* compile the corpus */
+static double load_source (lua_State *L) {
+  long i, n = scaled(20);
+  for (i = 0; i < n; i++) {
+    if (luaL_loadbuffer(L, corpus, corpuslen, "=corpus") != LUA_OK) {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      exit(EXIT_FAILURE);
+    }
+    lua_pop(L, 1);
+  }
+  return (double)n * (double)corpuslen;
+}
+
+
+/* analyze the corpus and produce its JSON report */
+static double report (lua_State *L) {
+  long i, n = scaled(10);
+  (void)L;
+  for (i = 0; i < n; i++) {
+    char *json = diluvium_generate_report(corpus, corpuslen, "=corpus");
+    if (json == NULL) {
+      fprintf(stderr, "cannot analyze corpus\n");
+      exit(EXIT_FAILURE);
+    }
+    free(json);
+  }
+  return (double)n * (double)corpuslen;
+}
+
+
+/* tasks on a pool with one worker per CPU (startup included) */
+static double pool_tasks (lua_State *L) {
+  static const char handler[] =
+    "return function (m)\n"
+    "  local s = 0\n"
+    "  for i = 1, #m do s = s + m:byte(i) end\n"
+    "  return tostring(s)\n"
+    "end\n";
+  long i, n = scaled(100000);
+  size_t len = (corpuslen < 64) ? corpuslen : 64;
+  DiluviumTask *t = (DiluviumTask *)calloc((size_t)n, sizeof(DiluviumTask));
+  char *error;
+  DiluviumPool *pool = diluvium_pool_new(handler, sizeof(handler) - 1,
+                                         "=handler", 0, &error);
+  (void)L;
+  if (t == NULL || pool == NULL) {
+    fprintf(stderr, "cannot create pool: %s\n", error ? error : "no memory");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < n; i++) {
+    t[i].message = corpus + (size_t)i % (corpuslen - len + 1);
+    t[i].message_len = len;
+    diluvium_pool_submit(pool, &t[i]);
+  }
+  for (i = 0; i < n; i++) {
+    if (!diluvium_pool_wait(pool, &t[i])) {
+      fprintf(stderr, "%s\n", t[i].error);
+      exit(EXIT_FAILURE);
+    }
+    free(t[i].result);
+  }
+  diluvium_pool_close(pool);
+  free(t);
+  return (double)n;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Corpus
+** =======================================================
+*/
+
+static char *readfile (const char *name, size_t *len) {
+  FILE *f = fopen(name, "rb");
+  char *buff;
+  long size;
+  if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+    fprintf(stderr, "cannot read '%s'\n", name);
+    exit(EXIT_FAILURE);
+  }
+  rewind(f);
+  buff = (char *)malloc((size_t)size + 1);
+  if (buff == NULL || fread(buff, 1, (size_t)size, f) != (size_t)size) {
+    fprintf(stderr, "cannot read '%s'\n", name);
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+  *len = (size_t)size;
+  return buff;
+}
+
+
+/*
+** Concatenate the given files, each one wrapped in a function so that
+** their locals do not add up, or generate a module of fixed contents.
+*/
+static void makecorpus (lua_State *L, char **files, int nfiles) {
+  luaL_Buffer b;
+  int i;
+  luaL_buffinit(L, &b);
+  if (nfiles > 0) {
+    for (i = 0; i < nfiles; i++) {
+      size_t len;
+      char *s = readfile(files[i], &len);
+      luaL_addstring(&b, "do local function _chunk(...)\n");
+      luaL_addlstring(&b, s, len);
+      luaL_addstring(&b, "\nend end\n");
+      free(s);
+    }
+  }
+  else {
+    luaL_addstring(&b, "local M = {}\nlocal cache = {}\n");
+    for (i = 0; i < 3000; i++) {
+      lua_pushfstring(L,
+        "function M.fn_%d(t, n)\n"
+        "  local s = 0\n"
+        "  for i = 1, n do s = s + (t[i] or %d) end\n"
+        "  cache[\"k%d\"] = {name = \"fn_%d\", total = s}\n"
+        "  if s > %d then return mod_%d.handle(t, s) end\n"
+        "  return string.format(\"%%d:%%s\", s, M.label)\n"
+        "end\n", i, i, i, i, i * 10, i % 50);
+      luaL_addvalue(&b);
+    }
+    luaL_addstring(&b, "M.label = 'corpus'\nreturn M\n");
+  }
+  luaL_pushresult(&b);
+  corpus = lua_tolstring(L, -1, &corpuslen);
+  lua_setfield(L, LUA_REGISTRYINDEX, "cbench.corpus");  /* anchor it */
+}
+
+/* }====================================================== */
+
+
+static const char setup[] =
+  "function add (a, b) return a + b end\n"
+  "function callc (n)\n"
+  "  local f = cadd\n"
+  "  for i = 1, n do f(i, 1) end\n"
+  "end\n";
+
+
+int main (int argc, char **argv) {
+  lua_State *L = luaL_newstate();
+  int i = 1;
+  if (L == NULL) {
+    fprintf(stderr, "cannot create state: not enough memory\n");
+    return EXIT_FAILURE;
+  }
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      runs = 3;
+      scale = 0.01;
+    }
+    else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+      runs = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "usage: %s [--quick] [--runs N] [file ...]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (runs < 1) runs = 1;
+  luaL_openlibs(L);
+  lua_register(L, "cadd", cadd);
+  if (luaL_dostring(L, setup) != LUA_OK) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return EXIT_FAILURE;
+  }
+  makecorpus(L, argv + i, argc - i);
+  printf("# case\tmedian\tp95\tmin\truns\trate\tunit\n");
+  bench("pcall_lua", "calls/s", 1, pcall_lua, L);
+  bench("pcall_c", "calls/s", 1, pcall_c, L);
+  bench("lua_to_c", "calls/s", 1, call_from_lua, L);
+  bench("strings_short", "strings/s", 1, strings_short, L);
+  bench("strings_long", "MB/s", 1e6, strings_long, L);
+  bench("strings_numbers", "numbers/s", 1, strings_numbers, L);
+  bench("loadbuffer", "MB/s", 1e6, load_source, L);
+  bench("report", "MB/s", 1e6, report, L);
+  bench("pool_tasks", "tasks/s", 1, pool_tasks, L);
+  lua_close(L);
+  return EXIT_SUCCESS;
+}
@@ -56,6 +56,20 @@ do
   assert(f() == f())
 end
 
+do   -- closures that may come from the cache of their prototype
+  local x = 0
+  local fs = {}
+  for i = 1, 20 do
+    fs[i] = function () x = x + 1; return x end
+  end
+  for i = 1, 20 do assert(fs[i]() == i) end   -- all share 'x'
+  local function mk (y) return function () return y end end
+  local g1, g2 = mk(1), mk(2)
+  assert(g1 ~= g2 and g1() == 1 and g2() == 2)
+  debug.upvaluejoin(fs[1], 1, g2, 1)
+  assert(fs[1]() == 3 and g2() == 3)
+end
+
 
 -- testing closures with 'for' control variable
 a = {}
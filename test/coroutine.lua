@@ -967,6 +967,48 @@ assert(run(function ()
            end, {"for", "for", "for"}) == 10)
 
 
+print"testing 'coroutine.reserve'"
+do
+  local function rec (n) if n == 0 then return 0 end return 1 + rec(n - 1) end
+  local raw = coroutine.create(function () end)
+  assert(coroutine.reserve(raw, 10000, 1000))
+  assert(not coroutine.reserve(raw, 0x7fffffff))   -- too large
+  local function checkerror (msg, ...)
+    local st, err = pcall(...)
+    assert(not st and string.find(err, msg))
+  end
+  checkerror("out of range", coroutine.reserve, raw, -1)
+  checkerror("out of range", coroutine.reserve, raw, 10, -1)
+  checkerror("thread expected", coroutine.reserve, {}, 10)
+  assert(coroutine.reserve((coroutine.running()), 0))
+
+  local co = coroutine.create(function (n)
+    while true do
+      local sz, nci
+      if T then _, sz, _, nci = T.stacklevel() end
+      n = coroutine.yield(rec(n), sz, nci)
+    end
+  end)
+  assert(coroutine.reserve(co, 20000, 3000))
+  for i = 1, 3 do
+    local _, r, sz, nci = coroutine.resume(co, 2000)
+    assert(r == 2000)
+    if T then assert(sz >= 20000 and nci >= 3000) end
+    collectgarbage()
+  end
+  -- the reservation survives collections while the coroutine is idle
+  collectgarbage(); collectgarbage()
+  local _, r, sz, nci = coroutine.resume(co, 1)
+  assert(r == 1)
+  if T then assert(sz >= 20000 and nci >= 3000) end
+  -- a zero reservation restores the usual shrinking
+  assert(coroutine.reserve(co, 0, 0))
+  collectgarbage(); collectgarbage(); collectgarbage()
+  _, r, sz, nci = coroutine.resume(co, 1)
+  if T then assert(sz < 20000 and nci < 3000) end
+end
+
+
 
 -- tests for coroutine API
 if T==nil then
@@ -1153,4 +1195,35 @@ end)
 local a = {co()}
 assert(a[10] == "hi")
 
+
+do   -- collected coroutines are reused through the thread pool
+  local old = collectgarbage("threadpool")
+  assert(collectgarbage("threadpool", 8, 100) == old)
+  local function deep (n)
+    if n == 0 then return coroutine.yield(n) end
+    return deep(n - 1) + 1
+  end
+  for i = 1, 50 do
+    local up = i
+    local co = coroutine.create(function (n)
+      local f = function () return up end
+      deep(n)
+      error(f())
+    end)
+    assert(coroutine.resume(co, i * 10) and coroutine.status(co) == "suspended")
+    co = nil
+    collectgarbage()
+    -- a reused thread must look like a brand new one
+    co = coroutine.create(function (...) return select('#', ...), ... end)
+    assert(coroutine.status(co) == "suspended")
+    local ok, n, x = coroutine.resume(co, i)
+    assert(ok and n == 1 and x == i and coroutine.status(co) == "dead")
+    assert(debug.traceback(coroutine.create(print)) == "stack traceback:")
+  end
+  assert(collectgarbage("threadpool", 0) == 8)
+  for i = 1, 10 do coroutine.wrap(print) end
+  collectgarbage()
+  assert(collectgarbage("threadpool", old) == 0)
+end
+
 print'OK'
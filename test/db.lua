@@ -378,13 +378,26 @@ alo' .. [[
 assert(debug.getinfo(1, "l").currentline == L+11)  -- check count of lines
 
 
+-- with the optimizer on (-O), uses of a constant local are folded,
+-- so they do not see changes made by 'debug.setlocal'
+-- (a global, to keep the upvalues of 'g')
+optimized = (function ()
+  local k = 1
+  debug.setlocal(1, 1, 2)
+  return k + 1
+end)() == 2
+
 function g (...)
   local arg = {...}
   do local a,b,c; a=math.sin(40); end
   local feijao
   local AAAA,B = "xuxu", "abacate"
   f(AAAA,B)
-  assert(AAAA == "pera" and B == "manga")
+  if optimized then
+    assert(AAAA == "xuxu" and B == "abacate")
+  else
+    assert(AAAA == "pera" and B == "manga")
+  end
   do
      local B = 13
      local x,y = debug.getlocal(1,5)
@@ -772,7 +785,8 @@ local x = debug.getinfo(co, 1, "lfLS")
 assert(x.currentline == l.currentline and x.activelines[x.currentline])
 assert(type(x.func) == "function")
 for i=x.linedefined + 1, x.lastlinedefined do
-  assert(x.activelines[i])
+  -- (with -O, the unreachable final 'return' in the last line is removed)
+  assert(x.activelines[i] or (optimized and i == x.lastlinedefined))
   x.activelines[i] = undef
 end
 assert(next(x.activelines) == nil)   -- no 'extra' elements
@@ -1050,5 +1064,7 @@ do   -- tests for 'source' in binary dumps
          debug.getinfo(h).source == '=?')
 end
 
+optimized = nil
+
 print"OK"
 
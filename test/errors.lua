@@ -218,6 +218,41 @@ checkmessage("local a = setmetatable({}, {__index = 10}).x",
              "attempt to index a number value")
 
 
+-- repeated errors at the same instruction (messages are cached)
+do
+  local function f (a, b) return a + b end
+  local function g (x) return x() end
+  local up
+  local function h () return up.x end
+  local named = setmetatable({}, {__name = "MyType"})
+  for i = 1, 3 do
+    checkerr("arithmetic on a table value %(local 'a'%)", f, {}, 1)
+    checkerr("arithmetic on a table value %(local 'b'%)", f, 1, {})
+    checkerr("arithmetic on a nil value %(local 'a'%)", f, nil, {})
+    checkerr("arithmetic on a MyType value %(local 'b'%)", f, 1, named)
+    checkerr("call a nil value %(local 'x'%)", g)
+    checkerr("call a table value %(local 'x'%)", g, {})
+    up = nil
+    checkerr("index a nil value %(upvalue 'up'%)", h)
+    up = true
+    checkerr("index a boolean value %(upvalue 'up'%)", h)
+    collectgarbage()
+  end
+  local _, m1 = pcall(f, {}, 1)
+  local _, m2 = pcall(f, {}, 1)
+  assert(m1 == m2 and string.find(m1, "^.-errors.lua:%d+: attempt"))
+  -- a collection between two errors (which can shrink the stack) keeps
+  -- the description of the operand
+  local function deep (n) return (n > 0) and deep(n - 1) + 1 or 0 end
+  for i = 1, 2 do
+    deep(1000)   -- grow the stack, so that the collection shrinks it
+    collectgarbage()
+    local _, m = pcall(f, {}, 1)
+    assert(m == m1 and string.find(m, "(local 'a')", 1, true))
+  end
+end
+
+
 -- numeric for loops
 checkmessage("for i = {}, 10 do end", "table")
 checkmessage("for i = io.stdin, 10 do end", "FILE")
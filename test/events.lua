@@ -484,6 +484,68 @@ child = setmetatable({}, parent)
 child.foo = 10      --> CRASH (on some machines)
 assert(T == parent and K == "foo" and V == 10)
 
+
+-- cached lookups through chains of '__index' tables
+do
+  local A = {}; A.__index = A
+  function A.m () return "A" end
+  local B = setmetatable({}, A); B.__index = B
+  local C = setmetatable({}, B); C.__index = C
+  local obj = setmetatable({}, C)
+  local function get (k) return obj[k] end
+  for _ = 1, 3 do assert(get("m")() == "A" and get("none") == nil) end
+  -- new key in the middle of the chain
+  function B.m () return "B" end
+  assert(get("m")() == "B")
+  -- removed key
+  B.m = nil
+  assert(get("m")() == "A")
+  -- existing key with nil value set again (no new key)
+  B.m = function () return "B2" end
+  assert(get("m")() == "B2")
+  rawset(B, "m", nil); assert(get("m")() == "A")
+  rawset(B, "m", A.m); assert(get("m") == A.m)
+  B.m = nil
+  -- overwritten '__index'
+  local D = {m = function () return "D" end}
+  B.__index = D
+  assert(get("m")() == "D")
+  B.__index = B
+  assert(get("m")() == "A")
+  -- changed metatable in the chain
+  setmetatable(B, nil)
+  assert(get("m") == nil)
+  setmetatable(B, {__index = D})
+  assert(get("m")() == "D")
+  setmetatable(B, A)
+  -- absent key becoming present at the end of the chain
+  assert(get("late") == nil)
+  A.late = 10
+  assert(get("late") == 10)
+  -- function at the end of the chain still works
+  setmetatable(A, {__index = function (_, k) return k .. "!" end})
+  assert(get("xuxu") == "xuxu!" and get("late") == 10)
+  -- rehash of a table of the chain
+  for i = 1, 100 do A["k" .. i] = i end
+  for i = 1, 100 do assert(get("k" .. i) == i) end
+  assert(get("m")() == "A")
+  -- weak tables in the chain and collections
+  local W = setmetatable({}, {__mode = "v"})
+  local wi = {m = function () return "W" end}  -- keep it until collected
+  W.__index = wi
+  setmetatable(C, W)
+  assert(get("m")() == "W")
+  wi = nil
+  collectgarbage()
+  assert(get("m") == nil)   -- '__index' value was collected
+  -- a loop in the chain is still an error
+  local l1, l2 = {}, {}
+  l1.__index = l2; l2.__index = l1
+  setmetatable(l1, l2); setmetatable(l2, l1)
+  local x = setmetatable({}, l1)
+  assert(not pcall(function () return x.nothing end))
+end
+
 print 'OK'
 
 return 12
@@ -767,6 +767,49 @@ if not _port then
 end
 
 
+do  print("testing files read from memory")
+  local file = os.tmpname()
+  local f = assert(io.open(file, "w"))
+  local contents = "line one\n  42 0x10 3.5e2 rest\n\n" ..
+                   string.rep("x", 10000) .. "\nlast"
+  local size = #contents
+  f:write(contents)
+  assert(f:close())
+  for _, mode in ipairs{"r", "rm", "rbm"} do
+    local f = assert(io.open(file, mode))
+    assert(f:read() == "line one")
+    local a, b, c = f:read("n", "n", "n")
+    assert(a == 42 and b == 16 and c == 350)
+    assert(f:read("L") == " rest\n")
+    assert(f:read("l") == "")
+    assert(f:read("l") == string.rep("x", 10000))
+    assert(f:read(0) == "" and f:read(2) == "la")
+    assert(f:seek("cur", -2) == size - 4)
+    assert(f:read("a") == "last" and f:read("a") == "")
+    assert(f:read(0) == nil and f:read() == nil and f:read("n") == nil)
+    assert(f:seek("set") == 0)
+    local n = 0
+    for l in f:lines("L") do n = n + #l end
+    assert(n == size)
+    assert(f:seek("end") == size)
+    if mode ~= "r" then
+      assert(not f:seek("end", 1) and not f:seek("set", -1))
+      assert(f:seek() == size)
+      assert(not f:write("x"))
+    end
+    assert(f:close())
+    checkerr("closed file", f.read, f)
+  end
+  f = assert(io.open(file, "w")); assert(f:close())  -- empty file
+  f = assert(io.open(file, "rm"))
+  assert(f:read("a") == "" and f:read() == nil)
+  assert(f:close())
+  assert(os.remove(file))
+  assert(not io.open(file, "rm"))
+  checkerr("invalid mode", io.open, file, "wm")
+end
+
+
 -- testing tmpfile
 f = io.tmpfile()
 assert(io.type(f) == "file")
@@ -355,6 +355,51 @@ GC()
 -- assert(next(a) == nil)
 
 
+-- long ephemeron chains spread over many tables (many atomic rounds)
+do
+  local function chain (ntabs, len)
+    local tabs = {}
+    for i = 1, ntabs do tabs[i] = setmetatable({}, mt) end
+    local first = {}
+    local k = first
+    for i = 1, len do   -- link backwards through the tables
+      local v = {i}
+      tabs[ntabs - (i % ntabs)][k] = v
+      k = v
+    end
+    return tabs, first
+  end
+  local function count (tabs, first)
+    local ntabs, n, k = #tabs, 0, first
+    while true do
+      local v = tabs[ntabs - ((n + 1) % ntabs)][k]
+      if not v then break end
+      n = n + 1; assert(v[1] == n); k = v
+    end
+    return n
+  end
+  local tabs, first = chain(20, 500)
+  GC()
+  assert(count(tabs, first) == 500)
+  first = nil
+  GC()
+  for i = 1, #tabs do assert(next(tabs[i]) == nil) end
+
+  if T then   -- pending entries cannot grow: traverse whole tables
+    tabs, first = chain(7, 300)
+    T.alloccount(0)
+    collectgarbage()
+    T.alloccount()
+    assert(count(tabs, first) == 300)
+    first = nil
+    T.alloccount(0)
+    collectgarbage()
+    T.alloccount()
+    for i = 1, #tabs do assert(next(tabs[i]) == nil) end
+  end
+end
+
+
 -- testing errors during GC
 if T then
   collectgarbage("stop")   -- stop collection
@@ -690,6 +735,118 @@ do    -- check that the collector is not reentrant in incremental mode
 end
 
 
+do    -- collector statistics
+  local phases = {"propagate", "atomic", "sweep", "finalize"}
+  local s0 = collectgarbage("stats")
+  for _, p in ipairs(phases) do
+    assert(s0[p].time >= 0 and s0[p].lasttime >= 0)
+    assert(math.type(s0[p].freed) == "integer")
+  end
+  local fin = 0
+  for i = 1, 1000 do
+    setmetatable({}, {__gc = function () fin = fin + 1 end})
+  end
+  collectgarbage()
+  collectgarbage()
+  local s1 = collectgarbage("stats")
+  assert(s1.major >= s0.major + 2)
+  assert(s1.finalized - s0.finalized >= 1000 and fin == 1000)
+  assert(s1.sweep.freed > s0.sweep.freed)
+  assert(s1.traversed.table > s0.traversed.table)
+  assert(s1.traversed.lclosure > s0.traversed.lclosure)
+  assert(s1.traversed.thread > s0.traversed.thread)
+  assert(s1.traversed.string > s0.traversed.string)
+  for _, p in ipairs(phases) do
+    assert(s1[p].time >= s0[p].time and s1[p].lasttime <= s1[p].time)
+  end
+  -- finalizers cannot call the collector, but they can read its statistics
+  local inside
+  setmetatable({}, {__gc = function () inside = collectgarbage("stats") end})
+  collectgarbage()
+  assert(inside.finalized > s1.finalized)
+end
+
+
+do   print("testing heap snapshots")
+  local file = os.tmpname()
+  local marker = "snapshot marker " .. os.time()
+  local big = {}
+  for i = 1, 1000 do big[i] = {i} end
+  local weak = setmetatable({}, {__mode = "k"})
+  weak[big] = true
+  _G.SNAPROOT = {[marker] = big, f = function () return big end}
+  assert(collectgarbage("snapshot", file) == true)
+  local f = assert(io.open(file, "rb"))
+  local s = f:read("a")
+  f:close()
+  os.remove(file)
+  assert(s:sub(1, 6) == "\27LSNAP" and s:byte(7) == 1 and s:byte(8) == 8)
+  local objs, roots, pos = {}, {}, 9
+  while true do
+    local r = s:sub(pos, pos); pos = pos + 1
+    if r == "O" then
+      local id, tag, size, name, n
+      id, tag, size, name, n, pos = string.unpack("<i8 B i8 s2 I4", s, pos)
+      local refs = {}
+      for i = 1, n do refs[i], pos = string.unpack("<i8", s, pos) end
+      assert(objs[id] == nil)
+      objs[id] = {tag = tag, size = size, name = name, refs = refs}
+    elseif r == "R" then
+      local id, name
+      id, name, pos = string.unpack("<i8 s2", s, pos)
+      roots[name] = id
+    else
+      assert(r == "E")
+      local n = string.unpack("<i8", s, pos)
+      local count = 0
+      for _ in pairs(objs) do count = count + 1 end
+      assert(count == n)
+      break
+    end
+  end
+  assert(objs[roots["registry"]].tag == 5)   -- LUA_VTABLE
+  assert(objs[roots["main thread"]] and objs[roots["string metatable"]])
+  local reached = {}   -- references lead only to objects in the snapshot
+  local function mark (id)
+    if not reached[id] then
+      local o = assert(objs[id], "reference to unknown object")
+      reached[id] = true
+      for _, r in ipairs(o.refs) do mark(r) end
+    end
+  end
+  for _, id in pairs(roots) do mark(id) end
+  local bigid
+  for id, o in pairs(objs) do
+    if o.name == marker then   -- find 'big' through the marker key
+      for _, o2 in pairs(objs) do
+        local r = o2.refs
+        for i = 1, #r - 1 do
+          if r[i] == id and objs[r[i + 1]].tag == 5 then bigid = r[i + 1] end
+        end
+      end
+    end
+  end
+  assert(reached[bigid] and #objs[bigid].refs == 1000)
+  assert(objs[bigid].size >= 1000 * 16)
+  _G.SNAPROOT = nil
+end
+
+
+if T then
+  print("background release of dead objects")
+  -- the code runs twice, with a new allocator in the second time
+  local _, stopped = T.bgsweep[[
+    local t = {}
+    for i = 1, 100000 do t[i] = {i, function () return i end} end
+    t = nil
+    collectgarbage()   -- frees the large table in the background
+    t = {}
+    for i = 1, 100000 do t[i] = {i} end
+  ]]
+  assert(stopped)   -- the new allocator stopped the background thread
+end
+
+
 collectgarbage(oldmode)
 
 print('OK')
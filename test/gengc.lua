@@ -123,6 +123,35 @@ do   -- bug introduced in commit 9cf3299fa
 end
 
 
+do   print("adaptive mode")
+  assert(collectgarbage("generational") == "generational")
+  assert(collectgarbage("adaptive") == "generational")
+  assert(collectgarbage("adaptive") == "adaptive")
+
+  -- building a structure: young objects survive and major collections
+  -- free too little, so it leaves generational mode
+  local t = {}
+  for i = 1, 200000 do t[i] = {i} end
+  local info = collectgarbage("adaptinfo")
+  assert(info.toinc >= 1 and info.badmajor >= 1)
+  assert(info.majorup >= 1 and info.majormul > 100)
+
+  -- steady state: it goes back to generational mode
+  for i = 1, 2000000 do local x = {i} end
+  info = collectgarbage("adaptinfo")
+  assert(info.togen >= 1 and info.minor > 0)
+  assert(0 <= info.survival and info.survival <= 100)
+  assert(10 <= info.minormul and info.minormul <= 100)
+  t = nil
+
+  -- choosing a mode turns it off
+  assert(collectgarbage("generational", 20, 100) == "adaptive")
+  assert(collectgarbage("adaptive") == "generational")
+  assert(collectgarbage("incremental") == "adaptive")
+  assert(collectgarbage("generational") == "incremental")
+end
+
+
 if T == nil then
   (Message or print)('\n >>> testC not active: \z
                              skipping some generational tests <<<\n')
@@ -119,6 +119,23 @@ lexerror("'alo \\z  \n\n", "<eof>")
 lexerror("'alo \\z", "<eof>")
 lexerror([['alo \98]], "<eof>")
 
+-- tokens split across reader blocks
+do
+  local src = "local name_1 = 'plain string \\65\\n' -- comment\n" ..
+              "return name_1 .. \"x\", elseif_, until1 --[[ long ]]"
+  local ref = string.dump(assert(load(src, "=src")), true)
+  for n = 1, 13 do
+    local i = 1
+    local f = assert(load(function ()
+      local s = string.sub(src, i, i + n - 1)
+      i = i + n
+      return s
+    end, "=src"))
+    assert(string.dump(f, true) == ref)
+    assert(f() == "plain string A\nx")
+  end
+end
+
 -- valid characters in variable names
 for i = 0, 255 do
   local s = string.char(i)
@@ -395,6 +395,17 @@ assert(not tonumber'+ 0.01' and not tonumber'+.e1' and
 assert(tonumber('-012') == -010-2)
 assert(tonumber('-1.2e2') == - - -120)
 
+do   -- decimal floats near the limits of the fast conversion
+  assert(tonumber("9007199254740993.0") == 2^53)
+  assert(tonumber("0.1") == 1/10 and tonumber("1e22") == 10^22)
+  assert(tonumber("1e23") == 1e23 and tonumber("123e30") == 1.23e32)
+  assert(tonumber("12345678901234567890.5") == 12345678901234567890.0)
+  assert(tonumber("1e-22") == 10^-22 and tonumber("  3e-400 ") == 0.0)
+  assert(tostring(tonumber("-0.0")) == "-0.0" and tonumber("0e99999") == 0)
+  assert(tonumber("0." .. string.rep("0", 300) .. "1") == 1e-301)
+  assert(not tonumber("1.5 x") and not tonumber("1..2"))
+end
+
 assert(tonumber("0xffffffffffff") == (1 << (4*12)) - 1)
 assert(tonumber("0x"..string.rep("f", (intbits//4))) == -1)
 assert(tonumber("-0x"..string.rep("f", (intbits//4))) == 1)
@@ -1020,5 +1031,131 @@ assert(not pcall(random, maxint, maxint - 1))
 assert(not pcall(random, maxint, minint))
 
 
+do   print("testing intrinsic opcodes")
+  local function check (name, f, y)
+    -- same results when computed inline, after a dump, and through a
+    -- call that is not an intrinsic opcode
+    local g = load(string.dump(f, true))
+    local ref = {math[name]}
+    for _, v in ipairs{3, -3, 3.5, -3.5, 0.0, -0.0, 1e100, -1/0, minint,
+                       maxint, "4.5", 0/0} do
+      local r1, r2 = pcall(f, v)
+      local s1, s2 = pcall(g, v)
+      local t1, t2 = pcall(ref[1], v, y)
+      assert(r1 == s1 and r1 == t1)
+      assert(not r1 or (eqT(r2, t2) and eqT(s2, t2)) or r2 ~= r2)
+      assert(not r1 or r2 ~= r2 or 1/r2 == 1/t2)   -- same zero
+    end
+  end
+  check("floor", function (x) return (math.floor(x)) end)
+  check("ceil", function (x) return (math.ceil(x)) end)
+  check("abs", function (x) return (math.abs(x)) end)
+  check("sqrt", function (x) return (math.sqrt(x)) end)
+  check("min", function (x) return (math.min(x, 2)) end, 2)
+  check("max", function (x) return (math.max(x, 2)) end, 2)
+  local floor, abs = math.floor, math.abs
+  assert(eqT(floor(3.7), 3) and eqT(floor(-3.5), -4) and eqT(floor(2^70), 2^70))
+  assert(eqT(math.ceil(3.2), 4) and eqT(abs(minint), minint))
+  assert(eqT(math.min(1, 2.0), 1) and eqT(math.max(2, 2.0), 2))
+  assert(eqT(math.max(1, 2.0), 2.0) and eqT(math.sqrt(4), 2.0))
+  local m = math.max(0/0, 1); assert(m ~= m)
+  checkerror("number expected", function () return math.floor({}) end)
+  -- a shadowed function is called as usual
+  local math = {floor = function (x) return "floor" .. x end}
+  assert(math.floor(1) == "floor1")
+  local function max (a, b) return "max" end
+  assert(max(1, 2) == "max")
+  -- hooks see the calls
+  local n = 0
+  debug.sethook(function () n = n + 1 end, "c")
+  local x = floor(1.5) + abs(-1)
+  debug.sethook()
+  assert(x == 2 and n >= 2)
+end
+
+
+do   print("testing typed integer arithmetic")
+  local function f (n)
+    local s, p = 0, 1
+    for i = 1, n do
+      local j = i * 3 - 1
+      s = s + j % 7 + j // 4 + (i + i) - (j - i)
+      p = (p * 5) % 1000003
+    end
+    return s, p
+  end
+  local g = load(string.dump(f))
+  local s, p = f(1000)
+  assert(eqT(s, 378747) and eqT(p, 463979))
+  assert(select(2, g(1000)) == p and g(1000) == s)
+  -- wrap-around
+  local function sq (x)
+    for i = x, x do return i * i, i + maxint, i - 2, i // -2, i % -2 end
+  end
+  local a, b, c, d, e = sq(minint)
+  assert(a == 0 and b == -1 and c == maxint - 1 and d == 2^62 and e == 0)
+  a, b, c, d, e = sq(7)
+  assert(a == 49 and b == minint + 6 and c == 5 and d == -4 and e == -1)
+  -- guards: control variable or operands that are not integers
+  local function h (n)
+    local t = {}
+    for i = 1, n do
+      if i == 2 then i = 2.5 end
+      t[#t + 1] = i * 2 + i % 2
+    end
+    return t
+  end
+  local t = h(3)
+  assert(eqT(t[1], 3) and eqT(t[2], 5.5) and eqT(t[3], 7))
+  local function k (n)
+    local r
+    for i = 1, n do
+      local a = debug.getinfo(1, "l") and i
+      r = a + 1
+    end
+    return r
+  end
+  assert(k(3) == 4)
+  -- 'l' with its control variable set to 'v' in the second iteration
+  local function l (n)
+    local t = {}
+    for i = 1, n do
+      t[#t + 1] = i * 10 + i % 3
+    end
+    return t
+  end
+  local function setcontrol (v)
+    local body = debug.getinfo(l, "S").linedefined + 3
+    local hits = 0
+    debug.sethook(function (_, line)
+      if line == body and debug.getinfo(2, "f").func == l then
+        hits = hits + 1
+      end
+      if hits == 2 and line == body then   -- second iteration
+        for n = 1, math.huge do
+          local name = debug.getlocal(2, n)
+          if name == nil then break
+          elseif name == "i" then debug.setlocal(2, n, v)
+          end
+        end
+      end
+    end, "l")
+    local t = l(3)
+    debug.sethook()
+    return t
+  end
+  t = setcontrol(0.5)
+  assert(eqT(t[1], 11) and eqT(t[2], 5.5) and eqT(t[3], 30))
+  t = setcontrol("10")
+  assert(t[2] == 101 and math.type(t[2]) == "integer")
+  -- metamethods in the fallback
+  local mt = {__mul = function (a, b) return 200 end,
+              __mod = function (a, b) return -2 end}
+  t = setcontrol(setmetatable({}, mt))
+  assert(t[1] == 11 and t[2] == 198 and t[3] == 30)
+  checkerror("arithmetic", setcontrol, {})
+  debug.sethook()
+end
+
 
 print('OK')
@@ -219,6 +219,68 @@ assert(#a == 51)
 end  --]
 
 
+do   -- preallocated tables
+  local t = table.new(100, 10)
+  check(t, 100, 16)
+  assert(next(t) == nil and #t == 0)
+  for i = 1, 100 do t[i] = i end
+  for i = 1, 10 do t["k" .. i] = i end
+  check(t, 100, 16)    -- no rehash while filling it
+  assert(#t == 100)
+  check(table.new(0), 0, 0)
+  check(table.new(5), 5, 0)
+  checkerror("out of range", table.new, -1)
+  checkerror("out of range", table.new, 1, -1)
+  checkerror("number expected", table.new)
+end
+
+
+do   -- frozen tables
+  local t = {10, 20, 30, x = 1, y = {}}
+  assert(not table.isfrozen(t))
+  assert(table.freeze(t) == t and table.isfrozen(t))
+  assert(table.freeze(t) == t)    -- freezing again is a no-op
+  assert(t[2] == 20 and t.x == 1 and #t == 3 and not table.isfrozen(t.y))
+  local function nowrite (f, ...)
+    checkerror("frozen table", f, ...)
+  end
+  nowrite(function () t.x = 2 end)      -- existing field
+  nowrite(function () t.z = 2 end)      -- new field
+  nowrite(function () t[1] = 0 end)     -- array part
+  nowrite(function () t[4] = 40 end)
+  nowrite(rawset, t, "x", 3)
+  nowrite(rawset, t, 100, 3)
+  nowrite(table.insert, t, 40)
+  nowrite(table.remove, t)
+  nowrite(table.sort, t, function (a, b) return a > b end)
+  nowrite(table.sort, t)
+  nowrite(table.move, {1}, 1, 1, 1, t)
+  nowrite(setmetatable, t, {})
+  assert(t[1] == 10 and t[3] == 30 and t[4] == nil and t.x == 1 and
+         t.z == nil and getmetatable(t) == nil)
+  t.y.a = 1     -- freezing is shallow
+  assert(t.y.a == 1)
+  checkerror("table expected", table.freeze, 1)
+  checkerror("table expected", table.isfrozen)
+
+  -- frozen tables work in '__index' chains
+  local base = table.freeze({f = 1})
+  local mid = setmetatable({}, {__index = base})
+  local obj = setmetatable({}, {__index = mid})
+  for i = 1, 3 do assert(obj.f == 1 and obj.g == nil) end
+  mid.g = 2     -- other tables in the chain still change
+  assert(obj.g == 2 and obj.f == 1)
+  nowrite(function () base.g = 3 end)
+  assert(obj.g == 2)
+
+  -- frozen tables are still collected
+  local w = setmetatable({}, {__mode = "k"})
+  w[table.freeze({})] = true
+  collectgarbage(); collectgarbage()
+  assert(next(w) == nil)
+end
+
+
 -- test size operation on tables with nils
 assert(#{} == 0)
 assert(#{nil} == 0)
@@ -822,4 +884,162 @@ do
   
 end
 
+
+do   print("testing loops with 'next' and 'ipairs' computed inline")
+  local t = {10, 20, 30, x = 1, y = 2, [2.5] = 3}
+  local function collect (...)
+    local r = {}
+    for k, v, extra in ... do
+      assert(extra == nil and r[k] == nil)
+      r[k] = v
+    end
+    return r
+  end
+  local function same (a, b)
+    for k, v in next, a do if b[k] ~= v then return false end end
+    for k, v in next, b do if a[k] ~= v then return false end end
+    return true
+  end
+  assert(same(collect(pairs(t)), t) and same(collect(next, t), t))
+  assert(same(collect(next, t, nil), t))
+  local r = collect(ipairs(t))
+  assert(#r == 3 and r[3] == 30 and r.x == nil)
+  -- one variable
+  local n = 0
+  for k in pairs(t) do n = n + 1; assert(t[k]) end
+  assert(n == 6)
+  -- starting from a key goes through 'next'
+  n = 0
+  for k in next, {1, 2, 3}, 1 do n = n + 1 end
+  assert(n == 2)
+  -- clearing fields while traversing
+  local big = {}
+  for i = 1, 100 do big[i] = i; big["k" .. i] = i end
+  n = 0
+  for k, v in pairs(big) do
+    big[k] = nil
+    n = n + 1
+    if n % 10 == 0 then collectgarbage() end
+  end
+  assert(n == 200 and next(big) == nil)
+  -- yields in the body
+  local co = coroutine.wrap(function ()
+    local s = 0
+    for k, v in pairs(t) do s = s + v; coroutine.yield() end
+    return s
+  end)
+  local s
+  repeat s = co() until s
+  assert(s == 66)
+  -- the control variable still works with 'next' changed
+  local calls = 0
+  local mynext = function (t, k) calls = calls + 1; return next(t, k) end
+  assert(same(collect(mynext, t), t) and calls == 7)
+  -- hooks set before the loop see the calls
+  calls = 0
+  debug.sethook(function () calls = calls + 1 end, "c")
+  for k in pairs(t) do end
+  debug.sethook()
+  assert(calls >= 7)
+  -- 'ipairs' stops at the first nil and respects '__index'
+  r = collect(ipairs{1, 2, nil, 4})
+  assert(#r == 2)
+  local proxy = setmetatable({1}, {__index = function (_, i)
+    if i <= 3 then return i * 10 end
+  end})
+  r = collect(ipairs(proxy))
+  assert(r[1] == 1 and r[2] == 20 and r[3] == 30 and r[4] == nil)
+  n = 0
+  for i in ipairs{10, 20, 30} do n = n + i end
+  assert(n == 6)
+  -- no integer wrap-around issues and errors as usual
+  n = 0
+  local wrap = setmetatable({}, {__index = function (_, i)
+    if i == math.mininteger then return "min" end
+  end})
+  for i, v in ipairs(wrap), wrap, math.maxinteger do
+    n = n + 1; assert(i == math.mininteger and v == "min")
+  end
+  assert(n == 1)
+  checkerror("table expected", function () for k in next, 1 do end end)
+end
+
+
+do   print("testing cached accesses to globals")
+  local env = setmetatable({}, {__index = _G})
+  local f = load([[
+    local n = 0
+    for i = 1, 100 do
+      n = n + G
+      G = G + 1
+      _ENV["x" .. i] = i   -- grows and rehashes '_ENV'
+      if i % 10 == 0 then _ENV["x" .. i - 5] = nil end
+    end
+    return n, type, math.floor(1.5)
+  ]], "", "t", env)
+  env.G = 1
+  local n, t, one = f()
+  assert(n == 5050 and env.G == 101 and t == type and one == 1)
+  assert(env.x100 == 100 and env.x95 == nil and env.x99 == 99)
+  env.G = nil         -- falls back to '__index'
+  _G.G = 7
+  local g = load("return G", "", "t", env)
+  assert(g() == 7)
+  env.G = 8
+  assert(g() == 8)
+  env = {G = 9}        -- same code, other table
+  debug.setupvalue(g, 1, env)
+  assert(g() == 9)
+  _G.G = nil
+end
+
+
+do   print("testing 'pairs' loops with light-userdata keys")
+  local a, b, c
+  local function f () return a, b, c end
+  local u1, u2, u3 = debug.upvalueid(f, 1), debug.upvalueid(f, 2),
+                     debug.upvalueid(f, 3)
+  local null = json.null     -- a NULL light userdata
+  local t = {[u1] = 1, [u2] = 2, [u3] = 3, [null] = 4}
+  local function count (...)
+    local n = 0
+    for k, v in ... do assert(t[k] == v); n = n + 1 end
+    return n
+  end
+  assert(count(pairs(t)) == 4 and count(next, t) == 4)
+  -- loops that start from a light-userdata key
+  local i = 0
+  local k = next(t)
+  while k ~= nil do
+    i = i + 1
+    assert(count(next, t, k) == 4 - i)
+    k = next(t, k)
+  end
+  assert(i == 4)
+  -- a loop started while a hook is active
+  debug.sethook(function () end, "c")
+  local n = count(pairs(t))
+  debug.sethook()
+  assert(n == 4)
+  -- the debug library sees the current key as the control value
+  local function control (level)   -- index of the control variable
+    for i = 1, math.huge do
+      if debug.getlocal(level + 1, i) == "(for state)" then
+        return i + 2   -- after the iterator and the state
+      end
+    end
+  end
+  n = 0
+  for k, v in pairs(t) do
+    local idx = control(1)
+    assert(select(2, debug.getlocal(1, idx)) == k)
+    n = n + 1
+    if n == 2 then   -- restart the traversal by hand
+      debug.setlocal(1, idx, nil)
+    end
+    if n > 10 then break end
+  end
+  assert(n == 6)
+end
+
 print"OK"
@@ -436,5 +436,58 @@ do   -- test reuse of original string in gsub
   assert(r == s and string.format("%p", s) ~= string.format("%p", r))
 end
 
+do  print("testing compiled patterns")
+  local p = string.compile("(%a+)=(%d+)")
+  assert(string.compile("(%a+)=(%d+)") == p)    -- cached
+  assert(string.compile(p) == p)
+  assert(p:match("x y=10") == "y")
+  assert(select(2, p:match("x y=10")) == "10")
+  assert(string.match(" a=1 ", p) == "a")    -- accepted as a pattern
+  local a, b, k, v = p:find("-- abc=123;")
+  assert(a == 4 and b == 10 and k == "abc" and v == "123")
+  assert(p:find("abc=123", 2) == 2)
+  assert(not p:find("abc="))
+  local t = {}
+  for k, v in p:gmatch("a=1, b=2, c=x, d=4") do t[#t + 1] = k .. v end
+  assert(table.concat(t, " ") == "a1 b2 d4")
+  assert(p:gsub("a=1, b=2", "%2=%1") == "1=a, 2=b")
+  assert(select(2, p:gsub("a=1, b=2, c=3", "", 2)) == 2)
+  assert(string.gsub("a=1", p, {a = "A"}) == "A")
+
+  -- literal prefixes and leading classes skip positions
+  p = string.compile("key:(%w*)")
+  assert(p:gsub("key:a key: keyb key:cc", "<%1>") == "<a> <> keyb <cc>")
+  assert(p:find("ke key:x") == 4)
+  p = string.compile("%d+%.?%d*")
+  assert(p:gsub("x1.5y22z.3", "#") == "x#y#z.#")
+  assert(string.compile("()ab"):match("xxab") == 3)
+
+  -- anchors, frontiers, balances, and back references
+  p = string.compile("^%s*(%S+)")
+  assert(p:match("  ab cd") == "ab" and not p:match("  ", 1))
+  assert(p:gsub("  ab cd", "[%1]") == "[ab] cd")
+  local n = 0
+  for w in string.compile("^a"):gmatch("^a^a") do n = n + 1 end
+  assert(n == 2)    -- in 'gmatch', '^' is not an anchor
+  assert(string.compile("%f[%w]%w+"):gsub("one two", "_") == "_ _")
+  assert(string.compile("%b()"):match("f(a(b)c)d") == "(a(b)c)")
+  assert(string.compile("(%w)%1"):match("abccd") == "c")
+  assert(string.compile("%[([^%]]*)%]"):match("x[a.b]") == "a.b")
+  assert(string.compile("a.-b$"):match("xaxbab") == "axbab")
+  assert(string.compile("a%z"):find("ba\0") == 2)
+  assert(string.compile("a\0b"):find("xa\0b", 1, true) == 2)
+
+  -- errors are raised when compiling
+  checkerror("malformed pattern %(ends with '%%'%)", string.compile, "a%")
+  checkerror("missing ']'", string.compile, "[a")
+  checkerror("invalid pattern capture", string.compile, "a)")
+  checkerror("invalid capture index %%1", string.compile, "%1(a)")
+  checkerror("missing arguments to '%%b'", string.compile, "x%b(")
+  checkerror("missing '%[' after '%%f'", string.compile, "%fx")
+  assert(string.find("b", "a)") == nil)    -- pattern never tried
+  checkerror("string expected", string.compile, {})
+  checkerror("strpattern expected", string.compile("a").find, "a")
+end
+
 print('OK')
 
@@ -47,4 +47,13 @@ print("Secrets retrieved:", p, k)
 OuterSecure()
 NormalFunction()
 
-print("=== All tests complete ===")
\ No newline at end of file
+print("=== All tests complete ===")
+
+-- Test 6: Binary chunks hide the contents of secure functions
+local chunk = string.dump(load([[
+  ~function Hidden() return "super_secret_password_123" end
+  return Hidden()
+]], "=hidden"))
+assert(not string.find(chunk, "super_secret", 1, true))
+assert(load(chunk)() == "super_secret_password_123")
+print("Dumped secure function reloads correctly")
@@ -188,6 +188,53 @@ checkerror("wrap around", table.move, {}, 1, 2, maxI)
 checkerror("wrap around", table.move, {}, minI, -2, 2)
 
 
+do   -- array parts are moved directly by the core
+  local function check (t, ...)
+    local n = select('#', ...)
+    for i = 1, n do assert(t[i] == select(i, ...)) end
+  end
+  local t = {}
+  for i = 1, 100 do table.insert(t, 1, i) end   -- grows the array part
+  assert(#t == 100 and t[1] == 100 and t[100] == 1)
+  for i = 1, 50 do assert(table.remove(t, 1) == 101 - i) end
+  assert(#t == 50 and t[1] == 50 and t[50] == 1 and t[51] == nil)
+  t = {1, nil, 3, 4}
+  table.insert(t, 2, 10)     -- holes move as nils
+  check(t, 1, 10, nil, 3, 4)
+  assert(table.remove(t, 1) == 1)
+  check(t, 10, nil, 3, 4)
+  t = table.move({1, 2, 3, 4, 5}, 2, 5, 1)   -- overlapping, down
+  check(t, 2, 3, 4, 5, 5)
+  t = table.move({1, 2, 3, 4, 5}, 1, 4, 2)   -- overlapping, up
+  check(t, 1, 1, 2, 3, 4)
+  local a = {}
+  for i = 1, 1000 do a[i] = {i} end
+  t = table.move(a, 1, 1000, 1, {})
+  collectgarbage()
+  for i = 1, 1000 do assert(t[i][1] == i) end
+  -- destination with fields in its hash part
+  t = table.move({1, 2, 3}, 1, 3, 2, {[3] = "x", [10] = "y"})
+  check(t, nil, 1, 2, 3)
+  assert(t[10] == "y")
+  -- metamethods still see the right accesses
+  local log = {}
+  local p = setmetatable({}, {__index = function (_, k) log[#log + 1] = k end})
+  assert(select('#', table.unpack(p, 1, 3)) == 3 and #log == 3)
+  p = setmetatable({1, nil, 3},
+        {__index = function (_, k) return k * 10 end})
+  check({table.unpack(p, 1, 3)}, 1, 20, 3)
+  t = table.move(p, 1, 3, 1, {})
+  check(t, 1, 20, 3)
+  p = setmetatable({1, nil, 3}, {__newindex = function (t, k, v)
+                                   rawset(t, k, v and v * 10) end})
+  table.move({1, 2, 3}, 1, 3, 1, p)
+  check(p, 1, 20, 3)
+  checkerror("frozen", table.insert, table.freeze({1, 2, 3}), 1, 0)
+  checkerror("frozen", table.remove, table.freeze({1, 2, 3}), 1)
+  checkerror("frozen", table.move, {1}, 1, 1, 1, table.freeze({1}))
+end
+
+
 print"testing sort"
 
 
@@ -301,6 +348,41 @@ table.sort(AA, function (x, y)
 
 _G.AA = nil
 
+do   -- arrays of one type are sorted without calling Lua
+  local a = {}
+  for i = 1, 1000 do a[i] = math.random(-2^40, 2^40) end
+  a[1], a[2] = math.mininteger, math.maxinteger
+  a[3], a[4] = -1, 0
+  table.sort(a)
+  check(a)
+  assert(a[1] == math.mininteger and a[1000] == math.maxinteger)
+
+  for i = 1, 1000 do a[i] = (math.random() - 0.5) * 2^(i % 60) end
+  a[1], a[2], a[3], a[4] = math.huge, -math.huge, -0.0, 0.0
+  table.sort(a)
+  check(a)
+  assert(a[1] == -math.huge and a[1000] == math.huge)
+  for i = 1, 1000 do assert(math.type(a[i]) == "float") end
+
+  a = {"b\0a", "b", "b\0", "a\0z", "a", "", "c"}
+  table.sort(a)
+  check(a)
+  assert(a[1] == "" and a[#a] == "c")
+
+  a = {3, 1.5, 2, 0.5}    -- mixed numbers take the generic path
+  table.sort(a)
+  check(a)
+
+  a = setmetatable({3, 2, 1}, {__index = error, __newindex = error})
+  table.sort(a)    -- no metamethods for present elements
+  assert(a[1] == 1 and a[3] == 3)
+
+  a = {}
+  for i = 1, 1000 do a[i] = 1000 - i end
+  table.sort(a, function (x, y) return x > y end)   -- order function
+  check(a, function (x, y) return x > y end)
+end
+
 local tt = {__lt = function (a,b) return a.val < b.val end}
 a = {}
 for i=1,10 do  a[i] = {val=math.random(100)}; setmetatable(a[i], tt); end
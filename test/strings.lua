@@ -259,6 +259,53 @@ assert(string.format("%08X", 0xFFFFFFFF) == "FFFFFFFF")
 assert(string.format("%+08d", 31501) == "+0031501")
 assert(string.format("%+08d", -30927) == "-0030927")
 
+do    -- '%g', '%f', '%d', and '%s' (which may not go through 'printf')
+  assert(string.format("%d %d", math.mininteger, 0) ==
+         "-9223372036854775808 0")
+  assert(string.format("%g %g %g", 0.5, -0.0, 100000) == "0.5 -0 100000")
+  assert(string.format("%g %g", 1e6, 1234567) == "1e+06 1.23457e+06")
+  assert(string.format("%g %g", 0.0001, 0.00001) == "0.0001 1e-05")
+  assert(string.format("%.3g %.3g", 2.5e-7, 999.5) == "2.5e-07 1e+03")
+  assert(string.format("%.0g %.1g %.1g", 2.5, 0.25, 0.35) == "2 0.2 0.3")
+  assert(string.format("%.14g", 2^53) == "9.007199254741e+15")
+  assert(string.format("%.15g %.15g", 0.1, 1/3) == "0.1 0.333333333333333")
+  assert(string.format("%g %g", 1e300, 5e-324) == "1e+300 4.94066e-324")
+  assert(tostring(-2^-10) == "-0.0009765625")
+  assert(tostring(123.25) == "123.25" and tostring(-0.1) == "-0.1")
+  assert(string.format("%f %.0f %.1f", 1/3, 2.5, -0.04) ==
+         "0.333333 2 -0.0")
+  assert(string.format("%.2f %.2f %.0f", 0.125, 0.375, 3.5) ==
+         "0.12 0.38 4")
+  assert(string.format("%.3f %.1f", 2^52, 1e300):sub(1, 20) ==
+         "4503599627370496.000")
+  assert(string.format("%5d|%-5d|%3d", 42, 42, 12345) ==
+         "   42|42   |12345")
+  assert(string.format("%8.2f|%-8.3g|%6s|%-6s|", 3.14159, 2/3, "ab", "ab")
+         == "    3.14|0.667   |    ab|ab    |")
+  assert(string.format("%.2f %5.1f%%", math.huge, -math.huge) ==
+         "inf  -inf%")
+end
+
+
+do    -- formats are compiled once and reused
+  local f = "[%s] %d%%"
+  for i = 1, 3 do
+    assert(string.format(f, "x", i) == "[x] " .. i .. "%")
+    collectgarbage()
+  end
+  -- errors come in the same order as before
+  checkerror("no value", string.format, "%d %z")
+  checkerror("number expected", string.format, "%d %z", {})
+  checkerror("invalid conversion '%%z'", string.format, "%d %z", 1, 2)
+  checkerror("number expected", string.format, "%123d", {})
+  checkerror("specification", string.format, "%123d", 1)
+  checkerror("too long", string.format, "%" .. string.rep("1", 30) .. "d", 1)
+  local t = setmetatable({}, {__tostring = function ()
+    return string.format(f, "in", 0)   -- reentrant use of 'f'
+  end})
+  assert(string.format(f, t, 1) == "[[in] 0%] 1%")
+end
+
 
 do    -- longest number that can be formatted
   local i = 1
@@ -522,5 +569,125 @@ else
 end
 
 
+do  print("testing string buffers")
+  local b = string.buffer("a", 1)
+  assert(#b == 2 and tostring(b) == "a1")
+  assert(b:append("x", 2.5) == b)
+  assert(b:tostring() == "a1x2.5")
+  local b1 = b .. "y" .. 3    -- appends in place
+  assert(b1 == b and b:tostring() == "a1x2.5y3")
+  assert("<" .. b == "<a1x2.5y3")    -- new string
+  b:reset()
+  assert(#b == 0 and b:tostring() == "")
+  b:appendf("%d-%5.1f-%q", 10, 0.25, "\n")
+  assert(b:tostring() == string.format("%d-%5.1f-%q", 10, 0.25, "\n"))
+  b:reset():rep("ab", 3, ",")
+  assert(b:tostring() == "ab,ab,ab")
+  b:rep("x", 0)
+  assert(b:tostring() == "ab,ab,ab")
+  b = b .. b    -- a buffer can append itself
+  assert(b:tostring() == "ab,ab,abab,ab,ab")
+  b = string.buffer("\0z") .. string.buffer("\0")
+  assert(b:tostring() == "\0z\0")
+
+  local n = 0
+  b = string.buffer()
+  for i = 1, 10000 do b = b .. $"{i},"; n = n + #tostring(i) + 1 end
+  assert(#b == n and string.sub(b:tostring(), 1, 4) == "1,2,")
+
+  checkerror("concatenate a table", function () return b .. {} end)
+  checkerror("concatenate a nil", function () return nil .. b end)
+  checkerror("strbuf expected", b.append, {})
+  checkerror("string expected", b.appendf, b)
+end
+
+
+do  print("testing long strings (vectorized loops)")
+  -- results must not depend on where a string crosses a 16-byte block
+  local function slow (s, f)
+    return (string.gsub(s, ".", f))
+  end
+  for n = 60, 100, 7 do
+    local s = string.rep("aZ\"\\\n\0\127\200 x", n):sub(1, 10 * n - 3)
+    assert(string.lower(s) == slow(s, string.lower))
+    assert(string.upper(s) == slow(s, string.upper))
+    local r = {}
+    for i = #s, 1, -1 do r[#r + 1] = string.sub(s, i, i) end
+    assert(string.reverse(s) == table.concat(r))
+    assert(load("return " .. string.format("%q", s))() == s)
+    assert(string.find(s, "\0\127\200", 1, true) == 6)
+    assert(string.find(s, "xaZ", 1, true) == 10)
+    assert(string.find(s .. "xyzzy", "xyzzy", 1, true) == #s + 1)
+    assert(not string.find(s, "xyzzy", 1, true))
+  end
+end
+
+
+do  print("testing long substrings (slices)")
+  local big = string.rep("abcdefghij", 10000)
+  local s = big:sub(11, 10010)
+  assert(#s == 10000 and s:sub(1, 3) == "abc")
+  assert(s == string.rep("abcdefghij", 1000))
+  local t = {[s] = 1}
+  assert(t[string.rep("abcdefghij", 1000)] == 1)
+  assert(s < big and big > s and s .. "" == s)
+  -- conversions need the slice to end where its contents end
+  local n = (" "):rep(300) .. "42" .. (" "):rep(10)
+  local m = ("x" .. n .. "y"):sub(2, -2)
+  assert(m + 1 == 43 and tonumber(m) == 42)
+  -- slices keep their parents alive
+  big = nil
+  collectgarbage()
+  assert(s:sub(5, 6) == "ef")
+  local ss = s:sub(2, 9000):sub(2, 8000)
+  assert(#ss == 7999 and ss:sub(1, 2) == "cd")
+  assert(string.find(s, "jab", 1, true) == 10)
+  local cap = s:match("(" .. ("."):rep(300) .. ")")
+  assert(#cap == 300 and cap == s:sub(1, 300))
+  local k = 0
+  for w in string.rep("x", 1000):gmatch(("x"):rep(300)) do k = k + #w end
+  assert(k == 900)
+end
+
+
+do  print("testing string-table growth")
+  -- strings keep their identity while the table moves them to a
+  -- larger array, and while the collector removes some of them
+  local t = {}
+  for i = 1, 20000 do
+    t["key" .. i] = i
+    if i % 3 == 0 then t["key" .. (i // 3)] = nil end
+    if i % 5000 == 0 then collectgarbage() end
+  end
+  for i = 1, 20000 do   -- keys up to 20000 // 3 were removed
+    assert(t["key" .. i] == (i > 20000 // 3 and i or nil))
+  end
+  local n = 0
+  for k, v in pairs(t) do assert(k == "key" .. v); n = n + 1 end
+  assert(n == 20000 - 20000 // 3)
+  if T then
+    local size, nuse = T.querystr()
+    assert(nuse <= size * 2)
+  end
+end
+
+if T then
+  -- while the table grows, all strings are still visible
+  collectgarbage("stop")
+  local size = T.querystr()
+  local t = {}
+  local i = 0
+  repeat
+    i = i + 1
+    t[i] = "grow" .. i
+  until T.querystr() ~= size
+  local nsize, nuse = T.querystr()
+  local n = 0
+  for b = 1, nsize do n = n + select('#', T.querystr(b)) end
+  assert(n == nuse)
+  collectgarbage("restart")
+end
+
+
 print('OK')
 
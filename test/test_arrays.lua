@@ -0,0 +1,99 @@
+-- test_arrays.lua
+-- A suite to verify the typed arrays of the 'array' library
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+local function fails(f, msg)
+    local ok, err = pcall(f)
+    return not ok and string.find(err, msg, 1, true) ~= nil
+end
+
+print("=== Starting Typed Array Tests ===\n")
+
+-- 1. Creation
+print("-- 1. Creation")
+local a = array.new("float64", 4)
+assert_eq(type(a), "userdata", "arrays are userdata")
+assert_eq(#a, 4, "length of a new array")
+assert_eq(a[1], 0.0, "new arrays are zeroed")
+assert_eq(math.type(a[4]), "float", "float64 elements are floats")
+assert_eq(a:kind(), "float64", "kind of an array")
+local b = array.new("int32", {10, 20, 30})
+assert_eq(#b, 3, "array from a list")
+assert_eq(b[2], 20, "elements copied from the list")
+assert_eq(math.type(b[3]), "integer", "int32 elements are integers")
+assert_eq(tostring(b):find("^int32 array %(3%)") ~= nil, true, "tostring")
+assert_eq(#array.new("int64", 0), 0, "empty array")
+assert_eq(fails(function () array.new("int8", 1) end, "invalid option"),
+          true, "unknown kind")
+assert_eq(fails(function () array.new("int64", -1) end, "invalid size"),
+          true, "negative size")
+
+-- 2. Indexing
+print("-- 2. Indexing")
+for i = 1, #a do a[i] = i * 1.5 end
+assert_eq(a[3], 4.5, "set and get inside the array")
+local k = 2
+a[k] = 7
+assert_eq(a[k], 7.0, "integers are stored as floats")
+assert_eq(a[0], nil, "index 0 is outside")
+assert_eq(a[5], nil, "index past the end is outside")
+assert_eq(a[2.0], 7.0, "float keys with integer values")
+assert_eq(a.x, nil, "absent fields")
+assert_eq(fails(function () a[5] = 1 end, "index out of range"), true,
+          "cannot grow an array")
+assert_eq(fails(function () a[1] = "1" end, "number expected"), true,
+          "strings are not converted")
+b[1] = 3.0
+assert_eq(math.type(b[1]), "integer", "integral floats go into int arrays")
+assert_eq(fails(function () b[1] = 0.5 end, "integer representation"), true,
+          "int arrays reject fractions")
+b[1] = 2^31 - 1
+assert_eq(b[1], 2147483647, "largest int32")
+b[1] = -2^31
+assert_eq(b[1], -2147483648, "smallest int32")
+assert_eq(fails(function () b[1] = 2^31 end, "out of range"), true,
+          "int32 range")
+local c = array.new("int64", 2)
+c[1] = math.maxinteger
+assert_eq(c[1], math.maxinteger, "int64 keeps all bits")
+
+-- 3. Bulk Operations
+print("-- 3. Bulk Operations")
+local x = array.new("float64", 1001)
+for i = 1, #x do x[i] = i end
+assert_eq(x:sum(), 1001 * 1002 / 2, "sum of floats")
+assert_eq(x:dot(x), 1001 * 1002 * 2003 / 6, "dot of floats")
+local y = array.new("int32", 1001):fill(2)
+assert_eq(y:sum(), 2002, "fill and sum of integers")
+assert_eq(x:dot(y), 1001 * 1002.0, "dot of mixed kinds is a float")
+assert_eq(y:dot(y), 4004, "dot of integers is an integer")
+assert_eq(y:scale(3), y, "scale returns the array")
+assert_eq(y[1001], 6, "scale in place")
+local z = x:map(function (v) return v * 2 end)
+assert_eq(z:kind(), "float64", "map keeps the kind")
+assert_eq(z[10], 20.0, "map applies the function")
+assert_eq(x[10], 10.0, "map does not change its source")
+local t = b:totable()
+assert_eq(#t, 3, "totable length")
+assert_eq(t[3], 30, "totable elements")
+assert_eq(fails(function () x:dot(b) end, "different sizes"), true,
+          "dot needs equal sizes")
+assert_eq(fails(function () array.new("int64", 1):scale(0.5) end,
+                "integer representation"), true, "int scale needs an integer")
+
+-- 4. Metatable
+print("-- 4. Metatable")
+assert_eq(debug.getregistry()[3], getmetatable(a),
+          "metatable is registry[LUA_RIDX_TYPEDARRAY]")
+
+print("\n=== All Typed Array Tests Passed ===")
@@ -0,0 +1,62 @@
+-- test_coalesce.lua
+-- A suite to verify the '??' (null-coalescing) operator
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+print("=== Starting Null-Coalescing Tests ===\n")
+
+local calls = 0
+local function default() calls = calls + 1; return "default" end
+local t = {x = 1, f = false}
+
+-- 1. Value Selection
+print("-- 1. Value Selection")
+assert_eq(t.x ?? 2, 1, "Non-nil left side is kept")
+assert_eq(t.y ?? 2, 2, "Nil left side takes the right side")
+assert_eq(t.f ?? 2, false, "false is not nil")
+assert_eq(nil ?? nil, nil, "Both sides nil")
+
+-- 2. Short-Circuit
+print("-- 2. Short-Circuit")
+calls = 0
+assert_eq(t.x ?? default(), 1, "Right side skipped")
+assert_eq(calls, 0, "Right side not evaluated when left is non-nil")
+assert_eq(t.y ?? default(), "default", "Right side evaluated")
+assert_eq(calls, 1, "Right side evaluated once when left is nil")
+local cfg = t.x ?? error("must not run")
+assert_eq(cfg, 1, "Error in skipped right side is not raised")
+
+-- 3. Chains
+print("-- 3. Chains")
+assert_eq(t.y ?? t.z ?? t.x, 1, "First non-nil value in a chain")
+assert_eq(nil ?? nil ?? 3, 3, "Constant chain")
+calls = 0
+assert_eq(t.x ?? default() ?? default(), 1, "Chain stops at first non-nil")
+assert_eq(calls, 0, "No later operand evaluated")
+
+-- 4. Locals and Mixed Expressions
+print("-- 4. Locals and Mixed Expressions")
+local a = nil
+local b = a ?? {n = 2}
+assert_eq(b.n, 2, "Table constructor as default")
+assert_eq(a, nil, "Left-side local is not modified")
+assert_eq((t.y ?? 1) + 1, 2, "Coalesced value in arithmetic")
+assert_eq((nil ?? false) or "o", "o", "Coalesced value in 'or'")
+assert_eq(t.y ?? (default() .. "!"), "default!", "Concatenation as default")
+local function first(...) return ... ?? "none" end
+assert_eq(first(), "none", "Vararg default")
+assert_eq(first(5), 5, "Vararg value")
+local hit = false
+if t.y ?? t.x then hit = true end
+assert_eq(hit, true, "Coalescing in a condition")
+
+print("\n=== All Tests Passed! ===")
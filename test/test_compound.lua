@@ -0,0 +1,125 @@
+-- test_compound.lua
+-- A suite to verify compound assignment operators ('op=')
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+print("=== Starting Compound Assignment Tests ===\n")
+
+-- 1. Operators
+print("-- 1. Operators")
+local x = 10
+x += 5;  assert_eq(x, 15, "+=")
+x -= 3;  assert_eq(x, 12, "-=")
+x *= 2;  assert_eq(x, 24, "*=")
+x /= 8;  assert_eq(x, 3.0, "/=")
+x = 17
+x //= 5; assert_eq(x, 3, "//=")
+x = 17
+x %= 5;  assert_eq(x, 2, "%=")
+x ^= 3;  assert_eq(x, 8.0, "^=")
+x = 0xf0
+x &= 0x3c; assert_eq(x, 0x30, "&=")
+x |= 1;    assert_eq(x, 0x31, "|=")
+x <<= 2;   assert_eq(x, 0xc4, "<<=")
+x >>= 4;   assert_eq(x, 0xc, ">>=")
+local s = "a"
+s ..= "b"; assert_eq(s, "ab", "..=")
+local v
+v ??= "set";  assert_eq(v, "set", "??= on nil")
+v ??= "again"; assert_eq(v, "set", "??= keeps a value")
+
+-- 2. Right Side
+print("-- 2. Right Side")
+x = 2
+x *= 3 + 4
+assert_eq(x, 14, "Right side is a whole expression")
+s = "x"
+s ..= "y" .. "z"
+assert_eq(s, "xyz", "Concatenation chain")
+local called = false
+local w = 1
+w ??= (function () called = true; return 2 end)()
+assert_eq(called, false, "??= does not evaluate an unneeded right side")
+
+-- 3. Variables
+print("-- 3. Variables")
+g_counter = 1
+g_counter += 1
+assert_eq(g_counter, 2, "Global")
+g_counter = nil
+local u = 0
+local function bump() u += 1 end
+bump(); bump()
+assert_eq(u, 2, "Upvalue")
+local t = {n = 1, [1] = 10, a = {b = {c = 5}}}
+t.n += 1
+t[1] -= 4
+t.a.b.c *= 2
+assert_eq(t.n, 2, "Field")
+assert_eq(t[1], 6, "Integer index")
+assert_eq(t.a.b.c, 10, "Nested field")
+local counts = {}
+for _, word in ipairs{"a", "b", "a", "c", "a"} do
+    counts[word] ??= 0
+    counts[word] += 1
+end
+assert_eq(counts.a, 3, "Counting with a variable key")
+assert_eq(counts.c, 1, "Counting with a variable key (2)")
+local obj = {count = 0}
+function obj:add(n) self.count += n end
+obj:add(3); obj:add(4)
+assert_eq(obj.count, 7, "Field of 'self'")
+
+-- 4. Single Evaluation
+print("-- 4. Single Evaluation")
+local nt, nk = 0, 0
+local tab = {k = 1}
+local function gett() nt += 1; return tab end
+local function getk() nk += 1; return "k" end
+gett()[getk()] += 1
+assert_eq(tab.k, 2, "Indexed through calls")
+assert_eq(nt, 1, "Table evaluated once")
+assert_eq(nk, 1, "Key evaluated once")
+local log = {}
+local proxy = setmetatable({}, {
+    __index = function (_, k) log[#log + 1] = "get " .. k; return 1 end,
+    __newindex = function (_, k, val) log[#log + 1] = "set " .. k .. "=" .. val end,
+})
+proxy.f += 1
+assert_eq(table.concat(log, ","), "get f,set f=2", "One read and one write")
+
+-- 5. Compatibility
+print("-- 5. Compatibility")
+local switch, case = 1, 2
+switch += 1
+case -= 5
+assert_eq(switch, 2, "'switch' as a variable")
+assert_eq(case, -3, "'case' as a variable")
+local r = 10 - 3 ~= 7
+assert_eq(r, false, "'~=' is still inequality")
+
+-- 6. Errors
+print("-- 6. Errors")
+local function perr(src)
+    local _, msg = load(src)
+    return msg or ""
+end
+assert_eq(perr("local a <const> = 1; a += 1"):find("const variable") ~= nil, true,
+          "Constant cannot be assigned")
+assert_eq(perr("f() += 1"):find("syntax error") ~= nil, true, "Call is not a variable")
+assert_eq(perr("a, b += 1"):find("'=' expected") ~= nil, true,
+          "Only one variable")
+local ok, msg = pcall(function () local q = {}; q.missing += 1 end)
+assert_eq(ok, false, "Arithmetic on nil fails")
+assert_eq(msg:find("field 'missing'") ~= nil, true, "Error names the field")
+
+print("\n=== All Compound Assignment Tests Passed ===")
@@ -0,0 +1,194 @@
+-- test_defer.lua
+-- A suite to verify deferred calls ('defer')
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+local log = {}
+local function push(...) log[#log + 1] = table.concat({...}, " ") end
+local function getlog()
+    local s = table.concat(log, ",")
+    log = {}
+    return s
+end
+
+print("=== Starting Defer Tests ===\n")
+
+-- 1. Order and Evaluation
+print("-- 1. Order and Evaluation")
+do
+    local x = 1
+    defer push("first", x)
+    x = 2
+    defer push("second", x)
+    defer do push("block", x) end
+    push("body")
+end
+assert_eq(getlog(), "body,block 2,second 2,first 1",
+          "Calls run in reverse order; arguments are evaluated at once")
+
+local obj = {n = 0}
+function obj:add(k) self.n = self.n + k end
+do
+    defer obj:add(5)
+    assert_eq(obj.n, 0, "Method call not made yet")
+end
+assert_eq(obj.n, 5, "Deferred method call")
+
+-- 2. Exits
+print("-- 2. Exits")
+local function f(n)
+    defer push("exit", n)
+    if n > 0 then return n * 2, "r" end
+    push("after")
+    return -1
+end
+local a, b = f(3)
+assert_eq(a, 6, "Return values kept")
+assert_eq(b, "r", "Return values kept (2)")
+assert_eq(getlog(), "exit 3", "Runs on return")
+f(0)
+assert_eq(getlog(), "after,exit 0", "Runs at the end of the function")
+
+for i = 1, 3 do
+    defer push("iter", i)
+    if i == 2 then break end
+end
+assert_eq(getlog(), "iter 1,iter 2", "Runs on each iteration and on break")
+
+do
+    for i = 1, 2 do
+        defer push("goto", i)
+        goto continue
+        push("never")
+        ::continue::
+    end
+end
+assert_eq(getlog(), "goto 1,goto 2", "Runs on goto")
+
+local function tail(n)
+    defer push("tail")
+    return tostring(n)
+end
+assert_eq(tail(5), "5", "No tail call out of a deferred scope")
+assert_eq(getlog(), "tail", "Runs after the returned call")
+
+-- 3. Errors
+print("-- 3. Errors")
+local ok, msg = pcall(function ()
+    defer push("unwind")
+    error("boom", 0)
+end)
+assert_eq(ok, false, "Error propagates")
+assert_eq(msg, "boom", "Error message kept")
+assert_eq(getlog(), "unwind", "Runs on error unwinding")
+
+ok, msg = pcall(function ()
+    defer error("in defer", 0)
+    push("body")
+end)
+assert_eq(msg, "in defer", "Error in a deferred call")
+assert_eq(getlog(), "body", "Body ran before the deferred call")
+ok, msg = pcall(function ()
+    defer nothing()
+end)
+assert_eq(msg:find("global 'nothing'") ~= nil, true,
+          "Calling a nil value fails at the 'defer'")
+
+local function perr(src)
+    local _, err = load(src)
+    return err or ""
+end
+assert_eq(perr("defer x"):find("function call expected") ~= nil, true,
+          "Only calls can be deferred")
+
+local function many() return "a", "b", "c" end
+local function count(...) push(select("#", ...), ...) end
+do
+    defer count(many())
+    defer count(1, many())
+    defer count(many(), 2)
+end
+assert_eq(getlog(), "2 a 2,2 1 a,1 a", "Open last argument gives one value")
+local function va(...)
+    defer count(...)
+    defer count(0, ...)
+end
+va("x", "y")
+assert_eq(getlog(), "2 0 x,1 x", "Vararg last argument gives one value")
+va()
+assert_eq(getlog(), "2 0,1", "Empty vararg gives one nil")
+
+local src = {}
+for i = 1, 190 do src[#src + 1] = "local v" .. i end
+src[#src + 1] = "defer f(1, 2, 3, 4, 5, 6, 7, 8, 9, 10)"
+assert_eq(perr(table.concat(src, "\n")):find("deferred arguments") ~= nil,
+          true, "Hidden variables count as locals")
+src[#src] = "defer f(1, 2, 3, 4, 5, 6, 7, 8)"
+assert_eq(perr(table.concat(src, "\n")), "", "Up to the limit")
+
+-- 4. Coroutines
+print("-- 4. Coroutines")
+local co = coroutine.wrap(function ()
+    defer push("co")
+    coroutine.yield(1)
+    return 2
+end)
+assert_eq(co(), 1, "Yield inside a deferred scope")
+assert_eq(getlog(), "", "Not run on yield")
+assert_eq(co(), 2, "Resume")
+assert_eq(getlog(), "co", "Runs when the coroutine ends")
+
+co = coroutine.create(function ()
+    defer push("closed")
+    coroutine.yield()
+end)
+coroutine.resume(co)
+coroutine.close(co)
+assert_eq(getlog(), "closed", "Runs on coroutine.close")
+
+co = coroutine.wrap(function ()
+    defer do
+        coroutine.yield("in defer")
+        push("resumed")
+    end
+    return "done"
+end)
+assert_eq(co(), "in defer", "Yield inside a deferred call")
+assert_eq(co(), "done", "Return after the deferred call")
+assert_eq(getlog(), "resumed", "Deferred call finished")
+
+-- 5. Compatibility
+print("-- 5. Compatibility")
+local defer = 3
+defer = defer + 1
+assert_eq(defer, 4, "'defer' as a variable")
+local t = {defer = print}
+assert_eq(t.defer, print, "'defer' as a field")
+
+-- 6. Allocation
+print("-- 6. Allocation")
+local count = 0
+local function inc(k) count = count + k end
+local function hot(n)
+    defer inc(n)
+    return n
+end
+collectgarbage("stop")
+hot(1)
+local before = collectgarbage("count")
+for i = 1, 1000 do hot(i) end
+local after = collectgarbage("count")
+collectgarbage("restart")
+assert_eq(after - before, 0, "Deferred calls do not allocate")
+assert_eq(count, 1 + 500500, "All deferred calls made")
+
+print("\n=== All Defer Tests Passed ===")
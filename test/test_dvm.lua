@@ -0,0 +1,108 @@
+-- test_dvm.lua
+-- A suite to verify the serialization of values by the 'dvm' library
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+local function fails(f, msg)
+    local ok, err = pcall(f)
+    return not ok and string.find(err, msg, 1, true) ~= nil
+end
+
+local function roundtrip(v)
+    local s = dvm.pack(v)
+    local u, pos = dvm.unpack(s)
+    assert(pos == #s + 1)
+    return u
+end
+
+print("=== Starting Serialization Tests ===\n")
+
+-- 1. Scalars
+print("-- 1. Scalars")
+assert_eq(roundtrip(nil), nil, "nil")
+assert_eq(roundtrip(true), true, "true")
+assert_eq(roundtrip(false), false, "false")
+assert_eq(roundtrip(0), 0, "zero")
+assert_eq(roundtrip(-1), -1, "negative integer")
+assert_eq(roundtrip(math.maxinteger), math.maxinteger, "maxinteger")
+assert_eq(roundtrip(math.mininteger), math.mininteger, "mininteger")
+assert_eq(math.type(roundtrip(3.0)), "float", "floats stay floats")
+assert_eq(roundtrip(-0.5), -0.5, "float")
+assert_eq(roundtrip(math.huge), math.huge, "inf")
+assert_eq(roundtrip(0/0) ~= roundtrip(0/0), true, "nan")
+assert_eq(roundtrip(""), "", "empty string")
+assert_eq(roundtrip("a\0b"), "a\0b", "string with zeros")
+local long = string.rep("xyz", 1000)
+assert_eq(roundtrip(long), long, "long string")
+assert_eq(#dvm.pack(5), 2, "small integers are compact")
+
+-- 2. Tables
+print("-- 2. Tables")
+local t = roundtrip({10, 20, 30, x = "a", [2.5] = true, [-1] = 0})
+assert_eq(#t, 3, "sequence")
+assert_eq(t[3], 30, "sequence values")
+assert_eq(t.x, "a", "string keys")
+assert_eq(t[2.5], true, "float keys")
+assert_eq(t[-1], 0, "other integer keys")
+assert_eq(next(roundtrip({})), nil, "empty table")
+local nested = roundtrip({a = {b = {c = {1, 2}}}})
+assert_eq(nested.a.b.c[2], 2, "nested tables")
+local shared = {}
+local u = roundtrip({shared, shared, k = shared})
+assert_eq(u[1] == u[2] and u[1] == u.k, true, "shared tables stay shared")
+local cyc = {name = "cycle"}
+cyc.self = cyc
+cyc.list = {cyc}
+u = roundtrip(cyc)
+assert_eq(u.self, u, "cycles")
+assert_eq(u.list[1], u, "cycles through other tables")
+assert_eq(getmetatable(roundtrip(setmetatable({}, {}))), nil,
+          "metatables are not packed")
+
+-- 3. Positions and sharing
+print("-- 3. Positions and sharing")
+local s = dvm.pack(1) .. dvm.pack("two") .. dvm.pack({3})
+local v, pos = dvm.unpack(s)
+assert_eq(v, 1, "first value")
+v, pos = dvm.unpack(s, pos)
+assert_eq(v, "two", "second value")
+v, pos = dvm.unpack(s, pos)
+assert_eq(v[1], 3, "third value")
+assert_eq(pos, #s + 1, "end position")
+assert_eq(dvm.unpack(dvm.pack({long}), 1, true)[1], long,
+          "strings shared with the packed data")
+
+-- 4. Errors
+print("-- 4. Errors")
+assert_eq(fails(function () dvm.pack(print) end, "cannot pack a function"),
+          true, "functions cannot be packed")
+assert_eq(fails(function () dvm.pack({io.stdout}) end, "cannot pack a"),
+          true, "userdata cannot be packed")
+local deep = {}
+local c = deep
+for _ = 1, 300 do c[1] = {}; c = c[1] end
+assert_eq(fails(function () dvm.pack(deep) end, "nested too deep"), true,
+          "nesting limit")
+local packed = dvm.pack({1, 2, "three", {4}})
+for i = 1, #packed - 1 do
+    assert(not pcall(dvm.unpack, packed:sub(1, i)))
+end
+assert_eq(fails(function () dvm.unpack(packed:sub(1, -2)) end, "truncated"),
+          true, "truncated data")
+assert_eq(fails(function () dvm.unpack("\200") end, "invalid data"), true,
+          "unknown tag")
+assert_eq(fails(function () dvm.unpack("\7\1") end, "invalid data"), true,
+          "reference to a table not unpacked")
+assert_eq(fails(function () dvm.unpack("", 2) end, "out of string"), true,
+          "position out of string")
+
+print("\n=== All Serialization Tests Passed ===")
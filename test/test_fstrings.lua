@@ -72,4 +72,26 @@ local n2 = 200
 local s11 = $"A{n1}B{n2}C"
 assert_eq(s11, "A100B200C", "Complex concatenation chain (A-x-B-y-C)")
 
+print("-- 9. Many Holes In One Interpolation")
+local parts = {}
+for i = 1, 120 do parts[#parts + 1] = "{i}," end
+local many = assert(load("local i = 3; return $\"" .. table.concat(parts) .. "\""))
+assert_eq(many(), string.rep("3,", 120), "Interpolation longer than one flush")
+
+print("-- 10. Nested F-Strings")
+local inner = "in"
+assert_eq($"<{ $'[{inner}]' }>", "<[in]>", "F-string inside a hole")
+
+print("-- 11. Adjacent Holes")
+assert_eq($"{x}{y}{name}", "1020World", "Holes with empty literals between them")
+
+print("-- 12. Number Formatting And Fallbacks")
+assert_eq($"{1}|{2.0}|{-0.5}|{math.mininteger}", "1|2.0|-0.5|" .. math.mininteger,
+          "Integers and floats format like tostring")
+local long = string.rep("x", 60)
+assert_eq($"{long}{long}{42}", long .. long .. "42", "Long string result")
+local cc = setmetatable({}, {__concat = function(a, b) return "mt" end})
+assert_eq($"<{cc}>", "<mt", "__concat metamethod still applies")
+assert_eq(pcall(function() return $"{nil}" end), false, "Nil hole raises an error")
+
 print("\n=== All Tests Passed! ===")
\ No newline at end of file
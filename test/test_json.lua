@@ -0,0 +1,96 @@
+-- test_json.lua
+-- A suite to verify the 'json' library
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+local function fails(f, msg)
+    local ok, err = pcall(f)
+    return not ok and string.find(err, msg, 1, true) ~= nil
+end
+
+print("=== Starting JSON Tests ===\n")
+
+-- 1. Encoding
+print("-- 1. Encoding")
+assert_eq(json.encode(nil), "null", "nil")
+assert_eq(json.encode(json.null), "null", "json.null")
+assert_eq(json.encode(true), "true", "true")
+assert_eq(json.encode(42), "42", "integer")
+assert_eq(json.encode(math.mininteger), tostring(math.mininteger), "mininteger")
+assert_eq(json.encode(0.1), "0.1", "short float")
+assert_eq(json.encode(2.0), "2.0", "integral float")
+assert_eq(tonumber(json.encode(1/3)), 1/3, "floats read back exactly")
+assert_eq(json.encode("a\"b\\c\n\t\1\127"), '"a\\"b\\\\c\\n\\t\\u0001\127"',
+          "escapes")
+assert_eq(json.encode("caf\195\169"), '"caf\195\169"', "UTF-8 is kept")
+local long = string.rep("plain text ", 100)
+assert_eq(json.encode(long), '"' .. long .. '"', "long plain string")
+assert_eq(json.encode({1, "two", false}), '[1,"two",false]', "array")
+assert_eq(json.encode({}), "{}", "empty table")
+assert_eq(json.encode({a = {1}}), '{"a":[1]}', "object")
+assert_eq(json.encode({[2.5] = 1}), '{"2.5":1}', "number keys")
+assert_eq(json.encode({1, 2, x = 3}):sub(1, 1), "{", "mixed tables are objects")
+assert_eq(json.encode({1, json.null, 3}), "[1,null,3]", "null in arrays")
+assert_eq(fails(function () json.encode(0/0) end, "NaN"), true, "nan")
+assert_eq(fails(function () json.encode(math.huge) end, "infinity"), true,
+          "inf")
+assert_eq(fails(function () json.encode({print}) end, "cannot encode"), true,
+          "functions")
+assert_eq(fails(function () json.encode({[true] = 1}) end, "key of type"),
+          true, "boolean keys")
+local cyc = {}
+cyc[1] = cyc
+assert_eq(fails(function () json.encode(cyc) end, "nested too deep"), true,
+          "cycles")
+
+-- 2. Decoding
+print("-- 2. Decoding")
+local v = json.decode(' { "a" : [1, -2.5e1, "x", true, false, null, {}, []] } ')
+assert_eq(v.a[1], 1, "integer")
+assert_eq(math.type(v.a[1]), "integer", "integers decode as integers")
+assert_eq(v.a[2], -25.0, "exponent")
+assert_eq(v.a[3], "x", "string")
+assert_eq(v.a[4], true, "true")
+assert_eq(v.a[5], false, "false")
+assert_eq(v.a[6], json.null, "null")
+assert_eq(next(v.a[7]), nil, "empty object")
+assert_eq(#v.a, 8, "array length")
+assert_eq(json.decode('"\\u00e9\\ud83d\\ude00\\/\\n"'), "\195\169\240\159\152\128/\n",
+          "unicode escapes")
+assert_eq(json.decode("12345678901234567890"), 1.2345678901234567e19,
+          "large integers become floats")
+assert_eq(json.decode("-0"), 0, "minus zero")
+local a = {}
+for i = 1, 1000 do a[i] = {id = i, name = "n" .. i, w = i / 7} end
+local back = json.decode(json.encode(a))
+assert_eq(#back, 1000, "large array")
+assert_eq(back[777].name, "n777", "large array contents")
+assert_eq(back[999].w, 999 / 7, "floats round trip")
+local o = {}
+for i = 1, 200 do o["k" .. i] = i end
+back = json.decode(json.encode(o))
+assert_eq(back.k200, 200, "large object")
+
+-- 3. Invalid text
+print("-- 3. Invalid text")
+local bad = {"", "[1,]", '{"a"}', "[1 2]", '"abc', "01", "1.", "-", "+1",
+             '"\\x"', "tru", "{1:2}", "[1]x", '"\1"', '"\\ud800"', "NaN"}
+for _, s in ipairs(bad) do
+    assert(not pcall(json.decode, s), s)
+end
+print("[PASS] invalid texts raise errors")
+assert_eq(fails(function () json.decode("[1,,2]") end, "position 4"), true,
+          "error positions")
+assert_eq(fails(function () json.decode(string.rep("[", 1000)) end,
+                "nested too deep"), true, "nesting limit")
+
+print("\n=== All JSON Tests Passed ===")
@@ -0,0 +1,176 @@
+-- test_optimize.lua
+-- A suite to verify the optimizer pass (run with 'lua -O')
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+-- lines of function 'f' that have code
+local function activelines(f)
+    local lines = {}
+    for l in pairs(debug.getinfo(f, "L").activelines) do
+        lines[#lines + 1] = l
+    end
+    table.sort(lines)
+    return table.concat(lines, ",")
+end
+
+print("=== Starting Optimizer Tests ===\n")
+
+-- 1. Dead Code
+print("-- 1. Dead Code")
+local f = load([[
+    local DEBUG = false
+    if DEBUG then
+        print("never")
+    end
+    return 1
+]])
+assert_eq(activelines(f), "1,5", "Code under a false constant is removed")
+assert_eq(f(), 1, "Function still runs")
+
+f = load([[
+    local x = ...
+    do return x end
+    x = x + 1
+    return x
+]])
+assert_eq(activelines(f), "1,2", "Code after a return is removed")
+assert_eq(f(7), 7, "Return value kept")
+
+f = load([[
+    local n = 0
+    for i = 1, 3 do
+        n = n + i
+        goto done
+        n = n * 10
+        ::done::
+    end
+    return n
+]])
+assert_eq(f(), 6, "Code skipped by a goto is removed")
+
+-- 2. Constant Propagation
+print("-- 2. Constant Propagation")
+f = load([[
+    local N = 10
+    local M = N * 2 + 1
+    local s = "x"
+    return M, -N, not N, N // 3, N / 4, 1 << N, N ~ 3, s
+]])
+local a, b, c, d, e, g, h, i = f()
+assert_eq(a, 21, "Arithmetic on a constant local")
+assert_eq(b, -10, "Unary minus")
+assert_eq(c, false, "Not")
+assert_eq(d, 3, "Floor division")
+assert_eq(e, 2.5, "Float division")
+assert_eq(g, 1024, "Shift")
+assert_eq(h, 9, "Xor")
+assert_eq(i, "x", "String constant")
+
+f = load([[
+    local z = 0
+    return 1 // z
+]])
+assert_eq(pcall(f), false, "Division by zero is not folded")
+
+f = load([[
+    local x, y = 1, 2
+    local t = {}
+    for i = 1, 3 do t[i] = x + y + i end
+    x = 5          -- 'x' is not a constant
+    return t[1], t[3], x + y
+]])
+a, b, c = f()
+assert_eq(a, 4, "Constant used in a loop")
+assert_eq(b, 6, "Constant used in a loop (last)")
+assert_eq(c, 7, "Assigned local is not propagated")
+
+f = load([[
+    local k = 1
+    local function inc() k = k + 1 end
+    inc()
+    return k
+]])
+assert_eq(f(), 2, "Local changed by a closure is not propagated")
+
+f = load([[
+    local v = 1
+    v = v + 1
+    v = v * 3
+    return v
+]])
+assert_eq(f(), 6, "Straight-line values are folded")
+
+-- 3. Tests over Constants
+print("-- 3. Tests over Constants")
+f = load([[
+    local x = nil
+    local y = 5
+    local t = {}
+    t[1] = x ?? "default"
+    t[2] = y ?? "default"
+    t[3] = (y == 5) and "eq" or "ne"
+    t[4] = (y < 3) and "lt" or "ge"
+    t[5] = (y ~= "5")
+    t[6] = not not x
+    return t
+]])
+local t = f()
+assert_eq(t[1], "default", "Nil constant in '??'")
+assert_eq(t[2], 5, "Non-nil constant in '??'")
+assert_eq(t[3], "eq", "Equality with a constant")
+assert_eq(t[4], "ge", "Order with a constant")
+assert_eq(t[5], true, "Number is not a string")
+assert_eq(t[6], false, "Double negation of nil")
+
+f = load([[
+    local x = ...
+    local y = 1
+    local b = (x == 1) or (y == 1)
+    return b
+]])
+assert_eq(f(0), true, "Mixed known and unknown conditions")
+assert_eq(f(1), true, "Mixed known and unknown conditions (2)")
+
+-- 4. Errors and Debug Information
+print("-- 4. Errors and Debug Information")
+local ok, msg = pcall(load("local a; a(13)"))
+assert_eq(ok, false, "Calling a nil constant fails")
+assert_eq(msg:find("local 'a'") ~= nil, true, "Error still names the local")
+f = load([[
+    local x = 1
+    local y = x + 1
+    return debug.getinfo(1, "l").currentline, y
+]])
+a, b = f()
+assert_eq(a, 3, "Line information kept")
+assert_eq(b, 2, "Folded value")
+
+-- 5. Loops
+print("-- 5. Loops")
+f = load([[
+    local n = 0
+    local STEP = 2
+    for i = 1, 10, STEP do n = n + i end
+    for _, v in ipairs({1, 2, 3}) do n = n + v end
+    local i = 0
+    while true do
+        i = i + 1
+        if i > 3 then break end
+    end
+    repeat local done = true until done
+    return n, i
+]])
+a, b = f()
+assert_eq(a, 31, "Numeric and generic loops")
+assert_eq(b, 4, "Loop with break")
+
+print("\n=== All Optimizer Tests Passed ===")
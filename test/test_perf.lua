@@ -0,0 +1,127 @@
+-- test_perf.lua
+-- A suite to verify the 'perf' library
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+local function fails(f, msg)
+    local ok, err = pcall(f)
+    return not ok and string.find(err, msg, 1, true) ~= nil
+end
+
+-- the events of the current trace, decoded
+local function events()
+    local text, dropped = perf.trace()
+    return json.decode(text).traceEvents, dropped
+end
+
+print("=== Starting Perf Tests ===\n")
+
+-- 1. Clock
+print("-- 1. Clock")
+local t0 = perf.now()
+assert_eq(math.type(t0), "integer", "now is an integer")
+local mono = true
+for _ = 1, 1000 do
+    local t1 = perf.now()
+    if t1 < t0 then mono = false end
+    t0 = t1
+end
+assert_eq(mono, true, "now never goes back")
+do
+    local a, c = perf.now(), os.clock()
+    repeat until os.clock() - c >= 0.01
+    assert_eq(perf.now() - a >= 5000000, true, "now counts nanoseconds")
+end
+
+-- 2. Spans
+print("\n-- 2. Spans")
+perf.clear()
+assert_eq(#events(), 0, "clear empties the trace")
+do
+    local function f(n)
+        local s <close> = perf.span("f" .. n)
+        if n > 0 then f(n - 1) end
+    end
+    f(1)
+end
+do
+    local ev = events()
+    assert_eq(#ev, 4, "two events per span")
+    assert_eq(ev[1].ph .. ev[2].ph .. ev[3].ph .. ev[4].ph, "BBEE", "nesting")
+    assert_eq(ev[1].name, "f1", "outer name")
+    assert_eq(ev[2].name, "f0", "inner name")
+    assert_eq(ev[3].name, nil, "end has no name")
+    assert_eq(ev[1].tid, 1, "main thread")
+    assert_eq(ev[1].ts <= ev[2].ts and ev[3].ts <= ev[4].ts, true, "ordered")
+end
+
+perf.clear()
+pcall(function ()
+    local s <close> = perf.span("err")
+    error("oops")
+end)
+assert_eq(#events(), 2, "span closed by an error")
+
+perf.clear()
+do
+    local co = coroutine.wrap(function ()
+        local s <close> = perf.span("in\t\"co\"")
+        coroutine.yield()
+    end)
+    co(); co()
+    local s <close> = perf.span("main")
+end
+do
+    local ev = events()
+    assert_eq(ev[1].tid, 2, "coroutine has its own thread")
+    assert_eq(ev[2].tid, 2, "end in the coroutine")
+    assert_eq(ev[1].name, "in\t\"co\"", "names are escaped")
+    assert_eq(ev[3].tid, 1, "back in the main thread")
+    assert_eq(ev[#ev].ph, "E", "closed before trace")
+end
+
+assert_eq(fails(function () perf.span() end, "string expected"),
+          true, "span needs a name")
+assert_eq(fails(function () getmetatable(perf.span("x")).__close({}) end,
+          "perf.trace expected"), true, "__close checks its argument")
+
+-- 3. Ring buffer
+print("\n-- 3. Ring buffer")
+perf.clear(4)
+for i = 1, 3 do
+    local s <close> = perf.span("s" .. i)
+end
+do
+    local ev, dropped = events()
+    assert_eq(#ev, 4, "ring keeps its size")
+    assert_eq(dropped, 2, "dropped events")
+    assert_eq(ev[1].name, "s2", "oldest events go first")
+end
+perf.clear()
+assert_eq(select(2, perf.trace()), 0, "clear resets dropped")
+assert_eq(fails(function () perf.clear(0) end, "invalid size"),
+          true, "invalid size")
+
+perf.clear(100)
+do
+    collectgarbage()
+    collectgarbage("stop")
+    local m = collectgarbage("count")
+    for _ = 1, 1000 do
+        local s <close> = perf.span("loop")
+    end
+    assert_eq(collectgarbage("count"), m, "spans do not allocate")
+    collectgarbage("restart")
+end
+perf.clear(4096)
+
+print("\n=== All Perf Tests Passed ===")
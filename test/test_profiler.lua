@@ -0,0 +1,205 @@
+-- test_profiler.lua
+-- A suite to verify the sampling profiler library and option '-P'
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+-- runs for at least 'secs' seconds of CPU time
+local function busy(secs)
+    local t0, s = os.clock(), 0
+    repeat
+        for i = 1, 10000 do s = s + i % 7 end
+    until os.clock() - t0 >= secs
+    return s
+end
+
+-- parses collapsed-stack output; returns total count and the lines
+local function parse(out)
+    local total, lines, ok = 0, {}, true
+    for line in out:gmatch("[^\n]+") do
+        local stack, n = line:match("^(.+) (%d+)$")
+        if not stack then ok = false end
+        total = total + (tonumber(n) or 0)
+        lines[#lines + 1] = line
+    end
+    return ok and total, lines
+end
+
+print("=== Starting Profiler Tests ===\n")
+
+-- 1. Start and Stop
+print("-- 1. Start and Stop")
+assert_eq(profiler.start(), true, "start returns true")
+assert_eq(pcall(profiler.start), false, "cannot start twice")
+busy(0.3)
+local out, n = profiler.stop()
+assert_eq(type(out), "string", "stop returns the samples as a string")
+assert_eq(n > 0, true, "samples were taken")
+local total, lines = parse(out)
+assert_eq(total, n, "counts of all stacks add up to the samples")
+local sorted = true
+for i = 2, #lines do sorted = sorted and lines[i - 1] < lines[i] end
+assert_eq(sorted, true, "stacks are sorted")
+assert_eq(out:find("busy (", 1, true) ~= nil, true, "busy function is sampled")
+assert_eq(out:find("main chunk (", 1, true) ~= nil, true, "main chunk is the root")
+assert_eq(pcall(profiler.stop), false, "cannot stop twice")
+
+-- 2. Arguments and Hooks
+print("-- 2. Arguments and Hooks")
+assert_eq(pcall(profiler.start, 0), false, "interval must be positive")
+debug.sethook(function () end, "l")
+assert_eq(pcall(profiler.start), false, "cannot start with a debug hook")
+debug.sethook()
+assert_eq(profiler.start(1), true, "restart after a stop")
+busy(0.05)
+local _, n2 = profiler.stop()
+assert_eq(n2 >= 0, true, "second profile is independent")
+assert_eq(debug.gethook(), nil, "stop leaves no hook behind")
+
+-- 3. Option -P
+print("-- 3. Option -P")
+local interp = arg and arg[-1]
+if interp then
+    local file = os.tmpname()
+    local code = "local s = 0; local t = os.clock(); " ..
+                 "repeat s = s + 1 until os.clock() - t > 0.2"
+    local cmd = string.format("%s -P %s -e %q", interp, file, code)
+    assert_eq(os.execute(cmd), true, "interpreter runs with -P")
+    local f = assert(io.open(file))
+    local samples = f:read("a")
+    f:close()
+    os.remove(file)
+    assert_eq(parse(samples) ~= false, true, "-P writes collapsed stacks")
+    assert_eq(samples:find("(command line)", 1, true) ~= nil, true,
+              "-P samples the command line chunk")
+else
+    print("skipping: no interpreter name in 'arg'")
+end
+
+-- 4. Heap Profiler
+print("-- 4. Heap Profiler")
+local function maketables(n)
+    local t = {}
+    for i = 1, n do t[i] = {i, i + 1} end
+    return t
+end
+assert_eq(pcall(profiler.heapstart, 0), false, "rate must be positive")
+assert_eq(profiler.heapstart(1024), true, "heapstart returns true")
+assert_eq(pcall(profiler.heapstart), false, "cannot start heap profile twice")
+assert_eq(pcall(profiler.start), false, "cannot run both profilers")
+local keep = maketables(20000)
+local hout, hn = profiler.heapstop()
+assert_eq(hn > 0, true, "heap samples were taken")
+local bytes = parse(hout)
+assert_eq(bytes >= 20000 * 32, true, "samples add up to the bytes allocated")
+assert_eq(hout:find("maketables (", 1, true) ~= nil, true,
+          "allocating function is sampled")
+assert_eq(pcall(profiler.heapstop), false, "cannot stop heap profile twice")
+assert_eq(debug.gethook(), nil, "heapstop leaves no hook behind")
+keep = nil
+
+-- 5. Accounting Contexts
+print("-- 5. Accounting Contexts")
+assert_eq(profiler.context(), 0, "default context is 0")
+assert_eq(pcall(profiler.setcontext, 256), false, "context out of range")
+local co = coroutine.create(function ()
+    local t = maketables(1000)
+    coroutine.yield(profiler.context())
+    return #t
+end)
+assert_eq(profiler.setcontext(5, co), 0, "setcontext returns old context")
+local b0, c0 = profiler.memstats(5)
+local _, ctx = coroutine.resume(co)
+assert_eq(ctx, 5, "coroutine runs in its context")
+local b1, c1 = profiler.memstats(5)
+assert_eq(b1 - b0 >= 1000 * 32 and c1 - c0 >= 1000, true,
+          "coroutine allocations charged to its context")
+local old = profiler.setcontext(9)
+local inner = coroutine.wrap(function () return profiler.context() end)
+assert_eq(inner(), 9, "new coroutines inherit the context")
+profiler.setcontext(old)
+
+-- 6. Coverage
+print("-- 6. Coverage")
+-- parses one lcov record; returns hit flags of functions and lines
+local function parsecov(out, file)
+    local rec = out:match("SF:" .. file:gsub("%p", "%%%0") ..
+                          "\n(.-)end_of_record")
+    if not rec then return nil end
+    local funcs, lines = {}, {}
+    for name, hit in rec:gmatch("FNDA:(%d+),([^\n]+)") do
+        funcs[hit] = (name == "1")
+    end
+    for line, hit in rec:gmatch("DA:(%d+),(%d+)") do
+        lines[tonumber(line)] = (hit == "1")
+    end
+    return funcs, lines
+end
+local modfile = os.tmpname()
+local mf = assert(io.open(modfile, "w"))
+mf:write([[
+local M = {}
+function M.sign(x)
+  if x > 0 then
+    return 1
+  end
+  return -1
+end
+function M.unused()
+  return 0
+end
+M.count = function (...) return select("#", ...) end
+return M
+]])
+mf:close()
+profiler.coveragestart()
+local m = dofile(modfile)
+m.sign(1)
+local cosign = coroutine.wrap(function () return m.sign(2) end)
+cosign()
+debug.sethook(function () end, "l")
+assert_eq(m.count(1, 2), 2, "coverage runs with a hook")
+debug.sethook()
+assert_eq(debug.gethook(), nil, "coverage is not a hook")
+m = nil
+collectgarbage()
+local report = profiler.coveragestop()
+local funcs, lines = parsecov(report, modfile)
+assert_eq(funcs ~= nil, true, "coverage reports the loaded file")
+assert_eq(funcs["main chunk"] and funcs["function <2>"] and
+          funcs["function <11>"], true, "functions that ran are hit")
+assert_eq(funcs["function <8>"], false, "functions that did not run")
+assert_eq(lines[3] and lines[4] and not lines[6] and not lines[9], true,
+          "lines that ran are hit")
+assert_eq(profiler.coverage(), report, "results kept after stop")
+m = dofile(modfile)
+m.unused()
+funcs = parsecov(profiler.coverage(), modfile)
+assert_eq(funcs["function <8>"], false, "nothing recorded while stopped")
+profiler.coveragestart()
+funcs = parsecov(profiler.coverage(), modfile)
+assert_eq(funcs["main chunk"] or funcs["function <2>"], false,
+          "start discards previous results")
+profiler.coveragestop()
+if interp then
+    local out = os.tmpname()
+    local cmd = string.format("%s -C %s %s", interp, out, modfile)
+    assert_eq(os.execute(cmd), true, "interpreter runs with -C")
+    local f = assert(io.open(out))
+    funcs, lines = parsecov(f:read("a"), modfile)
+    f:close()
+    os.remove(out)
+    assert_eq(funcs and funcs["main chunk"] and not funcs["function <2>"],
+              true, "-C writes the coverage of the run")
+end
+os.remove(modfile)
+
+print("\n=== All Profiler Tests Passed ===")
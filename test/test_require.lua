@@ -0,0 +1,154 @@
+-- test_require.lua
+-- A suite to verify the path cache and the bundles of 'require'
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+local function fails(f, msg)
+    local ok, err = pcall(f)
+    return not ok and string.find(err, msg, 1, true) ~= nil
+end
+
+local base = os.tmpname()
+local created = {}
+
+local function createfile(name, contents)
+    local f = assert(io.open(name, "wb"))
+    f:write(contents)
+    f:close()
+    created[#created + 1] = name
+end
+
+local function module(name, contents)
+    createfile(base .. "_" .. name .. ".lua", contents)
+end
+
+local oldpath, oldcpath = package.path, package.cpath
+package.path = base .. "_?.lua"
+package.cpath = ""
+
+print("=== Starting Require Tests ===\n")
+
+-- 1. Path cache
+print("-- 1. Path cache")
+assert_eq(type(package.pathcache), "table", "cache exists by default")
+assert_eq(pcall(require, "late"), false, "missing module")
+assert_eq(package.pathcache[base .. "_late.lua"], false,
+          "cache remembers the file not found")
+module("late", "return 'late'")
+assert_eq(pcall(require, "late"), false, "cached file is not tried again")
+assert_eq(package.searchpath("late", package.path), base .. "_late.lua",
+          "searchpath does not use the cache")
+package.pathcache = {}
+assert_eq(require("late"), "late", "a new cache tries the file again")
+package.pathcache = nil
+assert_eq(pcall(require, "nocache"), false, "search without cache")
+
+-- 2. Bundles
+print("\n-- 2. Bundles")
+module("a", "return {name = ..., data = select(2, ...)}")
+module("b", "local a = require 'a'; return {a = a}")
+module("bad", "return 1 +")
+createfile(base .. ".bdl", "")
+local bundle = base .. ".bdl"
+assert_eq(fails(function () package.makebundle(bundle, {"none"}) end,
+                "module 'none' not found"), true, "missing module")
+assert_eq(fails(function () package.makebundle(bundle, {"bad"}) end,
+                "unexpected symbol"), true, "module with errors")
+assert_eq(package.makebundle(bundle, {"a", "b"}), true, "bundle written")
+package.path = base .. "_nothing_?.lua"   -- modules only in the bundle
+package.bundle = bundle
+package.loaded.a = nil
+local b, data = require("b")
+assert_eq(data, bundle, "loader data is the bundle name")
+assert_eq(b.a.name, "a", "module name given to the loader")
+assert_eq(b.a.data, bundle, "modules required from a bundle module")
+assert_eq(fails(function () require("c") end,
+                "no module 'c' in bundle"), true, "module not in the bundle")
+
+assert_eq(package.makebundle(bundle .. "s", {}), true, "empty bundle written")
+created[#created + 1] = bundle .. "s"
+package.bundle = bundle .. "s"
+assert_eq(fails(function () require("c2") end,
+                "no module 'c2' in bundle"), true, "empty bundle")
+
+createfile(base .. ".bad", "\27Bdl\5\0\0\0xxxxxxxx")
+package.bundle = base .. ".bad"
+assert_eq(fails(function () require("c3") end, "malformed bundle"), true,
+          "malformed bundle")
+package.bundle = base .. ".none"
+assert_eq(fails(function () require("c4") end, "cannot open bundle"), true,
+          "missing bundle")
+package.bundle = {}
+assert_eq(fails(function () require("c5") end, "must be a string"), true,
+          "bundle name must be a string")
+
+package.bundle = nil
+
+-- 3. Bytecode cache
+print("\n-- 3. Bytecode cache")
+package.path = base .. "_?.lua"
+local cachedir = base .. "_cache"
+local function entry (name)   -- name of the cache entry for file 'name'
+  local h = 0xcbf29ce484222325
+  for i = 1, #name do h = (h ~ name:byte(i)) * 0x100000001b3 end
+  return string.format("%s/%016x.luac", cachedir, h)
+end
+local function exists (name)
+  local f = io.open(name, "rb")
+  if f then f:close() end
+  return f ~= nil
+end
+local cname = base .. "_cached.lua"
+package.cachedir = cachedir
+module("cached", "return {v = 1, line = debug.getinfo(1, 'l').currentline}")
+assert_eq(require("cached").v, 1, "module loaded")
+assert_eq(exists(entry(cname)), true, "entry written (and directory made)")
+package.loaded.cached = nil
+local m = require("cached")
+assert_eq(m.v == 1 and m.line == 1, true, "module loaded from the cache")
+assert_eq(loadfile(cname)().v, 1, "loadfile uses the cache")
+assert_eq(fails(function () assert(loadfile(cname, "b")) end,
+                "attempt to load a text chunk"), true,
+          "cache is not used for binary-only loads")
+os.remove(entry(cname))
+assert_eq(loadfile(cname, "t")().v, 1, "text-only load")
+assert_eq(exists(entry(cname)), false, "cache is not used for text-only loads")
+assert_eq(loadfile(cname, "bt")().v, 1, "load with both modes")
+assert_eq(exists(entry(cname)), true, "cache is used with both modes")
+module("cached", "return {v = 3, line = debug.getinfo(1, 'l').currentline}")
+package.loaded.cached = nil
+assert_eq(require("cached").v, 3, "same size, changed in the same second")
+module("cached", "return {v = 22}")
+package.loaded.cached = nil
+assert_eq(require("cached").v, 22, "changed file is compiled again")
+createfile(entry(cname), "\27Lch garbage")
+package.loaded.cached = nil
+assert_eq(require("cached").v, 22, "bad entry is a miss")
+local f = assert(io.open(entry(cname), "rb"))
+assert_eq(f:read(4), "\27Lch", "bad entry written again")
+f:close()
+module("badcache", "return 1 +")
+assert_eq(pcall(require, "badcache"), false, "module with errors")
+assert_eq(exists(entry(base .. "_badcache.lua")), false,
+          "module with errors is not cached")
+package.cachedir = nil
+package.loaded.cached = nil
+assert_eq(require("cached").v, 22, "no cache")
+os.remove(entry(cname))
+os.remove(cachedir)
+
+package.path, package.cpath = oldpath, oldcpath
+package.pathcache = {}
+for _, name in ipairs(created) do os.remove(name) end
+os.remove(base)
+
+print("\n=== All Require Tests Passed ===")
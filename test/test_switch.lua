@@ -0,0 +1,158 @@
+-- test_switch.lua
+-- A suite to verify the 'switch' statement
+
+local function assert_eq(actual, expected, name)
+    if actual == expected then
+        print(string.format("[PASS] %s", name))
+    else
+        print(string.format("[FAIL] %s", name))
+        print(string.format("       Expected: '%s'", tostring(expected)))
+        print(string.format("       Actual:   '%s'", tostring(actual)))
+        os.exit(1)
+    end
+end
+
+print("=== Starting Switch Tests ===\n")
+
+-- 1. Basic Dispatch
+print("-- 1. Basic Dispatch")
+local function kind(x)
+    switch x do
+        case 1 then return "one"
+        case 2, 3 then return "two or three"
+        case "a" then return "A"
+        case true then return "T"
+        case 2.5 then return "2.5"
+        else return "other"
+    end
+end
+assert_eq(kind(1), "one", "Integer case")
+assert_eq(kind(2), "two or three", "First of several values")
+assert_eq(kind(3), "two or three", "Second of several values")
+assert_eq(kind(3.0), "two or three", "Float with an integer value")
+assert_eq(kind("a"), "A", "String case")
+assert_eq(kind(true), "T", "Boolean case")
+assert_eq(kind(2.5), "2.5", "Float case")
+assert_eq(kind(4), "other", "Else branch")
+assert_eq(kind(false), "other", "False is not true")
+assert_eq(kind(nil), "other", "Nil goes to else")
+assert_eq(kind({}), "other", "Table goes to else")
+
+local function noelse(x)
+    local r = "none"
+    switch x do
+        case 1 then r = "one"
+    end
+    return r
+end
+assert_eq(noelse(1), "one", "Switch without else")
+assert_eq(noelse(2), "none", "No match and no else")
+
+local ran = false
+switch 5 do end
+switch 5 do else ran = true end
+assert_eq(ran, true, "Switch with only an else")
+
+-- 2. Blocks
+print("-- 2. Blocks")
+local t = {}
+for i = 1, 5 do
+    switch i do
+        case 1 then t[#t + 1] = "a"
+        case 2 then
+            local y = i * 10
+            t[#t + 1] = y
+        case 4 then break
+        else t[#t + 1] = "?"
+    end
+end
+assert_eq(table.concat(t, ","), "a,20,?", "Locals in cases and break")
+
+local fs = {}
+for i = 1, 3 do
+    switch i % 2 do
+        case 0 then
+            local v = i
+            fs[#fs + 1] = function () return v end
+        else
+            local v = -i
+            fs[#fs + 1] = function () return v end
+    end
+end
+assert_eq(fs[1]() + fs[2]() + fs[3](), -2, "Closures over case locals")
+
+local A <const> = 10
+local B <const> = "b"
+local function consts(x)
+    switch x do
+        case A then return "A"
+        case B then return "B"
+    end
+    return "-"
+end
+assert_eq(consts(10), "A", "Constant local as case value")
+assert_eq(consts("b"), "B", "String constant local as case value")
+assert_eq(consts(11), "-", "Constant locals: no match")
+
+local n = 0
+switch n + 1 do
+    case 1 then n = 100
+end
+assert_eq(n, 100, "Switch over an expression")
+
+-- 3. Large Tables
+print("-- 3. Large Tables")
+local src = {"local x = ...\nswitch x do\n"}
+for i = 1, 200 do
+    src[#src + 1] = string.format("case %d then return %d\n", i, i * 2)
+end
+src[#src + 1] = "else return -1\nend\n"
+local big = assert(load(table.concat(src)))
+local ok = true
+for i = 1, 200 do
+    if big(i) ~= i * 2 then ok = false end
+end
+assert_eq(ok, true, "All of 200 cases")
+assert_eq(big(201), -1, "Outside of 200 cases")
+
+-- 4. Compatibility
+print("-- 4. Compatibility")
+local switch = 1
+switch = switch + 1
+local case = {x = 3}
+case.y = 4
+local function f(...) return select("#", ...) end
+local r = {switch, case.x + case.y, f(switch)}
+assert_eq(r[1], 2, "'switch' as a variable")
+assert_eq(r[2], 7, "'case' as a table")
+assert_eq(r[3], 1, "'switch' as an argument")
+assert_eq(load("local case = 1; return case")(), 1, "'case' as a local")
+
+-- 5. Errors
+print("-- 5. Errors")
+local function perr(s)
+    local _, msg = load(s)
+    return msg or ""
+end
+assert_eq(perr("switch 1 do case 1 then case 1 then end"):find("duplicate case") ~= nil,
+          true, "Duplicate case value")
+assert_eq(perr("switch 1 do case 1.0, 1 then end"):find("duplicate case") ~= nil,
+          true, "Duplicate case value (float and integer)")
+assert_eq(perr("local y; switch 1 do case y then end"):find("must be a constant") ~= nil,
+          true, "Case value is not a constant")
+assert_eq(perr("switch 1 do case nil then end"):find("must be a constant") ~= nil,
+          true, "Nil case value")
+assert_eq(perr("switch 1 do\ncase 1 then"):find("to close 'switch'") ~= nil,
+          true, "Missing 'end'")
+
+-- 6. Binary Chunks
+print("-- 6. Binary Chunks")
+for _, strip in ipairs{false, true} do
+    local g = load(string.dump(kind, strip))
+    local res = {}
+    for _, v in ipairs{1, 3, "a", true, 2.5, 7} do res[#res + 1] = g(v) end
+    assert_eq(table.concat(res, ","), "one,two or three,A,T,2.5,other",
+              "Dumped switch" .. (strip and " (stripped)" or ""))
+end
+
+print("\n=== All Switch Tests Passed ===")